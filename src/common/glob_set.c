@@ -0,0 +1,542 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Multi-pattern fnmatch().
+ *
+ * Each pattern is split into its literal parts (sequences of characters
+ * out of '*', '?' and bracket expressions). Any string matched by the
+ * pattern contains all these parts, so they make a safe pre-filter.
+ * The literal parts of all patterns are stored into an Aho-Corasick
+ * automaton, turned into a DFA whose input alphabet is reduced to the
+ * characters that appear in literals. Matching a string is a single walk
+ * of the DFA, then a fnmatch() call for the patterns whose literal parts
+ * were all found.
+ *
+ * Literals are lower-cased, and so is the input string: this allows mixing
+ * case-sensitive and case-insensitive patterns in the same automaton (the
+ * pre-filter is just less selective for case-sensitive patterns).
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "glob_set.h"
+#include "Memory.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+
+/* Only the first literals of a pattern are used for pre-filtering
+ * (it remains safe as they are all required). */
+#define MAX_PATTERN_LITS    32
+/* shorter literals are not selective */
+#define MIN_LIT_LEN         2
+
+struct glob_pattern {
+    char       *pattern;
+    int         flags;
+    /** mask of the literal parts, once they are all found */
+    uint32_t    lit_mask;
+};
+
+/** a literal part of a pattern */
+struct glob_lit {
+    uint32_t    pattern;
+    uint32_t    lit_bit;
+};
+
+struct glob_set {
+    struct glob_pattern *patterns;
+    unsigned int    count;
+    unsigned int    alloc;
+
+    /* DFA */
+    uint8_t         char_class[256];    /**< input character -> class */
+    unsigned int    class_count;
+    unsigned int    state_count;
+    uint32_t       *delta;  /**< state_count * class_count transitions */
+    /** literals found when reaching a state:
+     * found[found_idx[s]] to found[found_idx[s+1] - 1] */
+    uint32_t       *found_idx;
+    struct glob_lit *found;
+
+    /** patterns with no literal part */
+    uint32_t       *no_lit;
+    unsigned int    no_lit_count;
+};
+
+glob_set_t *glob_set_new(void)
+{
+    return MemCalloc(1, sizeof(glob_set_t));
+}
+
+int glob_set_add(glob_set_t *set, const char *pattern, int flags)
+{
+    unsigned int i;
+
+    for (i = 0; i < set->count; i++)
+        if (set->patterns[i].flags == flags
+            && !strcmp(set->patterns[i].pattern, pattern))
+            return i;
+
+    if (set->count == set->alloc) {
+        struct glob_pattern *p;
+        unsigned int alloc = set->alloc ? 2 * set->alloc : 16;
+
+        p = MemRealloc(set->patterns, alloc * sizeof(*p));
+        if (p == NULL)
+            return -ENOMEM;
+        set->patterns = p;
+        set->alloc = alloc;
+    }
+
+    set->patterns[set->count].pattern = strdup(pattern);
+    if (set->patterns[set->count].pattern == NULL)
+        return -ENOMEM;
+    set->patterns[set->count].flags = flags;
+    set->patterns[set->count].lit_mask = 0;
+
+    return set->count++;
+}
+
+unsigned int glob_set_count(const glob_set_t *set)
+{
+    return set->count;
+}
+
+/** end of the bracket expression starting at p, NULL if it is malformed */
+static const char *bracket_end(const char *p, int flags)
+{
+    const char *q = p + 1;
+
+    if (*q == '!' || *q == '^')
+        q++;
+    /* a leading ']' is part of the set */
+    if (*q == ']')
+        q++;
+
+    while (*q != '\0' && *q != ']') {
+        if (*q == '[' && (q[1] == ':' || q[1] == '=' || q[1] == '.')) {
+            /* [:class:], [=equiv=], [.coll.] */
+            const char end[3] = { q[1], ']', '\0' };
+            const char *r = strstr(q + 2, end);
+
+            if (r == NULL)
+                return NULL;
+            q = r + 2;
+        } else if (*q == '\\' && !(flags & FNM_NOESCAPE) && q[1] != '\0')
+            q += 2;
+        else
+            q++;
+    }
+    return (*q == ']') ? q + 1 : NULL;
+}
+
+/**
+ * Split a pattern into its literal parts (lower-cased).
+ * @param[out] lits  allocated literals, to be freed by the caller.
+ * @return the number of literals, or -1 if the pattern can't be split
+ *         (it must then be tested against all strings).
+ */
+static int pattern_literals(const char *pattern, int flags, char **lits)
+{
+    char *run;
+    int len = 0, n = 0;
+    const char *p = pattern;
+
+    run = MemAlloc(strlen(pattern) + 1);
+    if (run == NULL)
+        return -1;
+
+#define FLUSH_RUN() do { \
+        if (len >= MIN_LIT_LEN && n < MAX_PATTERN_LITS) { \
+            run[len] = '\0'; \
+            lits[n] = strdup(run); \
+            if (lits[n] != NULL) \
+                n++; \
+        } \
+        len = 0; \
+    } while (0)
+
+    while (*p != '\0') {
+        unsigned char c = *p;
+
+        if (c == '*' || c == '?') {
+            FLUSH_RUN();
+            p++;
+            continue;
+        }
+        if (c == '[') {
+            const char *end = bracket_end(p, flags);
+
+            if (end == NULL) {
+                /* fnmatch() then considers '[' as a regular character:
+                 * don't try to guess */
+                while (n > 0)
+                    free(lits[--n]);
+                MemFree(run);
+                return -1;
+            }
+            FLUSH_RUN();
+            p = end;
+            continue;
+        }
+        if (c == '\\' && !(flags & FNM_NOESCAPE)) {
+            if (p[1] == '\0')
+                break;
+            p++;
+            c = *p;
+        }
+        /* case folding of multibyte characters depends on the locale */
+        if (c >= 0x80 && (flags & FNM_CASEFOLD)) {
+            FLUSH_RUN();
+            p++;
+            continue;
+        }
+        /* only ASCII letters are lower-cased, like the input string */
+        run[len++] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+        p++;
+    }
+    FLUSH_RUN();
+#undef FLUSH_RUN
+
+    MemFree(run);
+    return n;
+}
+
+/** temporary trie, before it is turned into a DFA */
+struct trie {
+    uint32_t       *next;   /**< state_count * class_count (0: none) */
+    unsigned int    state_count;
+    unsigned int    state_alloc;
+    unsigned int    class_count;
+    /* literals ending at each state */
+    struct glob_lit **lits;
+    unsigned int   *lit_count;
+};
+
+static int trie_new_state(struct trie *t)
+{
+    if (t->state_count == t->state_alloc) {
+        unsigned int alloc = t->state_alloc ? 2 * t->state_alloc : 256;
+        uint32_t *next;
+        struct glob_lit **lits;
+        unsigned int *lit_count;
+
+        next = MemRealloc(t->next, (size_t)alloc * t->class_count
+                          * sizeof(uint32_t));
+        if (next == NULL)
+            return -ENOMEM;
+        t->next = next;
+        lits = MemRealloc(t->lits, alloc * sizeof(*lits));
+        if (lits == NULL)
+            return -ENOMEM;
+        t->lits = lits;
+        lit_count = MemRealloc(t->lit_count, alloc * sizeof(*lit_count));
+        if (lit_count == NULL)
+            return -ENOMEM;
+        t->lit_count = lit_count;
+        t->state_alloc = alloc;
+    }
+    memset(t->next + (size_t)t->state_count * t->class_count, 0,
+           t->class_count * sizeof(uint32_t));
+    t->lits[t->state_count] = NULL;
+    t->lit_count[t->state_count] = 0;
+
+    return t->state_count++;
+}
+
+static int state_add_lit(struct trie *t, unsigned int s, struct glob_lit lit)
+{
+    struct glob_lit *l;
+
+    l = MemRealloc(t->lits[s], (t->lit_count[s] + 1) * sizeof(*l));
+    if (l == NULL)
+        return -ENOMEM;
+    l[t->lit_count[s]] = lit;
+    t->lits[s] = l;
+    t->lit_count[s]++;
+    return 0;
+}
+
+static int trie_insert(glob_set_t *set, struct trie *t, const char *lit,
+                       struct glob_lit id)
+{
+    unsigned int s = 0;
+    const unsigned char *c;
+
+    for (c = (const unsigned char *)lit; *c != '\0'; c++) {
+        uint32_t *next = &t->next[(size_t)s * t->class_count
+                                  + set->char_class[*c]];
+        if (*next == 0) {
+            int n = trie_new_state(t);
+
+            if (n < 0)
+                return n;
+            /* t->next may have moved */
+            next = &t->next[(size_t)s * t->class_count + set->char_class[*c]];
+            *next = n;
+        }
+        s = *next;
+    }
+    return state_add_lit(t, s, id);
+}
+
+static void trie_free(struct trie *t)
+{
+    unsigned int i;
+
+    for (i = 0; i < t->state_count; i++)
+        MemFree(t->lits[i]);
+    MemFree(t->lits);
+    MemFree(t->lit_count);
+    MemFree(t->next);
+}
+
+/** Turn the trie into a DFA: complete missing transitions with the
+ * transitions of the failure state, and merge the literals found in
+ * failure states (breadth-first, so the failure states are complete). */
+static int trie2dfa(glob_set_t *set, struct trie *t)
+{
+    unsigned int *queue;
+    unsigned int *fail;
+    unsigned int head = 0, tail = 0, s, c, i;
+    unsigned int nclass = t->class_count;
+    size_t total = 0;
+    int rc = 0;
+
+    queue = MemAlloc(t->state_count * sizeof(*queue));
+    fail = MemCalloc(t->state_count, sizeof(*fail));
+    if (queue == NULL || fail == NULL) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    queue[tail++] = 0;
+    while (head < tail) {
+        s = queue[head++];
+
+        for (c = 0; c < nclass; c++) {
+            uint32_t *next = &t->next[(size_t)s * nclass + c];
+
+            if (*next != 0 && c != 0) {
+                unsigned int child = *next;
+                unsigned int f = (s == 0) ? 0 :
+                    t->next[(size_t)fail[s] * nclass + c];
+
+                fail[child] = f;
+                for (i = 0; i < t->lit_count[f]; i++) {
+                    rc = state_add_lit(t, child, t->lits[f][i]);
+                    if (rc)
+                        goto out;
+                }
+                queue[tail++] = child;
+            } else {
+                *next = (s == 0) ? 0 : t->next[(size_t)fail[s] * nclass + c];
+            }
+        }
+    }
+
+    /* flatten found literals */
+    for (s = 0; s < t->state_count; s++)
+        total += t->lit_count[s];
+
+    set->found_idx = MemAlloc((t->state_count + 1) * sizeof(uint32_t));
+    set->found = MemAlloc((total ? total : 1) * sizeof(struct glob_lit));
+    if (set->found_idx == NULL || set->found == NULL) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    total = 0;
+    for (s = 0; s < t->state_count; s++) {
+        set->found_idx[s] = total;
+        if (t->lit_count[s] > 0)
+            memcpy(set->found + total, t->lits[s],
+                   t->lit_count[s] * sizeof(struct glob_lit));
+        total += t->lit_count[s];
+    }
+    set->found_idx[t->state_count] = total;
+
+    /* the DFA takes over the transition table */
+    set->delta = t->next;
+    t->next = NULL;
+    set->state_count = t->state_count;
+
+out:
+    MemFree(queue);
+    MemFree(fail);
+    return rc;
+}
+
+int glob_set_compile(glob_set_t *set)
+{
+    struct trie t = { 0 };
+    char ***lits;
+    int *lit_count;
+    unsigned int i, c;
+    int j, rc = 0;
+
+    lits = MemCalloc(set->count ? set->count : 1, sizeof(char **));
+    lit_count = MemCalloc(set->count ? set->count : 1, sizeof(int));
+    set->no_lit = MemAlloc((set->count ? set->count : 1) * sizeof(uint32_t));
+    if (lits == NULL || lit_count == NULL || set->no_lit == NULL) {
+        rc = ENOMEM;
+        goto out;
+    }
+
+    /* class 0 is for characters that appear in no literal */
+    memset(set->char_class, 0, sizeof(set->char_class));
+    set->class_count = 1;
+
+    for (i = 0; i < set->count; i++) {
+        lits[i] = MemAlloc(MAX_PATTERN_LITS * sizeof(char *));
+        if (lits[i] == NULL) {
+            rc = ENOMEM;
+            goto out;
+        }
+        lit_count[i] = pattern_literals(set->patterns[i].pattern,
+                                        set->patterns[i].flags, lits[i]);
+        if (lit_count[i] <= 0) {
+            set->no_lit[set->no_lit_count++] = i;
+            continue;
+        }
+        set->patterns[i].lit_mask = (lit_count[i] == 32) ? UINT32_MAX
+                                    : (1U << lit_count[i]) - 1;
+
+        for (j = 0; j < lit_count[i]; j++) {
+            const unsigned char *p;
+
+            for (p = (const unsigned char *)lits[i][j]; *p != '\0'; p++)
+                if (set->char_class[*p] == 0)
+                    set->char_class[*p] = set->class_count++;
+        }
+    }
+    /* input is lower-cased: upper case letters share the same class */
+    for (c = 'A'; c <= 'Z'; c++)
+        set->char_class[c] = set->char_class[c - 'A' + 'a'];
+
+    t.class_count = set->class_count;
+    if (trie_new_state(&t) < 0) {
+        rc = ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < set->count; i++) {
+        for (j = 0; j < lit_count[i]; j++) {
+            struct glob_lit id = {.pattern = i,.lit_bit = j };
+
+            if (trie_insert(set, &t, lits[i][j], id)) {
+                rc = ENOMEM;
+                goto out;
+            }
+        }
+    }
+
+    if (trie2dfa(set, &t))
+        rc = ENOMEM;
+
+out:
+    trie_free(&t);
+    if (lits != NULL) {
+        for (i = 0; i < set->count; i++) {
+            if (lits[i] == NULL)
+                continue;
+            for (j = 0; j < lit_count[i]; j++)
+                free(lits[i][j]);
+            MemFree(lits[i]);
+        }
+    }
+    MemFree(lits);
+    MemFree(lit_count);
+    return rc;
+}
+
+/* above this pattern count, the state of the literal search is allocated */
+#define STACK_PATTERNS  256
+
+void glob_set_match(const glob_set_t *set, const char *str,
+                    uint64_t *matches)
+{
+    uint32_t stack_seen[STACK_PATTERNS];
+    uint32_t *seen = stack_seen;
+    const unsigned char *c;
+    unsigned int s = 0, i;
+
+    memset(matches, 0, GLOB_SET_WORDS(set->count) * sizeof(uint64_t));
+
+    if (set->count > STACK_PATTERNS) {
+        seen = MemCalloc(set->count, sizeof(uint32_t));
+        if (seen == NULL) {
+            /* no pre-filter */
+            for (i = 0; i < set->count; i++)
+                if (!fnmatch(set->patterns[i].pattern, str,
+                             set->patterns[i].flags))
+                    matches[i / 64] |= (1ULL << (i % 64));
+            return;
+        }
+    } else {
+        memset(seen, 0, set->count * sizeof(uint32_t));
+    }
+
+    for (c = (const unsigned char *)str; *c != '\0'; c++) {
+        const struct glob_lit *l, *end;
+
+        s = set->delta[(size_t)s * set->class_count + set->char_class[*c]];
+
+        end = set->found + set->found_idx[s + 1];
+        for (l = set->found + set->found_idx[s]; l < end; l++) {
+            const struct glob_pattern *p = &set->patterns[l->pattern];
+            uint32_t prev = seen[l->pattern];
+
+            seen[l->pattern] |= (1U << l->lit_bit);
+
+            /* all literals found: now check the whole pattern */
+            if (prev != p->lit_mask && seen[l->pattern] == p->lit_mask
+                && !fnmatch(p->pattern, str, p->flags))
+                matches[l->pattern / 64] |= (1ULL << (l->pattern % 64));
+        }
+    }
+
+    for (i = 0; i < set->no_lit_count; i++) {
+        const struct glob_pattern *p = &set->patterns[set->no_lit[i]];
+
+        if (!fnmatch(p->pattern, str, p->flags))
+            matches[set->no_lit[i] / 64] |= (1ULL << (set->no_lit[i] % 64));
+    }
+
+    if (seen != stack_seen)
+        MemFree(seen);
+}
+
+void glob_set_free(glob_set_t *set)
+{
+    unsigned int i;
+
+    if (set == NULL)
+        return;
+
+    for (i = 0; i < set->count; i++)
+        free(set->patterns[i].pattern);
+    MemFree(set->patterns);
+    MemFree(set->delta);
+    MemFree(set->found_idx);
+    MemFree(set->found);
+    MemFree(set->no_lit);
+    MemFree(set);
+}
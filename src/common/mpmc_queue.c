@@ -0,0 +1,122 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Bounded lock-free MPMC queue.
+ *
+ * A producer owns the cell at 'enqueue_pos' when the cell sequence equals
+ * this position. Once filled, the cell sequence is set to position + 1,
+ * which hands it to the consumer of this position. After consumption, the
+ * sequence is set to position + capacity, so the cell is free for the
+ * producer of the next round.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "mpmc_queue.h"
+#include "Memory.h"
+
+#include <errno.h>
+
+int mpmc_queue_init(mpmc_queue_t *q, unsigned int size)
+{
+    uint64_t i, count = 2;
+
+    while (count < size)
+        count <<= 1;
+
+    q->cells = MemCalloc(count, sizeof(mpmc_cell_t));
+    if (q->cells == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < count; i++)
+        q->cells[i].seq = i;
+
+    q->mask = count - 1;
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+    __sync_synchronize();
+
+    return 0;
+}
+
+void mpmc_queue_destroy(mpmc_queue_t *q)
+{
+    MemFree(q->cells);
+    q->cells = NULL;
+}
+
+bool mpmc_queue_push(mpmc_queue_t *q, void *data)
+{
+    mpmc_cell_t *cell;
+    uint64_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        int64_t dif;
+
+        cell = &q->cells[pos & q->mask];
+        dif = (int64_t)ATOMIC_LOAD(cell->seq) - (int64_t)pos;
+
+        if (dif == 0) {
+            /* the cell is free for this position: try to take it */
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+            /* else: pos has been reloaded */
+        } else if (dif < 0) {
+            /* the cell has not been consumed since last round: full */
+            return false;
+        } else {
+            /* another producer took this position */
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->data = data;
+    ATOMIC_STORE(cell->seq, pos + 1);
+    return true;
+}
+
+bool mpmc_queue_pop(mpmc_queue_t *q, void **data)
+{
+    mpmc_cell_t *cell;
+    uint64_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        int64_t dif;
+
+        cell = &q->cells[pos & q->mask];
+        dif = (int64_t)ATOMIC_LOAD(cell->seq) - (int64_t)(pos + 1);
+
+        if (dif == 0) {
+            /* the cell is filled for this position: try to take it */
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            /* the cell has not been filled yet: empty */
+            return false;
+        } else {
+            /* another consumer took this position */
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    *data = cell->data;
+    ATOMIC_STORE(cell->seq, pos + q->mask + 1);
+    return true;
+}
@@ -14,7 +14,15 @@
 
 /**
  * Module for handling queue of items with feedback management.
- * The algorithm is based on a cyclic queue.
+ *
+ * Entries are stored in a bounded lock-free ring (see mpmc_queue.h).
+ * Threads only sleep (on a futex) when the ring is empty or full: a thread
+ * that is about to sleep first registers itself as waiting, then checks
+ * the ring again. The other side checks for waiting threads after each
+ * push/pop, so a wake-up cannot be missed.
+ *
+ * Acknowledgement counters are kept by each thread, and summed when
+ * statistics are retrieved.
  */
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -26,17 +34,130 @@
 #include "rbh_misc.h"
 
 #include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #define QUEUE_TAG "Queue"
 
-/* cyclic queue utilities */
-#define is_empty(pq) ((pq)->first_index == (pq)->last_index)
-#define is_full(pq)  ((pq)->first_index == \
-                      ((pq)->last_index + 1) % (pq)->array_size)
-#define nb_items(pq) (((pq)->last_index - (pq)->first_index) % (pq)->array_size)
+/** acknowledgement counters of a thread, for a given queue */
+struct queue_thr_stats {
+    struct queue_thr_stats *next;
+    entry_queue_t  *queue;
+    /* only modified by the owner thread */
+    unsigned int   *status_array;
+    unsigned long long *feedback_array;
+};
+
+static inline void futex_wait(int *addr, int val)
+{
+    /* spurious returns (EINTR, EAGAIN) are handled by callers */
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void futex_wake(int *addr, unsigned int nb)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, MIN2(nb, INT_MAX), NULL,
+            NULL, 0);
+}
+
+/** wake up to 'nb' threads sleeping on 'seq', if any */
+static inline void wake_waiters(int *seq, unsigned int *nb_waiting,
+                                unsigned int nb)
+{
+    /* order the previous push/pop before reading the waiter count */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ATOMIC_LOAD(*nb_waiting) == 0)
+        return;
+
+    ATOMIC_ADD(*seq, 1);
+    futex_wake(seq, nb);
+}
+
+/** update a timestamp, avoiding useless writes to a shared cache line */
+static inline void set_time(time_t *t)
+{
+    time_t now = time(NULL);
+
+    if (__atomic_load_n(t, __ATOMIC_RELAXED) != now)
+        __atomic_store_n(t, now, __ATOMIC_RELAXED);
+}
+
+/** fold the counters of an exiting thread into the queue */
+static void thr_stats_release(void *arg)
+{
+    struct queue_thr_stats *ts = arg;
+    entry_queue_t *q = ts->queue;
+    struct queue_thr_stats **curr;
+    unsigned int i;
+
+    P(q->stats_lock);
+    for (curr = &q->thr_stats; *curr != NULL; curr = &(*curr)->next) {
+        if (*curr == ts) {
+            *curr = ts->next;
+            break;
+        }
+    }
+    for (i = 0; i < q->status_count; i++)
+        q->status_array[i] += ts->status_array[i];
+    for (i = 0; i < q->feedback_count; i++)
+        q->feedback_array[i] += ts->feedback_array[i];
+    V(q->stats_lock);
+
+    MemFree(ts);
+}
+
+static struct queue_thr_stats *get_thr_stats(entry_queue_t *q)
+{
+    struct queue_thr_stats *ts = pthread_getspecific(q->thr_stats_key);
+
+    if (ts != NULL)
+        return ts;
+
+    /* counters are allocated with the structure */
+    ts = MemCalloc(1, sizeof(*ts)
+                   + q->feedback_count * sizeof(unsigned long long)
+                   + q->status_count * sizeof(unsigned int));
+    if (ts == NULL)
+        return NULL;
+
+    ts->queue = q;
+    ts->feedback_array = (unsigned long long *)(ts + 1);
+    ts->status_array = (unsigned int *)(ts->feedback_array
+                                        + q->feedback_count);
+
+    P(q->stats_lock);
+    ts->next = q->thr_stats;
+    q->thr_stats = ts;
+    V(q->stats_lock);
+
+    pthread_setspecific(q->thr_stats_key, ts);
+    return ts;
+}
+
+/** sum counters of all threads (stats_lock must be held) */
+static void sum_thr_stats(entry_queue_t *q, unsigned int *status_array,
+                          unsigned long long *feedback_array)
+{
+    struct queue_thr_stats *ts;
+    unsigned int i;
 
-#define lockq(pq) pthread_mutex_lock(&((pq)->queue_lock))
-#define unlockq(pq) pthread_mutex_unlock(&((pq)->queue_lock))
+    for (i = 0; i < q->status_count; i++)
+        status_array[i] = q->status_array[i];
+    for (i = 0; i < q->feedback_count; i++)
+        feedback_array[i] = q->feedback_array[i];
+
+    for (ts = q->thr_stats; ts != NULL; ts = ts->next) {
+        for (i = 0; i < q->status_count; i++)
+            status_array[i] += __atomic_load_n(&ts->status_array[i],
+                                               __ATOMIC_RELAXED);
+        for (i = 0; i < q->feedback_count; i++)
+            feedback_array[i] += __atomic_load_n(&ts->feedback_array[i],
+                                                 __ATOMIC_RELAXED);
+    }
+}
 
 /**
  * Initialize a queue.
@@ -52,37 +173,33 @@ int CreateQueue(entry_queue_t *p_queue, unsigned int queue_size,
     /* number of slots that can be used */
     p_queue->queue_size = queue_size;
 
-    /* array must be 1 slot larger than queue_size because 1 slot is lost
-     * in cyclic queue management */
-    p_queue->array_size = queue_size + 1;
+    rc = mpmc_queue_init(&p_queue->ring, queue_size);
+    if (rc)
+        return rc;
 
-    p_queue->first_index = 0;
-    p_queue->last_index = 0;
-
-    /* allocates array of entries and stats */
-    p_queue->queue = MemCalloc(p_queue->array_size, sizeof(void *));
-    if (p_queue->queue == NULL)
-        return ENOMEM;
+    p_queue->avail_seq = 0;
+    p_queue->free_seq = 0;
+    p_queue->nb_prod_waiting = 0;
 
     p_queue->status_count = max_status + 1;
-    p_queue->status_array = MemCalloc(max_status + 1, sizeof(unsigned int));
+    p_queue->status_array = MemCalloc(2 * (max_status + 1),
+                                      sizeof(unsigned int));
     if (p_queue->status_array == NULL)
         return ENOMEM;
+    p_queue->status_base = p_queue->status_array + max_status + 1;
 
     p_queue->feedback_count = feedback_count;
     p_queue->feedback_array =
-        MemCalloc(feedback_count, sizeof(unsigned long long));
+        MemCalloc(2 * feedback_count, sizeof(unsigned long long));
     if (p_queue->feedback_array == NULL)
         return ENOMEM;
+    p_queue->feedback_base = p_queue->feedback_array + feedback_count;
 
     /* init locks */
-    pthread_mutex_init(&p_queue->queue_lock, NULL);
-
-    rc = sem_init(&p_queue->sem_empty, 0, queue_size);
-    if (rc)
-        return rc;
+    pthread_mutex_init(&p_queue->stats_lock, NULL);
+    p_queue->thr_stats = NULL;
 
-    rc = sem_init(&p_queue->sem_full, 0, 0);
+    rc = pthread_key_create(&p_queue->thr_stats_key, thr_stats_release);
     if (rc)
         return rc;
 
@@ -100,14 +217,14 @@ int CreateQueue(entry_queue_t *p_queue, unsigned int queue_size,
  */
 void Reset_StatusCount(entry_queue_t *p_queue)
 {
-    unsigned int i;
-
-    lockq(p_queue);
-
-    for (i = 0; i < p_queue->status_count; i++)
-        p_queue->status_array[i] = 0;
-
-    unlockq(p_queue);
+    unsigned int status[p_queue->status_count];
+    unsigned long long feedback[p_queue->feedback_count];
+
+    /* counters are owned by threads: remember their current values */
+    P(p_queue->stats_lock);
+    sum_thr_stats(p_queue, status, feedback);
+    memcpy(p_queue->status_base, status, sizeof(status));
+    V(p_queue->stats_lock);
 }
 
 /**
@@ -115,6 +232,9 @@ void Reset_StatusCount(entry_queue_t *p_queue)
  */
 void Reset_Feedback(entry_queue_t *p_queue, unsigned int feedback_index)
 {
+    unsigned int status[p_queue->status_count];
+    unsigned long long feedback[p_queue->feedback_count];
+
     if (feedback_index >= p_queue->feedback_count) {
         DisplayLog(LVL_CRIT, QUEUE_TAG,
                    "Error: feedback_index overflow (feedback_index=%u, max=%u)",
@@ -122,91 +242,120 @@ void Reset_Feedback(entry_queue_t *p_queue, unsigned int feedback_index)
         return;
     }
 
-    lockq(p_queue);
-
-    p_queue->feedback_array[feedback_index] = 0;
-
-    unlockq(p_queue);
-
+    P(p_queue->stats_lock);
+    sum_thr_stats(p_queue, status, feedback);
+    p_queue->feedback_base[feedback_index] = feedback[feedback_index];
+    V(p_queue->stats_lock);
 }
 
 /**
- * Insert an entry to the queue.
+ * Insert several entries to the queue.
  * Can be blocking if the queue is full.
  */
-int Queue_Insert(entry_queue_t *p_queue, void *entry)
+int Queue_InsertBatch(entry_queue_t *p_queue, void **entries,
+                      unsigned int count)
 {
+    unsigned int i = 0;
+    unsigned int pushed = 0;
 
     if (p_queue == NULL)
         return EFAULT;
 
-    sem_wait_safe(&p_queue->sem_empty); /* wait for free places */
-
-    lockq(p_queue); /* enter into the critical section */
-
-    /* The queue should not be full */
-    if (is_full(p_queue)) {
-
-        unlockq(p_queue);
-        DisplayLog(LVL_CRIT, QUEUE_TAG,
-                   "UNEXPECTED ERROR: queue should not be full!");
-        return EFAULT;
-    } else {
-
-        /* Inserts data into the queue */
-        p_queue->queue[p_queue->last_index] = entry;
-        p_queue->last_index = (p_queue->last_index + 1) % p_queue->array_size;
-
+    while (i < count) {
+        int seq;
+
+        if (mpmc_queue_push(&p_queue->ring, entries[i])) {
+            i++;
+            pushed++;
+            continue;
+        }
+
+        /* queue is full: let consumers handle what we pushed */
+        if (pushed > 0) {
+            wake_waiters(&p_queue->avail_seq, &p_queue->nb_thr_waiting,
+                         pushed);
+            pushed = 0;
+        }
+
+        seq = ATOMIC_LOAD(p_queue->free_seq);
+        ATOMIC_ADD(p_queue->nb_prod_waiting, 1);
+        /* check again, now that consumers can see us */
+        if (mpmc_queue_push(&p_queue->ring, entries[i])) {
+            ATOMIC_SUB(p_queue->nb_prod_waiting, 1);
+            i++;
+            pushed++;
+            continue;
+        }
+        futex_wait(&p_queue->free_seq, seq);
+        ATOMIC_SUB(p_queue->nb_prod_waiting, 1);
     }
 
-    p_queue->last_submitted = time(NULL);
-
-    unlockq(p_queue);
-
-    sem_post_safe(&p_queue->sem_full);  /* increase filled places */
+    if (pushed > 0)
+        wake_waiters(&p_queue->avail_seq, &p_queue->nb_thr_waiting, pushed);
 
+    set_time(&p_queue->last_submitted);
     return 0;
+}
 
+/**
+ * Insert an entry to the queue.
+ * Can be blocking if the queue is full.
+ */
+int Queue_Insert(entry_queue_t *p_queue, void *entry)
+{
+    return Queue_InsertBatch(p_queue, &entry, 1);
 }
 
 /**
- * Get an entry from the queue.
+ * Get up to 'max' entries from the queue.
  * The call is blocking until there is an element available
  * in the queue.
  */
-int Queue_Get(entry_queue_t *p_queue, void **p_ptr)
+int Queue_GetBatch(entry_queue_t *p_queue, void **p_ptrs, unsigned int max,
+                   unsigned int *p_count)
 {
-    lockq(p_queue);
-    p_queue->nb_thr_waiting++;
-    unlockq(p_queue);
-
-    sem_wait_safe(&p_queue->sem_full);  /* wait for filled places */
-
-    lockq(p_queue); /* enters into the critical section */
+    unsigned int count = 0;
 
-    p_queue->nb_thr_waiting--;
-
-    /* The queue should not be empty */
-    if (is_empty(p_queue)) {
-
-        unlockq(p_queue);
-        DisplayLog(LVL_CRIT, QUEUE_TAG,
-                   "UNEXPECTED ERROR: queue should not be empty!");
+    if (p_queue == NULL || max == 0)
         return EFAULT;
-    } else {
-        /* retrieves data into the queue */
-        *p_ptr = p_queue->queue[p_queue->first_index];
-        p_queue->first_index = (p_queue->first_index + 1) % p_queue->array_size;
-    }
-
-    p_queue->last_unqueued = time(NULL);
 
-    unlockq(p_queue);
+    for (;;) {
+        int seq;
+
+        while (count < max && mpmc_queue_pop(&p_queue->ring, &p_ptrs[count]))
+            count++;
+        if (count > 0)
+            break;
+
+        seq = ATOMIC_LOAD(p_queue->avail_seq);
+        ATOMIC_ADD(p_queue->nb_thr_waiting, 1);
+        /* check again, now that producers can see us */
+        if (mpmc_queue_pop(&p_queue->ring, &p_ptrs[0])) {
+            ATOMIC_SUB(p_queue->nb_thr_waiting, 1);
+            count = 1;
+            continue;   /* get more entries if available */
+        }
+        futex_wait(&p_queue->avail_seq, seq);
+        ATOMIC_SUB(p_queue->nb_thr_waiting, 1);
+    }
 
-    sem_post_safe(&p_queue->sem_empty); /* increase free places */
+    wake_waiters(&p_queue->free_seq, &p_queue->nb_prod_waiting, count);
+    set_time(&p_queue->last_unqueued);
 
+    *p_count = count;
     return 0;
+}
+
+/**
+ * Get an entry from the queue.
+ * The call is blocking until there is an element available
+ * in the queue.
+ */
+int Queue_Get(entry_queue_t *p_queue, void **p_ptr)
+{
+    unsigned int count;
 
+    return Queue_GetBatch(p_queue, p_ptr, 1, &count);
 }
 
 /**
@@ -219,16 +368,24 @@ void Queue_Acknowledge(entry_queue_t *p_queue, unsigned int status,
                        unsigned long long *feedback_array,
                        unsigned int feedback_count)
 {
+    struct queue_thr_stats *ts;
     unsigned int i;
 
-    lockq(p_queue);
+    ts = get_thr_stats(p_queue);
+    if (ts == NULL) {
+        DisplayLog(LVL_CRIT, QUEUE_TAG,
+                   "ERROR: cannot allocate acknowledgement counters");
+        return;
+    }
 
+    /* counters are only written by this thread, but read by others */
     if (status >= p_queue->status_count)
         DisplayLog(LVL_CRIT, QUEUE_TAG,
                    "ERROR: status overflow (status=%u, max=%u)", status,
                    p_queue->status_count - 1);
     else
-        p_queue->status_array[status]++;
+        __atomic_store_n(&ts->status_array[status],
+                         ts->status_array[status] + 1, __ATOMIC_RELAXED);
 
     if (feedback_count > p_queue->feedback_count)
         DisplayLog(LVL_CRIT, QUEUE_TAG,
@@ -236,11 +393,11 @@ void Queue_Acknowledge(entry_queue_t *p_queue, unsigned int status,
                    feedback_count, p_queue->feedback_count);
 
     for (i = 0; i < MIN2(feedback_count, p_queue->feedback_count); i++)
-        p_queue->feedback_array[i] += feedback_array[i];
-
-    p_queue->last_ack = time(NULL);
+        __atomic_store_n(&ts->feedback_array[i],
+                         ts->feedback_array[i] + feedback_array[i],
+                         __ATOMIC_RELAXED);
 
-    unlockq(p_queue);
+    set_time(&p_queue->last_ack);
 }
 
 void RetrieveQueueStats(entry_queue_t *p_queue, unsigned int *p_nb_thr_wait,
@@ -251,26 +408,31 @@ void RetrieveQueueStats(entry_queue_t *p_queue, unsigned int *p_nb_thr_wait,
 {
     unsigned int i;
 
-    lockq(p_queue);
-
     if (p_nb_thr_wait)
-        *p_nb_thr_wait = p_queue->nb_thr_waiting;
+        *p_nb_thr_wait = ATOMIC_LOAD(p_queue->nb_thr_waiting);
     if (p_nb_items)
-        *p_nb_items = nb_items(p_queue);
+        *p_nb_items = mpmc_queue_count(&p_queue->ring);
     if (p_last_submitted)
-        *p_last_submitted = p_queue->last_submitted;
+        *p_last_submitted = ATOMIC_LOAD(p_queue->last_submitted);
     if (p_last_unqueued)
-        *p_last_unqueued = p_queue->last_unqueued;
+        *p_last_unqueued = ATOMIC_LOAD(p_queue->last_unqueued);
     if (p_last_ack)
-        *p_last_ack = p_queue->last_ack;
+        *p_last_ack = ATOMIC_LOAD(p_queue->last_ack);
 
-    if (status_array)
-        for (i = 0; i < p_queue->status_count; i++)
-            status_array[i] = p_queue->status_array[i];
+    if (status_array || feedback_array) {
+        unsigned int status[p_queue->status_count];
+        unsigned long long feedback[p_queue->feedback_count];
 
-    if (feedback_array)
-        for (i = 0; i < p_queue->feedback_count; i++)
-            feedback_array[i] = p_queue->feedback_array[i];
+        P(p_queue->stats_lock);
+        sum_thr_stats(p_queue, status, feedback);
 
-    unlockq(p_queue);
+        if (status_array)
+            for (i = 0; i < p_queue->status_count; i++)
+                status_array[i] = status[i] - p_queue->status_base[i];
+
+        if (feedback_array)
+            for (i = 0; i < p_queue->feedback_count; i++)
+                feedback_array[i] = feedback[i] - p_queue->feedback_base[i];
+        V(p_queue->stats_lock);
+    }
 }
@@ -221,6 +221,10 @@ int EntryProc_get_info_db(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
             attr_mask_unset_index(&p_op->db_attr_need, ATTR_INDEX_link);
     }
 
+    /* needed to maintain accounting when changing the DB */
+    if (diff_arg->apply != NO_APPLY)
+        acct2dbneed(p_op);
+
     if (!attr_mask_is_null(p_op->db_attr_need)) {
         p_op->db_attrs.attr_mask = p_op->db_attr_need;
         rc = ListMgr_Get(lmgr, &p_op->entry_id, &p_op->db_attrs);
@@ -806,6 +810,8 @@ int EntryProc_apply(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
             DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
                        "Error %d performing database operation: %s.", rc,
                        lmgr_err2str(rc));
+        else
+            EntryProc_AcctDelta(lmgr, p_op);
     } else if (diff_arg->db_tag) {
         /* tag the entry in the DB */
         rc = ListMgr_TagEntry(lmgr, diff_arg->db_tag, &p_op->entry_id);
@@ -956,6 +962,9 @@ int EntryProc_batch_apply(struct entry_proc_op_t **ops, int count,
         DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
                    "Error %d performing batch database operation: %s.", rc,
                    lmgr_err2str(rc));
+    else
+        for (i = 0; i < count; i++)
+            EntryProc_AcctDelta(lmgr, ops[i]);
 
     rc = EntryProcessor_AcknowledgeBatch(ops, count, -1, true);
     if (rc)
@@ -1129,6 +1138,9 @@ static int std_recover(lmgr_t *lmgr, entry_id_t *p_id, attr_set_t *p_oldattr)
                    PFID(p_id), PFID(&new_id), ATTR(&new_attrs, fullpath));
         goto clean_entry;
     }
+    /* the old entry is replaced by the new one */
+    ListMgr_AcctDelta(lmgr, p_id, p_oldattr, NULL);
+    ListMgr_AcctDelta(lmgr, &new_id, NULL, &new_attrs);
 
     return 0;
 
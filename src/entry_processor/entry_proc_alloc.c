@@ -0,0 +1,300 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Cache of pipeline operations.
+ *
+ * Operations are allocated by the scan or changelog threads and released by
+ * pipeline workers, at a high rate. Each thread keeps a small cache of free
+ * operations, and exchanges them by batches with a shared depot, so the
+ * allocator and the depot lock are rarely hit.
+ *
+ * Each operation is followed by an arena, which holds the status manager
+ * arrays of its attribute sets. The arena is reset at once when the operation
+ * is returned to the cache.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "entry_proc_alloc.h"
+#include "entry_proc_tools.h"
+#include "status_manager.h"
+#include "Memory.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include <pthread.h>
+#include <string.h>
+
+/** number of operations cached by each thread */
+#define OP_CACHE_THR_MAX    32
+/** number of operations moved at once from/to the depot */
+#define OP_CACHE_BATCH      (OP_CACHE_THR_MAX / 2)
+/** minimum number of operations kept in the depot */
+#define OP_CACHE_DEPOT_MIN  1024
+
+/** an operation and its arena */
+struct op_slab_obj {
+    entry_proc_op_t op;     /* must be first */
+    size_t          arena_used;
+    size_t          arena_size;
+    char            arena[] __attribute__ ((aligned(sizeof(void *))));
+};
+
+/** per-thread cache */
+struct op_thr_cache {
+    unsigned int        count;
+    struct op_slab_obj *objs[OP_CACHE_THR_MAX];
+    /* counters not yet reported to global stats */
+    unsigned long long  nb_get;
+    unsigned long long  nb_put;
+    unsigned long long  nb_alloc;
+};
+
+static __thread struct op_thr_cache *thr_cache = NULL;
+/* to flush the cache of exiting threads */
+static pthread_key_t thr_cache_key;
+static pthread_once_t op_cache_once = PTHREAD_ONCE_INIT;
+
+static size_t obj_size;
+static size_t arena_size;
+
+/* shared depot of free operations */
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rh_list_head depot = { &depot, &depot };
+static unsigned int depot_count = 0;
+static unsigned int depot_max;
+
+/* stats (updated under depot lock) */
+static struct op_cache_stats {
+    unsigned long long nb_get;
+    unsigned long long nb_put;
+    unsigned long long nb_depot_get;
+    unsigned long long nb_depot_put;
+    unsigned long long nb_alloc;
+    unsigned long long nb_free;
+} stats;
+
+static inline struct op_slab_obj *op2obj(entry_proc_op_t *op)
+{
+    return (struct op_slab_obj *)op;
+}
+
+/** move operations from a thread cache to the depot (depot must be locked) */
+static void depot_put(struct op_thr_cache *c, unsigned int nb)
+{
+    while (nb > 0 && c->count > 0) {
+        struct op_slab_obj *obj = c->objs[--c->count];
+
+        if (depot_count < depot_max) {
+            rh_list_add(&obj->op.list, &depot);
+            depot_count++;
+            stats.nb_depot_put++;
+        } else {
+            MemFree(obj);
+            stats.nb_free++;
+        }
+        nb--;
+    }
+}
+
+/** report thread counters to global stats (depot must be locked) */
+static void flush_thr_stats(struct op_thr_cache *c)
+{
+    stats.nb_get += c->nb_get;
+    stats.nb_put += c->nb_put;
+    stats.nb_alloc += c->nb_alloc;
+    c->nb_get = c->nb_put = c->nb_alloc = 0;
+}
+
+/** thread exit: give back cached operations */
+static void thr_cache_release(void *arg)
+{
+    struct op_thr_cache *c = arg;
+
+    P(depot_lock);
+    depot_put(c, c->count);
+    flush_thr_stats(c);
+    V(depot_lock);
+
+    MemFree(c);
+}
+
+static void op_cache_init(void)
+{
+    arena_size = 2 * (sm_inst_count * sizeof(char *)
+                      + sm_attr_count * sizeof(void *));
+    obj_size = sizeof(struct op_slab_obj) + arena_size;
+
+    /* the pipeline holds at most max_pending_operations at once, but
+     * changelog readers also keep operations in their own queue */
+    depot_max = 2 * entry_proc_conf.max_pending_operations;
+    if (depot_max < OP_CACHE_DEPOT_MIN)
+        depot_max = OP_CACHE_DEPOT_MIN;
+
+    pthread_key_create(&thr_cache_key, thr_cache_release);
+}
+
+static struct op_thr_cache *get_thr_cache(void)
+{
+    if (thr_cache != NULL)
+        return thr_cache;
+
+    thr_cache = MemCalloc(1, sizeof(*thr_cache));
+    if (thr_cache != NULL)
+        pthread_setspecific(thr_cache_key, thr_cache);
+    return thr_cache;
+}
+
+static void *op_arena_alloc(struct op_slab_obj *obj, size_t size)
+{
+    void *ptr;
+
+    /* keep pointer alignment */
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (obj->arena_used + size > obj->arena_size)
+        return NULL;
+
+    ptr = obj->arena + obj->arena_used;
+    obj->arena_used += size;
+    return ptr;
+}
+
+static inline bool in_arena(const struct op_slab_obj *obj, const void *ptr)
+{
+    return (const char *)ptr >= obj->arena
+        && (const char *)ptr < obj->arena + obj->arena_size;
+}
+
+/** allocate status manager arrays of an attribute set in the arena */
+static void attrs_attach_arena(struct op_slab_obj *obj, attr_set_t *attrs)
+{
+    if (sm_inst_count > 0)
+        attrs->attr_values.sm_status =
+            op_arena_alloc(obj, sm_inst_count * sizeof(char *));
+    if (sm_attr_count > 0)
+        attrs->attr_values.sm_info =
+            op_arena_alloc(obj, sm_attr_count * sizeof(void *));
+}
+
+/** release arena arrays of an attribute set, but not their contents */
+static void attrs_detach_arena(struct op_slab_obj *obj, attr_set_t *attrs)
+{
+    if (in_arena(obj, attrs->attr_values.sm_status))
+        attrs->attr_values.sm_status = NULL;
+
+    if (in_arena(obj, attrs->attr_values.sm_info)) {
+        unsigned int i;
+
+        for (i = 0; i < sm_attr_count; i++)
+            free(attrs->attr_values.sm_info[i]);  /* strdup -> free */
+        attrs->attr_values.sm_info = NULL;
+    }
+}
+
+entry_proc_op_t *op_cache_get(void)
+{
+    struct op_thr_cache *c;
+    struct op_slab_obj *obj = NULL;
+
+    pthread_once(&op_cache_once, op_cache_init);
+
+    c = get_thr_cache();
+    if (c != NULL) {
+        c->nb_get++;
+
+        if (c->count == 0) {
+            /* refill from the depot */
+            P(depot_lock);
+            while (c->count < OP_CACHE_BATCH && !rh_list_empty(&depot)) {
+                entry_proc_op_t *op = rh_list_first_entry(&depot,
+                                                          entry_proc_op_t,
+                                                          list);
+                rh_list_del(&op->list);
+                depot_count--;
+                stats.nb_depot_get++;
+                c->objs[c->count++] = op2obj(op);
+            }
+            flush_thr_stats(c);
+            V(depot_lock);
+        }
+
+        if (c->count > 0)
+            obj = c->objs[--c->count];
+        else
+            c->nb_alloc++;
+    }
+
+    if (obj == NULL) {
+        obj = MemAlloc(obj_size);
+        if (obj == NULL)
+            return NULL;
+    }
+
+    memset(obj, 0, obj_size);
+    obj->arena_size = arena_size;
+
+    attrs_attach_arena(obj, &obj->op.fs_attrs);
+    attrs_attach_arena(obj, &obj->op.db_attrs);
+
+    return &obj->op;
+}
+
+void op_cache_put(entry_proc_op_t *op)
+{
+    struct op_slab_obj *obj = op2obj(op);
+    struct op_thr_cache *c;
+
+    attrs_detach_arena(obj, &op->fs_attrs);
+    attrs_detach_arena(obj, &op->db_attrs);
+
+    /* free remaining allocated attributes (stripe items...) */
+    ListMgr_FreeAttrs(&op->fs_attrs);
+    ListMgr_FreeAttrs(&op->db_attrs);
+
+    c = get_thr_cache();
+    if (c == NULL) {
+        MemFree(obj);
+        return;
+    }
+
+    c->nb_put++;
+    if (c->count == OP_CACHE_THR_MAX) {
+        P(depot_lock);
+        depot_put(c, OP_CACHE_BATCH);
+        flush_thr_stats(c);
+        V(depot_lock);
+    }
+    c->objs[c->count++] = obj;
+}
+
+void op_cache_stats(void)
+{
+    struct op_cache_stats s;
+    unsigned int count;
+
+    P(depot_lock);
+    s = stats;
+    count = depot_count;
+    V(depot_lock);
+
+    /* counters of thread caches are reported by batches */
+    DisplayLog(LVL_MAJOR, "STATS",
+               "Op cache: get=%llu (hit=%.1f%%, depot=%llu, alloc=%llu), "
+               "put=%llu (depot=%llu, free=%llu), depot size=%u/%u",
+               s.nb_get,
+               s.nb_get ? 100.0 * (s.nb_get - s.nb_alloc) / s.nb_get : 0.0,
+               s.nb_depot_get, s.nb_alloc, s.nb_put, s.nb_depot_put,
+               s.nb_free, count, depot_max);
+}
@@ -0,0 +1,39 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Cache of pipeline operations, used by EntryProcessor_Get()
+ * and EntryProcessor_Release().
+ */
+#ifndef _ENTRY_PROC_ALLOC_H
+#define _ENTRY_PROC_ALLOC_H
+
+#include "entry_processor.h"
+
+/**
+ * Get a zeroed operation, from the cache of the current thread if possible.
+ * Status manager arrays of its attribute sets are already allocated
+ * in the operation arena.
+ * @return NULL on allocation failure.
+ */
+entry_proc_op_t *op_cache_get(void);
+
+/**
+ * Release attribute sets of an operation and return it to the cache.
+ */
+void op_cache_put(entry_proc_op_t *op);
+
+/** display allocation statistics */
+void op_cache_stats(void);
+
+#endif
@@ -0,0 +1,198 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Batch size management for batchable pipeline stages.
+ *
+ * When adaptive_batching is enabled, the batch size of a stage grows while
+ * the average batch latency remains under batch_latency_target, and shrinks
+ * when it exceeds it. max_batch_size is the upper bound.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "entry_proc_batch.h"
+#include "entry_proc_tools.h"
+#include "Memory.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/** batch size histogram: 1, 2-3, 4-7, ..., 1024+ */
+#define BATCH_HISTO_SIZE    11
+
+typedef struct batch_stage_t {
+    pthread_mutex_t lock;
+    unsigned int    limit;          /**< current batch size limit */
+    unsigned int    latency_avg;    /**< moving average of batch latency (us) */
+
+    /* stats for the current period */
+    struct timeval  period_start;
+    unsigned long long nb_batches;
+    unsigned long long nb_ops;
+    unsigned long long histo[BATCH_HISTO_SIZE];
+} batch_stage_t;
+
+static batch_stage_t *batch_stages = NULL;
+
+int batch_stats_init(void)
+{
+    unsigned int i;
+
+    batch_stages = MemCalloc(entry_proc_descr.stage_count,
+                             sizeof(batch_stage_t));
+    if (!batch_stages)
+        return ENOMEM;
+
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        pthread_mutex_init(&batch_stages[i].lock, NULL);
+        batch_stages[i].limit = entry_proc_conf.max_batch_size;
+        gettimeofday(&batch_stages[i].period_start, NULL);
+    }
+    return 0;
+}
+
+unsigned int batch_size_limit(unsigned int stage)
+{
+    unsigned int limit;
+
+    if (!entry_proc_conf.adaptive_batching || batch_stages == NULL)
+        return entry_proc_conf.max_batch_size;
+
+    limit = __atomic_load_n(&batch_stages[stage].limit, __ATOMIC_RELAXED);
+
+    /* max_batch_size may have been reduced by a config reload */
+    return MIN2(limit, entry_proc_conf.max_batch_size);
+}
+
+static unsigned int histo_index(unsigned int count)
+{
+    unsigned int i = 0;
+
+    while (count > 1 && i < BATCH_HISTO_SIZE - 1) {
+        count >>= 1;
+        i++;
+    }
+    return i;
+}
+
+/** grow or shrink the batch size limit (stage must be locked) */
+static void batch_adapt(batch_stage_t *st, unsigned int count)
+{
+    unsigned int target = entry_proc_conf.batch_latency_target * 1000;
+    unsigned int limit = st->limit;
+    unsigned int max = entry_proc_conf.max_batch_size;
+
+    if (st->latency_avg > target && limit > 1) {
+        limit -= MAX2(limit / 4, 1);
+    } else if (4 * st->latency_avg < 3 * target && count >= limit) {
+        /* only grow if there are enough operations to fill batches */
+        limit += MAX2(limit / 4, 1);
+    }
+    limit = MIN2(limit, max);
+
+    if (limit != st->limit) {
+        DisplayLog(LVL_FULL, ENTRYPROC_TAG, "Batch size limit: %u -> %u "
+                   "(avg latency: %.2fms)", st->limit, limit,
+                   st->latency_avg / 1000.0);
+        __atomic_store_n(&st->limit, limit, __ATOMIC_RELAXED);
+    }
+}
+
+void batch_report(unsigned int stage, unsigned int count,
+                  const struct timeval *duration)
+{
+    batch_stage_t *st;
+    unsigned int usec;
+
+    if (batch_stages == NULL)
+        return;
+
+    st = &batch_stages[stage];
+    usec = duration->tv_sec * 1000000 + duration->tv_usec;
+
+    P(st->lock);
+    st->nb_batches++;
+    st->nb_ops += count;
+    st->histo[histo_index(count)]++;
+
+    if (st->latency_avg == 0)
+        st->latency_avg = usec;
+    else
+        st->latency_avg = (7 * (unsigned long long)st->latency_avg + usec) / 8;
+
+    if (entry_proc_conf.adaptive_batching)
+        batch_adapt(st, count);
+    V(st->lock);
+}
+
+void batch_stats_dump(void)
+{
+    unsigned int i, j;
+    struct timeval now, diff;
+
+    if (batch_stages == NULL)
+        return;
+
+    gettimeofday(&now, NULL);
+
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        batch_stage_t *st = &batch_stages[i];
+        char histo[512] = "";
+        int len = 0;
+        double elapsed;
+
+        if (entry_proc_pipeline[i].test_batchable == NULL)
+            continue;
+
+        P(st->lock);
+        timersub(&now, &st->period_start, &diff);
+        elapsed = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+        for (j = 0; j < BATCH_HISTO_SIZE; j++) {
+            if (st->histo[j] == 0)
+                continue;
+            if (j == 0)
+                len += snprintf(histo + len, sizeof(histo) - len, " 1:%llu",
+                                st->histo[j]);
+            else if (j == BATCH_HISTO_SIZE - 1)
+                len += snprintf(histo + len, sizeof(histo) - len,
+                                " %u+:%llu", 1 << j, st->histo[j]);
+            else
+                len += snprintf(histo + len, sizeof(histo) - len,
+                                " %u-%u:%llu", 1 << j, (2 << j) - 1,
+                                st->histo[j]);
+        }
+
+        DisplayLog(LVL_MAJOR, "STATS", "%s: batch size limit=%u, "
+                   "avg batch size=%.1f, avg latency=%.2fms, %.1f rows/s, "
+                   "batch sizes:%s",
+                   strchr(entry_proc_pipeline[i].stage_name, '_') + 1,
+                   batch_size_limit(i), st->nb_batches ?
+                   (double)st->nb_ops / st->nb_batches : 0.0,
+                   st->latency_avg / 1000.0,
+                   elapsed > 0.0 ? st->nb_ops / elapsed : 0.0,
+                   len > 0 ? histo : " -");
+
+        /* reset stats so the displayed performance is per period */
+        st->period_start = now;
+        st->nb_batches = st->nb_ops = 0;
+        memset(st->histo, 0, sizeof(st->histo));
+        V(st->lock);
+    }
+}
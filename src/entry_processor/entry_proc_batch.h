@@ -0,0 +1,41 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Batch size management for batchable pipeline stages.
+ */
+#ifndef _ENTRY_PROC_BATCH_H
+#define _ENTRY_PROC_BATCH_H
+
+#include <sys/time.h>
+
+/** initialize batch statistics for the current pipeline */
+int batch_stats_init(void);
+
+/**
+ * Return the current maximum batch size for a stage.
+ * This is max_batch_size, or less if adaptive batching reduced it.
+ */
+unsigned int batch_size_limit(unsigned int stage);
+
+/**
+ * Account the execution of a batch, and adapt the batch size limit
+ * of the stage to the measured latency (if adaptive batching is enabled).
+ */
+void batch_report(unsigned int stage, unsigned int count,
+                  const struct timeval *duration);
+
+/** display batch statistics of batchable stages, and reset them */
+void batch_stats_dump(void);
+
+#endif
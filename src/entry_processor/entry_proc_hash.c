@@ -15,6 +15,11 @@
 /* A file ID (or Lustre FID) hash table. The hash table consists in a
  * fixed number of bucket, keyed on the ID, containing a linked list
  * of operation entries.
+ *
+ * The constraint index (op_index_*) is split into shards, each with its own
+ * lock and its own growable bucket array. Each key (entry id, or parent/name)
+ * owns the ordered chain of its pending operations, and operations point to
+ * their key, so the first operation for a key is found without scanning.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -30,6 +35,9 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
 
 /* List of prime numbers of different magnitudes, to size the hash table with a
  * suitable value according to max element count */
@@ -124,26 +132,370 @@ void id_hash_stats(struct id_hash *id_hash, const char *log_str)
 
 }
 
-void id_hash_dump(struct id_hash *id_hash, bool parent)
+
+/* === Constraint index === */
+
+/** initial number of buckets per shard */
+#define OP_INDEX_MIN_BUCKETS    16
+
+/** operation chain link used by an index */
+static inline struct rh_list_head *op_link(const struct op_index *idx,
+                                           entry_proc_op_t *op)
 {
-    unsigned int i;
+    return idx->by_name ? &op->name_hash_list : &op->id_hash_list;
+}
+
+static inline entry_proc_op_t *link2op(const struct op_index *idx,
+                                       struct rh_list_head *link)
+{
+    return idx->by_name ? rh_list_entry(link, entry_proc_op_t, name_hash_list)
+                        : rh_list_entry(link, entry_proc_op_t, id_hash_list);
+}
+
+/** key an operation is registered to in an index */
+static inline struct op_key **op_key_ptr(const struct op_index *idx,
+                                         entry_proc_op_t *op)
+{
+    return idx->by_name ? &op->name_key : &op->id_key;
+}
+
+static inline unsigned int pow2_above(unsigned int n)
+{
+    unsigned int p = 1;
+
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+static inline uint64_t op_key_hash(const struct op_index *idx,
+                                   const entry_proc_op_t *op)
+{
+    if (!idx->by_name)
+        return id_hash64(&op->entry_id);
+
+    return __hash64(id_hash64(&ATTR(&op->fs_attrs, parent_id))
+                    ^ g_str_hash(ATTR(&op->fs_attrs, name)));
+}
+
+static inline bool op_key_match(const struct op_index *idx,
+                                const struct op_key *key, uint64_t hash,
+                                const entry_proc_op_t *op)
+{
+    if (key->hash != hash)
+        return false;
+
+    if (!idx->by_name)
+        return entry_id_equal(&key->id, &op->entry_id);
+
+    return entry_id_equal(&key->id, &ATTR(&op->fs_attrs, parent_id))
+        && !strcmp(key->name, ATTR(&op->fs_attrs, name));
+}
+
+/* shards are selected by the upper bits of the hash, buckets by lower bits */
+static inline struct op_index_shard *hash2shard(const struct op_index *idx,
+                                                uint64_t hash)
+{
+    return &idx->shards[(hash >> 32) & (idx->nb_shards - 1)];
+}
+
+static inline struct op_key **hash2bucket(const struct op_index_shard *shard,
+                                          uint64_t hash)
+{
+    return &shard->buckets[hash & (shard->nb_buckets - 1)];
+}
+
+struct op_index *op_index_init(unsigned int max_count, unsigned int nb_shards,
+                               bool by_name)
+{
+    struct op_index *idx;
+    unsigned int i, nb_buckets;
+
+    nb_shards = pow2_above(nb_shards > 0 ? nb_shards : 1);
+    nb_buckets = pow2_above(max_count / nb_shards);
+    if (nb_buckets < OP_INDEX_MIN_BUCKETS)
+        nb_buckets = OP_INDEX_MIN_BUCKETS;
+
+    idx = MemAlloc(sizeof(*idx));
+    if (!idx)
+        goto err;
+
+    idx->by_name = by_name;
+    idx->nb_shards = nb_shards;
+    idx->shards = MemCalloc(nb_shards, sizeof(struct op_index_shard));
+    if (!idx->shards)
+        goto err_free;
+
+    for (i = 0; i < nb_shards; i++) {
+        struct op_index_shard *shard = &idx->shards[i];
+
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->buckets = MemCalloc(nb_buckets, sizeof(struct op_key *));
+        if (!shard->buckets)
+            goto err_free;
+        shard->nb_buckets = nb_buckets;
+    }
+
+    return idx;
+
+ err_free:
+    if (idx->shards) {
+        for (i = 0; i < nb_shards; i++)
+            MemFree(idx->shards[i].buckets);
+        MemFree(idx->shards);
+    }
+    MemFree(idx);
+ err:
+    DisplayLog(LVL_MAJOR, "Entry_Hash",
+               "Can't allocate constraint index with %u shards of %u buckets",
+               nb_shards, nb_buckets);
+    return NULL;
+}
+
+/** double the bucket count of a shard (shard must be locked) */
+static void shard_grow(struct op_index_shard *shard)
+{
+    struct op_key **new_buckets;
+    unsigned int i, new_size = shard->nb_buckets * 2;
+
+    new_buckets = MemCalloc(new_size, sizeof(struct op_key *));
+    if (!new_buckets)
+        /* keep on with longer bucket lists */
+        return;
+
+    for (i = 0; i < shard->nb_buckets; i++) {
+        struct op_key *key = shard->buckets[i];
+
+        while (key) {
+            struct op_key *next = key->next;
+            struct op_key **b = &new_buckets[key->hash & (new_size - 1)];
+
+            key->next = *b;
+            *b = key;
+            key = next;
+        }
+    }
+
+    MemFree(shard->buckets);
+    shard->buckets = new_buckets;
+    shard->nb_buckets = new_size;
+}
+
+/** get the key for an operation, or create it (shard must be locked) */
+static struct op_key *shard_get_key(const struct op_index *idx,
+                                    struct op_index_shard *shard,
+                                    uint64_t hash, entry_proc_op_t *op)
+{
+    struct op_key **bucket = hash2bucket(shard, hash);
+    struct op_key *key;
+    size_t name_len = 0;
+
+    for (key = *bucket; key != NULL; key = key->next)
+        if (op_key_match(idx, key, hash, op))
+            return key;
+
+    if (idx->by_name)
+        name_len = strlen(ATTR(&op->fs_attrs, name)) + 1;
+
+    key = MemAlloc(sizeof(*key) + name_len);
+    if (!key)
+        return NULL;
+
+    key->hash = hash;
+    if (idx->by_name) {
+        key->id = ATTR(&op->fs_attrs, parent_id);
+        memcpy(key->name, ATTR(&op->fs_attrs, name), name_len);
+    } else {
+        key->id = op->entry_id;
+    }
+    rh_list_init(&key->ops);
+    key->count = 0;
+
+    if (shard->nb_keys >= shard->nb_buckets) {
+        shard_grow(shard);
+        bucket = hash2bucket(shard, hash);
+    }
+    key->next = *bucket;
+    *bucket = key;
+    shard->nb_keys++;
+
+    return key;
+}
+
+/** remove an empty key from its shard and free it (shard must be locked) */
+static void shard_drop_key(struct op_index_shard *shard, struct op_key *key)
+{
+    struct op_key **p;
+
+    for (p = hash2bucket(shard, key->hash); *p != NULL; p = &(*p)->next) {
+        if (*p == key) {
+            *p = key->next;
+            shard->nb_keys--;
+            MemFree(key);
+            return;
+        }
+    }
+    RBH_BUG("Constraint key not found in its bucket");
+}
+
+int op_index_insert(struct op_index *idx, entry_proc_op_t *op,
+                    op_insert_pos_e pos)
+{
+    uint64_t hash = op_key_hash(idx, op);
+    struct op_index_shard *shard = hash2shard(idx, hash);
+    struct rh_list_head *link = op_link(idx, op);
+    struct rh_list_head *item;
+    struct op_key *key;
+
+    P(shard->lock);
+    key = shard_get_key(idx, shard, hash, op);
+    if (!key) {
+        V(shard->lock);
+        return ENOMEM;
+    }
+
+    switch (pos) {
+    case OP_INSERT_HEAD:
+        rh_list_add(link, &key->ops);
+        break;
+    case OP_INSERT_TAIL:
+        rh_list_add_tail(link, &key->ops);
+        break;
+    case OP_INSERT_SORTED:
+        /* look for the last operation that entered the pipeline before op
+         * (most of the time, the current tail) */
+        for (item = key->ops.prev; item != &key->ops; item = item->prev)
+            if (link2op(idx, item)->pipeline_seq < op->pipeline_seq)
+                break;
+        rh_list_add(link, item);
+        break;
+    }
+
+    key->count++;
+    shard->nb_ops++;
+    if (key->count > shard->max_chain)
+        shard->max_chain = key->count;
+    *op_key_ptr(idx, op) = key;
+
+    V(shard->lock);
+    return 0;
+}
+
+bool op_index_is_first(struct op_index *idx, entry_proc_op_t *op,
+                       bool set_wait)
+{
+    struct op_key *key = *op_key_ptr(idx, op);
+    struct op_index_shard *shard = hash2shard(idx, key->hash);
+    bool first;
+
+    P(shard->lock);
+    first = (key->ops.next == op_link(idx, op));
+    if (!first && set_wait)
+        /* flag it while the chain is locked, so the previous operation
+         * can't be removed in the meantime without waking it */
+        __atomic_store_n(&op->lf_state, LF_OP_WAIT_ID, __ATOMIC_SEQ_CST);
+    V(shard->lock);
+
+    return first;
+}
+
+bool op_index_has_pending(struct op_index *idx, const entry_proc_op_t *op)
+{
+    uint64_t hash = op_key_hash(idx, op);
+    struct op_index_shard *shard = hash2shard(idx, hash);
+    struct op_key *key;
+
+    P(shard->lock);
+    for (key = *hash2bucket(shard, hash); key != NULL; key = key->next)
+        if (op_key_match(idx, key, hash, op))
+            break;
+    V(shard->lock);
+
+    /* keys are freed as soon as their chain is empty */
+    return key != NULL;
+}
+
+int op_index_remove(struct op_index *idx, entry_proc_op_t *op,
+                    entry_proc_op_t **woken)
+{
+    struct op_key **key_ptr = op_key_ptr(idx, op);
+    struct op_key *key = *key_ptr;
+    struct op_index_shard *shard = hash2shard(idx, key->hash);
+    int nb = 0;
+
+    P(shard->lock);
+    rh_list_del(op_link(idx, op));
+    *key_ptr = NULL;
+    shard->nb_ops--;
+
+    if (--key->count == 0) {
+        shard_drop_key(shard, key);
+    } else if (woken != NULL) {
+        /* the next operation for this key can now be processed */
+        entry_proc_op_t *next = link2op(idx, key->ops.next);
+
+        if (__sync_bool_compare_and_swap(&next->lf_state, LF_OP_WAIT_ID,
+                                         LF_OP_READY)) {
+            *woken = next;
+            nb = 1;
+        }
+    }
+    V(shard->lock);
+
+    return nb;
+}
+
+void op_index_stats(struct op_index *idx, const char *log_str)
+{
+    unsigned int i, nb_ops = 0, nb_keys = 0, max_chain = 0, nb_buckets = 0;
+
+    for (i = 0; i < idx->nb_shards; i++) {
+        struct op_index_shard *shard = &idx->shards[i];
+
+        P(shard->lock);
+        nb_ops += shard->nb_ops;
+        nb_keys += shard->nb_keys;
+        nb_buckets += shard->nb_buckets;
+        if (shard->max_chain > max_chain)
+            max_chain = shard->max_chain;
+        /* longest chain over the next stats period */
+        shard->max_chain = 0;
+        V(shard->lock);
+    }
+
+    DisplayLog(LVL_MAJOR, "STATS",
+               "%s: %u (keys=%u, longest chain=%u, shards=%u, buckets=%u)",
+               log_str, nb_ops, nb_keys, max_chain, idx->nb_shards,
+               nb_buckets);
+}
+
+void op_index_dump(struct op_index *idx)
+{
+    unsigned int i, j;
+    struct op_key *key;
     entry_proc_op_t *op;
+    struct rh_list_head *item;
 
     /* dump all values */
     printf("==\n");
-    for (i = 0; i < id_hash->hash_size; i++) {
-        struct id_hash_slot *slot = &id_hash->slot[i];
-
-        P(slot->lock);
-        if (!parent) {
-            rh_list_for_each_entry(op, &slot->list, id_hash_list)
-                printf("[%u] " DFID "\n", i, PFID(&op->entry_id));
-        } else {
-            rh_list_for_each_entry(op, &slot->list, name_hash_list)
-                printf("[%u] " DFID "/%s:" DFID "\n", i,
-                       PFID(&ATTR(&op->fs_attrs, parent_id)),
-                       ATTR(&op->fs_attrs, name), PFID(&op->entry_id));
+    for (i = 0; i < idx->nb_shards; i++) {
+        struct op_index_shard *shard = &idx->shards[i];
+
+        P(shard->lock);
+        for (j = 0; j < shard->nb_buckets; j++) {
+            for (key = shard->buckets[j]; key != NULL; key = key->next) {
+                for (item = key->ops.next; item != &key->ops;
+                     item = item->next) {
+                    op = link2op(idx, item);
+                    if (!idx->by_name)
+                        printf("[%u/%u] " DFID "\n", i, j,
+                               PFID(&op->entry_id));
+                    else
+                        printf("[%u/%u] " DFID "/%s:" DFID "\n", i, j,
+                               PFID(&key->id), key->name, PFID(&op->entry_id));
+                }
+            }
         }
-        V(slot->lock);
+        V(shard->lock);
     }
 }
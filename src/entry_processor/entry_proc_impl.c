@@ -20,6 +20,9 @@
 
 #include "entry_processor.h"
 #include "entry_proc_tools.h"
+#include "entry_proc_lf.h"
+#include "entry_proc_alloc.h"
+#include "entry_proc_batch.h"
 #include "Memory.h"
 #include "rbh_logs.h"
 #include "rbh_misc.h"
@@ -137,8 +140,15 @@ static void *entry_proc_worker_thr(void *arg)
     }
 
     while ((list_op = EntryProcessor_GetNextOp(&count)) != NULL) {
-        const pipeline_stage_t *stage_info =
-            &entry_proc_pipeline[list_op[0]->pipeline_stage];
+        const unsigned int stage = list_op[0]->pipeline_stage;
+        const pipeline_stage_t *stage_info = &entry_proc_pipeline[stage];
+        struct timeval start, end, duration;
+
+        /* operations may be released by the stage function:
+         * don't access list_op[] after it */
+        if (stage_info->test_batchable != NULL)
+            gettimeofday(&start, NULL);
+
         if (count == 1) {
             /* preferably call single entry function, if it exists */
             if (stage_info->stage_function)
@@ -160,6 +170,12 @@ static void *entry_proc_worker_thr(void *arg)
         } else
             RBH_BUG("Empty operation list returned");
 
+        if (stage_info->test_batchable != NULL) {
+            gettimeofday(&end, NULL);
+            timersub(&end, &start, &duration);
+            batch_report(stage, count, &duration);
+        }
+
         MemFree(list_op);
     }
 
@@ -229,6 +245,12 @@ static int mk_bench_pipeline(unsigned int stages)
         bench_pipeline[1].stage_flags |= STAGE_FLAG_ID_CONSTRAINT;
         bench_pipeline_descr.DB_APPLY = stages - 1;
     }
+    /* like CHGLOG_CLR, last stage is sequential */
+    if (stages > 3) {
+        bench_pipeline[stages - 1].stage_flags =
+            STAGE_FLAG_SEQUENTIAL | STAGE_FLAG_SYNC;
+        bench_pipeline_descr.DB_APPLY = stages - 2;
+    }
     return 0;
 }
 #endif
@@ -264,6 +286,11 @@ int EntryProcessor_Init(pipeline_flavor_e flavor, run_flags_t flags, void *arg)
         entry_proc_descr = diff_pipeline_descr; /* full copy */
         /* arg is a diff_arg */
         break;
+    case LOAD_PIPELINE:
+        entry_proc_pipeline = load_pipeline;    /* pointer */
+        entry_proc_descr = load_pipeline_descr; /* full copy */
+        /* arg is a diff_mask */
+        break;
     default:
         DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Pipeline flavor not supported");
         return EINVAL;
@@ -319,6 +346,16 @@ int EntryProcessor_Init(pipeline_flavor_e flavor, run_flags_t flags, void *arg)
     if (id_constraint_init())
         return -1;
 
+    if (batch_stats_init())
+        return ENOMEM;
+
+    if (entry_proc_conf.pipeline_engine == PIPELINE_ENGINE_LOCKFREE) {
+        int rc = lf_pipeline_init();
+
+        if (rc)
+            return rc;
+    }
+
     /* start workers */
 
     worker_params =
@@ -359,6 +396,11 @@ void EntryProcessor_Push(entry_proc_op_t *p_entry)
     if (entry_proc_conf.max_pending_operations > 0)
         sem_wait(&pipeline_token);
 
+    if (entry_proc_conf.pipeline_engine == PIPELINE_ENGINE_LOCKFREE) {
+        lf_pipeline_push(p_entry);
+        return;
+    }
+
     /* We must always insert it in the first stage, to keep
      * the good ordering of entries.
      * Except if all stages between stage0 and insert_stage are empty
@@ -764,41 +806,50 @@ static entry_proc_op_t **next_work_avail(bool *p_empty, int *op_count)
                 pl->nb_threads++;
                 p_curr->being_processed = 1;
 
+                unsigned int batch_max = batch_size_limit(i);
                 entry_proc_op_t **listop =
-                    MemCalloc(entry_proc_conf.max_batch_size,
-                              sizeof(entry_proc_op_t *));
+                    MemCalloc(batch_max, sizeof(entry_proc_op_t *));
                 if (!listop)
                     return NULL;
                 listop[0] = p_curr;
                 *op_count = 1;
 
                 /* check if this stage is batchable */
-                if (entry_proc_conf.max_batch_size > 1
+                if (batch_max > 1
                     && entry_proc_pipeline[i].test_batchable != NULL
                     && entry_proc_pipeline[i].stage_batch_function != NULL) {
                     entry_proc_op_t *p_next;
                     attr_mask_t batch_mask = p_curr->fs_attrs.attr_mask;
+                    unsigned int skipped = 0;
 
                     rh_list_for_each_entry_after(p_next, &pl->entries, p_curr,
                                                  list) {
-                        if (*op_count >= entry_proc_conf.max_batch_size)
-                            break;
-                        else if (p_next->being_processed
-                                 || (p_next->pipeline_stage != i))
-                            /* entry is already beeing processed or is at
-                             * a different stage */
+                        if (*op_count >= batch_max)
                             break;
-
-                        if (entry_proc_pipeline[i].
-                            test_batchable(p_curr, p_next, &batch_mask)) {
+                        else if (!p_next->being_processed
+                                 && (p_next->pipeline_stage == i)
+                                 && p_next->entry_id_is_set
+                                 /* don't jump over a previous operation
+                                  * on the same id */
+                                 && (skipped == 0
+                                     || !(entry_proc_pipeline[i].stage_flags
+                                          & STAGE_FLAG_ID_CONSTRAINT)
+                                     || id_constraint_is_first_op(p_next))
+                                 && entry_proc_pipeline[i].
+                                 test_batchable(p_curr, p_next, &batch_mask)) {
                             pl->nb_unprocessed_entries--;
                             pl->nb_current_entries++;
                             p_next->being_processed = 1;
 
                             listop[*op_count] = p_next;
                             (*op_count)++;
-                        } else
-                            /* stop at first non-batchable entry */
+                        } else if (!p_next->entry_id_is_set
+                                   || ++skipped > entry_proc_conf.batch_window)
+                            /* entry is already being processed, is at
+                             * a different stage, or is not batchable:
+                             * look for batchable entries in the next
+                             * batch_window entries, but don't go over
+                             * special operations */
                             break;
                     }
                 }
@@ -840,6 +891,13 @@ static entry_proc_op_t **EntryProcessor_GetNextOp(int *count)
     int i;
     *count = 0;
 
+    if (entry_proc_conf.pipeline_engine == PIPELINE_ENGINE_LOCKFREE) {
+        list_op = lf_pipeline_get_next(count);
+        if (list_op == NULL)
+            return NULL;
+        goto set_timestamp;
+    }
+
     P(work_avail_lock);
     nb_waiting_threads++;
 
@@ -871,6 +929,7 @@ static entry_proc_op_t **EntryProcessor_GetNextOp(int *count)
 
     V(work_avail_lock);
 
+ set_timestamp:
     gettimeofday(&(list_op[0]->timestamp.start_processing_time), NULL);
     for (i = 1; i < *count; i++)
         list_op[i]->timestamp.start_processing_time =
@@ -892,11 +951,8 @@ void EntryProcessor_Release(entry_proc_op_t *p_op)
         p_op->extra_info_free_func(&p_op->extra_info);
     }
 
-    ListMgr_FreeAttrs(&p_op->fs_attrs);
-    ListMgr_FreeAttrs(&p_op->db_attrs);
-
-    /* free the memory */
-    MemFree(p_op);
+    /* free attributes and give the memory back to the cache */
+    op_cache_put(p_op);
 }
 
 /**
@@ -911,6 +967,11 @@ int EntryProcessor_AcknowledgeBatch(entry_proc_op_t **ops, unsigned int count,
     struct timeval now, diff;
     int i;
 
+    if (entry_proc_conf.pipeline_engine == PIPELINE_ENGINE_LOCKFREE) {
+        lf_pipeline_ack(ops, count, next_stage, remove);
+        goto release;
+    }
+
     gettimeofday(&now, NULL);
     timersub(&now, &ops[0]->timestamp.start_processing_time, &diff);
 
@@ -981,6 +1042,7 @@ int EntryProcessor_AcknowledgeBatch(entry_proc_op_t **ops, unsigned int count,
     }
 
     /* free entry resources if asked */
+ release:
     if (remove) {
         for (i = 0; i < count; i++) {
             /* If a limit of pending operations is specified, release a token */
@@ -1047,11 +1109,74 @@ static void print_op_stats(entry_proc_op_t *p_op, unsigned int stage,
                    entry_status_str(p_op, stage));
 }
 
-void EntryProcessor_DumpCurrentStages(void)
+/**
+ * Display stage lists statistics.
+ * @return true if there are pending operations in the pipeline.
+ */
+static bool dump_stage_lists(void)
 {
     unsigned int i;
     double tpe = 0.0;
     bool is_pending_op = false;
+
+    DisplayLog(LVL_MAJOR, "STATS", "Idle threads: %u", nb_waiting_threads);
+
+    id_constraint_stats();
+
+    DisplayLog(LVL_MAJOR, "STATS",
+               "%-18s | Wait | Curr | Done |     Total | ms/op |", "Stage");
+
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        P(pipeline[i].stage_mutex);
+
+        if (pipeline[i].total_processed != 0)
+            tpe =
+                ((1000.0 * pipeline[i].total_processing_time.tv_sec) +
+                 (1E-3 * pipeline[i].total_processing_time.tv_usec)) /
+                (double)(pipeline[i].total_processed);
+        else
+            tpe = 0.0;
+
+        if (pipeline[i].nb_batches > 0)
+            DisplayLog(LVL_MAJOR, "STATS", "%2u: %-14s |%5u | %4u | %4u | %9llu | %5.2f | %.2f%% batched (avg batch size: %.1f)",
+                       i, strchr(entry_proc_pipeline[i].stage_name, '_') + 1, /* removes STAGE_ */
+                       pipeline[i].nb_unprocessed_entries,
+                       pipeline[i].nb_current_entries,
+                       pipeline[i].nb_processed_entries,
+                       pipeline[i].total_processed, tpe,
+                       pipeline[i].total_processed ? 100.0 *
+                       (float)pipeline[i].total_batched_entries /
+                       (float)pipeline[i].total_processed : 0.0,
+                       (float)pipeline[i].total_batched_entries /
+                       (float)pipeline[i].nb_batches);
+        else
+            DisplayLog(LVL_MAJOR, "STATS", "%2u: %-14s |%5u | %4u | %4u | %9llu | %5.2f |",
+                       i, strchr(entry_proc_pipeline[i].stage_name, '_') + 1, /* removes STAGE_ */
+                       pipeline[i].nb_unprocessed_entries,
+                       pipeline[i].nb_current_entries,
+                       pipeline[i].nb_processed_entries,
+                       pipeline[i].total_processed, tpe);
+
+        /* reset stats so the displayed performance is per period */
+        memset(&pipeline[i].total_processing_time, 0,
+               sizeof(pipeline[i].total_processing_time));
+        pipeline[i].total_processed = 0;
+        pipeline[i].total_batched_entries = 0;
+        pipeline[i].nb_batches = 0;
+
+        V(pipeline[i].stage_mutex);
+
+        if (!rh_list_empty(&pipeline[i].entries))
+            is_pending_op = true;
+    }
+
+    return is_pending_op;
+}
+
+void EntryProcessor_DumpCurrentStages(void)
+{
+    unsigned int i;
+    bool is_pending_op = false;
     unsigned int nb_get, nb_ins, nb_upd, nb_rm;
 
     if (!entry_proc_pipeline)
@@ -1063,56 +1188,12 @@ void EntryProcessor_DumpCurrentStages(void)
 
         DisplayLog(LVL_MAJOR, "STATS",
                    "==== EntryProcessor Pipeline Stats ===");
-        DisplayLog(LVL_MAJOR, "STATS", "Idle threads: %u", nb_waiting_threads);
-
-        id_constraint_stats();
 
-        DisplayLog(LVL_MAJOR, "STATS",
-                   "%-18s | Wait | Curr | Done |     Total | ms/op |", "Stage");
-
-        for (i = 0; i < entry_proc_descr.stage_count; i++) {
-            P(pipeline[i].stage_mutex);
+        if (entry_proc_conf.pipeline_engine == PIPELINE_ENGINE_LOCKFREE)
+            lf_pipeline_dump_stages();
+        else
+            is_pending_op = dump_stage_lists();
 
-            if (pipeline[i].total_processed != 0)
-                tpe =
-                    ((1000.0 * pipeline[i].total_processing_time.tv_sec) +
-                     (1E-3 * pipeline[i].total_processing_time.tv_usec)) /
-                    (double)(pipeline[i].total_processed);
-            else
-                tpe = 0.0;
-
-            if (pipeline[i].nb_batches > 0)
-                DisplayLog(LVL_MAJOR, "STATS", "%2u: %-14s |%5u | %4u | %4u | %9llu | %5.2f | %.2f%% batched (avg batch size: %.1f)",
-                           i, strchr(entry_proc_pipeline[i].stage_name, '_') + 1, /* removes STAGE_ */
-                           pipeline[i].nb_unprocessed_entries,
-                           pipeline[i].nb_current_entries,
-                           pipeline[i].nb_processed_entries,
-                           pipeline[i].total_processed, tpe,
-                           pipeline[i].total_processed ? 100.0 *
-                           (float)pipeline[i].total_batched_entries /
-                           (float)pipeline[i].total_processed : 0.0,
-                           (float)pipeline[i].total_batched_entries /
-                           (float)pipeline[i].nb_batches);
-            else
-                DisplayLog(LVL_MAJOR, "STATS", "%2u: %-14s |%5u | %4u | %4u | %9llu | %5.2f |",
-                           i, strchr(entry_proc_pipeline[i].stage_name, '_') + 1, /* removes STAGE_ */
-                           pipeline[i].nb_unprocessed_entries,
-                           pipeline[i].nb_current_entries,
-                           pipeline[i].nb_processed_entries,
-                           pipeline[i].total_processed, tpe);
-
-            /* reset stats so the displayed performance is per period */
-            memset(&pipeline[i].total_processing_time, 0,
-                   sizeof(pipeline[i].total_processing_time));
-            pipeline[i].total_processed = 0;
-            pipeline[i].total_batched_entries = 0;
-            pipeline[i].nb_batches = 0;
-
-            V(pipeline[i].stage_mutex);
-
-            if (!rh_list_empty(&pipeline[i].entries))
-                is_pending_op = true;
-        }
         nb_get = nb_ins = nb_upd = nb_rm = 0;
         for (i = 0; i < entry_proc_conf.nb_thread; i++) {
             if (worker_params) {
@@ -1124,6 +1205,9 @@ void EntryProcessor_DumpCurrentStages(void)
         }
         DisplayLog(LVL_MAJOR, "STATS", "DB ops: get=%u/ins=%u/upd=%u/rm=%u",
                    nb_get, nb_ins, nb_upd, nb_rm);
+
+        op_cache_stats();
+        batch_stats_dump();
     }
 
     if (TestDisplayLevel(LVL_EVENT)) {
@@ -1159,7 +1243,7 @@ entry_proc_op_t *EntryProcessor_Get(void)
     /* allocate a new pipeline entry */
     entry_proc_op_t *p_entry;
 
-    p_entry = (entry_proc_op_t *) MemCalloc(1, sizeof(entry_proc_op_t));
+    p_entry = op_cache_get();
 
     if (!p_entry)
         return NULL;
@@ -1179,6 +1263,9 @@ static unsigned int count_nb_ops(void)
     int i;
     unsigned int total = 0;
 
+    if (entry_proc_conf.pipeline_engine == PIPELINE_ENGINE_LOCKFREE)
+        return lf_pipeline_count();
+
     for (i = 0; i < entry_proc_descr.stage_count; i++) {
         total += pipeline[i].nb_current_entries
             + pipeline[i].nb_unprocessed_entries
@@ -1211,6 +1298,8 @@ int EntryProcessor_Terminate(bool flush_ops)
 
     /* force idle thread to wake up */
     pthread_cond_broadcast(&work_avail_cond);
+    if (entry_proc_conf.pipeline_engine == PIPELINE_ENGINE_LOCKFREE)
+        lf_pipeline_terminate(terminate_flag == FLUSH);
 
     /* wait for all workers to process all pipeline entries and terminate */
     while (nb_finished_threads < entry_proc_conf.nb_thread) {
@@ -1242,6 +1331,11 @@ int EntryProcessor_Terminate(bool flush_ops)
  */
 void EntryProcessor_Unblock(int stage)
 {
+    if (entry_proc_conf.pipeline_engine == PIPELINE_ENGINE_LOCKFREE) {
+        lf_pipeline_unblock(stage);
+        return;
+    }
+
     P(pipeline[stage].stage_mutex);
 
     /* and unset the block. */
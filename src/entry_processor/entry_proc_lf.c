@@ -0,0 +1,697 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Lock-free pipeline engine.
+ *
+ * Each stage has a lock-free queue of operations ready to be processed
+ * at this stage. Workers pull operations from a stage chosen according to
+ * EntryProcessor::pipeline_scheduler, with no lock to walk the pipeline.
+ *
+ * Ordering constraints are enforced using the insertion order of operations
+ * in the pipeline (pipeline_seq) and "trackers". A tracker records which
+ * operations have passed a given point of the pipeline, and maintains a
+ * watermark: all operations with pipeline_seq < watermark have passed it.
+ * - A SEQUENTIAL stage has a 'passed' tracker: an operation can be processed
+ *   at this stage when all previous operations have passed it.
+ * - An ID_CONSTRAINT stage has a 'reached' tracker: an operation can be
+ *   processed when all previous operations have reached this stage (and
+ *   registered their id), and when it is the first operation for its id.
+ *   An operation with no id at this stage waits for all previous operations
+ *   to leave the pipeline, and holds next operations until it calls
+ *   EntryProcessor_Unblock() or leaves the stage.
+ * - A global 'removed' tracker is used for operations with no id, and
+ *   to limit the distance between the oldest and the newest operations.
+ * Operations that can't be processed yet are parked on the tracker (or in
+ * the id constraint list), and are put back in their stage queue
+ * by the thread that makes them eligible.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "entry_proc_lf.h"
+#include "entry_proc_tools.h"
+#include "entry_proc_batch.h"
+#include "mpmc_queue.h"
+#include "Memory.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <inttypes.h>
+
+/* trackers and idle threads management rely on store/load ordering */
+#define LF_LOAD(_x)         __atomic_load_n(&(_x), __ATOMIC_SEQ_CST)
+#define LF_STORE(_x, _v)    __atomic_store_n(&(_x), (_v), __ATOMIC_SEQ_CST)
+#define LF_XCHG(_x, _v)     __atomic_exchange_n(&(_x), (_v), __ATOMIC_SEQ_CST)
+
+/* marks of an operation (lf_marks): 2 bits per stage + removed */
+#define LF_MAX_STAGES           31
+#define LF_MARK_PASSED(_s)      (1ULL << (2 * (_s)))
+#define LF_MARK_REACHED(_s)     (1ULL << (2 * (_s) + 1))
+#define LF_MARK_REMOVED         (1ULL << 63)
+
+typedef struct lf_tracker {
+    uint64_t            wm;     /**< all ops with seq < wm are marked */
+    uint64_t           *marks;  /**< marks[seq % window] = seq if marked */
+    entry_proc_op_t   **parked; /**< parked[t % window]: op waiting for wm=t */
+} lf_tracker_t;
+
+typedef struct lf_stage {
+    mpmc_queue_t        ready;      /**< ops to be processed at this stage */
+    lf_tracker_t       *passed;     /**< for sequential stages */
+    lf_tracker_t       *reached;    /**< for stages with id constraint */
+    entry_proc_op_t    *barrier_op; /**< op with no id holding the stage */
+
+    unsigned int        nb_threads; /**< threads working on this stage */
+    unsigned int        nb_current; /**< ops being processed */
+    unsigned int        nb_parked;  /**< ops waiting for previous ones */
+
+    unsigned long long  total_processed;
+    unsigned long long  nb_batches;
+    unsigned long long  total_batched_entries;
+    unsigned long long  total_processing_usec;
+} lf_stage_t;
+
+static lf_stage_t *lf_stages = NULL;
+static lf_tracker_t lf_removed;
+
+/* tracker window (power of 2) */
+static uint64_t lf_window;
+static uint64_t lf_mask;
+
+static uint64_t lf_next_seq = 0;
+static unsigned int lf_nb_ops = 0;
+static unsigned int lf_rr_index = 0;
+
+static enum { LF_RUN = 0, LF_FLUSH = 1, LF_BREAK = 2 } lf_terminate = LF_RUN;
+
+/* idle workers */
+static pthread_mutex_t lf_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lf_idle_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int lf_nb_idle = 0;
+static uint64_t lf_work_seq = 0;
+
+/* producers waiting for the oldest operations to complete */
+static pthread_mutex_t lf_push_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lf_push_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int lf_push_waiters = 0;
+
+static int lf_tracker_init(lf_tracker_t *t)
+{
+    uint64_t i;
+
+    t->wm = 0;
+    t->marks = MemAlloc(lf_window * sizeof(*t->marks));
+    t->parked = MemCalloc(lf_window, sizeof(*t->parked));
+    if (t->marks == NULL || t->parked == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < lf_window; i++)
+        t->marks[i] = UINT64_MAX;
+    return 0;
+}
+
+static lf_tracker_t *lf_tracker_new(void)
+{
+    lf_tracker_t *t = MemAlloc(sizeof(*t));
+
+    if (t == NULL || lf_tracker_init(t) != 0)
+        return NULL;
+    return t;
+}
+
+/** wake up an idle worker (if any) */
+static void lf_signal_work(void)
+{
+    ATOMIC_ADD(lf_work_seq, 1);
+    if (LF_LOAD(lf_nb_idle) > 0) {
+        P(lf_idle_lock);
+        pthread_cond_signal(&lf_idle_cond);
+        V(lf_idle_lock);
+    }
+}
+
+static void lf_wake_all(void)
+{
+    ATOMIC_ADD(lf_work_seq, 1);
+    P(lf_idle_lock);
+    pthread_cond_broadcast(&lf_idle_cond);
+    V(lf_idle_lock);
+}
+
+/** add an operation to the ready queue of its current stage */
+static void lf_enqueue(entry_proc_op_t *op)
+{
+    lf_stage_t *st = &lf_stages[op->pipeline_stage];
+
+    /* Queues can hold a whole tracker window, which is more than the number
+     * of operations in the pipeline: this is not supposed to loop. */
+    while (!mpmc_queue_push(&st->ready, op))
+        sched_yield();
+
+    lf_signal_work();
+}
+
+/** an operation parked at its current stage is now eligible */
+static void lf_reschedule(entry_proc_op_t *op)
+{
+    ATOMIC_SUB(lf_stages[op->pipeline_stage].nb_parked, 1);
+    lf_enqueue(op);
+}
+
+/** move the watermark as far as possible and release parked operations */
+static void lf_tracker_advance(lf_tracker_t *t)
+{
+    for (;;) {
+        uint64_t v = LF_LOAD(t->wm);
+        entry_proc_op_t *op;
+
+        if (LF_LOAD(t->marks[v & lf_mask]) != v)
+            return;
+        if (!ATOMIC_CAS(t->wm, v, v + 1))
+            continue;
+
+        op = LF_XCHG(t->parked[(v + 1) & lf_mask], NULL);
+        if (op != NULL)
+            lf_reschedule(op);
+    }
+}
+
+/** set a mark for the operation (only once) */
+static void lf_mark(entry_proc_op_t *op, lf_tracker_t *t,
+                    unsigned long long bit)
+{
+    if (op->lf_marks & bit)
+        return;
+    op->lf_marks |= bit;
+
+    LF_STORE(t->marks[op->pipeline_seq & lf_mask], op->pipeline_seq);
+    lf_tracker_advance(t);
+}
+
+/**
+ * Check if the watermark of the tracker reached target.
+ * If not, the operation is parked and the caller must not access it anymore.
+ * @return true if the operation can go on.
+ */
+static bool lf_tracker_wait(lf_tracker_t *t, uint64_t target,
+                            entry_proc_op_t *op)
+{
+    entry_proc_op_t **slot = &t->parked[target & lf_mask];
+    lf_stage_t *st = &lf_stages[op->pipeline_stage];
+
+    /* count it first, as it can be rescheduled as soon as it is parked */
+    ATOMIC_ADD(st->nb_parked, 1);
+
+    for (;;) {
+        if (LF_LOAD(t->wm) >= target) {
+            ATOMIC_SUB(st->nb_parked, 1);
+            return true;
+        }
+        if (ATOMIC_CAS(*slot, NULL, op))
+            break;
+        /* slot still used by an operation of the previous window round */
+        sched_yield();
+    }
+
+    /* the watermark may have moved before the op was parked */
+    if (LF_LOAD(t->wm) >= target && ATOMIC_CAS(*slot, op, NULL)) {
+        ATOMIC_SUB(st->nb_parked, 1);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Set marks for an operation going to next_stage (or leaving the pipeline).
+ * Register its id if it reaches a stage with id constraint.
+ */
+static void lf_cross(entry_proc_op_t *op, unsigned int next_stage,
+                     bool removed)
+{
+    unsigned int i;
+
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        lf_stage_t *st = &lf_stages[i];
+
+        if (!removed && i >= next_stage) {
+            if (i == next_stage && st->reached != NULL
+                && op->entry_id_is_set) {
+                if (!op->id_is_referenced)
+                    id_constraint_register(op, false);
+                lf_mark(op, st->reached, LF_MARK_REACHED(i));
+            }
+            /* an op with no id marks 'reached' at Unblock() or when
+             * leaving the stage */
+            break;
+        }
+
+        if (st->passed != NULL)
+            lf_mark(op, st->passed, LF_MARK_PASSED(i));
+        if (st->reached != NULL)
+            lf_mark(op, st->reached, LF_MARK_REACHED(i));
+    }
+
+    if (removed)
+        lf_mark(op, &lf_removed, LF_MARK_REMOVED);
+}
+
+/**
+ * Check ordering constraints for an operation at the given stage.
+ * If it is not eligible, it is parked and the caller must not access it
+ * anymore.
+ */
+static bool lf_gate(entry_proc_op_t *op, unsigned int stage)
+{
+    lf_stage_t *st = &lf_stages[stage];
+    uint64_t seq = op->pipeline_seq;
+
+    if (st->reached != NULL) {
+        if (op->entry_id_is_set) {
+            /* all previous ops must have registered their id */
+            if (!lf_tracker_wait(st->reached, seq + 1, op))
+                return false;
+        } else {
+            /* no id: wait for all previous ops to complete */
+            if (!lf_tracker_wait(&lf_removed, seq, op))
+                return false;
+            LF_STORE(st->barrier_op, op);
+        }
+    }
+
+    if (st->passed != NULL && !lf_tracker_wait(st->passed, seq, op))
+        return false;
+
+    if (st->reached != NULL && op->id_is_referenced) {
+        ATOMIC_ADD(st->nb_parked, 1);
+        if (!id_constraint_wait_first(op))
+            return false;
+        ATOMIC_SUB(st->nb_parked, 1);
+    }
+
+    return true;
+}
+
+static bool lf_take_thread(unsigned int stage)
+{
+    unsigned int max = entry_proc_pipeline[stage].max_thread_count;
+
+    if (ATOMIC_ADD(lf_stages[stage].nb_threads, 1) > max && max != 0) {
+        ATOMIC_SUB(lf_stages[stage].nb_threads, 1);
+        return false;
+    }
+    return true;
+}
+
+static void lf_release_thread(unsigned int stage)
+{
+    ATOMIC_SUB(lf_stages[stage].nb_threads, 1);
+
+    /* another worker may have skipped this stage because of thread quota */
+    if (mpmc_queue_count(&lf_stages[stage].ready) > 0)
+        lf_signal_work();
+}
+
+/** get an operation (or a batch) to be processed at the given stage */
+static entry_proc_op_t **lf_try_stage(unsigned int stage, int *count)
+{
+    lf_stage_t *st = &lf_stages[stage];
+    const pipeline_stage_t *stage_info = &entry_proc_pipeline[stage];
+    entry_proc_op_t **list_op;
+    entry_proc_op_t *op = NULL;
+    unsigned int batch_max;
+    void *item;
+    int i;
+
+    while (mpmc_queue_count(&st->ready) > 0) {
+        if (!lf_take_thread(stage))
+            return NULL;
+
+        if (!mpmc_queue_pop(&st->ready, &item)) {
+            lf_release_thread(stage);
+            return NULL;
+        }
+        if (lf_gate(item, stage)) {
+            op = item;
+            break;
+        }
+        /* op is parked: try next one */
+        ATOMIC_SUB(st->nb_threads, 1);
+    }
+    if (op == NULL)
+        return NULL;
+
+    batch_max = batch_size_limit(stage);
+    list_op = MemCalloc(batch_max, sizeof(entry_proc_op_t *));
+    if (!list_op) {
+        lf_enqueue(op);
+        lf_release_thread(stage);
+        return NULL;
+    }
+    list_op[0] = op;
+    *count = 1;
+
+    /* check if this stage is batchable */
+    if (batch_max > 1
+        && stage_info->test_batchable != NULL
+        && stage_info->stage_batch_function != NULL) {
+        attr_mask_t batch_mask = op->fs_attrs.attr_mask;
+        /* re-enqueuing skipped operations changes their order */
+        unsigned int window = (stage_info->stage_flags & STAGE_FLAG_SEQUENTIAL)
+                                ? 0 : entry_proc_conf.batch_window;
+        unsigned int skipped = 0;
+
+        while (*count < batch_max && mpmc_queue_pop(&st->ready, &item)) {
+            entry_proc_op_t *next = item;
+
+            if (!lf_gate(next, stage))
+                continue;
+
+            if (!stage_info->test_batchable(op, next, &batch_mask)) {
+                /* leave non-batchable entries to another worker,
+                 * and look for batchable ones in the next
+                 * batch_window entries */
+                lf_enqueue(next);
+                if (++skipped > window)
+                    break;
+                continue;
+            }
+            list_op[*count] = next;
+            (*count)++;
+        }
+    }
+
+    for (i = 0; i < *count; i++)
+        list_op[i]->being_processed = 1;
+    ATOMIC_ADD(st->nb_current, *count);
+
+    return list_op;
+}
+
+/** return the stage with the most ready operations */
+static unsigned int lf_longest_queue(void)
+{
+    unsigned int i, best = entry_proc_descr.stage_count - 1;
+    unsigned int best_count = 0;
+
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        unsigned int c = mpmc_queue_count(&lf_stages[i].ready);
+
+        if (c > best_count) {
+            best_count = c;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static entry_proc_op_t **lf_try_get(int *count)
+{
+    unsigned int n = entry_proc_descr.stage_count;
+    unsigned int i, start = 0;
+    entry_proc_op_t **list_op;
+    lf_sched_policy_e policy = entry_proc_conf.pipeline_scheduler;
+
+    if (policy == LF_SCHED_ROUND_ROBIN) {
+        start = ATOMIC_ADD(lf_rr_index, 1);
+    } else if (policy == LF_SCHED_LONGEST_QUEUE) {
+        list_op = lf_try_stage(lf_longest_queue(), count);
+        if (list_op != NULL)
+            return list_op;
+    }
+
+    /* then check every stage (from the last to the first by default) */
+    for (i = 0; i < n; i++) {
+        unsigned int stage = (policy == LF_SCHED_ROUND_ROBIN) ?
+            (start + i) % n : n - 1 - i;
+
+        list_op = lf_try_stage(stage, count);
+        if (list_op != NULL)
+            return list_op;
+    }
+    return NULL;
+}
+
+static inline bool lf_must_stop(void)
+{
+    int term = LF_LOAD(lf_terminate);
+
+    return (term == LF_BREAK) || (term == LF_FLUSH && LF_LOAD(lf_nb_ops) == 0);
+}
+
+entry_proc_op_t **lf_pipeline_get_next(int *count)
+{
+    entry_proc_op_t **list_op;
+    uint64_t ticket;
+
+    *count = 0;
+
+    for (;;) {
+        if (LF_LOAD(lf_terminate) == LF_BREAK)
+            return NULL;
+
+        /* any change after this point will wake us up */
+        ticket = LF_LOAD(lf_work_seq);
+
+        list_op = lf_try_get(count);
+        if (list_op != NULL)
+            return list_op;
+
+        P(lf_idle_lock);
+        ATOMIC_ADD(lf_nb_idle, 1);
+        while (LF_LOAD(lf_work_seq) == ticket && !lf_must_stop())
+            pthread_cond_wait(&lf_idle_cond, &lf_idle_lock);
+        ATOMIC_SUB(lf_nb_idle, 1);
+        V(lf_idle_lock);
+
+        if (lf_must_stop())
+            return NULL;
+    }
+}
+
+int lf_pipeline_init(void)
+{
+    unsigned int i;
+    int rc;
+
+    if (entry_proc_descr.stage_count > LF_MAX_STAGES) {
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Lock-free pipeline engine "
+                   "supports %u stages at most", LF_MAX_STAGES);
+        return EINVAL;
+    }
+
+    /* the window must be larger than the number of pending operations */
+    lf_window = 1024;
+    while (lf_window < 2ULL * entry_proc_conf.max_pending_operations)
+        lf_window <<= 1;
+    lf_mask = lf_window - 1;
+
+    lf_stages = MemCalloc(entry_proc_descr.stage_count, sizeof(lf_stage_t));
+    if (lf_stages == NULL)
+        return ENOMEM;
+
+    rc = lf_tracker_init(&lf_removed);
+    if (rc)
+        return rc;
+
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        lf_stage_t *st = &lf_stages[i];
+        int flags = entry_proc_pipeline[i].stage_flags;
+
+        rc = mpmc_queue_init(&st->ready, lf_window);
+        if (rc)
+            return rc;
+
+        if (flags & STAGE_FLAG_SEQUENTIAL) {
+            st->passed = lf_tracker_new();
+            if (st->passed == NULL)
+                return ENOMEM;
+        }
+        if (flags & STAGE_FLAG_ID_CONSTRAINT) {
+            st->reached = lf_tracker_new();
+            if (st->reached == NULL)
+                return ENOMEM;
+        }
+    }
+
+    DisplayLog(LVL_VERB, ENTRYPROC_TAG, "Lock-free pipeline engine: "
+               "scheduler=%s, window=%" PRIu64,
+               lf_sched_policy2str(entry_proc_conf.pipeline_scheduler),
+               lf_window);
+    return 0;
+}
+
+void lf_pipeline_push(entry_proc_op_t *p_op)
+{
+    uint64_t seq = ATOMIC_ADD(lf_next_seq, 1) - 1;
+
+    /* don't get further than a tracker window from the oldest operation */
+    if (seq >= LF_LOAD(lf_removed.wm) + lf_window) {
+        P(lf_push_lock);
+        ATOMIC_ADD(lf_push_waiters, 1);
+        while (seq >= LF_LOAD(lf_removed.wm) + lf_window)
+            pthread_cond_wait(&lf_push_cond, &lf_push_lock);
+        ATOMIC_SUB(lf_push_waiters, 1);
+        V(lf_push_lock);
+    }
+
+    p_op->pipeline_seq = seq;
+    p_op->lf_marks = 0;
+    p_op->lf_state = LF_OP_READY;
+    ATOMIC_ADD(lf_nb_ops, 1);
+
+    lf_cross(p_op, p_op->pipeline_stage, false);
+    lf_enqueue(p_op);
+}
+
+/** remove an operation from the pipeline (before it is released) */
+static void lf_remove(entry_proc_op_t *op)
+{
+    entry_proc_op_t *woken[2];
+    int i, nb;
+
+    /* the next operations on the same id or name can now be processed */
+    nb = id_constraint_release(op, woken);
+    for (i = 0; i < nb; i++)
+        lf_reschedule(woken[i]);
+
+    lf_cross(op, 0, true);
+
+    if (LF_LOAD(lf_push_waiters) > 0) {
+        P(lf_push_lock);
+        pthread_cond_broadcast(&lf_push_cond);
+        V(lf_push_lock);
+    }
+
+    if (ATOMIC_SUB(lf_nb_ops, 1) == 0 && LF_LOAD(lf_terminate) == LF_FLUSH)
+        lf_wake_all();
+}
+
+void lf_pipeline_ack(entry_proc_op_t **ops, unsigned int count,
+                     unsigned int next_stage, bool remove)
+{
+    const unsigned int curr_stage = ops[0]->pipeline_stage;
+    lf_stage_t *st = &lf_stages[curr_stage];
+    struct timeval now, diff;
+    unsigned int i;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &ops[0]->timestamp.start_processing_time, &diff);
+
+    /* update stats */
+    ATOMIC_ADD(st->total_processing_usec,
+               diff.tv_sec * 1000000ULL + diff.tv_usec);
+    ATOMIC_ADD(st->total_processed, count);
+    if (count > 1) {
+        ATOMIC_ADD(st->nb_batches, 1);
+        ATOMIC_ADD(st->total_batched_entries, count);
+    }
+    ATOMIC_SUB(st->nb_current, count);
+
+    for (i = 0; i < count; i++) {
+        entry_proc_op_t *op = ops[i];
+
+        /* sanity check */
+        if ((!remove) && (op->pipeline_stage >= next_stage)) {
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "CRITICAL: entry is already"
+                       " in a higher pipeline stage %u >= %u !!!",
+                       op->pipeline_stage, next_stage);
+            RBH_BUG("Entry is already in a higher pipeline stage.");
+        }
+
+        op->being_processed = 0;
+        op->pipeline_stage = next_stage;
+        ATOMIC_CAS(st->barrier_op, op, NULL);
+
+        if (remove) {
+            lf_remove(op);
+        } else {
+            lf_cross(op, next_stage, false);
+            /* op must not be accessed after this call */
+            lf_enqueue(op);
+        }
+    }
+
+    lf_release_thread(curr_stage);
+}
+
+void lf_pipeline_unblock(int stage)
+{
+    lf_stage_t *st = &lf_stages[stage];
+    entry_proc_op_t *op = LF_XCHG(st->barrier_op, NULL);
+
+    /* let next operations reach this stage */
+    if (op != NULL && st->reached != NULL)
+        lf_mark(op, st->reached, LF_MARK_REACHED(stage));
+}
+
+void lf_pipeline_terminate(bool flush)
+{
+    int mode = flush ? LF_FLUSH : LF_BREAK;
+
+    if (LF_LOAD(lf_terminate) < mode)
+        LF_STORE(lf_terminate, mode);
+
+    lf_wake_all();
+}
+
+unsigned int lf_pipeline_count(void)
+{
+    return LF_LOAD(lf_nb_ops);
+}
+
+void lf_pipeline_dump_stages(void)
+{
+    unsigned int i;
+
+    DisplayLog(LVL_MAJOR, "STATS", "Pipeline engine: %s (scheduler: %s)",
+               pipeline_engine2str(entry_proc_conf.pipeline_engine),
+               lf_sched_policy2str(entry_proc_conf.pipeline_scheduler));
+    DisplayLog(LVL_MAJOR, "STATS", "Idle threads: %u", LF_LOAD(lf_nb_idle));
+
+    id_constraint_stats();
+
+    DisplayLog(LVL_MAJOR, "STATS",
+               "%-18s | Wait | Park | Curr |     Total | ms/op |", "Stage");
+
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        lf_stage_t *st = &lf_stages[i];
+        unsigned long long processed, usec, batches, batched;
+        double tpe;
+
+        /* reset stats so the displayed performance is per period */
+        processed = LF_XCHG(st->total_processed, 0);
+        usec = LF_XCHG(st->total_processing_usec, 0);
+        batches = LF_XCHG(st->nb_batches, 0);
+        batched = LF_XCHG(st->total_batched_entries, 0);
+
+        tpe = processed ? (1E-3 * usec) / (double)processed : 0.0;
+
+        if (batches > 0)
+            DisplayLog(LVL_MAJOR, "STATS", "%2u: %-14s |%5u | %4u | %4u | %9llu | %5.2f | %.2f%% batched (avg batch size: %.1f)",
+                       i, strchr(entry_proc_pipeline[i].stage_name, '_') + 1, /* removes STAGE_ */
+                       mpmc_queue_count(&st->ready), LF_LOAD(st->nb_parked),
+                       LF_LOAD(st->nb_current), processed, tpe,
+                       processed ? 100.0 * (float)batched / (float)processed
+                                 : 0.0,
+                       (float)batched / (float)batches);
+        else
+            DisplayLog(LVL_MAJOR, "STATS", "%2u: %-14s |%5u | %4u | %4u | %9llu | %5.2f |",
+                       i, strchr(entry_proc_pipeline[i].stage_name, '_') + 1, /* removes STAGE_ */
+                       mpmc_queue_count(&st->ready), LF_LOAD(st->nb_parked),
+                       LF_LOAD(st->nb_current), processed, tpe);
+    }
+}
@@ -0,0 +1,55 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Lock-free pipeline engine (EntryProcessor::pipeline_engine = lockfree).
+ * These functions are called by the EntryProcessor_* entry points
+ * when this engine is selected.
+ */
+#ifndef _ENTRY_PROC_LF_H
+#define _ENTRY_PROC_LF_H
+
+#include "entry_processor.h"
+
+/** initialize stage queues and ordering trackers */
+int lf_pipeline_init(void);
+
+/** insert an operation in the pipeline (token already taken) */
+void lf_pipeline_push(entry_proc_op_t *p_op);
+
+/**
+ * Wait for operations to be processed.
+ * @return NULL when the pipeline terminates.
+ */
+entry_proc_op_t **lf_pipeline_get_next(int *count);
+
+/**
+ * Move operations to their next stage, or remove them from the pipeline.
+ * Removed operations must then be released by the caller.
+ */
+void lf_pipeline_ack(entry_proc_op_t **ops, unsigned int count,
+                     unsigned int next_stage, bool remove);
+
+/** unblock a stage held by an operation with no id */
+void lf_pipeline_unblock(int stage);
+
+/** wake up workers so they terminate */
+void lf_pipeline_terminate(bool flush);
+
+/** number of operations in the pipeline */
+unsigned int lf_pipeline_count(void);
+
+/** display stage statistics */
+void lf_pipeline_dump_stages(void);
+
+#endif
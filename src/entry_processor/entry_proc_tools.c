@@ -28,77 +28,77 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 
 /* configuration for this module */
 entry_proc_config_t entry_proc_conf;
 int pipeline_flags = 0;
 
-/* hash table for storing references to ids */
-static struct id_hash *id_hash;
-/* hash table for storing references to parent_id/name */
-static struct id_hash *name_hash;
+/* index of pending operations by id */
+static struct op_index *id_index;
+/* index of pending operations by parent_id/name */
+static struct op_index *name_index;
 
 /** initialize id constraint manager */
 int id_constraint_init(void)
 {
-    /* get the suggested hash size for the max record count */
-    size_t size = max_count_to_hash_size(
-        entry_proc_conf.max_pending_operations);
-
-    id_hash = id_hash_init(size, true);
-    name_hash = id_hash_init(size, true);
-    /* exiting the process releases hash resources */
-    return (id_hash == NULL || name_hash == NULL) ? -1 : 0;
+    /* enough shards so that pipeline threads rarely contend on the same
+     * lock */
+    unsigned int nb_shards = 4 * entry_proc_conf.nb_thread;
+
+    if (nb_shards < 16)
+        nb_shards = 16;
+    else if (nb_shards > 1024)
+        nb_shards = 1024;
+
+    id_index = op_index_init(entry_proc_conf.max_pending_operations,
+                             nb_shards, false);
+    name_index = op_index_init(entry_proc_conf.max_pending_operations,
+                               nb_shards, true);
+    /* exiting the process releases index resources */
+    return (id_index == NULL || name_index == NULL) ? -1 : 0;
 }
 
 /**
  * This is called to register the operation (with the ordering of pipeline)
  * Normal operation is to register at the tail.
+ * With the lock-free pipeline engine, operations may register in a different
+ * order than they entered the pipeline, so chains are kept sorted by
+ * insertion order (at_head is ignored).
  * @return ID_OK if the entry can be processed.
  *         ID_MISSING if the ID is not set in p_op structure
- *         ID_ALREADY if the op_structure has already been registered
  */
 int id_constraint_register(entry_proc_op_t *p_op, int at_head)
 {
-    struct id_hash_slot *slot;
+    op_insert_pos_e pos;
 
     if (!p_op->entry_id_is_set)
         return ID_MISSING;
 
-    /* compute id hash value */
-    slot = get_hash_slot(id_hash, &p_op->entry_id);
-
-    P(slot->lock);
-
-    if (at_head)
-        rh_list_add(&p_op->id_hash_list, &slot->list);
+    if (entry_proc_conf.pipeline_engine == PIPELINE_ENGINE_LOCKFREE)
+        pos = OP_INSERT_SORTED;
     else
-        rh_list_add_tail(&p_op->id_hash_list, &slot->list);
+        pos = at_head ? OP_INSERT_HEAD : OP_INSERT_TAIL;
 
-    slot->count++;
+    if (op_index_insert(id_index, p_op, pos))
+        goto err;
     p_op->id_is_referenced = 1;
 
-    V(slot->lock);
-
     /* also lock parent_id/name */
     if (ATTR_MASK_TEST(&p_op->fs_attrs, parent_id) &&
         ATTR_MASK_TEST(&p_op->fs_attrs, name)) {
-        slot = get_name_hash_slot(name_hash, &ATTR(&p_op->fs_attrs, parent_id),
-                                  ATTR(&p_op->fs_attrs, name));
-        P(slot->lock);
-
-        if (at_head)
-            rh_list_add(&p_op->name_hash_list, &slot->list);
-        else
-            rh_list_add_tail(&p_op->name_hash_list, &slot->list);
-
-        slot->count++;
+        if (op_index_insert(name_index, p_op, pos))
+            goto err;
         p_op->name_is_referenced = 1;
-
-        V(slot->lock);
     }
 
     return ID_OK;
+
+ err:
+    DisplayLog(LVL_CRIT, "IdConstraint",
+               "Cannot allocate constraint key for " DFID,
+               PFID(&p_op->entry_id));
+    return -ENOMEM;
 }
 
 #ifdef HAVE_CHANGELOGS
@@ -115,75 +115,38 @@ int id_constraint_register(entry_proc_op_t *p_op, int at_head)
  */
 bool id_constraint_is_first_op(entry_proc_op_t *p_op_in)
 {
-    entry_proc_op_t *op;
-    struct id_hash_slot *slot;
-    int is_first = -1;  /* not set */
-
-    /* compute id hash value */
-    slot = get_hash_slot(id_hash, &p_op_in->entry_id);
-
-    P(slot->lock);
-    rh_list_for_each_entry(op, &slot->list, id_hash_list) {
-        if (entry_id_equal(&p_op_in->entry_id, &op->entry_id)) {
-            /* found an operation with the given id */
-            if (op == p_op_in)
-                is_first = 1;
-            else {
-                is_first = 0;
-                DisplayLog(LVL_FULL, "IdConstraint",
-                           "Pending operation with the same id: " DFID
-                           " (%s). next op: %s", PFID(&op->entry_id),
-                           op_name(op), op_name(p_op_in));
-            }
-            break;
-        }
-    }
-    V(slot->lock);
+    /* an operation that is not registered is never the first */
+    if (!p_op_in->id_is_referenced)
+        return false;
 
-    if (is_first == 0)
+    if (!op_index_is_first(id_index, p_op_in, false)) {
         /* for sure, there is another operation on the same id before
          * this one */
+        DisplayLog(LVL_FULL, "IdConstraint",
+                   "Pending operation with the same id: " DFID
+                   ". next op: %s", PFID(&p_op_in->entry_id),
+                   op_name(p_op_in));
         return false;
+    }
 
-    /* sanity check: registered operation was not found??? */
-    if ((is_first == -1) && (p_op_in->id_is_referenced))
-        RBH_BUG("Registered operation was not found in id_constraint hash");
-
-    /* Entry may be the first (or is not registered).
-     * Additional check of parent/name constraint: */
-    if (ATTR_MASK_TEST(&p_op_in->fs_attrs, parent_id) &&
-        ATTR_MASK_TEST(&p_op_in->fs_attrs, name)) {
-        slot =
-            get_name_hash_slot(name_hash, &ATTR(&p_op_in->fs_attrs, parent_id),
-                               ATTR(&p_op_in->fs_attrs, name));
-        P(slot->lock);
-        rh_list_for_each_entry(op, &slot->list, name_hash_list) {
-            if (entry_id_equal
-                (&ATTR(&p_op_in->fs_attrs, parent_id),
-                 &ATTR(&op->fs_attrs, parent_id))
-                && !strcmp(ATTR(&p_op_in->fs_attrs, name),
-                           ATTR(&op->fs_attrs, name))) {
-                if (op == p_op_in)
-                    is_first = 1;
-                else {
-                    is_first = 0;
-                    DisplayLog(LVL_FULL, "IdConstraint",
-                               "Pending operation with the same parent/name: "
-                               DFID "/%s (%s). next op: %s",
-                               PFID(&ATTR(&p_op_in->fs_attrs, parent_id)),
-                               ATTR(&p_op_in->fs_attrs, name), op_name(op),
-                               op_name(p_op_in));
-                }
-                break;
-            }
-        }
-        V(slot->lock);
+    /* Additional check of parent/name constraint: */
+    if (!ATTR_MASK_TEST(&p_op_in->fs_attrs, parent_id) ||
+        !ATTR_MASK_TEST(&p_op_in->fs_attrs, name))
+        return true;
+
+    if (p_op_in->name_is_referenced ?
+        !op_index_is_first(name_index, p_op_in, false) :
+        /* name was set after registration */
+        op_index_has_pending(name_index, p_op_in)) {
+        DisplayLog(LVL_FULL, "IdConstraint",
+                   "Pending operation with the same parent/name: "
+                   DFID "/%s. next op: %s",
+                   PFID(&ATTR(&p_op_in->fs_attrs, parent_id)),
+                   ATTR(&p_op_in->fs_attrs, name), op_name(p_op_in));
+        return false;
     }
 
-    /* if is_first = 0 => not first */
-    /* if is_first = -1: not found => not first */
-    /* just return TRUE if is_first = 1 */
-    return (is_first == 1);
+    return true;
 }
 
 /**
@@ -191,58 +154,65 @@ bool id_constraint_is_first_op(entry_proc_op_t *p_op_in)
  */
 int id_constraint_unregister(entry_proc_op_t *p_op)
 {
-    struct id_hash_slot *slot;
-
     if (!p_op->entry_id_is_set)
         return ID_MISSING;
 
     if (!p_op->id_is_referenced)
         return ID_NOT_EXISTS;
 
-    slot = get_hash_slot(id_hash, &p_op->entry_id);
+    op_index_remove(id_index, p_op, NULL);
+    p_op->id_is_referenced = 0;
+
+    if (p_op->name_is_referenced) {
+        op_index_remove(name_index, p_op, NULL);
+        p_op->name_is_referenced = 0;
+    }
 
-    /* Remove the entry */
-    P(slot->lock);
+    return ID_OK;
+}
 
-    rh_list_del(&p_op->id_hash_list);
-    p_op->id_is_referenced = 0;
-    slot->count--;
+bool id_constraint_wait_first(entry_proc_op_t *p_op_in)
+{
+    if (p_op_in->id_is_referenced &&
+        !op_index_is_first(id_index, p_op_in, true))
+        return false;
 
-    V(slot->lock);
+    if (p_op_in->name_is_referenced &&
+        !op_index_is_first(name_index, p_op_in, true))
+        return false;
+
+    return true;
+}
+
+int id_constraint_release(entry_proc_op_t *p_op, entry_proc_op_t *woken[2])
+{
+    int nb = 0;
+
+    /* a waiting operation is only woken once, as the CAS on its state
+     * only succeeds for the first of its chains it is at the head of */
+    if (p_op->id_is_referenced) {
+        nb += op_index_remove(id_index, p_op, &woken[nb]);
+        p_op->id_is_referenced = 0;
+    }
 
     if (p_op->name_is_referenced) {
-        if (ATTR_MASK_TEST(&p_op->fs_attrs, parent_id) &&
-            ATTR_MASK_TEST(&p_op->fs_attrs, name)) {
-            slot =
-                get_name_hash_slot(name_hash, &ATTR(&p_op->fs_attrs, parent_id),
-                                   ATTR(&p_op->fs_attrs, name));
-            /* Remove the entry */
-            P(slot->lock);
-
-            rh_list_del(&p_op->name_hash_list);
-            p_op->name_is_referenced = 0;
-            slot->count--;
-
-            V(slot->lock);
-        } else {
-            DisplayLog(LVL_MAJOR, "IdConstraint", "WARNING: cannot unregister "
-                       "entry with no parent/name but with a registered name!");
-        }
+        nb += op_index_remove(name_index, p_op, &woken[nb]);
+        p_op->name_is_referenced = 0;
     }
 
-    return ID_OK;
+    return nb;
 }
 
 void id_constraint_stats(void)
 {
-    id_hash_stats(id_hash, "Id constraints count");
-    id_hash_stats(name_hash, "Name constraints count");
+    op_index_stats(id_index, "Id constraints count");
+    op_index_stats(name_index, "Name constraints count");
 }
 
 void id_constraint_dump(void)
 {
-    id_hash_dump(id_hash, false);
-    id_hash_dump(name_hash, true);
+    op_index_dump(id_index);
+    op_index_dump(name_index);
 }
 
 /* ------------ Config management functions --------------- */
@@ -262,8 +232,16 @@ static void entry_proc_cfg_set_default(void *module_config)
     conf->max_pending_operations = 100;
     conf->max_batch_size = 100;
     conf->match_classes = true;
+    conf->verify_class_matching = false;
 
     conf->detect_fake_mtime = false;
+
+    conf->pipeline_engine = PIPELINE_ENGINE_LISTS;
+    conf->pipeline_scheduler = LF_SCHED_LAST_STAGE_FIRST;
+
+    conf->adaptive_batching = false;
+    conf->batch_latency_target = 100;
+    conf->batch_window = 0;
 }
 
 static void entry_proc_cfg_write_default(FILE *output)
@@ -278,7 +256,13 @@ static void entry_proc_cfg_write_default(FILE *output)
     print_line(output, 1, "max_pending_operations :  100");
     print_line(output, 1, "max_batch_size         :  100");
     print_line(output, 1, "match_classes          :  yes");
+    print_line(output, 1, "verify_class_matching  :  no");
     print_line(output, 1, "detect_fake_mtime      :  no");
+    print_line(output, 1, "pipeline_engine        :  lists");
+    print_line(output, 1, "pipeline_scheduler     :  last_stage_first");
+    print_line(output, 1, "adaptive_batching      :  no");
+    print_line(output, 1, "batch_latency_target   :  100 (ms)");
+    print_line(output, 1, "batch_window           :  0");
     print_end_block(output, 0);
 }
 
@@ -414,6 +398,76 @@ static void set_default_pipeline_config(const pipeline_descr_t *descr,
     }
 }
 
+const char *pipeline_engine2str(pipeline_engine_e engine)
+{
+    switch (engine) {
+    case PIPELINE_ENGINE_LISTS:
+        return "lists";
+    case PIPELINE_ENGINE_LOCKFREE:
+        return "lockfree";
+    }
+    return "?";
+}
+
+const char *lf_sched_policy2str(lf_sched_policy_e policy)
+{
+    switch (policy) {
+    case LF_SCHED_LAST_STAGE_FIRST:
+        return "last_stage_first";
+    case LF_SCHED_ROUND_ROBIN:
+        return "round_robin";
+    case LF_SCHED_LONGEST_QUEUE:
+        return "longest_queue";
+    }
+    return "?";
+}
+
+/** read pipeline_engine and pipeline_scheduler parameters */
+static int read_engine_params(config_item_t entryproc_block,
+                              entry_proc_config_t *conf, char *msg_out)
+{
+    char tmpstr[128];
+    int rc;
+
+    rc = GetStringParam(entryproc_block, ENTRYPROC_CONFIG_BLOCK,
+                        "pipeline_engine", PFLG_NO_WILDCARDS, tmpstr,
+                        sizeof(tmpstr), NULL, NULL, msg_out);
+    if ((rc != 0) && (rc != ENOENT))
+        return rc;
+    else if (rc != ENOENT) {
+        if (!strcasecmp(tmpstr, "lists"))
+            conf->pipeline_engine = PIPELINE_ENGINE_LISTS;
+        else if (!strcasecmp(tmpstr, "lockfree"))
+            conf->pipeline_engine = PIPELINE_ENGINE_LOCKFREE;
+        else {
+            sprintf(msg_out, "Invalid pipeline engine '%s' (expected: lists, "
+                    "lockfree)", tmpstr);
+            return EINVAL;
+        }
+    }
+
+    rc = GetStringParam(entryproc_block, ENTRYPROC_CONFIG_BLOCK,
+                        "pipeline_scheduler", PFLG_NO_WILDCARDS, tmpstr,
+                        sizeof(tmpstr), NULL, NULL, msg_out);
+    if ((rc != 0) && (rc != ENOENT))
+        return rc;
+    else if (rc != ENOENT) {
+        if (!strcasecmp(tmpstr, "last_stage_first"))
+            conf->pipeline_scheduler = LF_SCHED_LAST_STAGE_FIRST;
+        else if (!strcasecmp(tmpstr, "round_robin"))
+            conf->pipeline_scheduler = LF_SCHED_ROUND_ROBIN;
+        else if (!strcasecmp(tmpstr, "longest_queue"))
+            conf->pipeline_scheduler = LF_SCHED_LONGEST_QUEUE;
+        else {
+            sprintf(msg_out, "Invalid pipeline scheduler '%s' (expected: "
+                    "last_stage_first, round_robin, longest_queue)", tmpstr);
+            return EINVAL;
+        }
+    }
+
+    return 0;
+}
+
 static int entry_proc_cfg_read(config_file_t config, void *module_config,
                                char *msg_out)
 {
@@ -424,8 +478,8 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
 
     /* buffer to store arg names */
     char *pipeline_names = NULL;
-    /* max size is max pipeline steps (<10) + other args (<6) */
-#define MAX_ENTRYPROC_ARGS 16
+    /* max size is max pipeline steps (<10) + other args (<12) */
+#define MAX_ENTRYPROC_ARGS 22
     char *entry_proc_allowed[MAX_ENTRYPROC_ARGS] = { 0 };
 
     const cfg_param_t cfg_params[] = {
@@ -436,7 +490,12 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
         {"max_batch_size", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
          &conf->max_batch_size, 0},
         {"match_classes", PT_BOOL, 0, &conf->match_classes, 0},
+        {"verify_class_matching", PT_BOOL, 0, &conf->verify_class_matching, 0},
         {"detect_fake_mtime", PT_BOOL, 0, &conf->detect_fake_mtime, 0},
+        {"adaptive_batching", PT_BOOL, 0, &conf->adaptive_batching, 0},
+        {"batch_latency_target", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->batch_latency_target, 0},
+        {"batch_window", PT_INT, PFLG_POSITIVE, &conf->batch_window, 0},
 
         END_OF_PARAMS
     };
@@ -447,6 +506,7 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
     if (rc == ENOENT) {
         /* set default pipeline config */
         set_default_pipeline_config(&std_pipeline_descr, std_pipeline, conf);
+        set_default_pipeline_config(&load_pipeline_descr, load_pipeline, conf);
         /* No error because no parameter is mandatory */
         return 0;
     }
@@ -459,6 +519,10 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
     if (rc)
         return rc;
 
+    rc = read_engine_params(entryproc_block, conf, msg_out);
+    if (rc)
+        return rc;
+
     /* should have at least 2 threads! */
     if (conf->nb_thread == 1)
         DisplayLog(LVL_MAJOR, "EntryProc_Config", "WARNING: "
@@ -477,6 +541,13 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
     if (rc)
         return rc;
 
+    /* the bulk load pipeline has the same stages */
+    set_default_pipeline_config(&load_pipeline_descr, load_pipeline, conf);
+    rc = load_pipeline_config(&load_pipeline_descr, load_pipeline, conf,
+                              entryproc_block, msg_out);
+    if (rc)
+        return rc;
+
     // TODO load_pipeline_config(&diff_pipeline_descr, &diff_pipeline);
 
     /* TODO Check consistency of performance strategy:
@@ -510,7 +581,13 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
     entry_proc_allowed[next_idx++] = "max_pending_operations";
     entry_proc_allowed[next_idx++] = "max_batch_size";
     entry_proc_allowed[next_idx++] = "match_classes";
+    entry_proc_allowed[next_idx++] = "verify_class_matching";
     entry_proc_allowed[next_idx++] = "detect_fake_mtime";
+    entry_proc_allowed[next_idx++] = "pipeline_engine";
+    entry_proc_allowed[next_idx++] = "pipeline_scheduler";
+    entry_proc_allowed[next_idx++] = "adaptive_batching";
+    entry_proc_allowed[next_idx++] = "batch_latency_target";
+    entry_proc_allowed[next_idx++] = "batch_window";
 
     pipeline_names = malloc(16 * 256);  /* max 16 strings of 256 (oversized) */
     if (!pipeline_names)
@@ -542,6 +619,20 @@ static int entry_proc_cfg_reload(entry_proc_config_t *conf)
                    ENTRYPROC_CONFIG_BLOCK
                    "::max_pending_operations changed in config file, but cannot be modified dynamically");
 
+    if (conf->pipeline_engine != entry_proc_conf.pipeline_engine)
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::pipeline_engine changed in config file, but cannot be modified dynamically");
+
+    if (conf->pipeline_scheduler != entry_proc_conf.pipeline_scheduler) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::pipeline_scheduler updated: '%s'->'%s'",
+                   lf_sched_policy2str(entry_proc_conf.pipeline_scheduler),
+                   lf_sched_policy2str(conf->pipeline_scheduler));
+        entry_proc_conf.pipeline_scheduler = conf->pipeline_scheduler;
+    }
+
     if (conf->max_batch_size != entry_proc_conf.max_batch_size) {
         DisplayLog(LVL_MAJOR, "EntryProc_Config",
                    ENTRYPROC_CONFIG_BLOCK
@@ -550,6 +641,32 @@ static int entry_proc_cfg_reload(entry_proc_config_t *conf)
         entry_proc_conf.max_batch_size = conf->max_batch_size;
     }
 
+    if (conf->adaptive_batching != entry_proc_conf.adaptive_batching) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::adaptive_batching updated: '%s'->'%s'",
+                   bool2str(entry_proc_conf.adaptive_batching),
+                   bool2str(conf->adaptive_batching));
+        entry_proc_conf.adaptive_batching = conf->adaptive_batching;
+    }
+
+    if (conf->batch_latency_target != entry_proc_conf.batch_latency_target) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::batch_latency_target updated: '%u'->'%u'",
+                   entry_proc_conf.batch_latency_target,
+                   conf->batch_latency_target);
+        entry_proc_conf.batch_latency_target = conf->batch_latency_target;
+    }
+
+    if (conf->batch_window != entry_proc_conf.batch_window) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::batch_window updated: '%u'->'%u'",
+                   entry_proc_conf.batch_window, conf->batch_window);
+        entry_proc_conf.batch_window = conf->batch_window;
+    }
+
     if (conf->match_classes != entry_proc_conf.match_classes) {
         DisplayLog(LVL_MAJOR, "EntryProc_Config",
                    ENTRYPROC_CONFIG_BLOCK "::match_classes updated: '%s'->'%s'",
@@ -558,6 +675,16 @@ static int entry_proc_cfg_reload(entry_proc_config_t *conf)
         entry_proc_conf.match_classes = conf->match_classes;
     }
 
+    if (conf->verify_class_matching != entry_proc_conf.verify_class_matching) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::verify_class_matching updated: '%s'->'%s'",
+                   bool2str(entry_proc_conf.verify_class_matching),
+                   bool2str(conf->verify_class_matching));
+        entry_proc_conf.verify_class_matching = conf->verify_class_matching;
+        set_class_matching_check(conf->verify_class_matching);
+    }
+
     if (conf->detect_fake_mtime != entry_proc_conf.detect_fake_mtime) {
         DisplayLog(LVL_MAJOR, "EntryProc_Config",
                    ENTRYPROC_CONFIG_BLOCK
@@ -584,6 +711,7 @@ static int entry_proc_cfg_set(void *cfg, bool reload)
         return entry_proc_cfg_reload(config);
 
     entry_proc_conf = *config;
+    set_class_matching_check(entry_proc_conf.verify_class_matching);
     return 0;
 }
 
@@ -607,6 +735,18 @@ static void entry_proc_cfg_write_template(FILE *output)
     fprintf(output, "\n");
     print_line(output, 1, "# max batched DB operations (1=no batching)");
     print_line(output, 1, "max_batch_size = 100;");
+    print_line(output, 1,
+               "# Adapt batch size to the measured latency of DB operations.");
+    print_line(output, 1,
+               "# max_batch_size is then the upper bound of batch size.");
+    print_line(output, 1, "adaptive_batching = no;");
+    print_line(output, 1, "# target latency of a batch (in milliseconds)");
+    print_line(output, 1, "batch_latency_target = 100;");
+    print_line(output, 1,
+               "# Number of non-batchable operations that can be skipped");
+    print_line(output, 1,
+               "# to group batchable ones (0: consecutive operations only)");
+    print_line(output, 1, "batch_window = 0;");
     fprintf(output, "\n");
 
     print_line(output, 1,
@@ -634,6 +774,11 @@ static void entry_proc_cfg_write_template(FILE *output)
     print_line(output, 1,
                "# at policy application time (not during a scan or reading changelog)");
     print_line(output, 1, "match_classes = yes;");
+    print_line(output, 1,
+               "# Also match fileclasses with the (slower) interpreter, and");
+    print_line(output, 1,
+               "# report differences with the compiled matcher");
+    print_line(output, 1, "verify_class_matching = no;");
 
     fprintf(output, "\n");
     print_line(output, 1,
@@ -643,6 +788,17 @@ static void entry_proc_cfg_write_template(FILE *output)
     print_line(output, 1, "# and doesn't allow  mtime < creation_time");
     print_line(output, 1, "detect_fake_mtime = no;");
 
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Pipeline engine: 'lists' (per-stage locked lists) or");
+    print_line(output, 1,
+               "# 'lockfree' (per-stage lock-free queues of ready operations)");
+    print_line(output, 1, "pipeline_engine = lists;");
+    print_line(output, 1,
+               "# Order in which 'lockfree' workers look for operations:");
+    print_line(output, 1, "# last_stage_first, round_robin or longest_queue");
+    print_line(output, 1, "pipeline_scheduler = last_stage_first;");
+
     print_end_block(output, 0);
 }
 
@@ -761,6 +917,43 @@ void check_stripe_info(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
 }
 #endif
 
+void acct2dbneed(struct entry_proc_op_t *p_op)
+{
+    attr_mask_t tmp;
+
+    if (!lmgr_app_acct())
+        return;
+
+    tmp = ListMgr_AcctMask();
+    p_op->db_attr_need = attr_mask_or(&p_op->db_attr_need, &tmp);
+}
+
+void EntryProc_AcctDelta(lmgr_t *lmgr, const struct entry_proc_op_t *p_op)
+{
+    if (!lmgr_app_acct())
+        return;
+
+    switch (p_op->db_op_type) {
+    case OP_TYPE_INSERT:
+        ListMgr_AcctDelta(lmgr, &p_op->entry_id, NULL, &p_op->fs_attrs);
+        break;
+    case OP_TYPE_UPDATE:
+        /* batched updates may insert missing entries */
+        ListMgr_AcctDelta(lmgr, &p_op->entry_id,
+                          p_op->db_exists ? &p_op->db_attrs : NULL,
+                          &p_op->fs_attrs);
+        break;
+    case OP_TYPE_REMOVE_LAST:
+    case OP_TYPE_SOFT_REMOVE:
+        if (p_op->db_exists)
+            ListMgr_AcctDelta(lmgr, &p_op->entry_id, &p_op->db_attrs, NULL);
+        break;
+    default:
+        /* no change of entry attributes */
+        break;
+    }
+}
+
 static void *entry_proc_cfg_new(void)
 {
     return calloc(1, sizeof(entry_proc_config_t));
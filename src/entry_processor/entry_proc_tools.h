@@ -19,22 +19,52 @@
 
 #include "entry_processor.h"
 
+/** pipeline engine */
+typedef enum {
+    PIPELINE_ENGINE_LISTS = 0,  /**< per-stage lists protected by mutexes */
+    PIPELINE_ENGINE_LOCKFREE,   /**< per-stage lock-free queues of ready ops */
+} pipeline_engine_e;
+
+/** how lock-free engine workers choose the stage to pull ops from */
+typedef enum {
+    LF_SCHED_LAST_STAGE_FIRST = 0,  /**< drain the end of the pipeline first */
+    LF_SCHED_ROUND_ROBIN,           /**< rotate between stages */
+    LF_SCHED_LONGEST_QUEUE,         /**< stage with the most ready ops first */
+} lf_sched_policy_e;
+
 typedef struct entry_proc_config_t {
     unsigned int nb_thread;
     unsigned int max_pending_operations;
     unsigned int max_batch_size;
 
     bool match_classes;
+    /* also match fileclasses with the interpreter, to check the compiled
+     * fileclass matcher */
+    bool verify_class_matching;
 
     /* fake mtime in the past causes higher
      * migration priority */
     bool detect_fake_mtime;
 
+    pipeline_engine_e pipeline_engine;
+    lf_sched_policy_e pipeline_scheduler;
+
+    /* adapt batch size to the measured batch latency */
+    bool adaptive_batching;
+    /* target batch latency (ms) for adaptive batching */
+    unsigned int batch_latency_target;
+    /* number of non-batchable operations that can be skipped
+     * to find batchable ones (0: consecutive operations only) */
+    unsigned int batch_window;
+
 } entry_proc_config_t;
 
 extern entry_proc_config_t entry_proc_conf;
 extern int pipeline_flags;
 
+const char *pipeline_engine2str(pipeline_engine_e engine);
+const char *lf_sched_policy2str(lf_sched_policy_e policy);
+
 /** initialize id constraint manager */
 int id_constraint_init(void);
 
@@ -60,6 +90,25 @@ bool id_constraint_is_first_op(entry_proc_op_t *p_op);
  */
 int id_constraint_unregister(entry_proc_op_t *p_op);
 
+/* states of an operation regarding id constraints (lock-free engine) */
+#define LF_OP_READY     0
+#define LF_OP_WAIT_ID   1
+
+/**
+ * Lock-free engine: same as id_constraint_is_first_op(), but if the operation
+ * is not the first for its id or parent/name, it is atomically flagged as
+ * waiting, so id_constraint_release() of the previous operation wakes it up.
+ * The caller must not access the operation anymore if false is returned.
+ */
+bool id_constraint_wait_first(entry_proc_op_t *p_op);
+
+/**
+ * Lock-free engine: unregister an operation and return the waiting operations
+ * that are now the first for this id or parent/name (2 at most).
+ * @return the number of operations set in woken[].
+ */
+int id_constraint_release(entry_proc_op_t *p_op, entry_proc_op_t *woken[2]);
+
 /* display info about id constraints management */
 void id_constraint_stats(void);
 /* dump all values */
@@ -74,4 +123,12 @@ void check_and_warn_fake_mtime(const struct entry_proc_op_t *p_op);
 void check_stripe_info(struct entry_proc_op_t *p_op, lmgr_t *lmgr);
 #endif
 
+/** add attributes needed for accounting to the attributes retrieved from DB
+ * (if accounting is maintained by robinhood) */
+void acct2dbneed(struct entry_proc_op_t *p_op);
+
+/** account the change of an entry after it has been applied to the DB
+ * (if accounting is maintained by robinhood) */
+void EntryProc_AcctDelta(lmgr_t *lmgr, const struct entry_proc_op_t *p_op);
+
 #endif
@@ -431,6 +431,11 @@ static int EntryProc_ProcessLogRec(struct entry_proc_op_t *p_op)
     /* allow event-driven update */
     bool md_allow_event_updt = true;
 
+    /* cached directory names are outdated */
+    if (logrec->cr_type == CL_RENAME || logrec->cr_type == CL_EXT
+        || logrec->cr_type == CL_RMDIR)
+        ListMgr_PathCacheInvalidate(&p_op->entry_id);
+
     if (logrec->cr_type == CL_UNLINK) {
 #ifdef _LUSTRE_HSM
         DisplayLog(LVL_DEBUG, ENTRYPROC_TAG,
@@ -884,8 +889,10 @@ static void scan2dbneed(struct entry_proc_op_t *p_op)
 /**
  * check if the entry exists in the database and what info
  * must be retrieved.
+ * @param bulk  entries from FS scan are loaded into an empty database,
+ *              so they are not looked up.
  */
-int EntryProc_get_info_db(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
+static int get_info_db(struct entry_proc_op_t *p_op, lmgr_t *lmgr, bool bulk)
 {
     int rc = 0;
     int next_stage = -1;    /* -1 = skip */
@@ -972,6 +979,7 @@ int EntryProc_get_info_db(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
 
         /* determine needed attributes from DB */
         logrec2dbneed(p_op);
+        acct2dbneed(p_op);
 
         /* attributes to be retrieved */
         p_op->db_attrs.attr_mask = p_op->db_attr_need;
@@ -1031,8 +1039,12 @@ int EntryProc_get_info_db(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
 
         /* determined needed attributes from DB */
         scan2dbneed(p_op);
+        acct2dbneed(p_op);
 
-        if (!attr_mask_is_null(p_op->db_attr_need)) {
+        if (bulk) {
+            p_op->db_exists = 0;
+            ATTR_MASK_INIT(&p_op->db_attrs);
+        } else if (!attr_mask_is_null(p_op->db_attr_need)) {
             p_op->db_attrs.attr_mask = p_op->db_attr_need;
             rc = ListMgr_Get(lmgr, &p_op->entry_id, &p_op->db_attrs);
 
@@ -1169,6 +1181,11 @@ int EntryProc_get_info_db(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
     return rc;
 }
 
+int EntryProc_get_info_db(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
+{
+    return get_info_db(p_op, lmgr, false);
+}
+
 /** skip_record a record by acknowledging current operation */
 static int skip_record(struct entry_proc_op_t *p_op)
 {
@@ -1635,8 +1652,10 @@ int EntryProc_pre_apply(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
 
 /**
  * Perform a single operation on the database.
+ * @param bulk  inserts are bulk loaded. ACCT_STAT is built at the end of the
+ *              load, so there is no accounting delta to apply.
  */
-int EntryProc_db_apply(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
+static int db_apply(struct entry_proc_op_t *p_op, lmgr_t *lmgr, bool bulk)
 {
     int rc;
     const pipeline_stage_t *stage_info =
@@ -1654,7 +1673,13 @@ int EntryProc_db_apply(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
     case OP_TYPE_INSERT:
         DisplayLog(LVL_FULL, ENTRYPROC_TAG, "Insert(" DFID ")",
                    PFID(&p_op->entry_id));
-        rc = ListMgr_Insert(lmgr, &p_op->entry_id, &p_op->fs_attrs, false);
+        if (bulk) {
+            entry_id_t *p_id = &p_op->entry_id;
+            attr_set_t *p_attrs = &p_op->fs_attrs;
+
+            rc = ListMgr_BulkLoadAdd(lmgr, &p_id, &p_attrs, 1);
+        } else
+            rc = ListMgr_Insert(lmgr, &p_op->entry_id, &p_op->fs_attrs, false);
         break;
 
     case OP_TYPE_UPDATE:
@@ -1708,6 +1733,8 @@ int EntryProc_db_apply(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
         DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
                    "Error %d performing database operation: %s.", rc,
                    lmgr_err2str(rc));
+    else if (!bulk || p_op->db_op_type != OP_TYPE_INSERT)
+        EntryProc_AcctDelta(lmgr, p_op);
 
     /* Acknowledge the operation if there is a callback */
 #ifdef HAVE_CHANGELOGS
@@ -1724,11 +1751,17 @@ int EntryProc_db_apply(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
     return rc;
 }
 
+int EntryProc_db_apply(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
+{
+    return db_apply(p_op, lmgr, false);
+}
+
 /**
  * Perform a batch of operations on the database.
+ * @param bulk  inserts are bulk loaded (see db_apply).
  */
-int EntryProc_db_batch_apply(struct entry_proc_op_t **ops, int count,
-                             lmgr_t *lmgr)
+static int db_batch_apply(struct entry_proc_op_t **ops, int count,
+                          lmgr_t *lmgr, bool bulk)
 {
     int i, rc = 0;
     const pipeline_stage_t *stage_info =
@@ -1761,7 +1794,10 @@ int EntryProc_db_batch_apply(struct entry_proc_op_t **ops, int count,
     case OP_TYPE_INSERT:
         DisplayLog(LVL_FULL, ENTRYPROC_TAG, "BatchInsert(%u ops: " DFID "...)",
                    count, PFID(ids[0]));
-        rc = ListMgr_BatchInsert(lmgr, ids, attrs, count, false);
+        if (bulk)
+            rc = ListMgr_BulkLoadAdd(lmgr, ids, attrs, count);
+        else
+            rc = ListMgr_BatchInsert(lmgr, ids, attrs, count, false);
         break;
     case OP_TYPE_UPDATE:
         DisplayLog(LVL_FULL, ENTRYPROC_TAG, "BatchUpdate(%u ops: " DFID "...)",
@@ -1778,6 +1814,9 @@ int EntryProc_db_batch_apply(struct entry_proc_op_t **ops, int count,
         DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
                    "Error %d performing batch database operation: %s.", rc,
                    lmgr_err2str(rc));
+    else if (!bulk || ops[0]->db_op_type != OP_TYPE_INSERT)
+        for (i = 0; i < count; i++)
+            EntryProc_AcctDelta(lmgr, ops[i]);
 
     /* Acknowledge the operation if there is a callback */
 #ifdef HAVE_CHANGELOGS
@@ -1798,6 +1837,12 @@ int EntryProc_db_batch_apply(struct entry_proc_op_t **ops, int count,
     return rc;
 }
 
+int EntryProc_db_batch_apply(struct entry_proc_op_t **ops, int count,
+                             lmgr_t *lmgr)
+{
+    return db_batch_apply(ops, count, lmgr, false);
+}
+
 #ifdef HAVE_CHANGELOGS
 int EntryProc_chglog_clr(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
 {
@@ -1918,3 +1963,75 @@ int EntryProc_rm_old_entries(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
     return rc;
 
 }
+
+/* load_pipeline: same as std_pipeline, with entries from the initial scan
+ * bulk loaded into an empty database (see ListMgr_BulkLoadStart) */
+
+static int EntryProc_load_get_info_db(struct entry_proc_op_t *p_op,
+                                      lmgr_t *lmgr)
+{
+    return get_info_db(p_op, lmgr, true);
+}
+
+static int EntryProc_load_db_apply(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
+{
+    return db_apply(p_op, lmgr, true);
+}
+
+static int EntryProc_load_db_batch_apply(struct entry_proc_op_t **ops,
+                                         int count, lmgr_t *lmgr)
+{
+    return db_batch_apply(ops, count, lmgr, true);
+}
+
+static int EntryProc_load_rm_old_entries(struct entry_proc_op_t *p_op,
+                                         lmgr_t *lmgr)
+{
+    int rc;
+
+    /* all scanned entries went through the pipeline:
+     * load remaining rows, build indexes and accounting */
+    rc = ListMgr_BulkLoadEnd();
+    if (rc)
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
+                   "Error %d completing bulk load: %s", rc, lmgr_err2str(rc));
+
+    return EntryProc_rm_old_entries(p_op, lmgr);
+}
+
+const pipeline_descr_t load_pipeline_descr = {
+    .stage_count = PIPELINE_STAGE_COUNT,
+    .GET_ID = STAGE_GET_FID,
+    .GET_INFO_DB = STAGE_GET_INFO_DB,
+    .GET_INFO_FS = STAGE_GET_INFO_FS,
+    .GC_OLDENT = STAGE_RM_OLD_ENTRIES,
+    .DB_APPLY = STAGE_DB_APPLY,
+};
+
+pipeline_stage_t load_pipeline[] = {
+    {STAGE_GET_FID, "STAGE_GET_FID", EntryProc_get_fid, NULL, NULL,
+     STAGE_FLAG_PARALLEL | STAGE_FLAG_SYNC, 0},
+    {STAGE_GET_INFO_DB, "STAGE_GET_INFO_DB", EntryProc_load_get_info_db,
+     NULL, NULL,
+     STAGE_FLAG_PARALLEL | STAGE_FLAG_SYNC | STAGE_FLAG_ID_CONSTRAINT, 0},
+    {STAGE_GET_INFO_FS, "STAGE_GET_INFO_FS", EntryProc_get_info_fs, NULL, NULL,
+     STAGE_FLAG_PARALLEL | STAGE_FLAG_SYNC, 0},
+    {STAGE_PRE_APPLY, "STAGE_PRE_APPLY", EntryProc_pre_apply, NULL, NULL,
+     STAGE_FLAG_PARALLEL | STAGE_FLAG_SYNC, 0},
+    /* staging files are written under a lock: parallel threads
+     * mostly build rows and load complete files */
+    {STAGE_DB_APPLY, "STAGE_DB_APPLY", EntryProc_load_db_apply,
+     EntryProc_load_db_batch_apply, dbop_is_batchable,
+#if defined(_SQLITE)
+     STAGE_FLAG_MAX_THREADS | STAGE_FLAG_SYNC, 1},
+#else
+     STAGE_FLAG_PARALLEL | STAGE_FLAG_SYNC, 0},
+#endif
+#ifdef HAVE_CHANGELOGS
+    {STAGE_CHGLOG_CLR, "STAGE_CHGLOG_CLR", EntryProc_chglog_clr, NULL, NULL,
+     STAGE_FLAG_SEQUENTIAL | STAGE_FLAG_SYNC, 1},
+#endif
+    {STAGE_RM_OLD_ENTRIES, "STAGE_RM_OLD_ENTRIES",
+     EntryProc_load_rm_old_entries, NULL, NULL,
+     STAGE_FLAG_SEQUENTIAL | STAGE_FLAG_SYNC, 0}
+};
@@ -12,13 +12,47 @@
  * knowledge of the CeCILL license (http://www.cecill.info) and that you
  * accept its terms.
  */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "entry_proc_tools.h"
+#include "entry_proc_hash.h"
+#include "rbh_logs.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
 
-unsigned int max_count_to_hash_size(unsigned int max_count);
-void *log_config;
+log_config_t log_config;
 
-int main(int argc, char **argv)
+/* contention benchmark parameters */
+#define DEFAULT_THREADS     8
+#define DEFAULT_COUNT       1000000
+/* small id space, so that threads often register the same ids */
+#define NB_IDS              256
+/* operations registered at the same time by a thread */
+#define OPS_PER_THREAD      16
+
+static struct op_index *idx;
+static unsigned int nb_loops;
+
+static void set_id(entry_proc_op_t *op, unsigned int i)
+{
+    memset(&op->entry_id, 0, sizeof(op->entry_id));
+#ifdef FID_PK
+    op->entry_id.f_seq = 0x200000400;
+    op->entry_id.f_oid = i;
+#else
+    op->entry_id.fs_key = 1;
+    op->entry_id.inode = i;
+#endif
+    op->entry_id_is_set = 1;
+}
+
+static void test_count2size(void)
 {
     int i;
 
@@ -27,5 +61,156 @@ int main(int argc, char **argv)
         fprintf(stderr, "count2size(%d) = %u\n", i, s);
         assert(s >= i || s == 32000251);
     }
+}
+
+/** check ordering of operations with the same id */
+static void test_ordering(void)
+{
+    entry_proc_op_t ops[4];
+    entry_proc_op_t *woken = NULL;
+    int i;
+
+    /* few buckets, to make the shard grow */
+    idx = op_index_init(0, 4, false);
+    assert(idx != NULL);
+
+    memset(ops, 0, sizeof(ops));
+    for (i = 0; i < 4; i++) {
+        set_id(&ops[i], 42);
+        ops[i].pipeline_seq = i;
+    }
+
+    /* sorted insertion, out of order */
+    assert(op_index_insert(idx, &ops[2], OP_INSERT_SORTED) == 0);
+    assert(op_index_insert(idx, &ops[0], OP_INSERT_SORTED) == 0);
+    assert(op_index_insert(idx, &ops[3], OP_INSERT_SORTED) == 0);
+    assert(op_index_insert(idx, &ops[1], OP_INSERT_SORTED) == 0);
+    assert(ops[0].id_key == ops[3].id_key);
+
+    assert(op_index_is_first(idx, &ops[0], false));
+    assert(!op_index_is_first(idx, &ops[1], false));
+    /* flag ops[1] as waiting */
+    assert(!op_index_is_first(idx, &ops[1], true));
+    assert(ops[1].lf_state == LF_OP_WAIT_ID);
+    assert(op_index_has_pending(idx, &ops[0]));
+
+    /* removing the head wakes up the next one */
+    assert(op_index_remove(idx, &ops[0], &woken) == 1);
+    assert(woken == &ops[1] && ops[1].lf_state == LF_OP_READY);
+    assert(ops[0].id_key == NULL);
+    assert(op_index_is_first(idx, &ops[1], false));
+
+    /* ops[2] is not waiting: not woken */
+    woken = NULL;
+    assert(op_index_remove(idx, &ops[1], &woken) == 0);
+    assert(woken == NULL);
+
+    /* insertion at head */
+    assert(op_index_insert(idx, &ops[0], OP_INSERT_HEAD) == 0);
+    assert(op_index_is_first(idx, &ops[0], false));
+    op_index_remove(idx, &ops[0], NULL);
+    op_index_remove(idx, &ops[2], NULL);
+    op_index_remove(idx, &ops[3], NULL);
+
+    /* the key is released with its last operation */
+    assert(!op_index_has_pending(idx, &ops[3]));
+
+    /* many keys in a shard: make it grow */
+    {
+        entry_proc_op_t *many = calloc(1000, sizeof(*many));
+
+        assert(many != NULL);
+        for (i = 0; i < 1000; i++) {
+            set_id(&many[i], i);
+            assert(op_index_insert(idx, &many[i], OP_INSERT_TAIL) == 0);
+        }
+        for (i = 0; i < 1000; i++) {
+            assert(op_index_is_first(idx, &many[i], false));
+            op_index_remove(idx, &many[i], NULL);
+        }
+        free(many);
+    }
+
+    for (i = 0; i < idx->nb_shards; i++) {
+        assert(idx->shards[i].nb_keys == 0);
+        assert(idx->shards[i].nb_ops == 0);
+    }
+    fprintf(stderr, "ordering: OK\n");
+}
+
+/** register, check and unregister operations in a loop */
+static void *bench_thr(void *arg)
+{
+    entry_proc_op_t *ops = calloc(OPS_PER_THREAD, sizeof(*ops));
+    unsigned int seed = (unsigned long)arg;
+    unsigned int i, j;
+
+    assert(ops != NULL);
+
+    for (i = 0; i < nb_loops; i++) {
+        for (j = 0; j < OPS_PER_THREAD; j++) {
+            set_id(&ops[j], rand_r(&seed) % NB_IDS);
+            assert(op_index_insert(idx, &ops[j], OP_INSERT_TAIL) == 0);
+        }
+        for (j = 0; j < OPS_PER_THREAD; j++) {
+            op_index_is_first(idx, &ops[j], false);
+            op_index_remove(idx, &ops[j], NULL);
+        }
+    }
+
+    free(ops);
+    return NULL;
+}
+
+static void test_contention(unsigned int nb_threads, unsigned int count)
+{
+    pthread_t *threads = calloc(nb_threads, sizeof(pthread_t));
+    struct timeval start, end;
+    double elapsed;
+    unsigned int i;
+
+    assert(threads != NULL);
+    idx = op_index_init(nb_threads * OPS_PER_THREAD, 4 * nb_threads, false);
+    assert(idx != NULL);
+    nb_loops = count / (nb_threads * OPS_PER_THREAD) + 1;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nb_threads; i++)
+        assert(pthread_create(&threads[i], NULL, bench_thr,
+                              (void *)(unsigned long)(i + 1)) == 0);
+    for (i = 0; i < nb_threads; i++)
+        pthread_join(threads[i], NULL);
+    gettimeofday(&end, NULL);
+
+    for (i = 0; i < idx->nb_shards; i++) {
+        assert(idx->shards[i].nb_keys == 0);
+        assert(idx->shards[i].nb_ops == 0);
+    }
+
+    elapsed = (end.tv_sec - start.tv_sec)
+        + (end.tv_usec - start.tv_usec) / 1000000.0;
+    fprintf(stderr, "contention: %u threads, %u ops on %u ids: "
+            "%.2fs (%.0f ops/s)\n", nb_threads,
+            nb_loops * nb_threads * OPS_PER_THREAD, NB_IDS, elapsed,
+            nb_loops * nb_threads * OPS_PER_THREAD / elapsed);
+    free(threads);
+}
+
+/* usage: test_hash [<nb_threads> [<op_count>]] */
+int main(int argc, char **argv)
+{
+    unsigned int nb_threads = DEFAULT_THREADS;
+    unsigned int count = DEFAULT_COUNT;
+
+    if (argc > 1)
+        nb_threads = atoi(argv[1]);
+    if (argc > 2)
+        count = atoi(argv[2]);
+    if (nb_threads == 0)
+        nb_threads = 1;
+
+    test_count2size();
+    test_ordering();
+    test_contention(nb_threads, count);
     return 0;
 }
@@ -27,6 +27,7 @@
 #include "list_mgr.h"
 
 #include "task_stack_mngmt.h"
+#include "scan_uring.h"
 #include "task_tree_mngmt.h"
 #include "xplatform_print.h"
 #include "rbh_basename.h"
@@ -34,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>   /* for gettimeofday */
+#include <time.h>
 #include <sys/utsname.h>
 
 #include <unistd.h>
@@ -44,6 +46,7 @@
 
 #include <string.h>
 #include <fcntl.h>
+#include <glib.h>
 
 fs_scan_config_t fs_scan_config;
 run_flags_t fsscan_flags = 0;
@@ -54,6 +57,8 @@ const char *partial_scan_root = NULL;
 
 static bool is_lustre_fs = false;
 static bool is_first_scan = false;
+/* the current scan only reads directories that changed */
+static bool scan_incremental = false;
 
 /* information about scanning thread */
 
@@ -71,11 +76,37 @@ typedef struct thread_scan_info__ {
     /* entries handled since scan started */
     unsigned int entries_handled;
     unsigned int entries_errors;
+    /* directories handled since scan started */
+    unsigned int dirs_handled;
+    /* directories taken from other threads */
+    unsigned int dirs_stolen;
 
     /* time consumed for handling entries */
     struct timeval time_consumed;
     struct timeval last_processing_time;
 
+    /* ring for asynchronous stat (NULL if not used) */
+    struct scan_uring *uring;
+    /* io_uring could not be used by this thread */
+    bool uring_failed;
+    /* average time to handle an entry (in ns), with asynchronous
+     * (resp. synchronous) stat, to use the faster one */
+    unsigned long long uring_entry_ns;
+    unsigned long long sync_entry_ns;
+    /* time spent in stat calls for the current batch (in ns) */
+    unsigned long long stat_ns;
+    /* batches since the slower method was last tried */
+    unsigned int uring_probe;
+
+    /* DB connection to compare directories with their previous state
+     * (for incremental scans) */
+    lmgr_t lmgr;
+    bool lmgr_ok;
+    /* directories that were not read because they did not change */
+    unsigned int dirs_unchanged;
+    /* batches of entries of large directories handled */
+    unsigned int batches_handled;
+
 } thread_scan_info_t;
 
 /**
@@ -103,6 +134,21 @@ static struct timeval accurate_start_time = { 0, 0 };
 
 static unsigned int nb_hang_total = 0;
 
+/* Names that disappeared from the directories read during an incremental
+ * scan. They are removed from the DB at the end of the scan, once entries
+ * seen in other directories (renamed) have been updated by the pipeline.
+ */
+struct missing_name {
+    struct missing_name *next;
+    entry_id_t  id;
+    entry_id_t  parent_id;
+    char        name[];
+};
+static struct missing_name *missing_names = NULL;
+static pthread_mutex_t missing_lock = PTHREAD_MUTEX_INITIALIZER;
+/* some directories could not be compared to the DB */
+static bool missing_incomplete = false;
+
 /* used for adaptive scan interval */
 static double usage_max = 50.0; /* default: 50% */
 static time_t scan_interval = 0;
@@ -201,6 +247,10 @@ static void ResetScanStats(bool do_lock)
     for (i = 0; i < fs_scan_config.nb_threads_scan; i++) {
         thread_list[i].entries_handled = 0;
         thread_list[i].entries_errors = 0;
+        thread_list[i].dirs_handled = 0;
+        thread_list[i].dirs_stolen = 0;
+        thread_list[i].dirs_unchanged = 0;
+        thread_list[i].batches_handled = 0;
         timerclear(&thread_list[i].time_consumed);
         timerclear(&thread_list[i].last_processing_time);
     }
@@ -290,6 +340,186 @@ static bool ignore_entry(char *fullpath, char *name, unsigned int depth,
     return (rc != POLICY_NO_MATCH);
 }
 
+/** free children lists returned by ListMgr_GetChild() */
+static void free_child_list(wagon_t *ids, attr_set_t *attrs,
+                            unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        if (attrs)
+            ListMgr_FreeAttrs(&attrs[i]);
+        if (ids)
+            free(ids[i].fullname);
+    }
+    MemFree(attrs);
+    MemFree(ids);
+}
+
+static void add_missing_name(const entry_id_t *id, const entry_id_t *parent_id,
+                             const char *name)
+{
+    struct missing_name *m;
+
+    m = MemAlloc(sizeof(*m) + strlen(name) + 1);
+    if (m == NULL) {
+        missing_incomplete = true;
+        return;
+    }
+    m->id = *id;
+    m->parent_id = *parent_id;
+    strcpy(m->name, name);
+
+    P(missing_lock);
+    m->next = missing_names;
+    missing_names = m;
+    V(missing_lock);
+}
+
+static void free_missing_names(void)
+{
+    struct missing_name *m;
+
+    P(missing_lock);
+    while ((m = missing_names) != NULL) {
+        missing_names = m->next;
+        MemFree(m);
+    }
+    missing_incomplete = false;
+    V(missing_lock);
+}
+
+static void incr_remove_entry(lmgr_t *lmgr, const entry_id_t *id,
+                              const entry_id_t *parent_id, const char *name,
+                              unsigned int *nb_removed);
+
+/** remove the DB entries under a directory that no longer exists */
+static void incr_remove_subtree(lmgr_t *lmgr, const entry_id_t *dir_id,
+                                unsigned int *nb_removed)
+{
+    char no_path[] = "";
+    wagon_t parent = { *dir_id, no_path };
+    wagon_t *child_ids = NULL;
+    attr_set_t *child_attrs = NULL;
+    unsigned int count = 0;
+    unsigned int i;
+    int rc;
+
+    rc = ListMgr_GetChild(lmgr, NULL, &parent, 1, null_mask, &child_ids,
+                          &child_attrs, &count);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Failed to list children of "
+                   "removed directory " DFID " (error %d)", PFID(dir_id), rc);
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        if (ATTR_MASK_TEST(&child_attrs[i], name))
+            incr_remove_entry(lmgr, &child_ids[i].id, dir_id,
+                              ATTR(&child_attrs[i], name), nb_removed);
+
+    free_child_list(child_ids, child_attrs, count);
+}
+
+/** remove a name that disappeared from its parent directory */
+static void incr_remove_entry(lmgr_t *lmgr, const entry_id_t *id,
+                              const entry_id_t *parent_id, const char *name,
+                              unsigned int *nb_removed)
+{
+    attr_set_t attrs = ATTR_SET_INIT;
+    attr_set_t rm_attrs = ATTR_SET_INIT;
+    bool is_dir;
+    bool last = false;
+    int rc;
+
+    /* needed to account the removal */
+    if (lmgr_app_acct())
+        attrs.attr_mask = ListMgr_AcctMask();
+
+    ATTR_MASK_SET(&attrs, type);
+    ATTR_MASK_SET(&attrs, nlink);
+    ATTR_MASK_SET(&attrs, md_update);
+
+    rc = ListMgr_Get(lmgr, id, &attrs);
+    if (rc == DB_NOT_EXISTS)
+        return;
+    else if (rc) {
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Failed to get attributes of "
+                   DFID " (error %d): not removed", PFID(id), rc);
+        return;
+    }
+
+    ATTR_MASK_SET(&rm_attrs, parent_id);
+    ATTR(&rm_attrs, parent_id) = *parent_id;
+    ATTR_MASK_SET(&rm_attrs, name);
+    rh_strncpy(ATTR(&rm_attrs, name), name, sizeof(ATTR(&rm_attrs, name)));
+
+    is_dir = ATTR_MASK_TEST(&attrs, type)
+        && !strcmp(ATTR(&attrs, type), STR_TYPE_DIR);
+
+    if (ATTR_MASK_TEST(&attrs, md_update)
+        && ATTR(&attrs, md_update) >= scan_start_time) {
+        /* the entry was seen in another directory (renamed) */
+        DisplayLog(LVL_DEBUG, FSSCAN_TAG, "Removing stale name '%s' of "
+                   DFID, name, PFID(id));
+        rc = ListMgr_RemoveName(lmgr, id, &rm_attrs);
+    } else if (!is_dir && ATTR_MASK_TEST(&attrs, nlink)
+               && ATTR(&attrs, nlink) > 1) {
+        /* other links may be in directories that did not change */
+        DisplayLog(LVL_DEBUG, FSSCAN_TAG, "Removing link '%s' of " DFID,
+                   name, PFID(id));
+        rc = ListMgr_Remove(lmgr, id, &rm_attrs, false);
+    } else {
+        if (is_dir)
+            incr_remove_subtree(lmgr, id, nb_removed);
+
+        DisplayLog(LVL_DEBUG, FSSCAN_TAG, "Removing entry '%s' " DFID,
+                   name, PFID(id));
+        last = true;
+        if (has_deletion_policy()) {
+            ATTR_MASK_SET(&rm_attrs, rm_time);
+            ATTR(&rm_attrs, rm_time) = time(NULL);
+            rc = ListMgr_SoftRemove(lmgr, id, &rm_attrs);
+        } else
+            rc = ListMgr_Remove(lmgr, id, &rm_attrs, true);
+    }
+
+    if (rc)
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Failed to remove '%s' " DFID
+                   " from DB (error %d)", name, PFID(id), rc);
+    else {
+        if (last)
+            ListMgr_AcctDelta(lmgr, id, &attrs, NULL);
+        (*nb_removed)++;
+    }
+
+    ListMgr_FreeAttrs(&attrs);
+    ListMgr_FreeAttrs(&rm_attrs);
+}
+
+/**
+ * End of an incremental scan: remove names that disappeared from the
+ * directories that were read.
+ * @return true if the DB is consistent with the filesystem.
+ */
+static bool incr_scan_gc(lmgr_t *lmgr)
+{
+    struct missing_name *m;
+    unsigned int nb_removed = 0;
+    bool ok = !missing_incomplete;
+
+    while ((m = missing_names) != NULL) {
+        missing_names = m->next;
+        incr_remove_entry(lmgr, &m->id, &m->parent_id, m->name, &nb_removed);
+        MemFree(m);
+    }
+    missing_incomplete = false;
+
+    DisplayLog(LVL_EVENT, FSSCAN_TAG, "Incremental scan: %u names removed "
+               "from DB", nb_removed);
+    return ok;
+}
+
 /* Terminate a filesystem scan (called by the thread
  * that terminates the last task of scan, and merge
  * itself to the mother task).
@@ -303,6 +533,7 @@ static int TerminateScan(int scan_complete, time_t end)
     char tmp[1024];
     lmgr_t lmgr;
     bool no_db = false;
+    int rc = 0;
 
     if (ListMgr_InitAccess(&lmgr) != DB_SUCCESS) {
         no_db = true;
@@ -329,9 +560,6 @@ static int TerminateScan(int scan_complete, time_t end)
             ListMgr_SetVar(&lmgr, LAST_SCAN_STATUS,
                            scan_complete ? SCAN_STATUS_DONE :
                            SCAN_STATUS_INCOMPLETE);
-
-        /* no other DB actions, close the connection */
-        ListMgr_CloseAccess(&lmgr);
     }
 
     /* if scan is incomplete (aborted or failed), don't remove old entries
@@ -345,7 +573,8 @@ static int TerminateScan(int scan_complete, time_t end)
         if (!op) {
             DisplayLog(LVL_CRIT, FSSCAN_TAG,
                        "CRITICAL ERROR: Failed to allocate a new op");
-            return -ENOMEM;
+            rc = -ENOMEM;
+            goto out_close;
         }
 
         op->pipeline_stage = entry_proc_descr.GC_OLDENT;
@@ -357,8 +586,11 @@ static int TerminateScan(int scan_complete, time_t end)
         ATTR_MASK_INIT(&op->fs_attrs);
 
         /* if this is an initial scan, don't rm old entries
-         * (but flush pipeline still) */
-        if (fsscan_nogc || (is_first_scan && !partial_scan_root)) {
+         * (but flush pipeline still).
+         * Incremental scans don't see entries of unchanged directories:
+         * missing entries are removed after the flush. */
+        if (fsscan_nogc || scan_incremental
+            || (is_first_scan && !partial_scan_root)) {
             op->gc_entries = 0;
             op->gc_names = 0;
             op->callback_param = (void *)"End of flush";
@@ -396,8 +628,26 @@ static int TerminateScan(int scan_complete, time_t end)
 #else
         EntryProcessor_Release(op);
 #endif
+
+        if (!no_db) {
+            bool consistent = !fsscan_nogc;
+
+            if (scan_incremental && consistent)
+                consistent = incr_scan_gc(&lmgr);
+
+            /* next scan can only be incremental if the DB namespace
+             * is consistent with the filesystem */
+            ListMgr_SetVar(&lmgr, LAST_SCAN_GC, bool2str(consistent));
+        }
     }
 
+out_close:
+    if (!no_db)
+        ListMgr_CloseAccess(&lmgr);
+    free_missing_names();
+    if (rc)
+        return rc;
+
     /* take a lock on scan info */
     P(lock_scan);
 
@@ -432,7 +682,6 @@ static int TerminateScan(int scan_complete, time_t end)
         char *descr = NULL;
         char **cmd;
         char *log_cmd;
-        int rc;
 
         /* substitute special args in completion command.
          * only use global std parameters (no entry attrs, nor action params,
@@ -741,7 +990,8 @@ static void check_dir_error(int rc)
     }
 }
 
-static int create_child_task(const char *childpath, struct stat *inode,
+static int create_child_task(thread_scan_info_t *p_info,
+                             const char *childpath, struct stat *inode,
                              robinhood_task_t *parent,
                              const char *scan_root,
                              const char *entryname)
@@ -778,8 +1028,8 @@ static int create_child_task(const char *childpath, struct stat *inode,
     /* add the task to the parent's subtask list */
     AddChildTask(parent, p_task);
 
-    /* insert task to the stack */
-    InsertTask_to_Stack(&tasks_stack, p_task);
+    /* insert task to the stack of the current thread */
+    InsertTask_to_Stack(&tasks_stack, p_info->index, p_task);
     return 0;
 
  out_free:
@@ -787,6 +1037,16 @@ static int create_child_task(const char *childpath, struct stat *inode,
     return rc;
 }
 
+/** nanoseconds elapsed since start (CLOCK_MONOTONIC) */
+static inline unsigned long long elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000ULL
+           + now.tv_nsec - start->tv_nsec;
+}
+
 static int stat_entry(const char *path, const char *name, int parentfd,
                       struct stat *inode)
 {
@@ -813,13 +1073,17 @@ static int stat_entry(const char *path, const char *name, int parentfd,
     return 0;
 }
 
-/* process a filesystem entry */
+/* process a filesystem entry.
+ * p_stat is the entry attributes if they have already been retrieved,
+ * NULL else. */
 static int process_one_entry(thread_scan_info_t *p_info,
                              robinhood_task_t *p_task,
-                             char *entry_name, int parentfd)
+                             char *entry_name, int parentfd,
+                             const struct stat *p_stat)
 {
     char entry_path[RBH_PATH_MAX];
     struct stat inode;
+    struct timespec start;
     int rc = 0;
     int no_md = 0;
 
@@ -834,7 +1098,15 @@ static int process_one_entry(thread_scan_info_t *p_info,
 
     /* retrieve information about the entry (to know if it's a directory
      * or something else) */
-    rc = stat_entry(entry_path, entry_name, parentfd, &inode);
+    if (p_stat != NULL) {
+        inode = *p_stat;
+        rc = 0;
+    } else {
+        /* only the stat is accounted, to choose the stat method */
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        rc = stat_entry(entry_path, entry_name, parentfd, &inode);
+        p_info->stat_ns += elapsed_ns(&start);
+    }
     if (rc) {
 #ifdef _LUSTRE
         if (is_lustre_fs && (rc == -ESHUTDOWN)) {
@@ -869,7 +1141,8 @@ static int process_one_entry(thread_scan_info_t *p_info,
      * Note: directories are pushed in Thr_scan(), after the closedir() call.
      */
     if (S_ISDIR(inode.st_mode)) {
-        rc = create_child_task(entry_path, &inode, p_task, NULL, entry_name);
+        rc = create_child_task(p_info, entry_path, &inode, p_task, NULL,
+                               entry_name);
         if (rc)
             return rc;
     } else {
@@ -1015,6 +1288,8 @@ static int process_one_entry(thread_scan_info_t *p_info,
 /* directory specific types and accessors */
 #ifndef _NO_AT_FUNC
 #define GETDENTS_BUF_SZ 4096
+/* a dirent64 record takes at least 24 bytes */
+#define GETDENTS_MAX_ENTRIES (GETDENTS_BUF_SZ / 24)
 #define DIR_T int
 #define DIR_FD(_d) (_d)
 #define DIR_ERR(_d) ((_d) < 0)
@@ -1038,21 +1313,392 @@ static inline DIR_T dir_open(const char *path, int pfd, const char *relpath)
 #endif
 }
 
+#ifndef _NO_AT_FUNC
+/** check if entries can be stat'ed asynchronously */
+static bool async_stat_enabled(thread_scan_info_t *p_info,
+                               unsigned int count)
+{
+    if (!fs_scan_config.use_io_uring || p_info->uring_failed
+        || count == 0 || count > SCAN_URING_DEPTH)
+        return false;
+
+#if defined(_LUSTRE) && defined(_MDS_STAT_SUPPORT)
+    if (is_lustre_fs && global_config.direct_mds_stat)
+        return false;
+#endif
+    return true;
+}
+
+/* the slower stat method is tried again every N batches */
+#define URING_PROBE_INTERVAL 64
+
+/**
+ * Choose between asynchronous and synchronous stat for the next batch.
+ *
+ * io_uring always hands statx over to its worker threads, as it can't
+ * be done without blocking. When attributes are in memory (tmpfs, or
+ * local filesystems with a warm cache), this hand-off costs more than
+ * the stat itself, and the synchronous path is faster. So both are
+ * measured, and the faster one is used.
+ */
+static bool use_async_stat(thread_scan_info_t *p_info)
+{
+    bool async_faster;
+
+    /* measure both methods first */
+    if (p_info->uring_entry_ns == 0)
+        return true;
+    if (p_info->sync_entry_ns == 0)
+        return false;
+
+    async_faster = (p_info->uring_entry_ns <= p_info->sync_entry_ns);
+
+    /* the cost of stat changes with the cache state and server load */
+    if (++p_info->uring_probe >= URING_PROBE_INTERVAL) {
+        p_info->uring_probe = 0;
+        return !async_faster;
+    }
+    return async_faster;
+}
+
+/**
+ * Update the average time to stat an entry with the given method.
+ * Only the time spent in stat calls of the batch is accounted
+ * (p_info->stat_ns), not the processing of entries, which can block
+ * on the pipeline.
+ */
+static void update_stat_cost(thread_scan_info_t *p_info, bool async,
+                             unsigned int count)
+{
+    unsigned long long *avg = async ? &p_info->uring_entry_ns
+                                    : &p_info->sync_entry_ns;
+    unsigned long long ns;
+    bool async_faster;
+
+    ns = p_info->stat_ns / count;
+    if (ns == 0)
+        ns = 1;
+
+    async_faster = (p_info->uring_entry_ns <= p_info->sync_entry_ns);
+    *avg = (*avg == 0) ? ns : (7 * *avg + ns) / 8;
+
+    if (p_info->uring_entry_ns != 0 && p_info->sync_entry_ns != 0
+        && async_faster != (p_info->uring_entry_ns <= p_info->sync_entry_ns))
+        DisplayLog(LVL_DEBUG, FSSCAN_TAG, "ThrScan-%d: using %s stat "
+                   "(%lluns/entry vs. %lluns/entry)", p_info->index,
+                   async_faster ? "synchronous" : "asynchronous",
+                   async_faster ? p_info->sync_entry_ns
+                                : p_info->uring_entry_ns,
+                   async_faster ? p_info->uring_entry_ns
+                                : p_info->sync_entry_ns);
+}
+
+/**
+ * Stat entries of a directory asynchronously.
+ * @return true if the results can be retrieved from the thread ring.
+ */
+static bool async_stat(thread_scan_info_t *p_info, int dirfd, char **names,
+                       unsigned int count)
+{
+    struct timespec start;
+    int rc;
+
+    if (p_info->uring == NULL) {
+        p_info->uring = scan_uring_init();
+        if (p_info->uring == NULL) {
+            DisplayLog(LVL_MAJOR, FSSCAN_TAG, "ThrScan-%d: io_uring is not "
+                       "available (%s): using synchronous stat",
+                       p_info->index, strerror(errno));
+            p_info->uring_failed = true;
+            return false;
+        }
+    }
+
+    /* submit the requests and wait for their completion */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = scan_uring_stat(p_info->uring, dirfd, names, count);
+    p_info->stat_ns += elapsed_ns(&start);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "ThrScan-%d: asynchronous stat "
+                   "failed (%s): using synchronous stat", p_info->index,
+                   strerror(-rc));
+        scan_uring_release(p_info->uring);
+        p_info->uring = NULL;
+        p_info->uring_failed = true;
+        return false;
+    }
+    return true;
+}
+#endif
+
+/* number of entry batches waiting to be processed */
+static unsigned int batches_pending = 0;
+
+/** a batch task is terminated */
+static inline void batch_done(void)
+{
+    __atomic_sub_fetch(&batches_pending, 1, __ATOMIC_RELAXED);
+}
+
+#ifndef _NO_AT_FUNC
+/* size of an entry batch for large directories (a few getdents chunks) */
+#define ENTRY_BATCH_SZ  (8 * GETDENTS_BUF_SZ)
+
+/**
+ * Check if entries of a directory should be processed by other threads,
+ * after count entries have been read.
+ */
+static inline bool is_large_dir(unsigned int count)
+{
+    if (fs_scan_config.large_dir_threshold == 0
+        || count < fs_scan_config.large_dir_threshold)
+        return false;
+
+    /* don't read too far ahead of processing threads */
+    return __atomic_load_n(&batches_pending, __ATOMIC_RELAXED)
+                < 4 * fs_scan_config.nb_threads_scan;
+}
+
+/**
+ * Process a set of entries of a directory.
+ * @param count must not exceed GETDENTS_MAX_ENTRIES.
+ */
+static int process_entries(thread_scan_info_t *p_info,
+                           robinhood_task_t *p_dir, char **entries,
+                           unsigned int count, unsigned int *nb_entries,
+                           unsigned int *nb_errors)
+{
+    unsigned int i;
+    bool measure;
+    bool prefetched = false;
+
+    /* notify current activity */
+    p_info->last_action = time(NULL);
+
+    /* get attributes of all entries at once, if it is faster */
+    measure = async_stat_enabled(p_info, count);
+    p_info->stat_ns = 0;
+    if (measure) {
+        if (use_async_stat(p_info))
+            prefetched = async_stat(p_info, p_dir->fd, entries, count);
+    }
+
+    for (i = 0; i < count; i++) {
+        const struct stat *p_stat = NULL;
+
+        /* break ASAP if requested */
+        if (p_info->force_stop) {
+            DisplayLog(LVL_EVENT, FSSCAN_TAG, "Stop requested: "
+                       "cancelling directory scan operation "
+                       "(in '%s')", p_dir->path);
+            return -ECANCELED;
+        }
+
+        (*nb_entries)++;
+
+        /* on error, stat the entry again in process_one_entry(),
+         * so it is handled as usual */
+        if (prefetched
+            && scan_uring_result(p_info->uring, i, &p_stat) != 0)
+            p_stat = NULL;
+
+        /* Handle filesystem entry. */
+        if (process_one_entry(p_info, p_dir, entries[i], p_dir->fd, p_stat))
+            (*nb_errors)++;
+    }
+
+    if (measure)
+        update_stat_cost(p_info, prefetched, count);
+    return 0;
+}
+
+/** process a batch of entries of a large directory */
+static int process_entry_batch(thread_scan_info_t *p_info,
+                               robinhood_task_t *p_dir, char *batch,
+                               unsigned int count, unsigned int *nb_entries,
+                               unsigned int *nb_errors)
+{
+    char *entries[GETDENTS_MAX_ENTRIES];
+    unsigned int n = 0;
+    unsigned int i;
+    int rc;
+
+    for (i = 0; i < count; i++) {
+        entries[n++] = batch;
+        batch += strlen(batch) + 1;
+
+        if (n == GETDENTS_MAX_ENTRIES || i == count - 1) {
+            rc = process_entries(p_info, p_dir, entries, n, nb_entries,
+                                 nb_errors);
+            if (rc)
+                return rc;
+            n = 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Push a batch of entries of a large directory to the task stack,
+ * so it can be processed by any scan thread. The batch is processed
+ * by the current thread if no task can be allocated.
+ * The batch is released in any case.
+ */
+static int flush_batch(thread_scan_info_t *p_info, robinhood_task_t *p_dir,
+                       char *batch, unsigned int count,
+                       unsigned int *nb_entries, unsigned int *nb_dispatched,
+                       unsigned int *nb_errors)
+{
+    robinhood_task_t *p_task;
+    int rc;
+
+    p_task = CreateTask();
+    if (p_task == NULL) {
+        (*nb_dispatched) -= count;
+        rc = process_entry_batch(p_info, p_dir, batch, count, nb_entries,
+                                 nb_errors);
+        MemFree(batch);
+        return rc;
+    }
+
+    p_task->partial_scan_root = p_dir->partial_scan_root;
+    rh_strncpy(p_task->path, p_dir->path, sizeof(p_task->path));
+    p_task->dir_id = p_dir->dir_id;
+    /* same priority as sub-directories */
+    p_task->depth = p_dir->depth + 1;
+    p_task->entry_batch = batch;
+    p_task->batch_count = count;
+    p_task->task_finished = false;
+
+    /* the directory (and its fd) is kept until all batches are processed */
+    AddChildTask(p_dir, p_task);
+
+    __atomic_add_fetch(&batches_pending, 1, __ATOMIC_RELAXED);
+    InsertTask_to_Stack(&tasks_stack, p_info->index, p_task);
+    return 0;
+}
+#endif
+
+/** DB connection of a scan thread (for incremental scans) */
+static lmgr_t *scan_thr_lmgr(thread_scan_info_t *p_info)
+{
+    if (!p_info->lmgr_ok) {
+        if (ListMgr_InitAccess(&p_info->lmgr) != DB_SUCCESS) {
+            DisplayLog(LVL_MAJOR, FSSCAN_TAG, "ThrScan-%d: failed to "
+                       "connect to the database", p_info->index);
+            return NULL;
+        }
+        p_info->lmgr_ok = true;
+    }
+    return &p_info->lmgr;
+}
+
+/**
+ * Check if a directory did not change since it was last read,
+ * according to its mtime and ctime in the DB.
+ */
+static bool dir_unchanged(thread_scan_info_t *p_info,
+                          const robinhood_task_t *p_task)
+{
+    attr_set_t db_attrs = ATTR_SET_INIT;
+    lmgr_t *lmgr;
+    bool unchanged;
+
+    lmgr = scan_thr_lmgr(p_info);
+    if (lmgr == NULL)
+        return false;
+
+    ATTR_MASK_SET(&db_attrs, last_mod);
+    ATTR_MASK_SET(&db_attrs, last_mdchange);
+    ATTR_MASK_SET(&db_attrs, md_update);
+
+    if (ListMgr_Get(lmgr, &p_task->dir_id, &db_attrs) != DB_SUCCESS)
+        return false;
+
+    /* md_update is the time the directory was read: a modification in the
+     * same second may not have been seen. */
+    unchanged = ATTR_MASK_TEST(&db_attrs, last_mod)
+        && ATTR_MASK_TEST(&db_attrs, last_mdchange)
+        && ATTR_MASK_TEST(&db_attrs, md_update)
+        && ATTR(&db_attrs, last_mod) == p_task->dir_md.st_mtime
+        && ATTR(&db_attrs, last_mdchange) == p_task->dir_md.st_ctime
+        && ATTR(&db_attrs, last_mod) < ATTR(&db_attrs, md_update)
+        && ATTR(&db_attrs, last_mdchange) < ATTR(&db_attrs, md_update);
+
+    ListMgr_FreeAttrs(&db_attrs);
+    return unchanged;
+}
+
+/**
+ * Compare the names read in a directory to its children in the DB,
+ * and register missing ones for removal at the end of the scan.
+ */
+static void check_missing_names(thread_scan_info_t *p_info,
+                                robinhood_task_t *p_task, GHashTable *names)
+{
+    wagon_t parent = { p_task->dir_id, p_task->path };
+    wagon_t *child_ids = NULL;
+    attr_set_t *child_attrs = NULL;
+    unsigned int count = 0;
+    unsigned int i;
+    lmgr_t *lmgr;
+    int rc;
+
+    lmgr = scan_thr_lmgr(p_info);
+    if (lmgr == NULL) {
+        missing_incomplete = true;
+        return;
+    }
+
+    rc = ListMgr_GetChild(lmgr, NULL, &parent, 1, null_mask, &child_ids,
+                          &child_attrs, &count);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Failed to list children of %s "
+                   "from DB (error %d)", p_task->path, rc);
+        missing_incomplete = true;
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (!ATTR_MASK_TEST(&child_attrs[i], name))
+            continue;
+        if (g_hash_table_lookup(names, ATTR(&child_attrs[i], name)) == NULL)
+            add_missing_name(&child_ids[i].id, &p_task->dir_id,
+                             ATTR(&child_attrs[i], name));
+    }
+
+    free_child_list(child_ids, child_attrs, count);
+}
+
+/**
+ * Read a directory and process its entries.
+ * Entries handed to other threads are counted in nb_dispatched
+ * instead of nb_entries.
+ */
 static int process_one_dir(robinhood_task_t *p_task,
                            thread_scan_info_t *p_info,
-                           unsigned int *nb_entries, unsigned int *nb_errors)
+                           unsigned int *nb_entries,
+                           unsigned int *nb_dispatched,
+                           unsigned int *nb_errors)
 {
     DIR_T dirp;
 #ifndef _NO_AT_FUNC
     char dirent_buf[GETDENTS_BUF_SZ];
     struct dirent64 *direntry = NULL;
+    /* entries of a large directory not processed yet */
+    char *batch = NULL;
+    size_t batch_len = 0;
+    unsigned int batch_count = 0;
 #else
     struct dirent direntry;
     struct dirent *cookie_rep;
 #endif
+    /* names read in the directory (for incremental scans) */
+    GHashTable *names = NULL;
     int rc = 0;
 
     (*nb_entries) = 0;
+    (*nb_dispatched) = 0;
 
     /* hearbeat before opendir */
     p_info->last_action = time(NULL);
@@ -1074,6 +1720,9 @@ static int process_one_dir(robinhood_task_t *p_task,
                dirp);
     p_task->fd = dirp;
 
+    if (scan_incremental && !fsscan_nogc)
+        names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
     /* hearbeat before first readdir */
     p_info->last_action = time(NULL);
 
@@ -1082,6 +1731,9 @@ static int process_one_dir(robinhood_task_t *p_task,
     direntry = (struct dirent64 *)dirent_buf;
     while ((rc = syscall(SYS_getdents64, dirp, direntry, GETDENTS_BUF_SZ))
                     > 0) {
+        char *entries[GETDENTS_MAX_ENTRIES];
+        unsigned int count = 0;
+        unsigned int i;
         off_t bytepos;
         struct dirent64 *dp;
 
@@ -1092,23 +1744,50 @@ static int process_one_dir(robinhood_task_t *p_task,
             dp = (struct dirent64 *)(dirent_buf + bytepos);
             bytepos += dp->d_reclen;
 
-            /* break ASAP if requested */
-            if (p_info->force_stop) {
-                DisplayLog(LVL_EVENT, FSSCAN_TAG, "Stop requested: "
-                           "cancelling directory scan operation "
-                           "(in '%s')", p_task->path);
-                return -ECANCELED;
-            }
-
             if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
                 continue;
 
-            (*nb_entries)++;
+            entries[count++] = dp->d_name;
+        }
+
+        if (names != NULL) {
+            for (i = 0; i < count; i++) {
+                char *name = g_strdup(entries[i]);
 
-            /* Handle filesystem entry. */
-            if (process_one_entry(p_info, p_task, dp->d_name, DIR_FD(dirp)))
-                (*nb_errors)++;
+                g_hash_table_insert(names, name, name);
+            }
         }
+
+        /* large directory: let other threads process its entries */
+        if (batch == NULL && is_large_dir(*nb_entries + *nb_dispatched)) {
+            batch = MemAlloc(ENTRY_BATCH_SZ);
+            batch_len = batch_count = 0;
+        }
+        if (batch != NULL) {
+            for (i = 0; i < count; i++) {
+                size_t len = strlen(entries[i]) + 1;
+
+                memcpy(batch + batch_len, entries[i], len);
+                batch_len += len;
+            }
+            batch_count += count;
+            (*nb_dispatched) += count;
+
+            /* a getdents chunk may not fit anymore */
+            if (ENTRY_BATCH_SZ - batch_len < GETDENTS_BUF_SZ) {
+                rc = flush_batch(p_info, p_task, batch, batch_count,
+                                 nb_entries, nb_dispatched, nb_errors);
+                batch = NULL;
+                if (rc)
+                    goto out;
+            }
+            continue;
+        }
+
+        rc = process_entries(p_info, p_task, entries, count, nb_entries,
+                             nb_errors);
+        if (rc)
+            goto out;
     }
     /* rc == 0 => end of dir */
     if (rc < 0) {
@@ -1117,6 +1796,19 @@ static int process_one_dir(robinhood_task_t *p_task,
                    p_task->path, strerror(rc));
         (*nb_errors)++;
     }
+
+    /* last entries read */
+    if (batch != NULL) {
+        int rc2;
+
+        rc2 = flush_batch(p_info, p_task, batch, batch_count, nb_entries,
+                          nb_dispatched, nb_errors);
+        batch = NULL;
+        if (rc2 == -ECANCELED) {
+            rc = rc2;
+            goto out;
+        }
+    }
 #else
     /* read entries one by one */
     while (1) {
@@ -1132,7 +1824,8 @@ static int process_one_dir(robinhood_task_t *p_task,
             DisplayLog(LVL_EVENT, FSSCAN_TAG, "Stop requested: "
                        "cancelling directory scan operation (in '%s')",
                        p_task->path);
-            return -ECANCELED;
+            rc = -ECANCELED;
+            goto out;
         } else if (rc != 0) {
             DisplayLog(LVL_CRIT, FSSCAN_TAG, "ERROR reading directory %s (%s)",
                        p_task->path, strerror(rc));
@@ -1145,17 +1838,117 @@ static int process_one_dir(robinhood_task_t *p_task,
 
         (*nb_entries)++;
 
+        if (names != NULL) {
+            char *name = g_strdup(direntry.d_name);
+
+            g_hash_table_insert(names, name, name);
+        }
+
 #ifdef SIMUL_HANGS
         /* simulate a hang */
         sleep(20 * p_task->depth);
 #endif
 
         /* Handle filesystem entry. */
-        if (process_one_entry(p_info, p_task, direntry.d_name, dirfd(dirp)))
+        if (process_one_entry(p_info, p_task, direntry.d_name, dirfd(dirp),
+                              NULL))
             (*nb_errors)++;
 
     }   /* end of dir */
 #endif
+
+    /* names are only known to be missing if the whole directory was read */
+    if (names != NULL && rc == 0)
+        check_missing_names(p_info, p_task, names);
+    else if (names != NULL)
+        missing_incomplete = true;
+
+ out:
+#ifndef _NO_AT_FUNC
+    if (batch != NULL)
+        MemFree(batch);
+#endif
+    if (names != NULL)
+        g_hash_table_destroy(names);
+    return rc;
+}
+
+/**
+ * Incremental scan of a directory that did not change since it was last
+ * read: its sub-directories are known from the DB, and its other entries
+ * are not processed.
+ */
+static int process_unchanged_dir(robinhood_task_t *p_task,
+                                 thread_scan_info_t *p_info,
+                                 unsigned int *nb_entries,
+                                 unsigned int *nb_dispatched,
+                                 unsigned int *nb_errors)
+{
+    wagon_t parent = { p_task->dir_id, p_task->path };
+    wagon_t *child_ids = NULL;
+    attr_set_t *child_attrs = NULL;
+    unsigned int count = 0;
+    unsigned int i;
+    lmgr_filter_t filter;
+    filter_value_t fv;
+    DIR_T dirp;
+    int rc;
+
+    (*nb_entries) = 0;
+    (*nb_dispatched) = 0;
+
+    /* only get subdirs */
+    fv.value.val_str = STR_TYPE_DIR;
+    lmgr_simple_filter_init(&filter);
+    lmgr_simple_filter_add(&filter, ATTR_INDEX_type, EQUAL, fv, 0);
+
+    rc = ListMgr_GetChild(&p_info->lmgr, &filter, &parent, 1, null_mask,
+                          &child_ids, &child_attrs, &count);
+    lmgr_simple_filter_free(&filter);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Failed to list sub-directories "
+                   "of %s from DB (error %d): reading it", p_task->path, rc);
+        return process_one_dir(p_task, p_info, nb_entries, nb_dispatched,
+                               nb_errors);
+    }
+
+    /* sub-directories are looked up relatively to this one */
+    p_info->last_action = time(NULL);
+    dirp = dir_open(p_task->path,
+                    p_task->parent_task ? p_task->parent_task->fd : -1,
+                    p_task->relpath);
+    if (DIR_ERR(dirp)) {
+        rc = -errno;
+        DisplayLog(LVL_CRIT, FSSCAN_TAG,
+                   OPENDIR_STR " failed on %s (%s)",
+                   p_task->path, strerror(-rc));
+        (*nb_errors)++;
+        check_dir_error(rc);
+        goto out;
+    }
+    p_task->fd = dirp;
+
+    for (i = 0; i < count; i++) {
+        if (p_info->force_stop) {
+            DisplayLog(LVL_EVENT, FSSCAN_TAG, "Stop requested: "
+                       "cancelling directory scan operation (in '%s')",
+                       p_task->path);
+            rc = -ECANCELED;
+            goto out;
+        }
+        if (!ATTR_MASK_TEST(&child_attrs[i], name))
+            continue;
+
+        p_info->last_action = time(NULL);
+        (*nb_entries)++;
+
+        if (process_one_entry(p_info, p_task, ATTR(&child_attrs[i], name),
+                              DIR_FD(dirp), NULL))
+            (*nb_errors)++;
+    }
+
+ out:
+    free_child_list(child_ids, child_attrs, count);
     return rc;
 }
 
@@ -1163,7 +1956,8 @@ static int process_one_dir(robinhood_task_t *p_task,
  * If scan is restricted to a list of subdirectories, create 1 task
  * per subdirectory.
  */
-static int push_dir_list(robinhood_task_t *parent_task)
+static int push_dir_list(thread_scan_info_t *p_info,
+                         robinhood_task_t *parent_task)
 {
     int i, rc;
 
@@ -1210,7 +2004,7 @@ static int push_dir_list(robinhood_task_t *parent_task)
         DisplayLog(LVL_FULL, FSSCAN_TAG, "Pushing dir '%s' to reach "
                    "sub-tree '%s'", new_task_path, fs_scan_config.dir_list[i]);
 
-        rc = create_child_task(new_task_path, &inode,
+        rc = create_child_task(p_info, new_task_path, &inode,
                                parent_task, fs_scan_config.dir_list[i], NULL);
         free(new_task_path);
         if (rc)
@@ -1225,6 +2019,11 @@ static int process_one_task(robinhood_task_t *p_task,
                             unsigned int *nb_entries, unsigned int *nb_errors)
 {
     int rc;
+    /* directory content is known from the DB */
+    bool unchanged = false;
+    /* entries of a large directory handled by other threads */
+    unsigned int nb_dispatched = 0;
+    time_t read_time;
 #ifdef _BENCH_DB
     /* to map entry_id_t to an integer  we can increment */
     struct id_map {
@@ -1236,6 +2035,14 @@ static int process_one_task(robinhood_task_t *p_task,
         return 0;
 #endif
 
+#ifndef _NO_AT_FUNC
+    /* entries of a large directory read by another thread */
+    if (p_task->entry_batch != NULL)
+        return process_entry_batch(p_info, p_task->parent_task,
+                                   p_task->entry_batch, p_task->batch_count,
+                                   nb_entries, nb_errors);
+#endif
+
     /* if this is the root task, check that the filesystem is still mounted */
     if (p_task->parent_task == NULL) {
         /* retrieve filesystem device id */
@@ -1256,6 +2063,9 @@ static int process_one_task(robinhood_task_t *p_task,
         }
     }
 
+    /* directory attributes were retrieved before this time */
+    read_time = time(NULL);
+
     /* As long as the current task path is (strictly)
      * upper than partial scan root: just lookup, no readdir */
      if (p_task->partial_scan_root &&
@@ -1289,7 +2099,7 @@ static int process_one_task(robinhood_task_t *p_task,
         DisplayLog(LVL_DEBUG, FSSCAN_TAG, "Partial scan: processing '%s' in %s",
                    name, p_task->path);
 
-        rc = process_one_entry(p_info, p_task, name, -1);
+        rc = process_one_entry(p_info, p_task, name, -1, NULL);
         if (rc) {
             (*nb_errors)++;
             return rc;
@@ -1297,7 +2107,7 @@ static int process_one_task(robinhood_task_t *p_task,
     } else if (p_task->depth == 0 && fs_scan_config.dir_count > 0) {
         /* If scan is restricted to subdirectories, create child tasks under
          * mother task */
-        rc = push_dir_list(p_task);
+        rc = push_dir_list(p_info, p_task);
         if (rc) {
             (*nb_errors)++;
             return rc;
@@ -1309,8 +2119,18 @@ static int process_one_task(robinhood_task_t *p_task,
     else if (p_task->depth == 0)
 #endif
     {
-        /* read the directory and process each entry */
-        rc = process_one_dir(p_task, p_info, nb_entries, nb_errors);
+        /* root directory is always read */
+        if (scan_incremental && p_task->depth > 0
+            && dir_unchanged(p_info, p_task)) {
+            unchanged = true;
+            p_info->dirs_unchanged++;
+            rc = process_unchanged_dir(p_task, p_info, nb_entries,
+                                       &nb_dispatched, nb_errors);
+        } else {
+            /* read the directory and process each entry */
+            rc = process_one_dir(p_task, p_info, nb_entries, &nb_dispatched,
+                                 nb_errors);
+        }
         if (rc)
             return rc;
     }
@@ -1383,8 +2203,11 @@ static int process_one_task(robinhood_task_t *p_task,
             /* depth(/tmp/toto) = 0 */
             ATTR(&op->fs_attrs, depth) = p_task->depth - 1;
 
-            ATTR_MASK_SET(&op->fs_attrs, dircount);
-            ATTR(&op->fs_attrs, dircount) = *nb_entries;
+            /* only sub-directories were counted in unchanged directories */
+            if (!unchanged) {
+                ATTR_MASK_SET(&op->fs_attrs, dircount);
+                ATTR(&op->fs_attrs, dircount) = *nb_entries + nb_dispatched;
+            }
 
 #ifndef _BENCH_PIPELINE
 #if defined(_LUSTRE) && defined(_MDS_STAT_SUPPORT)
@@ -1418,11 +2241,12 @@ static int process_one_task(robinhood_task_t *p_task,
 
             p_info->entries_handled++;
 #endif
-            /* set update time  */
+            /* set update time: the directory content is the one of
+             * read_time, so incremental scans can detect later changes */
             ATTR_MASK_SET(&op->fs_attrs, md_update);
             ATTR_MASK_SET(&op->fs_attrs, path_update);
             ATTR(&op->fs_attrs, md_update) = ATTR(&op->fs_attrs, path_update)
-                = time(NULL);
+                = read_time;
 
             op->extra_info_is_set = 0;
 
@@ -1453,6 +2277,7 @@ static void *Thr_scan(void *arg_thread)
 
     unsigned int nb_entries = 0;
     unsigned int nb_errors = 0;
+    bool stolen;
 
     /* Initialize buddy management */
 #ifdef _BUDDY_MALLOC
@@ -1470,7 +2295,7 @@ static void *Thr_scan(void *arg_thread)
                    p_info->index);
 
         /* take a task from queue */
-        p_task = GetTask_from_Stack(&tasks_stack);
+        p_task = GetTask_from_Stack(&tasks_stack, p_info->index, &stolen);
 
         /* skip it if the thread was requested to stop */
         if (p_info->force_stop)
@@ -1507,6 +2332,14 @@ static void *Thr_scan(void *arg_thread)
         timeradd(&diff, &p_info->time_consumed, &p_info->time_consumed);
         p_info->entries_handled += nb_entries;
         p_info->entries_errors += nb_errors;
+        if (p_task->entry_batch != NULL) {
+            p_info->batches_handled++;
+            batch_done();
+        } else {
+            p_info->dirs_handled++;
+            if (stolen)
+                p_info->dirs_stolen++;
+        }
 
         /* make an average on directory entries */
         if (nb_entries > 0) {
@@ -1567,7 +2400,7 @@ int Robinhood_InitScanModule(void)
 
     /* initializing task stack */
 
-    st = InitTaskStack(&tasks_stack);
+    st = InitTaskStack(&tasks_stack, fs_scan_config.nb_threads_scan);
     if (st)
         return st;
 
@@ -1666,6 +2499,45 @@ void Robinhood_StopScanModule(void)
     }
 }
 
+/**
+ * Check if the scan can be incremental: the DB must be consistent with
+ * the filesystem at the end of the previous scan.
+ * This must be called before the scan status is changed.
+ */
+static bool incremental_allowed(lmgr_t *lmgr)
+{
+    char value[128];
+
+    if (!fs_scan_config.incremental_scan)
+        return false;
+
+#ifdef _NO_AT_FUNC
+    DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Incremental scan is not supported "
+               "on this platform: running a full scan");
+    return false;
+#endif
+
+    /* rbh-diff must see all entries */
+    if (entry_proc_pipeline != std_pipeline)
+        return false;
+
+    if (partial_scan_root) {
+        DisplayLog(LVL_EVENT, FSSCAN_TAG, "Partial scan: all directories "
+                   "are read");
+        return false;
+    }
+
+    if (ListMgr_GetVar(lmgr, LAST_SCAN_STATUS, value, sizeof(value))
+            != DB_SUCCESS || strcmp(value, SCAN_STATUS_DONE)
+        || ListMgr_GetVar(lmgr, LAST_SCAN_GC, value, sizeof(value))
+            != DB_SUCCESS || strcmp(value, bool2str(true))) {
+        DisplayLog(LVL_EVENT, FSSCAN_TAG, "Previous scan was not complete "
+                   "or did not clean the DB: running a full scan");
+        return false;
+    }
+    return true;
+}
+
 /* Start a scan of the filesystem.
  * This creates a root task and push it to the stack of tasks.
  * @param partial_root NULL for full scan; subdir path for partial scan
@@ -1735,7 +2607,12 @@ static int StartScan(void)
                    "WARNING: won't be able to update scan stats");
     }
 
+    scan_incremental = false;
+    free_missing_names();
+
     if (!no_db) {
+        scan_incremental = incremental_allowed(&lmgr);
+
         /* archive previous scan start/end time */
         if (ListMgr_GetVar
             (&lmgr, LAST_SCAN_START_TIME, timestamp,
@@ -1761,6 +2638,7 @@ static int StartScan(void)
 
         if ((rc == DB_SUCCESS) && (count == 0)) {
             is_first_scan = true;
+            scan_incremental = false;
             DisplayLog(LVL_EVENT, FSSCAN_TAG,
                        "Notice: this is the first scan (DB is empty)");
         } else if (rc)
@@ -1774,6 +2652,10 @@ static int StartScan(void)
         ListMgr_CloseAccess(&lmgr);
     }
 
+    if (scan_incremental)
+        DisplayLog(LVL_EVENT, FSSCAN_TAG, "Incremental scan: only reading "
+                   "directories modified since the previous scan");
+
     /* reset threads stats */
     ResetScanStats(false);
 
@@ -1783,8 +2665,8 @@ static int StartScan(void)
     /* start batching alerts */
     Alert_StartBatching();
 
-    /* insert first task in stack */
-    InsertTask_to_Stack(&tasks_stack, p_parent_task);
+    /* insert first task in stack (of the first thread) */
+    InsertTask_to_Stack(&tasks_stack, 0, p_parent_task);
 
     /* indicates that a scan started in logs */
     FlushLogs();
@@ -1814,6 +2696,19 @@ static void *Thr_scan_recovery(void *arg_thread)
     }
 #endif
 
+    /* the ring may have been left with pending requests */
+    scan_uring_release(p_info->uring);
+    p_info->uring = NULL;
+
+    if (p_info->current_task->entry_batch != NULL)
+        batch_done();
+
+    /* the DB connection may have been interrupted during a request */
+    if (p_info->lmgr_ok) {
+        ListMgr_CloseAccess(&p_info->lmgr);
+        p_info->lmgr_ok = false;
+    }
+
     /* terminate and free current task */
     st = RecursiveTaskTermination(p_info, p_info->current_task, false);
     if (st) {
@@ -2106,6 +3001,10 @@ void Robinhood_StatsScan(robinhood_fsscan_stat_t *p_stats)
 
         p_stats->scanned_entries = 0;
         p_stats->error_count = 0;
+        p_stats->scanned_dirs = 0;
+        p_stats->stolen_dirs = 0;
+        p_stats->unchanged_dirs = 0;
+        p_stats->entry_batches = 0;
         p_stats->scan_running = true;
         p_stats->start_time = scan_start_time;
 
@@ -2125,6 +3024,10 @@ void Robinhood_StatsScan(robinhood_fsscan_stat_t *p_stats)
                 nb_done++;
             }
             p_stats->error_count += thread_list[i].entries_errors;
+            p_stats->scanned_dirs += thread_list[i].dirs_handled;
+            p_stats->stolen_dirs += thread_list[i].dirs_stolen;
+            p_stats->unchanged_dirs += thread_list[i].dirs_unchanged;
+            p_stats->entry_batches += thread_list[i].batches_handled;
         }
 
         p_stats->last_action = last_action;
@@ -2146,6 +3049,13 @@ void Robinhood_StatsScan(robinhood_fsscan_stat_t *p_stats)
         else
             p_stats->curr_ms_per_entry = 0.0;
 
+        /* directory throughput of a thread */
+        if (timerisset(&total_time))
+            p_stats->dirs_per_sec_per_thread = p_stats->scanned_dirs /
+                (total_time.tv_sec + 1E-6 * total_time.tv_usec);
+        else
+            p_stats->dirs_per_sec_per_thread = 0.0;
+
     } else {
         p_stats->scan_running = false;
         p_stats->start_time = 0;
@@ -2154,6 +3064,11 @@ void Robinhood_StatsScan(robinhood_fsscan_stat_t *p_stats)
         p_stats->error_count = 0;
         p_stats->avg_ms_per_entry = 0.0;
         p_stats->curr_ms_per_entry = 0.0;
+        p_stats->scanned_dirs = 0;
+        p_stats->stolen_dirs = 0;
+        p_stats->unchanged_dirs = 0;
+        p_stats->entry_batches = 0;
+        p_stats->dirs_per_sec_per_thread = 0.0;
     }
 
     p_stats->nb_hang = nb_hang_total;
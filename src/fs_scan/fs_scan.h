@@ -52,6 +52,16 @@ typedef struct robinhood_fsscan_stat__ {
     double          avg_ms_per_entry;
     double          curr_ms_per_entry;
 
+    /* directories scanned, and taken from the stack of another thread */
+    unsigned int    scanned_dirs;
+    unsigned int    stolen_dirs;
+    /* directories not read by incremental scan */
+    unsigned int    unchanged_dirs;
+    /* batches of entries of large directories */
+    unsigned int    entry_batches;
+    /* directories handled per second of thread activity */
+    double          dirs_per_sec_per_thread;
+
 } robinhood_fsscan_stat_t;
 
 /**
@@ -222,6 +222,20 @@ void FSScan_DumpStats(void)
                                                                   start_time),
                            stats.avg_ms_per_entry);
         }
+
+        if (stats.scanned_dirs)
+            DisplayLog(LVL_MAJOR, "STATS",
+                       "     directories: %u scanned (%u stolen by idle threads), %.2f dirs/sec/thread",
+                       stats.scanned_dirs, stats.stolen_dirs,
+                       stats.dirs_per_sec_per_thread);
+        if (stats.entry_batches)
+            DisplayLog(LVL_MAJOR, "STATS",
+                       "     large directories: %u batches of entries processed in parallel",
+                       stats.entry_batches);
+        if (stats.unchanged_dirs)
+            DisplayLog(LVL_MAJOR, "STATS",
+                       "     unchanged directories (not read): %u",
+                       stats.unchanged_dirs);
     }
 
     if (stats.nb_hang > 0)
@@ -258,6 +272,9 @@ static void fs_scan_cfg_set_default(void *module_config)
     conf->exit_on_timeout = false;
     conf->spooler_check_interval = MINUTE;
     conf->nb_prealloc_tasks = 256;
+    conf->use_io_uring = false;
+    conf->incremental_scan = false;
+    conf->large_dir_threshold = 100000;
 
     conf->ignore_list = NULL;
     conf->ignore_count = 0;
@@ -281,6 +298,9 @@ static void fs_scan_cfg_write_default(FILE *output)
     print_line(output, 1, "exit_on_timeout        :    no");
     print_line(output, 1, "spooler_check_interval :  1min");
     print_line(output, 1, "nb_prealloc_tasks      :   256");
+    print_line(output, 1, "use_io_uring           :    no");
+    print_line(output, 1, "incremental_scan       :    no");
+    print_line(output, 1, "large_dir_threshold    : 100000");
     print_line(output, 1, "ignore                 :  NONE");
     print_line(output, 1, "dir_list               :  NONE");
     print_line(output, 1, "completion_command     :  NONE");
@@ -340,8 +360,8 @@ static int fs_scan_cfg_read(config_file_t config, void *module_config,
         "scan_interval", "min_scan_interval", "max_scan_interval",
         "scan_retry_delay", "nb_threads_scan", "scan_op_timeout",
         "exit_on_timeout", "spooler_check_interval", "nb_prealloc_tasks",
-        "completion_command", "scan_only",
-        IGNORE_BLOCK, NULL
+        "completion_command", "scan_only", "use_io_uring",
+        "incremental_scan", "large_dir_threshold", IGNORE_BLOCK, NULL
     };
 
     const cfg_param_t cfg_params[] = {
@@ -356,6 +376,10 @@ static int fs_scan_cfg_read(config_file_t config, void *module_config,
          &conf->spooler_check_interval, 0},
         {"nb_prealloc_tasks", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
          &conf->nb_prealloc_tasks, 0},
+        {"use_io_uring", PT_BOOL, 0, &conf->use_io_uring, 0},
+        {"incremental_scan", PT_BOOL, 0, &conf->incremental_scan, 0},
+        {"large_dir_threshold", PT_INT, PFLG_POSITIVE,
+         &conf->large_dir_threshold, 0},
         /* completion command can contain wildcards: {cfg}, {fspath} ... */
         {"completion_command", PT_CMD, 0,
          &conf->completion_command, 0},
@@ -568,6 +592,31 @@ static int fs_scan_cfg_reload(fs_scan_config_t *conf)
         fs_scan_config.exit_on_timeout = conf->exit_on_timeout;
     }
 
+    if (conf->use_io_uring != fs_scan_config.use_io_uring) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK "::use_io_uring updated: %s->%s",
+                   bool2str(fs_scan_config.use_io_uring),
+                   bool2str(conf->use_io_uring));
+        fs_scan_config.use_io_uring = conf->use_io_uring;
+    }
+
+    /* taken into account at the beginning of next scan */
+    if (conf->incremental_scan != fs_scan_config.incremental_scan) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK "::incremental_scan updated: %s->%s",
+                   bool2str(fs_scan_config.incremental_scan),
+                   bool2str(conf->incremental_scan));
+        fs_scan_config.incremental_scan = conf->incremental_scan;
+    }
+
+    if (conf->large_dir_threshold != fs_scan_config.large_dir_threshold) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK "::large_dir_threshold updated: %u->%u",
+                   fs_scan_config.large_dir_threshold,
+                   conf->large_dir_threshold);
+        fs_scan_config.large_dir_threshold = conf->large_dir_threshold;
+    }
+
     if (conf->spooler_check_interval != fs_scan_config.spooler_check_interval) {
         DisplayLog(LVL_EVENT, "FS_Scan_Config",
                    FSSCAN_CONFIG_BLOCK
@@ -666,6 +715,24 @@ static void fs_scan_cfg_write_template(FILE *output)
     print_line(output, 1, "# Memory preallocation parameters");
     print_line(output, 1, "nb_prealloc_tasks      =   256 ;");
     fprintf(output, "\n");
+    print_line(output, 1,
+               "# get attributes of directory entries by batches, using io_uring");
+    print_line(output, 1,
+               "# (if the system does not support it, or if it is slower, entries");
+    print_line(output, 1, "# are stat'ed one by one)");
+    print_line(output, 1, "use_io_uring           =    no ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# only read directories that changed since the previous scan");
+    print_line(output, 1,
+               "# (attribute changes of files in unchanged directories are missed)");
+    print_line(output, 1, "incremental_scan       =    no ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# entries of directories larger than this are dispatched to all scan threads");
+    print_line(output, 1, "# (0 = a directory is always read and processed by a single thread)");
+    print_line(output, 1, "large_dir_threshold    = 100000 ;");
+    fprintf(output, "\n");
     print_begin_block(output, 1, IGNORE_BLOCK, NULL);
     print_line(output, 2,
                "# ignore \".snapshot\" and \".snapdir\" directories (don't scan them)");
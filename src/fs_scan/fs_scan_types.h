@@ -36,6 +36,12 @@ typedef struct robinhood_task__ {
     /* fd to directory, kept until the task is freed for child tasks */
     int fd;
 
+    /* entries of a large directory to be processed by another thread
+     * (NULL for directory tasks): batch_count names separated by '\0'.
+     * The parent task is the directory. */
+    char           *entry_batch;
+    unsigned int    batch_count;
+
     /* the relative depth of the directory to be read */
     unsigned int    depth;
 
@@ -88,12 +94,14 @@ typedef struct robinhood_task__ {
  */
 #define MAX_TASK_DEPTH  255
 
-/* A stack of tasks ordered by depth,
- * handled by 'task_stack_mngmt' routines.
+/* A stack of tasks ordered by depth, owned by a scan thread.
+ * Other threads can steal tasks from it when their own stack is empty.
  */
-typedef struct tasks_stack__ {
-    pthread_mutex_t     stack_lock; /* lock on the stack */
-    sem_t               sem_tasks;  /* token for available tasks */
+typedef struct task_deque__ {
+    pthread_mutex_t     lock;
+
+    /* number of tasks in the stack (read without lock by thieves) */
+    unsigned int        nb_tasks;
 
     /* Indicates the depth for the first task available */
     unsigned int        max_task_depth;
@@ -101,6 +109,19 @@ typedef struct tasks_stack__ {
     /* list of tasks, ordered by depth */
     robinhood_task_t   *tasks_at_depth[MAX_TASK_DEPTH + 1];
 
+    /* avoid false sharing between threads */
+    char                pad[64];
+
+} task_deque_t;
+
+/* Per-thread stacks of tasks, handled by 'task_stack_mngmt' routines.
+ */
+typedef struct tasks_stack__ {
+    sem_t               sem_tasks;  /* token for available tasks */
+
+    unsigned int        nb_deques;
+    task_deque_t       *deques;     /* one per scan thread */
+
 } task_stack_t;
 
 #endif
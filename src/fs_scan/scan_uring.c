@@ -0,0 +1,272 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Asynchronous stat of directory entries, using io_uring.
+ *
+ * A scan thread submits a statx request for each entry of a getdents
+ * buffer at once, and waits for all of them to complete, instead of
+ * waiting for each stat in turn. The ring is used through raw system calls,
+ * so there is no dependency to liburing.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "scan_uring.h"
+
+#ifdef HAVE_SCAN_URING
+
+#include "Memory.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+
+struct scan_uring {
+    int             fd;
+
+    /* submission queue */
+    unsigned int   *sq_tail;
+    unsigned int   *sq_mask;
+    unsigned int   *sq_array;
+    struct io_uring_sqe *sqes;
+
+    /* completion queue */
+    unsigned int   *cq_head;
+    unsigned int   *cq_tail;
+    unsigned int   *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* mappings */
+    void           *sq_ptr;
+    size_t          sq_size;
+    void           *cq_ptr;
+    size_t          cq_size;
+    size_t          sqes_size;
+
+    /* results of the last batch */
+    struct statx    stx[SCAN_URING_DEPTH];
+    struct stat     st[SCAN_URING_DEPTH];
+    int             rc[SCAN_URING_DEPTH];
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   NULL, 0);
+}
+
+struct scan_uring *scan_uring_init(void)
+{
+    struct scan_uring *ring;
+    struct io_uring_params p;
+    int err;
+
+    ring = MemCalloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memset(&p, 0, sizeof(p));
+    ring->fd = sys_io_uring_setup(SCAN_URING_DEPTH, &p);
+    if (ring->fd < 0)
+        goto free_ring;
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_size = p.cq_off.cqes
+        + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto close_fd;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+            goto unmap_sq;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto unmap_cq;
+
+    ring->sq_tail = ring->sq_ptr + p.sq_off.tail;
+    ring->sq_mask = ring->sq_ptr + p.sq_off.ring_mask;
+    ring->sq_array = ring->sq_ptr + p.sq_off.array;
+    ring->cq_head = ring->cq_ptr + p.cq_off.head;
+    ring->cq_tail = ring->cq_ptr + p.cq_off.tail;
+    ring->cq_mask = ring->cq_ptr + p.cq_off.ring_mask;
+    ring->cqes = ring->cq_ptr + p.cq_off.cqes;
+
+    return ring;
+
+ unmap_cq:
+    err = errno;
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    errno = err;
+ unmap_sq:
+    err = errno;
+    munmap(ring->sq_ptr, ring->sq_size);
+    errno = err;
+ close_fd:
+    err = errno;
+    close(ring->fd);
+    errno = err;
+ free_ring:
+    err = errno;
+    MemFree(ring);
+    errno = err;
+    return NULL;
+}
+
+void scan_uring_release(struct scan_uring *ring)
+{
+    if (ring == NULL)
+        return;
+
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    MemFree(ring);
+}
+
+static void statx2stat(const struct statx *stx, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino = stx->stx_ino;
+    st->st_mode = stx->stx_mode;
+    st->st_nlink = stx->stx_nlink;
+    st->st_uid = stx->stx_uid;
+    st->st_gid = stx->stx_gid;
+    st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+    st->st_size = stx->stx_size;
+    st->st_blksize = stx->stx_blksize;
+    st->st_blocks = stx->stx_blocks;
+    st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+int scan_uring_stat(struct scan_uring *ring, int dirfd, char *const *names,
+                    unsigned int count)
+{
+    unsigned int tail, mask = *ring->sq_mask;
+    unsigned int i, submitted = 0, done = 0, nb_inval = 0;
+
+    if (count > SCAN_URING_DEPTH)
+        return -EINVAL;
+    if (count == 0)
+        return 0;
+
+    /* we are the only producer: no need for an atomic read */
+    tail = *ring->sq_tail;
+    for (i = 0; i < count; i++) {
+        unsigned int idx = tail & mask;
+        struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = dirfd;
+        sqe->addr = (unsigned long)names[i];
+        sqe->len = STATX_BASIC_STATS;
+        sqe->off = (unsigned long)&ring->stx[i];
+        sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        sqe->user_data = i;
+        ring->sq_array[idx] = idx;
+        tail++;
+    }
+    /* make entries visible to the kernel */
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    while (done < count) {
+        unsigned int head, cq_tail;
+        int rc;
+
+        rc = sys_io_uring_enter(ring->fd, count - submitted, 1,
+                                IORING_ENTER_GETEVENTS);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            /* results of submitted requests must still be reaped
+             * before the ring can be used again: give up with it */
+            return -errno;
+        }
+        submitted += rc;
+
+        /* reap completions */
+        head = *ring->cq_head;
+        cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != cq_tail) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+            i = cqe->user_data;
+            ring->rc[i] = cqe->res;
+            if (cqe->res == 0)
+                statx2stat(&ring->stx[i], &ring->st[i]);
+            else if (cqe->res == -EINVAL)
+                nb_inval++;
+            head++;
+            done++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    /* statx operation is not supported by this kernel */
+    if (nb_inval == count)
+        return -EOPNOTSUPP;
+
+    return 0;
+}
+
+int scan_uring_result(struct scan_uring *ring, unsigned int i,
+                      const struct stat **p_stat)
+{
+    if (ring->rc[i] == 0)
+        *p_stat = &ring->st[i];
+    return ring->rc[i];
+}
+
+#endif
@@ -0,0 +1,90 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Asynchronous stat of directory entries, using io_uring.
+ */
+#ifndef _SCAN_URING_H
+#define _SCAN_URING_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <stddef.h>
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_STATX)
+#define HAVE_SCAN_URING 1
+#endif
+
+/** max number of entries that can be stat'ed at once */
+#define SCAN_URING_DEPTH 256
+
+struct scan_uring;
+
+#ifdef HAVE_SCAN_URING
+
+/**
+ * Create a ring for the calling thread.
+ * @return NULL if io_uring is not available (errno is set).
+ */
+struct scan_uring *scan_uring_init(void);
+
+/** release ring resources */
+void scan_uring_release(struct scan_uring *ring);
+
+/**
+ * Stat the given entries of a directory, all at once
+ * (AT_SYMLINK_NOFOLLOW). Results are retrieved by scan_uring_result().
+ * @param count number of names (at most SCAN_URING_DEPTH).
+ * @return 0 on success, a negative error code if the ring can't be used.
+ */
+int scan_uring_stat(struct scan_uring *ring, int dirfd, char *const *names,
+                    unsigned int count);
+
+/**
+ * Get the result of the stat of the i-th entry of the last batch.
+ * @return 0 and set *p_stat on success, a negative error code else.
+ */
+int scan_uring_result(struct scan_uring *ring, unsigned int i,
+                      const struct stat **p_stat);
+
+#else
+
+static inline struct scan_uring *scan_uring_init(void)
+{
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static inline void scan_uring_release(struct scan_uring *ring)
+{
+}
+
+static inline int scan_uring_stat(struct scan_uring *ring, int dirfd,
+                                  char *const *names, unsigned int count)
+{
+    return -ENOTSUP;
+}
+
+static inline int scan_uring_result(struct scan_uring *ring, unsigned int i,
+                                    const struct stat **p_stat)
+{
+    return -ENOTSUP;
+}
+
+#endif
+
+#endif
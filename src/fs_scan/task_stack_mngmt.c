@@ -14,6 +14,11 @@
 /**
  * Module for managing FS scan tasks as a stack
  * with priorities on entry depth.
+ *
+ * Each scan thread has its own stack: child tasks are pushed to the stack
+ * of the thread that read their parent, which takes them back first
+ * (depth first, for locality and to bound the number of pending tasks).
+ * A thread with an empty stack steals the deepest task of other threads.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -24,27 +29,45 @@
 #include "task_stack_mngmt.h"
 #include "rbh_logs.h"
 #include "rbh_misc.h"
+#include "Memory.h"
+
+#include <sched.h>
+#include <errno.h>
 
 /* Initialize a stack of tasks */
-int InitTaskStack(task_stack_t *p_stack)
+int InitTaskStack(task_stack_t *p_stack, unsigned int nb_threads)
 {
-    unsigned int index;
+    unsigned int i, index;
     int rc;
 
-    /* initialize each level of the priority stack */
-    for (index = 0; index <= MAX_TASK_DEPTH; index++) {
-        p_stack->tasks_at_depth[index] = NULL;
-    }
+    if (nb_threads == 0)
+        nb_threads = 1;
+
+    p_stack->deques = MemCalloc(nb_threads, sizeof(task_deque_t));
+    if (p_stack->deques == NULL)
+        return ENOMEM;
+    p_stack->nb_deques = nb_threads;
+
+    for (i = 0; i < nb_threads; i++) {
+        task_deque_t *dq = &p_stack->deques[i];
 
-    /* no task waiting for now */
-    p_stack->max_task_depth = 0;
+        /* initialize each level of the priority stack */
+        for (index = 0; index <= MAX_TASK_DEPTH; index++)
+            dq->tasks_at_depth[index] = NULL;
 
-    /* initialize the lock and the semaphore for accessing the list */
-    pthread_mutex_init(&p_stack->stack_lock, NULL);
+        /* no task waiting for now */
+        dq->max_task_depth = 0;
+        dq->nb_tasks = 0;
+
+        pthread_mutex_init(&dq->lock, NULL);
+    }
 
     /* initially, no task available: sem=0 */
     if ((rc = sem_init(&p_stack->sem_tasks, 0, 0))) {
-        pthread_mutex_destroy(&p_stack->stack_lock);
+        for (i = 0; i < nb_threads; i++)
+            pthread_mutex_destroy(&p_stack->deques[i].lock);
+        MemFree(p_stack->deques);
+        p_stack->deques = NULL;
         DisplayLog(LVL_CRIT, FSSCAN_TAG, "ERROR initializing semaphore");
         return rc;
     }
@@ -54,77 +77,130 @@ int InitTaskStack(task_stack_t *p_stack)
 }
 
 /* insert a task in the stack */
-void InsertTask_to_Stack(task_stack_t *p_stack, robinhood_task_t *p_task)
+void InsertTask_to_Stack(task_stack_t *p_stack, unsigned int thr_index,
+                         robinhood_task_t *p_task)
 {
     unsigned int prof = p_task->depth;
+    task_deque_t *dq = &p_stack->deques[thr_index % p_stack->nb_deques];
 
     /* don't distinguish priorities over a given depth */
     if (prof > MAX_TASK_DEPTH)
         prof = MAX_TASK_DEPTH;
 
-    /* take the lock on stack */
-    P(p_stack->stack_lock);
+    /* take the lock on the thread stack */
+    P(dq->lock);
 
     /* insert the task at the good depth */
-    p_task->next_task = p_stack->tasks_at_depth[prof];
-    p_stack->tasks_at_depth[prof] = p_task;
+    p_task->next_task = dq->tasks_at_depth[prof];
+    dq->tasks_at_depth[prof] = p_task;
 
     /* update max_task_depth, if needed */
-    if (prof > p_stack->max_task_depth)
-        p_stack->max_task_depth = prof;
+    if (dq->nb_tasks == 0 || prof > dq->max_task_depth)
+        __atomic_store_n(&dq->max_task_depth, prof, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&dq->nb_tasks, dq->nb_tasks + 1, __ATOMIC_RELAXED);
 
     /* release the stack lock */
-    V(p_stack->stack_lock);
+    V(dq->lock);
 
     /* unblock waiting worker threads */
     sem_post_safe(&p_stack->sem_tasks);
 
 }
 
-/* take a task (blocking until there is a task in the stack) */
-robinhood_task_t *GetTask_from_Stack(task_stack_t *p_stack)
+/* take the deepest task of a thread stack (NULL if it is empty) */
+static robinhood_task_t *pop_deepest_task(task_deque_t *dq)
 {
     robinhood_task_t *p_task;
     int index;
 
-    /* wait for a task */
-    sem_wait_safe(&p_stack->sem_tasks);
+    P(dq->lock);
 
-    /* lock the stack */
-    P(p_stack->stack_lock);
+    if (dq->nb_tasks == 0) {
+        V(dq->lock);
+        return NULL;
+    }
 
     /* The scan is a 'depth first' scan: directly go to the highest depth. */
-    p_task = p_stack->tasks_at_depth[p_stack->max_task_depth];
+    p_task = dq->tasks_at_depth[dq->max_task_depth];
 
     /* sanity check */
     if (p_task == NULL) {
-        V(p_stack->stack_lock);
+        V(dq->lock);
         DisplayLog(LVL_CRIT, FSSCAN_TAG, "UNEXPECTED ERROR: NO TASK FOUND");
         return NULL;
     }
 
     /* update the list for this depth */
-    p_stack->tasks_at_depth[p_stack->max_task_depth] = p_task->next_task;
+    dq->tasks_at_depth[dq->max_task_depth] = p_task->next_task;
+    __atomic_store_n(&dq->nb_tasks, dq->nb_tasks - 1, __ATOMIC_RELAXED);
 
     /* if the list at current depth is empty, we need to
      * update max_task_depth.
      */
     if (p_task->next_task == NULL) {
-        for (index = p_stack->max_task_depth; index >= 0; index--) {
-            if (p_stack->tasks_at_depth[index] != NULL) {
-                p_stack->max_task_depth = index;
+        for (index = dq->max_task_depth; index >= 0; index--) {
+            if (dq->tasks_at_depth[index] != NULL)
                 break;
-            }
         }
-        /* no item found */
-        if (index < 0)
-            p_stack->max_task_depth = 0;
+        /* 0 if no item found */
+        __atomic_store_n(&dq->max_task_depth, index < 0 ? 0 : index,
+                         __ATOMIC_RELAXED);
     }
 
-    /* unlock the stack */
-    V(p_stack->stack_lock);
+    V(dq->lock);
 
-    /* returns pointer to the task */
     return p_task;
+}
 
+/* take a task (blocking until there is a task in the stack) */
+robinhood_task_t *GetTask_from_Stack(task_stack_t *p_stack,
+                                     unsigned int thr_index, bool *p_stolen)
+{
+    unsigned int self = thr_index % p_stack->nb_deques;
+    robinhood_task_t *p_task;
+
+    /* wait for a task */
+    sem_wait_safe(&p_stack->sem_tasks);
+
+    /* The token guarantees there is a task for us in one of the stacks.
+     * It may not be visible yet if another thread holding a token
+     * took the last task of a stack we already looked at: retry. */
+    for (;;) {
+        task_deque_t *victim = NULL;
+        unsigned int i, depth = 0;
+
+        /* first look in our own stack */
+        p_task = pop_deepest_task(&p_stack->deques[self]);
+        if (p_task != NULL) {
+            *p_stolen = false;
+            return p_task;
+        }
+
+        /* steal the deepest task of other threads */
+        for (i = 1; i < p_stack->nb_deques; i++) {
+            task_deque_t *dq = &p_stack->deques[(self + i)
+                                                % p_stack->nb_deques];
+            unsigned int d;
+
+            if (__atomic_load_n(&dq->nb_tasks, __ATOMIC_RELAXED) == 0)
+                continue;
+
+            d = __atomic_load_n(&dq->max_task_depth, __ATOMIC_RELAXED);
+            if (victim == NULL || d > depth) {
+                victim = dq;
+                depth = d;
+            }
+        }
+
+        if (victim != NULL) {
+            p_task = pop_deepest_task(victim);
+            if (p_task != NULL) {
+                *p_stolen = true;
+                return p_task;
+            }
+        }
+
+        sched_yield();
+    }
 }
@@ -21,13 +21,17 @@
 
 #include "fs_scan_types.h"
 
-/* initialize a task stack */
-int InitTaskStack(task_stack_t *p_stack);
+/* initialize a task stack, with one stack per scan thread */
+int InitTaskStack(task_stack_t *p_stack, unsigned int nb_threads);
 
-/* insert a task in the stack */
-void InsertTask_to_Stack(task_stack_t *p_stack, robinhood_task_t *p_task);
+/* insert a task in the stack of the given thread */
+void InsertTask_to_Stack(task_stack_t *p_stack, unsigned int thr_index,
+                         robinhood_task_t *p_task);
 
-/* take a task in the stack (block until there is a task available) */
-robinhood_task_t *GetTask_from_Stack(task_stack_t *p_stack);
+/* take a task in the stack of the given thread, or steal it from
+ * another thread (block until there is a task available).
+ * p_stolen is set to true if the task was taken from another thread. */
+robinhood_task_t *GetTask_from_Stack(task_stack_t *p_stack,
+                                     unsigned int thr_index, bool *p_stolen);
 
 #endif
@@ -76,6 +76,8 @@ int FreeTask(robinhood_task_t *p_task)
 {
     if (p_task->fd != -1)
         close(p_task->fd); /* check rc? */
+    if (p_task->entry_batch != NULL)
+        MemFree(p_task->entry_batch);
     pthread_spin_destroy(&p_task->child_list_lock);
 
     /* put it back to the allocation pool */
@@ -66,6 +66,10 @@ typedef struct result_handle_t {
 typedef struct db_config_t {
     char         filepath[RBH_PATH_MAX];
     unsigned int retry_delay_microsec;  /* retry time when busy */
+    char         journal_mode[16];      /* e.g. WAL */
+    char         synchronous[16];       /* e.g. NORMAL */
+    unsigned long long mmap_size;       /* size of memory-mapped I/O */
+    unsigned long long cache_size;      /* size of the page cache */
 } db_config_t;
 
 #else
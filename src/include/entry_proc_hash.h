@@ -46,8 +46,6 @@ struct id_hash *id_hash_init(const unsigned int hash_size, bool use_lock);
 /* display stats about the hash */
 void id_hash_stats(struct id_hash *id_hash, const char *log_str);
 
-/* dump all values in the hash */
-void id_hash_dump(struct id_hash *id_hash, bool parent);
 
 /**
  * Murmur3 uint64 finalizer
@@ -99,4 +97,85 @@ static inline struct id_hash_slot *get_name_hash_slot(struct id_hash *name_hash,
     return &name_hash->slot[hash_name(parent_id, name, name_hash->hash_size)];
 }
 
+/* === Constraint index: pending operations by id or by parent/name === */
+
+/** A key (entry id or parent/name) with its chain of pending operations */
+struct op_key {
+    struct op_key       *next;  /**< next key in the same bucket */
+    uint64_t             hash;
+    entry_id_t           id;    /**< entry id, or parent id */
+    struct rh_list_head  ops;   /**< pending operations, in pipeline order */
+    unsigned int         count; /**< number of operations in the chain */
+    char                 name[];    /**< entry name (name index only) */
+};
+
+/** A shard of the index: its own lock and its own bucket array */
+struct op_index_shard {
+    pthread_mutex_t      lock;
+    struct op_key      **buckets;
+    unsigned int         nb_buckets;    /**< power of 2 */
+    unsigned int         nb_keys;
+    unsigned int         nb_ops;
+    unsigned int         max_chain; /**< longest chain since last stats */
+};
+
+/** Index of pending operations, by id or by parent/name */
+struct op_index {
+    bool                   by_name;
+    unsigned int           nb_shards;   /**< power of 2 */
+    struct op_index_shard *shards;
+};
+
+/** where to insert an operation in the chain of its key */
+typedef enum {
+    OP_INSERT_TAIL,
+    OP_INSERT_HEAD,
+    OP_INSERT_SORTED,   /**< sorted by pipeline_seq */
+} op_insert_pos_e;
+
+/**
+ * Creates a new index of pending operations.
+ * Shard tables grow as needed, so max_count is only used as a hint
+ * for their initial size.
+ * @param nb_shards rounded up to a power of 2.
+ */
+struct op_index *op_index_init(unsigned int max_count, unsigned int nb_shards,
+                               bool by_name);
+
+/**
+ * Add an operation to the chain of its key (its id, or its parent/name).
+ * @return 0 on success, ENOMEM on error.
+ */
+int op_index_insert(struct op_index *idx, entry_proc_op_t *op,
+                    op_insert_pos_e pos);
+
+/**
+ * Indicate if a registered operation is the head of its chain.
+ * @param set_wait if it is not, flag the operation as waiting
+ *        (set while the chain is locked).
+ */
+bool op_index_is_first(struct op_index *idx, entry_proc_op_t *op,
+                       bool set_wait);
+
+/**
+ * Indicate if there are registered operations with the same key as op
+ * (op being not registered).
+ */
+bool op_index_has_pending(struct op_index *idx, const entry_proc_op_t *op);
+
+/**
+ * Remove an operation from the chain of its key.
+ * @param woken if not NULL, and the new head of the chain is waiting,
+ *        it is set in woken.
+ * @return the number of waiting operations set in woken (0 or 1).
+ */
+int op_index_remove(struct op_index *idx, entry_proc_op_t *op,
+                    entry_proc_op_t **woken);
+
+/* display stats about the index */
+void op_index_stats(struct op_index *idx, const char *log_str);
+
+/* dump all pending operations in the index */
+void op_index_dump(struct op_index *idx);
+
 #endif
@@ -54,6 +54,7 @@
 
 /* forward declaration */
 struct entry_proc_op_t;
+struct op_key;
 
 /**
  * Definition of pipeline stage functions
@@ -196,6 +197,17 @@ typedef struct entry_proc_op_t {
      */
     struct rh_list_head name_hash_list;
 
+    /* constraint keys this operation is registered to (id, parent/name) */
+    struct op_key  *id_key;
+    struct op_key  *name_key;
+
+    /* lock-free pipeline engine: insertion order in the pipeline */
+    unsigned long long pipeline_seq;
+    /* lock-free pipeline engine: ordering marks already set for this op */
+    unsigned long long lf_marks;
+    /* lock-free pipeline engine: waiting state for id constraints */
+    int             lf_state;
+
 } entry_proc_op_t;
 
 /* test attribute from filesystem, or else from DB */
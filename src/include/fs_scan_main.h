@@ -63,6 +63,16 @@ typedef struct fs_scan_config_t {
     /** memory management */
     unsigned        nb_prealloc_tasks;
 
+    /** stat directory entries asynchronously, using io_uring */
+    bool            use_io_uring;
+
+    /** only read directories whose mtime/ctime changed since last scan */
+    bool            incremental_scan;
+
+    /** entries of directories larger than this are processed by all
+     * scan threads (0 to disable) */
+    unsigned int    large_dir_threshold;
+
     /** ignore list (bool expr) */
     whitelist_item_t *ignore_list;
     unsigned int    ignore_count;
@@ -0,0 +1,65 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * \file glob_set.h
+ * \brief Match a string against a set of fnmatch(3) patterns at once.
+ *
+ * The literal parts of all patterns are merged into a single Aho-Corasick
+ * automaton, walked once over the (lower-cased) string. A pattern is only
+ * tested with fnmatch() when all its literal parts were found in the string,
+ * or when it has no literal part (e.g. "*").
+ */
+
+#ifndef _GLOB_SET_H
+#define _GLOB_SET_H
+
+#include <stdint.h>
+
+typedef struct glob_set glob_set_t;
+
+/** size of the result bitmap (in uint64_t) for a set of 'n' patterns */
+#define GLOB_SET_WORDS(_n)  (((_n) + 63) / 64)
+#define GLOB_SET_TEST(_bits, _i)  (((_bits)[(_i) / 64] >> ((_i) % 64)) & 1)
+
+/** create an empty set of patterns */
+glob_set_t *glob_set_new(void);
+
+/**
+ * Add a pattern to the set (before glob_set_compile()).
+ * Identical patterns with identical flags are only stored once.
+ * @param flags fnmatch() flags for this pattern.
+ * @return the pattern index in the set (>= 0), or a negative error code.
+ */
+int glob_set_add(glob_set_t *set, const char *pattern, int flags);
+
+/** number of distinct patterns in the set */
+unsigned int glob_set_count(const glob_set_t *set);
+
+/** build the automaton, once all patterns are added.
+ * @return 0 on success, or an error code. */
+int glob_set_compile(glob_set_t *set);
+
+/**
+ * Match a string against all patterns of a compiled set.
+ * This can be called concurrently by several threads.
+ * @param[out] matches bitmap of GLOB_SET_WORDS(glob_set_count()) words.
+ *                     The bit of each matching pattern is set.
+ */
+void glob_set_match(const glob_set_t *set, const char *str,
+                    uint64_t *matches);
+
+void glob_set_free(glob_set_t *set);
+
+#endif
@@ -54,6 +54,7 @@
 #define DB_BAD_SCHEMA          17
 #define DB_NEED_ALTER          18
 #define DB_RBH_SIG_SHUTDOWN    19
+#define DB_IO_ERROR            20
 
 static inline const char *lmgr_err2str(int err)
 {
@@ -96,6 +97,8 @@ static inline const char *lmgr_err2str(int err)
         return "schema needs to be altered";
     case DB_RBH_SIG_SHUTDOWN:
         return "robinhood signal shutdown";
+    case DB_IO_ERROR:
+        return "I/O error";
     default:
         return "unknown error";
     }
@@ -194,6 +197,12 @@ typedef struct lmgr_t {
     /* operation statistics */
     unsigned int    nbop[OPCOUNT];
 
+    /** prepared statements of this connection */
+    struct lmgr_stmt_cache *stmt_cache;
+
+    /** if set, reports are built from this snapshot file */
+    struct lmgr_snapshot *snapshot;
+
 } lmgr_t;
 
 /** List manager configuration */
@@ -206,6 +215,34 @@ typedef struct lmgr_config_t {
 
     /** enable accounting */
     bool            acct;
+    /** maintain accounting with DB triggers (else, by robinhood itself) */
+    bool            acct_triggers;
+    /** interval for flushing accounting changes to DB (without triggers) */
+    time_t          acct_flush_interval;
+
+    /** use prepared statements for entry insert/update/get */
+    bool            prepared_stmt;
+
+    /** number of entries retrieved at once by iterators (0 = all) */
+    unsigned int    iter_chunk_size;
+    /** retrieve the next chunk of an iterator in background */
+    bool            iter_prefetch;
+
+    /** max number of directories in the path cache (0 = disabled) */
+    unsigned int    path_cache_size;
+    /** lifetime of path cache entries (0 = until invalidated) */
+    time_t          path_cache_ttl;
+
+    /** number of connections used for mass removals */
+    unsigned int    mass_rm_threads;
+
+    /** load the initial scan of an empty DB from staging files */
+    bool            bulk_load;
+    /** directory of staging files */
+    char            bulk_load_dir[RBH_PATH_MAX];
+
+    /** store stripe items as a single encoded blob per file (Lustre) */
+    bool            compact_stripes;
 } lmgr_config_t;
 
 /** config handlers */
@@ -221,6 +258,11 @@ extern volatile bool lmgr_cancel_retry;
  */
 bool lmgr_parallel_batches(void);
 
+/** indicate if accounting is maintained by robinhood instead of DB triggers.
+ * In this case, ListMgr_AcctDelta() must be called for all entry changes.
+ */
+bool lmgr_app_acct(void);
+
 /** Container to associate an ID with its pathname. */
 typedef struct wagon {
     entry_id_t   id;
@@ -234,16 +276,27 @@ struct lmgr_profile_t;
 struct lmgr_rm_list_t;
 
 /** Options for iterators */
+/** Range of entry ids, in the order of the DB primary key:
+ * ids > min and <= max. NULL bounds are unlimited.
+ * (see ListMgr_SplitIdRange) */
+typedef struct lmgr_id_range_t {
+    char *min;
+    char *max;
+} lmgr_id_range_t;
+
 typedef struct lmgr_iter_opt_t {
     unsigned int list_count_max;    /* max entries to be returned by iterator or
                                        report */
     unsigned int force_no_acct:1;   /* don't use acct table for reports */
     unsigned int allow_no_attr:1;   /* allow returning entries if no attr is
                                        available */
+    /** only list entries in this range of ids, in id order
+     * (unsorted iterators only) */
+    const lmgr_id_range_t *id_range;
 } lmgr_iter_opt_t;
 
 #define LMGR_ITER_OPT_INIT {.list_count_max = 0, .force_no_acct = 0, \
-                            .allow_no_attr = 0}
+                            .allow_no_attr = 0, .id_range = NULL}
 
 typedef struct attr_mask {
     uint32_t std;     /**< standard attribute mask */
@@ -598,6 +651,7 @@ enum lmgr_init_flags {
     LIF_REPORT_ONLY = (1 << 0), /**< report only, no action on DB schema */
     LIF_ALTER_DB    = (1 << 1), /**< allow altering DB (insert/drop fields) */
     LIF_ALTER_NODISP = (1 << 2), /**< INTERNAL USE ONLY */
+    LIF_NO_DB       = (1 << 3), /**< no database access (snapshot reports) */
 };
 
 /** Initialize the List Manager */
@@ -680,6 +734,35 @@ int ListMgr_BatchInsert(lmgr_t *p_mgr, entry_id_t **p_ids,
                         attr_set_t **p_attrs, unsigned int count,
                         bool update_if_exists);
 
+/**
+ * Bulk load of an initial scan: entries are written to staging files
+ * (one per table and attribute set) which are loaded by large chunks with
+ * LOAD DATA, while secondary indexes and accounting triggers are dropped.
+ * \addtogroup BULK_LOAD_FUNCTIONS
+ * @{
+ */
+
+/**
+ * Start a bulk load, if the database is empty.
+ * @retval DB_SUCCESS entries must be inserted with ListMgr_BulkLoadAdd().
+ * @retval DB_NOT_ALLOWED bulk load is disabled, or the database is not empty.
+ */
+int ListMgr_BulkLoadStart(void);
+
+/**
+ * Insert a batch of new entries in the current bulk load.
+ */
+int ListMgr_BulkLoadAdd(lmgr_t *p_mgr, entry_id_t **p_ids,
+                        attr_set_t **p_attrs, unsigned int count);
+
+/**
+ * Load remaining staging files, then rebuild indexes, accounting and
+ * triggers. Does nothing if no bulk load is running.
+ */
+int ListMgr_BulkLoadEnd(void);
+
+/** @} */
+
 /**
  * Modifies an existing entry in the database.
  */
@@ -701,6 +784,14 @@ typedef void (*rm_cb_func_t) (const entry_id_t *);
 int ListMgr_Remove(lmgr_t *p_mgr, const entry_id_t *p_id,
                    const attr_set_t *p_attr_set, bool last);
 
+/**
+ * Removes a name from the database, without changing the entry itself
+ * (e.g. a stale name of an entry that has been renamed).
+ * p_attr_set must contain parent_id and name.
+ */
+int ListMgr_RemoveName(lmgr_t *p_mgr, const entry_id_t *p_id,
+                       const attr_set_t *p_attr_set);
+
 /**
  * Removes all entries that match the specified filter.
  */
@@ -714,6 +805,46 @@ int ListMgr_Replace(lmgr_t *p_mgr, entry_id_t *old_id, attr_set_t *old_attrs,
                     entry_id_t *new_id, attr_set_t *new_attrs,
                     bool src_is_last, bool update_target_if_exists);
 
+/**
+ * Accounting functions, when accounting is maintained by robinhood
+ * instead of DB triggers (see lmgr_app_acct()).
+ * \addtogroup ACCT_FUNCTIONS
+ * @{
+ */
+
+/** attributes needed to account the change of an entry */
+attr_mask_t ListMgr_AcctMask(void);
+
+/**
+ * Get the accounting attributes of an entry, before changing it.
+ * @return true if p_old was filled, false if robinhood doesn't maintain
+ *         accounting or the entry is not in DB.
+ */
+bool ListMgr_AcctGet(lmgr_t *p_mgr, const entry_id_t *p_id,
+                     attr_set_t *p_old);
+
+/**
+ * Account the change of an entry, after it has been applied to the DB.
+ * Changes are aggregated in memory and periodically written to ACCT_STAT
+ * (every accounting_flush_interval).
+ * @param p_id  id of the changed entry.
+ * @param p_old entry attributes before the change (NULL for a new entry).
+ *              It must contain the ListMgr_AcctMask() attributes of the entry.
+ * @param p_new entry attributes after the change (NULL for a removed entry).
+ *              Missing attributes are taken from p_old.
+ */
+void ListMgr_AcctDelta(lmgr_t *p_mgr, const entry_id_t *p_id,
+                       const attr_set_t *p_old, const attr_set_t *p_new);
+
+/** Write all pending accounting changes to the DB, in a single
+ * transaction. */
+int ListMgr_AcctFlush(lmgr_t *p_mgr);
+
+/** Display the progress of the background population of ACCT_STAT. */
+void ListMgr_AcctRebuildDumpStats(void);
+
+/** @} */
+
 /**
  * Soft Rm functions.
  * \addtogroup SOFT_RM_FUNCTIONS
@@ -884,6 +1015,23 @@ int ListMgr_GetNext(struct lmgr_iterator_t *p_iter,
  */
 void ListMgr_CloseIterator(struct lmgr_iterator_t *p_iter);
 
+/**
+ * Split the id space of DB entries into ranges of about the same entry count,
+ * so that unsorted listings can be run in parallel.
+ * @param[in]  count    requested number of ranges.
+ * @param[out] p_ranges array of ranges, to be released by
+ *                      ListMgr_FreeIdRanges().
+ * @param[out] p_nb     number of ranges (<= count, less if the DB has too few
+ *                      entries).
+ */
+int ListMgr_SplitIdRange(lmgr_t *p_mgr, unsigned int count,
+                         lmgr_id_range_t **p_ranges, unsigned int *p_nb);
+
+/** Make a range start after the given entry (to resume its listing). */
+int ListMgr_IdRangeStartAfter(lmgr_id_range_t *range, const entry_id_t *p_id);
+
+void ListMgr_FreeIdRanges(lmgr_id_range_t *ranges, unsigned int nb);
+
 /** @} */
 
 /**
@@ -1047,6 +1195,34 @@ int ListMgr_GetNextProfile(struct lmgr_profile_t *p_iter,
  */
 void ListMgr_CloseProfile(struct lmgr_profile_t *p_iter);
 
+/**
+ * Export the catalog (ENTRIES, ANNEX_INFO and NAMES tables) to a compressed
+ * columnar snapshot file.
+ * @param[out] p_count number of exported entries.
+ */
+int ListMgr_ExportSnapshot(lmgr_t *p_mgr, const char *file, uint64_t *p_count);
+
+/**
+ * Build the reports of p_mgr from a snapshot file instead of the database
+ * (see ListMgr_Report). p_mgr doesn't need to be connected to the database.
+ * @param[out] p_ctime time of the snapshot (optional).
+ */
+int ListMgr_OpenSnapshot(lmgr_t *p_mgr, const char *file, time_t *p_ctime);
+
+/**
+ * Release the snapshot opened by ListMgr_OpenSnapshot().
+ */
+void ListMgr_CloseSnapshot(lmgr_t *p_mgr);
+
+/**
+ * Drop the cached name of a directory from the path cache
+ * (to be called when a directory is renamed or removed).
+ */
+void ListMgr_PathCacheInvalidate(const entry_id_t *p_id);
+
+/** Dump path cache statistics to the log */
+void ListMgr_PathCacheDumpStats(void);
+
 /** @} */
 
 /**
@@ -1084,6 +1260,7 @@ void ListMgr_CloseProfile(struct lmgr_profile_t *p_iter);
 #define LAST_SCAN_AVGMSPE     "LastScanAvgMsPerEntry"
 #define LAST_SCAN_CURMSPE     "LastScanCurMsPerEntry"
 #define LAST_SCAN_NB_THREADS  "LastScanNbThreads"
+#define LAST_SCAN_GC          "LastScanGC"
 
 #define PREV_SCAN_START_TIME  "PrevScanStartTime"
 #define PREV_SCAN_END_TIME    "PrevScanEndTime"
@@ -1223,6 +1400,39 @@ int convert_boolexpr_to_simple_filter(struct bool_node_t *boolexpr,
                                       enum filter_flags flags,
                                       bool_op_t op_ctx);
 
+/** Result of convert_boolexpr_to_filter() */
+typedef struct filter_pushdown {
+    unsigned int cond_count;   /**< conditions in the expression */
+    unsigned int cond_pushed;  /**< conditions translated to the filter */
+    bool         never_matches; /**< the expression is always false */
+    /** If not NULL, the conditions the DB can't evaluate are appended
+     * to this string. */
+    GString     *leftovers;
+} filter_pushdown_t;
+
+/**
+ * Convert a whole boolean expression to a ListMgr filter (append filter).
+ * Unlike convert_boolexpr_to_simple_filter(), any nesting of AND, OR and NOT
+ * is supported. The filter selects a superset of the matching entries:
+ * conditions the DB can't evaluate (or can't negate) are considered as TRUE.
+ * Nothing is appended if the DB can't restrict the set of entries at all,
+ * or if the expression never matches (see stats->never_matches).
+ * As it produces OR blocks, the filter is only supported by listmgr_iterators.
+ * @param[in]     boolexpr  the boolean expression to be converted.
+ * @param[in,out] filter    the output filter to be appended.
+ * @param[in]     smi       the current status manager (if any).
+ * @param[in]     time_mod  time modifier for maintenance mode.
+ * @param[in]     flags     FILTER_FLAG_NOT to convert 'NOT <expr>',
+ *                          FILTER_FLAG_ALLOW_NULL to match NULL values.
+ * @param[out]    stats     what was converted (can be NULL).
+ */
+int convert_boolexpr_to_filter(struct bool_node_t *boolexpr,
+                               lmgr_filter_t *filter,
+                               const struct sm_instance *smi,
+                               const struct time_modifier *time_mod,
+                               enum filter_flags flags,
+                               filter_pushdown_t *stats);
+
 /** Set a complex filter structure */
 int lmgr_set_filter_expression(lmgr_filter_t *p_filter,
                                struct bool_node_t *boolexpr);
@@ -1286,6 +1496,9 @@ bool lmgr_batch_compat(attr_mask_t m1, attr_mask_t m2);
 /** Add begin or end block. */
 int lmgr_simple_filter_add_block(lmgr_filter_t *, enum filter_flags);
 
+/** Remove the last items of a filter, to keep the 'count' first ones. */
+void lmgr_simple_filter_truncate(lmgr_filter_t *p_filter, unsigned int count);
+
 /**
  * Check if conditions can be translated to SQL statement for DB query
  */
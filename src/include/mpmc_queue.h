@@ -0,0 +1,97 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * \file mpmc_queue.h
+ * \brief Bounded lock-free multi-producer/multi-consumer queue of pointers.
+ *
+ * Each cell of the ring carries a sequence number that tells producers and
+ * consumers whether the cell is free or filled for their turn
+ * (D. Vyukov's bounded MPMC queue). Push and pop never block: they fail
+ * when the queue is full (resp. empty).
+ */
+
+#ifndef _MPMC_QUEUE_H
+#define _MPMC_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* avoid false sharing between producer and consumer indexes */
+#define MPMC_CACHE_LINE 64
+
+/* atomic helpers shared by lock-free code */
+#define ATOMIC_LOAD(_x)         __atomic_load_n(&(_x), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(_x, _v)    __atomic_store_n(&(_x), (_v), __ATOMIC_RELEASE)
+#define ATOMIC_ADD(_x, _v)      __atomic_add_fetch(&(_x), (_v), __ATOMIC_SEQ_CST)
+#define ATOMIC_SUB(_x, _v)      __atomic_sub_fetch(&(_x), (_v), __ATOMIC_SEQ_CST)
+#define ATOMIC_CAS(_x, _old, _new) \
+        __sync_bool_compare_and_swap(&(_x), (_old), (_new))
+
+typedef struct mpmc_cell {
+    uint64_t    seq;
+    void       *data;
+} mpmc_cell_t;
+
+typedef struct mpmc_queue_t {
+    mpmc_cell_t    *cells;
+    uint64_t        mask;   /**< cell count - 1 (cell count is a power of 2) */
+    char            pad0[MPMC_CACHE_LINE];
+    uint64_t        enqueue_pos;
+    char            pad1[MPMC_CACHE_LINE];
+    uint64_t        dequeue_pos;
+    char            pad2[MPMC_CACHE_LINE];
+} mpmc_queue_t;
+
+/**
+ * Initialize a queue that can hold at least 'size' items.
+ * The actual capacity is rounded up to the next power of 2.
+ * @return 0 on success, ENOMEM on allocation failure.
+ */
+int mpmc_queue_init(mpmc_queue_t *q, unsigned int size);
+
+/** Release queue resources (the queue must no longer be in use). */
+void mpmc_queue_destroy(mpmc_queue_t *q);
+
+/** Return the capacity of the queue. */
+static inline unsigned int mpmc_queue_capacity(const mpmc_queue_t *q)
+{
+    return q->mask + 1;
+}
+
+/**
+ * Add an item at the tail of the queue.
+ * @return false if the queue is full.
+ */
+bool mpmc_queue_push(mpmc_queue_t *q, void *data);
+
+/**
+ * Get the item at the head of the queue.
+ * @return false if the queue is empty.
+ */
+bool mpmc_queue_pop(mpmc_queue_t *q, void **data);
+
+/**
+ * Approximate number of items in the queue
+ * (exact if the queue is not being modified).
+ */
+static inline unsigned int mpmc_queue_count(mpmc_queue_t *q)
+{
+    uint64_t enq = ATOMIC_LOAD(q->enqueue_pos);
+    uint64_t deq = ATOMIC_LOAD(q->dequeue_pos);
+
+    return (enq > deq) ? (unsigned int)(enq - deq) : 0;
+}
+
+#endif
@@ -49,9 +49,14 @@ extern const pipeline_descr_t std_pipeline_descr;
 extern pipeline_stage_t diff_pipeline[];
 extern const pipeline_descr_t diff_pipeline_descr;
 
+/** std pipeline with bulk load of scanned entries into an empty DB */
+extern pipeline_stage_t load_pipeline[];
+extern const pipeline_descr_t load_pipeline_descr;
+
 typedef enum {
     STD_PIPELINE,
     DIFF_PIPELINE,
+    LOAD_PIPELINE,
 } pipeline_flavor_e;
 
 /* specific argument for diff pipeline (accessible as entry_proc_arg) */
@@ -210,6 +210,10 @@ typedef struct policies_t {
     /* is there any policy that manages deleted entries? */
     unsigned int        manage_deleted:1;
 
+    /** compiled fileclasses and policy rules
+     *  (see compile_policy_matching) */
+    struct class_matcher *class_matcher;
+
 } policies_t;
 extern struct policies_t policies;
 
@@ -230,6 +234,17 @@ static inline bool has_deletion_policy(void)
 int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
                   const attr_set_t *p_attrs_cached);
 
+struct class_matcher;
+
+/** Compile fileclass definitions, policy rule conditions and ignore rules
+ * for match_classes(), policy_case(), is_whitelisted() and
+ * policy_match_all(). Expressions that can't be compiled are interpreted. */
+int compile_policy_matching(policies_t *pol);
+
+/** Also match fileclasses and rules with the interpreter, and report
+ *  differences with the compiled matcher. */
+void set_class_matching_check(bool enable);
+
 /* return values for matching */
 typedef enum {
     POLICY_MATCH = 0,
@@ -251,11 +266,15 @@ fileset_item_t *get_fileset_by_name(const policies_t *policies,
 /** get the first matching policy case for the given file
  *  \param pp_fileset(out) set to the matching fileset
  *         or NULL for the default policy case
+ *  \param cond_match(out) if not NULL, set to the result of matching the
+ *         condition of the returned policy case (with time_mod)
  */
 rule_item_t *policy_case(const policy_descr_t *policy,
                          const entry_id_t *p_entry_id,
                          const attr_set_t *p_entry_attr,
-                         fileset_item_t **pp_fileset);
+                         const time_modifier_t *time_mod,
+                         fileset_item_t **pp_fileset,
+                         policy_match_t *cond_match);
 
 /** get the policy case for the given fileclass.
  *  \param pp_fileset is set to the matching fileset
@@ -157,6 +157,11 @@ typedef struct policy_run_config_t {
     unsigned int        nb_threads;
     unsigned int        queue_size;
     unsigned int        db_request_limit;
+    /** number of candidates listed in advance of the workers queue
+     * (0 = list candidates synchronously) */
+    unsigned int        prefetch_size;
+    /** number of DB connections listing candidates of unsorted policies */
+    unsigned int        db_list_threads;
 
     unsigned int        max_action_nbr; /**< can also be specified in each
                                              trigger */
@@ -282,6 +287,8 @@ typedef struct __action_summary {
     counters_t      action_ctr;
     unsigned int    skipped;
     unsigned int    errors;
+    /** time the workers feed waited for the DB listing (seconds) */
+    double          list_stall;
 } action_summary_t;
 
 typedef enum {
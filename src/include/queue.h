@@ -17,30 +17,29 @@
  * \brief Module for managing the queue of files to be purged.
  */
 
-#include <semaphore.h>
 #include <time.h>
 #include <pthread.h>
 
+#include "mpmc_queue.h"
+
 #ifndef _QUEUE_MNGMT_H
 #define _QUEUE_MNGMT_H
 
+/** per-thread acknowledgement counters */
+struct queue_thr_stats;
+
 typedef struct entry_queue_t {
-    /* cyclic array of entries */
-    void          **queue;
+    /* lock-free ring of entries */
+    mpmc_queue_t    ring;
 
-    /* size and indexes */
-    unsigned int    array_size;
+    /* requested size (the ring capacity is rounded up to a power of 2) */
     unsigned int    queue_size;
-    unsigned int    first_index;
-    unsigned int    last_index;
 
-    /* mutex for accessing the queue */
-    pthread_mutex_t queue_lock;
-
-    /* token for free slots */
-    sem_t           sem_empty;
-    /* token for filled slots */
-    sem_t           sem_full;
+    /* futex words, bumped when entries (resp. free slots) are available */
+    int             avail_seq;
+    int             free_seq;
+    /* producers waiting for free slots */
+    unsigned int    nb_prod_waiting;
 
     /* ==== stats ==== */
 
@@ -51,13 +50,20 @@ typedef struct entry_queue_t {
     /* idle threads */
     unsigned int    nb_thr_waiting;
 
-    /* array of status count */
-    unsigned int   *status_array;
     unsigned int    status_count;
+    unsigned int    feedback_count;
 
-    /* special fields for counting feedback info */
+    /* acknowledgements are counted by each thread, to avoid sharing
+     * a lock or a cache line between workers */
+    pthread_key_t   thr_stats_key;
+    pthread_mutex_t stats_lock;
+    struct queue_thr_stats *thr_stats;  /**< list of per-thread counters */
+    /* counters of exited threads */
+    unsigned int   *status_array;
     unsigned long long *feedback_array;
-    unsigned int    feedback_count;
+    /* values at last reset (subtracted from counters) */
+    unsigned int   *status_base;
+    unsigned long long *feedback_base;
 
 } entry_queue_t;
 
@@ -86,6 +92,13 @@ void Reset_Feedback(entry_queue_t *p_queue, unsigned int feedback_index);
  */
 int Queue_Insert(entry_queue_t *p_queue, void *entry);
 
+/**
+ * Insert several entries to the queue, in order.
+ * Can be blocking until all entries are inserted, if the queue is full.
+ */
+int Queue_InsertBatch(entry_queue_t *p_queue, void **entries,
+                      unsigned int count);
+
 /**
  * Get an entry from the queue.
  * The call is blocking until there is an element available
@@ -93,6 +106,15 @@ int Queue_Insert(entry_queue_t *p_queue, void *entry);
  */
 int Queue_Get(entry_queue_t *p_queue, void **p_ptr);
 
+/**
+ * Get up to 'max' entries from the queue.
+ * The call is blocking until there is at least one element available
+ * in the queue.
+ * @param[out] p_count number of entries returned in p_ptrs.
+ */
+int Queue_GetBatch(entry_queue_t *p_queue, void **p_ptrs, unsigned int max,
+                   unsigned int *p_count);
+
 /**
  * Acknwoledge when an entry has been handled.
  * Indicates the status and optionnal feedback info (as unsigned long long
@@ -24,6 +24,10 @@
 #define SOFT_RM_TABLE       "SOFT_RM"
 #define VAR_TABLE           "VARS"
 #define ACCT_TABLE          "ACCT_STAT"
+#define ACCT_REBUILD_TABLE  "ACCT_STAT_REBUILD"
+#define MASS_RM_TABLE       "MASS_RM"
+#define MASS_RM_VAR         "MassRemove"
+#define BULK_LOAD_VAR       "BulkLoad"
 #define ACCT_TRIGGER_INSERT "ACCT_ENTRY_INSERT"
 #define ACCT_TRIGGER_UPDATE "ACCT_ENTRY_UPDATE"
 #define ACCT_TRIGGER_DELETE "ACCT_ENTRY_DELETE"
@@ -34,6 +38,26 @@
 #define ONE_PATH_FUNC       "one_path"
 #define THIS_PATH_FUNC      "this_path"
 
+/* SQL dialect */
+#ifdef _SQLITE
+/** insert rows, or update the given fields of rows that already exist */
+#define UPSERT_CLAUSE(_key) " ON CONFLICT(" _key ") DO UPDATE SET "
+/** new value of a field in UPSERT_CLAUSE */
+#define UPSERT_VALUE        "excluded.%s"
+#define INSERT_IGNORE       "INSERT OR IGNORE"
+/** take the write lock at the beginning of transactions: they wait for
+ * the current writer, instead of failing when upgrading their lock */
+#define BEGIN_TX            "BEGIN IMMEDIATE"
+/** max number of parameters of a prepared statement */
+#define DB_MAX_PARAMS       999
+#else
+#define UPSERT_CLAUSE(_key) " ON DUPLICATE KEY UPDATE "
+#define UPSERT_VALUE        "VALUES(%s)"
+#define INSERT_IGNORE       "INSERT IGNORE"
+#define BEGIN_TX            "BEGIN"
+#define DB_MAX_PARAMS       65535
+#endif
+
 /* for HSM flavors only */
 #define  RECOV_TABLE     "RECOVERY"
 
@@ -79,6 +103,14 @@ int            db_next_record( db_conn_t * conn,
                                result_handle_t * p_result,
                                char *outtab[], unsigned int outtabsize );
 
+/**
+ * Get the length of the fields of the last record returned by
+ * db_next_record(), for binary fields (which may contain '\0').
+ */
+int            db_record_lengths(db_conn_t *conn, result_handle_t *p_result,
+                                 unsigned long *lengths,
+                                 unsigned int count);
+
 /* retrieve number of records in result */
 int            db_result_nb_records( db_conn_t * conn, result_handle_t * p_result );
 
@@ -88,6 +120,52 @@ int            db_result_free( db_conn_t * conn, result_handle_t * p_result );
 /* indicate if the error is retryable (transaction must be restarted) */
 bool db_is_retryable(int db_err);
 
+/* -------------------- Prepared statements ---------------- */
+
+/** prepared statement (opaque, database specific) */
+typedef struct db_stmt db_stmt_t;
+
+/** prepare a statement, with '?' placeholders for parameters */
+int            db_stmt_prepare(db_conn_t *conn, const char *query,
+                               db_stmt_t **p_stmt);
+
+/** number of parameters of a prepared statement */
+unsigned int   db_stmt_param_count(db_stmt_t *stmt);
+
+/**
+ * Bind the value of the idx'th parameter (starting from 0).
+ * The value is copied, so it can be released before the statement is
+ * executed. DB_TEXT with a NULL string binds SQL NULL.
+ * DB_ID and DB_UIDGID must be converted by the caller.
+ */
+int            db_stmt_bind(db_stmt_t *stmt, unsigned int idx, db_type_e type,
+                            const db_type_u *value_ptr);
+
+/**
+ * Execute a prepared statement with the current parameter values.
+ * If with_result is true, the result is stored on the client side and
+ * can be read by db_stmt_next_record().
+ */
+int            db_stmt_exec(db_conn_t *conn, db_stmt_t *stmt,
+                            bool with_result);
+
+/* get the next record from a statement result (see db_next_record) */
+int            db_stmt_next_record(db_conn_t *conn, db_stmt_t *stmt,
+                                   char *outtab[], unsigned int outtabsize);
+
+/* free statement result resources (the statement can be executed again) */
+void           db_stmt_free_result(db_conn_t *conn, db_stmt_t *stmt);
+
+/* release a prepared statement */
+void           db_stmt_close(db_conn_t *conn, db_stmt_t *stmt);
+
+/**
+ * Identifier of the current server session.
+ * It changes when the connection is re-established, which invalidates
+ * prepared statements.
+ */
+unsigned long  db_session_id(db_conn_t *conn);
+
 typedef enum {DBOBJ_TABLE, DBOBJ_TRIGGER, DBOBJ_FUNCTION, DBOBJ_PROC, DBOBJ_INDEX} db_object_e;
 
 static inline const char *dbobj2str(db_object_e ot)
@@ -109,7 +187,8 @@ int            db_drop_component( db_conn_t * conn, db_object_e obj_type, const
 
 /**
  * check a component exists in the database
- * \param arg depends on the object type: src table for triggers, NULL for others.
+ * \param arg depends on the object type: src table for triggers and indexes,
+ *            NULL for others.
  */
 int db_check_component(db_conn_t *conn, db_object_e obj_type, const char *name, const char *arg);
 
@@ -118,11 +197,27 @@ int db_check_component(db_conn_t *conn, db_object_e obj_type, const char *name,
 int            db_create_trigger( db_conn_t * conn, const char *name, const char *event,
                                const char *table, const char *body );
 
+/**
+ * Load a tab-separated file into a table (existing rows are replaced).
+ * Tabs, newlines and backslashes in values are escaped by a backslash,
+ * and \N stands for NULL.
+ * \param fields    comma-separated list of the fields in the file.
+ * \param set_field optional field to be set to set_expr, an SQL expression
+ *                  of the loaded fields.
+ */
+int db_load_file(db_conn_t *conn, const char *path, const char *table,
+                 const char *fields, const char *set_field,
+                 const char *set_expr);
+
 /* -------------------- miscellaneous routines ---------------- */
 
 /* escape a string in a SQL request */
 int db_escape_string(db_conn_t *conn, char *str_out, size_t out_size, const char *str_in);
 
+/* append a binary value to a SQL request, as a literal */
+void db_append_binary(db_conn_t *conn, GString *req, const void *buf,
+                      size_t len);
+
 /* retrieve error message */
 char          *db_errmsg( db_conn_t * conn, char *errmsg, unsigned int buflen );
 
@@ -0,0 +1,1223 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Accounting maintained by robinhood instead of DB triggers.
+ *
+ * Changes are computed from the attributes of entries before and after
+ * they are modified. They are aggregated in memory by ACCT_STAT row
+ * (uid, gid, type, status...), and written to ACCT_STAT every
+ * accounting_flush_interval, in a single transaction.
+ * Without triggers, there is no contention on ACCT_STAT rows between
+ * pipeline threads, so DB batches can run in parallel.
+ *
+ * When ACCT_STAT has to be (re)built, it is populated online: a background
+ * thread walks the entries by ranges of ids and accounts them in a shadow
+ * table, while the changes of entries already scanned are applied to it.
+ * The shadow table then replaces ACCT_STAT.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "Memory.h"
+#include "rbh_misc.h"
+#include <pthread.h>
+#include <string.h>
+#include <inttypes.h>
+
+/** max number of ACCT_STAT rows per INSERT request */
+#define ACCT_INSERT_CHUNK   1000
+
+#define MAX_DB_FIELDS 64
+
+/** changes of an ACCT_STAT row */
+struct acct_delta {
+    long long count;
+    long long size;
+    long long blocks;
+    long long sz[SZ_PROFIL_COUNT];
+};
+
+/** accounting values of an entry */
+struct acct_state {
+    /** ACCT_STAT primary key values (NULL if the entry doesn't exist) */
+    char               *key;
+    unsigned long long  size;
+    unsigned long long  blocks;
+};
+
+/** accounting values of a removed entry */
+struct acct_item {
+    pktype              pk;
+    struct acct_state   state;
+};
+
+struct lmgr_acct_tab {
+    /** key: list of ACCT_STAT primary key values, as SQL strings.
+     *  value: struct acct_delta */
+    GHashTable *deltas;
+    /** removed entries, while ACCT_STAT is rebuilt (struct acct_item) */
+    GPtrArray  *items;
+    /** ACCT_STAT has been emptied */
+    bool        reset;
+};
+
+/* changes not yet written to DB */
+static pthread_mutex_t acct_lock = PTHREAD_MUTEX_INITIALIZER;
+static lmgr_acct_tab_t *acct_pending = NULL;
+static time_t acct_next_flush = 0;
+
+/* only one flush at once, to avoid deadlocks between flushing threads */
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef enum {
+    RB_NONE,
+    RB_RUNNING,
+    RB_DONE,
+    RB_FAILED
+} rebuild_status_e;
+
+/** range of entries recently scanned by the rebuild */
+struct rb_window {
+    time_t      time;       /**< end of the scan */
+    pktype      lo;         /**< ids in (lo, hi] */
+    pktype      hi;
+    bool        last;       /**< last range: no upper bound */
+    /** pk -> hash of the state read by the scan (missing if no entry) */
+    GHashTable *states;
+};
+
+/** online rebuild of ACCT_STAT (protected by acct_lock) */
+static struct acct_rebuild {
+    rebuild_status_e    status;
+    const char         *src_table;
+    /** entries up to this id are accounted in the shadow table */
+    pktype              cursor;
+    /** all entries have been scanned */
+    bool                scan_done;
+    /** ACCT_STAT has been emptied: scan again from the beginning */
+    bool                restart;
+    /** recently scanned ranges (struct rb_window), most recent first */
+    GQueue             *windows;
+    /** pk -> struct acct_state: last state of changed entries
+     *  that are not scanned yet */
+    GHashTable         *inflight;
+    /* progress */
+    time_t              start;
+    time_t              scan_end;
+    time_t              end;
+    uint64_t            est_total;
+    uint64_t            nb_scanned;
+    uint64_t            nb_applied;
+    uint64_t            nb_deferred;
+    uint64_t            nb_reconciled;
+} rebuild = {
+    .status = RB_NONE,
+};
+
+static inline bool rebuild_running(void)
+{
+    return rebuild.status == RB_RUNNING;
+}
+
+/** table to write accounting changes to (acct_lock must be held) */
+static inline const char *acct_target(void)
+{
+    return (rebuild.status == RB_RUNNING || rebuild.status == RB_FAILED) ?
+        ACCT_REBUILD_TABLE : ACCT_TABLE;
+}
+
+lmgr_acct_tab_t *lmgr_acct_tab_new(void)
+{
+    lmgr_acct_tab_t *tab = MemAlloc(sizeof(*tab));
+
+    if (tab == NULL)
+        return NULL;
+
+    tab->deltas = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        g_free);
+    tab->items = NULL;
+    tab->reset = false;
+    return tab;
+}
+
+static void acct_item_free(gpointer ptr)
+{
+    struct acct_item *item = ptr;
+
+    g_free(item->state.key);
+    g_free(item);
+}
+
+void lmgr_acct_tab_free(lmgr_acct_tab_t *tab)
+{
+    if (tab == NULL)
+        return;
+
+    g_hash_table_destroy(tab->deltas);
+    if (tab->items != NULL)
+        g_ptr_array_free(tab->items, TRUE);
+    MemFree(tab);
+}
+
+void lmgr_acct_tab_clear(lmgr_acct_tab_t *tab)
+{
+    g_hash_table_remove_all(tab->deltas);
+    if (tab->items != NULL)
+        g_ptr_array_set_size(tab->items, 0);
+    tab->reset = false;
+}
+
+attr_mask_t ListMgr_AcctMask(void)
+{
+    return attr_mask_or(&acct_pk_attr_set, &acct_attr_set);
+}
+
+static inline bool acct_attr_isset(const attr_set_t *p_set, unsigned int i)
+{
+    if (p_set == NULL || !attr_mask_test_index(&p_set->attr_mask, i))
+        return false;
+
+    /* status may be unset, even if it is in the mask */
+    if (is_status_field(i))
+        return p_set->attr_values.sm_status != NULL
+            && p_set->attr_values.sm_status[attr2status_index(i)] != NULL;
+
+    return true;
+}
+
+/** build the ACCT_STAT key of an entry: values of p_set, or p_dflt
+ *  for missing attributes, or DB defaults */
+static void acct_key(lmgr_t *p_mgr, GString *key, const attr_set_t *p_set,
+                     const attr_set_t *p_dflt)
+{
+    int i, cookie;
+    bool first = true;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (!is_acct_pk(i))
+            continue;
+
+        if (!first)
+            g_string_append_c(key, ',');
+        first = false;
+
+        if (acct_attr_isset(p_set, i))
+            print_attr_value(p_mgr, key, p_set, i);
+        else if (acct_attr_isset(p_dflt, i))
+            print_attr_value(p_mgr, key, p_dflt, i);
+        else {
+            const db_type_u *dflt = default_field_value(i);
+
+            if (dflt == NULL)
+                g_string_append(key, "NULL");
+            else
+                printdbtype(&p_mgr->conn, key, field_type(i), dflt);
+        }
+    }
+}
+
+#define ACCT_VAL(_s, _d, _attr) \
+    (ATTR_MASK_TEST(_s, _attr) ? ATTR(_s, _attr) : \
+     ((_d) != NULL && ATTR_MASK_TEST(_d, _attr)) ? ATTR(_d, _attr) : 0)
+
+/** get the accounting values of an entry (see acct_key()) */
+static void acct_state_get(lmgr_t *p_mgr, struct acct_state *st,
+                           const attr_set_t *p_set, const attr_set_t *p_dflt)
+{
+    GString *key = g_string_new(NULL);
+
+    acct_key(p_mgr, key, p_set, p_dflt);
+    st->key = g_string_free(key, FALSE);
+    st->size = ACCT_VAL(p_set, p_dflt, size);
+    st->blocks = ACCT_VAL(p_set, p_dflt, blocks);
+}
+
+static void acct_state_copy(struct acct_state *tgt,
+                            const struct acct_state *src)
+{
+    tgt->key = g_strdup(src->key);
+    tgt->size = src->size;
+    tgt->blocks = src->blocks;
+}
+
+static void acct_state_destroy(gpointer ptr)
+{
+    struct acct_state *st = ptr;
+
+    g_free(st->key);
+    g_free(st);
+}
+
+/** FNV-1a hash of the accounting values of an entry (0 if no entry) */
+static uint64_t acct_state_hash(const struct acct_state *st)
+{
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t h = 14695981039346656037ULL;
+    const char *c;
+
+    if (st == NULL || st->key == NULL)
+        return 0;
+
+    for (c = st->key; *c != '\0'; c++)
+        h = (h ^ (unsigned char)*c) * prime;
+    h = (h ^ st->size) * prime;
+    h = (h ^ st->blocks) * prime;
+
+    return h == 0 ? 1 : h;
+}
+
+/** add (sign=1) or subtract (sign=-1) accounting values to the given set */
+static void acct_tab_add_state(lmgr_acct_tab_t *tab,
+                               const struct acct_state *st, int sign)
+{
+    struct acct_delta *d;
+
+    if (st->key == NULL)
+        return;
+
+    d = g_hash_table_lookup(tab->deltas, st->key);
+    if (d == NULL) {
+        d = g_new0(struct acct_delta, 1);
+        g_hash_table_insert(tab->deltas, g_strdup(st->key), d);
+    }
+
+    d->count += sign;
+    d->size += sign * (long long)st->size;
+    d->blocks += sign * (long long)st->blocks;
+    d->sz[sz_index(st->size)] += sign;
+}
+
+/** add (sign=1) or subtract (sign=-1) an entry to the given set */
+static void acct_tab_add(lmgr_t *p_mgr, lmgr_acct_tab_t *tab,
+                         const attr_set_t *p_set, const attr_set_t *p_dflt,
+                         int sign)
+{
+    struct acct_state st;
+
+    acct_state_get(p_mgr, &st, p_set, p_dflt);
+    acct_tab_add_state(tab, &st, sign);
+    g_free(st.key);
+}
+
+/** add the changes of 'src' to 'tgt' */
+static void acct_tab_merge(lmgr_acct_tab_t *tgt, lmgr_acct_tab_t *src)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, src->deltas);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        struct acct_delta *s = value;
+        struct acct_delta *d = g_hash_table_lookup(tgt->deltas, key);
+        unsigned int i;
+
+        if (d == NULL) {
+            /* just move the item */
+            g_hash_table_iter_steal(&iter);
+            g_hash_table_insert(tgt->deltas, key, value);
+            continue;
+        }
+
+        d->count += s->count;
+        d->size += s->size;
+        d->blocks += s->blocks;
+        for (i = 0; i < SZ_PROFIL_COUNT; i++)
+            d->sz[i] += s->sz[i];
+    }
+}
+
+static inline bool delta_is_null(const struct acct_delta *d)
+{
+    unsigned int i;
+
+    if (d->count != 0 || d->size != 0 || d->blocks != 0)
+        return false;
+
+    for (i = 0; i < SZ_PROFIL_COUNT; i++)
+        if (d->sz[i] != 0)
+            return false;
+    return true;
+}
+
+static void append_delta(GString *req, bool *first, const char *field,
+                         long long val)
+{
+    if (val == 0)
+        return;
+
+    /* ACCT_STAT fields are unsigned: never add a negative value,
+     * and don't go below 0 if the table was not consistent */
+    if (val > 0)
+        g_string_append_printf(req, "%s%s=%s+%llu", *first ? "" : ",",
+                               field, field, (unsigned long long)val);
+    else
+        g_string_append_printf(req, "%s%s=CASE WHEN %s>%llu THEN %s-%llu "
+                               "ELSE 0 END", *first ? "" : ",", field, field,
+                               (unsigned long long)-val, field,
+                               (unsigned long long)-val);
+    *first = false;
+}
+
+/** write a set of changes to ACCT_STAT (no transaction management) */
+static int acct_write_no_tx(lmgr_t *p_mgr, lmgr_acct_tab_t *tab,
+                            const char *table)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    GString *req = g_string_new(NULL);
+    GString *pk_fields = g_string_new(NULL);
+    unsigned int nb = 0;
+    int rc = DB_SUCCESS;
+
+    attrmask2fieldlist(pk_fields, acct_pk_attr_set, T_ACCT, "", "", 0);
+
+    /* first make sure all rows exist */
+    g_hash_table_iter_init(&iter, tab->deltas);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (delta_is_null(value))
+            continue;
+
+        if (nb == 0)
+            g_string_printf(req, INSERT_IGNORE " INTO %s(%s) VALUES ",
+                            table, pk_fields->str);
+        else
+            g_string_append_c(req, ',');
+
+        g_string_append_printf(req, "(%s)", (char *)key);
+        nb++;
+
+        if (nb == ACCT_INSERT_CHUNK) {
+            rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+            if (rc)
+                goto out;
+            nb = 0;
+        }
+    }
+    if (nb > 0) {
+        rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+        if (rc)
+            goto out;
+    }
+
+    /* then update them */
+    g_hash_table_iter_init(&iter, tab->deltas);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        struct acct_delta *d = value;
+        bool first = true;
+        unsigned int i;
+
+        if (delta_is_null(d))
+            continue;
+
+        g_string_printf(req, "UPDATE %s SET ", table);
+        append_delta(req, &first, ACCT_FIELD_COUNT, d->count);
+        append_delta(req, &first, "size", d->size);
+        append_delta(req, &first, "blocks", d->blocks);
+        for (i = 0; i < SZ_PROFIL_COUNT; i++)
+            append_delta(req, &first, sz_field[i], d->sz[i]);
+        g_string_append_printf(req, " WHERE (%s)=(%s)", pk_fields->str,
+                               (char *)key);
+
+        rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+        if (rc)
+            goto out;
+    }
+
+ out:
+    g_string_free(pk_fields, TRUE);
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+/** write a set of changes to ACCT_STAT in a single transaction */
+static int acct_write(lmgr_t *p_mgr, lmgr_acct_tab_t *tab, const char *table)
+{
+    int rc;
+
+    /* Changes are kept for the next flush if they can't be written:
+     * they must be committed at once, whatever the commit behavior, so
+     * they are never applied twice. Don't include operations of a pending
+     * transaction of this connection. */
+    rc = lmgr_flush_commit(p_mgr);
+    if (rc)
+        return rc;
+
+ retry:
+    rc = _lmgr_begin(p_mgr, 1);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        return rc;
+
+    rc = acct_write_no_tx(p_mgr, tab, table);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc) {
+        _lmgr_rollback(p_mgr, 1);
+        return rc;
+    }
+
+    rc = _lmgr_commit(p_mgr, 1);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    return rc;
+}
+
+/** flush pending changes (flush_lock must be held) */
+static int acct_flush_locked(lmgr_t *p_mgr)
+{
+    lmgr_acct_tab_t *tab;
+    const char *table;
+    unsigned int count;
+    int rc;
+
+    P(acct_lock);
+    tab = acct_pending;
+    acct_pending = NULL;
+    acct_next_flush = time(NULL) + lmgr_config.acct_flush_interval;
+    table = acct_target();
+    V(acct_lock);
+
+    if (tab == NULL)
+        return DB_SUCCESS;
+
+    count = g_hash_table_size(tab->deltas);
+    rc = acct_write(p_mgr, tab, table);
+    if (rc) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to write accounting changes"
+                   " to %s (error %d): will retry later", table, rc);
+        /* keep them for next flush */
+        P(acct_lock);
+        if (acct_pending != NULL) {
+            acct_tab_merge(tab, acct_pending);
+            lmgr_acct_tab_free(acct_pending);
+        }
+        acct_pending = tab;
+        V(acct_lock);
+    } else {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG, "%u %s rows updated", count, table);
+        lmgr_acct_tab_free(tab);
+    }
+    return rc;
+}
+
+/** flush pending changes.
+ * @param wait if false, give up if another thread is flushing.
+ */
+static int acct_flush(lmgr_t *p_mgr, bool wait)
+{
+    int rc;
+
+    if (wait)
+        P(flush_lock);
+    else if (pthread_mutex_trylock(&flush_lock) != 0)
+        return DB_SUCCESS;
+
+    rc = acct_flush_locked(p_mgr);
+
+    V(flush_lock);
+    return rc;
+}
+
+int ListMgr_AcctFlush(lmgr_t *p_mgr)
+{
+    if (!lmgr_app_acct())
+        return DB_SUCCESS;
+
+    return acct_flush(p_mgr, true);
+}
+
+/** get the pending set (acct_lock must be held) */
+static lmgr_acct_tab_t *get_pending(void)
+{
+    if (acct_pending == NULL)
+        acct_pending = lmgr_acct_tab_new();
+    return acct_pending;
+}
+
+static uint64_t *hash_dup(uint64_t h)
+{
+    uint64_t *p = g_new(uint64_t, 1);
+
+    *p = h;
+    return p;
+}
+
+static void rb_window_free(gpointer ptr)
+{
+    struct rb_window *w = ptr;
+
+    g_hash_table_destroy(w->states);
+    g_free(w);
+}
+
+/** get the range of recently scanned entries an entry belongs to
+ * (acct_lock must be held) */
+static struct rb_window *rebuild_window(PK_ARG_T pk)
+{
+    GList *l;
+
+    for (l = g_queue_peek_head_link(rebuild.windows); l != NULL; l = l->next) {
+        struct rb_window *w = l->data;
+
+        if (strcmp(pk, w->lo) > 0 && (w->last || strcmp(pk, w->hi) <= 0))
+            return w;
+    }
+    return NULL;
+}
+
+/**
+ * Account the change of an entry while ACCT_STAT is rebuilt
+ * (acct_lock must be held).
+ * The DB change is committed before it is accounted, so the scan may have
+ * read the entry before or after the change:
+ * - changes of entries not scanned yet are remembered, and checked against
+ *   the state read by the scan of their range;
+ * - changes of recently scanned entries are only applied if the scan read
+ *   the previous state of the entry.
+ */
+static void rebuild_route(lmgr_acct_tab_t *tab, PK_ARG_T pk,
+                          const struct acct_state *old,
+                          const struct acct_state *new)
+{
+    struct rb_window *w;
+
+    if (!rebuild.scan_done && strcmp(pk, rebuild.cursor) > 0) {
+        struct acct_state *st = g_new0(struct acct_state, 1);
+
+        acct_state_copy(st, new);
+        g_hash_table_replace(rebuild.inflight, g_strdup(pk), st);
+        rebuild.nb_deferred++;
+        return;
+    }
+
+    w = rebuild_window(pk);
+    if (w != NULL) {
+        uint64_t *scanned = g_hash_table_lookup(w->states, pk);
+        uint64_t h_scan = scanned ? *scanned : 0;
+        uint64_t h_new = acct_state_hash(new);
+
+        /* the scan already read the new state, or a later one */
+        if (h_scan == h_new || h_scan != acct_state_hash(old))
+            return;
+
+        if (h_new == 0)
+            g_hash_table_remove(w->states, pk);
+        else if (scanned != NULL)
+            *scanned = h_new;
+        else
+            g_hash_table_insert(w->states, g_strdup(pk), hash_dup(h_new));
+    }
+
+    acct_tab_add_state(tab, old, -1);
+    acct_tab_add_state(tab, new, 1);
+    rebuild.nb_applied++;
+}
+
+void ListMgr_AcctDelta(lmgr_t *p_mgr, const entry_id_t *p_id,
+                       const attr_set_t *p_old, const attr_set_t *p_new)
+{
+    lmgr_acct_tab_t *tab;
+    bool need_flush;
+
+    if (!lmgr_app_acct() || (p_old == NULL && p_new == NULL))
+        return;
+
+    P(acct_lock);
+    tab = get_pending();
+    if (rebuild.status == RB_FAILED) {
+        /* ACCT_STAT will be rebuilt at next startup */
+    } else if (tab != NULL && rebuild_running()) {
+        struct acct_state old = { 0 };
+        struct acct_state new = { 0 };
+        DEF_PK(pk);
+
+        entry_id2pk(p_id, PTR_PK(pk));
+        if (p_old != NULL)
+            acct_state_get(p_mgr, &old, p_old, NULL);
+        if (p_new != NULL)
+            acct_state_get(p_mgr, &new, p_new, p_old);
+
+        rebuild_route(tab, pk, &old, &new);
+
+        g_free(old.key);
+        g_free(new.key);
+    } else if (tab != NULL) {
+        if (p_old != NULL)
+            acct_tab_add(p_mgr, tab, p_old, NULL, -1);
+        if (p_new != NULL)
+            acct_tab_add(p_mgr, tab, p_new, p_old, 1);
+    }
+    need_flush = (time(NULL) >= acct_next_flush);
+    V(acct_lock);
+
+    /* the first thread that sees the deadline does the flush */
+    if (need_flush)
+        acct_flush(p_mgr, false);
+}
+
+bool ListMgr_AcctGet(lmgr_t *p_mgr, const entry_id_t *p_id,
+                     attr_set_t *p_old)
+{
+    int rc;
+
+    if (!lmgr_app_acct())
+        return false;
+
+    p_old->attr_mask = ListMgr_AcctMask();
+    rc = ListMgr_Get(p_mgr, p_id, p_old);
+    if (rc == DB_SUCCESS)
+        return true;
+
+    if (rc != DB_NOT_EXISTS)
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to get accounting "
+                   "attributes of " DFID " (error %d)", PFID(p_id), rc);
+    ATTR_MASK_INIT(p_old);
+    return false;
+}
+
+int lmgr_acct_rm_ids(lmgr_t *p_mgr, lmgr_acct_tab_t *tab, const char *id_set)
+{
+    GString *req;
+    result_handle_t result;
+    char *field_tab[MAX_DB_FIELDS + 1];
+    attr_mask_t mask = ListMgr_AcctMask();
+    unsigned int nb;
+    bool keep_items;
+    int rc;
+
+    mask = attr_mask_and(&mask, &main_attr_set);
+
+    /* the rebuild needs to know which entries are removed */
+    P(acct_lock);
+    keep_items = rebuild_running();
+    V(acct_lock);
+    if (keep_items && tab->items == NULL)
+        tab->items = g_ptr_array_new_with_free_func(acct_item_free);
+
+    req = g_string_new("SELECT id,");
+    nb = attrmask2fieldlist(req, mask, T_MAIN, "", "", 0);
+    g_string_append_printf(req, " FROM " MAIN_TABLE " WHERE id IN (%s)",
+                           id_set);
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    g_string_free(req, TRUE);
+    if (rc)
+        return rc;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, field_tab, nb + 1))
+           == DB_SUCCESS) {
+        attr_set_t attrs = ATTR_SET_INIT;
+
+        attrs.attr_mask = mask;
+        rc = result2attrset(T_MAIN, field_tab + 1, nb, &attrs);
+        if (rc == DB_SUCCESS) {
+            acct_tab_add(p_mgr, tab, &attrs, NULL, -1);
+
+            if (keep_items && field_tab[0] != NULL) {
+                struct acct_item *item = g_new0(struct acct_item, 1);
+
+                rh_strncpy(item->pk, field_tab[0], sizeof(item->pk));
+                acct_state_get(p_mgr, &item->state, &attrs, NULL);
+                g_ptr_array_add(tab->items, item);
+            }
+        }
+        ListMgr_FreeAttrs(&attrs);
+        if (rc)
+            break;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    return (rc == DB_END_OF_LIST) ? DB_SUCCESS : rc;
+}
+
+int lmgr_acct_rm_all(lmgr_t *p_mgr, lmgr_acct_tab_t *tab)
+{
+    char req[256];
+
+    lmgr_acct_tab_clear(tab);
+    tab->reset = true;
+
+    P(acct_lock);
+    snprintf(req, sizeof(req), "DELETE FROM %s", acct_target());
+    V(acct_lock);
+
+    return db_exec_sql(&p_mgr->conn, req, NULL);
+}
+
+/** scan all entries again (acct_lock must be held) */
+static void rebuild_reset(void)
+{
+    rebuild.cursor[0] = '\0';
+    rebuild.scan_done = false;
+    rebuild.restart = true;
+    rebuild.nb_scanned = 0;
+    g_queue_free_full(rebuild.windows, rb_window_free);
+    rebuild.windows = g_queue_new();
+    g_hash_table_remove_all(rebuild.inflight);
+}
+
+void lmgr_acct_tab_commit(lmgr_acct_tab_t *tab)
+{
+    lmgr_acct_tab_t *pending;
+
+    P(acct_lock);
+    pending = get_pending();
+    if (pending != NULL) {
+        /* changes before ACCT_STAT was emptied are obsolete */
+        if (tab->reset) {
+            lmgr_acct_tab_clear(pending);
+            if (rebuild_running())
+                rebuild_reset();
+        }
+
+        if (rebuild.status == RB_FAILED) {
+            /* ACCT_STAT will be rebuilt at next startup */
+        } else if (!rebuild_running()) {
+            acct_tab_merge(pending, tab);
+        } else if (tab->items != NULL) {
+            struct acct_state none = { 0 };
+            unsigned int i;
+
+            for (i = 0; i < tab->items->len; i++) {
+                struct acct_item *item = g_ptr_array_index(tab->items, i);
+
+                rebuild_route(pending, item->pk, &item->state, &none);
+            }
+        }
+    }
+    V(acct_lock);
+
+    lmgr_acct_tab_free(tab);
+}
+
+/* -------------------- Online rebuild of ACCT_STAT ---------------- */
+
+/** number of entries read at once by the rebuild */
+#define ACCT_REBUILD_CHUNK  10000
+
+/** How long (in seconds) the state of scanned entries is kept. It must
+ * exceed the time between the commit of an entry change and its accounting
+ * by ListMgr_AcctDelta(). */
+#define ACCT_REBUILD_GRACE  30
+
+/** estimated number of entries to be scanned */
+static uint64_t rebuild_estimate(lmgr_t *p_mgr, const char *table)
+{
+    uint64_t count = 0;
+#ifdef _MYSQL
+    result_handle_t result;
+    char req[512];
+    char *res = NULL;
+
+    /* COUNT(*) would scan the whole table: use statistics */
+    snprintf(req, sizeof(req), "SELECT TABLE_ROWS FROM information_schema.TABLES"
+             " WHERE TABLE_SCHEMA=DATABASE() AND TABLE_NAME='%s'", table);
+    if (db_exec_sql(&p_mgr->conn, req, &result) != DB_SUCCESS)
+        return 0;
+    if (db_next_record(&p_mgr->conn, &result, &res, 1) == DB_SUCCESS
+        && res != NULL)
+        sscanf(res, "%" SCNu64, &count);
+    db_result_free(&p_mgr->conn, &result);
+#else
+    if (lmgr_table_count(&p_mgr->conn, table, &count) != DB_SUCCESS)
+        count = 0;
+#endif
+    return count;
+}
+
+/** Empty the shadow table after ACCT_STAT has been emptied. */
+static int rebuild_truncate(lmgr_t *p_mgr)
+{
+    int rc;
+
+    P(flush_lock);
+    P(acct_lock);
+    if (acct_pending != NULL)
+        lmgr_acct_tab_clear(acct_pending);
+    rebuild.restart = false;
+    V(acct_lock);
+
+    rc = db_exec_sql(&p_mgr->conn, "DELETE FROM " ACCT_REBUILD_TABLE, NULL);
+    V(flush_lock);
+    return rc;
+}
+
+/**
+ * Account the next range of entries in the shadow table.
+ * @param[in,out] req   buffer for the request.
+ */
+static int rebuild_chunk(lmgr_t *p_mgr, GString *req)
+{
+    result_handle_t result;
+    char *res[MAX_DB_FIELDS + 1];
+    attr_mask_t mask = ListMgr_AcctMask();
+    table_enum table;
+    GHashTable *scanned;
+    GHashTableIter iter;
+    gpointer key, value;
+    struct rb_window *w;
+    lmgr_acct_tab_t *tab;
+    pktype lo, hi;
+    unsigned int nb, nrows = 0;
+    bool end;
+    time_t now;
+    int rc;
+
+    if (!strcmp(rebuild.src_table, ANNEX_TABLE)) {
+        table = T_ANNEX;
+        mask = attr_mask_and(&mask, &annex_attr_set);
+    } else {
+        table = T_MAIN;
+        mask = attr_mask_and(&mask, &main_attr_set);
+    }
+
+    P(acct_lock);
+    rh_strncpy(lo, rebuild.cursor, sizeof(lo));
+    V(acct_lock);
+    rh_strncpy(hi, lo, sizeof(hi));
+
+    g_string_assign(req, "SELECT id,");
+    nb = attrmask2fieldlist(req, mask, table, "", "", 0);
+    g_string_append_printf(req, " FROM %s WHERE id>" DPK " ORDER BY id"
+                           " LIMIT %u", rebuild.src_table, lo,
+                           ACCT_REBUILD_CHUNK);
+
+    /* pk -> struct acct_state */
+    scanned = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                    acct_state_destroy);
+
+ retry:
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto out;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, res, nb + 1))
+           == DB_SUCCESS) {
+        attr_set_t attrs = ATTR_SET_INIT;
+        struct acct_state *st;
+
+        if (res[0] == NULL) {
+            rc = DB_REQUEST_FAILED;
+            break;
+        }
+
+        attrs.attr_mask = mask;
+        rc = result2attrset(table, res + 1, nb, &attrs);
+        if (rc) {
+            ListMgr_FreeAttrs(&attrs);
+            break;
+        }
+
+        st = g_new0(struct acct_state, 1);
+        acct_state_get(p_mgr, st, &attrs, NULL);
+        g_hash_table_replace(scanned, g_strdup(res[0]), st);
+        ListMgr_FreeAttrs(&attrs);
+
+        rh_strncpy(hi, res[0], sizeof(hi));
+        nrows++;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc != DB_END_OF_LIST)
+        goto out;
+    rc = DB_SUCCESS;
+    end = (nrows < ACCT_REBUILD_CHUNK);
+
+    P(acct_lock);
+    tab = get_pending();
+    if (rebuild.restart || tab == NULL) {
+        /* ACCT_STAT was emptied during the scan: drop this chunk */
+        V(acct_lock);
+        goto out;
+    }
+
+    /* entries changed during the scan: account their last state */
+    g_hash_table_iter_init(&iter, rebuild.inflight);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        struct acct_state *st = value;
+
+        if (!end && strcmp(key, hi) > 0)
+            continue;
+
+        if (acct_state_hash(st) ==
+            acct_state_hash(g_hash_table_lookup(scanned, key)))
+            continue;
+
+        if (st->key == NULL)
+            g_hash_table_remove(scanned, key);
+        else {
+            g_hash_table_iter_steal(&iter);
+            g_hash_table_replace(scanned, key, st);
+        }
+        rebuild.nb_reconciled++;
+    }
+    /* next scans will read the current state of other entries */
+    g_hash_table_remove_all(rebuild.inflight);
+
+    now = time(NULL);
+    w = g_new0(struct rb_window, 1);
+    w->time = now;
+    rh_strncpy(w->lo, lo, sizeof(w->lo));
+    rh_strncpy(w->hi, hi, sizeof(w->hi));
+    w->last = end;
+    w->states = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                      g_free);
+
+    g_hash_table_iter_init(&iter, scanned);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        uint64_t h = acct_state_hash(value);
+
+        acct_tab_add_state(tab, value, 1);
+        g_hash_table_insert(w->states, g_strdup(key), hash_dup(h));
+    }
+
+    g_queue_push_head(rebuild.windows, w);
+    while (g_queue_get_length(rebuild.windows) > 1) {
+        struct rb_window *old = g_queue_peek_tail(rebuild.windows);
+
+        if (old->time + ACCT_REBUILD_GRACE > now)
+            break;
+        rb_window_free(g_queue_pop_tail(rebuild.windows));
+    }
+
+    rh_strncpy(rebuild.cursor, hi, sizeof(rebuild.cursor));
+    rebuild.nb_scanned += nrows;
+    if (end) {
+        rebuild.scan_done = true;
+        rebuild.scan_end = now;
+    }
+    V(acct_lock);
+
+ out:
+    g_hash_table_destroy(scanned);
+    return rc;
+}
+
+/** Replace ACCT_STAT by the shadow table.
+ * @return true if the table has been replaced.
+ */
+static bool rebuild_swap(lmgr_t *p_mgr, int *p_rc)
+{
+    bool done = false;
+
+    /* the pending changes are written to the new table after the swap */
+    P(flush_lock);
+    P(acct_lock);
+    if (rebuild.scan_done && !rebuild.restart) {
+#ifdef _SQLITE
+        *p_rc = db_exec_sql(&p_mgr->conn, "ALTER TABLE " ACCT_REBUILD_TABLE
+                            " RENAME TO " ACCT_TABLE, NULL);
+#else
+        *p_rc = db_exec_sql(&p_mgr->conn, "RENAME TABLE " ACCT_REBUILD_TABLE
+                            " TO " ACCT_TABLE, NULL);
+#endif
+        if (*p_rc == DB_SUCCESS) {
+            rebuild.status = RB_DONE;
+            rebuild.end = time(NULL);
+            g_queue_free_full(rebuild.windows, rb_window_free);
+            rebuild.windows = NULL;
+            g_hash_table_destroy(rebuild.inflight);
+            rebuild.inflight = NULL;
+            done = true;
+        }
+    }
+    V(acct_lock);
+    V(flush_lock);
+    return done;
+}
+
+/** give up rebuilding ACCT_STAT */
+static void rebuild_fail(int rc)
+{
+    DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to build " ACCT_TABLE
+               " (error %d): accounting will be rebuilt at next startup", rc);
+
+    P(acct_lock);
+    rebuild.status = RB_FAILED;
+    rebuild.end = time(NULL);
+    if (acct_pending != NULL)
+        lmgr_acct_tab_clear(acct_pending);
+    g_queue_free_full(rebuild.windows, rb_window_free);
+    rebuild.windows = NULL;
+    g_hash_table_destroy(rebuild.inflight);
+    rebuild.inflight = NULL;
+    V(acct_lock);
+}
+
+static void *rebuild_thr(void *arg)
+{
+    lmgr_t lmgr;
+    GString *req;
+    bool restart, scan_done, due;
+    time_t scan_end;
+    uint64_t est;
+    char t[128];
+    int rc;
+
+    rc = ListMgr_InitAccess(&lmgr);
+    if (rc) {
+        rebuild_fail(rc);
+        return NULL;
+    }
+
+    est = rebuild_estimate(&lmgr, rebuild.src_table);
+    P(acct_lock);
+    rebuild.est_total = est;
+    V(acct_lock);
+    req = g_string_new(NULL);
+
+    for (;;) {
+        P(acct_lock);
+        restart = rebuild.restart;
+        scan_done = rebuild.scan_done;
+        scan_end = rebuild.scan_end;
+        due = (time(NULL) >= acct_next_flush);
+        V(acct_lock);
+
+        if (due) {
+            /* pipeline threads may be idle */
+            rc = acct_flush(&lmgr, false);
+            if (rc)
+                break;
+        }
+
+        if (restart) {
+            DisplayLog(LVL_EVENT, LISTMGR_TAG, ACCT_TABLE " was emptied: "
+                       "scanning entries again");
+            rc = rebuild_truncate(&lmgr);
+            if (rc)
+                break;
+        } else if (!scan_done) {
+            rc = rebuild_chunk(&lmgr, req);
+            if (rc)
+                break;
+        } else if (time(NULL) < scan_end + ACCT_REBUILD_GRACE) {
+            /* wait for changes committed before the end of the scan */
+            rh_sleep(1);
+        } else if (rebuild_swap(&lmgr, &rc)) {
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, ACCT_TABLE " built in %s "
+                       "(%" PRIu64 " entries)", FormatDurationFloat(t, sizeof(t),
+                       rebuild.end - rebuild.start), rebuild.nb_scanned);
+            break;
+        } else if (rc) {
+            break;
+        }
+    }
+
+    if (rc)
+        rebuild_fail(rc);
+
+    g_string_free(req, TRUE);
+    ListMgr_CloseAccess(&lmgr);
+    return NULL;
+}
+
+int lmgr_acct_rebuild_start(const char *src_table)
+{
+    pthread_attr_t attr;
+    pthread_t thr;
+    int rc;
+
+    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Populating " ACCT_TABLE " in "
+               "background. Reports won't use it until this is complete.");
+
+    P(acct_lock);
+    rebuild.status = RB_RUNNING;
+    rebuild.src_table = src_table;
+    rebuild.cursor[0] = '\0';
+    rebuild.scan_done = false;
+    rebuild.restart = false;
+    rebuild.windows = g_queue_new();
+    rebuild.inflight = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                             acct_state_destroy);
+    rebuild.start = time(NULL);
+    V(acct_lock);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thr, &attr, rebuild_thr, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to start accounting "
+                   "rebuild thread: %s", strerror(rc));
+        rebuild_fail(DB_REQUEST_FAILED);
+        return DB_REQUEST_FAILED;
+    }
+    return DB_SUCCESS;
+}
+
+void ListMgr_AcctRebuildDumpStats(void)
+{
+    time_t now = time(NULL);
+    char t1[128], t2[128];
+
+    P(acct_lock);
+    if (rebuild.status == RB_NONE) {
+        V(acct_lock);
+        return;
+    }
+
+    DisplayLog(LVL_MAJOR, "STATS", "==== " ACCT_TABLE " rebuild ====");
+    switch (rebuild.status) {
+    case RB_RUNNING:
+        if (!rebuild.scan_done) {
+            time_t elapsed = MAX2(now - rebuild.start, 1);
+            double speed = (double)rebuild.nb_scanned / elapsed;
+
+            DisplayLog(LVL_MAJOR, "STATS", "status: running, %" PRIu64
+                       " entries scanned (~%.1f%%), %.0f entries/sec",
+                       rebuild.nb_scanned, rebuild.est_total > 0 ?
+                       MIN2(100.0 * rebuild.nb_scanned / rebuild.est_total,
+                            100.0) : 0.0, speed);
+            if (speed > 0 && rebuild.est_total > rebuild.nb_scanned)
+                DisplayLog(LVL_MAJOR, "STATS", "elapsed: %s, ETA: ~%s",
+                           FormatDurationFloat(t1, sizeof(t1), elapsed),
+                           FormatDurationFloat(t2, sizeof(t2),
+                               (rebuild.est_total - rebuild.nb_scanned)
+                               / speed));
+            else
+                DisplayLog(LVL_MAJOR, "STATS", "elapsed: %s",
+                           FormatDurationFloat(t1, sizeof(t1), elapsed));
+        } else
+            DisplayLog(LVL_MAJOR, "STATS", "status: scan complete (%" PRIu64
+                       " entries), switching tables", rebuild.nb_scanned);
+        break;
+    case RB_DONE:
+        DisplayLog(LVL_MAJOR, "STATS", "status: done in %s (%" PRIu64
+                   " entries)", FormatDurationFloat(t1, sizeof(t1),
+                   rebuild.end - rebuild.start), rebuild.nb_scanned);
+        break;
+    case RB_FAILED:
+        DisplayLog(LVL_MAJOR, "STATS", "status: failed (will be rebuilt "
+                   "at next startup)");
+        break;
+    case RB_NONE:
+        break;
+    }
+    DisplayLog(LVL_MAJOR, "STATS", "concurrent changes: %" PRIu64 " applied, "
+               "%" PRIu64 " deferred to scan, %" PRIu64 " reconciled",
+               rebuild.nb_applied, rebuild.nb_deferred,
+               rebuild.nb_reconciled);
+    V(acct_lock);
+}
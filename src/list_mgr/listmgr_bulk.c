@@ -0,0 +1,568 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Bulk load of the initial scan of an empty database.
+ *
+ * Entries are not inserted row by row: they are written to tab-separated
+ * staging files (one per table and set of fields), which are loaded by
+ * large chunks (LOAD DATA LOCAL INFILE for MySQL). Secondary indexes and
+ * accounting triggers are dropped during the load, then indexes are built
+ * and ACCT_STAT is populated once at the end.
+ *
+ * A variable in VARS indicates a bulk load is running, so that indexes and
+ * triggers are restored at next startup if the process is interrupted.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "listmgr_stripe.h"
+#include "database.h"
+#include "Memory.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+/** staging files are loaded as soon as they reach this number of rows */
+#define BULK_CHUNK_ROWS     500000
+
+/** staging file of a table, for a given set of fields */
+struct bulk_file {
+    table_enum      table;
+    attr_mask_t     mask;       /**< fields of the table in the file */
+    FILE           *file;
+    char            path[RBH_PATH_MAX];
+    unsigned int    rows;
+};
+
+static struct bulk_load {
+    pthread_mutex_t lock;
+    bool            active;
+    char            dir[RBH_PATH_MAX];
+    GPtrArray      *files;      /**< struct bulk_file being written */
+    unsigned int    seq;        /**< to name staging files */
+    /* stats */
+    time_t          start;
+    uint64_t        nb_entries;
+    uint64_t        nb_loaded_files;
+    uint64_t        nb_loaded_rows;
+} bulk = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const table_enum bulk_tables[] = {T_MAIN, T_DNAMES, T_ANNEX};
+
+/** fields of a table in an attribute mask */
+static inline attr_mask_t table_mask(const attr_mask_t *mask,
+                                     table_enum table)
+{
+    switch (table) {
+    case T_MAIN:
+        return attr_mask_and(mask, &main_attr_set);
+    case T_DNAMES:
+        return attr_mask_and(mask, &names_attr_set);
+    case T_ANNEX:
+        return attr_mask_and(mask, &annex_attr_set);
+    default:
+        RBH_BUG("Unexpected table for bulk load");
+    }
+}
+
+/** same as entry_filter() for inserts */
+static inline bool bulk_filter(table_enum table, const attr_mask_t *fields,
+                               const attr_set_t *p_attrs)
+{
+    if (table == T_DNAMES)
+        return ATTR_MASK_TEST(p_attrs, name)
+            && ATTR_MASK_TEST(p_attrs, parent_id);
+
+    return !attr_mask_is_null(*fields);
+}
+
+/** create a new staging file (lock must be held) */
+static int bulk_file_open(struct bulk_file *bf)
+{
+    snprintf(bf->path, sizeof(bf->path), "%s/%s.%u", bulk.dir,
+             table2name(bf->table), bulk.seq++);
+    bf->rows = 0;
+    bf->file = fopen(bf->path, "w");
+    if (bf->file == NULL) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to create staging file "
+                   "%s: %s", bf->path, strerror(errno));
+        return DB_IO_ERROR;
+    }
+    return DB_SUCCESS;
+}
+
+/** get the staging file for a table and fields (lock must be held) */
+static struct bulk_file *bulk_file_get(table_enum table, attr_mask_t mask)
+{
+    struct bulk_file *bf;
+    int i;
+
+    for (i = 0; i < bulk.files->len; i++) {
+        bf = g_ptr_array_index(bulk.files, i);
+        if (bf->table == table && attr_mask_equal(&bf->mask, &mask))
+            return bf;
+    }
+
+    bf = MemCalloc(1, sizeof(*bf));
+    if (bf == NULL)
+        return NULL;
+    bf->table = table;
+    bf->mask = mask;
+    if (bulk_file_open(bf)) {
+        MemFree(bf);
+        return NULL;
+    }
+    g_ptr_array_add(bulk.files, bf);
+    return bf;
+}
+
+/** load a complete staging file, then remove it */
+static int bulk_file_load(lmgr_t *p_mgr, const struct bulk_file *bf)
+{
+    GString *fields;
+    int rc;
+
+    fields = g_string_new("id");
+    attrmask2fieldlist(fields, bf->mask, bf->table, "", "", AOF_LEADING_SEP);
+
+ retry:
+    if (bf->table == T_DNAMES)
+        rc = db_load_file(&p_mgr->conn, bf->path, DNAMES_TABLE, fields->str,
+                          "pkn", HNAME_DEF);
+    else
+        rc = db_load_file(&p_mgr->conn, bf->path, table2name(bf->table),
+                          fields->str, NULL, NULL);
+    if (lmgr_delayed_retry(p_mgr, rc) == 1)
+        goto retry;
+    g_string_free(fields, TRUE);
+
+    if (rc) {
+        char errmsg[1024];
+
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to load %s into %s: "
+                   "Error: %s", bf->path, table2name(bf->table),
+                   db_errmsg(&p_mgr->conn, errmsg, sizeof(errmsg)));
+        return rc;
+    }
+
+    DisplayLog(LVL_DEBUG, LISTMGR_TAG, "%u rows loaded into %s from %s",
+               bf->rows, table2name(bf->table), bf->path);
+    if (unlink(bf->path))
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to remove %s: %s",
+                   bf->path, strerror(errno));
+
+    P(bulk.lock);
+    bulk.nb_loaded_files++;
+    bulk.nb_loaded_rows += bf->rows;
+    V(bulk.lock);
+    return DB_SUCCESS;
+}
+
+/**
+ * Append rows to the staging file of a table.
+ * If the file is complete, it is loaded by the calling thread.
+ */
+static int bulk_write(lmgr_t *p_mgr, table_enum table, attr_mask_t mask,
+                      const GString *rows, unsigned int nb_rows)
+{
+    struct bulk_file *bf;
+    struct bulk_file full;
+    bool load = false;
+    int rc = DB_SUCCESS;
+
+    P(bulk.lock);
+    if (!bulk.active) {
+        V(bulk.lock);
+        return DB_NOT_ALLOWED;
+    }
+
+    bf = bulk_file_get(table, mask);
+    if (bf == NULL) {
+        rc = DB_IO_ERROR;
+        goto out_unlock;
+    }
+
+    if (fwrite(rows->str, 1, rows->len, bf->file) != rows->len) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to write to %s: %s",
+                   bf->path, strerror(errno));
+        rc = DB_IO_ERROR;
+        goto out_unlock;
+    }
+    bf->rows += nb_rows;
+
+    if (bf->rows >= BULK_CHUNK_ROWS) {
+        /* load it outside the lock, and go on with a new file */
+        full = *bf;
+        if (fclose(full.file)) {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to write to %s: %s",
+                       full.path, strerror(errno));
+            rc = DB_IO_ERROR;
+        } else
+            load = true;
+        rc = bulk_file_open(bf) ? DB_IO_ERROR : rc;
+    }
+
+ out_unlock:
+    V(bulk.lock);
+
+    if (load) {
+        int rc2 = bulk_file_load(p_mgr, &full);
+
+        if (rc2 && !rc)
+            rc = rc2;
+    }
+    return rc;
+}
+
+#ifdef _LUSTRE
+/** stripe tables are not bulk loaded: insert stripes of a batch */
+static int bulk_add_stripes(lmgr_t *p_mgr, entry_id_t **p_ids, pktype *pklist,
+                            attr_set_t **p_attrs, unsigned int count)
+{
+    attr_mask_t all_bits_on = {.std = ~0, .status = ~0, .sm_info = ~0LL};
+    int *validators;
+    int i, rc;
+
+    if (!stripe_fields(sum_masks(p_attrs, count, all_bits_on)))
+        return DB_SUCCESS;
+
+    validators = MemCalloc(count, sizeof(int));
+    if (validators == NULL)
+        return DB_NO_MEMORY;
+
+    for (i = 0; i < count; i++)
+#ifdef HAVE_LLAPI_FSWAP_LAYOUTS
+        validators[i] = ATTR_MASK_TEST(p_attrs[i], stripe_info) ?
+            ATTR(p_attrs[i], stripe_info).validator : VALID_NOSTRIPE;
+#else
+        validators[i] = VALID(p_ids[i]);
+#endif
+
+ retry:
+    rc = lmgr_begin(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc) == 1)
+        goto retry;
+    else if (rc)
+        goto out_free;
+
+    rc = batch_insert_stripe_info(p_mgr, pklist, validators, p_attrs, count,
+                                  true);
+    if (lmgr_delayed_retry(p_mgr, rc) == 1)
+        goto retry;
+    else if (rc) {
+        lmgr_rollback(p_mgr);
+        goto out_free;
+    }
+
+    rc = lmgr_commit(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc) == 1)
+        goto retry;
+
+ out_free:
+    MemFree(validators);
+    return rc;
+}
+#endif
+
+int ListMgr_BulkLoadAdd(lmgr_t *p_mgr, entry_id_t **p_ids,
+                        attr_set_t **p_attrs, unsigned int count)
+{
+    pktype *pklist;
+    GString *rows;
+    int i, j, t, rc = DB_SUCCESS;
+
+    if (count == 0)
+        return DB_SUCCESS;
+
+    if (!bulk.active)
+        return ListMgr_BatchInsert(p_mgr, p_ids, p_attrs, count, false);
+
+    for (i = 0; i < count; i++) {
+        if (readonly_fields(p_attrs[i]->attr_mask)) {
+            attr_mask_t and = attr_mask_and(&p_attrs[i]->attr_mask,
+                                            &readonly_attr_set);
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG,
+                       "Error: trying to insert read only values: attr_mask="
+                       DMASK, PMASK(&and));
+            return DB_INVALID_ARG;
+        }
+    }
+
+    pklist = MemCalloc(count, sizeof(pktype));
+    if (pklist == NULL)
+        return DB_NO_MEMORY;
+    for (i = 0; i < count; i++)
+        entry_id2pk(p_ids[i], PTR_PK(pklist[i]));
+
+    rows = g_string_new(NULL);
+
+    for (t = 0; t < sizeof(bulk_tables) / sizeof(*bulk_tables); t++) {
+        table_enum table = bulk_tables[t];
+
+        /* write consecutive entries with the same fields at once */
+        for (i = 0; i < count; i = j) {
+            attr_mask_t mask = table_mask(&p_attrs[i]->attr_mask, table);
+            unsigned int nb_rows = 0;
+
+            g_string_truncate(rows, 0);
+            for (j = i; j < count; j++) {
+                attr_mask_t m = table_mask(&p_attrs[j]->attr_mask, table);
+
+                if (!attr_mask_equal(&m, &mask))
+                    break;
+                if (!bulk_filter(table, &m, p_attrs[j]))
+                    continue;
+
+                g_string_append(rows, pklist[j]);
+                attrset2tsv(rows, p_attrs[j], table);
+                g_string_append_c(rows, '\n');
+                nb_rows++;
+            }
+
+            if (nb_rows > 0) {
+                rc = bulk_write(p_mgr, table, mask, rows, nb_rows);
+                if (rc)
+                    goto out_free;
+            }
+        }
+    }
+
+#ifdef _LUSTRE
+    rc = bulk_add_stripes(p_mgr, p_ids, pklist, p_attrs, count);
+    if (rc)
+        goto out_free;
+#endif
+
+    P(bulk.lock);
+    bulk.nb_entries += count;
+    V(bulk.lock);
+    p_mgr->nbop[OPIDX_INSERT] += count;
+
+ out_free:
+    g_string_free(rows, TRUE);
+    MemFree(pklist);
+    return rc;
+}
+
+/** remove the staging directory and the files it contains */
+static void bulk_clean_dir(const char *dir)
+{
+    char path[RBH_PATH_MAX];
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(dir);
+    if (d == NULL) {
+        if (errno != ENOENT)
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to open staging "
+                       "directory %s: %s", dir, strerror(errno));
+        return;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (unlink(path))
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to remove %s: %s",
+                       path, strerror(errno));
+    }
+    closedir(d);
+
+    if (rmdir(dir))
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to remove %s: %s", dir,
+                   strerror(errno));
+}
+
+/** restore indexes, triggers and accounting, then clear the bulk load
+ * marker */
+static int bulk_complete(db_conn_t *pconn, const char *dir)
+{
+    int rc;
+
+    rc = lmgr_bulk_finish(pconn);
+    if (rc) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to build indexes and "
+                   "accounting after bulk load (error %d): this will be "
+                   "retried at next startup", rc);
+        return rc;
+    }
+
+    bulk_clean_dir(dir);
+    return lmgr_set_var(pconn, BULK_LOAD_VAR, NULL);
+}
+
+int ListMgr_BulkLoadStart(void)
+{
+    lmgr_t lmgr;
+    bool empty = false;
+    int rc;
+
+    if (!lmgr_config.bulk_load)
+        return DB_NOT_ALLOWED;
+
+    rc = ListMgr_InitAccess(&lmgr);
+    if (rc)
+        return rc;
+
+    rc = lmgr_table_empty(&lmgr.conn, MAIN_TABLE, &empty);
+    if (rc)
+        goto close;
+    if (!empty) {
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Database is not empty: "
+                   "entries are inserted without bulk load");
+        rc = DB_NOT_ALLOWED;
+        goto close;
+    }
+
+    P(bulk.lock);
+    snprintf(bulk.dir, sizeof(bulk.dir), "%s/rbh_bulk.XXXXXX",
+             lmgr_config.bulk_load_dir);
+    if (mkdtemp(bulk.dir) == NULL) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to create staging "
+                   "directory in %s: %s", lmgr_config.bulk_load_dir,
+                   strerror(errno));
+        V(bulk.lock);
+        rc = DB_IO_ERROR;
+        goto close;
+    }
+    V(bulk.lock);
+
+    /* indexes and triggers will be restored at next startup
+     * if the load is interrupted */
+    rc = lmgr_set_var(&lmgr.conn, BULK_LOAD_VAR, bulk.dir);
+    if (rc)
+        goto rm_dir;
+
+    rc = lmgr_bulk_prepare(&lmgr.conn);
+    if (rc) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to prepare tables for "
+                   "bulk load (error %d)", rc);
+        bulk_complete(&lmgr.conn, bulk.dir);
+        goto close;
+    }
+
+    P(bulk.lock);
+    bulk.files = g_ptr_array_new();
+    bulk.seq = 0;
+    bulk.start = time(NULL);
+    bulk.nb_entries = 0;
+    bulk.nb_loaded_files = 0;
+    bulk.nb_loaded_rows = 0;
+    bulk.active = true;
+    V(bulk.lock);
+
+    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Database is empty: bulk loading "
+               "entries (staging files in %s)", bulk.dir);
+    goto close;
+
+ rm_dir:
+    bulk_clean_dir(bulk.dir);
+ close:
+    ListMgr_CloseAccess(&lmgr);
+    return rc;
+}
+
+int ListMgr_BulkLoadEnd(void)
+{
+    GPtrArray *files;
+    lmgr_t lmgr;
+    char t[128];
+    int i, rc, rc2;
+
+    P(bulk.lock);
+    if (!bulk.active) {
+        V(bulk.lock);
+        return DB_SUCCESS;
+    }
+    /* next entries are inserted the usual way */
+    bulk.active = false;
+    files = bulk.files;
+    bulk.files = NULL;
+    V(bulk.lock);
+
+    rc = ListMgr_InitAccess(&lmgr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to connect to the database "
+                   "to complete bulk load (error %d)", rc);
+        return rc;
+    }
+
+    /* load the remaining rows */
+    for (i = 0; i < files->len; i++) {
+        struct bulk_file *bf = g_ptr_array_index(files, i);
+
+        if (fclose(bf->file)) {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to write to %s: %s",
+                       bf->path, strerror(errno));
+            rc = DB_IO_ERROR;
+        } else if (bf->rows > 0) {
+            rc2 = bulk_file_load(&lmgr, bf);
+            if (rc2 && !rc)
+                rc = rc2;
+        }
+        MemFree(bf);
+    }
+    g_ptr_array_free(files, TRUE);
+
+    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Bulk load: %" PRIu64 " entries "
+               "(%" PRIu64 " rows from %" PRIu64 " files) loaded in %s. "
+               "Building indexes and accounting...", bulk.nb_entries,
+               bulk.nb_loaded_rows, bulk.nb_loaded_files,
+               FormatDurationFloat(t, sizeof(t), time(NULL) - bulk.start));
+    FlushLogs();
+
+    rc2 = bulk_complete(&lmgr.conn, bulk.dir);
+    if (rc2 && !rc)
+        rc = rc2;
+    else if (!rc2)
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Bulk load complete in %s",
+                   FormatDurationFloat(t, sizeof(t),
+                                       time(NULL) - bulk.start));
+
+    ListMgr_CloseAccess(&lmgr);
+    return rc;
+}
+
+int listmgr_bulk_recover(db_conn_t *pconn)
+{
+    char dir[RBH_PATH_MAX];
+    int rc;
+
+    rc = lmgr_get_var(pconn, BULK_LOAD_VAR, dir, sizeof(dir));
+    if (rc == DB_NOT_EXISTS)
+        return DB_SUCCESS;
+    else if (rc)
+        return rc;
+
+    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "A bulk load was interrupted: "
+               "building indexes and accounting. Entries that were not "
+               "loaded will be inserted by the next scan.");
+    FlushLogs();
+
+    return bulk_complete(pconn, dir);
+}
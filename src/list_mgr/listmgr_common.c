@@ -682,35 +682,47 @@ int attrmask2fieldcomparison(GString *str, attr_mask_t attr_mask,
     return nbfields;
 }
 
-static void print_attr_value(lmgr_t *p_mgr, GString *str,
-                             const attr_set_t *p_set, unsigned int attr_index)
+/** get the DB value of an attribute
+ * @param tmp buffer for values that must be converted */
+static db_type_e attr_db_value(const attr_set_t *p_set,
+                               unsigned int attr_index, db_type_u *typeu,
+                               char *tmp, size_t tmp_size)
 {
-    char tmp[1024];
-    db_type_u typeu;
     db_type_e t;
 
     if (attr_index < ATTR_COUNT) {
-        assign_union(&typeu, field_infos[attr_index].db_type,
+        assign_union(typeu, field_infos[attr_index].db_type,
                      attr_address_const(p_set, attr_index));
 
         if (is_sepdlist(attr_index)) {
-            separated_list2db(typeu.val_str, tmp, sizeof(tmp));
-            typeu.val_str = tmp;
+            separated_list2db(typeu->val_str, tmp, tmp_size);
+            typeu->val_str = tmp;
         }
         t = field_infos[attr_index].db_type;
     } else if (is_status_field(attr_index)) {
         unsigned int status_idx = attr2status_index(attr_index);
 
-        assign_union(&typeu, DB_TEXT, p_set->attr_values.sm_status[status_idx]);
+        assign_union(typeu, DB_TEXT, p_set->attr_values.sm_status[status_idx]);
         t = DB_TEXT;
     } else if (is_sm_info_field(attr_index)) {
         unsigned int info_idx = attr2sminfo_index(attr_index);
 
         t = sm_attr_info[info_idx].def->db_type;
-        assign_union(&typeu, t, (char *)p_set->attr_values.sm_info[info_idx]);
+        assign_union(typeu, t, (char *)p_set->attr_values.sm_info[info_idx]);
     } else
         RBH_BUG("Attribute index is not in a valid range");
 
+    return t;
+}
+
+void print_attr_value(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
+                      unsigned int attr_index)
+{
+    char tmp[1024];
+    db_type_u typeu;
+    db_type_e t;
+
+    t = attr_db_value(p_set, attr_index, &typeu, tmp, sizeof(tmp));
     printdbtype(&p_mgr->conn, str, t, &typeu);
 }
 
@@ -735,7 +747,10 @@ int attrset2valuelist(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
                 if (leading_comma || (nbfields > 0))
                     g_string_append(str, ",");
 
-                print_attr_value(p_mgr, str, p_set, i);
+                if (flags & AOF_PLACEHOLDER)
+                    g_string_append_c(str, '?');
+                else
+                    print_attr_value(p_mgr, str, p_set, i);
                 nbfields++;
             }
         }
@@ -771,7 +786,9 @@ int attrset2updatelist(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
             g_string_append_printf(str, "%s=", field_name(i));
 
             if (generic_value)
-                g_string_append_printf(str, "VALUES(%s)", field_name(i));
+                g_string_append_printf(str, UPSERT_VALUE, field_name(i));
+            else if (flags & AOF_PLACEHOLDER)
+                g_string_append_c(str, '?');
             else
                 print_attr_value(p_mgr, str, p_set, i);
 
@@ -781,6 +798,171 @@ int attrset2updatelist(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
     return nbfields;
 }
 
+int attrmask_field_count(attr_mask_t attr_mask, table_enum table)
+{
+    int i, cookie;
+    unsigned int nbfields = 0;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (attr_mask_test_index(&attr_mask, i) && match_table(table, i))
+            nbfields++;
+    }
+    return nbfields;
+}
+
+int bind_db_value(db_stmt_t *stmt, unsigned int idx, db_type_e type,
+                  const db_type_u *value_ptr)
+{
+    switch (type) {
+    case DB_ID:
+        {
+            DEF_PK(pk);
+            db_type_u u;
+
+            entry_id2pk(&value_ptr->val_id, PTR_PK(pk));
+            u.val_str = pk;
+            return db_stmt_bind(stmt, idx, PK_DB_TYPE, &u);
+        }
+    case DB_UIDGID:
+        return db_stmt_bind(stmt, idx, global_config.uid_gid_as_numbers ?
+                            DB_INT : DB_TEXT, value_ptr);
+    default:
+        return db_stmt_bind(stmt, idx, type, value_ptr);
+    }
+}
+
+/** bind an attribute value to a statement parameter */
+static int bind_attr_value(db_stmt_t *stmt, unsigned int idx,
+                           const attr_set_t *p_set, unsigned int attr_index)
+{
+    char tmp[1024];
+    db_type_u typeu;
+    db_type_e t;
+
+    t = attr_db_value(p_set, attr_index, &typeu, tmp, sizeof(tmp));
+    return bind_db_value(stmt, idx, t, &typeu);
+}
+
+/**
+ * Bind attribute values to statement parameters, in the same order
+ * as attrset2valuelist() and attrset2updatelist().
+ * @param idx   index of the first parameter. It is incremented for each
+ *              bound value.
+ * @param table T_MAIN, T_ANNEX, T_DNAMES
+ * @return nbr of fields, or a negative error code.
+ */
+int attrset2params(db_stmt_t *stmt, unsigned int *idx,
+                   const attr_set_t *p_set, table_enum table)
+{
+    int i, cookie, rc;
+    unsigned int nbfields = 0;
+
+    if ((table == T_STRIPE_INFO) || (table == T_STRIPE_ITEMS))
+        return -DB_NOT_SUPPORTED;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (attr_mask_test_index(&p_set->attr_mask, i)
+            && match_table(table, i)) {
+            rc = bind_attr_value(stmt, *idx, p_set, i);
+            if (rc)
+                return -rc;
+            (*idx)++;
+            nbfields++;
+        }
+    }
+    return nbfields;
+}
+
+/** append a string to a tab-separated row, escaping separators */
+static void tsv_append_str(GString *str, const char *val)
+{
+    const char *c;
+
+    for (c = val; *c != '\0'; c++) {
+        switch (*c) {
+        case '\\':
+            g_string_append(str, "\\\\");
+            break;
+        case '\t':
+            g_string_append(str, "\\t");
+            break;
+        case '\n':
+            g_string_append(str, "\\n");
+            break;
+        case '\r':
+            g_string_append(str, "\\r");
+            break;
+        default:
+            g_string_append_c(str, *c);
+        }
+    }
+}
+
+/** print a value to a tab-separated row (see db_load_file()) */
+static void printdbtype_tsv(GString *str, db_type_e type,
+                            const db_type_u *value_ptr)
+{
+    switch (type) {
+    case DB_ID:
+        {
+            DEF_PK(pk);
+
+            entry_id2pk(&value_ptr->val_id, PTR_PK(pk));
+            g_string_append(str, pk);
+            break;
+        }
+    case DB_UIDGID:
+        if (global_config.uid_gid_as_numbers) {
+            g_string_append_printf(str, "%d", value_ptr->val_int);
+            break;
+        }
+        /* UID/GID is TEXT. Fall throught ... */
+
+    case DB_TEXT:
+    case DB_ENUM_FTYPE:
+        if (value_ptr->val_str == NULL)
+            g_string_append(str, "\\N");
+        else
+            tsv_append_str(str, value_ptr->val_str);
+        break;
+    default:
+        /* numeric types are printed the same way as in SQL requests */
+        printdbtype(NULL, str, type, value_ptr);
+    }
+}
+
+/**
+ * Append attribute values to a tab-separated row, in the same order
+ * as attrmask2fieldlist().
+ * @param table T_MAIN, T_ANNEX, T_DNAMES
+ * @return nbr of fields
+ */
+int attrset2tsv(GString *str, const attr_set_t *p_set, table_enum table)
+{
+    int i, cookie;
+    unsigned int nbfields = 0;
+    char tmp[1024];
+    db_type_u typeu;
+    db_type_e t;
+
+    if ((table == T_STRIPE_INFO) || (table == T_STRIPE_ITEMS))
+        return -DB_NOT_SUPPORTED;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (attr_mask_test_index(&p_set->attr_mask, i)
+            && match_table(table, i)) {
+            g_string_append_c(str, '\t');
+            t = attr_db_value(p_set, i, &typeu, tmp, sizeof(tmp));
+            printdbtype_tsv(str, t, &typeu);
+            nbfields++;
+        }
+    }
+    return nbfields;
+}
+
 int fullpath_attr2db(const char *attr, char *db)
 {
     DEF_PK(root_pk);
@@ -969,9 +1151,13 @@ char *compar2str(filter_comparator_t compar)
         return " NOT LIKE ";
 #else
     case LIKE:
+    case ILIKE:
         return " LIKE ";
     case UNLIKE:
+    case IUNLIKE:
         return " NOT LIKE ";
+    case RLIKE:
+        return " REGEXP ";
 #endif
     case IN:
         return " IN ";
@@ -1416,6 +1602,22 @@ int filter2str(lmgr_t *p_mgr, GString *str, const lmgr_filter_t *p_filter,
                             printdbtype(&p_mgr->conn, str,
                                         field_infos[index].db_type, &typeu);
                         }
+                    } else if (p_filter->filter_simple.filter_compar[i] == IN
+                               || p_filter->filter_simple.filter_compar[i]
+                                  == NOTIN) {
+                        const value_list_t *list =
+                            &p_filter->filter_simple.filter_value[i].list;
+                        unsigned int j;
+
+                        /* list of values (e.g. several parent ids) */
+                        g_string_append_c(str, '(');
+                        for (j = 0; j < list->count; j++) {
+                            if (j > 0)
+                                g_string_append_c(str, ',');
+                            printdbtype(&p_mgr->conn, str, field_type(index),
+                                        &list->values[j]);
+                        }
+                        g_string_append_c(str, ')');
                     } else {
                         char tmp[1024];
 
@@ -1683,13 +1885,13 @@ int _lmgr_begin(lmgr_t *p_mgr, int behavior)
         return DB_SUCCESS;
     else if (behavior == 1)
         /* commit every transaction */
-        return db_exec_sql(&p_mgr->conn, "BEGIN", NULL);
+        return db_exec_sql(&p_mgr->conn, BEGIN_TX, NULL);
     else {
         int rc = DB_SUCCESS;
 
         /* if last operation was committed, issue a begin statement */
         if (p_mgr->last_commit == 0) {
-            rc = db_exec_sql(&p_mgr->conn, "BEGIN", NULL);
+            rc = db_exec_sql(&p_mgr->conn, BEGIN_TX, NULL);
             if (rc)
                 return rc;
         }
@@ -1772,7 +1974,7 @@ int _lmgr_flush_commit(lmgr_t *p_mgr, int behavior)
 int lmgr_table_count(db_conn_t *pconn, const char *table, uint64_t *count)
 {
     char *str_count = NULL;
-    result_handle_t result = NULL;
+    result_handle_t result;
     char *sql;
     int rc;
 
@@ -1785,19 +1987,40 @@ int lmgr_table_count(db_conn_t *pconn, const char *table, uint64_t *count)
         goto out_free;
 
     rc = db_next_record(pconn, &result, &str_count, 1);
-    if (rc)
-        goto out_free;
-
-    if (sscanf(str_count, "%" SCNu64, count) != 1)
+    if (rc == DB_SUCCESS
+        && (str_count == NULL || sscanf(str_count, "%" SCNu64, count) != 1))
         rc = DB_REQUEST_FAILED;
 
+    db_result_free(pconn, &result);
  out_free:
-    if (result != NULL)
-        db_result_free(pconn, &result);
     free(sql);
     return rc;
 }
 
+int lmgr_table_empty(db_conn_t *pconn, const char *table, bool *empty)
+{
+    result_handle_t result;
+    char *str_id = NULL;
+    char sql[256];
+    int rc;
+
+    /* unlike COUNT(*), this doesn't scan the table */
+    snprintf(sql, sizeof(sql), "SELECT 1 FROM %s LIMIT 1", table);
+
+    rc = db_exec_sql(pconn, sql, &result);
+    if (rc)
+        return rc;
+
+    rc = db_next_record(pconn, &result, &str_id, 1);
+    if (rc == DB_SUCCESS || rc == DB_END_OF_LIST) {
+        *empty = (rc == DB_END_OF_LIST);
+        rc = DB_SUCCESS;
+    }
+
+    db_result_free(pconn, &result);
+    return rc;
+}
+
 /**
  * If p_target_attrset attributes are unset,
  * retrieve them from p_source_attrset.
@@ -490,6 +490,8 @@ typedef enum {
                                    "on duplicate key ..." statement) */
     AOF_PREFIX      = (1 << 2), /* prefix field name with table name */
     AOF_SKIP_NAME   = (1 << 3), /* skip name record */
+    AOF_PLACEHOLDER = (1 << 4), /* write '?' instead of values
+                                   (for prepared statements) */
 } attrset_op_flag_e;
 
 int attrmask2fieldlist(GString *str, attr_mask_t attr_mask, table_enum table,
@@ -511,6 +513,95 @@ int attrset2valuelist(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
 int attrset2updatelist(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
                        table_enum table, attrset_op_flag_e flags);
 
+/** print the DB value of an attribute */
+void print_attr_value(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
+                      unsigned int attr_index);
+
+/** default value of a DB field (NULL if it has none) */
+const db_type_u *default_field_value(int attr_index);
+
+/** count the fields of attr_mask in the given table */
+int attrmask_field_count(attr_mask_t attr_mask, table_enum table);
+
+/** bind a value to a statement parameter (converts ids and uid/gid) */
+int bind_db_value(db_stmt_t *stmt, unsigned int idx, db_type_e type,
+                  const db_type_u *value_ptr);
+
+int attrset2params(db_stmt_t *stmt, unsigned int *idx,
+                   const attr_set_t *p_set, table_enum table);
+
+/** append attribute values to a tab-separated row for db_load_file()
+ * (each value is preceded by a tab) */
+int attrset2tsv(GString *str, const attr_set_t *p_set, table_enum table);
+
+/* -------------------- Prepared statement cache ---------------- */
+
+/** kind of cached statement */
+typedef enum {
+    STMT_GET,           /**< select entry attributes by id */
+    STMT_INSERT,        /**< multi-row insert */
+    STMT_UPSERT,        /**< multi-row insert or update */
+    STMT_UPDATE,        /**< update by id */
+    STMT_UPDATE_NAME,   /**< insert or update a name by id */
+} stmt_kind_e;
+
+/** cached statements are identified by their kind, table, attribute mask
+ * and row count (for multi-row statements) */
+typedef struct lmgr_stmt_key {
+    stmt_kind_e     kind;
+    table_enum      table;
+    attr_mask_t     mask;
+    unsigned int    rows;
+} lmgr_stmt_key_t;
+
+/** maximum number of rows in a multi-row statement */
+#define STMT_MAX_ROWS   256
+
+/**
+ * Get a statement from the connection cache.
+ * @return NULL if it is not in the cache (use lmgr_stmt_prepare() then).
+ */
+db_stmt_t *lmgr_stmt_lookup(lmgr_t *p_mgr, const lmgr_stmt_key_t *key);
+
+/** prepare a statement and add it to the connection cache */
+int lmgr_stmt_prepare(lmgr_t *p_mgr, const lmgr_stmt_key_t *key,
+                      const char *query, db_stmt_t **p_stmt);
+
+/**
+ * Execute a cached statement.
+ * If the connection was lost, all cached statements are released.
+ * So the statement must not be used anymore after an error.
+ */
+int lmgr_stmt_exec(lmgr_t *p_mgr, db_stmt_t *stmt, bool with_result);
+
+/** release all cached statements of a connection */
+void lmgr_stmt_cache_free(lmgr_t *p_mgr);
+
+/* -------------------- Application-side accounting ---------------- */
+
+/** set of accounting changes (see listmgr_acct.c) */
+typedef struct lmgr_acct_tab lmgr_acct_tab_t;
+
+lmgr_acct_tab_t *lmgr_acct_tab_new(void);
+void lmgr_acct_tab_free(lmgr_acct_tab_t *tab);
+/** drop the changes of a set (e.g. when its transaction is restarted) */
+void lmgr_acct_tab_clear(lmgr_acct_tab_t *tab);
+
+/** account the removal of entries whose ids are in id_set
+ * (SQL list of ids, or subquery) */
+int lmgr_acct_rm_ids(lmgr_t *p_mgr, lmgr_acct_tab_t *tab, const char *id_set);
+
+/** empty ACCT_STAT as all entries are removed */
+int lmgr_acct_rm_all(lmgr_t *p_mgr, lmgr_acct_tab_t *tab);
+
+/** add a set of changes to the pending ones, once they are committed.
+ * The set is released. */
+void lmgr_acct_tab_commit(lmgr_acct_tab_t *tab);
+
+/** populate ACCT_STAT in background from the given table
+ * (ACCT_REBUILD_TABLE must exist and be empty) */
+int lmgr_acct_rebuild_start(const char *src_table);
+
 char *compar2str(filter_comparator_t compar);
 
 int filter2str(lmgr_t *p_mgr, GString *str, const lmgr_filter_t *p_filter,
@@ -654,6 +745,19 @@ static inline db_type_e field_type(unsigned int index)
     RBH_BUG("Unexpected field type");
 }
 
+/** index of the size range field (see SZRANGE_FUNC) */
+static inline unsigned int sz_index(unsigned long long size)
+{
+    unsigned int idx;
+
+    if (size == 0)
+        return 0;
+
+    /* floor(log2(size)/5) + 1 */
+    idx = (63 - __builtin_clzll(size)) / 5 + 1;
+    return MIN2(idx, SZ_PROFIL_COUNT - 1);
+}
+
 /** helper to check empty filter */
 static inline bool no_filter(const lmgr_filter_t *p_filter)
 {
@@ -667,5 +771,7 @@ static inline bool no_filter(const lmgr_filter_t *p_filter)
 bool match_table(table_enum t, unsigned int attr_index);
 
 int lmgr_table_count(db_conn_t *pconn, const char *table, uint64_t *count);
+/** check if a table has no record */
+int lmgr_table_empty(db_conn_t *pconn, const char *table, bool *empty);
 
 #endif
@@ -58,9 +58,24 @@ static void lmgr_cfg_set_default(void *module_config)
 #elif defined(_SQLITE)
     strcpy(conf->db_config.filepath, "/var/robinhood/robinhood_sqlite_db");
     conf->db_config.retry_delay_microsec = 1000;    /* 1ms */
+    strcpy(conf->db_config.journal_mode, "WAL");
+    strcpy(conf->db_config.synchronous, "NORMAL");
+    conf->db_config.mmap_size = 256LL * 1024 * 1024;     /* 256MB */
+    conf->db_config.cache_size = 1024LL * 1024 * 1024;   /* 1GB */
 #endif
 
     conf->acct = true;
+    conf->acct_triggers = true;
+    conf->acct_flush_interval = 10;
+    conf->prepared_stmt = true;
+    conf->iter_chunk_size = 10000;
+    conf->iter_prefetch = true;
+    conf->path_cache_size = 0;
+    conf->path_cache_ttl = 60;
+    conf->mass_rm_threads = 4;
+    conf->bulk_load = false;
+    strcpy(conf->bulk_load_dir, "/var/tmp");
+    conf->compact_stripes = false;
 }
 
 static void lmgr_cfg_write_default(FILE *output)
@@ -70,6 +85,17 @@ static void lmgr_cfg_write_default(FILE *output)
     print_line(output, 1, "connect_retry_interval_min  : 1s");
     print_line(output, 1, "connect_retry_interval_max  : 30s");
     print_line(output, 1, "accounting  : enabled");
+    print_line(output, 1, "accounting_triggers         : yes");
+    print_line(output, 1, "accounting_flush_interval   : 10s");
+    print_line(output, 1, "prepared_statements         : yes");
+    print_line(output, 1, "iterator_chunk_size         : 10000");
+    print_line(output, 1, "iterator_prefetch           : yes");
+    print_line(output, 1, "path_cache_size             : 0 (disabled)");
+    print_line(output, 1, "path_cache_ttl              : 1min");
+    print_line(output, 1, "mass_remove_threads         : 4");
+    print_line(output, 1, "bulk_load                   : no");
+    print_line(output, 1, "bulk_load_dir               : \"/var/tmp\"");
+    print_line(output, 1, "compact_stripes             : no");
     fprintf(output, "\n");
 
 #ifdef _MYSQL
@@ -87,6 +113,10 @@ static void lmgr_cfg_write_default(FILE *output)
     print_line(output, 2,
                "db_file              :  \"/var/robinhood/robinhood_sqlite_db\"");
     print_line(output, 2, "retry_delay_microsec :  1000 (1 millisec)");
+    print_line(output, 2, "journal_mode         :  WAL");
+    print_line(output, 2, "synchronous          :  NORMAL");
+    print_line(output, 2, "mmap_size            :  256MB");
+    print_line(output, 2, "cache_size           :  1GB");
     print_end_block(output, 1);
 #endif
 
@@ -107,7 +137,10 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
 
     static const char *lmgr_allowed[] = {
         "commit_behavior", "connect_retry_interval_min",
-        "connect_retry_interval_max", "accounting",
+        "connect_retry_interval_max", "accounting", "accounting_triggers",
+        "accounting_flush_interval", "prepared_statements",
+        "iterator_chunk_size", "iterator_prefetch", "path_cache_size",
+        "path_cache_ttl", "mass_remove_threads", "bulk_load", "bulk_load_dir", "compact_stripes",
         MYSQL_CONFIG_BLOCK, SQLITE_CONFIG_BLOCK,
         "user_acct", "group_acct",  /* deprecated => accounting */
         NULL
@@ -119,6 +152,23 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
         {"connect_retry_interval_max", PT_DURATION, PFLG_POSITIVE |
          PFLG_NOT_NULL, &conf->connect_retry_max, 0},
         {"accounting", PT_BOOL, 0, &conf->acct, 0},
+        {"accounting_triggers", PT_BOOL, 0, &conf->acct_triggers, 0},
+        {"accounting_flush_interval", PT_DURATION, PFLG_POSITIVE |
+         PFLG_NOT_NULL, &conf->acct_flush_interval, 0},
+        {"prepared_statements", PT_BOOL, 0, &conf->prepared_stmt, 0},
+        {"iterator_chunk_size", PT_INT, PFLG_POSITIVE, &conf->iter_chunk_size,
+         0},
+        {"iterator_prefetch", PT_BOOL, 0, &conf->iter_prefetch, 0},
+        {"path_cache_size", PT_INT, PFLG_POSITIVE, &conf->path_cache_size, 0},
+        {"path_cache_ttl", PT_DURATION, PFLG_POSITIVE, &conf->path_cache_ttl,
+         0},
+        {"mass_remove_threads", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->mass_rm_threads, 0},
+        {"bulk_load", PT_BOOL, 0, &conf->bulk_load, 0},
+        {"bulk_load_dir", PT_STRING, PFLG_ABSOLUTE_PATH | PFLG_NO_WILDCARDS |
+         PFLG_REMOVE_FINAL_SLASH, conf->bulk_load_dir,
+         sizeof(conf->bulk_load_dir)},
+        {"compact_stripes", PT_BOOL, 0, &conf->compact_stripes, 0},
         END_OF_PARAMS
     };
 
@@ -154,8 +204,8 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
     };
 #elif defined(_SQLITE)
     static const char *db_allowed[] = {
-        "db_file", "retry_delay_microsec",
-        NULL
+        "db_file", "retry_delay_microsec", "journal_mode", "synchronous",
+        "mmap_size", "cache_size", NULL
     };
     const cfg_param_t db_params[] = {
         {"db_file", PT_STRING, PFLG_ABSOLUTE_PATH | PFLG_NO_WILDCARDS,
@@ -163,6 +213,12 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
         ,
         {"retry_delay_microsec", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
          (int *)&conf->db_config.retry_delay_microsec, 0},
+        {"journal_mode", PT_STRING, PFLG_NO_WILDCARDS,
+         conf->db_config.journal_mode, sizeof(conf->db_config.journal_mode)},
+        {"synchronous", PT_STRING, PFLG_NO_WILDCARDS,
+         conf->db_config.synchronous, sizeof(conf->db_config.synchronous)},
+        {"mmap_size", PT_SIZE, PFLG_POSITIVE, &conf->db_config.mmap_size, 0},
+        {"cache_size", PT_SIZE, PFLG_POSITIVE, &conf->db_config.cache_size, 0},
         END_OF_PARAMS
     };
 #endif
@@ -325,6 +381,19 @@ static int lmgr_cfg_reload(lmgr_config_t *conf)
                    LMGR_CONFIG_BLOCK
                    "::accounting changed in config file, but cannot be modified dynamically");
 
+    if (conf->acct_triggers != lmgr_config.acct_triggers)
+        DisplayLog(LVL_MAJOR, TAG,
+                   LMGR_CONFIG_BLOCK
+                   "::accounting_triggers changed in config file, but cannot be modified dynamically");
+
+    if (conf->acct_flush_interval != lmgr_config.acct_flush_interval) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK
+                   "::accounting_flush_interval updated: %ld->%ld",
+                   lmgr_config.acct_flush_interval, conf->acct_flush_interval);
+        lmgr_config.acct_flush_interval = conf->acct_flush_interval;
+    }
+
     if (conf->connect_retry_min != lmgr_config.connect_retry_min) {
         DisplayLog(LVL_EVENT, TAG,
                    LMGR_CONFIG_BLOCK
@@ -340,6 +409,63 @@ static int lmgr_cfg_reload(lmgr_config_t *conf)
                    lmgr_config.connect_retry_max, conf->connect_retry_max);
         lmgr_config.connect_retry_max = conf->connect_retry_max;
     }
+
+    if (conf->prepared_stmt != lmgr_config.prepared_stmt) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::prepared_statements updated: %s->%s",
+                   bool2str(lmgr_config.prepared_stmt),
+                   bool2str(conf->prepared_stmt));
+        lmgr_config.prepared_stmt = conf->prepared_stmt;
+    }
+
+    if (conf->iter_chunk_size != lmgr_config.iter_chunk_size) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::iterator_chunk_size updated: %u->%u",
+                   lmgr_config.iter_chunk_size, conf->iter_chunk_size);
+        lmgr_config.iter_chunk_size = conf->iter_chunk_size;
+    }
+
+    if (conf->iter_prefetch != lmgr_config.iter_prefetch) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::iterator_prefetch updated: %s->%s",
+                   bool2str(lmgr_config.iter_prefetch),
+                   bool2str(conf->iter_prefetch));
+        lmgr_config.iter_prefetch = conf->iter_prefetch;
+    }
+
+    if (conf->path_cache_size != lmgr_config.path_cache_size)
+        DisplayLog(LVL_MAJOR, TAG, LMGR_CONFIG_BLOCK
+                   "::path_cache_size changed in config file, but cannot be "
+                   "modified dynamically");
+
+    if (conf->path_cache_ttl != lmgr_config.path_cache_ttl) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::path_cache_ttl updated: %ld->%ld",
+                   lmgr_config.path_cache_ttl, conf->path_cache_ttl);
+        lmgr_config.path_cache_ttl = conf->path_cache_ttl;
+    }
+
+    if (conf->mass_rm_threads != lmgr_config.mass_rm_threads) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::mass_remove_threads updated: %u->%u",
+                   lmgr_config.mass_rm_threads, conf->mass_rm_threads);
+        lmgr_config.mass_rm_threads = conf->mass_rm_threads;
+    }
+
+    if (conf->bulk_load != lmgr_config.bulk_load)
+        DisplayLog(LVL_MAJOR, TAG, LMGR_CONFIG_BLOCK
+                   "::bulk_load changed in config file, but cannot be "
+                   "modified dynamically");
+
+    if (strcmp(conf->bulk_load_dir, lmgr_config.bulk_load_dir))
+        DisplayLog(LVL_MAJOR, TAG, LMGR_CONFIG_BLOCK
+                   "::bulk_load_dir changed in config file, but cannot be "
+                   "modified dynamically");
+
+    if (conf->compact_stripes != lmgr_config.compact_stripes)
+        DisplayLog(LVL_MAJOR, TAG, LMGR_CONFIG_BLOCK
+                   "::compact_stripes changed in config file, but cannot be "
+                   "modified dynamically");
 #ifdef _MYSQL
 
     if (strcmp(conf->db_config.server, lmgr_config.db_config.server))
@@ -373,6 +499,15 @@ static int lmgr_cfg_reload(lmgr_config_t *conf)
         lmgr_config.db_config.retry_delay_microsec =
             conf->db_config.retry_delay_microsec;
     }
+
+    if (strcmp(conf->db_config.journal_mode, lmgr_config.db_config.journal_mode)
+        || strcmp(conf->db_config.synchronous, lmgr_config.db_config.synchronous)
+        || conf->db_config.mmap_size != lmgr_config.db_config.mmap_size
+        || conf->db_config.cache_size != lmgr_config.db_config.cache_size)
+        DisplayLog(LVL_MAJOR, TAG,
+                   SQLITE_CONFIG_BLOCK
+                   "::journal_mode, synchronous, mmap_size or cache_size changed"
+                   " in config file, but cannot be modified dynamically");
 #endif
 
     return 0;
@@ -414,6 +549,67 @@ static void lmgr_cfg_write_template(FILE *output)
                "# disable the following options if you are not interested in");
     print_line(output, 1, "# user or group stats (to speed up scan)");
     print_line(output, 1, "accounting  = enabled ;");
+    print_line(output, 1,
+               "# Maintain accounting with DB triggers. If disabled, robinhood");
+    print_line(output, 1,
+               "# aggregates accounting changes in memory and writes them to DB");
+    print_line(output, 1,
+               "# every accounting_flush_interval (allows parallel DB batches).");
+    print_line(output, 1,
+               "# Pending changes are lost if the process is killed.");
+    print_line(output, 1, "accounting_triggers = yes ;");
+    print_line(output, 1, "accounting_flush_interval = 10s ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Send entry inserts, updates and gets as prepared statements,");
+    print_line(output, 1,
+               "# with values in binary form (less parsing and escaping).");
+    print_line(output, 1, "prepared_statements = yes ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Sorted entry lists (e.g. policy candidates) are retrieved by");
+    print_line(output, 1,
+               "# chunks of this size, to bound client memory (0 = at once).");
+    print_line(output, 1, "iterator_chunk_size = 10000 ;");
+    print_line(output, 1,
+               "# Retrieve the next chunk in background, using an extra DB connection.");
+    print_line(output, 1, "iterator_prefetch = yes ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Number of directory names cached to build entry paths");
+    print_line(output, 1,
+               "# on the client side (0 = build paths in the database).");
+    print_line(output, 1,
+               "# The cache only sees the namespace changes written by this process,");
+    print_line(output, 1,
+               "# e.g. to enable in the process reading changelogs: in others,");
+    print_line(output, 1,
+               "# cached names can be outdated for path_cache_ttl.");
+    print_line(output, 1, "path_cache_size = 0 ;");
+    print_line(output, 1, "path_cache_ttl = 1min ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Number of DB connections used to remove old entries at the");
+    print_line(output, 1,
+               "# end of a scan (entries are removed by chunks of 1000).");
+    print_line(output, 1, "mass_remove_threads = 4 ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Initial scan of an empty database (--scan --once): write entries");
+    print_line(output, 1,
+               "# to staging files in bulk_load_dir and load them with LOAD DATA,");
+    print_line(output, 1,
+               "# then build indexes and accounting at the end of the scan.");
+    print_line(output, 1, "bulk_load = no ;");
+    print_line(output, 1, "bulk_load_dir = \"/var/tmp\" ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Lustre: store the stripe objects of a file as a single encoded");
+    print_line(output, 1,
+               "# blob in STRIPE_INFO (STRIPE_ITEMS only indexes OSTs of files).");
+    print_line(output, 1,
+               "# Changing this requires to convert the DB with 'robinhood --alter-db'.");
+    print_line(output, 1, "compact_stripes = no ;");
     fprintf(output, "\n");
 #ifdef _MYSQL
     print_begin_block(output, 1, MYSQL_CONFIG_BLOCK, NULL);
@@ -429,6 +625,12 @@ static void lmgr_cfg_write_template(FILE *output)
     print_begin_block(output, 1, SQLITE_CONFIG_BLOCK, NULL);
     print_line(output, 2, "db_file = \"/var/robinhood/robinhood_sqlite_db\" ;");
     print_line(output, 2, "retry_delay_microsec = 1000 ;");
+    print_line(output, 2,
+               "# WAL journal allows reports to run while robinhood writes.");
+    print_line(output, 2, "journal_mode = WAL ;");
+    print_line(output, 2, "synchronous = NORMAL ;");
+    print_line(output, 2, "mmap_size = 256MB ;");
+    print_line(output, 2, "cache_size = 1GB ;");
     print_end_block(output, 1);
 #endif
 
@@ -459,5 +661,11 @@ mod_cfg_funcs_t lmgr_cfg_hdlr = {
 
 bool lmgr_parallel_batches(void)
 {
-    return !lmgr_config.acct;
+    /* no risk of deadlock if ACCT_STAT is not updated by triggers */
+    return !lmgr_config.acct || !lmgr_config.acct_triggers;
+}
+
+bool lmgr_app_acct(void)
+{
+    return lmgr_config.acct && !lmgr_config.acct_triggers;
 }
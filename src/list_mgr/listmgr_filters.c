@@ -307,6 +307,16 @@ int lmgr_simple_filter_add_block(lmgr_filter_t *p_filter,
     return lmgr_simple_filter_add(p_filter, 0, 0, val, flag);
 }
 
+/** Remove the last items of a filter, to keep the 'count' first ones. */
+void lmgr_simple_filter_truncate(lmgr_filter_t *p_filter, unsigned int count)
+{
+    while (p_filter->filter_simple.filter_count > count) {
+        p_filter->filter_simple.filter_count--;
+        lmgr_simple_filter_free_buffers(p_filter,
+                                        p_filter->filter_simple.filter_count);
+    }
+}
+
 
 /* is it a simple 'AND' expression ? */
 static bool is_simple_expr(bool_node_t *boolexpr, int depth, bool_op_t op_ctx)
@@ -688,6 +698,485 @@ int convert_boolexpr_to_simple_filter(bool_node_t *boolexpr,
     return rc;
 }
 
+/* Translation of whole boolean expressions (e.g. policy rules).
+ * NOT operators are pushed down to the conditions, by inverting their
+ * comparators, so the resulting filter only consists of nested AND/OR blocks.
+ * Conditions the DB can't evaluate are replaced by TRUE: the filter selects
+ * a superset of the matching entries, which must be checked afterwards.
+ */
+
+/** What a part of a boolean expression turns into in a DB filter */
+typedef enum {
+    SQL_TRUE,   /**< no restriction */
+    SQL_FALSE,  /**< no entry can match */
+    SQL_FILTER, /**< restriction by a DB filter */
+} sql_expr_e;
+
+struct sql_expr_ctx {
+    lmgr_filter_t           *filter;
+    const sm_instance_t     *smi;
+    const time_modifier_t   *time_mod;
+    enum filter_flags        flags;  /**< flags for all conditions */
+    /** Entries have a row per OST in the DB, and all conditions of the filter
+     * are tested on the same row: 'ost == 1 AND ost == 2' would never match.
+     * So OST conditions are only pushed down if there is only one. */
+    bool                     skip_ost_conds;
+    filter_pushdown_t       *stats;
+};
+
+/** invert a comparator, return false if it can't be */
+static bool negate_comparator(filter_comparator_t *comp)
+{
+    switch (*comp) {
+    case EQUAL:           *comp = NOTEQUAL;        return true;
+    case NOTEQUAL:        *comp = EQUAL;           return true;
+    case LESSTHAN:        *comp = MORETHAN_STRICT; return true;
+    case MORETHAN:        *comp = LESSTHAN_STRICT; return true;
+    case LESSTHAN_STRICT: *comp = MORETHAN;        return true;
+    case MORETHAN_STRICT: *comp = LESSTHAN;        return true;
+    case LIKE:            *comp = UNLIKE;          return true;
+    case UNLIKE:          *comp = LIKE;            return true;
+    case ILIKE:           *comp = IUNLIKE;         return true;
+    case IUNLIKE:         *comp = ILIKE;           return true;
+    case IN:              *comp = NOTIN;           return true;
+    case NOTIN:           *comp = IN;              return true;
+    case ISNULL:          *comp = NOTNULL;         return true;
+    case NOTNULL:         *comp = ISNULL;          return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Does the DB evaluate conditions on this field exactly like policies do?
+ * This is not the case for string patterns (LIKE matches a superset of
+ * shell patterns, and some columns are case insensitive), or for stripes
+ * (a condition matches if any stripe matches). For such fields, the DB can
+ * only select a superset of the entries matching a positive condition.
+ */
+static bool exact_field(unsigned int index)
+{
+    if (is_stripe_field(index) || is_funcattr(index) || is_sepdlist(index))
+        return false;
+
+    switch (field_type(index)) {
+    case DB_INT:
+    case DB_UINT:
+    case DB_SHORT:
+    case DB_USHORT:
+    case DB_BIGINT:
+    case DB_BIGUINT:
+    case DB_BOOL:
+    case DB_ENUM_FTYPE:
+        return true;
+    case DB_UIDGID:
+        return global_config.uid_gid_as_numbers;
+    case DB_TEXT:
+        /* status values are a fixed set of names */
+        return is_status_field(index);
+    default:
+        return false;
+    }
+}
+
+/**
+ * Translate a condition to a single filter item.
+ * @param negate  translate 'NOT condition'.
+ * @return false if the DB can't select a superset of the matching entries.
+ */
+static bool cond2filter_item(const struct sql_expr_ctx *ctx,
+                             const compare_triplet_t *cond, bool negate,
+                             unsigned int *index, filter_comparator_t *comp,
+                             filter_value_t *val, bool *must_free)
+{
+    attr_mask_t tmp = null_mask;
+
+    *must_free = false;
+    *index = ATTR_INDEX_FLG_UNSPEC;
+    if (criteria2filter(cond, index, comp, val, must_free, ctx->smi,
+                        ctx->time_mod) != 0
+        || (*index & ATTR_INDEX_FLG_UNSPEC))
+        goto not_sql;
+
+    attr_mask_set_index(&tmp, *index);
+    /* fullpath is computed by a DB function: it can be filtered */
+    if (generated_fields(tmp) || dirattr_fields(tmp)
+        || (funcattr_fields(tmp) && *index != ATTR_INDEX_fullpath))
+        goto not_sql;
+
+    if (ctx->skip_ost_conds && field_type(*index) == DB_STRIPE_ITEMS)
+        goto not_sql;
+
+    /* 'iname == x' (no wildcard) is a case insensitive equality */
+    if ((cond->flags & CMP_FLG_INSENSITIVE) && field_type(*index) == DB_TEXT
+        && !is_status_field(*index)) {
+        if (*comp == EQUAL)
+            *comp = ILIKE;
+        else if (*comp == NOTEQUAL)
+            *comp = IUNLIKE;
+    }
+
+    if (negate && !negate_comparator(comp))
+        goto not_sql;
+
+    if (exact_field(*index)) {
+        if (*comp != RLIKE)
+            return true;
+    } else if (*comp == EQUAL || *comp == LIKE || *comp == ILIKE
+               || *comp == IN) {
+        return true;
+    }
+
+not_sql:
+    if (*must_free) {
+        MemFree((char *)val->value.val_str);
+        *must_free = false;
+    }
+    return false;
+}
+
+/** operator between the 2 operands of a binary expression, once NOT is
+ * pushed down to them */
+static inline bool_op_t effective_op(const bool_node_t *expr, bool negate)
+{
+    bool_op_t op = expr->content_u.bool_expr.bool_op;
+
+    if (!negate)
+        return op;
+    return op == BOOL_AND ? BOOL_OR : BOOL_AND;
+}
+
+static sql_expr_e expr_kind(const struct sql_expr_ctx *ctx,
+                            bool_node_t *expr, bool negate)
+{
+    unsigned int index;
+    filter_comparator_t comp;
+    filter_value_t val;
+    bool must_free;
+    sql_expr_e k1, k2, absorb;
+
+    switch (expr->node_type) {
+    case NODE_CONSTANT:
+        return expr->content_u.constant != negate ? SQL_TRUE : SQL_FALSE;
+
+    case NODE_CONDITION:
+        if (!cond2filter_item(ctx, expr->content_u.condition, negate, &index,
+                              &comp, &val, &must_free))
+            return SQL_TRUE;
+        if (must_free)
+            MemFree((char *)val.value.val_str);
+        return SQL_FILTER;
+
+    case NODE_UNARY_EXPR:
+        if (expr->content_u.bool_expr.bool_op != BOOL_NOT)
+            return SQL_TRUE;
+        return expr_kind(ctx, expr->content_u.bool_expr.expr1, !negate);
+
+    case NODE_BINARY_EXPR:
+        if (expr->content_u.bool_expr.bool_op != BOOL_AND
+            && expr->content_u.bool_expr.bool_op != BOOL_OR)
+            return SQL_TRUE;
+
+        k1 = expr_kind(ctx, expr->content_u.bool_expr.expr1, negate);
+        k2 = expr_kind(ctx, expr->content_u.bool_expr.expr2, negate);
+
+        /* FALSE for AND, TRUE for OR */
+        absorb = effective_op(expr, negate) == BOOL_AND ? SQL_FALSE : SQL_TRUE;
+        if (k1 == absorb || k2 == absorb)
+            return absorb;
+        if (k1 == SQL_FILTER || k2 == SQL_FILTER)
+            return SQL_FILTER;
+        return k1;
+    }
+    return SQL_TRUE;
+}
+
+/** Is there a condition on path in the expression?
+ * They are the most expensive for the DB, as it must build entry paths. */
+static bool has_path_cond(const bool_node_t *expr)
+{
+    switch (expr->node_type) {
+    case NODE_CONDITION:
+        return expr->content_u.condition->crit == CRITERIA_TREE
+               || expr->content_u.condition->crit == CRITERIA_PATH;
+    case NODE_UNARY_EXPR:
+        return has_path_cond(expr->content_u.bool_expr.expr1);
+    case NODE_BINARY_EXPR:
+        return has_path_cond(expr->content_u.bool_expr.expr1)
+               || has_path_cond(expr->content_u.bool_expr.expr2);
+    default:
+        return false;
+    }
+}
+
+/** 'tree' conditions also match the root of the tree: get its path
+ * from the pattern of the subtree. */
+static char *tree_root_path(const char *subtree)
+{
+    size_t len = strlen(subtree);
+    char *root = MemAlloc(len + 1);
+
+    if (root == NULL)
+        return NULL;
+
+    /* remove the trailing '*', then '/' (except for "/") */
+    strcpy(root, subtree);
+    if (len > 0 && root[len - 1] == '*')
+        root[--len] = '\0';
+    if (len > 1 && root[len - 1] == '/')
+        root[--len] = '\0';
+
+    return root;
+}
+
+/**
+ * Append an expression known to be SQL_FILTER to the current block.
+ * @param op    operator between the items of the current block.
+ * @param first is it the first item of the block?
+ */
+static int append_expr(struct sql_expr_ctx *ctx, bool_node_t *expr,
+                       bool negate, bool_op_t op, bool first)
+{
+    int rc, flags = (op == BOOL_OR && !first) ? FILTER_FLAG_OR : 0;
+
+    switch (expr->node_type) {
+    case NODE_CONDITION:
+        {
+            unsigned int index;
+            filter_comparator_t comp;
+            filter_value_t val;
+            bool must_free;
+            filter_value_t root = FV_NULL;
+            int item_flags = 0;
+
+            if (!cond2filter_item(ctx, expr->content_u.condition, negate,
+                                  &index, &comp, &val, &must_free))
+                RBH_BUG("condition is not a DB filter");
+
+            if ((ctx->flags & FILTER_FLAG_ALLOW_NULL)
+                || allow_null(index, &comp, &val))
+                item_flags |= FILTER_FLAG_ALLOW_NULL;
+
+            /* tree == 'x' => (fullpath like 'x/%' OR fullpath like 'x') */
+            if (expr->content_u.condition->crit == CRITERIA_TREE
+                && (comp == LIKE || comp == ILIKE)) {
+                root.value.val_str = tree_root_path(val.value.val_str);
+                if (root.value.val_str == NULL) {
+                    rc = DB_NO_MEMORY;
+                    goto free_val;
+                }
+                if (op == BOOL_AND) {
+                    rc = lmgr_simple_filter_add_block(ctx->filter,
+                                                      FILTER_FLAG_BEGIN_BLOCK);
+                    if (rc)
+                        goto free_val;
+                    flags = 0;
+                }
+            }
+
+            DisplayLog(LVL_FULL, LISTMGR_TAG,
+                       "Appending filter on \"%s\", flags=%#X",
+                       field_name(index), flags | item_flags);
+            rc = lmgr_simple_filter_add(ctx->filter, index, comp, val,
+                                        flags | item_flags
+                                        | (must_free ?
+                                           FILTER_FLAG_ALLOC_STR : 0));
+            if (rc)
+                goto free_val;
+            /* the filter now owns the value */
+            must_free = false;
+
+            if (root.value.val_str != NULL) {
+                rc = lmgr_simple_filter_add(ctx->filter, index, comp, root,
+                                            item_flags | FILTER_FLAG_OR
+                                            | FILTER_FLAG_ALLOC_STR);
+                if (rc)
+                    goto free_val;
+                root.value.val_str = NULL;
+
+                if (op == BOOL_AND) {
+                    rc = lmgr_simple_filter_add_block(ctx->filter,
+                                                      FILTER_FLAG_END_BLOCK);
+                    if (rc)
+                        return rc;
+                }
+            }
+            ctx->stats->cond_pushed++;
+            return 0;
+
+free_val:
+            if (must_free)
+                MemFree((char *)val.value.val_str);
+            if (root.value.val_str != NULL)
+                MemFree((char *)root.value.val_str);
+            return rc;
+        }
+
+    case NODE_UNARY_EXPR:
+        return append_expr(ctx, expr->content_u.bool_expr.expr1, !negate, op,
+                           first);
+
+    case NODE_BINARY_EXPR:
+        {
+            bool_node_t *e1 = expr->content_u.bool_expr.expr1;
+            bool_node_t *e2 = expr->content_u.bool_expr.expr2;
+            bool_op_t eop = effective_op(expr, negate);
+
+            /* the other operand is neutral */
+            if (expr_kind(ctx, e1, negate) != SQL_FILTER)
+                return append_expr(ctx, e2, negate, op, first);
+            if (expr_kind(ctx, e2, negate) != SQL_FILTER)
+                return append_expr(ctx, e1, negate, op, first);
+
+            /* let the DB test path conditions last */
+            if (has_path_cond(e1) && !has_path_cond(e2)) {
+                e1 = expr->content_u.bool_expr.expr2;
+                e2 = expr->content_u.bool_expr.expr1;
+            }
+
+            if (eop == op) {
+                rc = append_expr(ctx, e1, negate, op, first);
+                if (rc)
+                    return rc;
+                return append_expr(ctx, e2, negate, op, false);
+            }
+
+            /* new level of parenthesing */
+            rc = lmgr_simple_filter_add_block(ctx->filter,
+                                              FILTER_FLAG_BEGIN_BLOCK | flags);
+            if (rc)
+                return rc;
+            rc = append_expr(ctx, e1, negate, eop, true);
+            if (rc)
+                return rc;
+            rc = append_expr(ctx, e2, negate, eop, false);
+            if (rc)
+                return rc;
+            return lmgr_simple_filter_add_block(ctx->filter,
+                                                FILTER_FLAG_END_BLOCK);
+        }
+
+    default:
+        RBH_BUG("expression is not a DB filter");
+    }
+}
+
+/** count conditions on OSTs */
+static unsigned int count_ost_conds(const struct sql_expr_ctx *ctx,
+                                    bool_node_t *expr)
+{
+    unsigned int index = ATTR_INDEX_FLG_UNSPEC;
+    filter_comparator_t comp;
+    filter_value_t val;
+    bool must_free;
+
+    switch (expr->node_type) {
+    case NODE_CONDITION:
+        if (criteria2filter(expr->content_u.condition, &index, &comp, &val,
+                            &must_free, ctx->smi, ctx->time_mod) != 0)
+            return 0;
+        if (must_free)
+            MemFree((char *)val.value.val_str);
+        return (!(index & ATTR_INDEX_FLG_UNSPEC)
+                && field_type(index) == DB_STRIPE_ITEMS) ? 1 : 0;
+    case NODE_UNARY_EXPR:
+        return count_ost_conds(ctx, expr->content_u.bool_expr.expr1);
+    case NODE_BINARY_EXPR:
+        return count_ost_conds(ctx, expr->content_u.bool_expr.expr1)
+               + count_ost_conds(ctx, expr->content_u.bool_expr.expr2);
+    default:
+        return 0;
+    }
+}
+
+/** count the conditions of an expression, and list those the DB
+ * can't evaluate */
+static void count_conditions(const struct sql_expr_ctx *ctx,
+                             bool_node_t *expr, bool negate)
+{
+    unsigned int index;
+    filter_comparator_t comp;
+    filter_value_t val;
+    bool must_free;
+    char buff[RBH_PATH_MAX];
+
+    switch (expr->node_type) {
+    case NODE_CONDITION:
+        ctx->stats->cond_count++;
+        if (cond2filter_item(ctx, expr->content_u.condition, negate, &index,
+                             &comp, &val, &must_free)) {
+            if (must_free)
+                MemFree((char *)val.value.val_str);
+            return;
+        }
+        if (ctx->stats->leftovers == NULL)
+            return;
+        if (BoolExpr2str(expr, buff, sizeof(buff)) < 0)
+            rh_strncpy(buff, criteria2str(expr->content_u.condition->crit),
+                       sizeof(buff));
+        g_string_append_printf(ctx->stats->leftovers, "%s%s%s",
+                               ctx->stats->leftovers->len > 0 ? ", " : "",
+                               negate ? "NOT " : "", buff);
+        return;
+
+    case NODE_UNARY_EXPR:
+        count_conditions(ctx, expr->content_u.bool_expr.expr1, !negate);
+        return;
+
+    case NODE_BINARY_EXPR:
+        count_conditions(ctx, expr->content_u.bool_expr.expr1, negate);
+        count_conditions(ctx, expr->content_u.bool_expr.expr2, negate);
+        return;
+
+    default:
+        return;
+    }
+}
+
+/** Convert a whole boolean expression to a ListMgr filter (append filter) */
+int convert_boolexpr_to_filter(bool_node_t *boolexpr, lmgr_filter_t *filter,
+                               const sm_instance_t *smi,
+                               const time_modifier_t *time_mod,
+                               enum filter_flags flags,
+                               filter_pushdown_t *stats)
+{
+    filter_pushdown_t dummy = { 0 };
+    struct sql_expr_ctx ctx = {
+        .filter = filter,
+        .smi = smi,
+        .time_mod = time_mod,
+        .flags = flags & FILTER_FLAG_ALLOW_NULL,
+        .stats = stats ? stats : &dummy,
+    };
+    bool negate = !!(flags & FILTER_FLAG_NOT);
+    unsigned int count_orig = filter->filter_simple.filter_count;
+    int rc;
+
+    ctx.stats->cond_count = 0;
+    ctx.stats->cond_pushed = 0;
+    ctx.stats->never_matches = false;
+    ctx.skip_ost_conds = (count_ost_conds(&ctx, boolexpr) > 1);
+    count_conditions(&ctx, boolexpr, negate);
+
+    switch (expr_kind(&ctx, boolexpr, negate)) {
+    case SQL_TRUE:
+        return 0;
+    case SQL_FALSE:
+        ctx.stats->never_matches = true;
+        return 0;
+    case SQL_FILTER:
+        break;
+    }
+
+    rc = append_expr(&ctx, boolexpr, negate, BOOL_AND, true);
+    if (rc) {
+        /* add all or nothing */
+        lmgr_simple_filter_truncate(filter, count_orig);
+        ctx.stats->cond_pushed = 0;
+    }
+    return rc;
+}
+
 /** Set a complex filter structure */
 int lmgr_set_filter_expression(lmgr_filter_t *p_filter,
                                struct bool_node_t *boolexpr)
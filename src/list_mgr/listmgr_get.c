@@ -217,62 +217,28 @@ static void clean_std_table_bits(attr_mask_t *p_mask)
 }
 
 /**
- *  Retrieve entry attributes from its primary key
+ * Build the request to get attributes from main, annex and names tables.
+ * @param pk_val    value to match the id with (pk or placeholder)
+ * @return the first table of the request, NULL if no field is to be
+ *         retrieved from these tables.
  */
-int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
+static const char *get_by_pk_query(GString *req, attr_mask_t attr_mask,
+                                   const char *pk_val)
 {
-    int             rc;
-    char           *first_table = NULL;
-    GString        *req, *from;
-    /* attribute count is up to 1 per bit (8 per byte).
-     * x2 for bullet proofing */
-    char           *result_tab[2*8*sizeof(p_info->attr_mask)];
-    result_handle_t result;
-    bool            checkmain   = true;
-    int             main_count  = 0,
-                    annex_count = 0,
-                    name_count  = 0;
-    attr_mask_t     gen = gen_fields(p_info->attr_mask);
-
-    if (p_info == NULL)
-        return 0;
-
-    /* init entry info */
-    memset(&p_info->attr_values, 0, sizeof(entry_info_t));
-    req = g_string_new("SELECT ");
-    from = g_string_new(" FROM ");
-
-    /* retrieve source info for generated fields (only about std fields)*/
-    add_source_fields_for_gen(&p_info->attr_mask.std);
+    GString    *from = g_string_new(" FROM ");
+    const char *first_table = NULL;
 
-    /* don't get fields that are not in main, names, annex, stripe...
-     * This allows the caller to set all bits 'on' to get everything.
-     * Note: this also clear generated fields. They will be restored after.
-     */
-    supported_bits_only(&p_info->attr_mask);
+    g_string_assign(req, "SELECT ");
 
     /* get info from main table (if asked) */
-    main_count = attrmask2fieldlist(req, p_info->attr_mask, T_MAIN, "", "", 0);
-    if (main_count < 0)
+    if (attrmask2fieldlist(req, attr_mask, T_MAIN, "", "", 0) > 0)
     {
-        rc = -main_count;
-        goto free_str;
-    }
-    else if (main_count > 0)
-    {
-        checkmain = false;
         first_table = MAIN_TABLE;
         g_string_append(from, MAIN_TABLE);
     }
 
-    annex_count = attrmask2fieldlist(req, p_info->attr_mask, T_ANNEX, "", "",
-                                     first_table != NULL ? AOF_LEADING_SEP : 0);
-    if (annex_count < 0)
-    {
-        rc = -annex_count;
-        goto free_str;
-    }
-    else if (annex_count > 0)
+    if (attrmask2fieldlist(req, attr_mask, T_ANNEX, "", "",
+                           first_table != NULL ? AOF_LEADING_SEP : 0) > 0)
     {
         if (first_table != NULL)
             g_string_append_printf(from, " LEFT JOIN "ANNEX_TABLE" ON %s.id="
@@ -284,14 +250,8 @@ int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
         }
     }
 
-    name_count = attrmask2fieldlist(req, p_info->attr_mask, T_DNAMES, "", "",
-                                    first_table != NULL ? AOF_LEADING_SEP : 0);
-    if (name_count < 0)
-    {
-        rc = -name_count;
-        goto free_str;
-    }
-    else if (name_count > 0)
+    if (attrmask2fieldlist(req, attr_mask, T_DNAMES, "", "",
+                           first_table != NULL ? AOF_LEADING_SEP : 0) > 0)
     {
         if (first_table)
             /* it's OK to JOIN with NAMES table here even if there are multiple paths,
@@ -307,18 +267,119 @@ int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
     }
 
     if (first_table != NULL)
+        g_string_append_printf(req, "%s WHERE %s.id=%s", from->str,
+                               first_table, pk_val);
+
+    g_string_free(from, TRUE);
+    return first_table;
+}
+
+/** execute the get request as a prepared statement */
+static int get_by_pk_stmt(lmgr_t *p_mgr, PK_ARG_T pk, attr_mask_t attr_mask,
+                          db_stmt_t **p_stmt)
+{
+    lmgr_stmt_key_t key = {
+        .kind = STMT_GET,
+        .table = T_MAIN,
+        .mask = attr_mask,
+        .rows = 1,
+    };
+    db_type_u u;
+    int rc;
+
+    *p_stmt = lmgr_stmt_lookup(p_mgr, &key);
+    if (*p_stmt == NULL) {
+        GString *req = g_string_new(NULL);
+
+        get_by_pk_query(req, attr_mask, "?");
+        rc = lmgr_stmt_prepare(p_mgr, &key, req->str, p_stmt);
+        g_string_free(req, TRUE);
+        if (rc)
+            return rc;
+    }
+
+    u.val_str = pk;
+    rc = db_stmt_bind(*p_stmt, 0, PK_DB_TYPE, &u);
+    if (rc)
+        return rc;
+
+    return lmgr_stmt_exec(p_mgr, *p_stmt, true);
+}
+
+/**
+ *  Retrieve entry attributes from its primary key
+ */
+int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
+{
+    int             rc;
+    GString        *req;
+    /* attribute count is up to 1 per bit (8 per byte).
+     * x2 for bullet proofing */
+    char           *result_tab[2*8*sizeof(p_info->attr_mask)];
+    result_handle_t result;
+    db_stmt_t      *stmt = NULL;
+    bool            checkmain   = true;
+    int             main_count  = 0,
+                    annex_count = 0,
+                    name_count  = 0;
+    attr_mask_t     gen = gen_fields(p_info->attr_mask);
+    attr_mask_t     path_added;
+    bool            client_path;
+
+    if (p_info == NULL)
+        return 0;
+
+    /* init entry info */
+    memset(&p_info->attr_values, 0, sizeof(entry_info_t));
+    req = g_string_new(NULL);
+
+    /* retrieve source info for generated fields (only about std fields)*/
+    add_source_fields_for_gen(&p_info->attr_mask.std);
+
+    /* don't get fields that are not in main, names, annex, stripe...
+     * This allows the caller to set all bits 'on' to get everything.
+     * Note: this also clear generated fields. They will be restored after.
+     */
+    supported_bits_only(&p_info->attr_mask);
+
+    /* build fullpath from parent_id and name, using the path cache */
+    client_path = path_cache_fix_mask(&p_info->attr_mask, &path_added);
+
+    main_count = attrmask_field_count(p_info->attr_mask, T_MAIN);
+    annex_count = attrmask_field_count(p_info->attr_mask, T_ANNEX);
+    name_count = attrmask_field_count(p_info->attr_mask, T_DNAMES);
+
+    /* the entry exists if it is in main table */
+    if (main_count > 0)
+        checkmain = false;
+
+    if (main_count + annex_count + name_count > 0)
     {
         int shift = 0;
 
-        g_string_append_printf(req, "%s WHERE %s.id="DPK, from->str,
-                               first_table, pk);
+        if (lmgr_config.prepared_stmt)
+        {
+            rc = get_by_pk_stmt(p_mgr, pk, p_info->attr_mask, &stmt);
+            if (rc)
+                goto free_str;
 
-        rc = db_exec_sql(&p_mgr->conn, req->str, &result);
-        if (rc)
-            goto free_str;
+            rc = db_stmt_next_record(&p_mgr->conn, stmt, result_tab,
+                                     main_count + annex_count + name_count);
+        }
+        else
+        {
+            char pk_val[PK_LEN + 2];
+
+            snprintf(pk_val, sizeof(pk_val), DPK, pk);
+            get_by_pk_query(req, p_info->attr_mask, pk_val);
 
-        rc = db_next_record(&p_mgr->conn, &result, result_tab,
-                            main_count + annex_count + name_count);
+            rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+            if (rc)
+                goto free_str;
+
+            rc = db_next_record(&p_mgr->conn, &result, result_tab,
+                                main_count + annex_count + name_count);
+        }
         /* END_OF_LIST means it does not exist */
         if (rc == DB_END_OF_LIST)
         {
@@ -359,7 +420,17 @@ int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
         }
 
 next_table:
-        db_result_free(&p_mgr->conn, &result);
+        if (stmt != NULL)
+            db_stmt_free_result(&p_mgr->conn, stmt);
+        else
+            db_result_free(&p_mgr->conn, &result);
+    }
+
+    if (client_path)
+    {
+        rc = path_cache_fullpath(p_mgr, p_info, &path_added);
+        if (rc)
+            goto free_str;
     }
 
     /* remove stripe info if it is not a file */
@@ -435,10 +506,12 @@ next_table:
     goto free_str;
 
   free_res:
-    db_result_free(&p_mgr->conn, &result);
+    if (stmt != NULL)
+        db_stmt_free_result(&p_mgr->conn, stmt);
+    else
+        db_result_free(&p_mgr->conn, &result);
   free_str:
     g_string_free(req, TRUE);
-    g_string_free(from, TRUE);
     return rc;
 } /* listmgr_get_by_pk */
 
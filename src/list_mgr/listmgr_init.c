@@ -20,6 +20,9 @@
 #include "listmgr_internal.h"
 #include "database.h"
 #include "listmgr_common.h"
+#ifdef _LUSTRE
+#include "listmgr_stripe.h"
+#endif
 #include "rbh_logs.h"
 #include "rbh_misc.h"
 #include <stdio.h>
@@ -28,6 +31,8 @@
 
 /* global symbols */
 static const char *acct_info_table = NULL;
+/** ACCT_STAT is to be populated in background */
+static bool acct_rebuild = false;
 static enum lmgr_init_flags init_flags;
 #define report_only (!!(init_flags & LIF_REPORT_ONLY))
 #define alter_db    (!!(init_flags & LIF_ALTER_DB))
@@ -177,7 +182,7 @@ static void init_default_field_values(void)
     }
 }
 
-static const db_type_u *default_field_value(int attr_index)
+const db_type_u *default_field_value(int attr_index)
 {
     switch (attr_index) {
     case ATTR_INDEX_type:
@@ -1334,6 +1339,107 @@ static int run_create_index(db_conn_t *pconn, const char *table_name,
     return DB_SUCCESS;
 }
 
+/** create the index on a field of a table
+ * @param check don't create the index if it already exists */
+static int create_field_index(db_conn_t *pconn, const char *table_name,
+                              const char *field, bool check)
+{
+    char name[128];
+    char request[1024];
+    int rc;
+
+    snprintf(name, sizeof(name), "%s_index", field);
+
+    if (check) {
+        rc = db_check_component(pconn, DBOBJ_INDEX, name, table_name);
+        if (rc != DB_NOT_EXISTS)
+            return rc;
+    }
+
+    snprintf(request, sizeof(request), "CREATE INDEX %s ON %s(%s)", name,
+             table_name, field);
+    return run_create_index(pconn, table_name, field, request);
+}
+
+/** drop the index on a field of a table, if it exists */
+static int drop_field_index(db_conn_t *pconn, const char *table_name,
+                            const char *field)
+{
+    char name[128];
+    char request[1024];
+    char errmsg[1024];
+    int rc;
+
+    snprintf(name, sizeof(name), "%s_index", field);
+
+    rc = db_check_component(pconn, DBOBJ_INDEX, name, table_name);
+    if (rc == DB_NOT_EXISTS)
+        return DB_SUCCESS;
+    else if (rc)
+        return rc;
+
+#ifdef _SQLITE
+    snprintf(request, sizeof(request), "DROP INDEX %s", name);
+#else
+    snprintf(request, sizeof(request), "DROP INDEX %s ON %s", name,
+             table_name);
+#endif
+    rc = db_exec_sql(pconn, request, NULL);
+    if (rc) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                   "Failed to drop index of %s(%s): Error: %s", table_name,
+                   field, db_errmsg(pconn, errmsg, sizeof(errmsg)));
+        return rc;
+    }
+    DisplayLog(LVL_VERB, LISTMGR_TAG, "Index on %s(%s) dropped", table_name,
+               field);
+    return DB_SUCCESS;
+}
+
+/** create the indexes of ENTRIES, NAMES or ANNEX_INFO table
+ * @param check don't create the indexes that already exist */
+static int create_table_indexes(db_conn_t *pconn, table_enum table,
+                                bool check)
+{
+    int i, rc, cookie;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (match_table(table, i) && is_indexed_field(i)) {
+            rc = create_field_index(pconn, table2name(table), field_name(i),
+                                    check);
+            if (rc)
+                return rc;
+        }
+    }
+
+    /* this index is needed to build the fullpath of entries */
+    if (table == T_DNAMES)
+        return create_field_index(pconn, DNAMES_TABLE, "id", check);
+
+    return DB_SUCCESS;
+}
+
+/** drop the indexes created by create_table_indexes() */
+static int drop_table_indexes(db_conn_t *pconn, table_enum table)
+{
+    int i, rc, cookie;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (match_table(table, i) && is_indexed_field(i)) {
+            rc = drop_field_index(pconn, table2name(table), field_name(i));
+            if (rc)
+                return rc;
+        }
+    }
+
+    if (table == T_DNAMES)
+        return drop_field_index(pconn, DNAMES_TABLE, "id");
+
+    return DB_SUCCESS;
+}
+
 static void append_engine(GString *request)
 {
 #ifdef _MYSQL
@@ -1447,19 +1553,7 @@ static int create_table_main(db_conn_t *pconn, bool *affects_trig)
         goto free_str;
 
     /* create indexes on this table */
-    cookie = -1;
-    while ((i = attr_index_iter(0, &cookie)) != -1) {
-        if (is_main_field(i) && is_indexed_field(i)) {
-            g_string_printf(request,
-                            "CREATE INDEX %s_index ON " MAIN_TABLE "(%s)",
-                            field_name(i), field_name(i));
-            rc = run_create_index(pconn, MAIN_TABLE, field_name(i),
-                                  request->str);
-            if (rc)
-                goto free_str;
-        }
-    }
-    rc = DB_SUCCESS;
+    rc = create_table_indexes(pconn, T_MAIN, false);
 
  free_str:
     g_string_free(request, TRUE);
@@ -1524,22 +1618,7 @@ static int create_table_dnames(db_conn_t *pconn, bool *affects_trig)
         goto free_str;
 
     /* create indexes on this table */
-    cookie = -1;
-    while ((i = attr_index_iter(0, &cookie)) != -1) {
-        if (is_names_field(i) && is_indexed_field(i)) {
-            g_string_printf(request,
-                            "CREATE INDEX %s_index ON " DNAMES_TABLE "(%s)",
-                            field_name(i), field_name(i));
-            rc = run_create_index(pconn, DNAMES_TABLE, field_name(i),
-                                  request->str);
-            if (rc)
-                goto free_str;
-        }
-    }
-
-    /* this index is needed to build the fullpath of entries */
-    rc = run_create_index(pconn, DNAMES_TABLE, "id",
-                          "CREATE INDEX id_index ON " DNAMES_TABLE "(id)");
+    rc = create_table_indexes(pconn, T_DNAMES, false);
  free_str:
     g_string_free(request, TRUE);
     return rc;
@@ -1611,19 +1690,7 @@ static int create_table_annex(db_conn_t *pconn, bool *affects_trig)
         goto free_str;
 
     /* create indexes on this table */
-    cookie = -1;
-    while ((i = attr_index_iter(0, &cookie)) != -1) {
-        if (is_annex_field(i) && is_indexed_field(i)) {
-            g_string_printf(request,
-                            "CREATE INDEX %s_index ON " ANNEX_TABLE "(%s)",
-                            field_name(i), field_name(i));
-            rc = run_create_index(pconn, ANNEX_TABLE, field_name(i),
-                                  request->str);
-            if (rc)
-                goto free_str;
-        }
-    }
-    rc = DB_SUCCESS;
+    rc = create_table_indexes(pconn, T_ANNEX, false);
 
  free_str:
     g_string_free(request, TRUE);
@@ -1631,6 +1698,9 @@ static int create_table_annex(db_conn_t *pconn, bool *affects_trig)
 }
 
 #ifdef _LUSTRE
+/** STRIPE_INFO has a 'layout' field (compact_stripes) */
+static bool stripe_info_has_layout = false;
+
 static int check_table_stripe_info(db_conn_t *pconn, bool *affects_trig)
 {
     int rc;
@@ -1683,10 +1753,43 @@ static int check_table_stripe_info(db_conn_t *pconn, bool *affects_trig)
         if (check_field_name
             ("pool_name", &curr_field_index, STRIPE_INFO_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
+
+        /* compact_stripes: layout field. If it is no longer used, it is
+         * dropped after STRIPE_ITEMS conversion. */
+        stripe_info_has_layout = (curr_field_index < MAX_DB_FIELDS
+                                  && fieldtab[curr_field_index] != NULL
+                                  && !strcmp(fieldtab[curr_field_index],
+                                             "layout"));
+        if (stripe_info_has_layout)
+            curr_field_index++;
+
         /* is there any extra field ? */
         if (has_extra_field
             (curr_field_index, STRIPE_INFO_TABLE, fieldtab, true))
             return DB_BAD_SCHEMA;
+
+        if (lmgr_config.compact_stripes && !stripe_info_has_layout
+            && !report_only) {
+            if (!alter_db) {
+                DisplayLog(LVL_CRIT, LISTMGR_TAG, "DB schema change detected: "
+                           "compact_stripes is enabled: field '"
+                           STRIPE_INFO_TABLE ".layout' must be added"
+                           " => Run 'robinhood --alter-db' to convert stripe "
+                           "tables.");
+                return DB_NEED_ALTER;
+            }
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "=> Adding field 'layout' to "
+                       "table " STRIPE_INFO_TABLE);
+            rc = db_exec_sql(pconn, "ALTER TABLE " STRIPE_INFO_TABLE
+                             " ADD layout " LAYOUT_TYPE, NULL);
+            if (rc) {
+                DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                           "Failed to add field 'layout': Error: %s",
+                           db_errmsg(pconn, strbuf, sizeof(strbuf)));
+                return rc;
+            }
+            stripe_info_has_layout = true;
+        }
     } else if (rc != DB_NOT_EXISTS) {
         DisplayLog(LVL_CRIT, LISTMGR_TAG,
                    "Error checking database schema: %s",
@@ -1704,11 +1807,171 @@ static int create_table_stripe_info(db_conn_t *pconn, bool *affects_trig)
     g_string_printf(request, "CREATE TABLE " STRIPE_INFO_TABLE
                     " (id " PK_TYPE " PRIMARY KEY, validator INT, "
                     "stripe_count INT UNSIGNED, stripe_size INT UNSIGNED, "
-                    "pool_name VARBINARY(%u))", MAX_POOL_LEN - 1);
+                    "pool_name VARBINARY(%u)", MAX_POOL_LEN - 1);
+    if (lmgr_config.compact_stripes)
+        g_string_append(request, ", layout " LAYOUT_TYPE);
+    g_string_append(request, ")");
     append_engine(request);
 
     rc = run_create_table(pconn, STRIPE_INFO_TABLE, request->str);
     g_string_free(request, TRUE);
+    if (rc == DB_SUCCESS)
+        stripe_info_has_layout = lmgr_config.compact_stripes;
+    return rc;
+}
+
+/** STRIPE_ITEMS definition (only OSTs of each file if compact) */
+static int create_stripe_items(db_conn_t *pconn, const char *table,
+                               bool compact)
+{
+    GString *request;
+    int rc;
+
+    request = g_string_new(NULL);
+    if (compact)
+        g_string_printf(request, "CREATE TABLE %s (id " PK_TYPE ", "
+                        "ostidx INT UNSIGNED)", table);
+    else
+        g_string_printf(request, "CREATE TABLE %s (id " PK_TYPE ", "
+                        "stripe_index INT UNSIGNED, ostidx INT UNSIGNED, "
+                        "details BINARY(%u))", table, STRIPE_DETAIL_SZ);
+    append_engine(request);
+
+    rc = run_create_table(pconn, table, request->str);
+    g_string_free(request, TRUE);
+    return rc;
+}
+
+static int create_stripe_items_indexes(db_conn_t *pconn)
+{
+    int rc;
+
+    rc = run_create_index(pconn, STRIPE_ITEMS_TABLE, "id",
+                          "CREATE INDEX id_index ON " STRIPE_ITEMS_TABLE
+                          "(id)");
+    if (rc)
+        return rc;
+
+    return run_create_index(pconn, STRIPE_ITEMS_TABLE, "ostidx",
+                            "CREATE INDEX ost_index ON " STRIPE_ITEMS_TABLE
+                            "(ostidx)");
+}
+
+#define STRIPE_ITEMS_NEW    STRIPE_ITEMS_TABLE "_NEW"
+#define STRIPE_ITEMS_OLD    STRIPE_ITEMS_TABLE "_OLD"
+
+/** replace STRIPE_ITEMS by the converted table, then build its indexes */
+static int replace_stripe_items(db_conn_t *pconn)
+{
+    char errmsg[1024];
+    int rc;
+
+#ifdef _MYSQL
+    /* atomic swap */
+    rc = db_exec_sql(pconn, "RENAME TABLE " STRIPE_ITEMS_TABLE " TO "
+                     STRIPE_ITEMS_OLD ", " STRIPE_ITEMS_NEW " TO "
+                     STRIPE_ITEMS_TABLE, NULL);
+    if (rc == DB_SUCCESS)
+        rc = db_drop_component(pconn, DBOBJ_TABLE, STRIPE_ITEMS_OLD);
+#else
+    /* DDL is transactional */
+    rc = db_exec_sql(pconn, BEGIN_TX, NULL);
+    if (rc == DB_SUCCESS)
+        rc = db_drop_component(pconn, DBOBJ_TABLE, STRIPE_ITEMS_TABLE);
+    if (rc == DB_SUCCESS)
+        rc = db_exec_sql(pconn, "ALTER TABLE " STRIPE_ITEMS_NEW " RENAME TO "
+                         STRIPE_ITEMS_TABLE, NULL);
+    if (rc == DB_SUCCESS)
+        rc = db_exec_sql(pconn, "COMMIT", NULL);
+    else
+        db_exec_sql(pconn, "ROLLBACK", NULL);
+#endif
+    if (rc) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to replace table "
+                   STRIPE_ITEMS_TABLE ": Error: %s",
+                   db_errmsg(pconn, errmsg, sizeof(errmsg)));
+        return rc;
+    }
+
+    return create_stripe_items_indexes(pconn);
+}
+
+/**
+ * Convert stripe tables after compact_stripes changed.
+ * The conversion can be resumed if it is interrupted:
+ * - to compact: STRIPE_ITEMS details are dropped at last;
+ * - to rows: STRIPE_INFO.layout is dropped at last.
+ */
+static int convert_stripe_tables(db_conn_t *pconn, bool to_compact)
+{
+    char timestr[256] = "";
+    char t[128];
+    time_t estimated;
+    int rc;
+
+    if (!alter_db) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "DB schema change detected: "
+                   "compact_stripes is %s: stripe tables must be converted"
+                   " => Run 'robinhood --alter-db' to apply this change.",
+                   to_compact ? "enabled" : "disabled");
+        return DB_NEED_ALTER;
+    }
+
+    estimated = estimated_time(pconn, STRIPE_ITEMS_TABLE, 50000);
+    if (estimated > 0)
+        snprintf(timestr, sizeof(timestr), " (estim. duration: ~%s)",
+                 FormatDurationFloat(t, sizeof(t), estimated));
+    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "=> Converting stripe tables to %s%s",
+               to_compact ? "compact layouts" : "stripe items", timestr);
+
+    /* leftovers of an interrupted conversion */
+    rc = db_drop_component(pconn, DBOBJ_TABLE, STRIPE_ITEMS_NEW);
+    if (rc && rc != DB_NOT_EXISTS)
+        return rc;
+    rc = create_stripe_items(pconn, STRIPE_ITEMS_NEW, to_compact);
+    if (rc)
+        return rc;
+
+    if (to_compact) {
+        rc = stripe_layouts_encode_all(pconn);
+        if (rc)
+            goto err;
+
+        /* only keep the index of OSTs */
+        rc = db_exec_sql(pconn, "INSERT INTO " STRIPE_ITEMS_NEW
+                         " (id,ostidx) SELECT DISTINCT id,ostidx FROM "
+                         STRIPE_ITEMS_TABLE, NULL);
+        if (rc)
+            goto err;
+
+        rc = replace_stripe_items(pconn);
+        if (rc)
+            return rc;
+    } else {
+        rc = stripe_layouts_decode_all(pconn, STRIPE_ITEMS_NEW);
+        if (rc)
+            goto err;
+
+        rc = replace_stripe_items(pconn);
+        if (rc)
+            return rc;
+
+        rc = drop_field(pconn, STRIPE_INFO_TABLE, "layout");
+        if (rc)
+            return rc;
+        stripe_info_has_layout = false;
+    }
+
+    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Stripe tables successfully converted");
+    return DB_SUCCESS;
+
+ err:
+    {
+        char errmsg[1024];
+
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to convert stripe tables: "
+                   "Error: %s", db_errmsg(pconn, errmsg, sizeof(errmsg)));
+    }
     return rc;
 }
 
@@ -1723,18 +1986,22 @@ static int check_table_stripe_items(db_conn_t *pconn, bool *affects_trig)
 
     if (rc == DB_SUCCESS) {
         int curr_field_index = 0;
+        bool compact;
 
         /* check index */
         if (check_field_name
             ("id", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
-        if (check_field_name
+        /* compact_stripes: only id and ostidx */
+        compact = (fieldtab[curr_field_index] != NULL
+                   && !strcmp(fieldtab[curr_field_index], "ostidx"));
+        if (!compact && check_field_name
             ("stripe_index", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
         if (check_field_name
             ("ostidx", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
-        if (check_field_name
+        if (!compact && check_field_name
             ("details", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
 
@@ -1742,6 +2009,25 @@ static int check_table_stripe_items(db_conn_t *pconn, bool *affects_trig)
         if (has_extra_field
             (curr_field_index, STRIPE_ITEMS_TABLE, fieldtab, true))
             return DB_BAD_SCHEMA;
+
+        if (compact && !stripe_info_has_layout) {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Database schema: compact "
+                       STRIPE_ITEMS_TABLE " table without "
+                       STRIPE_INFO_TABLE ".layout");
+            return DB_BAD_SCHEMA;
+        }
+
+        /* reporting commands use the current encoding */
+        if (report_only) {
+            lmgr_config.compact_stripes = compact;
+            return DB_SUCCESS;
+        }
+
+        if (lmgr_config.compact_stripes && !compact)
+            return convert_stripe_tables(pconn, true);
+        /* layout is dropped at the end of the conversion */
+        if (!lmgr_config.compact_stripes && stripe_info_has_layout)
+            return convert_stripe_tables(pconn, false);
     } else if (rc != DB_NOT_EXISTS) {
         DisplayLog(LVL_CRIT, LISTMGR_TAG,
                    "Error checking database schema: %s",
@@ -1752,31 +2038,14 @@ static int check_table_stripe_items(db_conn_t *pconn, bool *affects_trig)
 
 static int create_table_stripe_items(db_conn_t *pconn, bool *affects_trig)
 {
-    GString *request;
     int rc;
 
-    request = g_string_new(NULL);
-    g_string_printf(request, "CREATE TABLE " STRIPE_ITEMS_TABLE
-                    " (id " PK_TYPE ", stripe_index INT UNSIGNED, "
-                    "ostidx INT UNSIGNED, details BINARY(%u))",
-                    STRIPE_DETAIL_SZ);
-    append_engine(request);
-
-    rc = run_create_table(pconn, STRIPE_ITEMS_TABLE, request->str);
-    g_string_free(request, TRUE);
+    rc = create_stripe_items(pconn, STRIPE_ITEMS_TABLE,
+                             lmgr_config.compact_stripes);
     if (rc)
         return rc;
 
-    rc = run_create_index(pconn, STRIPE_ITEMS_TABLE, "id",
-                          "CREATE INDEX id_index ON " STRIPE_ITEMS_TABLE
-                          "(id)");
-    if (rc)
-        return rc;
-
-    rc = run_create_index(pconn, STRIPE_ITEMS_TABLE, "ostidx",
-                          "CREATE INDEX ost_index ON " STRIPE_ITEMS_TABLE
-                          "(ostidx)");
-    return rc;
+    return create_stripe_items_indexes(pconn);
 }
 #endif
 
@@ -1982,11 +2251,36 @@ static int create_table_acct(db_conn_t *pconn, bool *affects_trig)
     int i, rc, cookie;
     bool first_acct_pk = true;
     bool is_first_acct_field = true;
+    /* If robinhood maintains accounting, the table is populated online:
+     * build a shadow table that will replace ACCT_STAT once complete. */
+    bool online = lmgr_app_acct();
+    bool empty = false;
+    const char *table;
 
     if (!lmgr_config.acct)
         return DB_SUCCESS;
 
-    request = g_string_new("CREATE TABLE " ACCT_TABLE " (");
+    /* nothing to populate in background if there is no entry yet */
+    if (online && lmgr_table_empty(pconn, acct_info_table, &empty) == DB_SUCCESS
+        && empty)
+        online = false;
+    table = online ? ACCT_REBUILD_TABLE : ACCT_TABLE;
+
+    if (online) {
+        /* left by an interrupted rebuild */
+        rc = db_drop_component(pconn, DBOBJ_TABLE, ACCT_REBUILD_TABLE);
+        if (rc != DB_SUCCESS && rc != DB_NOT_EXISTS) {
+            char err_buf[1024];
+
+            DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                       "Failed to drop table " ACCT_REBUILD_TABLE ": Error: %s",
+                       db_errmsg(pconn, err_buf, sizeof(err_buf)));
+            return rc;
+        }
+    }
+
+    request = g_string_new(NULL);
+    g_string_printf(request, "CREATE TABLE %s (", table);
 
     cookie = -1;
     while ((i = attr_index_iter(0, &cookie)) != -1) {
@@ -2029,12 +2323,15 @@ static int create_table_acct(db_conn_t *pconn, bool *affects_trig)
     g_string_append(request, "))");
     append_engine(request);
 
-    rc = run_create_table(pconn, ACCT_TABLE, request->str);
+    rc = run_create_table(pconn, table, request->str);
     if (rc)
         goto free_str;
 
     /* now populate it */
-    rc = populate_acct_table(pconn);
+    if (online)
+        acct_rebuild = true;
+    else
+        rc = populate_acct_table(pconn);
 
  free_str:
     g_string_free(request, TRUE);
@@ -2199,15 +2496,21 @@ static int set_functions_version(db_conn_t *conn)
     return rc;
 }
 
+/** is accounting maintained by triggers? */
+static inline bool acct_use_triggers(void)
+{
+    return lmgr_config.acct && lmgr_config.acct_triggers;
+}
+
 static int check_triggers_version(db_conn_t *pconn, bool *affects_trig)
 {
     int rc;
     char val[1024];
 
-    /* no accounting or report_only: don't check triggers */
-    if (!lmgr_config.acct && !report_only) {
+    /* no accounting triggers or report_only: don't check triggers */
+    if (!acct_use_triggers() && !report_only) {
         DisplayLog(LVL_VERB, LISTMGR_TAG,
-                   "Accounting is disabled: all triggers will be dropped.");
+                   "Accounting triggers are disabled: all triggers will be dropped.");
         return DB_SUCCESS;
     } else if (report_only)
         return DB_SUCCESS;  /* don't care about triggers */
@@ -2256,8 +2559,8 @@ static int check_trig_acct_insert(db_conn_t *pconn, bool *affects_trig)
     int rc;
     char strbuf[4096];
 
-    if (!lmgr_config.acct) {
-        /* no acct: must delete trigger */
+    if (!acct_use_triggers()) {
+        /* no acct triggers: must delete trigger */
         if (!report_only) {
             DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Dropping trigger %s",
                        ACCT_TRIGGER_INSERT);
@@ -2285,8 +2588,8 @@ static int check_trig_acct_delete(db_conn_t *pconn, bool *affects_trig)
 {
     int rc;
     char strbuf[4096];
-    if (!lmgr_config.acct) {
-        /* no acct: must delete trigger */
+    if (!acct_use_triggers()) {
+        /* no acct triggers: must delete trigger */
         if (!report_only) {
             DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Dropping trigger %s",
                        ACCT_TRIGGER_DELETE);
@@ -2314,8 +2617,8 @@ static int check_trig_acct_update(db_conn_t *pconn, bool *affects_trig)
 {
     int rc;
     char strbuf[4096];
-    if (!lmgr_config.acct) {
-        /* no acct: must delete trigger */
+    if (!acct_use_triggers()) {
+        /* no acct triggers: must delete trigger */
         if (!report_only) {
             DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Dropping trigger %s",
                        ACCT_TRIGGER_UPDATE);
@@ -2732,6 +3035,83 @@ static int create_func_thispath(db_conn_t *pconn, bool *affects_trig)
     return rc;
 }
 
+static const table_enum bulk_tables[] = {T_MAIN, T_DNAMES, T_ANNEX};
+
+/** drop accounting triggers and secondary indexes before a bulk load */
+int lmgr_bulk_prepare(db_conn_t *pconn)
+{
+    static const char *triggers[] = {ACCT_TRIGGER_INSERT, ACCT_TRIGGER_DELETE,
+                                     ACCT_TRIGGER_UPDATE};
+    char errbuf[1024];
+    int i, rc;
+
+    if (acct_use_triggers()) {
+        for (i = 0; i < sizeof(triggers) / sizeof(*triggers); i++) {
+            rc = db_drop_component(pconn, DBOBJ_TRIGGER, triggers[i]);
+            if (rc != DB_SUCCESS && rc != DB_TRG_NOT_EXISTS
+                && rc != DB_NOT_EXISTS) {
+                DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                           "Failed to drop %s trigger: Error: %s",
+                           triggers[i], db_errmsg(pconn, errbuf,
+                                                  sizeof(errbuf)));
+                return rc;
+            }
+        }
+    }
+
+    for (i = 0; i < sizeof(bulk_tables) / sizeof(*bulk_tables); i++) {
+        rc = drop_table_indexes(pconn, bulk_tables[i]);
+        if (rc)
+            return rc;
+    }
+    return DB_SUCCESS;
+}
+
+/** rebuild secondary indexes, ACCT_STAT contents and accounting triggers
+ * after a bulk load */
+int lmgr_bulk_finish(db_conn_t *pconn)
+{
+    char errbuf[1024];
+    bool dummy;
+    int i, rc;
+
+    for (i = 0; i < sizeof(bulk_tables) / sizeof(*bulk_tables); i++) {
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Building indexes of %s...",
+                   table2name(bulk_tables[i]));
+        FlushLogs();
+        rc = create_table_indexes(pconn, bulk_tables[i], true);
+        if (rc)
+            return rc;
+    }
+
+    if (lmgr_config.acct) {
+        /* ACCT_STAT was not maintained during the load */
+        rc = db_exec_sql(pconn, "DELETE FROM " ACCT_TABLE, NULL);
+        if (rc) {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                       "Failed to empty " ACCT_TABLE ": Error: %s",
+                       db_errmsg(pconn, errbuf, sizeof(errbuf)));
+            return rc;
+        }
+        rc = populate_acct_table(pconn);
+        if (rc)
+            return rc;
+    }
+
+    if (acct_use_triggers()) {
+        rc = create_trig_acct_insert(pconn, &dummy);
+        if (rc)
+            return rc;
+        rc = create_trig_acct_delete(pconn, &dummy);
+        if (rc)
+            return rc;
+        rc = create_trig_acct_update(pconn, &dummy);
+        if (rc)
+            return rc;
+    }
+    return DB_SUCCESS;
+}
+
 typedef struct dbobj_descr {
     db_object_e o_type;
     const char *o_name;
@@ -2798,6 +3178,12 @@ int ListMgr_Init(enum lmgr_init_flags flags)
     /* determine source tables for accounting */
     acct_info_table = acct_table();
 
+    path_cache_init(lmgr_config.path_cache_size);
+
+    /* reports from a snapshot file */
+    if (init_flags & LIF_NO_DB)
+        return DB_SUCCESS;
+
     /* create a database access */
     rc = db_connect(&conn);
     if (rc)
@@ -2869,8 +3255,20 @@ int ListMgr_Init(enum lmgr_init_flags flags)
             goto close_conn;
     }
 
+    /* a bulk load was interrupted */
+    if (!report_only) {
+        rc = listmgr_bulk_recover(&conn);
+        if (rc)
+            goto close_conn;
+    }
+
     rc = DB_SUCCESS;
 
+    if (acct_rebuild) {
+        acct_rebuild = false;
+        rc = lmgr_acct_rebuild_start(acct_info_table);
+    }
+
  close_conn:
     /* close the connection in any case */
     db_close_conn(&conn);
@@ -2907,6 +3305,9 @@ int ListMgr_InitAccess(lmgr_t *p_mgr)
     for (i = 0; i < OPCOUNT; i++)
         p_mgr->nbop[i] = 0;
 
+    p_mgr->stmt_cache = NULL;
+    p_mgr->snapshot = NULL;
+
     return 0;
 }
 
@@ -2914,9 +3315,15 @@ int ListMgr_CloseAccess(lmgr_t *p_mgr)
 {
     int rc;
 
+    /* write pending accounting changes */
+    ListMgr_AcctFlush(p_mgr);
+
     /* force to commit queued requests */
     rc = lmgr_flush_commit(p_mgr);
 
+    /* release prepared statements */
+    lmgr_stmt_cache_free(p_mgr);
+
     /* close connexion */
     db_close_conn(&p_mgr->conn);
 
@@ -24,6 +24,7 @@
 #include "Memory.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void no_name_warning(const PK_PARG_T pk, const attr_set_t *p_attrs,
                             unsigned int count)
@@ -80,6 +81,144 @@ static bool entry_filter(table_enum table, bool update,
     }
 }
 
+/** build a batch insert statement with placeholders for the given rows */
+static GString *batch_insert_query(attr_mask_t full_mask, unsigned int rows,
+                                   table_enum table, bool update,
+                                   bool id_is_pk, const char *extra_field_name,
+                                   const char *extra_field_value)
+{
+    GString    *req;
+    attr_set_t  fake_attrs = ATTR_SET_INIT;
+    int         i;
+
+    fake_attrs.attr_mask = full_mask;
+
+    req = g_string_new("INSERT INTO ");
+    g_string_append_printf(req, "%s(id", table2name(table));
+    attrmask2fieldlist(req, full_mask, table, "", "", AOF_LEADING_SEP);
+
+    if (extra_field_name != NULL)
+        g_string_append_printf(req, ",%s) VALUES ", extra_field_name);
+    else
+        g_string_append(req, ") VALUES ");
+
+    for (i = 0; i < rows; i++) {
+        g_string_append(req, i == 0 ? "(?" : ",(?");
+        attrset2valuelist(NULL, req, &fake_attrs, table,
+                          AOF_LEADING_SEP | AOF_PLACEHOLDER);
+        if (extra_field_value != NULL)
+            g_string_append_printf(req, ",%s)", extra_field_value);
+        else
+            g_string_append(req, ")");
+    }
+
+    if (update) {
+        if (id_is_pk)
+            g_string_append(req, UPSERT_CLAUSE("id"));
+        else
+            g_string_append_printf(req, UPSERT_CLAUSE("pkn") "id="
+                                   UPSERT_VALUE ",", "id");
+        attrset2updatelist(NULL, req, &fake_attrs, table, AOF_GENERIC_VAL);
+    }
+    return req;
+}
+
+/**
+ * Same as run_batch_insert(), using prepared statements.
+ * Rows are sent by chunks of power-of-2 sizes, so a few statements per table
+ * and attribute mask are enough for any batch size.
+ */
+static int run_batch_insert_stmt(lmgr_t *p_mgr,
+                                 attr_mask_t full_mask,
+                                 pktype *const pklist,
+                                 attr_set_t **p_attrs, unsigned int count,
+                                 table_enum table,
+                                 bool update, bool id_is_pk,
+                                 const char* extra_field_name,
+                                 const char* extra_field_value)
+{
+    lmgr_stmt_key_t key = {
+        .kind = update ? STMT_UPSERT : STMT_INSERT,
+        .table = table,
+        .mask = full_mask,
+    };
+    unsigned int *rows;
+    unsigned int  nb_rows = 0;
+    unsigned int  max_rows;
+    unsigned int  i, done;
+    int           rc = DB_SUCCESS;
+
+    /* do nothing if no field is to be set */
+    if (attrmask_field_count(full_mask, table) == 0
+        && extra_field_name == NULL)
+        return DB_SUCCESS;
+
+    rows = MemAlloc(count * sizeof(*rows));
+    if (rows == NULL)
+        return DB_NO_MEMORY;
+
+    for (i = 0; i < count; i++)
+        if (entry_filter(table, update, pklist[i], p_attrs[i]))
+            rows[nb_rows++] = i;
+
+    /* the number of parameters of a statement is limited */
+    max_rows = MIN2(STMT_MAX_ROWS, DB_MAX_PARAMS
+                    / (1 + attrmask_field_count(full_mask, table)));
+
+    for (done = 0; done < nb_rows; done += key.rows) {
+        db_stmt_t    *stmt;
+        unsigned int  idx = 0;
+        db_type_u     u;
+
+        /* largest power of 2 <= remaining rows */
+        key.rows = 1;
+        while (key.rows * 2 <= MIN2(nb_rows - done, max_rows))
+            key.rows *= 2;
+
+        stmt = lmgr_stmt_lookup(p_mgr, &key);
+        if (stmt == NULL) {
+            GString *req = batch_insert_query(full_mask, key.rows, table,
+                                              update, id_is_pk,
+                                              extra_field_name,
+                                              extra_field_value);
+
+            rc = lmgr_stmt_prepare(p_mgr, &key, req->str, &stmt);
+            g_string_free(req, TRUE);
+            if (rc)
+                goto out_free;
+        }
+
+        for (i = done; i < done + key.rows; i++) {
+            u.val_str = pklist[rows[i]];
+            rc = db_stmt_bind(stmt, idx++, PK_DB_TYPE, &u);
+            if (rc)
+                goto out_free;
+
+            rc = attrset2params(stmt, &idx, p_attrs[rows[i]], table);
+            if (rc < 0) {
+                rc = -rc;
+                goto out_free;
+            }
+        }
+        if (idx != db_stmt_param_count(stmt)) {
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Incompatible attr mask "
+                       "in batched operation: %u values for %u parameters",
+                       idx, db_stmt_param_count(stmt));
+            rc = DB_INVALID_ARG;
+            goto out_free;
+        }
+
+        rc = lmgr_stmt_exec(p_mgr, stmt, false);
+        if (rc)
+            goto out_free;
+    }
+    rc = DB_SUCCESS;
+
+out_free:
+    MemFree(rows);
+    return rc;
+}
+
 /**
  * Build and execute a batch insert request for the given table.
  * @param full_mask     the sum of all entries attribute masks
@@ -105,6 +244,11 @@ static int run_batch_insert(lmgr_t *p_mgr,
     if (unlikely(extra_field_name != NULL && extra_field_value == NULL))
         return DB_INVALID_ARG;
 
+    if (lmgr_config.prepared_stmt)
+        return run_batch_insert_stmt(p_mgr, full_mask, pklist, p_attrs, count,
+                                     table, update, id_is_pk,
+                                     extra_field_name, extra_field_value);
+
     /* build batch request for the table */
     req = g_string_new("INSERT INTO ");
     g_string_append_printf(req, "%s(id", table2name(table));
@@ -142,10 +286,12 @@ static int run_batch_insert(lmgr_t *p_mgr,
          * based on full_mask attr mask */
         attr_set_t  fake_attrs = *(p_attrs[0]);
 
-        g_string_append(req, " ON DUPLICATE KEY UPDATE ");
         /* explicitely update the id if it is not part of the pk */
-        if (!id_is_pk)
-            g_string_append(req, "id=VALUES(id),");
+        if (id_is_pk)
+            g_string_append(req, UPSERT_CLAUSE("id"));
+        else
+            g_string_append_printf(req, UPSERT_CLAUSE("pkn") "id="
+                                   UPSERT_VALUE ",", "id");
 
         /* append x=VALUES(x) for all values */
         fake_attrs.attr_mask = full_mask;
@@ -257,6 +403,26 @@ out_free:
 }
 
 
+void listmgr_batch_insert_done(entry_id_t **p_ids, attr_set_t **p_attrs,
+                               unsigned int count, bool update_if_exists)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!ATTR_MASK_TEST(p_attrs[i], name)
+            || !ATTR_MASK_TEST(p_attrs[i], parent_id))
+            continue;
+
+        /* Existing entries may have been renamed.
+         * Only directories are cached (as ancestors): a new directory
+         * may have been cached as unknown when its children were inserted
+         * first (e.g. by a scan), new files can't be cached. */
+        if (update_if_exists || !ATTR_MASK_TEST(p_attrs[i], type)
+            || !strcmp(ATTR(p_attrs[i], type), STR_TYPE_DIR))
+            ListMgr_PathCacheInvalidate(p_ids[i]);
+    }
+}
+
 int ListMgr_Insert(lmgr_t *p_mgr, entry_id_t *p_id, attr_set_t *p_info,
                    bool update_if_exists)
 {
@@ -296,8 +462,10 @@ retry:
         goto retry;
 
     /* success, count it */
-    if (!rc)
+    if (!rc) {
         p_mgr->nbop[OPIDX_INSERT]++;
+        listmgr_batch_insert_done(&p_id, &p_info, 1, update_if_exists);
+    }
     return rc;
 }
 
@@ -368,6 +536,8 @@ retry:
             p_mgr->nbop[OPIDX_UPDATE] += count;
         else
             p_mgr->nbop[OPIDX_INSERT] += count;
+
+        listmgr_batch_insert_done(p_ids, p_attrs, count, update_if_exists);
     }
     return rc;
 }
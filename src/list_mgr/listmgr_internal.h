@@ -83,23 +83,66 @@ int listmgr_get_funcattrs(lmgr_t *p_mgr, PK_ARG_T pk, attr_set_t *p_attrs);
 int listmgr_batch_insert_no_tx(lmgr_t *p_mgr, entry_id_t **p_ids,
                                attr_set_t **p_attrs, unsigned int count,
                                bool update_if_exists);
+/** to be called once listmgr_batch_insert_no_tx() is committed */
+void listmgr_batch_insert_done(entry_id_t **p_ids, attr_set_t **p_attrs,
+                               unsigned int count, bool update_if_exists);
 
 int listmgr_remove_no_tx(lmgr_t *p_mgr, const entry_id_t *p_id,
                          const attr_set_t *p_attr_set, bool last);
 
+struct iter_stream;
+
 typedef struct lmgr_iterator_t {
     lmgr_t          *p_mgr;
     lmgr_iter_opt_t  opt;
     result_handle_t  select_result;
+    /** entries retrieved by chunks (NULL if retrieved at once) */
+    struct iter_stream *stream;
     unsigned int     opt_is_set:1;
 } lmgr_iterator_t;
 
+/* client-side path resolution (see listmgr_pathcache.c) */
+void path_cache_init(unsigned int max_count);
+/* invalidations must be done after the change is committed */
+void path_cache_invalidate(PK_ARG_T pk);
+/** invalidate the entries of a directory (e.g. after moving them) */
+void path_cache_invalidate_children(PK_ARG_T parent);
+/** replace fullpath by parent_id and name in the mask of a DB request.
+ * @param[out] p_added attributes added to the mask.
+ * @return true if fullpath is to be built by path_cache_fullpath().
+ */
+bool path_cache_fix_mask(attr_mask_t *p_mask, attr_mask_t *p_added);
+/** build fullpath from parent_id and name, then clear p_added attributes */
+int path_cache_fullpath(lmgr_t *p_mgr, attr_set_t *p_set,
+                        const attr_mask_t *p_added);
+
+/* bulk load of an initial scan (see listmgr_bulk.c) */
+int lmgr_bulk_prepare(db_conn_t *pconn);
+int lmgr_bulk_finish(db_conn_t *pconn);
+/** complete a bulk load that was interrupted */
+int listmgr_bulk_recover(db_conn_t *pconn);
+
+/* reports built from a snapshot file (see ListMgr_OpenSnapshot) */
+struct snap_report;
+
+struct snap_report *listmgr_snapshot_report(struct lmgr_snapshot *snap,
+                                    const report_field_descr_t *report_desc,
+                                    unsigned int report_descr_count,
+                                    const profile_field_descr_t *profile_descr,
+                                    const lmgr_filter_t *p_filter,
+                                    const lmgr_iter_opt_t *p_opt);
+int listmgr_snapshot_next(struct snap_report *r, db_value_t *p_value,
+                          unsigned int *p_value_count, profile_u *p_profile);
+void listmgr_snapshot_report_free(struct snap_report *r);
+
 #ifdef _LUSTRE
 /* see stripe_item_t structure in list_mgr.h */
 #define OSTGEN_SZ   4
 #define OBJID_SZ    8
 #define OBJSEQ_SZ   8
 #define STRIPE_DETAIL_SZ (OBJID_SZ+OBJSEQ_SZ+OSTGEN_SZ)
+/* encoded stripe layout (compact_stripes), see listmgr_stripe.c */
+#define LAYOUT_TYPE "MEDIUMBLOB"
 #endif
 
 static inline int buf2hex(char *out, size_t out_sz, const unsigned char *in,
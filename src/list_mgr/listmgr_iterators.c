@@ -26,6 +26,7 @@
 #include "rbh_misc.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 /* generate a select query that defines the given dirattr with the given name.
  * (for FILTERDIR_OTHER types)
@@ -196,6 +197,396 @@ static int select_all_request(lmgr_t *p_mgr, GString *req,
     return DB_SUCCESS;
 }
 
+/* -------------- Entries retrieved by chunks ---------------- */
+
+/**
+ * With iterator_chunk_size > 0, ordered entry lists are not retrieved by
+ * a single request, but by successive requests of iterator_chunk_size
+ * entries, starting after the last retrieved (sort value, id):
+ *      WHERE <filter> AND (sort > last_val OR (sort = last_val AND id > last_id))
+ *      ORDER BY sort, id LIMIT <chunk_size>
+ * This bounds client memory and request duration. With iterator_prefetch,
+ * the next chunk is retrieved by a background thread (using its own DB
+ * connection) while the current one is processed.
+ */
+
+/** a chunk of entry ids */
+struct iter_chunk {
+    pktype         *pks;
+    unsigned int    count;
+    unsigned int    next;   /**< index of the next entry to be returned */
+    bool            last;   /**< no more entries after this chunk */
+};
+
+struct iter_stream {
+    GString        *select;     /**< SELECT ... FROM ... */
+    GString        *where;      /**< filter (can be empty) */
+    GString        *id_col;     /**< qualified id field */
+    GString        *sort_col;   /**< qualified sort field (NULL if none) */
+    sort_order_t    order;
+    unsigned int    chunk_size;
+    unsigned int    max_count;  /**< max entries to retrieve (0=unlimited) */
+    unsigned int    total;      /**< number of entries retrieved so far */
+
+    /* key of the last retrieved entry */
+    bool            started;
+    pktype          last_pk;
+    char           *last_val;   /**< NULL for a NULL sort value */
+
+    struct iter_chunk chunks[2];
+    unsigned int    curr;       /**< chunk being returned */
+
+    /* background retrieval of the next chunk */
+    bool            prefetch;
+    lmgr_t          pf_lmgr;    /**< prefetch DB connection */
+    pthread_t       pf_thread;
+    pthread_mutex_t pf_lock;
+    pthread_cond_t  pf_cond;
+    bool            pf_pending; /**< next chunk requested */
+    bool            pf_stop;
+    int             pf_rc;
+};
+
+/** check if an iterator request can be split into chunks */
+static bool iter_can_stream(const lmgr_sort_type_t *p_sort_type,
+                            table_enum sort_table, unsigned int sort_dirattr)
+{
+    if (lmgr_config.iter_chunk_size == 0)
+        return false;
+
+    /* dirattr sort is computed by the request */
+    if ((sort_dirattr & ATTR_INDEX_FLG_UNSPEC) == 0)
+        return false;
+
+    if (sort_table == T_NONE)
+        return true;
+
+    if (sort_table != T_MAIN && sort_table != T_ANNEX)
+        return false;
+
+    /* sort values are inserted as is in the next request */
+    switch (field_type(p_sort_type->attr_index)) {
+    case DB_INT:
+    case DB_UINT:
+    case DB_SHORT:
+    case DB_USHORT:
+    case DB_BIGINT:
+    case DB_BIGUINT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/** append the condition to start after the last retrieved entry */
+static void stream_append_key(struct iter_stream *s, GString *req)
+{
+    const char *id = s->id_col->str;
+
+    if (s->sort_col == NULL) {
+        g_string_append_printf(req, "%s>"DPK, id, s->last_pk);
+        return;
+    }
+
+    /* NULL values come first in ascending order, last in descending order */
+    if (s->order == SORT_ASC) {
+        if (s->last_val == NULL)
+            g_string_append_printf(req, "((%s IS NULL AND %s>"DPK") OR "
+                                   "%s IS NOT NULL)", s->sort_col->str, id,
+                                   s->last_pk, s->sort_col->str);
+        else
+            g_string_append_printf(req, "(%s>%s OR (%s=%s AND %s>"DPK"))",
+                                   s->sort_col->str, s->last_val,
+                                   s->sort_col->str, s->last_val, id,
+                                   s->last_pk);
+    } else {
+        if (s->last_val == NULL)
+            g_string_append_printf(req, "(%s IS NULL AND %s<"DPK")",
+                                   s->sort_col->str, id, s->last_pk);
+        else
+            g_string_append_printf(req, "(%s<%s OR (%s=%s AND %s<"DPK") OR "
+                                   "%s IS NULL)", s->sort_col->str,
+                                   s->last_val, s->sort_col->str, s->last_val,
+                                   id, s->last_pk, s->sort_col->str);
+    }
+}
+
+/** retrieve the next chunk of entries */
+static int stream_fetch(lmgr_t *p_mgr, struct iter_stream *s,
+                        struct iter_chunk *c)
+{
+    result_handle_t result;
+    GString *req;
+    unsigned int limit = s->chunk_size;
+    char *res[2] = { NULL, NULL };
+    char *last_res[2] = { NULL, NULL };
+    int rc;
+
+    c->count = c->next = 0;
+    c->last = true;
+
+    if (s->max_count > 0)
+        limit = MIN2(limit, s->max_count - s->total);
+    if (limit == 0)
+        return DB_SUCCESS;
+
+    req = g_string_new(s->select->str);
+
+    if (!GSTRING_EMPTY(s->where) || s->started) {
+        g_string_append(req, " WHERE ");
+        if (!GSTRING_EMPTY(s->where)) {
+            g_string_append(req, s->where->str);
+            if (s->started)
+                g_string_append(req, " AND ");
+        }
+        if (s->started)
+            stream_append_key(s, req);
+    }
+
+    if (s->sort_col == NULL)
+        g_string_append_printf(req, " ORDER BY %s", s->id_col->str);
+    else if (s->order == SORT_ASC)
+        g_string_append_printf(req, " ORDER BY %s ASC, %s ASC",
+                               s->sort_col->str, s->id_col->str);
+    else
+        g_string_append_printf(req, " ORDER BY %s DESC, %s DESC",
+                               s->sort_col->str, s->id_col->str);
+
+    g_string_append_printf(req, " LIMIT %u", limit);
+
+retry:
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, res,
+                                s->sort_col ? 2 : 1)) == DB_SUCCESS) {
+        if (res[0] == NULL) {
+            rc = DB_REQUEST_FAILED;
+            break;
+        }
+        rh_strncpy(c->pks[c->count], res[0], sizeof(pktype));
+        c->count++;
+        last_res[0] = res[0];
+        last_res[1] = res[1];
+    }
+    if (rc == DB_END_OF_LIST)
+        rc = DB_SUCCESS;
+
+    /* save the key of the last entry before releasing the result */
+    if (rc == DB_SUCCESS && c->count > 0) {
+        rh_strncpy(s->last_pk, last_res[0], sizeof(pktype));
+        free(s->last_val);
+        s->last_val = last_res[1] ? strdup(last_res[1]) : NULL;
+        s->started = true;
+        s->total += c->count;
+        c->last = (c->count < limit)
+                  || (s->max_count > 0 && s->total >= s->max_count);
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+free_str:
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+static void *stream_prefetch_thr(void *arg)
+{
+    struct iter_stream *s = arg;
+    int rc;
+
+    P(s->pf_lock);
+    while (!s->pf_stop) {
+        if (!s->pf_pending) {
+            pthread_cond_wait(&s->pf_cond, &s->pf_lock);
+            continue;
+        }
+        V(s->pf_lock);
+
+        rc = stream_fetch(&s->pf_lmgr, s, &s->chunks[1 - s->curr]);
+
+        P(s->pf_lock);
+        s->pf_rc = rc;
+        s->pf_pending = false;
+        pthread_cond_broadcast(&s->pf_cond);
+    }
+    V(s->pf_lock);
+    return NULL;
+}
+
+/** request the next chunk to the prefetch thread */
+static void stream_prefetch_next(struct iter_stream *s)
+{
+    P(s->pf_lock);
+    s->pf_pending = true;
+    pthread_cond_broadcast(&s->pf_cond);
+    V(s->pf_lock);
+}
+
+static void stream_free(struct iter_stream *s)
+{
+    if (s->prefetch) {
+        P(s->pf_lock);
+        s->pf_stop = true;
+        pthread_cond_broadcast(&s->pf_cond);
+        V(s->pf_lock);
+        pthread_join(s->pf_thread, NULL);
+        ListMgr_CloseAccess(&s->pf_lmgr);
+        pthread_cond_destroy(&s->pf_cond);
+        pthread_mutex_destroy(&s->pf_lock);
+    }
+
+    g_string_free(s->select, TRUE);
+    g_string_free(s->where, TRUE);
+    g_string_free(s->id_col, TRUE);
+    if (s->sort_col)
+        g_string_free(s->sort_col, TRUE);
+    free(s->last_val);
+    MemFree(s->chunks[0].pks);
+    MemFree(s->chunks[1].pks);
+    MemFree(s);
+}
+
+/**
+ * Create a chunked iterator request and retrieve the first chunk.
+ * \param id_table table of the selected id
+ * \param from     FROM clause
+ * \param where    filter (NULL or empty if none)
+ */
+static struct iter_stream *stream_new(lmgr_t *p_mgr, const char *id_table,
+                                      const char *from, const char *where,
+                                      bool distinct,
+                                      const lmgr_sort_type_t *p_sort_type,
+                                      table_enum sort_table,
+                                      const lmgr_iter_opt_t *p_opt)
+{
+    struct iter_stream *s;
+    int rc;
+
+    s = MemCalloc(1, sizeof(*s));
+    if (s == NULL)
+        return NULL;
+
+    s->chunk_size = lmgr_config.iter_chunk_size;
+    s->max_count = p_opt ? p_opt->list_count_max : 0;
+    /* don't allocate more than needed */
+    if (s->max_count > 0)
+        s->chunk_size = MIN2(s->chunk_size, s->max_count);
+
+    s->chunks[0].pks = MemAlloc(s->chunk_size * sizeof(pktype));
+    s->chunks[1].pks = MemAlloc(s->chunk_size * sizeof(pktype));
+
+    s->id_col = g_string_new(NULL);
+    g_string_printf(s->id_col, "%s.id", id_table);
+
+    s->select = g_string_new(NULL);
+    g_string_printf(s->select, distinct ? "SELECT DISTINCT(%s) AS id" :
+                    "SELECT %s AS id", s->id_col->str);
+
+    if (sort_table != T_NONE) {
+        s->sort_col = g_string_new(NULL);
+        g_string_printf(s->sort_col, "%s.%s", table2name(sort_table),
+                        field_name(p_sort_type->attr_index));
+        s->order = p_sort_type->order;
+        g_string_append_printf(s->select, ",%s", s->sort_col->str);
+    }
+    g_string_append_printf(s->select, " FROM %s", from);
+    s->where = g_string_new(where);
+
+    if (s->chunks[0].pks == NULL || s->chunks[1].pks == NULL)
+        goto free_stream;
+
+    /* retrieve the first chunk with the caller's connection */
+    rc = stream_fetch(p_mgr, s, &s->chunks[0]);
+    if (rc)
+        goto free_stream;
+    s->curr = 0;
+
+    if (s->chunks[0].last || !lmgr_config.iter_prefetch)
+        return s;
+
+    /* start retrieving the next chunk */
+    if (ListMgr_InitAccess(&s->pf_lmgr) != DB_SUCCESS) {
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to open a DB connection "
+                   "for prefetching: retrieving entries synchronously");
+        return s;
+    }
+    pthread_mutex_init(&s->pf_lock, NULL);
+    pthread_cond_init(&s->pf_cond, NULL);
+    s->pf_pending = true;
+
+    if (pthread_create(&s->pf_thread, NULL, stream_prefetch_thr, s) != 0) {
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to start prefetch thread: "
+                   "retrieving entries synchronously");
+        ListMgr_CloseAccess(&s->pf_lmgr);
+        pthread_cond_destroy(&s->pf_cond);
+        pthread_mutex_destroy(&s->pf_lock);
+        return s;
+    }
+    s->prefetch = true;
+    return s;
+
+free_stream:
+    stream_free(s);
+    return NULL;
+}
+
+/** get the id of the next entry of a chunked iterator */
+static int stream_next(lmgr_t *p_mgr, struct iter_stream *s, const char **pk)
+{
+    struct iter_chunk *c = &s->chunks[s->curr];
+    int rc;
+
+    if (c->next >= c->count) {
+        if (c->last)
+            return DB_END_OF_LIST;
+
+        if (s->prefetch) {
+            /* wait for the next chunk */
+            P(s->pf_lock);
+            while (s->pf_pending)
+                pthread_cond_wait(&s->pf_cond, &s->pf_lock);
+            rc = s->pf_rc;
+            V(s->pf_lock);
+            if (rc)
+                return rc;
+
+            s->curr = 1 - s->curr;
+            c = &s->chunks[s->curr];
+
+            if (!c->last)
+                stream_prefetch_next(s);
+        } else {
+            rc = stream_fetch(p_mgr, s, c);
+            if (rc)
+                return rc;
+        }
+
+        if (c->count == 0)
+            return DB_END_OF_LIST;
+    }
+
+    *pk = c->pks[c->next++];
+    return DB_SUCCESS;
+}
+
+/** append the condition on a range of ids */
+static void append_id_range(GString *str, const char *id_col,
+                            const lmgr_id_range_t *range)
+{
+    if (range->min != NULL)
+        g_string_append_printf(str, "%s>"DPK, id_col, range->min);
+    if (range->min != NULL && range->max != NULL)
+        g_string_append(str, " AND ");
+    if (range->max != NULL)
+        g_string_append_printf(str, "%s<="DPK, id_col, range->max);
+    /* no bound */
+    if (range->min == NULL && range->max == NULL)
+        g_string_append(str, "1");
+}
+
 /** get an iterator on a list of entries */
 struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
                                          const lmgr_filter_t *p_filter,
@@ -216,6 +607,7 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
     GString *where = NULL;
     GString *req = NULL;
     GString *filter_dir = NULL;
+    GString *range = NULL;
 
     /* Iterator only select a sorted list of ids.
      * Entry attributes are retrieved afterward in ListMgr_GetNext() call.
@@ -287,6 +679,27 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
         }
     }
 
+    /* restrict an unsorted listing to a range of ids */
+    if (p_opt != NULL && p_opt->id_range != NULL) {
+        char id_col[128];
+
+        if (do_sort(sort_table, sort_dirattr)) {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Unexpected range of ids "
+                       "for a sorted iterator");
+            goto free_str;
+        }
+
+        snprintf(id_col, sizeof(id_col), "%s.id",
+                 from != NULL ? table2name(query_tab) : MAIN_TABLE);
+        range = g_string_new(NULL);
+        append_id_range(range, id_col, p_opt->id_range);
+
+        g_string_append_printf(req, from != NULL ? " AND %s" : " WHERE %s",
+                               range->str);
+        if (from != NULL)
+            g_string_append_printf(where, " AND %s", range->str);
+    }
+
 #define SORT_ATTR_OPTIM (ATTR_INDEX_FLG_UNSPEC | 0x2)
 #if 0 /** @TODO RBHv3 to be reimplemnted */
     /* both filter and sort order */
@@ -309,6 +722,37 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
     }
 #endif
 
+    /* retrieve entries by chunks? */
+    if (iter_can_stream(p_sort_type, sort_table, sort_dirattr)
+        && filter_dir_type == FILTERDIR_NONE) {
+        const char *id_table;
+
+        if (from == NULL)   /* select all */
+            id_table = (sort_table != T_NONE) ? table2name(sort_table)
+                                              : MAIN_TABLE;
+        else
+            id_table = table2name(query_tab);
+
+        it = (lmgr_iterator_t *) MemAlloc(sizeof(lmgr_iterator_t));
+        if (it == NULL)
+            goto free_str;
+        it->p_mgr = p_mgr;
+        it->opt_is_set = 0;
+        if (p_opt) {
+            it->opt = *p_opt;
+            it->opt_is_set = 1;
+        }
+
+        it->stream = stream_new(p_mgr, id_table,
+                                from != NULL ? from->str : id_table,
+                                from != NULL ? where->str :
+                                    (range != NULL ? range->str : NULL),
+                                distinct, p_sort_type, sort_table, p_opt);
+        if (it->stream == NULL)
+            goto free_it;
+        goto free_str_ok;
+    }
+
     /* sort order */
     if (do_sort(sort_table, sort_dirattr)) {
         /* special cases: stripe info stands for pool_name,
@@ -330,6 +774,11 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
             g_string_append(req, "ASC");
         else
             g_string_append(req, "DESC");
+    } else if (range != NULL) {
+        /* so that the listing can be resumed after its last entry */
+        g_string_append_printf(req, " ORDER BY %s.id",
+                               from != NULL ? table2name(query_tab)
+                                            : MAIN_TABLE);
     }
 
     /* iterator opt */
@@ -339,6 +788,7 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
     /* allocate a new iterator */
     it = (lmgr_iterator_t *) MemAlloc(sizeof(lmgr_iterator_t));
     it->p_mgr = p_mgr;
+    it->stream = NULL;
     if (p_opt) {
         it->opt = *p_opt;
         it->opt_is_set = 1;
@@ -351,6 +801,9 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
     if (rc)
         goto free_it;
 
+ free_str_ok:
+    if (range != NULL)
+        g_string_free(range, TRUE);
     if (filter_dir != NULL)
         g_string_free(filter_dir, TRUE);
     if (from != NULL)
@@ -366,6 +819,8 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
     if (it != NULL)
         MemFree(it);
  free_str:
+    if (range != NULL)
+        g_string_free(range, TRUE);
     if (filter_dir != NULL)
         g_string_free(filter_dir, TRUE);
     if (from != NULL)
@@ -391,8 +846,12 @@ int ListMgr_GetNext(struct lmgr_iterator_t *p_iter, entry_id_t *p_id,
         entry_disappeared = false;
 
         idstr[0] = idstr[1] = idstr[2] = NULL;
-        rc = db_next_record(&p_iter->p_mgr->conn, &p_iter->select_result, idstr,
-                            3);
+        if (p_iter->stream != NULL)
+            rc = stream_next(p_iter->p_mgr, p_iter->stream,
+                             (const char **)&idstr[0]);
+        else
+            rc = db_next_record(&p_iter->p_mgr->conn, &p_iter->select_result,
+                                idstr, 3);
 
         if (rc)
             return rc;
@@ -439,6 +898,111 @@ int ListMgr_GetNext(struct lmgr_iterator_t *p_iter, entry_id_t *p_id,
 
 void ListMgr_CloseIterator(struct lmgr_iterator_t *p_iter)
 {
-    db_result_free(&p_iter->p_mgr->conn, &p_iter->select_result);
+    if (p_iter->stream != NULL)
+        stream_free(p_iter->stream);
+    else
+        db_result_free(&p_iter->p_mgr->conn, &p_iter->select_result);
     MemFree(p_iter);
 }
+
+/* -------------- Ranges of ids ---------------- */
+
+/**
+ * Range bounds are taken at regular offsets of the primary key index,
+ * so each range holds about the same number of entries (at the time of
+ * the split).
+ */
+int ListMgr_SplitIdRange(lmgr_t *p_mgr, unsigned int count,
+                         lmgr_id_range_t **p_ranges, unsigned int *p_nb)
+{
+    lmgr_id_range_t *ranges;
+    uint64_t total = 0;
+    unsigned int i, nb = 0;
+    char *prev = NULL;
+    int rc;
+
+    *p_ranges = NULL;
+    *p_nb = 0;
+
+    if (count == 0)
+        return DB_INVALID_ARG;
+
+    if (count > 1) {
+        rc = ListMgr_EntryCount(p_mgr, &total);
+        if (rc)
+            return rc;
+
+        /* don't split tiny tables */
+        if (total < count)
+            count = 1;
+    }
+
+    ranges = MemCalloc(count, sizeof(*ranges));
+    if (ranges == NULL)
+        return DB_NO_MEMORY;
+
+    for (i = 1; i < count; i++) {
+        result_handle_t result;
+        char *res = NULL;
+        char query[256];
+
+        snprintf(query, sizeof(query), "SELECT id FROM "MAIN_TABLE
+                 " ORDER BY id LIMIT 1 OFFSET %"PRIu64, (total * i) / count);
+retry:
+        rc = db_exec_sql(&p_mgr->conn, query, &result);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto free_ranges;
+
+        rc = db_next_record(&p_mgr->conn, &result, &res, 1);
+        if (rc == DB_SUCCESS && res != NULL
+            && (prev == NULL || strcmp(prev, res) != 0)) {
+            /* close the previous range on this id */
+            ranges[nb].min = prev != NULL ? strdup(prev) : NULL;
+            ranges[nb].max = strdup(res);
+            prev = ranges[nb].max;
+            nb++;
+        }
+        db_result_free(&p_mgr->conn, &result);
+        /* the table shrank meanwhile */
+        if (rc == DB_END_OF_LIST)
+            break;
+        else if (rc)
+            goto free_ranges;
+    }
+
+    /* last range is unbounded */
+    ranges[nb].min = prev != NULL ? strdup(prev) : NULL;
+    ranges[nb].max = NULL;
+    nb++;
+
+    *p_ranges = ranges;
+    *p_nb = nb;
+    return DB_SUCCESS;
+
+free_ranges:
+    ListMgr_FreeIdRanges(ranges, nb);
+    return rc;
+}
+
+int ListMgr_IdRangeStartAfter(lmgr_id_range_t *range, const entry_id_t *p_id)
+{
+    DEF_PK(pk);
+
+    entry_id2pk(p_id, PTR_PK(pk));
+    free(range->min);
+    range->min = strdup(pk);
+    return range->min != NULL ? DB_SUCCESS : DB_NO_MEMORY;
+}
+
+void ListMgr_FreeIdRanges(lmgr_id_range_t *ranges, unsigned int nb)
+{
+    unsigned int i;
+
+    for (i = 0; i < nb; i++) {
+        free(ranges[i].min);
+        free(ranges[i].max);
+    }
+    MemFree(ranges);
+}
@@ -65,8 +65,62 @@ static int append_parent_cond(lmgr_t *p_mgr, GString *str, const wagon_t *parent
     return DB_SUCCESS;
 }
 
+/**
+ * Index parents by primary key, to match children to their parent.
+ * Also return the max length of parent paths.
+ */
+static int parent_index_build(const wagon_t *parent_list,
+                              unsigned int parent_count,
+                              GHashTable **p_index, size_t *max_len)
+{
+    GHashTable *index;
+    unsigned int i;
+    DEF_PK(pk);
+
+    index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    if (index == NULL)
+        return DB_NO_MEMORY;
+
+    *max_len = 0;
+    for (i = 0; i < parent_count; i++)
+    {
+        size_t len = strlen(parent_list[i].fullname);
+
+        if (len > *max_len)
+            *max_len = len;
+
+        entry_id2pk(&parent_list[i].id, PTR_PK(pk));
+        /* store index + 1, as NULL means 'not found' */
+        g_hash_table_insert(index, g_strdup(pk), GUINT_TO_POINTER(i + 1));
+    }
+
+    *p_index = index;
+    return DB_SUCCESS;
+}
+
+/** find the parent of a child entry from its parent_id */
+static const wagon_t *parent_lookup(GHashTable *index,
+                                    const wagon_t *parent_list,
+                                    const attr_set_t *child_attrs)
+{
+    unsigned int i;
+    DEF_PK(pk);
+
+    if (!ATTR_MASK_TEST(child_attrs, parent_id))
+        return NULL;
+
+    entry_id2pk(&ATTR(child_attrs, parent_id), PTR_PK(pk));
+    i = GPOINTER_TO_UINT(g_hash_table_lookup(index, pk));
+    if (i == 0)
+        return NULL;
+
+    return &parent_list[i - 1];
+}
+
 /**
  * Get the list of children of a given parent (or list of parents).
+ * When several parents are specified, children full paths are built from
+ * the path of their own parent.
  * \param parent_list       [in]  list of parents to get the child of
  * \param parent_count      [in]  number of ids in parent list
  * \param attr_mask         [in]  required attributes for children
@@ -93,17 +147,17 @@ int ListMgr_GetChild(lmgr_t *p_mgr, const lmgr_filter_t *p_filter,
     table_enum         query_tab = T_DNAMES;
     bool               distinct = false;
     int                retry_status;
-
-    /* XXX: querying children from several parent cannot work, since
-     * we need to get the paths of the children. Or we could do a
-     * lookup into parent_list to find the right one. In the meantime,
-     * try not to mess up the code. */
-    if (unlikely(parent_count != 1))
-        RBH_BUG("cannot get children for several parent simultaneously");
+    GHashTable        *parent_idx = NULL;
+    size_t             max_len = 0;
 
     /* always request for name to build fullpath in wagon */
     attr_mask_set_index(&attr_mask, ATTR_INDEX_name);
 
+    /* with several parents, parent_id is needed to match children
+     * to their parent path */
+    if (parent_count > 1 && child_attr_list != NULL)
+        attr_mask_set_index(&attr_mask, ATTR_INDEX_parent_id);
+
     fields = g_string_new(NULL);
 
     /* append fields for all tables */
@@ -215,9 +269,19 @@ retry:
         }
     }
 
+    if (parent_count > 1 && child_attr_list != NULL)
+    {
+        rc = parent_index_build(parent_list, parent_count, &parent_idx,
+                                &max_len);
+        if (rc)
+            goto array_free;
+    }
+    else
+        max_len = strlen(parent_list[0].fullname);
+
     /* Allocate a string long enough to contain the parent path and a
      * child name. */
-    path_len = strlen(parent_list[0].fullname) + RBH_NAME_MAX + 2;
+    path_len = max_len + RBH_NAME_MAX + 2;
     path = malloc(path_len);
     if (!path) {
         DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Can't alloc enough memory (%d bytes)",
@@ -229,6 +293,7 @@ retry:
     for (i = 0; i < *child_count; i++)
     {
         char *res[128]; /* 128 fields per record is large enough */
+        const wagon_t *parent;
 
         rc = db_next_record(&p_mgr->conn, &result, res, sizeof(res)/sizeof(*res));
         if (rc)
@@ -288,8 +353,22 @@ retry:
 
             generate_fields(&((*child_attr_list)[i]));
 
+            parent = parent_list;
+            if (parent_idx != NULL)
+            {
+                parent = parent_lookup(parent_idx, parent_list,
+                                       &(*child_attr_list)[i]);
+                if (unlikely(parent == NULL))
+                {
+                    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Unexpected parent for "
+                               "entry %s: not in the requested list", res[0]);
+                    rc = DB_REQUEST_FAILED;
+                    goto array_free;
+                }
+            }
+
             /* Note: path is properly sized already to not overflow. */
-            snprintf(path, path_len, "%s/%s", parent_list[0].fullname,
+            snprintf(path, path_len, "%s/%s", parent->fullname,
                      (*child_attr_list)[i].attr_values.name);
             (*child_id_list)[i].fullname = strdup(path);
         }
@@ -297,6 +376,8 @@ retry:
 
     if (path)
         free(path);
+    if (parent_idx)
+        g_hash_table_destroy(parent_idx);
 
     db_result_free(&p_mgr->conn, &result);
     g_string_free(req, TRUE);
@@ -308,6 +389,8 @@ retry:
 array_free:
     if (path)
         free(path);
+    if (parent_idx)
+        g_hash_table_destroy(parent_idx);
     if (child_attr_list && *child_attr_list)
     {
         MemFree(*child_attr_list);
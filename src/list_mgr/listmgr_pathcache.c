@@ -0,0 +1,463 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Client-side resolution of entry paths.
+ *
+ * Instead of calling the this_path() DB function for each entry (which walks
+ * the NAMES table parent by parent), fullpath is built from the parent_id
+ * and name of the entry, and the names of its ancestors kept in an LRU cache
+ * (directory id -> parent_id, name).
+ *
+ * Caching the name of each directory (rather than its full path) means a
+ * directory rename or removal only invalidates the directory itself.
+ * Entries are invalidated when the list manager writes or removes names
+ * (once the change is committed), and when the pipeline processes
+ * rename/rmdir changelog records.
+ * Changes made by other processes are not seen: entries also expire after
+ * path_cache_ttl.
+ * The cache is shared by all connections of the process.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "Memory.h"
+#include "rbh_logs.h"
+#include <pthread.h>
+#include <string.h>
+#include <inttypes.h>
+
+/** max depth of a path (prevents from looping on inconsistent DB) */
+#define PC_MAX_DEPTH    1024
+
+struct pc_entry {
+    pktype              pk;
+    pktype              parent;     /**< empty if the id is not in NAMES */
+    char               *name;
+    time_t              expire;     /**< 0 if the entry doesn't expire */
+    struct pc_entry    *prev;       /**< LRU list, most recent first */
+    struct pc_entry    *next;
+};
+
+/** a name being read from the DB after a cache miss */
+struct pc_pending {
+    pktype              pk;
+    unsigned int        users;      /**< lookups in progress for pk */
+    unsigned int        version;    /**< incremented by invalidations */
+};
+
+static struct path_cache {
+    pthread_mutex_t     lock;
+    GHashTable         *table;      /**< pk -> struct pc_entry */
+    struct pc_entry    *head;
+    struct pc_entry    *tail;
+    unsigned int        count;
+    unsigned int        max_count;
+    /** pk -> struct pc_pending: lookups invalidated while reading the DB
+     * don't insert outdated values */
+    GHashTable         *pending;
+    /* stats */
+    uint64_t            nb_hit;
+    uint64_t            nb_miss;
+    uint64_t            nb_inval;
+    uint64_t            nb_evict;
+    uint64_t            nb_expired;
+} pcache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline bool path_cache_enabled(void)
+{
+    return pcache.table != NULL;
+}
+
+void path_cache_init(unsigned int max_count)
+{
+    P(pcache.lock);
+    if (pcache.table == NULL && max_count > 0) {
+        pcache.table = g_hash_table_new(g_str_hash, g_str_equal);
+        pcache.pending = g_hash_table_new(g_str_hash, g_str_equal);
+        pcache.max_count = max_count;
+    }
+    V(pcache.lock);
+}
+
+static void lru_unlink(struct pc_entry *e)
+{
+    if (e->prev != NULL)
+        e->prev->next = e->next;
+    else
+        pcache.head = e->next;
+    if (e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        pcache.tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push(struct pc_entry *e)
+{
+    e->prev = NULL;
+    e->next = pcache.head;
+    if (pcache.head != NULL)
+        pcache.head->prev = e;
+    pcache.head = e;
+    if (pcache.tail == NULL)
+        pcache.tail = e;
+}
+
+/** remove an entry from the cache (lock must be held) */
+static void pc_remove(struct pc_entry *e)
+{
+    g_hash_table_remove(pcache.table, e->pk);
+    lru_unlink(e);
+    pcache.count--;
+    MemFree(e->name);
+    MemFree(e);
+}
+
+void path_cache_invalidate(PK_ARG_T pk)
+{
+    struct pc_pending *p;
+    struct pc_entry *e;
+
+    if (!path_cache_enabled())
+        return;
+
+    P(pcache.lock);
+    p = g_hash_table_lookup(pcache.pending, pk);
+    if (p != NULL)
+        p->version++;
+    e = g_hash_table_lookup(pcache.table, pk);
+    if (e != NULL) {
+        pc_remove(e);
+        pcache.nb_inval++;
+    }
+    V(pcache.lock);
+}
+
+static void pc_pending_invalidate(gpointer k, gpointer v, gpointer udata)
+{
+    struct pc_pending *p = v;
+
+    p->version++;
+}
+
+void path_cache_invalidate_children(PK_ARG_T parent)
+{
+    struct pc_entry *e, *next;
+
+    if (!path_cache_enabled())
+        return;
+
+    P(pcache.lock);
+    for (e = pcache.head; e != NULL; e = next) {
+        next = e->next;
+        if (!strcmp(e->parent, parent)) {
+            pc_remove(e);
+            pcache.nb_inval++;
+        }
+    }
+    /* the parent of pending lookups is not known yet */
+    g_hash_table_foreach(pcache.pending, pc_pending_invalidate, NULL);
+    V(pcache.lock);
+}
+
+void ListMgr_PathCacheInvalidate(const entry_id_t *p_id)
+{
+    DEF_PK(pk);
+
+    if (!path_cache_enabled())
+        return;
+
+    entry_id2pk(p_id, PTR_PK(pk));
+    path_cache_invalidate(pk);
+}
+
+/** register a lookup of pk in the DB (lock must be held) */
+static struct pc_pending *pc_pending_get(PK_ARG_T pk)
+{
+    struct pc_pending *p;
+
+    p = g_hash_table_lookup(pcache.pending, pk);
+    if (p == NULL) {
+        p = MemAlloc(sizeof(*p));
+        if (p == NULL)
+            return NULL;
+        rh_strncpy(p->pk, pk, sizeof(p->pk));
+        p->users = 0;
+        p->version = 0;
+        g_hash_table_insert(pcache.pending, p->pk, p);
+    }
+    p->users++;
+    return p;
+}
+
+/** a lookup of the DB is over (lock must be held) */
+static void pc_pending_put(struct pc_pending *p)
+{
+    if (--p->users > 0)
+        return;
+    g_hash_table_remove(pcache.pending, p->pk);
+    MemFree(p);
+}
+
+/**
+ * Get the parent and name of a directory from the cache.
+ * On miss, the lookup is registered: the caller must then call pc_insert()
+ * or pc_abort() with *p_pending (NULL if the lookup couldn't be registered).
+ * @param[out] p_version version of the pending lookup (on miss).
+ * @return true on cache hit.
+ */
+static bool pc_lookup(PK_ARG_T pk, PK_ARG_T parent, GString *name,
+                      struct pc_pending **p_pending, unsigned int *p_version)
+{
+    struct pc_entry *e;
+
+    P(pcache.lock);
+    e = g_hash_table_lookup(pcache.table, pk);
+    if (e != NULL && e->expire != 0 && e->expire <= time(NULL)) {
+        pc_remove(e);
+        pcache.nb_expired++;
+        e = NULL;
+    }
+    if (e == NULL) {
+        pcache.nb_miss++;
+        *p_pending = pc_pending_get(pk);
+        if (*p_pending != NULL)
+            *p_version = (*p_pending)->version;
+        V(pcache.lock);
+        return false;
+    }
+    pcache.nb_hit++;
+    lru_unlink(e);
+    lru_push(e);
+    strcpy(parent, e->parent);
+    g_string_assign(name, e->name);
+    V(pcache.lock);
+    return true;
+}
+
+/** a lookup of the DB failed */
+static void pc_abort(struct pc_pending *pending)
+{
+    if (pending == NULL)
+        return;
+
+    P(pcache.lock);
+    pc_pending_put(pending);
+    V(pcache.lock);
+}
+
+/** insert the result of a lookup, unless pk was invalidated since then */
+static void pc_insert(PK_ARG_T pk, PK_ARG_T parent, const char *name,
+                      struct pc_pending *pending, unsigned int version)
+{
+    struct pc_entry *e;
+
+    if (pending == NULL)
+        return;
+
+    P(pcache.lock);
+    if (pending->version != version
+        || g_hash_table_lookup(pcache.table, pk) != NULL)
+        goto out;
+
+    e = MemAlloc(sizeof(*e));
+    if (e == NULL)
+        goto out;
+    e->name = MemAlloc(strlen(name) + 1);
+    if (e->name == NULL) {
+        MemFree(e);
+        goto out;
+    }
+    strcpy(e->name, name);
+    rh_strncpy(e->pk, pk, sizeof(e->pk));
+    rh_strncpy(e->parent, parent, sizeof(e->parent));
+    e->expire = lmgr_config.path_cache_ttl == 0 ? 0 :
+                    time(NULL) + lmgr_config.path_cache_ttl;
+
+    g_hash_table_insert(pcache.table, e->pk, e);
+    lru_push(e);
+    pcache.count++;
+
+    while (pcache.count > pcache.max_count) {
+        pc_remove(pcache.tail);
+        pcache.nb_evict++;
+    }
+ out:
+    pc_pending_put(pending);
+    V(pcache.lock);
+}
+
+/** get the parent and name of an entry from the DB */
+static int pc_get_db(lmgr_t *p_mgr, PK_ARG_T pk, PK_ARG_T parent,
+                     GString *name)
+{
+    result_handle_t result;
+    char *res[2];
+    GString *req;
+    int rc;
+
+    req = g_string_new(NULL);
+    g_string_printf(req, "SELECT parent_id,name FROM " DNAMES_TABLE
+                    " WHERE id=" DPK " LIMIT 1", pk);
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    g_string_free(req, TRUE);
+    if (rc)
+        return rc;
+
+    rc = db_next_record(&p_mgr->conn, &result, res, 2);
+    if (rc == DB_END_OF_LIST) {
+        /* top of the namespace */
+        parent[0] = '\0';
+        g_string_truncate(name, 0);
+        rc = DB_SUCCESS;
+    } else if (rc == DB_SUCCESS) {
+        if (res[0] == NULL || res[1] == NULL) {
+            rc = DB_REQUEST_FAILED;
+        } else {
+            rh_strncpy(parent, res[0], PK_LEN);
+            g_string_assign(name, res[1]);
+        }
+    }
+    db_result_free(&p_mgr->conn, &result);
+    return rc;
+}
+
+/**
+ * Build the path of an entry, in DB format (like this_path()):
+ * <id of the topmost known ancestor>/<name>/.../<name>
+ */
+static int path_cache_build(lmgr_t *p_mgr, PK_ARG_T parent_pk,
+                            const char *name, GString *path)
+{
+    GString *n = g_string_new(NULL);
+    pktype cur, parent;
+    unsigned int depth;
+    struct pc_pending *pending;
+    unsigned int version = 0;
+    int rc = DB_SUCCESS;
+
+    g_string_assign(path, name);
+    rh_strncpy(cur, parent_pk, sizeof(cur));
+
+    for (depth = 0; depth < PC_MAX_DEPTH; depth++) {
+        if (!pc_lookup(cur, parent, n, &pending, &version)) {
+            rc = pc_get_db(p_mgr, cur, parent, n);
+            if (rc) {
+                pc_abort(pending);
+                goto out;
+            }
+            pc_insert(cur, parent, n->str, pending, version);
+        }
+
+        if (parent[0] == '\0')
+            /* cur is not in NAMES */
+            break;
+
+        g_string_prepend_c(path, '/');
+        g_string_prepend(path, n->str);
+        rh_strncpy(cur, parent, sizeof(cur));
+    }
+
+    if (depth == PC_MAX_DEPTH) {
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Path of entry '%s' in parent "
+                   DPK " is too deep: loop in namespace?", name, parent_pk);
+        rc = DB_REQUEST_FAILED;
+        goto out;
+    }
+
+    g_string_prepend_c(path, '/');
+    g_string_prepend(path, cur);
+
+ out:
+    g_string_free(n, TRUE);
+    return rc;
+}
+
+bool path_cache_fix_mask(attr_mask_t *p_mask, attr_mask_t *p_added)
+{
+    memset(p_added, 0, sizeof(*p_added));
+
+    if (!path_cache_enabled()
+        || !attr_mask_test_index(p_mask, ATTR_INDEX_fullpath))
+        return false;
+
+    attr_mask_unset_index(p_mask, ATTR_INDEX_fullpath);
+    if (!attr_mask_test_index(p_mask, ATTR_INDEX_parent_id)) {
+        attr_mask_set_index(p_mask, ATTR_INDEX_parent_id);
+        attr_mask_set_index(p_added, ATTR_INDEX_parent_id);
+    }
+    if (!attr_mask_test_index(p_mask, ATTR_INDEX_name)) {
+        attr_mask_set_index(p_mask, ATTR_INDEX_name);
+        attr_mask_set_index(p_added, ATTR_INDEX_name);
+    }
+    return true;
+}
+
+int path_cache_fullpath(lmgr_t *p_mgr, attr_set_t *p_set,
+                        const attr_mask_t *p_added)
+{
+    DEF_PK(parent_pk);
+    GString *path;
+    int rc = DB_SUCCESS;
+
+    if (ATTR_MASK_TEST(p_set, parent_id) && ATTR_MASK_TEST(p_set, name)) {
+        path = g_string_new(NULL);
+        entry_id2pk(&ATTR(p_set, parent_id), PTR_PK(parent_pk));
+
+        rc = path_cache_build(p_mgr, parent_pk, ATTR(p_set, name), path);
+        if (rc == DB_SUCCESS) {
+            if (path->len < sizeof(ATTR(p_set, fullpath))) {
+                fullpath_db2attr(path->str, ATTR(p_set, fullpath));
+                ATTR_MASK_SET(p_set, fullpath);
+            } else {
+                DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Path of entry '%s' in "
+                           "parent " DPK " is too long", ATTR(p_set, name),
+                           parent_pk);
+            }
+        }
+        g_string_free(path, TRUE);
+    }
+
+    p_set->attr_mask = attr_mask_and_not(&p_set->attr_mask, p_added);
+    return rc;
+}
+
+void ListMgr_PathCacheDumpStats(void)
+{
+    uint64_t total;
+
+    if (!path_cache_enabled())
+        return;
+
+    P(pcache.lock);
+    total = pcache.nb_hit + pcache.nb_miss;
+    DisplayLog(LVL_MAJOR, "STATS", "==== Path cache stats ====");
+    DisplayLog(LVL_MAJOR, "STATS", "entries: %u/%u", pcache.count,
+               pcache.max_count);
+    DisplayLog(LVL_MAJOR, "STATS", "hits: %"PRIu64", misses: %"PRIu64
+               " (hit ratio: %.2f%%)", pcache.nb_hit, pcache.nb_miss,
+               total ? 100.0 * pcache.nb_hit / total : 0.0);
+    DisplayLog(LVL_MAJOR, "STATS", "invalidations: %"PRIu64", evictions: %"
+               PRIu64", expired: %"PRIu64, pcache.nb_inval, pcache.nb_evict,
+               pcache.nb_expired);
+    V(pcache.lock);
+}
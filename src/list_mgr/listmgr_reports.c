@@ -44,6 +44,9 @@ typedef struct lmgr_report_t {
     unsigned int profile_attr;  /* profile attr (if profile_count > 0) */
 
     char **str_tab;
+
+    /** report built from a snapshot file */
+    struct snap_report *snap;
 } lmgr_report_t;
 
 /* Return field string */
@@ -329,6 +332,18 @@ struct lmgr_report_t *ListMgr_Report(lmgr_t *p_mgr,
         return NULL;
 
     p_report->p_mgr = p_mgr;
+    p_report->snap = NULL;
+
+    if (p_mgr->snapshot != NULL) {
+        p_report->snap = listmgr_snapshot_report(p_mgr->snapshot,
+                                                 report_desc_array,
+                                                 report_descr_count,
+                                                 profile_descr, p_filter,
+                                                 p_opt);
+        if (p_report->snap == NULL)
+            goto free_report;
+        return p_report;
+    }
 
     p_report->result = (struct result *)MemCalloc(report_descr_count
                                                   + profile_len + ratio,
@@ -650,6 +665,10 @@ int ListMgr_GetNextReportItem(struct lmgr_report_t *p_iter,
     int rc;
     unsigned int i;
 
+    if (p_iter->snap != NULL)
+        return listmgr_snapshot_next(p_iter->snap, p_value, p_value_count,
+                                     p_profile);
+
     if (*p_value_count <
         p_iter->result_count - p_iter->profile_count - p_iter->ratio_count)
         return DB_BUFFER_TOO_SMALL;
@@ -720,6 +739,12 @@ int ListMgr_GetNextReportItem(struct lmgr_report_t *p_iter,
 
 void ListMgr_CloseReport(struct lmgr_report_t *p_iter)
 {
+    if (p_iter->snap != NULL) {
+        listmgr_snapshot_report_free(p_iter->snap);
+        MemFree(p_iter);
+        return;
+    }
+
     db_result_free(&p_iter->p_mgr->conn, &p_iter->select_result);
 
     if (p_iter->str_tab != NULL)
@@ -0,0 +1,2254 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Columnar snapshots of the catalog.
+ *
+ * ListMgr_ExportSnapshot() streams the ENTRIES table (joined with ANNEX_INFO)
+ * and the NAMES table to a file, by row groups of SNAP_RG_ROWS rows.
+ * In a row group, each column is stored as a separate zlib-compressed chunk,
+ * with the min and max values of numeric columns:
+ *
+ *  header:  magic, version, byte order, creation time, filesystem path
+ *  table:   tag, name, columns (name, type)
+ *           row group: row count, chunks (header, compressed data)
+ *           ...
+ *           end of table (row count = 0)
+ *  ...
+ *  end tag
+ *
+ * The raw content of a numeric chunk is an array of 64 bits values followed
+ * by an array of validity bytes (0 for NULL). A text chunk is the array of
+ * validity bytes followed by the NUL-terminated strings of non-NULL rows.
+ *
+ * Reports on a snapshot (see ListMgr_OpenSnapshot) only read the columns
+ * they need, skip the row groups that can't match the filter according to
+ * chunk stats, and process row groups in parallel.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "Memory.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "global_config.h"
+#include <zlib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#define SNAP_MAGIC      "RBHSNAP"
+#define SNAP_VERSION    1
+/** snapshots are written in host byte order */
+#define SNAP_BYTE_ORDER 0x01020304
+#define SNAP_TAG_TABLE  0x5441424c  /* "TABL" */
+#define SNAP_TAG_END    0x454e4446  /* "ENDF" */
+
+#define MAX_DB_FIELDS 64
+
+/** max number of rows in a row group */
+#define SNAP_RG_ROWS        65536
+/** max number of threads for processing reports */
+#define SNAP_MAX_THREADS    16
+
+/** how column values are stored */
+typedef enum {
+    SK_TEXT,    /**< NUL-terminated strings */
+    SK_INT,     /**< int64_t */
+    SK_UINT,    /**< uint64_t */
+} snap_kind_e;
+
+typedef union {
+    int64_t  i;
+    uint64_t u;
+} snap_num_t;
+
+struct snap_file_hdr {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    byte_order;
+    uint64_t    ctime;
+};
+
+/** column chunk header (followed by z_len bytes of compressed data) */
+struct snap_chunk_hdr {
+    uint32_t    raw_len;
+    uint32_t    z_len;
+    uint32_t    null_count;
+    uint32_t    flags;
+    snap_num_t  min;
+    snap_num_t  max;
+};
+#define SNAP_CHUNK_STATS    0x1 /**< min and max are set */
+
+struct snap_coldesc {
+    char        *name;
+    db_type_e    type;
+    snap_kind_e  kind;
+};
+
+static snap_kind_e snap_kind(db_type_e type)
+{
+    switch (type) {
+    case DB_INT:
+    case DB_SHORT:
+    case DB_BIGINT:
+        return SK_INT;
+    case DB_UINT:
+    case DB_USHORT:
+    case DB_BIGUINT:
+    case DB_BOOL:
+        return SK_UINT;
+    default:
+        return SK_TEXT;
+    }
+}
+
+/** type of a field in snapshots (uid/gid format is resolved) */
+static db_type_e snap_type(db_type_e type)
+{
+    if (type == DB_UIDGID)
+        return global_config.uid_gid_as_numbers ? DB_INT : DB_TEXT;
+    return type;
+}
+
+static void dbval2num(db_type_e type, const db_type_u *v, snap_num_t *n)
+{
+    switch (type) {
+    case DB_INT:
+    case DB_UIDGID:
+        n->i = v->val_int;
+        break;
+    case DB_SHORT:
+        n->i = v->val_short;
+        break;
+    case DB_BIGINT:
+        n->i = v->val_bigint;
+        break;
+    case DB_UINT:
+        n->u = v->val_uint;
+        break;
+    case DB_USHORT:
+        n->u = v->val_ushort;
+        break;
+    case DB_BIGUINT:
+        n->u = v->val_biguint;
+        break;
+    case DB_BOOL:
+        n->u = v->val_bool;
+        break;
+    default:
+        n->u = 0;
+    }
+}
+
+static void num2dbval(db_type_e type, snap_num_t n, db_type_u *v)
+{
+    switch (type) {
+    case DB_INT:
+    case DB_UIDGID:
+        v->val_int = n.i;
+        break;
+    case DB_SHORT:
+        v->val_short = n.i;
+        break;
+    case DB_BIGINT:
+        v->val_bigint = n.i;
+        break;
+    case DB_UINT:
+        v->val_uint = n.u;
+        break;
+    case DB_USHORT:
+        v->val_ushort = n.u;
+        break;
+    case DB_BIGUINT:
+        v->val_biguint = n.u;
+        break;
+    case DB_BOOL:
+        v->val_bool = (n.u != 0);
+        break;
+    default:
+        v->val_biguint = n.u;
+    }
+}
+
+static int num_cmp(snap_kind_e kind, snap_num_t a, snap_num_t b)
+{
+    if (kind == SK_INT)
+        return (a.i > b.i) - (a.i < b.i);
+    return (a.u > b.u) - (a.u < b.u);
+}
+
+/* -------------------- Snapshot export ---------------- */
+
+/** column being exported */
+struct snap_wcol {
+    struct snap_coldesc     desc;
+    unsigned char          *valid;
+    uint64_t               *num;    /**< numeric columns */
+    GString                *txt;    /**< text columns */
+    struct snap_chunk_hdr   hdr;
+};
+
+/** table being exported */
+struct snap_wtable {
+    const char         *name;
+    GString            *select;     /**< SELECT <key>,<columns> FROM ... */
+    const char         *key;        /**< unique key to iterate on */
+    unsigned int        col_count;
+    struct snap_wcol   *cols;
+};
+
+struct snap_writer {
+    FILE               *f;
+    GString            *raw;
+    unsigned char      *zbuf;
+    uLong               z_size;
+};
+
+static int snap_write(FILE *f, const void *buf, size_t len)
+{
+    if (len > 0 && fwrite(buf, len, 1, f) != 1) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to write snapshot: %s",
+                   strerror(errno));
+        return DB_IO_ERROR;
+    }
+    return DB_SUCCESS;
+}
+
+static int snap_write_u32(FILE *f, uint32_t val)
+{
+    return snap_write(f, &val, sizeof(val));
+}
+
+static int snap_write_str(FILE *f, const char *str)
+{
+    uint16_t len = strlen(str);
+    int rc;
+
+    rc = snap_write(f, &len, sizeof(len));
+    if (rc)
+        return rc;
+    return snap_write(f, str, len);
+}
+
+static void snap_wtable_init(struct snap_wtable *t, const char *name,
+                             const char *key, unsigned int max_cols)
+{
+    t->name = name;
+    t->key = key;
+    t->select = g_string_new("SELECT ");
+    g_string_append(t->select, key);
+    t->col_count = 0;
+    t->cols = MemCalloc(max_cols, sizeof(*t->cols));
+}
+
+static void snap_wtable_add(struct snap_wtable *t, const char *table,
+                            const char *name, db_type_e type)
+{
+    struct snap_wcol *c = &t->cols[t->col_count++];
+
+    g_string_append_printf(t->select, ",%s.%s", table, name);
+
+    c->desc.name = (char *)name;
+    c->desc.type = snap_type(type);
+    c->desc.kind = snap_kind(c->desc.type);
+    c->valid = MemAlloc(SNAP_RG_ROWS);
+    if (c->desc.kind == SK_TEXT)
+        c->txt = g_string_new(NULL);
+    else
+        c->num = MemAlloc(SNAP_RG_ROWS * sizeof(uint64_t));
+}
+
+static void snap_wtable_free(struct snap_wtable *t)
+{
+    unsigned int i;
+
+    if (t->cols == NULL)
+        return;
+
+    for (i = 0; i < t->col_count; i++) {
+        MemFree(t->cols[i].valid);
+        if (t->cols[i].txt != NULL)
+            g_string_free(t->cols[i].txt, TRUE);
+        if (t->cols[i].num != NULL)
+            MemFree(t->cols[i].num);
+    }
+    MemFree(t->cols);
+    g_string_free(t->select, TRUE);
+}
+
+/** append a value (as returned by the DB) to a column */
+static void snap_wcol_append(struct snap_wcol *c, unsigned int row,
+                             const char *val)
+{
+    snap_num_t n = { .u = 0 };
+    bool first = !(c->hdr.flags & SNAP_CHUNK_STATS);
+
+    if (val == NULL) {
+        c->valid[row] = 0;
+        if (c->num != NULL)
+            c->num[row] = 0;
+        c->hdr.null_count++;
+        return;
+    }
+    c->valid[row] = 1;
+
+    switch (c->desc.kind) {
+    case SK_TEXT:
+        g_string_append_len(c->txt, val, strlen(val) + 1);
+        return;
+    case SK_INT:
+        n.i = strtoll(val, NULL, 10);
+        break;
+    case SK_UINT:
+        n.u = strtoull(val, NULL, 10);
+        break;
+    }
+    c->num[row] = n.u;
+
+    if (first || num_cmp(c->desc.kind, n, c->hdr.min) < 0)
+        c->hdr.min = n;
+    if (first || num_cmp(c->desc.kind, n, c->hdr.max) > 0)
+        c->hdr.max = n;
+    c->hdr.flags |= SNAP_CHUNK_STATS;
+}
+
+/** compress and write the chunk of a column, then reset it */
+static int snap_write_chunk(struct snap_writer *w, struct snap_wcol *c,
+                            unsigned int nrows)
+{
+    uLong z_len;
+    int rc;
+
+    g_string_truncate(w->raw, 0);
+    if (c->desc.kind == SK_TEXT) {
+        g_string_append_len(w->raw, (char *)c->valid, nrows);
+        g_string_append_len(w->raw, c->txt->str, c->txt->len);
+    } else {
+        g_string_append_len(w->raw, (char *)c->num, nrows * sizeof(uint64_t));
+        g_string_append_len(w->raw, (char *)c->valid, nrows);
+    }
+
+    z_len = compressBound(w->raw->len);
+    if (z_len > w->z_size) {
+        MemFree(w->zbuf);
+        w->zbuf = MemAlloc(z_len);
+        if (w->zbuf == NULL) {
+            w->z_size = 0;
+            return DB_NO_MEMORY;
+        }
+        w->z_size = z_len;
+    }
+
+    rc = compress2(w->zbuf, &z_len, (Bytef *)w->raw->str, w->raw->len,
+                   Z_BEST_SPEED);
+    if (rc != Z_OK) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to compress column '%s': "
+                   "zlib error %d", c->desc.name, rc);
+        return DB_IO_ERROR;
+    }
+
+    c->hdr.raw_len = w->raw->len;
+    c->hdr.z_len = z_len;
+
+    rc = snap_write(w->f, &c->hdr, sizeof(c->hdr));
+    if (rc == DB_SUCCESS)
+        rc = snap_write(w->f, w->zbuf, z_len);
+
+    memset(&c->hdr, 0, sizeof(c->hdr));
+    if (c->txt != NULL)
+        g_string_truncate(c->txt, 0);
+    return rc;
+}
+
+/** export a table, by chunks of SNAP_RG_ROWS rows */
+static int snap_export_table(lmgr_t *p_mgr, struct snap_writer *w,
+                             struct snap_wtable *t, uint64_t *p_count)
+{
+    result_handle_t result;
+    char *res[MAX_DB_FIELDS + 1];
+    pktype last_key = "";
+    unsigned int nrows, i;
+    GString *req;
+    int rc;
+
+    rc = snap_write_u32(w->f, SNAP_TAG_TABLE);
+    if (rc == DB_SUCCESS)
+        rc = snap_write_str(w->f, t->name);
+    if (rc == DB_SUCCESS)
+        rc = snap_write_u32(w->f, t->col_count);
+    for (i = 0; i < t->col_count && rc == DB_SUCCESS; i++) {
+        rc = snap_write_str(w->f, t->cols[i].desc.name);
+        if (rc == DB_SUCCESS)
+            rc = snap_write_u32(w->f, t->cols[i].desc.type);
+    }
+    if (rc)
+        return rc;
+
+    *p_count = 0;
+    req = g_string_new(NULL);
+
+    do {
+        g_string_assign(req, t->select->str);
+        if (*p_count > 0)
+            g_string_append_printf(req, " WHERE %s>"DPK, t->key, last_key);
+        g_string_append_printf(req, " ORDER BY %s LIMIT %u", t->key,
+                               SNAP_RG_ROWS);
+
+ retry:
+        rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            break;
+
+        nrows = 0;
+        while ((rc = db_next_record(&p_mgr->conn, &result, res,
+                                    t->col_count + 1)) == DB_SUCCESS) {
+            if (res[0] == NULL) {
+                rc = DB_REQUEST_FAILED;
+                break;
+            }
+            for (i = 0; i < t->col_count; i++)
+                snap_wcol_append(&t->cols[i], nrows, res[i + 1]);
+            rh_strncpy(last_key, res[0], sizeof(last_key));
+            nrows++;
+        }
+        db_result_free(&p_mgr->conn, &result);
+
+        if (rc != DB_END_OF_LIST)
+            break;
+        rc = DB_SUCCESS;
+
+        if (nrows == 0)
+            break;
+
+        rc = snap_write_u32(w->f, nrows);
+        for (i = 0; i < t->col_count && rc == DB_SUCCESS; i++)
+            rc = snap_write_chunk(w, &t->cols[i], nrows);
+        if (rc)
+            break;
+
+        *p_count += nrows;
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG, "%s: %"PRIu64" rows exported",
+                   t->name, *p_count);
+
+    } while (nrows == SNAP_RG_ROWS);
+
+    g_string_free(req, TRUE);
+
+    /* end of table */
+    if (rc == DB_SUCCESS)
+        rc = snap_write_u32(w->f, 0);
+    return rc;
+}
+
+int ListMgr_ExportSnapshot(lmgr_t *p_mgr, const char *file, uint64_t *p_count)
+{
+    struct snap_writer w = { 0 };
+    struct snap_wtable entries = { 0 };
+    struct snap_wtable names = { 0 };
+    struct snap_file_hdr hdr = { { 0 } };
+    char tmp[RBH_PATH_MAX + 8];
+    uint64_t name_count = 0;
+    unsigned int annex_count = 0;
+    int i, cookie, rc;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+    w.f = fopen(tmp, "w");
+    if (w.f == NULL) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to create %s: %s", tmp,
+                   strerror(errno));
+        return DB_IO_ERROR;
+    }
+    w.raw = g_string_new(NULL);
+
+    /* ENTRIES and ANNEX_INFO fields, one row per entry */
+    snap_wtable_init(&entries, MAIN_TABLE, MAIN_TABLE ".id", MAX_DB_FIELDS);
+    snap_wtable_add(&entries, MAIN_TABLE, "id", PK_DB_TYPE);
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (is_main_field(i) && entries.col_count < MAX_DB_FIELDS)
+            snap_wtable_add(&entries, MAIN_TABLE, field_name(i),
+                            field_type(i));
+    }
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (is_annex_field(i) && entries.col_count < MAX_DB_FIELDS) {
+            snap_wtable_add(&entries, ANNEX_TABLE, field_name(i),
+                            field_type(i));
+            annex_count++;
+        }
+    }
+    g_string_append(entries.select, " FROM " MAIN_TABLE);
+    if (annex_count > 0)
+        g_string_append(entries.select, " LEFT JOIN " ANNEX_TABLE
+                        " ON " MAIN_TABLE ".id=" ANNEX_TABLE ".id");
+
+    /* NAMES, one row per hardlink */
+    snap_wtable_init(&names, DNAMES_TABLE, "pkn", MAX_DB_FIELDS);
+    snap_wtable_add(&names, DNAMES_TABLE, "id", PK_DB_TYPE);
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (is_names_field(i) && !is_funcattr(i)
+            && names.col_count < MAX_DB_FIELDS)
+            snap_wtable_add(&names, DNAMES_TABLE, field_name(i),
+                            field_type(i));
+    }
+    g_string_append(names.select, " FROM " DNAMES_TABLE);
+
+    memcpy(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+    hdr.version = SNAP_VERSION;
+    hdr.byte_order = SNAP_BYTE_ORDER;
+    hdr.ctime = time(NULL);
+
+    rc = snap_write(w.f, &hdr, sizeof(hdr));
+    if (rc == DB_SUCCESS)
+        rc = snap_write_str(w.f, global_config.fs_path);
+    if (rc == DB_SUCCESS)
+        rc = snap_export_table(p_mgr, &w, &entries, p_count);
+    if (rc == DB_SUCCESS)
+        rc = snap_export_table(p_mgr, &w, &names, &name_count);
+    if (rc == DB_SUCCESS)
+        rc = snap_write_u32(w.f, SNAP_TAG_END);
+
+    if (fclose(w.f) != 0 && rc == DB_SUCCESS) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to write %s: %s", tmp,
+                   strerror(errno));
+        rc = DB_IO_ERROR;
+    }
+
+    if (rc == DB_SUCCESS && rename(tmp, file) != 0) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to rename %s to %s: %s",
+                   tmp, file, strerror(errno));
+        rc = DB_IO_ERROR;
+    }
+    if (rc)
+        unlink(tmp);
+    else
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Snapshot %s: %"PRIu64" entries, "
+                   "%"PRIu64" names", file, *p_count, name_count);
+
+    snap_wtable_free(&entries);
+    snap_wtable_free(&names);
+    g_string_free(w.raw, TRUE);
+    MemFree(w.zbuf);
+    return rc;
+}
+
+/* -------------------- Snapshot loading ---------------- */
+
+struct snap_chunk {
+    off_t                   offset; /**< offset of compressed data */
+    struct snap_chunk_hdr   hdr;
+};
+
+struct snap_rowgroup {
+    unsigned int        nrows;
+    struct snap_chunk  *chunks;     /**< one per column */
+};
+
+struct lmgr_snapshot {
+    int                     fd;
+    time_t                  ctime;
+    /* ENTRIES table */
+    unsigned int            col_count;
+    struct snap_coldesc    *cols;
+    unsigned int            rg_count;
+    struct snap_rowgroup   *rgs;
+    uint64_t                row_count;
+};
+
+static int snap_read(FILE *f, void *buf, size_t len)
+{
+    if (len > 0 && fread(buf, len, 1, f) != 1) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to read snapshot: %s",
+                   ferror(f) ? strerror(errno) : "unexpected end of file");
+        return DB_IO_ERROR;
+    }
+    return DB_SUCCESS;
+}
+
+static int snap_read_str(FILE *f, char **str)
+{
+    uint16_t len;
+    int rc;
+
+    rc = snap_read(f, &len, sizeof(len));
+    if (rc)
+        return rc;
+
+    *str = MemAlloc(len + 1);
+    if (*str == NULL)
+        return DB_NO_MEMORY;
+
+    rc = snap_read(f, *str, len);
+    if (rc) {
+        MemFree(*str);
+        *str = NULL;
+        return rc;
+    }
+    (*str)[len] = '\0';
+    return DB_SUCCESS;
+}
+
+static void snap_free_cols(struct snap_coldesc *cols, unsigned int count)
+{
+    unsigned int i;
+
+    if (cols == NULL)
+        return;
+    for (i = 0; i < count; i++)
+        MemFree(cols[i].name);
+    MemFree(cols);
+}
+
+static void snap_free(struct lmgr_snapshot *snap)
+{
+    unsigned int i;
+
+    for (i = 0; i < snap->rg_count; i++)
+        MemFree(snap->rgs[i].chunks);
+    MemFree(snap->rgs);
+    snap_free_cols(snap->cols, snap->col_count);
+    if (snap->fd >= 0)
+        close(snap->fd);
+    MemFree(snap);
+}
+
+/** read a table description and index its row groups */
+static int snap_load_table(FILE *f, struct lmgr_snapshot *snap)
+{
+    struct snap_coldesc *cols = NULL;
+    struct snap_chunk *chunks;
+    uint32_t col_count, nrows, type;
+    char *name = NULL;
+    bool keep;
+    unsigned int i;
+    int rc;
+
+    rc = snap_read_str(f, &name);
+    if (rc)
+        return rc;
+    rc = snap_read(f, &col_count, sizeof(col_count));
+    if (rc)
+        goto out;
+    if (col_count == 0 || col_count > MAX_DB_FIELDS) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid column count %u in "
+                   "snapshot table %s", col_count, name);
+        rc = DB_INVALID_ARG;
+        goto out;
+    }
+
+    cols = MemCalloc(col_count, sizeof(*cols));
+    if (cols == NULL) {
+        rc = DB_NO_MEMORY;
+        goto out;
+    }
+    for (i = 0; i < col_count; i++) {
+        rc = snap_read_str(f, &cols[i].name);
+        if (rc == DB_SUCCESS)
+            rc = snap_read(f, &type, sizeof(type));
+        if (rc)
+            goto out;
+        cols[i].type = type;
+        cols[i].kind = snap_kind(type);
+    }
+
+    /* only ENTRIES is used for reports */
+    keep = !strcmp(name, MAIN_TABLE) && snap->cols == NULL;
+
+    while ((rc = snap_read(f, &nrows, sizeof(nrows))) == DB_SUCCESS
+           && nrows != 0) {
+        if (nrows > SNAP_RG_ROWS) {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid row count %u in "
+                       "snapshot table %s", nrows, name);
+            rc = DB_INVALID_ARG;
+            goto out;
+        }
+
+        chunks = MemCalloc(col_count, sizeof(*chunks));
+        if (chunks == NULL) {
+            rc = DB_NO_MEMORY;
+            goto out;
+        }
+        for (i = 0; i < col_count; i++) {
+            rc = snap_read(f, &chunks[i].hdr, sizeof(chunks[i].hdr));
+            if (rc)
+                break;
+            chunks[i].offset = ftello(f);
+            if (fseeko(f, chunks[i].hdr.z_len, SEEK_CUR) != 0) {
+                rc = DB_IO_ERROR;
+                break;
+            }
+        }
+        if (rc || !keep) {
+            MemFree(chunks);
+            if (rc)
+                goto out;
+            continue;
+        }
+
+        if ((snap->rg_count & (snap->rg_count - 1)) == 0) {
+            /* grow the array for powers of 2 */
+            struct snap_rowgroup *rgs;
+
+            rgs = MemRealloc(snap->rgs, MAX2(2 * snap->rg_count, 1)
+                                        * sizeof(*rgs));
+            if (rgs == NULL) {
+                MemFree(chunks);
+                rc = DB_NO_MEMORY;
+                goto out;
+            }
+            snap->rgs = rgs;
+        }
+        snap->rgs[snap->rg_count].nrows = nrows;
+        snap->rgs[snap->rg_count].chunks = chunks;
+        snap->rg_count++;
+        snap->row_count += nrows;
+    }
+
+    if (rc == DB_SUCCESS && keep) {
+        snap->cols = cols;
+        snap->col_count = col_count;
+        cols = NULL;
+    }
+
+ out:
+    snap_free_cols(cols, col_count);
+    MemFree(name);
+    return rc;
+}
+
+int ListMgr_OpenSnapshot(lmgr_t *p_mgr, const char *file, time_t *p_ctime)
+{
+    struct lmgr_snapshot *snap;
+    struct snap_file_hdr hdr;
+    char *fs_path = NULL;
+    uint32_t tag;
+    FILE *f;
+    int rc;
+
+    f = fopen(file, "r");
+    if (f == NULL) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to open %s: %s", file,
+                   strerror(errno));
+        return DB_IO_ERROR;
+    }
+
+    snap = MemCalloc(1, sizeof(*snap));
+    if (snap == NULL) {
+        fclose(f);
+        return DB_NO_MEMORY;
+    }
+    snap->fd = -1;
+
+    rc = snap_read(f, &hdr, sizeof(hdr));
+    if (rc)
+        goto out;
+    if (memcmp(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) != 0
+        || hdr.byte_order != SNAP_BYTE_ORDER) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "%s is not a snapshot file, or it "
+                   "was created on a different architecture", file);
+        rc = DB_INVALID_ARG;
+        goto out;
+    }
+    if (hdr.version != SNAP_VERSION) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Unsupported snapshot version %u "
+                   "(expected %u)", hdr.version, SNAP_VERSION);
+        rc = DB_NOT_SUPPORTED;
+        goto out;
+    }
+    snap->ctime = hdr.ctime;
+
+    rc = snap_read_str(f, &fs_path);
+    if (rc)
+        goto out;
+    if (strcmp(fs_path, global_config.fs_path))
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "WARNING: snapshot %s was "
+                   "created for filesystem %s (current: %s)", file, fs_path,
+                   global_config.fs_path);
+
+    while ((rc = snap_read(f, &tag, sizeof(tag))) == DB_SUCCESS
+           && tag == SNAP_TAG_TABLE) {
+        rc = snap_load_table(f, snap);
+        if (rc)
+            goto out;
+    }
+    if (rc)
+        goto out;
+
+    if (tag != SNAP_TAG_END || snap->cols == NULL) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid or truncated snapshot %s",
+                   file);
+        rc = DB_INVALID_ARG;
+        goto out;
+    }
+
+    snap->fd = open(file, O_RDONLY);
+    if (snap->fd < 0) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to open %s: %s", file,
+                   strerror(errno));
+        rc = DB_IO_ERROR;
+        goto out;
+    }
+
+    DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Snapshot %s: %"PRIu64" entries, "
+               "%u columns, %u row groups", file, snap->row_count,
+               snap->col_count, snap->rg_count);
+
+    if (p_ctime != NULL)
+        *p_ctime = snap->ctime;
+
+    if (p_mgr->snapshot != NULL)
+        snap_free(p_mgr->snapshot);
+    p_mgr->snapshot = snap;
+
+ out:
+    fclose(f);
+    MemFree(fs_path);
+    if (rc)
+        snap_free(snap);
+    return rc;
+}
+
+void ListMgr_CloseSnapshot(lmgr_t *p_mgr)
+{
+    if (p_mgr->snapshot == NULL)
+        return;
+    snap_free(p_mgr->snapshot);
+    p_mgr->snapshot = NULL;
+}
+
+/* -------------------- Reports on snapshots ---------------- */
+
+/** filter condition on a column */
+struct snap_cond {
+    unsigned int        col;
+    snap_kind_e         kind;
+    filter_comparator_t compar;
+    bool                negate;
+    bool                allow_null;
+    snap_num_t          num;
+    const char         *str;        /**< string value or LIKE pattern */
+    char               *str_alloc;
+    unsigned int        list_count; /**< IN, NOTIN */
+    snap_num_t         *num_list;
+    const char        **str_list;
+};
+
+/** report field */
+struct snap_field {
+    report_type_t       type;
+    int                 col;        /**< -1 for COUNT */
+    snap_kind_e         kind;       /**< kind of the column */
+    db_type_e           out_type;
+    int                 flags;
+    sort_order_t        sort;
+
+    /* condition on the aggregated value (HAVING) */
+    bool                having;
+    filter_comparator_t compar;
+    db_type_u           value;
+};
+
+/** aggregated values of a field */
+struct snap_acc {
+    uint64_t            nvals;      /**< non-NULL values */
+    snap_num_t          sum;
+    snap_num_t          min;
+    snap_num_t          max;
+    GHashTable         *distinct;
+};
+
+struct snap_group {
+    char               *key;        /**< encoded GROUP BY values */
+    unsigned int        key_len;
+    uint64_t            count;
+    uint64_t            prof[SZ_PROFIL_COUNT];
+    double              ratio;
+    db_value_t         *values;     /**< result values */
+    struct snap_acc     acc[];
+};
+
+struct snap_report {
+    struct lmgr_snapshot   *snap;
+
+    unsigned int            field_count;
+    struct snap_field      *fields;
+    unsigned int            cond_count;
+    struct snap_cond       *conds;
+    bool                    grouped;
+    bool                    profile;
+    profile_field_descr_t   prof_descr;
+    int                     size_col;
+    unsigned char          *needed;     /**< columns to be read */
+
+    /* processing */
+    unsigned int            next_rg;
+    unsigned int            skipped_rg;
+    int                     rc;
+    GHashTable             *groups;
+
+    /* results */
+    struct snap_group     **results;
+    unsigned int            result_count;
+    unsigned int            next;
+};
+
+/** column data of the current row group */
+struct snap_colbuf {
+    unsigned char          *raw;
+    size_t                  raw_size;
+    unsigned char          *zbuf;
+    size_t                  z_size;
+    const unsigned char    *valid;
+    const uint64_t         *u;
+    const int64_t          *i;
+    const char            **str;
+};
+
+struct snap_worker {
+    struct snap_report     *r;
+    pthread_t               thread;
+    GHashTable             *groups;
+    struct snap_colbuf     *cols;
+    unsigned char          *sel;
+    unsigned char          *match;
+    GString                *key;
+};
+
+static int snap_find_col(const struct lmgr_snapshot *snap,
+                         unsigned int attr_index)
+{
+    const char *name = field_name(attr_index);
+    unsigned int i;
+
+    if (name == NULL)
+        return -1;
+
+    for (i = 0; i < snap->col_count; i++)
+        if (!strcmp(snap->cols[i].name, name))
+            return i;
+    return -1;
+}
+
+/** get the column of an attribute, check its type is compatible */
+static int snap_attr_col(struct snap_report *r, unsigned int attr_index)
+{
+    const struct lmgr_snapshot *snap = r->snap;
+    int col = snap_find_col(snap, attr_index);
+
+    if (col < 0) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Attribute '%s' is not available "
+                   "in snapshots", field_name(attr_index) ?: "?");
+        return -DB_NOT_SUPPORTED;
+    }
+    if (snap->cols[col].kind != snap_kind(snap_type(field_type(attr_index)))) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Type of attribute '%s' in the "
+                   "snapshot doesn't match current configuration",
+                   snap->cols[col].name);
+        return -DB_INVALID_ARG;
+    }
+    r->needed[col] = 1;
+    return col;
+}
+
+static inline bool chr_eq(char c1, char c2, bool icase)
+{
+    if (icase)
+        return tolower((unsigned char)c1) == tolower((unsigned char)c2);
+    return c1 == c2;
+}
+
+/** match a string against a SQL LIKE pattern ('%' and '_' wildcards) */
+static bool like_match(const char *s, const char *p, bool icase)
+{
+    const char *star = NULL;
+    const char *s_star = NULL;
+
+    while (*s != '\0') {
+        if (*p == '%') {
+            star = ++p;
+            s_star = s;
+        } else if (*p != '\0' && (*p == '_' || chr_eq(*p, *s, icase))) {
+            p++;
+            s++;
+        } else if (star != NULL) {
+            /* retry from the last '%', consuming one more char */
+            p = star;
+            s = ++s_star;
+        } else {
+            return false;
+        }
+    }
+    while (*p == '%')
+        p++;
+    return *p == '\0';
+}
+
+static int snap_add_cond(struct snap_report *r, unsigned int attr_index,
+                         filter_comparator_t compar, const filter_value_t *fv,
+                         int flags)
+{
+    struct snap_cond *c = &r->conds[r->cond_count];
+    db_type_e type = field_type(attr_index);
+    unsigned int i;
+    int col;
+
+    if (flags & ~(FILTER_FLAG_NOT | FILTER_FLAG_ALLOW_NULL
+                  | FILTER_FLAG_ALLOC_STR | FILTER_FLAG_ALLOC_LIST)) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Complex filter expressions are "
+                   "not supported on snapshots");
+        return DB_NOT_SUPPORTED;
+    }
+
+    col = snap_attr_col(r, attr_index);
+    if (col < 0)
+        return -col;
+
+    memset(c, 0, sizeof(*c));
+    c->col = col;
+    c->kind = r->snap->cols[col].kind;
+    c->negate = !!(flags & FILTER_FLAG_NOT);
+    c->allow_null = !!(flags & FILTER_FLAG_ALLOW_NULL);
+
+    /* always match '%+<item>+%' in lists (see filter2str) */
+    if (is_sepdlist(attr_index)) {
+        if (compar == EQUAL)
+            compar = LIKE;
+        else if (compar == NOTEQUAL)
+            compar = UNLIKE;
+    }
+    c->compar = compar;
+
+    switch (compar) {
+    case ISNULL:
+    case NOTNULL:
+        break;
+
+    case LIKE:
+    case UNLIKE:
+    case ILIKE:
+    case IUNLIKE:
+        if (c->kind != SK_TEXT)
+            goto not_supp;
+        if (is_sepdlist(attr_index)) {
+            c->str_alloc = g_strdup_printf("%%" LIST_SEP_STR "%s"
+                                           LIST_SEP_STR "%%",
+                                           fv->value.val_str);
+            c->str = c->str_alloc;
+        } else {
+            c->str = fv->value.val_str;
+        }
+        break;
+
+    case IN:
+    case NOTIN:
+        c->list_count = fv->list.count;
+        if (c->kind == SK_TEXT) {
+            c->str_list = MemCalloc(MAX2(c->list_count, 1), sizeof(char *));
+            for (i = 0; i < c->list_count; i++)
+                c->str_list[i] = fv->list.values[i].val_str;
+        } else {
+            c->num_list = MemCalloc(MAX2(c->list_count, 1),
+                                    sizeof(snap_num_t));
+            for (i = 0; i < c->list_count; i++)
+                dbval2num(type, &fv->list.values[i], &c->num_list[i]);
+        }
+        break;
+
+    case EQUAL:
+    case NOTEQUAL:
+    case LESSTHAN:
+    case MORETHAN:
+    case LESSTHAN_STRICT:
+    case MORETHAN_STRICT:
+        if (c->kind == SK_TEXT)
+            c->str = fv->value.val_str;
+        else
+            dbval2num(type, &fv->value, &c->num);
+        break;
+
+    default:
+        goto not_supp;
+    }
+
+    r->cond_count++;
+    return DB_SUCCESS;
+
+ not_supp:
+    DisplayLog(LVL_CRIT, LISTMGR_TAG, "Filter '%s%s' on attribute '%s' is not "
+               "supported on snapshots", compar2str(compar),
+               c->kind == SK_TEXT ? "" : "(numeric)", field_name(attr_index));
+    return DB_NOT_SUPPORTED;
+}
+
+/** can the condition match some rows of a chunk, according to its stats? */
+static bool chunk_may_match(const struct snap_cond *c,
+                            const struct snap_chunk_hdr *h, unsigned int nrows)
+{
+    snap_num_t min = h->min, max = h->max;
+    unsigned int i;
+
+    if (c->compar == ISNULL)
+        return c->negate ? h->null_count < nrows : h->null_count > 0;
+    if (c->compar == NOTNULL)
+        return c->negate ? h->null_count > 0 : h->null_count < nrows;
+
+    if (c->kind == SK_TEXT || c->negate)
+        return true;
+    if (c->allow_null && h->null_count > 0)
+        return true;
+    if (!(h->flags & SNAP_CHUNK_STATS))
+        /* all values are NULL */
+        return false;
+
+    switch (c->compar) {
+    case EQUAL:
+        return num_cmp(c->kind, min, c->num) <= 0
+            && num_cmp(c->kind, c->num, max) <= 0;
+    case NOTEQUAL:
+        return num_cmp(c->kind, min, c->num) != 0
+            || num_cmp(c->kind, max, c->num) != 0;
+    case LESSTHAN:
+        return num_cmp(c->kind, min, c->num) <= 0;
+    case LESSTHAN_STRICT:
+        return num_cmp(c->kind, min, c->num) < 0;
+    case MORETHAN:
+        return num_cmp(c->kind, max, c->num) >= 0;
+    case MORETHAN_STRICT:
+        return num_cmp(c->kind, max, c->num) > 0;
+    case IN:
+        for (i = 0; i < c->list_count; i++)
+            if (num_cmp(c->kind, min, c->num_list[i]) <= 0
+                && num_cmp(c->kind, c->num_list[i], max) <= 0)
+                return true;
+        return false;
+    default:
+        return true;
+    }
+}
+
+/* Comparison loops are kept branch-free so the compiler can vectorize them */
+#define SCAN_OP(_v, _x, _op) \
+    for (r = 0; r < n; r++)  \
+        m[r] = ((_v)[r] _op (_x))
+
+#define SCAN_NUM(_v, _x, _list)                                     \
+    do {                                                            \
+        switch (c->compar) {                                        \
+        case EQUAL:           SCAN_OP(_v, _x, ==); break;           \
+        case NOTEQUAL:        SCAN_OP(_v, _x, !=); break;           \
+        case LESSTHAN:        SCAN_OP(_v, _x, <=); break;           \
+        case MORETHAN:        SCAN_OP(_v, _x, >=); break;           \
+        case LESSTHAN_STRICT: SCAN_OP(_v, _x, <);  break;           \
+        case MORETHAN_STRICT: SCAN_OP(_v, _x, >);  break;           \
+        case IN:                                                    \
+        case NOTIN:                                                 \
+            memset(m, 0, n);                                        \
+            for (j = 0; j < c->list_count; j++)                     \
+                for (r = 0; r < n; r++)                             \
+                    m[r] |= ((_v)[r] == (_list)[j]);                \
+            if (c->compar == NOTIN)                                 \
+                for (r = 0; r < n; r++)                             \
+                    m[r] ^= 1;                                      \
+            break;                                                  \
+        default:                                                    \
+            memset(m, 0, n);                                        \
+        }                                                           \
+    } while (0)
+
+static void scan_num(const struct snap_cond *c, const struct snap_colbuf *b,
+                     unsigned char *m, unsigned int n)
+{
+    unsigned int r, j;
+
+    if (c->kind == SK_INT) {
+        const int64_t *v = b->i;
+        int64_t x = c->num.i;
+        int64_t list[c->list_count + 1];
+
+        for (j = 0; j < c->list_count; j++)
+            list[j] = c->num_list[j].i;
+        SCAN_NUM(v, x, list);
+    } else {
+        const uint64_t *v = b->u;
+        uint64_t x = c->num.u;
+        uint64_t list[c->list_count + 1];
+
+        for (j = 0; j < c->list_count; j++)
+            list[j] = c->num_list[j].u;
+        SCAN_NUM(v, x, list);
+    }
+}
+
+static bool text_match(const struct snap_cond *c, const char *s)
+{
+    unsigned int j;
+
+    switch (c->compar) {
+    case EQUAL:
+        return strcmp(s, c->str) == 0;
+    case NOTEQUAL:
+        return strcmp(s, c->str) != 0;
+    case LESSTHAN:
+        return strcmp(s, c->str) <= 0;
+    case MORETHAN:
+        return strcmp(s, c->str) >= 0;
+    case LESSTHAN_STRICT:
+        return strcmp(s, c->str) < 0;
+    case MORETHAN_STRICT:
+        return strcmp(s, c->str) > 0;
+    case LIKE:
+        return like_match(s, c->str, false);
+    case UNLIKE:
+        return !like_match(s, c->str, false);
+    case ILIKE:
+        return like_match(s, c->str, true);
+    case IUNLIKE:
+        return !like_match(s, c->str, true);
+    case IN:
+    case NOTIN:
+        for (j = 0; j < c->list_count; j++)
+            if (strcmp(s, c->str_list[j]) == 0)
+                return c->compar == IN;
+        return c->compar == NOTIN;
+    default:
+        return false;
+    }
+}
+
+/** restrict the selection of rows to the ones matching the condition */
+static void snap_cond_apply(const struct snap_cond *c,
+                            const struct snap_colbuf *b, unsigned char *sel,
+                            unsigned char *m, unsigned int n)
+{
+    const unsigned char *valid = b->valid;
+    unsigned char neg = c->negate;
+    unsigned char anull = c->allow_null;
+    unsigned int r;
+
+    if (c->compar == ISNULL || c->compar == NOTNULL) {
+        unsigned char isnull = (c->compar == ISNULL);
+
+        for (r = 0; r < n; r++)
+            sel[r] &= (valid[r] ^ isnull) ^ neg;
+        return;
+    }
+
+    if (c->kind == SK_TEXT) {
+        for (r = 0; r < n; r++)
+            m[r] = (sel[r] && b->str[r] != NULL) ? text_match(c, b->str[r])
+                                                 : 0;
+    } else {
+        scan_num(c, b, m, n);
+    }
+
+    /* SQL semantics: conditions on NULL values are false */
+    for (r = 0; r < n; r++)
+        sel[r] &= (valid[r] & (m[r] ^ neg)) | ((valid[r] ^ 1) & anull);
+}
+
+/** read and decompress the chunk of a column */
+static int snap_load_chunk(const struct lmgr_snapshot *snap,
+                           const struct snap_coldesc *cd,
+                           const struct snap_chunk *c, unsigned int nrows,
+                           struct snap_colbuf *b)
+{
+    const struct snap_chunk_hdr *h = &c->hdr;
+    uLongf len = h->raw_len;
+    size_t done = 0;
+    ssize_t sz;
+
+    if (h->z_len > b->z_size) {
+        MemFree(b->zbuf);
+        b->zbuf = MemAlloc(h->z_len);
+        b->z_size = b->zbuf ? h->z_len : 0;
+    }
+    if (h->raw_len > b->raw_size) {
+        MemFree(b->raw);
+        b->raw = MemAlloc(h->raw_len);
+        b->raw_size = b->raw ? h->raw_len : 0;
+    }
+    if ((h->z_len > 0 && b->zbuf == NULL) || (h->raw_len > 0 && b->raw == NULL))
+        return DB_NO_MEMORY;
+
+    while (done < h->z_len) {
+        sz = pread(snap->fd, b->zbuf + done, h->z_len - done,
+                   c->offset + done);
+        if (sz <= 0) {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to read snapshot: %s",
+                       sz < 0 ? strerror(errno) : "unexpected end of file");
+            return DB_IO_ERROR;
+        }
+        done += sz;
+    }
+
+    if (uncompress(b->raw, &len, b->zbuf, h->z_len) != Z_OK
+        || len != h->raw_len)
+        goto corrupted;
+
+    if (cd->kind != SK_TEXT) {
+        if (h->raw_len != nrows * (sizeof(uint64_t) + 1))
+            goto corrupted;
+        b->u = (const uint64_t *)b->raw;
+        b->i = (const int64_t *)b->raw;
+        b->valid = b->raw + nrows * sizeof(uint64_t);
+    } else {
+        const char *p = (const char *)b->raw + nrows;
+        const char *end = (const char *)b->raw + h->raw_len;
+        unsigned int r;
+
+        if (h->raw_len < nrows)
+            goto corrupted;
+        b->valid = b->raw;
+        for (r = 0; r < nrows; r++) {
+            const char *z;
+
+            if (!b->valid[r]) {
+                b->str[r] = NULL;
+                continue;
+            }
+            z = memchr(p, '\0', end - p);
+            if (z == NULL)
+                goto corrupted;
+            b->str[r] = p;
+            p = z + 1;
+        }
+    }
+    return DB_SUCCESS;
+
+ corrupted:
+    DisplayLog(LVL_CRIT, LISTMGR_TAG, "Corrupted chunk for column '%s' in "
+               "snapshot", cd->name);
+    return DB_IO_ERROR;
+}
+
+static guint snap_key_hash(gconstpointer key)
+{
+    const struct snap_group *g = key;
+    guint h = 2166136261u;
+    unsigned int i;
+
+    /* FNV-1a */
+    for (i = 0; i < g->key_len; i++)
+        h = (h ^ (unsigned char)g->key[i]) * 16777619u;
+    return h;
+}
+
+static gboolean snap_key_equal(gconstpointer k1, gconstpointer k2)
+{
+    const struct snap_group *g1 = k1;
+    const struct snap_group *g2 = k2;
+
+    return g1->key_len == g2->key_len
+        && memcmp(g1->key, g2->key, g1->key_len) == 0;
+}
+
+static void snap_group_free(struct snap_report *r, struct snap_group *g)
+{
+    unsigned int i;
+
+    for (i = 0; i < r->field_count; i++)
+        if (g->acc[i].distinct != NULL)
+            g_hash_table_destroy(g->acc[i].distinct);
+    MemFree(g->values);
+    MemFree(g->key);
+    MemFree(g);
+}
+
+static void snap_groups_free(struct snap_report *r, GHashTable *groups)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, groups);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        snap_group_free(r, value);
+    g_hash_table_destroy(groups);
+}
+
+/** get or create the group with the given key */
+static struct snap_group *snap_group_get(struct snap_report *r,
+                                         GHashTable *groups, const char *key,
+                                         unsigned int key_len)
+{
+    struct snap_group probe = { .key = (char *)key, .key_len = key_len };
+    struct snap_group *g;
+    unsigned int i;
+
+    g = g_hash_table_lookup(groups, &probe);
+    if (g != NULL)
+        return g;
+
+    g = MemCalloc(1, sizeof(*g) + r->field_count * sizeof(struct snap_acc));
+    if (g == NULL)
+        return NULL;
+    g->key = MemAlloc(key_len + 1);
+    if (g->key == NULL) {
+        MemFree(g);
+        return NULL;
+    }
+    memcpy(g->key, key, key_len);
+    g->key_len = key_len;
+
+    for (i = 0; i < r->field_count; i++) {
+        struct snap_acc *a = &g->acc[i];
+
+        if (r->fields[i].kind == SK_INT) {
+            a->min.i = INT64_MAX;
+            a->max.i = INT64_MIN;
+        } else {
+            a->min.u = UINT64_MAX;
+            a->max.u = 0;
+        }
+        if (r->fields[i].type == REPORT_COUNT_DISTINCT)
+            a->distinct = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free, NULL);
+    }
+    g_hash_table_insert(groups, g, g);
+    return g;
+}
+
+/** encode the GROUP BY values of a row */
+static void snap_make_key(const struct snap_report *r,
+                          const struct snap_colbuf *cols, unsigned int row,
+                          GString *key)
+{
+    unsigned int i;
+
+    g_string_truncate(key, 0);
+    for (i = 0; i < r->field_count; i++) {
+        const struct snap_field *f = &r->fields[i];
+        const struct snap_colbuf *b;
+
+        if (f->type != REPORT_GROUP_BY)
+            continue;
+        b = &cols[f->col];
+
+        if (!b->valid[row]) {
+            g_string_append_c(key, 0);
+            continue;
+        }
+        g_string_append_c(key, 1);
+        if (f->kind == SK_TEXT)
+            g_string_append_len(key, b->str[row], strlen(b->str[row]) + 1);
+        else
+            g_string_append_len(key, (const char *)&b->u[row],
+                                sizeof(uint64_t));
+    }
+}
+
+static void snap_acc_distinct(const struct snap_field *f, struct snap_acc *a,
+                              const struct snap_colbuf *b, unsigned int row)
+{
+    char *val;
+
+    if (f->kind == SK_TEXT)
+        val = g_strdup(b->str[row]);
+    else if (f->kind == SK_INT)
+        val = g_strdup_printf("%"PRId64, b->i[row]);
+    else
+        val = g_strdup_printf("%"PRIu64, b->u[row]);
+
+    if (g_hash_table_lookup_extended(a->distinct, val, NULL, NULL))
+        g_free(val);
+    else
+        g_hash_table_insert(a->distinct, val, NULL);
+}
+
+/** aggregate the values of a single row */
+static void snap_group_add_row(const struct snap_report *r,
+                               struct snap_group *g,
+                               const struct snap_colbuf *cols,
+                               unsigned int row)
+{
+    unsigned int i;
+
+    g->count++;
+
+    for (i = 0; i < r->field_count; i++) {
+        const struct snap_field *f = &r->fields[i];
+        struct snap_acc *a = &g->acc[i];
+        const struct snap_colbuf *b;
+
+        if (f->col < 0 || f->type == REPORT_GROUP_BY)
+            continue;
+        b = &cols[f->col];
+        if (!b->valid[row])
+            continue;
+
+        switch (f->type) {
+        case REPORT_COUNT_DISTINCT:
+            snap_acc_distinct(f, a, b, row);
+            break;
+        case REPORT_SUM:
+        case REPORT_AVG:
+            a->sum.u += b->u[row];
+            a->nvals++;
+            break;
+        case REPORT_MIN:
+            if (f->kind == SK_INT)
+                a->min.i = MIN2(a->min.i, b->i[row]);
+            else
+                a->min.u = MIN2(a->min.u, b->u[row]);
+            a->nvals++;
+            break;
+        case REPORT_MAX:
+            if (f->kind == SK_INT)
+                a->max.i = MAX2(a->max.i, b->i[row]);
+            else
+                a->max.u = MAX2(a->max.u, b->u[row]);
+            a->nvals++;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (r->profile && cols[r->size_col].valid[row])
+        g->prof[sz_index(cols[r->size_col].u[row])]++;
+}
+
+/* Aggregation of all selected rows (no GROUP BY):
+ * NULL and unselected values are masked instead of tested, so these loops
+ * can be vectorized. */
+
+static void acc_sum(struct snap_acc *a, const struct snap_colbuf *b,
+                    const unsigned char *sel, unsigned int n)
+{
+    uint64_t sum = 0, cnt = 0;
+    unsigned int r;
+
+    for (r = 0; r < n; r++) {
+        uint64_t m = -(uint64_t)(sel[r] & b->valid[r]);
+
+        sum += b->u[r] & m;
+        cnt += m & 1;
+    }
+    /* two's complement: also right for signed values */
+    a->sum.u += sum;
+    a->nvals += cnt;
+}
+
+static void acc_min_max(struct snap_acc *a, snap_kind_e kind, bool is_min,
+                        const struct snap_colbuf *b, const unsigned char *sel,
+                        unsigned int n)
+{
+    uint64_t cnt = 0;
+    unsigned int r;
+
+    if (kind == SK_INT) {
+        int64_t min = a->min.i, max = a->max.i;
+
+        for (r = 0; r < n; r++) {
+            int64_t m = -(int64_t)(sel[r] & b->valid[r]);
+            int64_t v = b->i[r];
+
+            if (is_min) {
+                v = (v & m) | (INT64_MAX & ~m);
+                min = v < min ? v : min;
+            } else {
+                v = (v & m) | (INT64_MIN & ~m);
+                max = v > max ? v : max;
+            }
+            cnt += m & 1;
+        }
+        a->min.i = min;
+        a->max.i = max;
+    } else {
+        uint64_t min = a->min.u, max = a->max.u;
+
+        for (r = 0; r < n; r++) {
+            uint64_t m = -(uint64_t)(sel[r] & b->valid[r]);
+            uint64_t v = b->u[r];
+
+            if (is_min) {
+                v = (v & m) | ~m;
+                min = v < min ? v : min;
+            } else {
+                v = v & m;
+                max = v > max ? v : max;
+            }
+            cnt += m & 1;
+        }
+        a->min.u = min;
+        a->max.u = max;
+    }
+    a->nvals += cnt;
+}
+
+static void snap_group_add_all(const struct snap_report *r,
+                               struct snap_group *g,
+                               const struct snap_colbuf *cols,
+                               const unsigned char *sel, unsigned int n)
+{
+    uint64_t cnt = 0;
+    unsigned int i, row;
+
+    for (row = 0; row < n; row++)
+        cnt += sel[row];
+    g->count += cnt;
+
+    for (i = 0; i < r->field_count; i++) {
+        const struct snap_field *f = &r->fields[i];
+        struct snap_acc *a = &g->acc[i];
+        const struct snap_colbuf *b;
+
+        if (f->col < 0)
+            continue;
+        b = &cols[f->col];
+
+        switch (f->type) {
+        case REPORT_SUM:
+        case REPORT_AVG:
+            acc_sum(a, b, sel, n);
+            break;
+        case REPORT_MIN:
+        case REPORT_MAX:
+            acc_min_max(a, f->kind, f->type == REPORT_MIN, b, sel, n);
+            break;
+        case REPORT_COUNT_DISTINCT:
+            for (row = 0; row < n; row++)
+                if (sel[row] && b->valid[row])
+                    snap_acc_distinct(f, a, b, row);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (r->profile) {
+        const struct snap_colbuf *b = &cols[r->size_col];
+
+        for (row = 0; row < n; row++)
+            if (sel[row] && b->valid[row])
+                g->prof[sz_index(b->u[row])]++;
+    }
+}
+
+static int snap_process_rg(struct snap_worker *w, unsigned int idx)
+{
+    struct snap_report *r = w->r;
+    const struct lmgr_snapshot *snap = r->snap;
+    const struct snap_rowgroup *rg = &snap->rgs[idx];
+    unsigned int n = rg->nrows;
+    struct snap_group *g;
+    unsigned int i, row;
+    int rc;
+
+    /* skip row groups that can't match */
+    for (i = 0; i < r->cond_count; i++) {
+        const struct snap_cond *c = &r->conds[i];
+
+        if (!chunk_may_match(c, &rg->chunks[c->col].hdr, n)) {
+            __atomic_fetch_add(&r->skipped_rg, 1, __ATOMIC_RELAXED);
+            return DB_SUCCESS;
+        }
+    }
+
+    for (i = 0; i < snap->col_count; i++) {
+        if (!r->needed[i])
+            continue;
+        rc = snap_load_chunk(snap, &snap->cols[i], &rg->chunks[i], n,
+                             &w->cols[i]);
+        if (rc)
+            return rc;
+    }
+
+    memset(w->sel, 1, n);
+    for (i = 0; i < r->cond_count; i++)
+        snap_cond_apply(&r->conds[i], &w->cols[r->conds[i].col], w->sel,
+                        w->match, n);
+
+    if (!r->grouped) {
+        g = snap_group_get(r, w->groups, "", 0);
+        if (g == NULL)
+            return DB_NO_MEMORY;
+        snap_group_add_all(r, g, w->cols, w->sel, n);
+        return DB_SUCCESS;
+    }
+
+    for (row = 0; row < n; row++) {
+        if (!w->sel[row])
+            continue;
+        snap_make_key(r, w->cols, row, w->key);
+        g = snap_group_get(r, w->groups, w->key->str, w->key->len);
+        if (g == NULL)
+            return DB_NO_MEMORY;
+        snap_group_add_row(r, g, w->cols, row);
+    }
+    return DB_SUCCESS;
+}
+
+static void *snap_worker_thr(void *arg)
+{
+    struct snap_worker *w = arg;
+    struct snap_report *r = w->r;
+    unsigned int idx;
+    int rc;
+
+    while ((idx = __atomic_fetch_add(&r->next_rg, 1, __ATOMIC_RELAXED))
+           < r->snap->rg_count) {
+        if (__atomic_load_n(&r->rc, __ATOMIC_RELAXED) != DB_SUCCESS)
+            break;
+        rc = snap_process_rg(w, idx);
+        if (rc) {
+            __atomic_store_n(&r->rc, rc, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int snap_worker_init(struct snap_report *r, struct snap_worker *w)
+{
+    unsigned int i;
+
+    w->r = r;
+    w->groups = g_hash_table_new(snap_key_hash, snap_key_equal);
+    w->key = g_string_new(NULL);
+    w->sel = MemAlloc(SNAP_RG_ROWS);
+    w->match = MemAlloc(SNAP_RG_ROWS);
+    w->cols = MemCalloc(r->snap->col_count, sizeof(*w->cols));
+    if (w->sel == NULL || w->match == NULL || w->cols == NULL)
+        return DB_NO_MEMORY;
+
+    for (i = 0; i < r->snap->col_count; i++) {
+        if (!r->needed[i] || r->snap->cols[i].kind != SK_TEXT)
+            continue;
+        w->cols[i].str = MemAlloc(SNAP_RG_ROWS * sizeof(char *));
+        if (w->cols[i].str == NULL)
+            return DB_NO_MEMORY;
+    }
+    return DB_SUCCESS;
+}
+
+static void snap_worker_free(struct snap_report *r, struct snap_worker *w)
+{
+    unsigned int i;
+
+    if (w->groups != NULL)
+        snap_groups_free(r, w->groups);
+    if (w->key != NULL)
+        g_string_free(w->key, TRUE);
+    MemFree(w->sel);
+    MemFree(w->match);
+    if (w->cols == NULL)
+        return;
+    for (i = 0; i < r->snap->col_count; i++) {
+        MemFree(w->cols[i].raw);
+        MemFree(w->cols[i].zbuf);
+        MemFree(w->cols[i].str);
+    }
+    MemFree(w->cols);
+}
+
+static void snap_acc_merge(const struct snap_field *f, struct snap_acc *tgt,
+                           struct snap_acc *src)
+{
+    GHashTableIter iter;
+    gpointer key;
+
+    tgt->nvals += src->nvals;
+    tgt->sum.u += src->sum.u;
+    if (f->kind == SK_INT) {
+        tgt->min.i = MIN2(tgt->min.i, src->min.i);
+        tgt->max.i = MAX2(tgt->max.i, src->max.i);
+    } else {
+        tgt->min.u = MIN2(tgt->min.u, src->min.u);
+        tgt->max.u = MAX2(tgt->max.u, src->max.u);
+    }
+
+    if (src->distinct == NULL)
+        return;
+    g_hash_table_iter_init(&iter, src->distinct);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        g_hash_table_iter_steal(&iter);
+        if (g_hash_table_lookup_extended(tgt->distinct, key, NULL, NULL))
+            g_free(key);
+        else
+            g_hash_table_insert(tgt->distinct, key, NULL);
+    }
+}
+
+/** move the groups of a worker to the report */
+static void snap_groups_merge(struct snap_report *r, GHashTable *src)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    unsigned int i;
+
+    g_hash_table_iter_init(&iter, src);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        struct snap_group *g = value;
+        struct snap_group *tgt = g_hash_table_lookup(r->groups, g);
+
+        g_hash_table_iter_steal(&iter);
+        if (tgt == NULL) {
+            g_hash_table_insert(r->groups, g, g);
+            continue;
+        }
+
+        tgt->count += g->count;
+        for (i = 0; i < SZ_PROFIL_COUNT; i++)
+            tgt->prof[i] += g->prof[i];
+        for (i = 0; i < r->field_count; i++)
+            snap_acc_merge(&r->fields[i], &tgt->acc[i], &g->acc[i]);
+        snap_group_free(r, g);
+    }
+}
+
+static inline void set_null(db_value_t *v)
+{
+    v->type = DB_TEXT;
+    v->value_u.val_str = NULL;
+}
+
+/** compute the result values of a group */
+static void snap_group_values(const struct snap_report *r,
+                              struct snap_group *g)
+{
+    const char *key = g->key;
+    unsigned int i, j;
+
+    for (i = 0; i < r->field_count; i++) {
+        const struct snap_field *f = &r->fields[i];
+        const struct snap_acc *a = &g->acc[i];
+        db_value_t *v = &g->values[i];
+        snap_num_t n;
+
+        v->type = f->out_type;
+
+        switch (f->type) {
+        case REPORT_COUNT:
+            v->value_u.val_biguint = g->count;
+            break;
+
+        case REPORT_COUNT_DISTINCT:
+            v->value_u.val_biguint = g_hash_table_size(a->distinct);
+            break;
+
+        case REPORT_GROUP_BY:
+            if (*(key++) == 0) {
+                set_null(v);
+            } else if (f->kind == SK_TEXT) {
+                v->value_u.val_str = key;
+                key += strlen(key) + 1;
+            } else {
+                memcpy(&n, key, sizeof(n));
+                key += sizeof(n);
+                num2dbval(f->out_type, n, &v->value_u);
+            }
+            break;
+
+        case REPORT_SUM:
+            if (a->nvals == 0)
+                set_null(v);
+            else
+                num2dbval(f->out_type, a->sum, &v->value_u);
+            break;
+
+        case REPORT_AVG:
+            if (a->nvals == 0) {
+                set_null(v);
+                break;
+            }
+            /* ROUND(AVG(x)) */
+            if (f->kind == SK_INT && a->sum.i < 0)
+                n.i = -(int64_t)((-a->sum.i + a->nvals / 2) / a->nvals);
+            else
+                n.u = (a->sum.u + a->nvals / 2) / a->nvals;
+            num2dbval(f->out_type, n, &v->value_u);
+            break;
+
+        case REPORT_MIN:
+        case REPORT_MAX:
+            if (a->nvals == 0)
+                set_null(v);
+            else
+                num2dbval(f->out_type, f->type == REPORT_MIN ? a->min : a->max,
+                          &v->value_u);
+            break;
+        }
+    }
+
+    if (r->profile && r->prof_descr.range_ratio_len > 0 && g->count > 0) {
+        uint64_t sum = 0;
+
+        for (j = r->prof_descr.range_ratio_start;
+             j < r->prof_descr.range_ratio_start
+                 + r->prof_descr.range_ratio_len && j < SZ_PROFIL_COUNT; j++)
+            sum += g->prof[j];
+        g->ratio = (double)sum / g->count;
+    }
+}
+
+/** compare result values (NULL first) */
+static int value_cmp(const db_value_t *v1, const db_value_t *v2)
+{
+    snap_num_t n1, n2;
+
+    if (DB_IS_NULL(v1) || DB_IS_NULL(v2))
+        return !DB_IS_NULL(v1) - !DB_IS_NULL(v2);
+
+    if (snap_kind(snap_type(v1->type)) == SK_TEXT)
+        return strcmp(v1->value_u.val_str, v2->value_u.val_str);
+
+    dbval2num(v1->type, &v1->value_u, &n1);
+    dbval2num(v2->type, &v2->value_u, &n2);
+    return num_cmp(snap_kind(snap_type(v1->type)), n1, n2);
+}
+
+static bool snap_having_match(const struct snap_report *r,
+                              const struct snap_group *g)
+{
+    unsigned int i;
+
+    for (i = 0; i < r->field_count; i++) {
+        const struct snap_field *f = &r->fields[i];
+        db_value_t fv = { .type = f->out_type, .value_u = f->value };
+        int c;
+
+        if (!f->having)
+            continue;
+        if (DB_IS_NULL(&g->values[i]))
+            return false;
+
+        c = value_cmp(&g->values[i], &fv);
+        switch (f->compar) {
+        case EQUAL:           if (c != 0) return false; break;
+        case NOTEQUAL:        if (c == 0) return false; break;
+        case LESSTHAN:        if (c > 0)  return false; break;
+        case MORETHAN:        if (c < 0)  return false; break;
+        case LESSTHAN_STRICT: if (c >= 0) return false; break;
+        case MORETHAN_STRICT: if (c <= 0) return false; break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+static gint snap_group_cmp(gconstpointer p1, gconstpointer p2, gpointer udata)
+{
+    const struct snap_report *r = udata;
+    const struct snap_group *g1 = *(struct snap_group * const *)p1;
+    const struct snap_group *g2 = *(struct snap_group * const *)p2;
+    unsigned int i;
+    int c;
+
+    /* sorting by ratio first */
+    if (r->profile && r->prof_descr.range_ratio_len > 0
+        && r->prof_descr.range_ratio_sort != SORT_NONE) {
+        c = (g1->ratio > g2->ratio) - (g1->ratio < g2->ratio);
+        if (c != 0)
+            return r->prof_descr.range_ratio_sort == SORT_DESC ? -c : c;
+    }
+
+    for (i = 0; i < r->field_count; i++) {
+        if (r->fields[i].sort == SORT_NONE)
+            continue;
+        c = value_cmp(&g1->values[i], &g2->values[i]);
+        if (c != 0)
+            return r->fields[i].sort == SORT_DESC ? -c : c;
+    }
+    return 0;
+}
+
+/** build the sorted list of results from aggregated groups */
+static int snap_finalize(struct snap_report *r, unsigned int max_count)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    unsigned int count = 0;
+
+    /* without GROUP BY, the SQL request always returns a row */
+    if (!r->grouped && snap_group_get(r, r->groups, "", 0) == NULL)
+        return DB_NO_MEMORY;
+
+    r->results = MemCalloc(MAX2(g_hash_table_size(r->groups), 1),
+                           sizeof(*r->results));
+    if (r->results == NULL)
+        return DB_NO_MEMORY;
+
+    g_hash_table_iter_init(&iter, r->groups);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        struct snap_group *g = value;
+
+        g->values = MemCalloc(MAX2(r->field_count, 1), sizeof(db_value_t));
+        if (g->values == NULL)
+            return DB_NO_MEMORY;
+        snap_group_values(r, g);
+
+        if (snap_having_match(r, g))
+            r->results[count++] = g;
+    }
+
+    g_qsort_with_data(r->results, count, sizeof(*r->results),
+                      snap_group_cmp, r);
+
+    r->result_count = (max_count > 0) ? MIN2(count, max_count) : count;
+    return DB_SUCCESS;
+}
+
+void listmgr_snapshot_report_free(struct snap_report *r)
+{
+    unsigned int i;
+
+    for (i = 0; i < r->cond_count; i++) {
+        g_free(r->conds[i].str_alloc);
+        MemFree(r->conds[i].num_list);
+        MemFree(r->conds[i].str_list);
+    }
+    MemFree(r->conds);
+    MemFree(r->fields);
+    MemFree(r->needed);
+    MemFree(r->results);
+    if (r->groups != NULL)
+        snap_groups_free(r, r->groups);
+    MemFree(r);
+}
+
+/** check report fields and filters, determine the columns to be read */
+static int snap_report_compile(struct snap_report *r,
+                               const report_field_descr_t *report_desc,
+                               unsigned int report_descr_count,
+                               const profile_field_descr_t *profile_descr,
+                               const lmgr_filter_t *p_filter)
+{
+    unsigned int i;
+    int col, rc;
+
+    for (i = 0; i < report_descr_count; i++) {
+        const report_field_descr_t *d = &report_desc[i];
+        struct snap_field *f = &r->fields[i];
+
+        f->type = d->report_type;
+        f->sort = d->sort_flag;
+        f->col = -1;
+        f->kind = SK_UINT;
+        f->out_type = DB_BIGUINT;
+
+        if (d->report_type != REPORT_COUNT) {
+            col = snap_attr_col(r, d->attr_index);
+            if (col < 0)
+                return -col;
+            f->col = col;
+            f->kind = r->snap->cols[col].kind;
+            if (d->report_type != REPORT_COUNT_DISTINCT)
+                f->out_type = field_type(d->attr_index);
+            if (d->attr_index < ATTR_COUNT)
+                f->flags = field_infos[d->attr_index].flags;
+
+            if (f->kind == SK_TEXT && d->report_type != REPORT_GROUP_BY
+                && d->report_type != REPORT_COUNT_DISTINCT) {
+                DisplayLog(LVL_CRIT, LISTMGR_TAG, "Unsupported report type %d"
+                           " on text attribute '%s' in snapshots",
+                           d->report_type, field_name(d->attr_index));
+                return DB_NOT_SUPPORTED;
+            }
+        }
+
+        if (d->report_type == REPORT_GROUP_BY)
+            r->grouped = true;
+
+        if (!d->filter)
+            continue;
+
+        if (d->report_type == REPORT_GROUP_BY) {
+            /* filter on entry values (WHERE) */
+            rc = snap_add_cond(r, d->attr_index, d->filter_compar,
+                               &d->filter_value, 0);
+            if (rc)
+                return rc;
+        } else {
+            /* filter on aggregated values (HAVING) */
+            switch (d->filter_compar) {
+            case EQUAL:
+            case NOTEQUAL:
+            case LESSTHAN:
+            case MORETHAN:
+            case LESSTHAN_STRICT:
+            case MORETHAN_STRICT:
+                break;
+            default:
+                DisplayLog(LVL_CRIT, LISTMGR_TAG, "Unsupported comparator "
+                           "'%s' on report field #%u", compar2str(d->
+                           filter_compar), i);
+                return DB_NOT_SUPPORTED;
+            }
+            f->having = true;
+            f->compar = d->filter_compar;
+            f->value = d->filter_value.value;
+        }
+    }
+
+    if (profile_descr != NULL) {
+        col = snap_attr_col(r, ATTR_INDEX_size);
+        if (col < 0)
+            return -col;
+        r->profile = true;
+        r->prof_descr = *profile_descr;
+        r->size_col = col;
+    }
+
+    if (no_filter(p_filter))
+        return DB_SUCCESS;
+
+    if (p_filter->filter_type != FILTER_SIMPLE) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Boolean filter expressions are not "
+                   "supported on snapshots");
+        return DB_NOT_SUPPORTED;
+    }
+
+    for (i = 0; i < p_filter->filter_simple.filter_count; i++) {
+        rc = snap_add_cond(r, p_filter->filter_simple.filter_index[i],
+                           p_filter->filter_simple.filter_compar[i],
+                           &p_filter->filter_simple.filter_value[i],
+                           p_filter->filter_simple.filter_flags[i]);
+        if (rc)
+            return rc;
+    }
+    return DB_SUCCESS;
+}
+
+struct snap_report *listmgr_snapshot_report(struct lmgr_snapshot *snap,
+                                    const report_field_descr_t *report_desc,
+                                    unsigned int report_descr_count,
+                                    const profile_field_descr_t *profile_descr,
+                                    const lmgr_filter_t *p_filter,
+                                    const lmgr_iter_opt_t *p_opt)
+{
+    struct snap_worker workers[SNAP_MAX_THREADS];
+    struct snap_report *r;
+    unsigned int nb_thr, filter_count = 0, i, started;
+    long nb_cpu;
+    int rc;
+
+    r = MemCalloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    r->snap = snap;
+
+    if (!no_filter(p_filter) && p_filter->filter_type == FILTER_SIMPLE)
+        filter_count = p_filter->filter_simple.filter_count;
+
+    r->field_count = report_descr_count;
+    r->fields = MemCalloc(MAX2(report_descr_count, 1), sizeof(*r->fields));
+    r->conds = MemCalloc(MAX2(report_descr_count + filter_count, 1),
+                         sizeof(*r->conds));
+    r->needed = MemCalloc(snap->col_count, 1);
+    r->groups = g_hash_table_new(snap_key_hash, snap_key_equal);
+    if (r->fields == NULL || r->conds == NULL || r->needed == NULL) {
+        rc = DB_NO_MEMORY;
+        goto out;
+    }
+
+    rc = snap_report_compile(r, report_desc, report_descr_count,
+                             profile_descr, p_filter);
+    if (rc)
+        goto out;
+
+    nb_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nb_thr = MIN2(MAX2(nb_cpu, 1), SNAP_MAX_THREADS);
+    nb_thr = MAX2(MIN2(nb_thr, snap->rg_count), 1);
+
+    memset(workers, 0, sizeof(workers));
+    for (i = 0; i < nb_thr && rc == DB_SUCCESS; i++)
+        rc = snap_worker_init(r, &workers[i]);
+
+    /* the current thread is the first worker */
+    started = 1;
+    for (i = 1; i < nb_thr && rc == DB_SUCCESS; i++, started++) {
+        if (pthread_create(&workers[i].thread, NULL, snap_worker_thr,
+                           &workers[i]) != 0) {
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to start report thread:"
+                       " %s", strerror(errno));
+            break;
+        }
+    }
+    if (rc == DB_SUCCESS)
+        snap_worker_thr(&workers[0]);
+
+    for (i = 1; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+    if (rc == DB_SUCCESS)
+        rc = r->rc;
+
+    for (i = 0; i < nb_thr; i++) {
+        if (rc == DB_SUCCESS && workers[i].groups != NULL)
+            snap_groups_merge(r, workers[i].groups);
+        snap_worker_free(r, &workers[i]);
+    }
+    if (rc)
+        goto out;
+
+    rc = snap_finalize(r, p_opt ? p_opt->list_count_max : 0);
+    if (rc)
+        goto out;
+
+    DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Snapshot report: %u row groups "
+               "(%u skipped), %u threads, %u results", snap->rg_count,
+               r->skipped_rg, started, r->result_count);
+    return r;
+
+ out:
+    DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to build report from snapshot: "
+               "%s", lmgr_err2str(rc));
+    listmgr_snapshot_report_free(r);
+    return NULL;
+}
+
+int listmgr_snapshot_next(struct snap_report *r, db_value_t *p_value,
+                          unsigned int *p_value_count, profile_u *p_profile)
+{
+    struct snap_group *g;
+    unsigned int i;
+
+    if (*p_value_count < r->field_count)
+        return DB_BUFFER_TOO_SMALL;
+
+    if (r->next >= r->result_count)
+        return DB_END_OF_LIST;
+
+    g = r->results[r->next++];
+
+    for (i = 0; i < r->field_count; i++) {
+        p_value[i] = g->values[i];
+        /* values are returned once: convert lists in place */
+        if ((r->fields[i].flags & SEPD_LIST) && !DB_IS_NULL(&p_value[i])
+            && strlen(p_value[i].value_u.val_str) >= 2)
+            separated_db2list_inplace((char *)p_value[i].value_u.val_str);
+    }
+
+    if (p_profile != NULL && r->profile)
+        memcpy(p_profile->size.file_count, g->prof, sizeof(g->prof));
+
+    *p_value_count = r->field_count;
+    return DB_SUCCESS;
+}
@@ -0,0 +1,168 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Cache of prepared statements.
+ *
+ * Each connection (lmgr_t) keeps the statements it prepared, identified by
+ * their kind, table, attribute mask and row count. Statements are only valid
+ * in the server session they were prepared in: the cache is dropped when the
+ * connection is lost or re-established.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "Memory.h"
+#include <string.h>
+
+/** max number of statements per connection */
+#define STMT_CACHE_SIZE 128
+
+struct stmt_entry {
+    lmgr_stmt_key_t     key;
+    db_stmt_t          *stmt;
+    unsigned long long  last_use;
+};
+
+struct lmgr_stmt_cache {
+    unsigned long       session;    /**< session statements belong to */
+    unsigned int        count;
+    unsigned long long  tick;
+    /* stats */
+    unsigned long long  nb_hit;
+    unsigned long long  nb_miss;
+    struct stmt_entry   entries[STMT_CACHE_SIZE];
+};
+
+static inline bool key_equal(const lmgr_stmt_key_t *k1,
+                             const lmgr_stmt_key_t *k2)
+{
+    return k1->kind == k2->kind && k1->table == k2->table
+        && k1->rows == k2->rows && attr_mask_equal(&k1->mask, &k2->mask);
+}
+
+/** release the statements of the cache (but not the cache itself) */
+static void stmt_cache_clear(lmgr_t *p_mgr)
+{
+    struct lmgr_stmt_cache *c = p_mgr->stmt_cache;
+    unsigned int i;
+
+    for (i = 0; i < c->count; i++)
+        db_stmt_close(&p_mgr->conn, c->entries[i].stmt);
+    c->count = 0;
+}
+
+/** check the cache is allocated and belongs to the current session */
+static struct lmgr_stmt_cache *stmt_cache_get(lmgr_t *p_mgr)
+{
+    struct lmgr_stmt_cache *c = p_mgr->stmt_cache;
+    unsigned long session = db_session_id(&p_mgr->conn);
+
+    if (c == NULL) {
+        c = MemCalloc(1, sizeof(*c));
+        if (c == NULL)
+            return NULL;
+        c->session = session;
+        p_mgr->stmt_cache = c;
+    } else if (c->session != session) {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG, "DB session changed: "
+                   "releasing %u prepared statements", c->count);
+        stmt_cache_clear(p_mgr);
+        c->session = session;
+    }
+    return c;
+}
+
+db_stmt_t *lmgr_stmt_lookup(lmgr_t *p_mgr, const lmgr_stmt_key_t *key)
+{
+    struct lmgr_stmt_cache *c = stmt_cache_get(p_mgr);
+    unsigned int i;
+
+    if (c == NULL)
+        return NULL;
+
+    for (i = 0; i < c->count; i++) {
+        if (key_equal(&c->entries[i].key, key)) {
+            c->entries[i].last_use = ++c->tick;
+            c->nb_hit++;
+            return c->entries[i].stmt;
+        }
+    }
+    c->nb_miss++;
+    return NULL;
+}
+
+int lmgr_stmt_prepare(lmgr_t *p_mgr, const lmgr_stmt_key_t *key,
+                      const char *query, db_stmt_t **p_stmt)
+{
+    struct lmgr_stmt_cache *c = stmt_cache_get(p_mgr);
+    struct stmt_entry *e;
+    int rc;
+
+    if (c == NULL)
+        return DB_NO_MEMORY;
+
+    rc = db_stmt_prepare(&p_mgr->conn, query, p_stmt);
+    if (rc)
+        return rc;
+
+    if (c->count < STMT_CACHE_SIZE) {
+        e = &c->entries[c->count++];
+    } else {
+        unsigned int i;
+
+        /* replace the least recently used statement */
+        e = &c->entries[0];
+        for (i = 1; i < c->count; i++)
+            if (c->entries[i].last_use < e->last_use)
+                e = &c->entries[i];
+        db_stmt_close(&p_mgr->conn, e->stmt);
+    }
+
+    e->key = *key;
+    e->stmt = *p_stmt;
+    e->last_use = ++c->tick;
+    return DB_SUCCESS;
+}
+
+int lmgr_stmt_exec(lmgr_t *p_mgr, db_stmt_t *stmt, bool with_result)
+{
+    int rc = db_stmt_exec(&p_mgr->conn, stmt, with_result);
+
+    /* statements are lost with the connection */
+    if (rc == DB_CONNECT_FAILED && p_mgr->stmt_cache != NULL)
+        stmt_cache_clear(p_mgr);
+
+    return rc;
+}
+
+void lmgr_stmt_cache_free(lmgr_t *p_mgr)
+{
+    struct lmgr_stmt_cache *c = p_mgr->stmt_cache;
+
+    if (c == NULL)
+        return;
+
+    DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Prepared statements: %u cached, "
+               "%llu hits, %llu misses", c->count, c->nb_hit, c->nb_miss);
+
+    stmt_cache_clear(p_mgr);
+    MemFree(c);
+    p_mgr->stmt_cache = NULL;
+}
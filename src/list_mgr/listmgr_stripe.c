@@ -24,6 +24,7 @@
 #include "rbh_misc.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 
 #define STRIPE_INFO_FIELDS "id,validator,stripe_count,stripe_size,pool_name"
 #define STRIPE_INFO_SET_VALUES "validator=VALUES(validator),"       \
@@ -32,6 +33,129 @@
                                "pool_name=VALUES(pool_name)"
 
 #define STRIPE_ITEMS_FIELDS "id,stripe_index,ostidx,details"
+/* compact_stripes: STRIPE_ITEMS only indexes the OSTs of each file */
+#define STRIPE_OSTS_FIELDS  "id,ostidx"
+
+/* Compact stripe layout (compact_stripes = yes), stored in STRIPE_INFO.layout
+ * (binary field):
+ * <version> <item count> then for each stripe item:
+ * <ost_idx> <ost_gen> <obj_id> <obj_seq>
+ * All values are encoded as LEB128 varints (7 bits per byte, high bit set
+ * if more bytes follow).
+ */
+#define LAYOUT_VERSION  1
+
+/** append a varint to a buffer */
+static void varint_put(GString *buf, uint64_t val)
+{
+    unsigned char b;
+
+    do {
+        b = val & 0x7F;
+        val >>= 7;
+        if (val)
+            b |= 0x80;
+        g_string_append_c(buf, b);
+    } while (val);
+}
+
+/** read a varint from a buffer, and move the pointer forward */
+static bool varint_get(const unsigned char **p_buf, const unsigned char *end,
+                       uint64_t *val)
+{
+    const unsigned char *p = *p_buf;
+    unsigned int shift;
+
+    *val = 0;
+    for (shift = 0; shift < 64 && p < end; shift += 7, p++) {
+        *val |= (uint64_t)(*p & 0x7F) << shift;
+        if (!(*p & 0x80)) {
+            *p_buf = p + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void stripe_layout_encode(GString *buf, const stripe_items_t *p_items)
+{
+    int i;
+
+    varint_put(buf, LAYOUT_VERSION);
+    varint_put(buf, p_items->count);
+    for (i = 0; i < p_items->count; i++) {
+        varint_put(buf, p_items->stripe[i].ost_idx);
+        varint_put(buf, p_items->stripe[i].ost_gen);
+        varint_put(buf, p_items->stripe[i].obj_id);
+        varint_put(buf, p_items->stripe[i].obj_seq);
+    }
+}
+
+int stripe_layout_decode(const char *buf, size_t len,
+                         stripe_items_t *p_items)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    const unsigned char *end = p + len;
+    uint64_t version, count, v[4];
+    int i, j;
+
+    p_items->count = 0;
+    p_items->stripe = NULL;
+
+    /* no stripe items */
+    if (buf == NULL || len == 0)
+        return DB_SUCCESS;
+
+    if (!varint_get(&p, end, &version) || version != LAYOUT_VERSION
+        || !varint_get(&p, end, &count))
+        return DB_BAD_SCHEMA;
+
+    /* an item takes at least 4 bytes */
+    if (count > (end - p) / 4)
+        return DB_BAD_SCHEMA;
+    if (count == 0)
+        return DB_SUCCESS;
+
+    p_items->stripe = MemCalloc(count, sizeof(stripe_item_t));
+    if (p_items->stripe == NULL)
+        return DB_NO_MEMORY;
+    p_items->count = count;
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < 4; j++) {
+            if (!varint_get(&p, end, &v[j])) {
+                free_stripe_items(p_items);
+                return DB_BAD_SCHEMA;
+            }
+        }
+        p_items->stripe[i].ost_idx = v[0];
+        p_items->stripe[i].ost_gen = v[1];
+        p_items->stripe[i].obj_id = v[2];
+        p_items->stripe[i].obj_seq = v[3];
+    }
+    return DB_SUCCESS;
+}
+
+void stripe_layout_append(db_conn_t *pconn, GString *req,
+                          const stripe_items_t *p_items)
+{
+    GString *buf = g_string_sized_new(2 + 8 * p_items->count);
+
+    stripe_layout_encode(buf, p_items);
+    db_append_binary(pconn, req, buf->str, buf->len);
+    g_string_free(buf, TRUE);
+}
+
+/** check if the OST of the given stripe appears in a previous stripe */
+static inline bool ost_seen(const stripe_items_t *p_items, int s)
+{
+    int i;
+
+    for (i = 0; i < s; i++)
+        if (p_items->stripe[i].ost_idx == p_items->stripe[s].ost_idx)
+            return true;
+    return false;
+}
 
 int update_stripe_info(lmgr_t *p_mgr, PK_ARG_T pk, int validator,
                        const stripe_info_t *p_stripe,
@@ -93,7 +217,10 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
     if (!attr_mask_is_null(sum_masks(p_attrs, count, tmp_mask))) {
         /* build batch request for STRIPE_INFO table */
         g_string_assign(req, "INSERT INTO " STRIPE_INFO_TABLE " ("
-                        STRIPE_INFO_FIELDS ") VALUES ");
+                        STRIPE_INFO_FIELDS);
+        if (lmgr_config.compact_stripes)
+            g_string_append(req, ",layout");
+        g_string_append(req, ") VALUES ");
 
         first = true;
         for (i = 0; i < count; i++) {
@@ -101,19 +228,33 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
             if (!ATTR_MASK_TEST(p_attrs[i], stripe_info))
                 continue;
 
-            g_string_append_printf(req, "%s(" DPK ",%d,%u,%u,'%s')",
+            g_string_append_printf(req, "%s(" DPK ",%d,%u,%u,'%s'",
                                    first ? "" : ",", pklist[i], validators[i],
                                    ATTR(p_attrs[i], stripe_info).stripe_count,
                                    (unsigned int)ATTR(p_attrs[i],
                                                       stripe_info).stripe_size,
                                    ATTR(p_attrs[i], stripe_info).pool_name);
+            if (lmgr_config.compact_stripes) {
+                if (ATTR_MASK_TEST(p_attrs[i], stripe_items)) {
+                    g_string_append_c(req, ',');
+                    stripe_layout_append(&p_mgr->conn, req,
+                                         &ATTR(p_attrs[i], stripe_items));
+                } else {
+                    g_string_append(req, ",NULL");
+                }
+            }
+            g_string_append_c(req, ')');
             first = false;
         }
 
-        if (update_if_exists)
+        if (update_if_exists) {
             /* append "on duplicate key ..." */
             g_string_append(req,
                             " ON DUPLICATE KEY UPDATE " STRIPE_INFO_SET_VALUES);
+            /* keep the current layout if stripe items are not set */
+            if (lmgr_config.compact_stripes)
+                g_string_append(req, ",layout=IFNULL(VALUES(layout),layout)");
+        }
 
         if (!first) {   /* do nothing if no entry had stripe info */
             rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
@@ -124,6 +265,24 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
         g_string_assign(req, "");
     }
 
+    /* compact_stripes: set the layout of entries with stripe items only */
+    if (lmgr_config.compact_stripes) {
+        for (i = 0; i < count; i++) {
+            if (!ATTR_MASK_TEST(p_attrs[i], stripe_items)
+                || ATTR_MASK_TEST(p_attrs[i], stripe_info))
+                continue;
+
+            g_string_assign(req, "UPDATE " STRIPE_INFO_TABLE " SET layout=");
+            stripe_layout_append(&p_mgr->conn, req,
+                                 &ATTR(p_attrs[i], stripe_items));
+            g_string_append_printf(req, " WHERE id=" DPK, pklist[i]);
+
+            rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+            if (rc)
+                goto out;
+        }
+    }
+
     /* Stripe items more tricky because we want to delete previous items
      * on update. */
     /* If update_if_exists is false, insert them all as a batch.
@@ -152,8 +311,12 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
 
     total_si = 0;
     first = true;
-    g_string_assign(req, "INSERT INTO " STRIPE_ITEMS_TABLE
-                    " (" STRIPE_ITEMS_FIELDS ") VALUES ");
+    if (lmgr_config.compact_stripes)
+        g_string_assign(req, "INSERT INTO " STRIPE_ITEMS_TABLE
+                        " (" STRIPE_OSTS_FIELDS ") VALUES ");
+    else
+        g_string_assign(req, "INSERT INTO " STRIPE_ITEMS_TABLE
+                        " (" STRIPE_ITEMS_FIELDS ") VALUES ");
 
     /* loop on all entries and all stripe items */
     for (i = 0; i < count; i++) {
@@ -168,6 +331,17 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
         for (s = 0; s < p_items->count; s++) {
             char buff[2 * STRIPE_DETAIL_SZ + 1];
 
+            if (lmgr_config.compact_stripes) {
+                /* one row per OST of the file */
+                if (ost_seen(p_items, s))
+                    continue;
+                g_string_append_printf(req, "%s(" DPK ",%u)", first ? "" : ",",
+                                       pklist[i], p_items->stripe[s].ost_idx);
+                total_si++;
+                first = false;
+                continue;
+            }
+
             total_si++;
             if (buf2hex
                 (buff, sizeof(buff),
@@ -198,7 +372,9 @@ int get_stripe_info(lmgr_t *p_mgr, PK_ARG_T pk, stripe_info_t *p_stripe_info,
 {
 /* stripe_count, stripe_size, pool_name, validator => 4 */
 #define STRIPE_INFO_COUNT 4
-    char *res[STRIPE_INFO_COUNT];
+    /* + layout if compact_stripes is set */
+    char *res[STRIPE_INFO_COUNT + 1];
+    unsigned long len[STRIPE_INFO_COUNT + 1];
     result_handle_t result;
     int i;
     int rc = DB_SUCCESS;
@@ -207,15 +383,18 @@ int get_stripe_info(lmgr_t *p_mgr, PK_ARG_T pk, stripe_info_t *p_stripe_info,
     /* retrieve basic stripe info */
     req =
         g_string_new
-        ("SELECT stripe_count, stripe_size, pool_name,validator FROM "
-         STRIPE_INFO_TABLE " WHERE id=");
-    g_string_append_printf(req, DPK, pk);
+        ("SELECT stripe_count, stripe_size, pool_name,validator");
+    if (lmgr_config.compact_stripes)
+        g_string_append(req, ",layout");
+    g_string_append_printf(req, " FROM " STRIPE_INFO_TABLE " WHERE id=" DPK,
+                           pk);
 
     rc = db_exec_sql(&p_mgr->conn, req->str, &result);
     if (rc)
         goto out;
 
-    rc = db_next_record(&p_mgr->conn, &result, res, STRIPE_INFO_COUNT);
+    rc = db_next_record(&p_mgr->conn, &result, res, STRIPE_INFO_COUNT
+                        + (lmgr_config.compact_stripes ? 1 : 0));
 
     if (rc == DB_END_OF_LIST)
         rc = DB_NOT_EXISTS;
@@ -238,6 +417,20 @@ int get_stripe_info(lmgr_t *p_mgr, PK_ARG_T pk, stripe_info_t *p_stripe_info,
     p_stripe_info->validator = atoi(res[3]);
 #endif
 
+    if (p_items && lmgr_config.compact_stripes) {
+        /* stripe items are in the layout: no other query */
+        rc = db_record_lengths(&p_mgr->conn, &result, len,
+                               STRIPE_INFO_COUNT + 1);
+        if (rc)
+            goto res_free;
+        rc = stripe_layout_decode(res[STRIPE_INFO_COUNT],
+                                  len[STRIPE_INFO_COUNT], p_items);
+        if (rc)
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Invalid stripe layout for "
+                       "entry " DPK, pk);
+        goto res_free;
+    }
+
     db_result_free(&p_mgr->conn, &result);
 
     if (p_items) {
@@ -416,3 +609,244 @@ int ListMgr_CheckStripe(lmgr_t *p_mgr, const entry_id_t *p_id, int validator)
                PFID(p_id), __func__, rc);
     return rc;
 }
+
+/* Conversion of stripe tables when compact_stripes is changed
+ * (see ListMgr_Init with --alter-db). */
+
+/** stripe items read by chunks for conversion */
+#define LAYOUT_CONV_ROWS    10000
+/** entries converted by chunks */
+#define LAYOUT_CONV_ENTRIES 1000
+
+/** append the layout of an entry to a conversion request */
+static void append_layout_case(db_conn_t *pconn, GString *cases,
+                               GString *ids, const char *pk,
+                               const stripe_items_t *p_items)
+{
+    g_string_append_printf(cases, " WHEN " DPK " THEN ", pk);
+    stripe_layout_append(pconn, cases, p_items);
+    g_string_append_printf(ids, "%s" DPK, ids->len == 0 ? "" : ",", pk);
+}
+
+int stripe_layouts_encode_all(db_conn_t *pconn)
+{
+    result_handle_t result;
+    stripe_items_t items = {0, NULL};
+    unsigned int alloc = 0;
+    unsigned int nb_rows, nb_entries, r;
+    uint64_t total = 0;
+    bool full_chunk;
+    char *res[3];
+    unsigned long len[3];
+    DEF_PK(last);
+    DEF_PK(cur);
+    GString *req, *cases, *ids;
+    int rc = DB_SUCCESS;
+
+    req = g_string_new(NULL);
+    cases = g_string_new(NULL);
+    ids = g_string_new(NULL);
+    last[0] = '\0';
+
+    do {
+        /* the last entry of a chunk may be incomplete: restart from it */
+        g_string_assign(req, "SELECT id,ostidx,details FROM "
+                        STRIPE_ITEMS_TABLE);
+        if (last[0] != '\0')
+            g_string_append_printf(req, " WHERE id>=" DPK, last);
+        g_string_append_printf(req, " ORDER BY id,stripe_index LIMIT %u",
+                               LAYOUT_CONV_ROWS);
+
+        rc = db_exec_sql(pconn, req->str, &result);
+        if (rc)
+            goto out;
+
+        nb_rows = db_result_nb_records(pconn, &result);
+        full_chunk = (nb_rows == LAYOUT_CONV_ROWS);
+        g_string_truncate(cases, 0);
+        g_string_truncate(ids, 0);
+        nb_entries = 0;
+        cur[0] = '\0';
+        items.count = 0;
+
+        for (r = 0; r < nb_rows; r++) {
+            unsigned char details[STRIPE_DETAIL_SZ];
+
+            rc = db_next_record(pconn, &result, res, 3);
+            if (rc)
+                goto free_res;
+            rc = db_record_lengths(pconn, &result, len, 3);
+            if (rc)
+                goto free_res;
+            if (res[0] == NULL || res[1] == NULL) {
+                rc = DB_ATTR_MISSING;
+                goto free_res;
+            }
+
+            if (strcmp(res[0], cur)) {
+                /* new entry: the previous one is complete */
+                if (cur[0] != '\0') {
+                    append_layout_case(pconn, cases, ids, cur, &items);
+                    nb_entries++;
+                }
+                rh_strncpy(cur, res[0], sizeof(cur));
+                items.count = 0;
+            }
+
+            if (items.count == alloc) {
+                stripe_item_t *tmp;
+
+                alloc = alloc ? 2 * alloc : 64;
+                tmp = MemRealloc(items.stripe, alloc * sizeof(stripe_item_t));
+                if (tmp == NULL) {
+                    rc = DB_NO_MEMORY;
+                    goto free_res;
+                }
+                items.stripe = tmp;
+            }
+
+            memset(details, 0, sizeof(details));
+            if (res[2] != NULL)
+                memcpy(details, res[2], MIN2(len[2], STRIPE_DETAIL_SZ));
+
+            items.stripe[items.count].ost_idx = strtoul(res[1], NULL, 10);
+            /* same layout as the 'details' field (see batch insert) */
+            memcpy(&items.stripe[items.count].ost_gen, details,
+                   STRIPE_DETAIL_SZ);
+            items.count++;
+        }
+        db_result_free(pconn, &result);
+
+        if (!full_chunk) {
+            /* end of table: the last entry is complete */
+            if (cur[0] != '\0') {
+                append_layout_case(pconn, cases, ids, cur, &items);
+                nb_entries++;
+            }
+        } else if (nb_entries == 0) {
+            /* a single entry can't have so many stripes */
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Too many stripe items for "
+                       "entry " DPK, cur);
+            rc = DB_BAD_SCHEMA;
+            goto out;
+        }
+        rh_strncpy(last, cur, sizeof(last));
+
+        if (nb_entries == 0)
+            break;
+
+        g_string_printf(req, "UPDATE " STRIPE_INFO_TABLE " SET layout=CASE id"
+                        "%s END WHERE id IN (%s)", cases->str, ids->str);
+        rc = db_exec_sql(pconn, req->str, NULL);
+        if (rc)
+            goto out;
+
+        total += nb_entries;
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "%" PRIu64 " stripe layouts "
+                   "encoded", total);
+    } while (full_chunk);
+
+    goto out;
+
+ free_res:
+    db_result_free(pconn, &result);
+ out:
+    if (items.stripe)
+        MemFree(items.stripe);
+    g_string_free(ids, TRUE);
+    g_string_free(cases, TRUE);
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+int stripe_layouts_decode_all(db_conn_t *pconn, const char *items_table)
+{
+    result_handle_t result;
+    unsigned int nb, e;
+    uint64_t total = 0;
+    char *res[2];
+    unsigned long len[2];
+    DEF_PK(last);
+    GString *req, *ins;
+    bool first;
+    int rc = DB_SUCCESS;
+
+    req = g_string_new(NULL);
+    ins = g_string_new(NULL);
+    last[0] = '\0';
+
+    do {
+        g_string_assign(req, "SELECT id,layout FROM " STRIPE_INFO_TABLE
+                        " WHERE layout IS NOT NULL");
+        if (last[0] != '\0')
+            g_string_append_printf(req, " AND id>" DPK, last);
+        g_string_append_printf(req, " ORDER BY id LIMIT %u",
+                               LAYOUT_CONV_ENTRIES);
+
+        rc = db_exec_sql(pconn, req->str, &result);
+        if (rc)
+            goto out;
+
+        nb = db_result_nb_records(pconn, &result);
+        g_string_printf(ins, "INSERT INTO %s (" STRIPE_ITEMS_FIELDS
+                        ") VALUES ", items_table);
+        first = true;
+
+        for (e = 0; e < nb; e++) {
+            stripe_items_t items;
+            int s;
+
+            rc = db_next_record(pconn, &result, res, 2);
+            if (rc)
+                goto free_res;
+            if (res[0] == NULL) {
+                rc = DB_ATTR_MISSING;
+                goto free_res;
+            }
+            rh_strncpy(last, res[0], sizeof(last));
+
+            rc = db_record_lengths(pconn, &result, len, 2);
+            if (rc)
+                goto free_res;
+            rc = stripe_layout_decode(res[1], len[1], &items);
+            if (rc) {
+                DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Invalid stripe layout "
+                           "for entry " DPK ": skipped", res[0]);
+                continue;
+            }
+
+            for (s = 0; s < items.count; s++) {
+                char buff[2 * STRIPE_DETAIL_SZ + 1];
+
+                buf2hex(buff, sizeof(buff),
+                        (unsigned char *)(&items.stripe[s].ost_gen),
+                        STRIPE_DETAIL_SZ);
+                g_string_append_printf(ins, "%s(" DPK ",%u,%u,x'%s')",
+                                       first ? "" : ",", res[0], s,
+                                       items.stripe[s].ost_idx, buff);
+                first = false;
+            }
+            free_stripe_items(&items);
+        }
+        db_result_free(pconn, &result);
+
+        if (!first) {
+            rc = db_exec_sql(pconn, ins->str, NULL);
+            if (rc)
+                goto out;
+        }
+
+        total += nb;
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "%" PRIu64 " stripe layouts "
+                   "decoded", total);
+    } while (nb == LAYOUT_CONV_ENTRIES);
+
+    goto out;
+
+ free_res:
+    db_result_free(pconn, &result);
+ out:
+    g_string_free(ins, TRUE);
+    g_string_free(req, TRUE);
+    return rc;
+}
@@ -14,6 +14,7 @@
 
 #include "list_mgr.h"
 #include "listmgr_internal.h"
+#include "database.h"
 
 #ifndef _LISTMGR_STRIPE_H
 #define _LISTMGR_STRIPE_H
@@ -37,4 +38,21 @@ int dup_stripe_items(stripe_items_t *p_stripe_out,
 
 void free_stripe_items(stripe_items_t *p_stripe_items);
 
+/* compact stripe layout (compact_stripes parameter) */
+
+/** append the encoded layout of stripe items to a buffer (raw bytes) */
+void stripe_layout_encode(GString *buf, const stripe_items_t *p_items);
+/** decode a layout of the given length (NULL = no items) */
+int stripe_layout_decode(const char *buf, size_t len,
+                         stripe_items_t *p_items);
+/** append the encoded layout of stripe items to a request,
+ * as a binary literal */
+void stripe_layout_append(db_conn_t *pconn, GString *req,
+                          const stripe_items_t *p_items);
+
+/** encode the stripe items of all entries to STRIPE_INFO.layout */
+int stripe_layouts_encode_all(db_conn_t *pconn);
+/** decode all layouts of STRIPE_INFO as rows of the given table */
+int stripe_layouts_decode_all(db_conn_t *pconn, const char *items_table);
+
 #endif
@@ -176,6 +176,7 @@ struct lmgr_iterator_t *ListMgr_ListUntagged( lmgr_t * p_mgr,
     /* allocate a new iterator */
     it = (lmgr_iterator_t *) MemAlloc(sizeof(lmgr_iterator_t));
     it->p_mgr = p_mgr;
+    it->stream = NULL;
     if (p_opt)
     {
         it->opt = *p_opt;
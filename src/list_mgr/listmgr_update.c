@@ -27,6 +27,100 @@
 #include <unistd.h>
 #include <pthread.h>
 
+/** update the fields of the main or annex table, using a prepared statement */
+static int update_table_stmt(lmgr_t *p_mgr, table_enum table, PK_ARG_T pk,
+                             const attr_set_t *p_set)
+{
+    lmgr_stmt_key_t key = {
+        .kind = STMT_UPDATE,
+        .table = table,
+        .mask = p_set->attr_mask,
+        .rows = 1,
+    };
+    db_stmt_t *stmt;
+    unsigned int idx = 0;
+    db_type_u u;
+    int rc;
+
+    stmt = lmgr_stmt_lookup(p_mgr, &key);
+    if (stmt == NULL) {
+        GString *req = g_string_new("UPDATE ");
+
+        g_string_append_printf(req, "%s SET ", table2name(table));
+        rc = attrset2updatelist(p_mgr, req, p_set, table, AOF_PLACEHOLDER);
+        if (rc <= 0) {
+            /* error, or nothing to update */
+            g_string_free(req, TRUE);
+            return -rc;
+        }
+        g_string_append(req, " WHERE id=?");
+
+        rc = lmgr_stmt_prepare(p_mgr, &key, req->str, &stmt);
+        g_string_free(req, TRUE);
+        if (rc)
+            return rc;
+    }
+
+    rc = attrset2params(stmt, &idx, p_set, table);
+    if (rc < 0)
+        return -rc;
+
+    u.val_str = pk;
+    rc = db_stmt_bind(stmt, idx, PK_DB_TYPE, &u);
+    if (rc)
+        return rc;
+
+    return lmgr_stmt_exec(p_mgr, stmt, false);
+}
+
+/** insert or update the name of an entry, using a prepared statement */
+static int update_name_stmt(lmgr_t *p_mgr, PK_ARG_T pk,
+                            const attr_set_t *p_set)
+{
+    lmgr_stmt_key_t key = {
+        .kind = STMT_UPDATE_NAME,
+        .table = T_DNAMES,
+        .mask = p_set->attr_mask,
+        .rows = 1,
+    };
+    db_stmt_t *stmt;
+    unsigned int idx = 0;
+    db_type_u u;
+    int rc;
+
+    stmt = lmgr_stmt_lookup(p_mgr, &key);
+    if (stmt == NULL) {
+        GString *req = g_string_new("INSERT INTO " DNAMES_TABLE "(id");
+
+        attrmask2fieldlist(req, p_set->attr_mask, T_DNAMES, "", "",
+                           AOF_LEADING_SEP);
+        g_string_append(req, ",pkn) VALUES (?");
+        attrset2valuelist(p_mgr, req, p_set, T_DNAMES,
+                          AOF_LEADING_SEP | AOF_PLACEHOLDER);
+        g_string_append(req,
+                        "," HNAME_DEF ")" UPSERT_CLAUSE("pkn") "id=");
+        g_string_append_printf(req, UPSERT_VALUE, "id");
+        attrset2updatelist(p_mgr, req, p_set, T_DNAMES,
+                           AOF_LEADING_SEP | AOF_GENERIC_VAL);
+
+        rc = lmgr_stmt_prepare(p_mgr, &key, req->str, &stmt);
+        g_string_free(req, TRUE);
+        if (rc)
+            return rc;
+    }
+
+    u.val_str = pk;
+    rc = db_stmt_bind(stmt, idx++, PK_DB_TYPE, &u);
+    if (rc)
+        return rc;
+
+    rc = attrset2params(stmt, &idx, p_set, T_DNAMES);
+    if (rc < 0)
+        return -rc;
+
+    return lmgr_stmt_exec(p_mgr, stmt, false);
+}
+
 int ListMgr_Update(lmgr_t *p_mgr, const entry_id_t *p_id,
                    const attr_set_t *p_update_set)
 {
@@ -54,7 +148,13 @@ int ListMgr_Update(lmgr_t *p_mgr, const entry_id_t *p_id,
         goto retry;
 
     /* update fields in main table */
-    if (main_fields(p_update_set->attr_mask)) {
+    if (main_fields(p_update_set->attr_mask) && lmgr_config.prepared_stmt) {
+        rc = update_table_stmt(p_mgr, T_MAIN, pk, p_update_set);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    } else if (main_fields(p_update_set->attr_mask)) {
         g_string_assign(req, "UPDATE " MAIN_TABLE " SET ");
 
         rc = attrset2updatelist(p_mgr, req, p_update_set, T_MAIN, 0);
@@ -73,15 +173,23 @@ int ListMgr_Update(lmgr_t *p_mgr, const entry_id_t *p_id,
 
     /* update names table */
     if (ATTR_MASK_TEST(p_update_set, name)
-        && ATTR_MASK_TEST(p_update_set, parent_id)) {
+        && ATTR_MASK_TEST(p_update_set, parent_id)
+        && lmgr_config.prepared_stmt) {
+        rc = update_name_stmt(p_mgr, pk, p_update_set);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    } else if (ATTR_MASK_TEST(p_update_set, name)
+               && ATTR_MASK_TEST(p_update_set, parent_id)) {
         g_string_assign(req, "INSERT INTO " DNAMES_TABLE "(id");
         attrmask2fieldlist(req, p_update_set->attr_mask, T_DNAMES, "", "",
                            AOF_LEADING_SEP);
         g_string_append_printf(req, ",pkn) VALUES (" DPK, pk);
         attrset2valuelist(p_mgr, req, p_update_set, T_DNAMES, AOF_LEADING_SEP);
         g_string_append(req,
-                        "," HNAME_DEF
-                        ") ON DUPLICATE KEY UPDATE id=VALUES(id)");
+                        "," HNAME_DEF ")" UPSERT_CLAUSE("pkn") "id=");
+        g_string_append_printf(req, UPSERT_VALUE, "id");
         attrset2updatelist(p_mgr, req, p_update_set, T_DNAMES,
                            AOF_LEADING_SEP | AOF_GENERIC_VAL);
 
@@ -101,7 +209,13 @@ int ListMgr_Update(lmgr_t *p_mgr, const entry_id_t *p_id,
     }
 
     /* update annex table */
-    if (annex_fields(p_update_set->attr_mask)) {
+    if (annex_fields(p_update_set->attr_mask) && lmgr_config.prepared_stmt) {
+        rc = update_table_stmt(p_mgr, T_ANNEX, pk, p_update_set);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    } else if (annex_fields(p_update_set->attr_mask)) {
         g_string_assign(req, "UPDATE " ANNEX_TABLE " SET ");
         rc = attrset2updatelist(p_mgr, req, p_update_set, T_ANNEX, 0);
         if (rc < 0) {
@@ -145,6 +259,11 @@ int ListMgr_Update(lmgr_t *p_mgr, const entry_id_t *p_id,
     if (rc == DB_SUCCESS)
         p_mgr->nbop[OPIDX_UPDATE]++;
 
+    /* the entry may have been renamed */
+    if (ATTR_MASK_TEST(p_update_set, name)
+        && ATTR_MASK_TEST(p_update_set, parent_id))
+        path_cache_invalidate(pk);
+
     goto free_str;
 
  rollback:
@@ -203,10 +322,16 @@ int ListMgr_Replace(lmgr_t *p_mgr, entry_id_t *old_id, attr_set_t *old_attrs,
     rc = lmgr_commit(p_mgr);
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
-    else {
-        g_string_free(req, TRUE);
-        return rc;
+
+    if (rc == DB_SUCCESS) {
+        path_cache_invalidate(oldpk);
+        listmgr_batch_insert_done(&new_id, &new_attrs, 1,
+                                  update_target_if_exists);
+        /* children of the old entry were moved to the new one */
+        path_cache_invalidate_children(oldpk);
     }
+    g_string_free(req, TRUE);
+    return rc;
 
  rollback:
     lmgr_rollback(p_mgr);
@@ -95,8 +95,8 @@ int lmgr_set_var(db_conn_t *pconn, const char *varname, const char *value)
 
     g_string_printf(query,
                     "INSERT INTO " VAR_TABLE
-                    " (varname,value) VALUES ('%s','%s') "
-                    "ON DUPLICATE KEY UPDATE value='%s'", varname, escaped,
+                    " (varname,value) VALUES ('%s','%s')"
+                    UPSERT_CLAUSE("varname") "value='%s'", varname, escaped,
                     escaped);
 
     rc = db_exec_sql(pconn, query->str, NULL);
@@ -116,6 +116,7 @@ bool db_is_retryable(int db_err)
 int db_connect(db_conn_t *conn)
 {
     my_bool reconnect = 1;
+    unsigned int local_infile = 1;
     unsigned int retry = 0;
 
     /* Connect to database */
@@ -131,6 +132,9 @@ int db_connect(db_conn_t *conn)
     /* older version */
     conn->reconnect = 1;
 #endif
+    /* allow LOAD DATA LOCAL INFILE (see db_load_file) */
+    if (lmgr_config.bulk_load)
+        mysql_options(conn, MYSQL_OPT_LOCAL_INFILE, &local_infile);
 
     while (1) {
         /* connect to server */
@@ -298,12 +302,400 @@ int db_next_record(db_conn_t *conn, result_handle_t *p_result,
 
 }
 
+int db_record_lengths(db_conn_t *conn, result_handle_t *p_result,
+                      unsigned long *lengths, unsigned int count)
+{
+    unsigned long *l = mysql_fetch_lengths(*p_result);
+    unsigned int nb_fields = mysql_num_fields(*p_result);
+    unsigned int i;
+
+    if (l == NULL)
+        return DB_REQUEST_FAILED;
+
+    for (i = 0; i < count; i++)
+        lengths[i] = (i < nb_fields) ? l[i] : 0;
+
+    return DB_SUCCESS;
+}
+
 /* retrieve number of records in result */
 int db_result_nb_records(db_conn_t *conn, result_handle_t *p_result)
 {
     return mysql_num_rows(*p_result);
 }
 
+/* -------------------- Prepared statements ---------------- */
+
+/** initial size of string buffers for statement results */
+#define STMT_COL_BUF_SZ 256
+
+struct db_stmt {
+    MYSQL_STMT     *stmt;
+    char           *query;      /* for logging */
+
+    /* parameters */
+    unsigned int    nb_params;
+    MYSQL_BIND     *params;
+    db_type_u      *param_vals; /* numeric values */
+    char          **param_bufs; /* string values */
+    unsigned long  *param_bufsz;
+    unsigned long  *param_lens;
+    my_bool        *param_null;
+
+    /* result columns (retrieved as strings) */
+    unsigned int    nb_cols;
+    MYSQL_BIND     *cols;
+    char          **col_bufs;
+    unsigned long  *col_lens;
+    my_bool        *col_null;
+    my_bool        *col_err;
+};
+
+static void stmt_free_cols(db_stmt_t *s)
+{
+    unsigned int i;
+
+    if (s->col_bufs)
+        for (i = 0; i < s->nb_cols; i++)
+            MemFree(s->col_bufs[i]);
+
+    MemFree(s->cols);
+    MemFree(s->col_bufs);
+    MemFree(s->col_lens);
+    MemFree(s->col_null);
+    MemFree(s->col_err);
+    s->cols = NULL;
+    s->col_bufs = NULL;
+    s->col_lens = NULL;
+    s->col_null = NULL;
+    s->col_err = NULL;
+    s->nb_cols = 0;
+}
+
+static void db_stmt_free(db_stmt_t *s)
+{
+    unsigned int i;
+
+    if (s->param_bufs)
+        for (i = 0; i < s->nb_params; i++)
+            MemFree(s->param_bufs[i]);
+
+    MemFree(s->params);
+    MemFree(s->param_vals);
+    MemFree(s->param_bufs);
+    MemFree(s->param_bufsz);
+    MemFree(s->param_lens);
+    MemFree(s->param_null);
+    stmt_free_cols(s);
+    g_free(s->query);
+    MemFree(s);
+}
+
+static int stmt_error(db_stmt_t *s, const char *what)
+{
+    int dberr = mysql_stmt_errno(s->stmt);
+    int rc = mysql_error_convert(dberr, true);
+
+    if (dberr == ER_DUP_ENTRY)
+        DisplayLog(LVL_EVENT, LISTMGR_TAG,
+                   "A database record already exists for this entry: '%s' (%s)",
+                   s->query, mysql_stmt_error(s->stmt));
+    else if (!db_is_retryable(rc))
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG,
+                   "Error %d %s statement '%s': %s", rc, what, s->query,
+                   mysql_stmt_error(s->stmt));
+    return rc;
+}
+
+int db_stmt_prepare(db_conn_t *conn, const char *query, db_stmt_t **p_stmt)
+{
+    db_stmt_t *s;
+    int rc;
+
+#ifdef _DEBUG_DB
+    DisplayLog(LVL_FULL, LISTMGR_TAG, "SQL prepare: %s", query);
+#endif
+
+    s = MemCalloc(1, sizeof(*s));
+    if (s == NULL)
+        return DB_NO_MEMORY;
+
+    s->query = g_strdup(query);
+    s->stmt = mysql_stmt_init(conn);
+    if (s->stmt == NULL) {
+        db_stmt_free(s);
+        return DB_NO_MEMORY;
+    }
+
+    if (mysql_stmt_prepare(s->stmt, query, strlen(query))) {
+        rc = stmt_error(s, "preparing");
+        mysql_stmt_close(s->stmt);
+        db_stmt_free(s);
+        return rc;
+    }
+
+    s->nb_params = mysql_stmt_param_count(s->stmt);
+    if (s->nb_params > 0) {
+        s->params = MemCalloc(s->nb_params, sizeof(MYSQL_BIND));
+        s->param_vals = MemCalloc(s->nb_params, sizeof(db_type_u));
+        s->param_bufs = MemCalloc(s->nb_params, sizeof(char *));
+        s->param_bufsz = MemCalloc(s->nb_params, sizeof(unsigned long));
+        s->param_lens = MemCalloc(s->nb_params, sizeof(unsigned long));
+        s->param_null = MemCalloc(s->nb_params, sizeof(my_bool));
+
+        if (!s->params || !s->param_vals || !s->param_bufs
+            || !s->param_bufsz || !s->param_lens || !s->param_null) {
+            mysql_stmt_close(s->stmt);
+            db_stmt_free(s);
+            return DB_NO_MEMORY;
+        }
+    }
+
+    *p_stmt = s;
+    return DB_SUCCESS;
+}
+
+unsigned int db_stmt_param_count(db_stmt_t *stmt)
+{
+    return stmt->nb_params;
+}
+
+static int bind_string(db_stmt_t *s, unsigned int idx, const char *str)
+{
+    MYSQL_BIND *b = &s->params[idx];
+    unsigned long len;
+
+    b->buffer_type = MYSQL_TYPE_STRING;
+    b->length = &s->param_lens[idx];
+    b->is_null = &s->param_null[idx];
+
+    if (str == NULL) {
+        s->param_null[idx] = 1;
+        return DB_SUCCESS;
+    }
+
+    len = strlen(str);
+    if (len + 1 > s->param_bufsz[idx]) {
+        MemFree(s->param_bufs[idx]);
+        s->param_bufsz[idx] = MAX2(len + 1, STMT_COL_BUF_SZ);
+        s->param_bufs[idx] = MemAlloc(s->param_bufsz[idx]);
+        if (s->param_bufs[idx] == NULL) {
+            s->param_bufsz[idx] = 0;
+            return DB_NO_MEMORY;
+        }
+    }
+    memcpy(s->param_bufs[idx], str, len + 1);
+
+    b->buffer = s->param_bufs[idx];
+    b->buffer_length = s->param_bufsz[idx];
+    s->param_lens[idx] = len;
+    s->param_null[idx] = 0;
+    return DB_SUCCESS;
+}
+
+int db_stmt_bind(db_stmt_t *stmt, unsigned int idx, db_type_e type,
+                 const db_type_u *value_ptr)
+{
+    MYSQL_BIND *b;
+    db_type_u *v;
+
+    if (idx >= stmt->nb_params) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Parameter index %u is out of "
+                   "range for statement '%s'", idx, stmt->query);
+        return DB_INVALID_ARG;
+    }
+
+    b = &stmt->params[idx];
+    v = &stmt->param_vals[idx];
+    memset(b, 0, sizeof(*b));
+
+    switch (type) {
+    case DB_TEXT:
+    case DB_ENUM_FTYPE:
+        return bind_string(stmt, idx, value_ptr->val_str);
+
+    case DB_INT:
+    case DB_UINT:
+        *v = *value_ptr;
+        b->buffer_type = MYSQL_TYPE_LONG;
+        b->buffer = &v->val_int;
+        b->is_unsigned = (type == DB_UINT);
+        break;
+
+    case DB_SHORT:
+    case DB_USHORT:
+        *v = *value_ptr;
+        b->buffer_type = MYSQL_TYPE_SHORT;
+        b->buffer = &v->val_short;
+        b->is_unsigned = (type == DB_USHORT);
+        break;
+
+    case DB_BIGINT:
+    case DB_BIGUINT:
+        *v = *value_ptr;
+        b->buffer_type = MYSQL_TYPE_LONGLONG;
+        b->buffer = &v->val_bigint;
+        b->is_unsigned = (type == DB_BIGUINT);
+        break;
+
+    case DB_BOOL:
+        v->val_int = value_ptr->val_bool ? 1 : 0;
+        b->buffer_type = MYSQL_TYPE_LONG;
+        b->buffer = &v->val_int;
+        break;
+
+    case DB_ID:
+    case DB_UIDGID:
+    case DB_STRIPE_INFO:
+    case DB_STRIPE_ITEMS:
+        RBH_BUG("Unsupported DB type");
+    }
+    return DB_SUCCESS;
+}
+
+/** allocate result buffers the first time the statement is executed */
+static int stmt_alloc_cols(db_stmt_t *s)
+{
+    unsigned int i;
+
+    s->nb_cols = mysql_stmt_field_count(s->stmt);
+    if (s->nb_cols == 0)
+        return DB_SUCCESS;
+
+    s->cols = MemCalloc(s->nb_cols, sizeof(MYSQL_BIND));
+    s->col_bufs = MemCalloc(s->nb_cols, sizeof(char *));
+    s->col_lens = MemCalloc(s->nb_cols, sizeof(unsigned long));
+    s->col_null = MemCalloc(s->nb_cols, sizeof(my_bool));
+    s->col_err = MemCalloc(s->nb_cols, sizeof(my_bool));
+    if (!s->cols || !s->col_bufs || !s->col_lens || !s->col_null
+        || !s->col_err)
+        return DB_NO_MEMORY;
+
+    for (i = 0; i < s->nb_cols; i++) {
+        s->col_bufs[i] = MemAlloc(STMT_COL_BUF_SZ);
+        if (s->col_bufs[i] == NULL)
+            return DB_NO_MEMORY;
+
+        s->cols[i].buffer_type = MYSQL_TYPE_STRING;
+        s->cols[i].buffer = s->col_bufs[i];
+        /* keep room for the terminating null char */
+        s->cols[i].buffer_length = STMT_COL_BUF_SZ - 1;
+        s->cols[i].length = &s->col_lens[i];
+        s->cols[i].is_null = &s->col_null[i];
+        s->cols[i].error = &s->col_err[i];
+    }
+    return DB_SUCCESS;
+}
+
+int db_stmt_exec(db_conn_t *conn, db_stmt_t *stmt, bool with_result)
+{
+    int rc;
+
+    if (stmt->nb_params > 0 && mysql_stmt_bind_param(stmt->stmt, stmt->params))
+        return stmt_error(stmt, "binding parameters of");
+
+    if (mysql_stmt_execute(stmt->stmt))
+        return stmt_error(stmt, "executing");
+
+    if (!with_result)
+        return DB_SUCCESS;
+
+    if (stmt->cols == NULL) {
+        rc = stmt_alloc_cols(stmt);
+        if (rc) {
+            stmt_free_cols(stmt);
+            mysql_stmt_free_result(stmt->stmt);
+            return rc;
+        }
+    }
+
+    if (stmt->nb_cols > 0
+        && mysql_stmt_bind_result(stmt->stmt, stmt->cols))
+        return stmt_error(stmt, "binding result of");
+
+    /* fetch results to the client, so other requests can be issued
+     * before the result is released */
+    if (mysql_stmt_store_result(stmt->stmt))
+        return stmt_error(stmt, "fetching result of");
+
+    return DB_SUCCESS;
+}
+
+int db_stmt_next_record(db_conn_t *conn, db_stmt_t *stmt, char *outtab[],
+                        unsigned int outtabsize)
+{
+    unsigned int i;
+    int rc;
+
+    for (i = 0; i < outtabsize; i++)
+        outtab[i] = NULL;
+
+    rc = mysql_stmt_fetch(stmt->stmt);
+    if (rc == MYSQL_NO_DATA)
+        return DB_END_OF_LIST;
+    else if (rc == 1)
+        return stmt_error(stmt, "fetching record of");
+
+    if (rc == MYSQL_DATA_TRUNCATED) {
+        bool rebind = false;
+
+        /* enlarge buffers of truncated columns and fetch them again */
+        for (i = 0; i < stmt->nb_cols; i++) {
+            MYSQL_BIND *b = &stmt->cols[i];
+
+            if (!stmt->col_err[i])
+                continue;
+
+            MemFree(stmt->col_bufs[i]);
+            stmt->col_bufs[i] = MemAlloc(stmt->col_lens[i] + 1);
+            if (stmt->col_bufs[i] == NULL) {
+                b->buffer = NULL;
+                b->buffer_length = 0;
+                return DB_NO_MEMORY;
+            }
+            b->buffer = stmt->col_bufs[i];
+            b->buffer_length = stmt->col_lens[i];
+            rebind = true;
+
+            if (mysql_stmt_fetch_column(stmt->stmt, b, i, 0))
+                return stmt_error(stmt, "fetching column of");
+        }
+        if (rebind && mysql_stmt_bind_result(stmt->stmt, stmt->cols))
+            return stmt_error(stmt, "binding result of");
+    }
+
+    for (i = 0; i < outtabsize && i < stmt->nb_cols; i++) {
+        if (stmt->col_null[i])
+            continue;
+        stmt->col_bufs[i][stmt->col_lens[i]] = '\0';
+        outtab[i] = stmt->col_bufs[i];
+    }
+
+    if (stmt->nb_cols > outtabsize) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                   "Output array too small: size = %u, num_fields = %u",
+                   outtabsize, stmt->nb_cols);
+        return DB_BUFFER_TOO_SMALL;
+    }
+    return DB_SUCCESS;
+}
+
+void db_stmt_free_result(db_conn_t *conn, db_stmt_t *stmt)
+{
+    mysql_stmt_free_result(stmt->stmt);
+}
+
+void db_stmt_close(db_conn_t *conn, db_stmt_t *stmt)
+{
+    mysql_stmt_close(stmt->stmt);
+    db_stmt_free(stmt);
+}
+
+unsigned long db_session_id(db_conn_t *conn)
+{
+    return mysql_thread_id(conn);
+}
+
 int db_list_table_info(db_conn_t *conn, const char *table,
                        char **field_tab, char **type_tab, char **default_tab,
                        unsigned int outtabsize,
@@ -380,6 +772,22 @@ int db_escape_string(db_conn_t *conn, char *str_out, size_t out_size,
     return DB_SUCCESS;
 }
 
+void db_append_binary(db_conn_t *conn, GString *req, const void *buf,
+                      size_t len)
+{
+    size_t start;
+    unsigned long n;
+
+    g_string_append(req, "_binary'");
+    start = req->len;
+
+    /* worst case: every byte is escaped */
+    g_string_set_size(req, start + 2 * len + 1);
+    n = mysql_real_escape_string(conn, req->str + start, buf, len);
+    g_string_set_size(req, start + n);
+    g_string_append_c(req, '\'');
+}
+
 /* remove a database component (table, trigger, function, ...) */
 int db_drop_component(db_conn_t *conn, db_object_e obj_type, const char *name)
 {
@@ -505,13 +913,72 @@ int db_check_component(db_conn_t *conn, db_object_e obj_type, const char *name,
         } else
             rc = DB_NOT_EXISTS;
 
+        mysql_free_result(result);
+        return rc;
+    } else if (obj_type == DBOBJ_INDEX) {
+        if (arg != NULL)
+            snprintf(query, sizeof(query), "SELECT DISTINCT INDEX_NAME FROM "
+                     "INFORMATION_SCHEMA.STATISTICS WHERE TABLE_SCHEMA='%s' "
+                     "AND TABLE_NAME='%s' AND INDEX_NAME='%s'",
+                     lmgr_config.db_config.db, arg, name);
+        else
+            snprintf(query, sizeof(query), "SELECT DISTINCT INDEX_NAME FROM "
+                     "INFORMATION_SCHEMA.STATISTICS WHERE TABLE_SCHEMA='%s' "
+                     "AND INDEX_NAME='%s'", lmgr_config.db_config.db, name);
+
+        rc = _db_exec_sql(conn, query, &result, false);
+        if (rc)
+            return rc;
+
+        if (!result) {
+            DisplayLog(LVL_DEBUG, LISTMGR_TAG, "%s does not exist", name);
+            return DB_NOT_EXISTS;
+        }
+
+        row = mysql_fetch_row(result);
+        if (row) {
+            DisplayLog(LVL_FULL, LISTMGR_TAG, "Index %s exists", name);
+            rc = DB_SUCCESS;
+        } else
+            rc = DB_NOT_EXISTS;
+
         mysql_free_result(result);
         return rc;
     } else {
-        RBH_BUG("Only triggers are supported for now");
+        RBH_BUG("Only triggers, functions and indexes are supported for now");
     }
 }
 
+int db_load_file(db_conn_t *conn, const char *path, const char *table,
+                 const char *fields, const char *set_field,
+                 const char *set_expr)
+{
+    GString *query;
+    char *esc_path;
+    int len = 2 * strlen(path) + 1;
+    int rc;
+
+    esc_path = MemAlloc(len);
+    if (esc_path == NULL)
+        return DB_NO_MEMORY;
+    db_escape_string(conn, esc_path, len, path);
+
+    /* the file is read by the client library and sent to the server */
+    query = g_string_new(NULL);
+    g_string_printf(query, "LOAD DATA LOCAL INFILE '%s' REPLACE INTO TABLE %s"
+                    " FIELDS TERMINATED BY '\\t' ESCAPED BY '\\\\'"
+                    " LINES TERMINATED BY '\\n' (%s)", esc_path, table,
+                    fields);
+    if (set_field != NULL)
+        g_string_append_printf(query, " SET %s=%s", set_field, set_expr);
+
+    rc = _db_exec_sql(conn, query->str, NULL, false);
+
+    g_string_free(query, TRUE);
+    MemFree(esc_path);
+    return rc;
+}
+
 /* create a trigger */
 int db_create_trigger(db_conn_t *conn, const char *name, const char *event,
                       const char *table, const char *body)
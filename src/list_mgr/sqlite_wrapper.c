@@ -19,8 +19,14 @@
 #include "list_mgr.h"
 #include "database.h"
 #include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+
+/** time SQLite waits for a lock before returning SQLITE_BUSY (ms) */
+#define LOCK_WAIT_MS 100
 
 static int sqlite_error_convert(int err)
 {
@@ -39,20 +45,32 @@ static int sqlite_error_convert(int err)
     }
 }
 
+bool db_is_retryable(int db_err)
+{
+    switch (db_err) {
+    case DB_CONNECT_FAILED:
+    case DB_DEADLOCK:  /* Note: the whole transaction must be retryed */
+        return true;
+    default:
+        return false;
+    }
+}
+
 static int db_is_busy_err(int rc)
 {
     /* sometimes, SQLITE_CANTOPEN meens the db is busy (locked)... */
     return (rc == SQLITE_BUSY) || (rc == SQLITE_CANTOPEN);
 }
 
-static int set_cache_size(sqlite3 *conn)
+static int set_pragma(sqlite3 *conn, const char *pragma)
 {
     int rc;
     char *errmsg;
 
-    rc = sqlite3_exec(conn, "PRAGMA cache_size=1000000", NULL, NULL, &errmsg);
+    rc = sqlite3_exec(conn, pragma, NULL, NULL, &errmsg);
     if (rc != SQLITE_OK) {
-        DisplayLog(LVL_CRIT, LISTMGR_TAG, "SQL error: %s", errmsg);
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "SQL error: %s: %s", pragma,
+                   errmsg);
         sqlite3_free(errmsg);
         return DB_REQUEST_FAILED;
     }
@@ -60,13 +78,57 @@ static int set_cache_size(sqlite3 *conn)
     return DB_SUCCESS;
 }
 
+/**
+ * Tune the connection for robinhood workload:
+ * - WAL journal: readers run concurrently with the writer, and commits
+ *   only append to the log (synchronous=NORMAL is safe in this mode),
+ * - memory-mapped I/O and a large page cache for reads,
+ * - temporary tables and indexes in memory.
+ */
+static int set_tuning(sqlite3 *conn)
+{
+    const db_config_t *cfg = &lmgr_config.db_config;
+    char pragma[256];
+    int rc;
+
+    snprintf(pragma, sizeof(pragma), "PRAGMA journal_mode=%s",
+             cfg->journal_mode);
+    rc = set_pragma(conn, pragma);
+    if (rc)
+        return rc;
+
+    snprintf(pragma, sizeof(pragma), "PRAGMA synchronous=%s",
+             cfg->synchronous);
+    rc = set_pragma(conn, pragma);
+    if (rc)
+        return rc;
+
+    snprintf(pragma, sizeof(pragma), "PRAGMA mmap_size=%llu",
+             cfg->mmap_size);
+    rc = set_pragma(conn, pragma);
+    if (rc)
+        return rc;
+
+    /* negative value: size in KiB */
+    snprintf(pragma, sizeof(pragma), "PRAGMA cache_size=-%llu",
+             cfg->cache_size / 1024);
+    rc = set_pragma(conn, pragma);
+    if (rc)
+        return rc;
+
+    return set_pragma(conn, "PRAGMA temp_store=MEMORY");
+}
+
 /* create client connection */
 int db_connect(db_conn_t *conn)
 {
     int rc;
 
     /* Connect to database */
-    rc = sqlite3_open(lmgr_config.db_config.filepath, conn);
+    /* each thread uses its own connection: no need for SQLite mutexes */
+    rc = sqlite3_open_v2(lmgr_config.db_config.filepath, conn,
+                         SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE
+                         | SQLITE_OPEN_NOMUTEX, NULL);
     if (rc != 0) {
         if (*conn) {
             DisplayLog(LVL_CRIT, LISTMGR_TAG,
@@ -82,7 +144,15 @@ int db_connect(db_conn_t *conn)
 
     DisplayLog(LVL_FULL, LISTMGR_TAG, "Logged on to database successfully");
 
-    set_cache_size(*conn);
+    /* let SQLite wait for locks before returning SQLITE_BUSY */
+    sqlite3_busy_timeout(*conn, LOCK_WAIT_MS);
+
+    rc = set_tuning(*conn);
+    if (rc) {
+        sqlite3_close(*conn);
+        *conn = NULL;
+        return rc;
+    }
 
     return DB_SUCCESS;
 }
@@ -199,6 +269,14 @@ int db_result_free(db_conn_t *conn, result_handle_t *p_result)
     return DB_SUCCESS;
 }
 
+int db_record_lengths(db_conn_t *conn, result_handle_t *p_result,
+                      unsigned long *lengths, unsigned int count)
+{
+    /* results are retrieved as strings (sqlite3_get_table):
+     * binary values are truncated at the first '\0' */
+    return DB_NOT_SUPPORTED;
+}
+
 /* retrieve number of records in result */
 int db_result_nb_records(db_conn_t *conn, result_handle_t *p_result)
 {
@@ -212,10 +290,10 @@ int db_close_conn(db_conn_t *conn)
     return DB_SUCCESS;
 }
 
-int db_list_table_fields(db_conn_t *conn, const char *table,
-                         char **outtab,
-                         unsigned int outtabsize, char *inbuffer,
-                         unsigned int inbuffersize)
+int db_list_table_info(db_conn_t *conn, const char *table,
+                       char **field_tab, char **type_tab, char **default_tab,
+                       unsigned int outtabsize,
+                       char *inbuffer, unsigned int inbuffersize)
 {
     char request[4096];
     char **result = NULL;
@@ -224,7 +302,7 @@ int db_list_table_fields(db_conn_t *conn, const char *table,
     int i, rc, curr_output;
     char *curr_ptr = inbuffer;
 
-    sprintf(request, "PRAGMA table_info(%s)", table);
+    snprintf(request, sizeof(request), "PRAGMA table_info(%s)", table);
 
     rc = sqlite3_get_table(*conn, request, &result, &rows, &cols, &errmsg);
 
@@ -242,20 +320,40 @@ int db_list_table_fields(db_conn_t *conn, const char *table,
             sqlite3_free(errmsg);
         if (result)
             sqlite3_free_table(result);
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG, "%s does not exist", table);
         return DB_NOT_EXISTS;
     }
 
-    /* init ouput tab */
-    for (i = 0; i < outtabsize; i++)
-        outtab[i] = NULL;
+    /* init ouput tabs */
+    for (i = 0; i < outtabsize; i++) {
+        field_tab[i] = NULL;
+        if (type_tab)
+            type_tab[i] = NULL;
+        if (default_tab)
+            default_tab[i] = NULL;
+    }
 
     curr_output = 0;
 
-    /* starting at 1 because first raw contains headers */
-    for (i = 1; i < rows + 1; i++) {
+    /* starting at 1 because first raw contains headers.
+     * columns are: cid, name, type, notnull, dflt_value, pk */
+    for (i = 1; i < rows + 1 && curr_output < outtabsize; i++) {
         strcpy(curr_ptr, result[1 + i * cols]);
-        outtab[curr_output] = curr_ptr;
+        field_tab[curr_output] = curr_ptr;
         curr_ptr += strlen(curr_ptr) + 1;
+
+        if (type_tab) {
+            strcpy(curr_ptr, result[2 + i * cols]);
+            type_tab[curr_output] = curr_ptr;
+            curr_ptr += strlen(curr_ptr) + 1;
+        }
+
+        if (default_tab && result[4 + i * cols] != NULL) {
+            strcpy(curr_ptr, result[4 + i * cols]);
+            default_tab[curr_output] = curr_ptr;
+            curr_ptr += strlen(curr_ptr) + 1;
+        }
+
         curr_output++;
     }
 
@@ -271,9 +369,447 @@ unsigned long long db_last_id(db_conn_t *conn)
 }
 
 /* escape a string in a SQL request */
-void db_escape_string(db_conn_t *conn, char *str_out, size_t out_size,
-                      const char *str_in)
+int db_escape_string(db_conn_t *conn, char *str_out, size_t out_size,
+                     const char *str_in)
 {
+    /* output size must be at least 2 x instrlen + 1 for the worst case */
+    if (out_size < 2 * strlen(str_in) + 1)
+        return DB_BUFFER_TOO_SMALL;
+
     /* using slqite3_snprintf with "%q" format, to escape strings */
-    sqlite3_snprintf(out_size, str_out, str_in);
+    sqlite3_snprintf(out_size, str_out, "%q", str_in);
+    return DB_SUCCESS;
+}
+
+void db_append_binary(db_conn_t *conn, GString *req, const void *buf,
+                      size_t len)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    const unsigned char *b = buf;
+    size_t i;
+
+    /* blob literal */
+    g_string_append(req, "x'");
+    for (i = 0; i < len; i++) {
+        g_string_append_c(req, hex_digits[b[i] >> 4]);
+        g_string_append_c(req, hex_digits[b[i] & 0xF]);
+    }
+    g_string_append_c(req, '\'');
+}
+
+/* remove a database component (table, trigger, ...) */
+int db_drop_component(db_conn_t *conn, db_object_e obj_type, const char *name)
+{
+    char query[1024];
+    int rc;
+
+    switch (obj_type) {
+    case DBOBJ_TABLE:
+    case DBOBJ_TRIGGER:
+    case DBOBJ_INDEX:
+        break;
+    default:
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Object type not supported in %s",
+                   __func__);
+        return DB_NOT_SUPPORTED;
+    }
+
+    /* mimic MySQL: report missing objects */
+    rc = db_check_component(conn, obj_type, name, NULL);
+    if (rc)
+        return rc;
+
+    snprintf(query, sizeof(query), "DROP %s IF EXISTS %s",
+             obj_type == DBOBJ_TABLE ? "TABLE" :
+             obj_type == DBOBJ_TRIGGER ? "TRIGGER" : "INDEX", name);
+    return db_exec_sql(conn, query, NULL);
+}
+
+/**
+ * check a component exists in the database
+ * \param arg depends on the object type: src table for triggers, NULL for
+ *            others.
+ */
+int db_check_component(db_conn_t *conn, db_object_e obj_type, const char *name,
+                       const char *arg)
+{
+    char query[1024];
+    result_handle_t result;
+    char *row[1];
+    int rc;
+
+    if (obj_type == DBOBJ_FUNCTION || obj_type == DBOBJ_PROC)
+        /* not stored in the database */
+        return DB_NOT_SUPPORTED;
+
+    snprintf(query, sizeof(query), "SELECT tbl_name FROM sqlite_master "
+             "WHERE type='%s' AND name='%s'", dbobj2str(obj_type), name);
+    rc = db_exec_sql(conn, query, &result);
+    if (rc)
+        return rc;
+
+    rc = db_next_record(conn, &result, row, 1);
+    if (rc == DB_END_OF_LIST) {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG, "%s does not exist", name);
+        rc = DB_NOT_EXISTS;
+    } else if (rc == DB_SUCCESS && arg != NULL
+               && (row[0] == NULL || strcmp(arg, row[0]))) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                   "%s %s is on wrong table: expected %s, got %s",
+                   dbobj2str(obj_type), name, arg, row[0] ? row[0] : "<null>");
+        rc = DB_BAD_SCHEMA;
+    }
+
+    db_result_free(conn, &result);
+    return rc;
+}
+
+/* create a trigger */
+int db_create_trigger(db_conn_t *conn, const char *name, const char *event,
+                      const char *table, const char *body)
+{
+    int rc;
+    GString *request = g_string_new("CREATE TRIGGER ");
+
+    g_string_append_printf(request, "%s %s ON %s FOR EACH ROW "
+                           "BEGIN %s END", name, event, table, body);
+    rc = db_exec_sql(conn, request->str, NULL);
+    g_string_free(request, TRUE);
+    return rc;
+}
+
+/** set transaction level (optimize performance or locking) */
+int db_transaction_level(db_conn_t *conn, what_trans_e what_tx,
+                         tx_level_e tx_level)
+{
+    /* SQLite transactions are always serializable,
+     * and WAL readers don't block the writer */
+    return DB_SUCCESS;
+}
+
+/* -------------------- Prepared statements ---------------- */
+
+struct db_stmt {
+    sqlite3_stmt   *stmt;
+    unsigned int    nb_cols;
+};
+
+int db_stmt_prepare(db_conn_t *conn, const char *query, db_stmt_t **p_stmt)
+{
+    db_stmt_t *s;
+    int rc;
+
+#ifdef _DEBUG_DB
+    DisplayLog(LVL_FULL, LISTMGR_TAG, "SQL prepare: %s", query);
+#endif
+
+    s = MemCalloc(1, sizeof(*s));
+    if (s == NULL)
+        return DB_NO_MEMORY;
+
+    do {
+        rc = sqlite3_prepare_v2(*conn, query, -1, &s->stmt, NULL);
+
+        if (db_is_busy_err(rc))
+            usleep(lmgr_config.db_config.retry_delay_microsec);
+    }
+    while (db_is_busy_err(rc));
+
+    if (rc != SQLITE_OK) {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG,
+                   "SQLite prepare failed (%d): %s: %s", rc,
+                   sqlite3_errmsg(*conn), query);
+        MemFree(s);
+        return sqlite_error_convert(rc);
+    }
+
+    s->nb_cols = sqlite3_column_count(s->stmt);
+    *p_stmt = s;
+    return DB_SUCCESS;
+}
+
+unsigned int db_stmt_param_count(db_stmt_t *stmt)
+{
+    return sqlite3_bind_parameter_count(stmt->stmt);
+}
+
+int db_stmt_bind(db_stmt_t *stmt, unsigned int idx, db_type_e type,
+                 const db_type_u *value_ptr)
+{
+    int rc = SQLITE_OK;
+
+    /* sqlite parameters start from 1 */
+    idx++;
+
+    switch (type) {
+    case DB_TEXT:
+    case DB_ENUM_FTYPE:
+        if (value_ptr->val_str == NULL)
+            rc = sqlite3_bind_null(stmt->stmt, idx);
+        else
+            rc = sqlite3_bind_text(stmt->stmt, idx, value_ptr->val_str, -1,
+                                   SQLITE_TRANSIENT);
+        break;
+    case DB_INT:
+        rc = sqlite3_bind_int(stmt->stmt, idx, value_ptr->val_int);
+        break;
+    case DB_UINT:
+        rc = sqlite3_bind_int64(stmt->stmt, idx, value_ptr->val_uint);
+        break;
+    case DB_SHORT:
+        rc = sqlite3_bind_int(stmt->stmt, idx, value_ptr->val_short);
+        break;
+    case DB_USHORT:
+        rc = sqlite3_bind_int(stmt->stmt, idx, value_ptr->val_ushort);
+        break;
+    case DB_BIGINT:
+        rc = sqlite3_bind_int64(stmt->stmt, idx, value_ptr->val_bigint);
+        break;
+    case DB_BIGUINT:
+        rc = sqlite3_bind_int64(stmt->stmt, idx, value_ptr->val_biguint);
+        break;
+    case DB_BOOL:
+        rc = sqlite3_bind_int(stmt->stmt, idx, value_ptr->val_bool ? 1 : 0);
+        break;
+    case DB_ID:
+    case DB_UIDGID:
+    case DB_STRIPE_INFO:
+    case DB_STRIPE_ITEMS:
+        RBH_BUG("Unsupported DB type");
+    }
+
+    return sqlite_error_convert(rc);
+}
+
+/** execute a step of a statement, retrying while the database is busy */
+static int stmt_step(db_conn_t *conn, db_stmt_t *stmt)
+{
+    int rc;
+
+    do {
+        rc = sqlite3_step(stmt->stmt);
+
+        if (db_is_busy_err(rc)) {
+            sqlite3_reset(stmt->stmt);
+            usleep(lmgr_config.db_config.retry_delay_microsec);
+        }
+    }
+    while (db_is_busy_err(rc));
+
+    return rc;
+}
+
+int db_stmt_exec(db_conn_t *conn, db_stmt_t *stmt, bool with_result)
+{
+    int rc;
+
+    /* results are read step by step by db_stmt_next_record() */
+    if (with_result)
+        return DB_SUCCESS;
+
+    rc = stmt_step(conn, stmt);
+    /* reset the statement so it can be executed again
+     * (parameter values are kept) */
+    sqlite3_reset(stmt->stmt);
+
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG,
+                   "SQLite statement failed (%d): %s: %s", rc,
+                   sqlite3_errmsg(*conn), sqlite3_sql(stmt->stmt));
+        return sqlite_error_convert(rc);
+    }
+    return DB_SUCCESS;
+}
+
+int db_stmt_next_record(db_conn_t *conn, db_stmt_t *stmt, char *outtab[],
+                        unsigned int outtabsize)
+{
+    unsigned int i;
+    int rc;
+
+    for (i = 0; i < outtabsize; i++)
+        outtab[i] = NULL;
+
+    rc = stmt_step(conn, stmt);
+    if (rc == SQLITE_DONE)
+        return DB_END_OF_LIST;
+    else if (rc != SQLITE_ROW) {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG,
+                   "SQLite statement failed (%d): %s: %s", rc,
+                   sqlite3_errmsg(*conn), sqlite3_sql(stmt->stmt));
+        return sqlite_error_convert(rc);
+    }
+
+    if (stmt->nb_cols > outtabsize)
+        return DB_BUFFER_TOO_SMALL;
+
+    /* values remain valid until the next step */
+    for (i = 0; i < stmt->nb_cols; i++)
+        outtab[i] = (char *)sqlite3_column_text(stmt->stmt, i);
+
+    return DB_SUCCESS;
+}
+
+void db_stmt_free_result(db_conn_t *conn, db_stmt_t *stmt)
+{
+    sqlite3_reset(stmt->stmt);
+}
+
+void db_stmt_close(db_conn_t *conn, db_stmt_t *stmt)
+{
+    sqlite3_finalize(stmt->stmt);
+    MemFree(stmt);
+}
+
+unsigned long db_session_id(db_conn_t *conn)
+{
+    /* local database: the connection is never re-established */
+    return 0;
+}
+
+/* -------------------- Bulk load ---------------- */
+
+/** unescape a field of a tab-separated file, in place
+ * @return false if the field is NULL */
+static bool tsv_unescape(char *field)
+{
+    char *r, *w;
+
+    if (!strcmp(field, "\\N"))
+        return false;
+
+    for (r = w = field; *r != '\0'; r++, w++) {
+        if (*r == '\\' && r[1] != '\0') {
+            r++;
+            switch (*r) {
+            case 't':
+                *w = '\t';
+                break;
+            case 'n':
+                *w = '\n';
+                break;
+            case 'r':
+                *w = '\r';
+                break;
+            default:
+                *w = *r;
+            }
+        } else
+            *w = *r;
+    }
+    *w = '\0';
+    return true;
+}
+
+/** build the insert statement of db_load_file() */
+static GString *load_query(const char *table, const char *fields,
+                           unsigned int nb_fields, const char *set_field,
+                           const char *set_expr)
+{
+    GString *query = g_string_new(NULL);
+    unsigned int i;
+
+    g_string_printf(query, "INSERT OR REPLACE INTO %s(%s", table, fields);
+
+    if (set_field == NULL) {
+        g_string_append(query, ") VALUES(");
+        for (i = 0; i < nb_fields; i++)
+            g_string_append(query, i == 0 ? "?" : ",?");
+        g_string_append(query, ")");
+    } else {
+        /* set_expr refers to the loaded fields by their name */
+        gchar **names = g_strsplit(fields, ",", -1);
+
+        g_string_append_printf(query, ",%s) SELECT %s,%s FROM (SELECT ",
+                               set_field, fields, set_expr);
+        for (i = 0; i < nb_fields; i++)
+            g_string_append_printf(query, "%s? AS %s", i == 0 ? "" : ",",
+                                   names[i]);
+        g_string_append(query, ")");
+        g_strfreev(names);
+    }
+    return query;
+}
+
+/* SQLite has no LOAD DATA: insert the rows in a single transaction,
+ * with a prepared statement */
+int db_load_file(db_conn_t *conn, const char *path, const char *table,
+                 const char *fields, const char *set_field,
+                 const char *set_expr)
+{
+    GString *query;
+    db_stmt_t *stmt = NULL;
+    unsigned int nb_fields = 1;
+    unsigned int line_nb = 0;
+    char *line = NULL;
+    size_t line_sz = 0;
+    ssize_t len;
+    const char *c;
+    FILE *f;
+    int rc;
+
+    for (c = fields; *c != '\0'; c++)
+        if (*c == ',')
+            nb_fields++;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        rc = errno;
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to open %s: %s", path,
+                   strerror(rc));
+        return DB_IO_ERROR;
+    }
+
+    query = load_query(table, fields, nb_fields, set_field, set_expr);
+    rc = db_stmt_prepare(conn, query->str, &stmt);
+    g_string_free(query, TRUE);
+    if (rc)
+        goto close_file;
+
+    rc = db_exec_sql(conn, BEGIN_TX, NULL);
+    if (rc)
+        goto close_stmt;
+
+    while ((len = getline(&line, &line_sz, f)) != -1) {
+        char *field, *next;
+        unsigned int i;
+        db_type_u u;
+
+        line_nb++;
+        if (len > 0 && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+
+        for (i = 0, field = line; i < nb_fields; i++, field = next) {
+            if (field == NULL) {
+                DisplayLog(LVL_CRIT, LISTMGR_TAG, "%s:%u: %u fields "
+                           "expected", path, line_nb, nb_fields);
+                rc = DB_INVALID_ARG;
+                goto rollback;
+            }
+            next = strchr(field, '\t');
+            if (next != NULL)
+                *(next++) = '\0';
+
+            u.val_str = tsv_unescape(field) ? field : NULL;
+            rc = db_stmt_bind(stmt, i, DB_TEXT, &u);
+            if (rc)
+                goto rollback;
+        }
+
+        rc = db_stmt_exec(conn, stmt, false);
+        if (rc)
+            goto rollback;
+    }
+
+    rc = db_exec_sql(conn, "COMMIT", NULL);
+    goto close_stmt;
+
+ rollback:
+    db_exec_sql(conn, "ROLLBACK", NULL);
+ close_stmt:
+    db_stmt_close(conn, stmt);
+ close_file:
+    free(line);
+    fclose(f);
+    return rc;
 }
@@ -200,6 +200,13 @@ static action_scheduler_t sched_mpr = {
 
 /** scheduler defined in sched_ratelimit.c */
 extern action_scheduler_t sched_tbf;
+/** schedulers defined in sched_fair.c */
+#ifdef _LUSTRE
+extern action_scheduler_t sched_fair_ost;
+extern action_scheduler_t sched_fair_pool;
+#endif
+extern action_scheduler_t sched_fair_user;
+extern action_scheduler_t sched_fair_class;
 
 /** get a common scheduler by name */
 action_scheduler_t *mod_get_scheduler(const char *sched_name)
@@ -208,6 +215,16 @@ action_scheduler_t *mod_get_scheduler(const char *sched_name)
         return &sched_mpr;
     else if (strcmp(sched_name, "common.rate_limit") == 0)
         return &sched_tbf;
+#ifdef _LUSTRE
+    else if (strcmp(sched_name, "common.fair_ost") == 0)
+        return &sched_fair_ost;
+    else if (strcmp(sched_name, "common.fair_pool") == 0)
+        return &sched_fair_pool;
+#endif
+    else if (strcmp(sched_name, "common.fair_user") == 0)
+        return &sched_fair_user;
+    else if (strcmp(sched_name, "common.fair_class") == 0)
+        return &sched_fair_class;
 
     return NULL;
 }
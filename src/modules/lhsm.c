@@ -27,6 +27,7 @@
 #include "db_schema.h" /* for common robinhood types: entry_id_t,
                           stripe_info_t... */
 #include "status_manager.h"
+#include "lhsm_batch.h"
 
 #include <stdbool.h>
 #include <glib.h>
@@ -39,6 +40,8 @@
 #define LHSM_TAG "lhsm"
 
 #define DEFAULT_ARCHIVE_ID  0
+#define DEFAULT_BATCH_SIZE  1 /* no batching */
+#define DEFAULT_BATCH_TIMEOUT_MS  100
 #define ARCHIVE_PARAM "archive_id"
 
 /* Length of a UUID as a string, without trailing NUL. */
@@ -49,6 +52,11 @@ typedef struct lhsm_config_t {
 
     char uuid_xattr[XATTR_NAME_MAX + 1];
     bool strict_uuid;
+
+    /* max entries per HSM request */
+    int batch_size;
+    /* max time to wait for entries to fill a request */
+    int batch_timeout_ms;
 } lhsm_config_t;
 
 /* lhsm config is global as the status manager is shared */
@@ -113,13 +121,69 @@ static int lhsm_init(struct sm_instance *smi, run_flags_t flags)
     return init_action_global_info();
 }
 
+/** Send an HSM request for a set of entries */
+static int lhsm_send_request(int action, unsigned int archive_id,
+                             const char *data, int data_len,
+                             const entry_id_t *ids, unsigned int count)
+{
+    struct hsm_user_request *req;
+    char *mpath;
+    unsigned int i;
+    int rc;
+
+    req = llapi_hsm_user_request_alloc(count, data_len);
+    if (!req) {
+        rc = -errno;
+        DisplayLog(LVL_CRIT, LHSM_TAG, "Cannot create HSM request: %s",
+                   strerror(-rc));
+        return rc;
+    }
+
+    req->hur_request.hr_action = action;
+    req->hur_request.hr_archive_id = archive_id;
+    req->hur_request.hr_flags = 0;
+
+    for (i = 0; i < count; i++) {
+        req->hur_user_item[i].hui_fid = ids[i];
+        req->hur_user_item[i].hui_extent.offset = 0;
+        /* XXX for now, always transfer entire file */
+        req->hur_user_item[i].hui_extent.length = -1LL;
+    }
+
+    req->hur_request.hr_itemcount = count;
+    req->hur_request.hr_data_len = data_len;
+
+    if (data)
+        memcpy(hur_data(req), data, data_len);
+
+    /* make tmp copy as llapi_hsm_request arg is not const */
+    mpath = strdup(get_mount_point(NULL));
+    rc = llapi_hsm_request(mpath, req);
+    free(mpath);
+    free(req);
+
+    if (rc == 0)
+        return 0;
+
+    if (count == 1)
+        DisplayLog(LVL_CRIT, LHSM_TAG,
+                   "ERROR performing HSM request(%s, root=%s, fid=" DFID
+                   "): %s", hsm_user_action2name(action), get_mount_point(NULL),
+                   PFID(&ids[0]), strerror(-rc));
+    else
+        /* each entry is sent again to get its status */
+        DisplayLog(LVL_EVENT, LHSM_TAG,
+                   "HSM request(%s, root=%s) failed for %u entries: %s",
+                   hsm_user_action2name(action), get_mount_point(NULL), count,
+                   strerror(-rc));
+    return rc;
+}
+
 /** Trigger an HSM action */
 static int lhsm_action(enum hsm_user_action action, const entry_id_t *p_id,
                        const attr_set_t *attrs, const action_params_t *params)
 {
-    struct hsm_user_request *req;
     int rc;
-    char *mpath;
     unsigned int archive_id = DEFAULT_ARCHIVE_ID;   /* default */
     GString *args = NULL;
     const char *data = NULL;
@@ -169,40 +233,10 @@ static int lhsm_action(enum hsm_user_action action, const entry_id_t *p_id,
                "action %s, fid=" DFID ", archive_id=%u, parameters='%s'",
                hsm_user_action2name(action), PFID(p_id), archive_id, args->str);
 
-    req = llapi_hsm_user_request_alloc(1, data_len);
-    if (!req) {
-        rc = -errno;
-        DisplayLog(LVL_CRIT, LHSM_TAG, "Cannot create HSM request: %s",
-                   strerror(-rc));
-        goto free_args;
-    }
-
-    req->hur_request.hr_action = action;
-    req->hur_request.hr_archive_id = archive_id;
-    req->hur_request.hr_flags = 0;
-
-    req->hur_user_item[0].hui_fid = *p_id;
-    req->hur_user_item[0].hui_extent.offset = 0;
-    /* XXX for now, always transfer entire file */
-    req->hur_user_item[0].hui_extent.length = -1LL;
-
-    req->hur_request.hr_itemcount = 1;
-    req->hur_request.hr_data_len = data_len;
-
-    if (data)
-        memcpy(hur_data(req), data, data_len);
-
-    /* make tmp copy as llapi_hsm_request arg is not const */
-    mpath = strdup(get_mount_point(NULL));
-    rc = llapi_hsm_request(mpath, req);
-    free(mpath);
-    free(req);
+    rc = hsm_batch_request(lhsm_send_request, action, archive_id, data,
+                           data_len, p_id, config.batch_size,
+                           config.batch_timeout_ms);
 
-    if (rc)
-        DisplayLog(LVL_CRIT, LHSM_TAG,
-                   "ERROR performing HSM request(%s, root=%s, fid=" DFID
-                   "): %s", hsm_user_action2name(action), get_mount_point(NULL),
-                   PFID(p_id), strerror(-rc));
  free_args:
     g_string_free(args, TRUE);
     return rc;
@@ -942,6 +976,9 @@ static void lhsm_cfg_set_default(void *module_config)
 
     conf->uuid_xattr[0] = 0;
     conf->strict_uuid = true;
+
+    conf->batch_size = DEFAULT_BATCH_SIZE;
+    conf->batch_timeout_ms = DEFAULT_BATCH_TIMEOUT_MS;
 }
 
 #define UUID_CONFIG_BLOCK "uuid"
@@ -950,6 +987,8 @@ static void lhsm_cfg_write_default(FILE *output)
 {
     print_begin_block(output, 0, LHSM_BLOCK, NULL);
     print_line(output, 1, "rebind_cmd: " DEFAULT_REBIND_CMD);
+    print_line(output, 1, "batch_size: %d (no batching)", DEFAULT_BATCH_SIZE);
+    print_line(output, 1, "batch_timeout_ms: %d", DEFAULT_BATCH_TIMEOUT_MS);
     print_begin_block(output, 1, UUID_CONFIG_BLOCK, NULL);
     print_line(output, 2, "xattr = \"\" (disabled)");
     print_line(output, 2, "strict_uuid = yes");
@@ -970,6 +1009,10 @@ static int lhsm_cfg_read(config_file_t config, void *module_config,
     const cfg_param_t hsm_params[] = {
         /* rebind_cmd can contain wildcards: {fsroot} {oldfid} {newfid}... */
         {"rebind_cmd", PT_CMD, 0, &conf->rebind_cmd, 0},
+        {"batch_size", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->batch_size, 0},
+        {"batch_timeout_ms", PT_INT, PFLG_POSITIVE, &conf->batch_timeout_ms,
+         0},
         END_OF_PARAMS
     };
 
@@ -984,7 +1027,7 @@ static int lhsm_cfg_read(config_file_t config, void *module_config,
     };
 
     static const char *allowed_params[] = {
-        "rebind_cmd", "uuid", NULL
+        "rebind_cmd", "batch_size", "batch_timeout_ms", "uuid", NULL
     };
 
     /* get lhsm_config block */
@@ -1027,6 +1070,13 @@ static void lhsm_cfg_write_template(FILE *output)
     print_line(output, 1, "rebind_cmd = \"lhsmtool_posix "
                "--archive={archive_id} --hsm_root=/tmp/backend "
                "--rebind {oldfid} {newfid} {fsroot}\";");
+    print_line(output, 1, "# send up to 16 entries per HSM request, "
+               "if they are processed at the same time");
+    print_line(output, 1, "# (should not exceed the number of policy "
+               "threads)");
+    print_line(output, 1, "batch_size = 16;");
+    print_line(output, 1, "# max time to wait for other entries");
+    print_line(output, 1, "batch_timeout_ms = 100;");
     print_begin_block(output, 1, UUID_CONFIG_BLOCK, NULL);
     print_line(output, 2, "xattr = \"trusted.lhsm.uuid\";");
     print_line(output, 2, "# enforce UUID-length of 36 bytes");
@@ -1061,6 +1111,20 @@ static int lhsm_cfg_set(void *cfg, bool reload)
                    "but cannot be changed dynamically");
     }
 
+    /* batching parameters are read for each action */
+    if (new->batch_size != config.batch_size) {
+        DisplayLog(LVL_EVENT, LHSM_TAG, LHSM_BLOCK
+                   "::batch_size updated: %d->%d", config.batch_size,
+                   new->batch_size);
+        config.batch_size = new->batch_size;
+    }
+    if (new->batch_timeout_ms != config.batch_timeout_ms) {
+        DisplayLog(LVL_EVENT, LHSM_TAG, LHSM_BLOCK
+                   "::batch_timeout_ms updated: %d->%d",
+                   config.batch_timeout_ms, new->batch_timeout_ms);
+        config.batch_timeout_ms = new->batch_timeout_ms;
+    }
+
     return 0;
 }
 
@@ -0,0 +1,205 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "lhsm_batch.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "list.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#define BATCH_TAG "lhsm"
+
+/** entries to be sent in a single request */
+struct hsm_batch {
+    struct rh_list_head list;       /**< in open_batches */
+    int                 action;
+    unsigned int        archive_id;
+    char               *data;
+    int                 data_len;
+
+    entry_id_t         *ids;
+    unsigned int        count;
+    unsigned int        size;
+
+    struct timespec     deadline;   /**< send time if not full */
+    bool                open;       /**< can take new entries */
+    bool                sent;
+    int                 rc;         /**< status of the request */
+    unsigned int        users;      /**< threads waiting for the request */
+    pthread_cond_t      cond;
+};
+
+/** protects open_batches and all batches */
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+/** batches waiting for more entries */
+static struct rh_list_head open_batches = { &open_batches, &open_batches };
+
+static struct hsm_batch *batch_find(int action, unsigned int archive_id,
+                                    const char *data, int data_len)
+{
+    struct hsm_batch *b;
+
+    rh_list_for_each_entry(b, &open_batches, list) {
+        if (b->action == action && b->archive_id == archive_id
+            && b->data_len == data_len
+            && (data_len == 0 || !memcmp(b->data, data, data_len)))
+            return b;
+    }
+    return NULL;
+}
+
+static void batch_free(struct hsm_batch *b)
+{
+    pthread_cond_destroy(&b->cond);
+    free(b->data);
+    free(b->ids);
+    free(b);
+}
+
+static struct hsm_batch *batch_new(int action, unsigned int archive_id,
+                                   const char *data, int data_len,
+                                   unsigned int size, unsigned int timeout_ms)
+{
+    struct hsm_batch *b;
+
+    b = calloc(1, sizeof(*b));
+    if (!b)
+        return NULL;
+
+    b->ids = calloc(size, sizeof(*b->ids));
+    if (!b->ids)
+        goto err_free;
+
+    if (data_len > 0) {
+        b->data = malloc(data_len);
+        if (!b->data)
+            goto err_free;
+        memcpy(b->data, data, data_len);
+    }
+
+    b->action = action;
+    b->archive_id = archive_id;
+    b->data_len = data_len;
+    b->size = size;
+    b->open = true;
+    pthread_cond_init(&b->cond, NULL);
+
+    clock_gettime(CLOCK_REALTIME, &b->deadline);
+    b->deadline.tv_sec += timeout_ms / 1000;
+    b->deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (b->deadline.tv_nsec >= 1000000000L) {
+        b->deadline.tv_sec++;
+        b->deadline.tv_nsec -= 1000000000L;
+    }
+
+    rh_list_add_tail(&b->list, &open_batches);
+    return b;
+
+err_free:
+    free(b->ids);
+    free(b);
+    return NULL;
+}
+
+/** Send a batch and wake up its users.
+ * Must be called with batch_lock held (released while sending). */
+static void batch_send(struct hsm_batch *b, hsm_send_func_t send)
+{
+    int rc;
+
+    b->open = false;
+    rh_list_del(&b->list);
+    pthread_mutex_unlock(&batch_lock);
+
+    DisplayLog(LVL_FULL, BATCH_TAG, "Sending HSM request for %u entries",
+               b->count);
+    rc = send(b->action, b->archive_id, b->data, b->data_len, b->ids,
+              b->count);
+
+    pthread_mutex_lock(&batch_lock);
+    b->rc = rc;
+    b->sent = true;
+    pthread_cond_broadcast(&b->cond);
+}
+
+int hsm_batch_request(hsm_send_func_t send, int action,
+                      unsigned int archive_id, const char *data,
+                      int data_len, const entry_id_t *id,
+                      unsigned int batch_size, unsigned int timeout_ms)
+{
+    struct hsm_batch *b;
+    unsigned int count;
+    int rc;
+
+    if (batch_size <= 1)
+        return send(action, archive_id, data, data_len, id, 1);
+
+    pthread_mutex_lock(&batch_lock);
+
+    b = batch_find(action, archive_id, data, data_len);
+    if (b == NULL) {
+        b = batch_new(action, archive_id, data, data_len, batch_size,
+                      timeout_ms);
+        if (b == NULL) {
+            pthread_mutex_unlock(&batch_lock);
+            return send(action, archive_id, data, data_len, id, 1);
+        }
+    }
+
+    b->ids[b->count] = *id;
+    b->count++;
+    b->users++;
+
+    if (b->count >= b->size)
+        batch_send(b, send);
+
+    while (!b->sent) {
+        if (b->open) {
+            /* the first user that reaches the deadline sends the batch */
+            if (pthread_cond_timedwait(&b->cond, &batch_lock, &b->deadline)
+                    == ETIMEDOUT && b->open)
+                batch_send(b, send);
+        } else {
+            pthread_cond_wait(&b->cond, &batch_lock);
+        }
+    }
+
+    rc = b->rc;
+    count = b->count;
+    b->users--;
+    if (b->users == 0)
+        batch_free(b);
+
+    pthread_mutex_unlock(&batch_lock);
+
+    /* the request is for all entries, or none:
+     * resend this one alone to get its own status */
+    if (rc != 0 && count > 1) {
+        DisplayLog(LVL_DEBUG, BATCH_TAG, "HSM request for %u entries "
+                   "failed (%s): sending entry " DFID " alone", count,
+                   strerror(-rc), PFID(id));
+        rc = send(action, archive_id, data, data_len, id, 1);
+    }
+
+    return rc;
+}
@@ -0,0 +1,52 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file lhsm_batch.h
+ * \brief Gather the HSM requests of concurrent actions.
+ *
+ * Entries sent at the same time with the same action, archive_id and
+ * parameters are grouped into a single request. The request is sent when
+ * it has 'batch_size' entries, or after 'timeout_ms'. Each caller waits
+ * for the request of its entry, and gets its own status.
+ *
+ * This is independent from liblustreapi: requests are sent by the given
+ * function, so this can be tested without Lustre.
+ */
+#ifndef LHSM_BATCH_H
+#define LHSM_BATCH_H
+
+#include "list_mgr.h"
+
+/**
+ * Function to send an HSM request for a set of entries.
+ * @return 0 on success, a negative error code on failure.
+ */
+typedef int (*hsm_send_func_t)(int action, unsigned int archive_id,
+                               const char *data, int data_len,
+                               const entry_id_t *ids, unsigned int count);
+
+/**
+ * Send an HSM request for an entry, in a batch with other entries.
+ * @param send       Function to send the requests.
+ * @param data       Request data (action parameters), can be NULL.
+ * @param batch_size Max entries per request.
+ * @param timeout_ms Max time to wait for other entries.
+ * @return The status of the request for this entry.
+ */
+int hsm_batch_request(hsm_send_func_t send, int action,
+                      unsigned int archive_id, const char *data,
+                      int data_len, const entry_id_t *id,
+                      unsigned int batch_size, unsigned int timeout_ms);
+
+#endif
@@ -0,0 +1,698 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Fair share schedulers: entries are queued by target (OST, pool, user or
+ * fileclass), and the actions are submitted by a pool of threads that
+ * serves the targets in deficit round-robin, with a limit of running
+ * actions per target. This limit can be adjusted according to the
+ * duration of actions (when max_latency_ms is set), so that a slow target
+ * only holds a few threads.
+ *
+ * The duration of an action is only known when the scheduler is the last
+ * one of the stack: else, it is the time to submit the entry to the next
+ * scheduler.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "mod_internal.h"
+#include "policy_run.h"
+#include "global_config.h"
+#include "rbh_misc.h"
+#include "list.h"
+
+#include <glib.h>
+#include <pthread.h>
+#include <time.h>
+
+/** attribute the entries are queued by */
+typedef enum {
+    FAIR_KEY_OST,   /**< OST index of the first stripe */
+    FAIR_KEY_POOL,  /**< OST pool */
+    FAIR_KEY_USER,  /**< owner */
+    FAIR_KEY_CLASS, /**< fileclass */
+} fair_key_e;
+
+#define FAIR_DEFAULT_THREADS        8
+#define FAIR_DEFAULT_MAX_PER_KEY    2
+#define FAIR_DEFAULT_MAX_QUEUED     10000
+
+/** max length of a queue key */
+#define FAIR_KEY_MAX    1024
+
+/** fair share scheduler configuration */
+typedef struct sched_fair_config {
+    fair_key_e  key;            /**< depends on the scheduler flavor */
+    int         nb_threads;
+    int         max_per_key;    /**< max running actions per key */
+    int         max_queued;     /**< max waiting entries (all keys) */
+    int         max_key_queued; /**< max waiting entries per key */
+    ull_t       quantum;        /**< volume granted to a key per round
+                                     (0 to count actions) */
+    int         max_latency_ms; /**< target action duration */
+} sched_fair_config_t;
+
+/** an entry waiting for its action */
+struct fair_item {
+    struct rh_list_head  list;
+    sched_cb_t           cb;
+    void                *udata;
+    ull_t                cost;
+};
+
+/** queue of a target */
+struct fair_key {
+    char                *name;
+    struct rh_list_head  items;     /**< waiting entries */
+    unsigned int         count;     /**< number of waiting entries */
+    struct rh_list_head  rr;        /**< position in the round-robin list */
+    bool                 is_active; /**< is in the round-robin list */
+    ull_t                deficit;
+    unsigned int         running;   /**< running actions */
+    unsigned int         cap;       /**< current limit of running actions */
+    unsigned int         done;      /**< actions since last cap update */
+    double               latency_ms;/**< smoothed duration of actions */
+};
+
+/** internal state for fair share scheduler */
+struct sched_fair_state {
+    sched_fair_config_t  cfg;
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond;
+    GHashTable          *keys;      /**< name => struct fair_key */
+    struct rh_list_head  rr;        /**< keys with waiting entries */
+    unsigned int         nb_active; /**< number of keys in rr */
+    unsigned int         queued;    /**< waiting entries (all keys) */
+    pthread_t           *threads;
+    int                  nb_threads;
+};
+
+static const char *fair_block_name(fair_key_e key)
+{
+    switch (key) {
+    case FAIR_KEY_OST:
+        return "fair_ost";
+    case FAIR_KEY_POOL:
+        return "fair_pool";
+    case FAIR_KEY_USER:
+        return "fair_user";
+    case FAIR_KEY_CLASS:
+        return "fair_class";
+    }
+    return "?";
+}
+
+/** Max running actions per key.
+ * No key can have more than the number of threads. */
+static unsigned int fair_max_cap(const sched_fair_config_t *cfg)
+{
+    if (cfg->max_per_key > 0 && cfg->max_per_key < cfg->nb_threads)
+        return cfg->max_per_key;
+    return cfg->nb_threads;
+}
+
+/** Get the queue key of an entry.
+ * Entries without the key attribute share the "" key. */
+static const char *fair_key_name(fair_key_e key, const attr_set_t *attrs,
+                                 char *buff, size_t size)
+{
+    buff[0] = '\0';
+    if (attrs == NULL)
+        return buff;
+
+    switch (key) {
+#ifdef _LUSTRE
+    case FAIR_KEY_OST:
+        if (ATTR_MASK_TEST(attrs, stripe_items)
+            && ATTR(attrs, stripe_items).count > 0)
+            snprintf(buff, size, "%u",
+                     ATTR(attrs, stripe_items).stripe[0].ost_idx);
+        break;
+    case FAIR_KEY_POOL:
+        if (ATTR_MASK_TEST(attrs, stripe_info))
+            rh_strncpy(buff, ATTR(attrs, stripe_info).pool_name, size);
+        break;
+#else
+    case FAIR_KEY_OST:
+    case FAIR_KEY_POOL:
+        break;
+#endif
+    case FAIR_KEY_USER:
+        if (!ATTR_MASK_TEST(attrs, uid))
+            break;
+        if (global_config.uid_gid_as_numbers)
+            snprintf(buff, size, "%d", ATTR(attrs, uid).num);
+        else
+            rh_strncpy(buff, ATTR(attrs, uid).txt, size);
+        break;
+    case FAIR_KEY_CLASS:
+        if (ATTR_MASK_TEST(attrs, fileclass))
+            rh_strncpy(buff, ATTR(attrs, fileclass), size);
+        break;
+    }
+    return buff;
+}
+
+static struct fair_key *fair_key_get(struct sched_fair_state *state,
+                                     const char *name)
+{
+    struct fair_key *key;
+
+    key = g_hash_table_lookup(state->keys, name);
+    if (key != NULL)
+        return key;
+
+    key = calloc(1, sizeof(*key));
+    if (!key)
+        return NULL;
+
+    key->name = strdup(name);
+    if (!key->name) {
+        free(key);
+        return NULL;
+    }
+    rh_list_init(&key->items);
+    key->cap = fair_max_cap(&state->cfg);
+
+    g_hash_table_insert(state->keys, key->name, key);
+    return key;
+}
+
+static void fair_key_free(gpointer ptr)
+{
+    struct fair_key *key = ptr;
+
+    free(key->name);
+    free(key);
+}
+
+/** remove a key from the round-robin list, once it has no waiting entry */
+static void fair_key_deactivate(struct sched_fair_state *state,
+                                struct fair_key *key)
+{
+    rh_list_del(&key->rr);
+    key->is_active = false;
+    key->deficit = 0;
+    state->nb_active--;
+}
+
+/**
+ * Take the next entry to be run, in deficit round-robin.
+ * The key at the head of the list runs its entries as long as its
+ * deficit allows it, then it gets a new quantum and goes to the tail.
+ * Keys that reached their limit of running actions are skipped.
+ * If no key can run its first entry after a round, all the rounds needed
+ * for that are granted at once (entries can be much larger than a quantum).
+ * @return NULL if there is no entry to run for now.
+ */
+static struct fair_item *fair_next(struct sched_fair_state *state,
+                                   struct fair_key **p_key)
+{
+    ull_t quantum = state->cfg.quantum > 0 ? state->cfg.quantum : 1;
+
+    while (1) {
+        struct fair_key *key;
+        bool runnable = false;
+        ull_t rounds = 0;
+        unsigned int i;
+
+        for (i = 0; i < state->nb_active; i++) {
+            struct fair_item *item;
+
+            key = rh_list_first_entry(&state->rr, struct fair_key, rr);
+            item = rh_list_first_entry(&key->items, struct fair_item, list);
+
+            if (key->running < key->cap) {
+                ull_t needed;
+
+                if (key->deficit >= item->cost) {
+                    key->deficit -= item->cost;
+                    rh_list_del(&item->list);
+                    key->count--;
+                    key->running++;
+                    state->queued--;
+                    if (key->count == 0)
+                        fair_key_deactivate(state, key);
+                    *p_key = key;
+                    return item;
+                }
+                key->deficit += quantum;
+
+                /* rounds before the key can run its first entry */
+                needed = key->deficit >= item->cost ? 0 :
+                            (item->cost - key->deficit - 1) / quantum + 1;
+                if (!runnable || needed < rounds)
+                    rounds = needed;
+                runnable = true;
+            }
+            /* next key */
+            rh_list_del(&key->rr);
+            rh_list_add_tail(&key->rr, &state->rr);
+        }
+
+        if (!runnable)
+            return NULL;
+
+        if (rounds == 0)
+            continue;
+        rh_list_for_each_entry(key, &state->rr, rr) {
+            if (key->running < key->cap)
+                key->deficit += rounds * quantum;
+        }
+    }
+}
+
+/**
+ * Account the duration of an action for its key.
+ * If max_latency_ms is set, the limit of running actions of the key is
+ * halved when its actions get slower than this target, and incremented
+ * when they are faster. It is updated once per 'cap' actions.
+ * @return true if the limit was increased.
+ */
+static bool fair_key_done(struct sched_fair_state *state,
+                          struct fair_key *key, double duration_ms)
+{
+    unsigned int max_cap = fair_max_cap(&state->cfg);
+
+    key->running--;
+
+    if (key->latency_ms == 0.0)
+        key->latency_ms = duration_ms;
+    else
+        key->latency_ms += (duration_ms - key->latency_ms) / 8;
+
+    if (state->cfg.max_latency_ms <= 0) {
+        key->cap = max_cap;
+        return false;
+    }
+
+    if (++key->done < key->cap)
+        return false;
+    key->done = 0;
+
+    if (key->latency_ms > state->cfg.max_latency_ms) {
+        if (key->cap > 1) {
+            key->cap /= 2;
+            DisplayLog(LVL_DEBUG, fair_block_name(state->cfg.key),
+                       "Actions on '%s' take %.0fms: limiting to %u "
+                       "running actions", key->name, key->latency_ms,
+                       key->cap);
+        }
+    } else if (key->cap < max_cap) {
+        key->cap++;
+        return true;
+    }
+    return false;
+}
+
+/** Thread that runs the actions (i.e. calls the action callbacks) */
+static void *fair_thr(void *arg)
+{
+    struct sched_fair_state *state = arg;
+
+    pthread_mutex_lock(&state->lock);
+    while (1) {
+        struct fair_item *item;
+        struct fair_key *key = NULL;
+        struct timespec start, end;
+        double duration_ms;
+
+        item = fair_next(state, &key);
+        if (item == NULL) {
+            pthread_cond_wait(&state->cond, &state->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&state->lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        item->cb(item->udata, SCHED_OK);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        free(item);
+
+        duration_ms = (end.tv_sec - start.tv_sec) * 1000.0
+                      + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+
+        pthread_mutex_lock(&state->lock);
+        /* this thread takes the freed slot, wake up another one
+         * if the key can run more actions */
+        if (fair_key_done(state, key, duration_ms))
+            pthread_cond_signal(&state->cond);
+    }
+    UNREACHED();
+}
+
+static int sched_fair_init(void *config, void **p_sched_data)
+{
+    struct sched_fair_state *state;
+    sched_fair_config_t *cfg = config;
+    int rc = 0;
+    int i;
+
+    if (!config)
+        return -EINVAL;
+
+    state = calloc(1, sizeof(*state));
+    if (!state)
+        return -ENOMEM;
+
+    state->cfg = *cfg;
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->cond, NULL);
+    rh_list_init(&state->rr);
+    state->keys = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                        fair_key_free);
+
+    state->threads = calloc(cfg->nb_threads, sizeof(pthread_t));
+    if (!state->threads) {
+        rc = -ENOMEM;
+        goto out_free;
+    }
+
+    for (i = 0; i < cfg->nb_threads; i++) {
+        rc = pthread_create(&state->threads[i], NULL, fair_thr, state);
+        if (rc)
+            break;
+    }
+    if (i == 0) {
+        rc = -rc;
+        goto out_free;
+    }
+    if (rc) {
+        /* the started threads use the scheduler: go on with them */
+        DisplayLog(LVL_MAJOR, fair_block_name(cfg->key),
+                   "Could only start %d threads out of %d: %s", i,
+                   cfg->nb_threads, strerror(rc));
+        rc = 0;
+    }
+    state->nb_threads = i;
+    state->cfg.nb_threads = i;
+
+    *p_sched_data = state;
+    return 0;
+
+out_free:
+    free(state->threads);
+    g_hash_table_destroy(state->keys);
+    free(state);
+    return rc;
+}
+
+static gboolean fair_key_idle(gpointer k, gpointer v, gpointer udata)
+{
+    struct fair_key *key = v;
+
+    return key->running == 0 && key->count == 0;
+}
+
+/** Drop waiting entries (skipped for the current run) */
+static int sched_fair_reset(void *sched_data)
+{
+    struct sched_fair_state *state = sched_data;
+    struct rh_list_head dropped;
+
+    rh_list_init(&dropped);
+
+    pthread_mutex_lock(&state->lock);
+    while (!rh_list_empty(&state->rr)) {
+        struct fair_key *key = rh_list_first_entry(&state->rr,
+                                                   struct fair_key, rr);
+
+        rh_list_splice_tail(&dropped, &key->items);
+        rh_list_init(&key->items);
+        key->count = 0;
+        fair_key_deactivate(state, key);
+    }
+    state->queued = 0;
+    g_hash_table_foreach_remove(state->keys, fair_key_idle, NULL);
+    pthread_mutex_unlock(&state->lock);
+
+    /* callbacks are called out of the lock, as they can reset schedulers */
+    while (!rh_list_empty(&dropped)) {
+        struct fair_item *item = rh_list_first_entry(&dropped,
+                                                     struct fair_item, list);
+
+        rh_list_del(&item->list);
+        item->cb(item->udata, SCHED_SKIP_ENTRY);
+        free(item);
+    }
+    return 0;
+}
+
+static int sched_fair_schedule(void *sched_data, const entry_id_t *id,
+                               const attr_set_t *attrs, sched_cb_t cb,
+                               void *udata)
+{
+    struct sched_fair_state *state = sched_data;
+    const char *tag = fair_block_name(state->cfg.key);
+    struct fair_item *item;
+    struct fair_key *key;
+    char buff[FAIR_KEY_MAX];
+    const char *name;
+
+    name = fair_key_name(state->cfg.key, attrs, buff, sizeof(buff));
+
+    item = calloc(1, sizeof(*item));
+    if (!item)
+        return -ENOMEM;
+
+    item->cb = cb;
+    item->udata = udata;
+    if (state->cfg.quantum == 0)
+        item->cost = 1;
+    else if (attrs != NULL && ATTR_MASK_TEST(attrs, size))
+        item->cost = ATTR(attrs, size);
+
+    pthread_mutex_lock(&state->lock);
+
+    /* too many waiting entries: wait for running actions */
+    if (state->cfg.max_queued > 0 && state->queued >= state->cfg.max_queued) {
+        pthread_mutex_unlock(&state->lock);
+        free(item);
+        DisplayLog(LVL_DEBUG, tag, "Throttling after %u waiting entries",
+                   state->cfg.max_queued);
+        return SCHED_DELAY;
+    }
+
+    key = fair_key_get(state, name);
+    if (key == NULL) {
+        pthread_mutex_unlock(&state->lock);
+        free(item);
+        return -ENOMEM;
+    }
+
+    /* don't let a slow target fill the queues */
+    if (state->cfg.max_key_queued > 0
+        && key->count >= state->cfg.max_key_queued) {
+        pthread_mutex_unlock(&state->lock);
+        free(item);
+        DisplayLog(LVL_DEBUG, tag, "%u entries waiting for '%s': skipping "
+                   "entry for the current run", key->count, name);
+        return SCHED_SKIP_ENTRY;
+    }
+
+    rh_list_add_tail(&item->list, &key->items);
+    key->count++;
+    state->queued++;
+
+    if (!key->is_active) {
+        rh_list_add_tail(&key->rr, &state->rr);
+        key->is_active = true;
+        state->nb_active++;
+    }
+
+    pthread_cond_signal(&state->cond);
+    pthread_mutex_unlock(&state->lock);
+    return SCHED_OK;
+}
+
+/* ------------- configuration management functions ---------- */
+
+static void *sched_fair_cfg_new(fair_key_e key)
+{
+    sched_fair_config_t *cfg = calloc(1, sizeof(sched_fair_config_t));
+
+    if (cfg != NULL)
+        cfg->key = key;
+    return cfg;
+}
+
+static void sched_fair_cfg_free(void *cfg)
+{
+    free(cfg);
+}
+
+static void sched_fair_cfg_set_default(void *module_config)
+{
+    sched_fair_config_t *conf = module_config;
+
+    conf->nb_threads = FAIR_DEFAULT_THREADS;
+    conf->max_per_key = FAIR_DEFAULT_MAX_PER_KEY;
+    conf->max_queued = FAIR_DEFAULT_MAX_QUEUED;
+    conf->max_key_queued = 0;
+    conf->quantum = 0;
+    conf->max_latency_ms = 0;
+}
+
+static void sched_fair_cfg_write_default(fair_key_e key, int indent,
+                                         FILE *output)
+{
+    print_begin_block(output, indent, fair_block_name(key), NULL);
+    print_line(output, indent + 1, "nb_threads:     %d",
+               FAIR_DEFAULT_THREADS);
+    print_line(output, indent + 1, "max_per_key:    %d",
+               FAIR_DEFAULT_MAX_PER_KEY);
+    print_line(output, indent + 1, "max_queued:     %d",
+               FAIR_DEFAULT_MAX_QUEUED);
+    print_line(output, indent + 1, "max_key_queued: 0 (unlimited)");
+    print_line(output, indent + 1, "quantum:        0 (count actions)");
+    print_line(output, indent + 1, "max_latency_ms: 0 (disabled)");
+    print_end_block(output, indent);
+}
+
+static void sched_fair_cfg_write_template(fair_key_e key, int indent,
+                                          FILE *output)
+{
+    print_begin_block(output, indent, fair_block_name(key), NULL);
+    print_line(output, indent + 1, "# threads running the actions");
+    print_line(output, indent + 1, "nb_threads = 8;");
+    print_line(output, indent + 1, "# max running actions per %s",
+               key == FAIR_KEY_OST ? "OST" :
+               key == FAIR_KEY_POOL ? "pool" :
+               key == FAIR_KEY_USER ? "user" : "fileclass");
+    print_line(output, indent + 1, "max_per_key = 2;");
+    print_line(output, indent + 1, "# max waiting entries before delaying "
+               "new ones");
+    print_line(output, indent + 1, "max_queued = 10000;");
+    print_line(output, indent + 1, "# max waiting entries per key, "
+               "before skipping new ones for the current run");
+    print_line(output, indent + 1, "max_key_queued = 1000;");
+    print_line(output, indent + 1, "# volume granted to each key per round "
+               "(0 to count actions)");
+    print_line(output, indent + 1, "quantum = 10GB;");
+    print_line(output, indent + 1, "# reduce max_per_key for keys whose "
+               "actions get slower");
+    print_line(output, indent + 1, "max_latency_ms = 5000;");
+    print_end_block(output, indent);
+}
+
+/** get a 'fair_<key>' sublock from the policy parameters */
+static int sched_fair_cfg_read_from_block(config_item_t parent, void *cfg,
+                                          char *msg_out)
+{
+    sched_fair_config_t *conf = cfg;
+    const char *block_name = fair_block_name(conf->key);
+    static const char *const allowed_params[] = {
+        "nb_threads", "max_per_key", "max_queued", "max_key_queued",
+        "quantum", "max_latency_ms", NULL
+    };
+    const cfg_param_t fair_params[] = {
+        {"nb_threads", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+                       &conf->nb_threads, 0},
+        {"max_per_key", PT_INT, PFLG_POSITIVE, &conf->max_per_key, 0},
+        {"max_queued", PT_INT, PFLG_POSITIVE, &conf->max_queued, 0},
+        {"max_key_queued", PT_INT, PFLG_POSITIVE, &conf->max_key_queued, 0},
+        {"quantum", PT_SIZE, PFLG_POSITIVE, &conf->quantum, 0},
+        {"max_latency_ms", PT_INT, PFLG_POSITIVE, &conf->max_latency_ms, 0},
+        END_OF_PARAMS
+    };
+    config_item_t block;
+    int rc;
+
+    /* get 'fair_<key>' subblock */
+    rc = get_cfg_subblock(parent, block_name, &block, msg_out);
+    if (rc)
+        return rc == ENOENT ? 0 : rc;   /* not mandatory */
+
+    /* read std parameters */
+    rc = read_scalar_params(block, block_name, fair_params, msg_out);
+    if (rc)
+        return rc;
+
+    CheckUnknownParameters(block, block_name, allowed_params);
+    return 0;
+}
+
+static void fair_key_reset_cap(gpointer k, gpointer v, gpointer udata)
+{
+    struct fair_key *key = v;
+    const struct sched_fair_state *state = udata;
+    unsigned int max_cap = fair_max_cap(&state->cfg);
+
+    if (state->cfg.max_latency_ms <= 0 || key->cap > max_cap)
+        key->cap = max_cap;
+}
+
+static int sched_fair_cfg_update(void *sched_data, void *cfg)
+{
+    struct sched_fair_state *state = sched_data;
+    sched_fair_config_t *new = cfg;
+
+    pthread_mutex_lock(&state->lock);
+    state->cfg = *new;
+    /* the number of threads can't change */
+    state->cfg.nb_threads = state->nb_threads;
+
+    g_hash_table_foreach(state->keys, fair_key_reset_cap, state);
+
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->lock);
+    return 0;
+}
+
+/** Define a fair share scheduler flavor (key attribute, name,
+ *  and attributes needed to get the key). */
+#define FAIR_SCHED(_key, _name, _mask)                                      \
+static void *sched_##_name##_cfg_new(void)                                  \
+{                                                                           \
+    return sched_fair_cfg_new(_key);                                        \
+}                                                                           \
+static void sched_##_name##_cfg_write_default(int indent, FILE *output)     \
+{                                                                           \
+    sched_fair_cfg_write_default(_key, indent, output);                     \
+}                                                                           \
+static void sched_##_name##_cfg_write_template(int indent, FILE *output)    \
+{                                                                           \
+    sched_fair_cfg_write_template(_key, indent, output);                    \
+}                                                                           \
+static const ctx_cfg_funcs_t sched_##_name##_cfg_funcs = {                  \
+    .module_name     = #_name" scheduler",                                  \
+    .new             = sched_##_name##_cfg_new,                             \
+    .free            = sched_fair_cfg_free,                                 \
+    .set_default     = sched_fair_cfg_set_default,                          \
+    .read_from_block = sched_fair_cfg_read_from_block,                      \
+    .update          = sched_fair_cfg_update,                               \
+    .write_default   = sched_##_name##_cfg_write_default,                   \
+    .write_template  = sched_##_name##_cfg_write_template,                  \
+};                                                                          \
+action_scheduler_t sched_##_name = {                                        \
+    .sched_name         = #_name,                                           \
+    .sched_cfg_funcs    = &sched_##_name##_cfg_funcs,                       \
+    .sched_init_func    = sched_fair_init,                                  \
+    .sched_reset_func   = sched_fair_reset,                                 \
+    .sched_schedule     = sched_fair_schedule,                              \
+    /* size is needed for the deficit */                                    \
+    .sched_attr_mask    = { .std = ATTR_MASK_size | (_mask), },             \
+}
+
+#ifdef _LUSTRE
+/** "fair_ost" scheduler definition */
+FAIR_SCHED(FAIR_KEY_OST, fair_ost, ATTR_MASK_stripe_items);
+/** "fair_pool" scheduler definition */
+FAIR_SCHED(FAIR_KEY_POOL, fair_pool, ATTR_MASK_stripe_info);
+#endif
+/** "fair_user" scheduler definition */
+FAIR_SCHED(FAIR_KEY_USER, fair_user, ATTR_MASK_uid);
+/** "fair_class" scheduler definition */
+FAIR_SCHED(FAIR_KEY_CLASS, fair_class, ATTR_MASK_fileclass);
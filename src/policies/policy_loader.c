@@ -2095,10 +2095,18 @@ static int set_policies(void *cfg, bool reload)
     if (reload)
         return reload_policies(p_policies);
     else {
+        int rc;
+
         policies = *p_policies;
 
         /* update status manager masks, once they are all loaded */
         smi_update_masks();
+
+        rc = compile_policy_matching(&policies);
+        if (rc)
+            DisplayLog(LVL_MAJOR, LOADER_TAG, "Failed to compile fileclass "
+                       "definitions and policy rules (error %d): they will "
+                       "be interpreted", rc);
     }
     return 0;
 }
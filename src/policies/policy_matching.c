@@ -26,6 +26,7 @@
 #include "xplatform_print.h"
 #include "rbh_boolexpr.h"
 #include "status_manager.h"
+#include "glob_set.h"
 
 #include <string.h>
 #include <libgen.h>
@@ -83,13 +84,10 @@ static bool TestRegexp(const char *regexp, const char *to_be_tested,
     return !fnmatch(regexp, to_be_tested, match_flag);
 }
 
-static bool TestPathRegexp(const char *regexp, const char *to_be_tested,
-                           enum regexp_flags flags)
+/** fnmatch flags to test a path against a regexp */
+static int path_match_flags(enum regexp_flags flags)
 {
-    char full_path[RBH_PATH_MAX];
-    const char *full_regexp = regexp;
-    bool any_level = (flags & REGEXP_ANY_LEVEL);
-    int match_flag = 0, rc;
+    int match_flag = 0;
 
     if (flags & REGEXP_IS_CHILD)
         match_flag |= FNM_LEADING_DIR;
@@ -97,23 +95,45 @@ static bool TestPathRegexp(const char *regexp, const char *to_be_tested,
     if (flags & REGEXP_INSENSITIVE)
         match_flag |= FNM_CASEFOLD;
 
+    if (!(flags & REGEXP_ANY_LEVEL))
+        match_flag |= FNM_PATHNAME;
+
+    return match_flag;
+}
+
+/**
+ * Return the absolute form of a path regexp.
+ * @param buff  buffer of RBH_PATH_MAX bytes, used if the root path
+ *              must be added to the regexp.
+ */
+static const char *path_regexp(const char *regexp, enum regexp_flags flags,
+                               char *buff)
+{
+    int rc;
+
     /* is the regexp relative ?
      * (don't add the root path if expression starts with '**').
      */
-    if (!IS_ABSOLUTE_PATH(regexp) && !(any_level && (regexp[0] == '*'))) {
-        /* add root path to the path to be tested */
-        rc = snprintf(full_path, RBH_PATH_MAX, "%s/%s",
-                      global_config.fs_path, regexp);
-        if (rc >= RBH_PATH_MAX) {
-            DisplayLog(LVL_VERB, POLICY_TAG,
-                       "Path name too long: %s/%s. Try matching anyway.",
-                       global_config.fs_path, regexp);
-        }
-        full_regexp = full_path;
+    if (IS_ABSOLUTE_PATH(regexp)
+        || ((flags & REGEXP_ANY_LEVEL) && (regexp[0] == '*')))
+        return regexp;
+
+    /* add root path to the path to be tested */
+    rc = snprintf(buff, RBH_PATH_MAX, "%s/%s", global_config.fs_path, regexp);
+    if (rc >= RBH_PATH_MAX) {
+        DisplayLog(LVL_VERB, POLICY_TAG,
+                   "Path name too long: %s/%s. Try matching anyway.",
+                   global_config.fs_path, regexp);
     }
+    return buff;
+}
 
-    if (!any_level)
-        match_flag |= FNM_PATHNAME;
+static bool TestPathRegexp(const char *regexp, const char *to_be_tested,
+                           enum regexp_flags flags)
+{
+    char full_path[RBH_PATH_MAX];
+    const char *full_regexp = path_regexp(regexp, flags, full_path);
+    int match_flag = path_match_flags(flags);
 
     if (!fnmatch(full_regexp, to_be_tested, match_flag)) {
 #ifdef _DEBUG_POLICIES
@@ -1347,12 +1367,603 @@ policy_match_t entry_matches(const entry_id_t *p_entry_id,
                           false);
 }
 
-static policy_match_t _is_whitelisted(const policy_descr_t *policy,
-                                      const entry_id_t *p_entry_id,
-                                      const attr_set_t *p_entry_attr,
-                                      fileset_item_t **fileset,
-                                      bool no_warning)
+/* ======================================================================
+ * Compiled fileclass and policy rule matching.
+ *
+ * Fileclass definitions, policy rule conditions and ignore rules are
+ * compiled once, when the configuration is loaded, into programs (a flat
+ * prefix form of their boolean expression).
+ * Path and name conditions of all these expressions are merged into a few
+ * pattern sets (see glob_set.h), so each path or name of an entry is only
+ * walked once to determine all the conditions it matches, wherever they
+ * appear: checking the ignore rules of a policy, then the targets of its
+ * rules and the condition of the selected rule share a single walk.
+ * Other conditions are evaluated by eval_condition().
+ * ======================================================================*/
+
+/* strings that path and name conditions are tested on */
+enum glob_subject {
+    GLOB_PARENT = 0,    /**< parent directory (tree conditions) */
+    GLOB_PATH,          /**< fullpath (path and tree conditions) */
+    GLOB_NAME,          /**< name */
+    GLOB_SUBJECT_COUNT
+};
+
+typedef enum {
+    MOP_CONST,
+    MOP_NOT,
+    MOP_AND,
+    MOP_OR,
+    MOP_COND,   /**< condition evaluated by eval_condition() */
+    MOP_TREE,
+    MOP_PATH,
+    MOP_NAME
+} match_op_e;
+
+struct match_op {
+    match_op_e      type;
+    /** number of operations in this sub-expression */
+    unsigned int    size;
+    /** for MOP_TREE, MOP_PATH, MOP_NAME: the condition is != or unlike */
+    bool            negate;
+    union {
+        bool        constant;
+        const compare_triplet_t *cond;
+        /** pattern index in the set of the subject.
+         * For MOP_TREE: index in the GLOB_PARENT set, then GLOB_PATH set */
+        int         glob[2];
+    } u;
+};
+
+/** compiled rules of a policy (NULL programs are interpreted) */
+struct policy_matcher {
+    /** program of each ignore rule */
+    struct match_op **whitelist;
+    unsigned int      whitelist_count;
+    /** program of each rule condition */
+    struct match_op **conditions;
+    unsigned int      rule_count;
+};
+
+struct class_matcher {
+    glob_set_t       *globs[GLOB_SUBJECT_COUNT];
+    /** program of each fileclass (NULL if it is interpreted) */
+    struct match_op **progs;
+    unsigned int      count;
+    /** compiled rules of each policy */
+    struct policy_matcher *pol_matchers;
+    unsigned int      policy_count;
+};
+
+/** context to evaluate compiled programs on an entry */
+struct match_ctx {
+    const struct class_matcher *matcher;
+    const entry_id_t *id;
+    const attr_set_t *attrs;
+    /** arguments of eval_condition() */
+    const time_modifier_t *pol_mod;
+    const sm_instance_t *smi;
+    bool              no_warning;
+    /** patterns matched by each subject (NULL if the subject is missing) */
+    uint64_t         *globs[GLOB_SUBJECT_COUNT];
+};
+
+/* check compiled matching with the interpreter */
+static bool check_class_matching = false;
+
+void set_class_matching_check(bool enable)
+{
+    check_class_matching = enable;
+}
+
+static unsigned int bool_expr_size(const bool_node_t *node)
+{
+    switch (node->node_type) {
+    case NODE_UNARY_EXPR:
+        return 1 + bool_expr_size(node->content_u.bool_expr.expr1);
+    case NODE_BINARY_EXPR:
+        return 1 + bool_expr_size(node->content_u.bool_expr.expr1)
+            + bool_expr_size(node->content_u.bool_expr.expr2);
+    default:
+        return 1;
+    }
+}
+
+/** add a pattern to a pattern set, and set its index in *idx */
+static int add_glob(struct class_matcher *m, enum glob_subject subj,
+                    const char *pattern, int flags, int *idx)
+{
+    *idx = glob_set_add(m->globs[subj], pattern, flags);
+    return (*idx < 0) ? -*idx : 0;
+}
+
+static int compile_glob(struct class_matcher *m,
+                        const compare_triplet_t *cond, struct match_op *op)
+{
+    char buff[RBH_PATH_MAX];
+    enum regexp_flags flags = cmpflg2regexpflg(cond->flags);
+    int rc;
+
+    op->negate = !(cond->op == COMP_EQUAL || cond->op == COMP_LIKE);
+
+    switch (cond->crit) {
+    case CRITERIA_TREE:
+        op->type = MOP_TREE;
+        rc = add_glob(m, GLOB_PARENT, path_regexp(cond->val.str, flags, buff),
+                      path_match_flags(flags | REGEXP_IS_CHILD),
+                      &op->u.glob[0]);
+        if (rc)
+            return rc;
+        /* also try matching root */
+        return add_glob(m, GLOB_PATH, path_regexp(cond->val.str, flags, buff),
+                        path_match_flags(flags), &op->u.glob[1]);
+
+    case CRITERIA_PATH:
+        op->type = MOP_PATH;
+        return add_glob(m, GLOB_PATH, path_regexp(cond->val.str, flags, buff),
+                        path_match_flags(flags), &op->u.glob[0]);
+
+    case CRITERIA_NAME:
+    case CRITERIA_INAME:
+        op->type = MOP_NAME;
+        return add_glob(m, GLOB_NAME, cond->val.str,
+                        (flags & REGEXP_INSENSITIVE) ? FNM_CASEFOLD : 0,
+                        &op->u.glob[0]);
+    default:
+        RBH_BUG("unexpected criteria");
+    }
+}
+
+/**
+ * Compile a boolean expression to the given operation array.
+ * @return the number of operations, or a negative value on error.
+ */
+static int compile_bool_expr(struct class_matcher *m, const bool_node_t *node,
+                             struct match_op *op)
+{
+    int n1, n2, rc;
+
+    memset(op, 0, sizeof(*op));
+
+    switch (node->node_type) {
+    case NODE_UNARY_EXPR:
+        if (node->content_u.bool_expr.bool_op != BOOL_NOT)
+            return -EINVAL;
+        op->type = MOP_NOT;
+        n1 = compile_bool_expr(m, node->content_u.bool_expr.expr1, op + 1);
+        if (n1 < 0)
+            return n1;
+        op->size = 1 + n1;
+        break;
+
+    case NODE_BINARY_EXPR:
+        if (node->content_u.bool_expr.bool_op == BOOL_AND)
+            op->type = MOP_AND;
+        else if (node->content_u.bool_expr.bool_op == BOOL_OR)
+            op->type = MOP_OR;
+        else
+            return -EINVAL;
+        n1 = compile_bool_expr(m, node->content_u.bool_expr.expr1, op + 1);
+        if (n1 < 0)
+            return n1;
+        n2 = compile_bool_expr(m, node->content_u.bool_expr.expr2,
+                               op + 1 + n1);
+        if (n2 < 0)
+            return n2;
+        op->size = 1 + n1 + n2;
+        break;
+
+    case NODE_CONDITION:
+        op->size = 1;
+        switch (node->content_u.condition->crit) {
+        case CRITERIA_TREE:
+        case CRITERIA_PATH:
+        case CRITERIA_NAME:
+        case CRITERIA_INAME:
+            rc = compile_glob(m, node->content_u.condition, op);
+            if (rc)
+                return -rc;
+            break;
+        default:
+            op->type = MOP_COND;
+            op->u.cond = node->content_u.condition;
+        }
+        break;
+
+    case NODE_CONSTANT:
+        op->type = MOP_CONST;
+        op->size = 1;
+        op->u.constant = node->content_u.constant;
+        break;
+
+    default:
+        return -EINVAL;
+    }
+    return op->size;
+}
+
+static void free_prog_list(struct match_op **progs, unsigned int count)
+{
+    unsigned int i;
+
+    if (progs == NULL)
+        return;
+    for (i = 0; i < count; i++)
+        free(progs[i]);
+    free(progs);
+}
+
+static void free_class_matcher(struct class_matcher *m)
+{
+    unsigned int i;
+
+    for (i = 0; i < GLOB_SUBJECT_COUNT; i++)
+        if (m->globs[i] != NULL)
+            glob_set_free(m->globs[i]);
+
+    free_prog_list(m->progs, m->count);
+
+    if (m->pol_matchers != NULL) {
+        for (i = 0; i < m->policy_count; i++) {
+            free_prog_list(m->pol_matchers[i].whitelist,
+                           m->pol_matchers[i].whitelist_count);
+            free_prog_list(m->pol_matchers[i].conditions,
+                           m->pol_matchers[i].rule_count);
+        }
+        free(m->pol_matchers);
+    }
+    free(m);
+}
+
+/**
+ * Compile a boolean expression to a program.
+ * @param[out] prog the program, or NULL if the expression can't be
+ *                  compiled (it is then interpreted).
+ * @param[in,out] compiled incremented if the expression is compiled.
+ * @return 0 on success, or an error code.
+ */
+static int compile_prog(struct class_matcher *m, const bool_node_t *expr,
+                        struct match_op **prog, unsigned int *compiled)
+{
+    int n;
+
+    *prog = malloc(bool_expr_size(expr) * sizeof(struct match_op));
+    if (*prog == NULL)
+        return ENOMEM;
+
+    n = compile_bool_expr(m, expr, *prog);
+    if (n >= 0) {
+        (*compiled)++;
+        return 0;
+    }
+
+    free(*prog);
+    *prog = NULL;
+    /* else, leave it to the interpreter */
+    return (n == -ENOMEM) ? ENOMEM : 0;
+}
+
+static int compile_policy_rules(struct class_matcher *m,
+                                const policy_descr_t *policy,
+                                struct policy_matcher *pm,
+                                unsigned int *compiled)
+{
+    const policy_rules_t *rules = &policy->rules;
+    unsigned int i;
+    int rc;
+
+    if (rules->whitelist_count > 0) {
+        pm->whitelist = calloc(rules->whitelist_count,
+                               sizeof(*pm->whitelist));
+        if (pm->whitelist == NULL)
+            return ENOMEM;
+        pm->whitelist_count = rules->whitelist_count;
+    }
+    if (rules->rule_count > 0) {
+        pm->conditions = calloc(rules->rule_count, sizeof(*pm->conditions));
+        if (pm->conditions == NULL)
+            return ENOMEM;
+        pm->rule_count = rules->rule_count;
+    }
+
+    for (i = 0; i < pm->whitelist_count; i++) {
+        rc = compile_prog(m, &rules->whitelist_rules[i].bool_expr,
+                          &pm->whitelist[i], compiled);
+        if (rc)
+            return rc;
+        if (pm->whitelist[i] == NULL)
+            DisplayLog(LVL_EVENT, POLICY_TAG, "Ignore rule #%u of policy "
+                       "'%s' can't be compiled: it will be interpreted",
+                       i, policy->name);
+    }
+
+    for (i = 0; i < pm->rule_count; i++) {
+        rc = compile_prog(m, &rules->rules[i].condition, &pm->conditions[i],
+                          compiled);
+        if (rc)
+            return rc;
+        if (pm->conditions[i] == NULL)
+            DisplayLog(LVL_EVENT, POLICY_TAG, "Condition of rule '%s' in "
+                       "policy '%s' can't be compiled: it will be "
+                       "interpreted", rules->rules[i].rule_id, policy->name);
+    }
+    return 0;
+}
+
+int compile_policy_matching(policies_t *pol)
 {
+    struct class_matcher *m;
+    unsigned int i, compiled = 0, rules = 0, rules_compiled = 0;
+    int rc = 0;
+
+    pol->class_matcher = NULL;
+    if (pol->fileset_count == 0 && pol->policy_count == 0)
+        return 0;
+
+    m = calloc(1, sizeof(*m));
+    if (m == NULL)
+        return ENOMEM;
+
+    m->count = pol->fileset_count;
+    m->progs = calloc(m->count, sizeof(*m->progs));
+    m->policy_count = pol->policy_count;
+    m->pol_matchers = calloc(m->policy_count, sizeof(*m->pol_matchers));
+    if ((m->count > 0 && m->progs == NULL)
+        || (m->policy_count > 0 && m->pol_matchers == NULL)) {
+        rc = ENOMEM;
+        goto err;
+    }
+
+    for (i = 0; i < GLOB_SUBJECT_COUNT; i++) {
+        m->globs[i] = glob_set_new();
+        if (m->globs[i] == NULL) {
+            rc = ENOMEM;
+            goto err;
+        }
+    }
+
+    /* non-matchable fileclasses can still be policy targets */
+    for (i = 0; i < m->count; i++) {
+        fileset_item_t *fset = &pol->fileset_list[i];
+
+        rc = compile_prog(m, &fset->definition, &m->progs[i], &compiled);
+        if (rc)
+            goto err;
+        if (m->progs[i] == NULL)
+            DisplayLog(LVL_EVENT, POLICY_TAG, "Fileclass '%s' can't be "
+                       "compiled: it will be interpreted", fset->fileset_id);
+    }
+
+    for (i = 0; i < m->policy_count; i++) {
+        rc = compile_policy_rules(m, &pol->policy_list[i],
+                                  &m->pol_matchers[i], &rules_compiled);
+        if (rc)
+            goto err;
+        rules += m->pol_matchers[i].whitelist_count
+                 + m->pol_matchers[i].rule_count;
+    }
+
+    for (i = 0; i < GLOB_SUBJECT_COUNT; i++) {
+        rc = glob_set_compile(m->globs[i]);
+        if (rc)
+            goto err;
+    }
+
+    DisplayLog(LVL_VERB, POLICY_TAG, "%u/%u fileclasses and %u/%u policy "
+               "rules compiled (patterns: %u parent, %u path, %u name)",
+               compiled, m->count, rules_compiled, rules,
+               glob_set_count(m->globs[GLOB_PARENT]),
+               glob_set_count(m->globs[GLOB_PATH]),
+               glob_set_count(m->globs[GLOB_NAME]));
+
+    pol->class_matcher = m;
+    return 0;
+
+err:
+    free_class_matcher(m);
+    return rc;
+}
+
+/* above this number of patterns, match results are allocated */
+#define MATCH_STACK_WORDS 32
+
+/**
+ * Match the path and name of an entry against all patterns.
+ * Evaluated conditions are interpreted if m is NULL.
+ * @param buff  used for results of up to MATCH_STACK_WORDS words.
+ * @return the allocated result buffer, if it was not big enough.
+ */
+static uint64_t *match_ctx_init(struct match_ctx *ctx,
+                                const struct class_matcher *m,
+                                const entry_id_t *id, const attr_set_t *attrs,
+                                uint64_t *buff)
+{
+    char parent[RBH_PATH_MAX];
+    const char *subject[GLOB_SUBJECT_COUNT] = { NULL };
+    unsigned int i, words = 0;
+    uint64_t *bits = buff;
+    uint64_t *alloc = NULL;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->matcher = m;
+    ctx->id = id;
+    ctx->attrs = attrs;
+    ctx->no_warning = true;
+
+    if (m == NULL)
+        return NULL;
+
+    if (ATTR_MASK_TEST(attrs, fullpath)) {
+        subject[GLOB_PARENT] = ExtractParentDir(ATTR(attrs, fullpath), parent);
+        subject[GLOB_PATH] = ATTR(attrs, fullpath);
+    }
+    if (ATTR_MASK_TEST(attrs, name))
+        subject[GLOB_NAME] = ATTR(attrs, name);
+
+    for (i = 0; i < GLOB_SUBJECT_COUNT; i++)
+        words += GLOB_SET_WORDS(glob_set_count(m->globs[i]));
+
+    if (words > MATCH_STACK_WORDS) {
+        alloc = malloc(words * sizeof(uint64_t));
+        if (alloc == NULL) {
+            /* interpret all expressions */
+            ctx->matcher = NULL;
+            return NULL;
+        }
+        bits = alloc;
+    }
+
+    for (i = 0; i < GLOB_SUBJECT_COUNT; i++) {
+        if (subject[i] == NULL)
+            continue;
+        glob_set_match(m->globs[i], subject[i], bits);
+        ctx->globs[i] = bits;
+        bits += GLOB_SET_WORDS(glob_set_count(m->globs[i]));
+    }
+    return alloc;
+}
+
+static policy_match_t eval_match_prog(const struct match_op *op,
+                                      const struct match_ctx *ctx)
+{
+    policy_match_t rc;
+    bool match;
+
+    switch (op->type) {
+    case MOP_CONST:
+        return bool2policy_match(op->u.constant);
+
+    case MOP_NOT:
+        return negate_match(eval_match_prog(op + 1, ctx));
+
+    case MOP_AND:
+    case MOP_OR:
+        /* always test the first expression */
+        rc = eval_match_prog(op + 1, ctx);
+
+        /* in some cases, we can stop here */
+        if (op->type == MOP_OR && rc == POLICY_MATCH)
+            return POLICY_MATCH;
+        else if (op->type == MOP_AND && rc == POLICY_NO_MATCH)
+            return POLICY_NO_MATCH;
+        else if (rc != POLICY_MATCH && rc != POLICY_NO_MATCH)
+            return rc;
+
+        /* the second expression follows the first one */
+        return eval_match_prog(op + 1 + op[1].size, ctx);
+
+    case MOP_COND:
+        return eval_condition(ctx->id, ctx->attrs, op->u.cond, ctx->pol_mod,
+                              ctx->smi, ctx->no_warning);
+
+    case MOP_TREE:
+        if (ctx->globs[GLOB_PARENT] == NULL)
+            return POLICY_MISSING_ATTR;
+        match = GLOB_SET_TEST(ctx->globs[GLOB_PARENT], op->u.glob[0])
+            || GLOB_SET_TEST(ctx->globs[GLOB_PATH], op->u.glob[1]);
+        break;
+
+    case MOP_PATH:
+        if (ctx->globs[GLOB_PATH] == NULL)
+            return POLICY_MISSING_ATTR;
+        match = GLOB_SET_TEST(ctx->globs[GLOB_PATH], op->u.glob[0]);
+        break;
+
+    case MOP_NAME:
+        if (ctx->globs[GLOB_NAME] == NULL)
+            return POLICY_MISSING_ATTR;
+        match = GLOB_SET_TEST(ctx->globs[GLOB_NAME], op->u.glob[0]);
+        break;
+
+    default:
+        return POLICY_ERR;
+    }
+
+    return bool2policy_match(match != op->negate);
+}
+
+/**
+ * Check if an entry matches a boolean expression, with its compiled
+ * program if any.
+ * @param kind, name  describe the expression in logs.
+ */
+static policy_match_t expr_matches(const struct match_ctx *ctx,
+                                   const struct match_op *prog,
+                                   const bool_node_t *expr, const char *kind,
+                                   const char *name)
+{
+    policy_match_t rc, check;
+
+    if (prog == NULL)
+        return _entry_matches(ctx->id, ctx->attrs, expr, ctx->pol_mod,
+                              ctx->smi, ctx->no_warning);
+
+    rc = eval_match_prog(prog, ctx);
+    if (!check_class_matching)
+        return rc;
+
+    check = _entry_matches(ctx->id, ctx->attrs, expr, ctx->pol_mod, ctx->smi,
+                           true);
+    if (check != rc) {
+        DisplayLog(LVL_CRIT, POLICY_TAG, DFID ": compiled matching of "
+                   "%s '%s' returned %d instead of %d",
+                   PFID(ctx->id), kind, name, rc, check);
+        return check;
+    }
+    return rc;
+}
+
+/** check if an entry matches the given fileclass */
+static policy_match_t fileclass_matches(const struct match_ctx *ctx,
+                                        const fileset_item_t *fset)
+{
+    const struct match_op *prog = NULL;
+    const struct class_matcher *m = ctx->matcher;
+
+    if (m != NULL && fset >= policies.fileset_list
+        && fset < policies.fileset_list + m->count)
+        prog = m->progs[fset - policies.fileset_list];
+
+    return expr_matches(ctx, prog, &fset->definition, "fileclass",
+                        fset->fileset_id);
+}
+
+/** get the compiled rules of a policy (NULL if there is none) */
+static const struct policy_matcher *
+get_policy_matcher(const struct match_ctx *ctx, const policy_descr_t *policy)
+{
+    const struct class_matcher *m = ctx->matcher;
+
+    if (m == NULL || policy < policies.policy_list
+        || policy >= policies.policy_list + m->policy_count)
+        return NULL;
+
+    return &m->pol_matchers[policy - policies.policy_list];
+}
+
+/** check if an entry matches the condition of a rule */
+static policy_match_t rule_cond_matches(const struct match_ctx *ctx,
+                                        const policy_descr_t *policy,
+                                        const rule_item_t *rule)
+{
+    const struct policy_matcher *pm = get_policy_matcher(ctx, policy);
+    const struct match_op *prog = NULL;
+    unsigned int idx = rule - policy->rules.rules;
+
+    if (pm != NULL && idx < pm->rule_count)
+        prog = pm->conditions[idx];
+
+    return expr_matches(ctx, prog, &rule->condition, "condition of rule",
+                        rule->rule_id);
+}
+
+static policy_match_t _is_whitelisted(const struct match_ctx *ctx,
+                                      const policy_descr_t *policy,
+                                      fileset_item_t **fileset)
+{
+    const struct policy_matcher *pm = get_policy_matcher(ctx, policy);
+    const entry_id_t *p_entry_id = ctx->id;
+    bool no_warning = ctx->no_warning;
     unsigned int i, count;
     policy_match_t rc = POLICY_NO_MATCH;
     whitelist_item_t *list;
@@ -1368,9 +1979,9 @@ static policy_match_t _is_whitelisted(const policy_descr_t *policy,
     count = policy->rules.whitelist_count;
 
     for (i = 0; i < count; i++) {
-        switch (_entry_matches
-                (p_entry_id, p_entry_attr, &list[i].bool_expr, NULL,
-                 policy->status_mgr, no_warning)) {
+        switch (expr_matches(ctx, (pm != NULL && i < pm->whitelist_count) ?
+                             pm->whitelist[i] : NULL, &list[i].bool_expr,
+                             "ignore rule of policy", policy->name)) {
         case POLICY_MATCH:
             /* TODO remember the entry is ignored for this policy? */
             return POLICY_MATCH;
@@ -1410,9 +2021,7 @@ static policy_match_t _is_whitelisted(const policy_descr_t *policy,
         printf("Checking if entry matches whitelisted fileset %s...\n",
                fs_list[i]->fileset_id);
 #endif
-        switch (_entry_matches
-                (p_entry_id, p_entry_attr, &fs_list[i]->definition, NULL,
-                 policy->status_mgr, no_warning)) {
+        switch (fileclass_matches(ctx, fs_list[i])) {
         case POLICY_MATCH:
             {
 #ifdef _DEBUG_POLICIES
@@ -1461,7 +2070,20 @@ policy_match_t is_whitelisted(const policy_descr_t *policy,
                               const attr_set_t *p_entry_attr,
                               fileset_item_t **fileset)
 {
-    return _is_whitelisted(policy, p_entry_id, p_entry_attr, fileset, false);
+    struct match_ctx ctx;
+    uint64_t stack_bits[MATCH_STACK_WORDS];
+    uint64_t *bits;
+    policy_match_t rc;
+
+    bits = match_ctx_init(&ctx, policies.class_matcher, p_entry_id,
+                          p_entry_attr, stack_bits);
+    ctx.smi = policy->status_mgr;
+    ctx.no_warning = false;
+
+    rc = _is_whitelisted(&ctx, policy, fileset);
+
+    free(bits);
+    return rc;
 }
 
 /** determine if a class is whitelisted for the given policy */
@@ -1490,6 +2112,9 @@ int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
     unsigned int i;
     int ok = 0;
     int left = sizeof(ATTR(p_attrs_new, fileclass));
+    struct match_ctx ctx;
+    uint64_t stack_bits[MATCH_STACK_WORDS];
+    uint64_t *bits = NULL;
 
     /* initialize output fileclass */
     char *pcur = ATTR(p_attrs_new, fileclass);
@@ -1502,6 +2127,9 @@ int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
     if (p_attrs_cached != NULL)
         ListMgr_MergeAttrSets(&attr_cp, p_attrs_cached, false);
 
+    bits = match_ctx_init(&ctx, policies.class_matcher, id, &attr_cp,
+                          stack_bits);
+
     for (i = 0; i < policies.fileset_count; i++) {
         fileset_item_t *fset = &policies.fileset_list[i];
 
@@ -1510,8 +2138,7 @@ int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
             continue;
         }
 
-        switch (_entry_matches
-                (id, &attr_cp, &fset->definition, NULL, NULL, true)) {
+        switch (fileclass_matches(&ctx, fset)) {
         case POLICY_MATCH:
             ok++;
             if (EMPTY_STRING(ATTR(p_attrs_new, fileclass))) {
@@ -1552,15 +2179,15 @@ int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
         ATTR_MASK_SET(p_attrs_new, class_update);
     }
 
+    free(bits);
     ListMgr_FreeAttrs(&attr_cp);
     return 0;
 }
 
 /** get the first matching policy case for the given file */
-rule_item_t *policy_case(const policy_descr_t *policy,
-                         const entry_id_t *p_entry_id,
-                         const attr_set_t *p_entry_attr,
-                         fileset_item_t **pp_fileset)
+static rule_item_t *select_rule(const struct match_ctx *ctx,
+                                const policy_descr_t *policy,
+                                fileset_item_t **pp_fileset)
 {
     int count, i, j;
     unsigned int default_index = ATTR_INDEX_FLG_UNSPEC;
@@ -1595,14 +2222,12 @@ rule_item_t *policy_case(const policy_descr_t *policy,
                    pol_list[i].target_list[j]->fileset_id);
 #endif
 
-            switch (entry_matches(p_entry_id, p_entry_attr,
-                                  &pol_list[i].target_list[j]->definition,
-                                  NULL, policy->status_mgr)) {
+            switch (fileclass_matches(ctx, pol_list[i].target_list[j])) {
             case POLICY_MATCH:
                 DisplayLog(LVL_FULL, POLICY_TAG,
                            "Entry " F_ENT_ID
                            " matches target file class '%s' of policy '%s'",
-                           P_ENT_ID(p_entry_id, p_entry_attr),
+                           P_ENT_ID(ctx->id, ctx->attrs),
                            pol_list[i].target_list[j]->fileset_id,
                            pol_list[i].rule_id);
                 if (pp_fileset)
@@ -1616,7 +2241,7 @@ rule_item_t *policy_case(const policy_descr_t *policy,
                 DisplayLog(LVL_MAJOR, POLICY_TAG,
                            "Attributes are missing to check if entry " F_ENT_ID
                            " matches file class '%s' (in policy '%s')",
-                           P_ENT_ID(p_entry_id, p_entry_attr),
+                           P_ENT_ID(ctx->id, ctx->attrs),
                            pol_list[i].target_list[j]->fileset_id,
                            pol_list[i].rule_id);
                 break;
@@ -1625,7 +2250,7 @@ rule_item_t *policy_case(const policy_descr_t *policy,
                 DisplayLog(LVL_CRIT, POLICY_TAG,
                            "Error while checking if entry " F_ENT_ID
                            " matches file class '%s' (in policy '%s')",
-                           P_ENT_ID(p_entry_id, p_entry_attr),
+                           P_ENT_ID(ctx->id, ctx->attrs),
                            pol_list[i].target_list[j]->fileset_id,
                            pol_list[i].rule_id);
             }
@@ -1644,11 +2269,40 @@ rule_item_t *policy_case(const policy_descr_t *policy,
     DisplayLog(LVL_DEBUG, POLICY_TAG,
                "Entry " F_ENT_ID
                " matches no policy case: not applying %s policy to it.",
-               P_ENT_ID(p_entry_id, p_entry_attr), policy->name);
+               P_ENT_ID(ctx->id, ctx->attrs), policy->name);
 
     return NULL;
 }
 
+rule_item_t *policy_case(const policy_descr_t *policy,
+                         const entry_id_t *p_entry_id,
+                         const attr_set_t *p_entry_attr,
+                         const time_modifier_t *time_mod,
+                         fileset_item_t **pp_fileset,
+                         policy_match_t *cond_match)
+{
+    struct match_ctx ctx;
+    uint64_t stack_bits[MATCH_STACK_WORDS];
+    uint64_t *bits;
+    rule_item_t *rule;
+
+    bits = match_ctx_init(&ctx, policies.class_matcher, p_entry_id,
+                          p_entry_attr, stack_bits);
+    ctx.smi = policy->status_mgr;
+    ctx.no_warning = false;
+
+    rule = select_rule(&ctx, policy, pp_fileset);
+
+    /* paths and names were already matched against the rule condition */
+    if (rule != NULL && cond_match != NULL) {
+        ctx.pol_mod = time_mod;
+        *cond_match = rule_cond_matches(&ctx, policy, rule);
+    }
+
+    free(bits);
+    return rule;
+}
+
 /** get the policy case for the given fileclass.
  *  \param pp_fileset is set to the matching fileset
  *         or NULL for the default policy case
@@ -1705,11 +2359,10 @@ rule_item_t *class_policy_case(const policy_descr_t *policy,
 /**
  *  Check if an entry has a chance to be matched in any policy condition.
  */
-policy_match_t policy_match_all(const policy_descr_t *policy,
-                                const entry_id_t *p_entry_id,
-                                const attr_set_t *p_entry_attr,
-                                const time_modifier_t *time_mod,
-                                fileset_item_t **pp_fileset)
+static policy_match_t _policy_match_all(struct match_ctx *ctx,
+                                        const policy_descr_t *policy,
+                                        const time_modifier_t *time_mod,
+                                        fileset_item_t **pp_fileset)
 {
     bool could_not_match = false;
     int count, i, j;
@@ -1719,8 +2372,8 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
     /* if it MATCHES any whitelist condition, return NO_MATCH
      * else, it could potentially match a policy, so we must test them.
      */
-    switch (_is_whitelisted(policy, p_entry_id, p_entry_attr, pp_fileset,
-            true)) {
+    ctx->pol_mod = NULL;
+    switch (_is_whitelisted(ctx, policy, pp_fileset)) {
     case POLICY_MATCH:
         return POLICY_NO_MATCH;
     case POLICY_MISSING_ATTR:
@@ -1732,6 +2385,7 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
         return POLICY_ERR;
     }
 
+    ctx->pol_mod = time_mod;
     pol_list = policy->rules.rules;
     count = policy->rules.rule_count;
 
@@ -1771,9 +2425,7 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
                    pol_list[i].target_list[j]->fileset_id);
 #endif
 
-            switch (_entry_matches(p_entry_id, p_entry_attr,
-                                   &pol_list[i].target_list[j]->definition,
-                                   time_mod, policy->status_mgr, true)) {
+            switch (fileclass_matches(ctx, pol_list[i].target_list[j])) {
             case POLICY_MATCH:
                 DisplayLog(LVL_FULL, POLICY_TAG,
                            "Entry matches target file class '%s' of policy '%s'",
@@ -1834,9 +2486,7 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
          * - if we get NO_MATCH for the condition, this policy cannot be matched.
          * - if we get MISSING_ATTR for the condition, return MISSING_ATTR.
          */
-        switch (_entry_matches(p_entry_id, p_entry_attr,
-                               &pol_list[i].condition, time_mod,
-                               policy->status_mgr, true)) {
+        switch (rule_cond_matches(ctx, policy, &pol_list[i])) {
         case POLICY_NO_MATCH:
             /* the entry cannot match this item */
             break;
@@ -1880,9 +2530,7 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
          * - if we get NO_MATCH for the condition, no policy is matched.
          * - if we get MISSING_ATTR for the condition, return MISSING_ATTR.
          */
-        switch (_entry_matches(p_entry_id, p_entry_attr,
-                               &pol_list[default_index].condition,
-                               time_mod, policy->status_mgr, true)) {
+        switch (rule_cond_matches(ctx, policy, &pol_list[default_index])) {
         case POLICY_NO_MATCH:
             return POLICY_NO_MATCH;
             break;
@@ -1911,6 +2559,27 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
     return POLICY_NO_MATCH;
 }
 
+policy_match_t policy_match_all(const policy_descr_t *policy,
+                                const entry_id_t *p_entry_id,
+                                const attr_set_t *p_entry_attr,
+                                const time_modifier_t *time_mod,
+                                fileset_item_t **pp_fileset)
+{
+    struct match_ctx ctx;
+    uint64_t stack_bits[MATCH_STACK_WORDS];
+    uint64_t *bits;
+    policy_match_t rc;
+
+    bits = match_ctx_init(&ctx, policies.class_matcher, p_entry_id,
+                          p_entry_attr, stack_bits);
+    ctx.smi = policy->status_mgr;
+
+    rc = _policy_match_all(&ctx, policy, time_mod, pp_fileset);
+
+    free(bits);
+    return rc;
+}
+
 policy_match_t match_scope(const policy_descr_t *pol, const entry_id_t *id,
                            const attr_set_t *attrs, bool warn)
 {
@@ -29,12 +29,17 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
 
 #define CHECK_QUEUE_INTERVAL    1
 
+/* entries moved at once between listing, workers queue and workers */
+#define QUEUE_BATCH_SIZE        32
+#define WORKER_BATCH_SIZE       8
+
 #define ignore_policies(_p) ((_p)->flags & RUNFLG_IGNORE_POL)
 #define dry_run(_p)         ((_p)->flags & RUNFLG_DRY_RUN)
 #define aborted(_p)         ((_p)->aborted)
@@ -825,36 +830,6 @@ static bool check_queue_limit(policy_info_t *pol,
     RBH_BUG("This line should not be reached");
 }
 
-/**
- * Count how many rules can be translated to SQL query
- */
-static int count_valid_rules(policy_info_t *policy, const policy_rules_t *rules)
-{
-    int valid_db_rules = 0;
-    int i;
-
-    for (i = 0; i < rules->rule_count; i++) {
-        int j, tc = 0;
-        /**
-         * Rule can be translated to SQL statement if any condition
-         * can be translated
-         * or targets class with report = yes
-         */
-        if (cond2sql_ok(&rules->rules[i].condition,
-                        policy->descr->status_mgr,
-                        policy->time_modifier))
-            valid_db_rules++;
-        else if (!policy->config->recheck_ignored_entries) {
-            for (j = 0; j < rules->rules[i].target_count; j++)
-                if (rules->rules[i].target_list[j]->matchable)
-                    tc++;
-            if (tc > 0)
-                valid_db_rules++;
-        }
-    }
-    return valid_db_rules;
-}
-
 /**
  * build a filter from from policy rules for DB query
  */
@@ -862,7 +837,8 @@ static void set_rule_filters(policy_info_t *policy,
                              lmgr_filter_t *p_filter)
 {
     policy_rules_t *rules = &policy->descr->rules;
-    int valid_db_rules;
+    unsigned int count_orig = p_filter->filter_simple.filter_count;
+    GString *leftovers;
     int i;
     int actual_rules = 0;
 
@@ -872,11 +848,11 @@ static void set_rule_filters(policy_info_t *policy,
     /* 'OR' between rule targets */
     /* 'AND' rule targets and condition */
 
-    valid_db_rules = count_valid_rules(policy, rules);
-
-    if (valid_db_rules == 0)
+    if (rules->rule_count == 0)
         return;
 
+    leftovers = g_string_new(NULL);
+
     /* Always add opening/closing parenthesis, no matter if there is a single
      * expression. This adds "AND" before the block.
      * It make the code simpler and easier to follow. */
@@ -886,9 +862,8 @@ static void set_rule_filters(policy_info_t *policy,
     for (i = 0; i < rules->rule_count; i++) {
         int j, tc = 0;
         rule_item_t *rule = &rules->rules[i];
-        bool cond_valid = cond2sql_ok(&rule->condition,
-                                      policy->descr->status_mgr,
-                                      policy->time_modifier);
+        unsigned int rule_start = p_filter->filter_simple.filter_count;
+        filter_pushdown_t pd = { .leftovers = leftovers };
 
         /* count matchables fileclasses for current rule */
         if (!policy->config->recheck_ignored_entries) {
@@ -898,38 +873,52 @@ static void set_rule_filters(policy_info_t *policy,
             }
         }
 
-        if (cond_valid == 0 && tc == 0)
-            continue;
-
-        /* The condition is valid or the fileclass is matchable:
-         * start a new block.
+        /* Start a new block for the rule.
          * 'OR' with previous blocks if is is not the first. */
         lmgr_simple_filter_add_block(p_filter, actual_rules == 0 ?
             FILTER_FLAG_BEGIN_BLOCK :
             FILTER_FLAG_BEGIN_BLOCK | FILTER_FLAG_OR);
-        actual_rules ++;
 
-        /* If the condition is valid, add its SQL. We are in a dedicated sub-block
+        /* Add the SQL of the condition. We are in a dedicated sub-block
          * and we want to "AND" with fileclass expression (if any). */
-        if (cond_valid) {
-            if (convert_boolexpr_to_simple_filter(&rule->condition,
-                                            p_filter, policy->descr->status_mgr,
-                                            policy->time_modifier,
-                                            policy->descr->manage_deleted ?
-                                                FILTER_FLAG_ALLOW_NULL : 0,
-                                            BOOL_AND)) {
-                DisplayLog(LVL_DEBUG, tag(policy),
-                           "Could not convert condition of rule '%s' to "
-                           "simple filter.", rule->rule_id);
-                if (tc == 0) {
-                    /* drop the last begin block */
-                    actual_rules --;
-                    p_filter->filter_simple.filter_count --;
-                    continue;
-                }
-            }
+        g_string_truncate(leftovers, 0);
+        if (convert_boolexpr_to_filter(&rule->condition,
+                                       p_filter, policy->descr->status_mgr,
+                                       policy->time_modifier,
+                                       policy->descr->manage_deleted ?
+                                           FILTER_FLAG_ALLOW_NULL : 0,
+                                       &pd))
+            DisplayLog(LVL_DEBUG, tag(policy),
+                       "Could not convert condition of rule '%s' to "
+                       "DB filter.", rule->rule_id);
+
+        if (pd.never_matches) {
+            DisplayLog(LVL_EVENT, tag(policy), "Rule '%s' never matches: "
+                       "skipping it in DB request", rule->rule_id);
+            lmgr_simple_filter_truncate(p_filter, rule_start);
+            continue;
         }
 
+        if (pd.cond_count > 0)
+            DisplayLog(LVL_EVENT, tag(policy), "Rule '%s': %u/%u conditions "
+                       "pushed down to DB request%s%s%s", rule->rule_id,
+                       pd.cond_pushed, pd.cond_count,
+                       leftovers->len > 0 ?
+                            " (only checked on candidates: " : "",
+                       leftovers->str, leftovers->len > 0 ? ")" : "");
+
+        if (pd.cond_pushed == 0 && tc == 0) {
+            /* Any entry may match this rule: the DB request can't be
+             * restricted by policy rules. */
+            DisplayLog(LVL_EVENT, tag(policy), "Warning: rule '%s' can't be "
+                       "checked by the DB: all entries are candidates",
+                       rule->rule_id);
+            lmgr_simple_filter_truncate(p_filter, count_orig);
+            g_string_free(leftovers, TRUE);
+            return;
+        }
+        actual_rules++;
+
         /* AND with fileclass criteria */
         if (tc > 0) {
             filter_value_t fval;
@@ -956,11 +945,13 @@ static void set_rule_filters(policy_info_t *policy,
         }
         lmgr_simple_filter_add_block(p_filter, FILTER_FLAG_END_BLOCK);
     }
+    g_string_free(leftovers, TRUE);
+
     if (actual_rules > 0)
         lmgr_simple_filter_add_block(p_filter, FILTER_FLAG_END_BLOCK);
     else
         /* drop last begin block */
-        p_filter->filter_simple.filter_count--;
+        lmgr_simple_filter_truncate(p_filter, count_orig);
 }
 
 /** Add DB filters according to 'ignore_fileclass' and 'ignore' statements */
@@ -990,15 +981,18 @@ static void set_ignore_filters(policy_info_t *policy, lmgr_filter_t *filter)
 
     /* don't select entries maching 'ignore' statements */
     for (i = 0; i < rules->whitelist_count; i++) {
-        if (convert_boolexpr_to_simple_filter(
-            &rules->whitelist_rules[i].bool_expr, filter,
-            policy->descr->status_mgr, policy->time_modifier,
-            /* XXX Only ALLOW_NULL once (?) */
-            (policy->descr->manage_deleted && i == 0) ?
-             FILTER_FLAG_ALLOW_NULL | FILTER_FLAG_NOT
-             : FILTER_FLAG_NOT, BOOL_AND)) {
-            DisplayLog(LVL_DEBUG, tag(policy),
-                       "Could not convert 'ignore' rule to simple filter.");
+        filter_pushdown_t pd = { 0 };
+
+        if (convert_boolexpr_to_filter(&rules->whitelist_rules[i].bool_expr,
+                                       filter, policy->descr->status_mgr,
+                                       policy->time_modifier,
+                                       policy->descr->manage_deleted ?
+                                        FILTER_FLAG_ALLOW_NULL | FILTER_FLAG_NOT
+                                        : FILTER_FLAG_NOT, &pd)
+            || pd.cond_pushed < pd.cond_count) {
+            DisplayLog(LVL_DEBUG, tag(policy), "Only %u/%u conditions of "
+                       "'ignore' rule pushed down to DB request.",
+                       pd.cond_pushed, pd.cond_count);
             DisplayLog(LVL_EVENT, tag(policy),
                        "Warning: 'ignore' rule is too complex and may "
                        "affect policy run performance");
@@ -1573,6 +1567,617 @@ static inline int iter_open(lmgr_t *lmgr,
     return DB_SUCCESS;
 }
 
+/** add the time elapsed since 'start' to the listing stall time */
+static void add_list_stall(policy_info_t *pol, const struct timeval *start)
+{
+    struct timeval now, diff;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, start, &diff);
+    pol->progress.list_stall += diff.tv_sec + diff.tv_usec / 1000000.0;
+}
+
+/* -------------- Candidates listed in advance ---------------- */
+
+/**
+ * With prefetch_size > 0, candidates are listed by separate threads
+ * (listers) into a bounded buffer, and the workers queue is fed from this
+ * buffer. Listers retrieve entries from the DB, compute their target amount
+ * and, if policy rules are first matched on cached attributes, discard the
+ * entries that can't match. So the workers are not left idle while the
+ * next DB request is running.
+ *
+ * A new DB request doesn't need to wait for the workers queue to be empty:
+ * - unsorted listings are resumed after the last listed id. They can be
+ *   split into ranges of ids, each listed on its own DB connection
+ *   (db_list_threads);
+ * - sorted listings can only list again the entries with the last sort
+ *   value (or no sort value), which are remembered to be skipped.
+ * If a whole request only returns already listed entries, the lister waits
+ * for the workers queue to be empty before the next request.
+ */
+
+/** a listed candidate */
+struct pf_cand {
+    queue_item_t   *item;
+    counters_t      amount;
+};
+
+struct prefetch;
+
+/** a listing thread */
+struct lister {
+    struct prefetch    *pf;
+    pthread_t           thread;
+    bool                started;
+    lmgr_t             *lmgr;
+    lmgr_t              own_lmgr;   /**< DB connection of additional listers */
+    struct policy_iter  it;
+    lmgr_iter_opt_t     opt;
+    /** range of ids to be listed (unsorted listings) */
+    lmgr_id_range_t    *range;
+    entry_id_t          last_id;
+    int                 last_sort_time;
+    unsigned int        req_count;  /**< entries returned by current request */
+    unsigned int        new_count;  /**< entries not listed before */
+};
+
+struct prefetch {
+    policy_info_t          *pol;
+    const policy_param_t   *param;
+    lmgr_filter_t          *filter;
+    const lmgr_sort_type_t *sort_type;
+    attr_mask_t             attr_mask;
+    /** discard entries that don't match policy rules */
+    bool                    pre_match;
+
+    struct lister          *listers;
+    unsigned int            nb_listers;
+    lmgr_id_range_t        *ranges;
+
+    /** entries listed with the last sort value, or no sort value */
+    GHashTable             *tied;
+    GHashTable             *no_sort_val;
+
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    struct pf_cand         *cands;
+    unsigned int            size;
+    unsigned int            first;
+    unsigned int            count;
+    unsigned int            running;    /**< listers not terminated */
+    /** candidates taken from the buffer, not yet returned by
+     * prefetch_get() (only accessed by the thread filling the queue) */
+    struct pf_cand          taken[QUEUE_BATCH_SIZE];
+    unsigned int            taken_first;
+    unsigned int            taken_count;
+    unsigned int            drain_req;  /**< requests to empty the queue */
+    unsigned int            drain_done;
+    bool                    error;
+    bool                    stop;
+
+    /* stats */
+    unsigned int            total_listed;
+    unsigned int            discarded;
+};
+
+static guint id_ghash(gconstpointer key)
+{
+    const entry_id_t *id = key;
+
+#ifdef FID_PK
+    return (guint)(id->f_seq * 31 + id->f_oid);
+#else
+    return (guint)(id->inode * 31 + id->fs_key);
+#endif
+}
+
+static gboolean id_gequal(gconstpointer a, gconstpointer b)
+{
+    return entry_id_equal((const entry_id_t *)a, (const entry_id_t *)b);
+}
+
+/** remember an entry, return false if it was already listed */
+static bool id_set_add(GHashTable *set, const entry_id_t *id)
+{
+    entry_id_t *key;
+
+    if (g_hash_table_lookup(set, id) != NULL)
+        return false;
+
+    key = malloc(sizeof(*key));
+    if (key == NULL)
+        return true;    /* the entry may be listed twice */
+    *key = *id;
+    g_hash_table_insert(set, key, key);
+    return true;
+}
+
+/**
+ * For sorted listings, check if an entry was already listed by a previous
+ * request.
+ */
+static bool already_listed(struct lister *l, const attr_set_t *attrs,
+                           const entry_id_t *id)
+{
+    struct prefetch *pf = l->pf;
+    int val;
+
+    if (pf->tied == NULL)
+        return false;
+
+    val = get_sort_attr(pf->pol, attrs);
+    if (val == -1)
+        return !id_set_add(pf->no_sort_val, id);
+
+    /* entries are sorted: previous values can't be listed again */
+    if (val != l->last_sort_time)
+        g_hash_table_remove_all(pf->tied);
+    l->last_sort_time = val;
+
+    return !id_set_add(pf->tied, id);
+}
+
+/** push a candidate to the buffer, wait for a free slot if it is full.
+ * @return false if prefetching is stopping. */
+static bool prefetch_push(struct prefetch *pf, const struct pf_cand *cand)
+{
+    P(pf->lock);
+    while (pf->count == pf->size && !pf->stop)
+        pthread_cond_wait(&pf->cond, &pf->lock);
+    if (pf->stop) {
+        V(pf->lock);
+        return false;
+    }
+    pf->cands[(pf->first + pf->count) % pf->size] = *cand;
+    pf->count++;
+    pthread_cond_broadcast(&pf->cond);
+    V(pf->lock);
+    return true;
+}
+
+/** wait until all listed entries have been processed */
+static void prefetch_wait_drain(struct prefetch *pf)
+{
+    unsigned int ticket;
+
+    P(pf->lock);
+    ticket = ++pf->drain_req;
+    pthread_cond_broadcast(&pf->cond);
+    while (pf->drain_done < ticket && !pf->stop)
+        pthread_cond_wait(&pf->cond, &pf->lock);
+    V(pf->lock);
+}
+
+/** open the iterator of a lister
+ * @param first first request of the lister */
+static int lister_open(struct lister *l, bool first)
+{
+    struct prefetch *pf = l->pf;
+    policy_info_t *pol = pf->pol;
+    filter_value_t fval;
+    int rc;
+
+    l->req_count = 0;
+    l->new_count = 0;
+
+    if (first)
+        goto open;
+
+    if (l->range != NULL) {
+        /* resume after the last listed entry */
+        rc = ListMgr_IdRangeStartAfter(l->range, &l->last_id);
+        if (rc)
+            return rc;
+        goto open;
+    }
+
+    /* same as a synchronous listing */
+    if (!pol->descr->manage_deleted) {
+        fval.value.val_int = pol->progress.policy_start;
+        rc = lmgr_simple_filter_add_or_replace(pf->filter,
+                                               ATTR_INDEX_md_update,
+                                               LESSTHAN_STRICT, fval,
+                                               FILTER_FLAG_ALLOW_NULL);
+        if (rc)
+            return rc;
+    }
+    if (pol->config->lru_sort_attr != LRU_ATTR_NONE) {
+        fval.value.val_int = l->last_sort_time;
+        rc = lmgr_simple_filter_add_or_replace(pf->filter,
+                                       pol->config->lru_sort_attr,
+                                       policy_order_to_listmgr_comp(
+                                           pol->config->lru_sort_order),
+                                       fval, FILTER_FLAG_ALLOW_NULL);
+        if (rc)
+            return rc;
+    }
+
+open:
+    return iter_open(l->lmgr, pol->descr->manage_deleted ? IT_RMD : IT_LIST,
+                     &l->it, pf->filter, pf->sort_type, &l->opt);
+}
+
+/** check if the listing of a lister is complete, after a request */
+static bool lister_end_of_list(struct lister *l)
+{
+    policy_info_t *pol = l->pf->pol;
+
+    if (l->req_count == 0 || l->opt.list_count_max == 0
+        || l->req_count < l->opt.list_count_max)
+        return true;
+
+    if (pol->config->lru_sort_attr != LRU_ATTR_NONE
+        && heuristic_end_of_list(pol, l->last_sort_time))
+        return true;
+
+    return false;
+}
+
+static void *lister_thr(void *arg)
+{
+    struct lister *l = arg;
+    struct prefetch *pf = l->pf;
+    policy_info_t *pol = pf->pol;
+    bool drained = false;
+    int rc = 0;
+
+    while (!aborted(pol) && !stopping(pol)) {
+        struct pf_cand cand;
+        attr_set_t attr_set;
+        entry_id_t entry_id;
+
+        memset(&attr_set, 0, sizeof(attr_set_t));
+        attr_set.attr_mask = pf->attr_mask;
+        memset(&entry_id, 0, sizeof(entry_id_t));
+
+        rc = iter_next(&l->it, &entry_id, &attr_set);
+
+        if (rc == DB_END_OF_LIST) {
+            rc = 0;
+            if (lister_end_of_list(l))
+                break;
+
+            if (l->new_count == 0) {
+                /* a whole request of entries already listed */
+                if (drained)
+                    break;
+                DisplayLog(LVL_DEBUG, tag(pol), "No new entry in last DB "
+                           "request: waiting for current actions to end");
+                prefetch_wait_drain(pf);
+                drained = true;
+            } else {
+                drained = false;
+            }
+
+            iter_close(&l->it);
+            DisplayLog(LVL_DEBUG, tag(pol), "Performing new request with a "
+                       "limit of %u entries", l->opt.list_count_max);
+            rc = lister_open(l, false);
+            if (rc) {
+                DisplayLog(LVL_CRIT, tag(pol), "Error %d retrieving list of "
+                           "candidates from database", rc);
+                break;
+            }
+            continue;
+        } else if (rc != 0) {
+            DisplayLog(LVL_CRIT, tag(pol),
+                       "Error %d getting next entry of iterator", rc);
+            break;
+        }
+
+        l->req_count++;
+        l->last_id = entry_id;
+
+        if (already_listed(l, &attr_set, &entry_id)) {
+            ListMgr_FreeAttrs(&attr_set);
+            continue;
+        }
+        l->new_count++;
+        __sync_fetch_and_add(&pf->total_listed, 1);
+
+        if (pf->pre_match
+            && policy_match_all(pol->descr, &entry_id, &attr_set,
+                                pol->time_modifier, NULL) == POLICY_NO_MATCH) {
+            __sync_fetch_and_add(&pf->discarded, 1);
+            ListMgr_FreeAttrs(&attr_set);
+            continue;
+        }
+
+        if (entry2tgt_amount(pf->param, &attr_set, &cand.amount) == -1) {
+            DisplayLog(LVL_MAJOR, tag(pol),
+                       "Failed to determine target amount for entry " DFID,
+                       PFID(&entry_id));
+            ListMgr_FreeAttrs(&attr_set);
+            continue;
+        }
+
+        cand.item = entry2queue_item(&entry_id, &attr_set,
+                                     cand.amount.targeted);
+        if (cand.item == NULL) {
+            ListMgr_FreeAttrs(&attr_set);
+            rc = -ENOMEM;
+            break;
+        }
+
+        if (!prefetch_push(pf, &cand)) {
+            free_queue_item(cand.item);
+            break;
+        }
+    }
+
+    P(pf->lock);
+    if (rc)
+        pf->error = true;
+    pf->running--;
+    pthread_cond_broadcast(&pf->cond);
+    V(pf->lock);
+
+    return NULL;
+}
+
+/**
+ * Get the next listed candidate.
+ * @retval 0 on success.
+ * @retval EAGAIN if a lister waits for the workers queue to be empty
+ *         (call prefetch_drained() after that).
+ * @retval ENOENT at the end of the listing.
+ * @retval EIO if a lister failed.
+ */
+static int prefetch_get(struct prefetch *pf, struct pf_cand *cand)
+{
+    struct timeval start;
+    bool waited = false;
+    int rc;
+
+    if (pf->taken_first < pf->taken_count) {
+        *cand = pf->taken[pf->taken_first++];
+        return 0;
+    }
+
+    P(pf->lock);
+    while (pf->count == 0 && pf->running > 0
+           && pf->drain_req == pf->drain_done && !pf->error
+           && !aborted(pf->pol) && !stopping(pf->pol)) {
+        if (!waited) {
+            gettimeofday(&start, NULL);
+            waited = true;
+        }
+        pthread_cond_wait(&pf->cond, &pf->lock);
+    }
+
+    if (pf->count > 0) {
+        /* take several candidates at once, to lock less often */
+        pf->taken_first = 0;
+        pf->taken_count = 0;
+        while (pf->count > 0 && pf->taken_count < QUEUE_BATCH_SIZE) {
+            pf->taken[pf->taken_count++] = pf->cands[pf->first];
+            pf->first = (pf->first + 1) % pf->size;
+            pf->count--;
+        }
+        pthread_cond_broadcast(&pf->cond);
+        *cand = pf->taken[pf->taken_first++];
+        rc = 0;
+    } else if (pf->error) {
+        rc = EIO;
+    } else if (pf->drain_req != pf->drain_done) {
+        rc = EAGAIN;
+    } else {
+        rc = ENOENT;
+    }
+    V(pf->lock);
+
+    if (waited)
+        add_list_stall(pf->pol, &start);
+    return rc;
+}
+
+/** check if prefetch_get() can return a candidate without locking */
+static inline bool prefetch_has_taken(const struct prefetch *pf)
+{
+    return pf->taken_first < pf->taken_count;
+}
+
+/** indicate the listers that the workers queue is empty */
+static void prefetch_drained(struct prefetch *pf)
+{
+    P(pf->lock);
+    pf->drain_done = pf->drain_req;
+    pthread_cond_broadcast(&pf->cond);
+    V(pf->lock);
+}
+
+/** stop listers and release prefetch resources */
+static void prefetch_free(struct prefetch *pf)
+{
+    unsigned int i;
+
+    P(pf->lock);
+    pf->stop = true;
+    pthread_cond_broadcast(&pf->cond);
+    V(pf->lock);
+
+    for (i = 0; i < pf->nb_listers; i++) {
+        struct lister *l = &pf->listers[i];
+
+        if (l->started)
+            pthread_join(l->thread, NULL);
+        iter_close(&l->it);
+        if (l->lmgr == &l->own_lmgr)
+            ListMgr_CloseAccess(&l->own_lmgr);
+    }
+
+    /* candidates that won't be processed */
+    for (; pf->taken_first < pf->taken_count; pf->taken_first++)
+        free_queue_item(pf->taken[pf->taken_first].item);
+    for (; pf->count > 0; pf->count--) {
+        free_queue_item(pf->cands[pf->first].item);
+        pf->first = (pf->first + 1) % pf->size;
+    }
+
+    if (pf->discarded > 0) {
+        DisplayLog(LVL_EVENT, tag(pf->pol), "%u candidates discarded "
+                   "before processing, as they can't match policy rules",
+                   pf->discarded);
+        /* as if they had been skipped by workers */
+        pf->pol->progress.skipped += pf->discarded;
+    }
+
+    if (pf->ranges != NULL)
+        ListMgr_FreeIdRanges(pf->ranges, pf->nb_listers);
+    if (pf->tied != NULL) {
+        g_hash_table_destroy(pf->tied);
+        g_hash_table_destroy(pf->no_sort_val);
+    }
+    pthread_cond_destroy(&pf->cond);
+    pthread_mutex_destroy(&pf->lock);
+    MemFree(pf->listers);
+    MemFree(pf->cands);
+    MemFree(pf);
+}
+
+/**
+ * Prepare listing candidates in advance and perform the first DB
+ * request(s). Listers are started by prefetch_start().
+ * @param lmgr connection of the first lister.
+ * @return NULL on error.
+ */
+static struct prefetch *prefetch_init(policy_info_t *pol,
+                                      const policy_param_t *param,
+                                      lmgr_t *lmgr, lmgr_filter_t *filter,
+                                      const lmgr_sort_type_t *sort_type,
+                                      const lmgr_iter_opt_t *opt,
+                                      attr_mask_t attr_mask)
+{
+    struct prefetch *pf;
+    unsigned int nb = 1;
+    unsigned int i;
+    bool sorted = (pol->config->lru_sort_attr != LRU_ATTR_NONE);
+    match_source_t check_method;
+
+    pf = MemCalloc(1, sizeof(*pf));
+    if (pf == NULL)
+        return NULL;
+
+    pf->pol = pol;
+    pf->param = param;
+    pf->filter = filter;
+    pf->sort_type = sort_type;
+    pf->attr_mask = attr_mask;
+    pf->size = pol->config->prefetch_size;
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->cond, NULL);
+
+    /* rules are first checked on cached attributes: no need to queue
+     * the entries that can't match them */
+    check_method = pol->config->sched_count == 0 ?
+                        MAX(pol->config->pre_sched_match,
+                            pol->config->post_sched_match) :
+                        pol->config->pre_sched_match;
+    pf->pre_match = (check_method == MS_CACHE_ONLY) && !ignore_policies(pol)
+                    && !pol->descr->manage_deleted;
+
+    if (pol->descr->manage_deleted) {
+        /* removed entries are listed at once */
+        if (pol->config->db_list_threads > 1)
+            DisplayLog(LVL_EVENT, tag(pol), "Listing removed entries with a "
+                       "single DB connection (db_list_threads ignored)");
+    } else if (sorted) {
+        if (pol->config->db_list_threads > 1)
+            DisplayLog(LVL_EVENT, tag(pol), "Listing sorted entries with a "
+                       "single DB connection (db_list_threads ignored)");
+        pf->tied = g_hash_table_new_full(id_ghash, id_gequal, free, NULL);
+        pf->no_sort_val = g_hash_table_new_full(id_ghash, id_gequal, free,
+                                                NULL);
+    } else if (ListMgr_SplitIdRange(lmgr, pol->config->db_list_threads,
+                                    &pf->ranges, &nb) != DB_SUCCESS) {
+        DisplayLog(LVL_CRIT, tag(pol), "Failed to split the list of "
+                   "entries into ranges");
+        goto free_pf;
+    }
+
+    pf->cands = MemCalloc(pf->size, sizeof(*pf->cands));
+    pf->listers = MemCalloc(nb, sizeof(*pf->listers));
+    if (pf->cands == NULL || pf->listers == NULL)
+        goto free_pf;
+
+    for (i = 0; i < nb; i++) {
+        struct lister *l = &pf->listers[i];
+
+        l->pf = pf;
+        l->opt = *opt;
+        if (pf->ranges != NULL) {
+            l->range = &pf->ranges[i];
+            l->opt.id_range = l->range;
+        }
+
+        if (i == 0) {
+            l->lmgr = lmgr;
+        } else {
+            if (ListMgr_InitAccess(&l->own_lmgr) != DB_SUCCESS) {
+                DisplayLog(LVL_CRIT, tag(pol), "Could not connect to "
+                           "database for listing candidates");
+                goto free_pf;
+            }
+            l->lmgr = &l->own_lmgr;
+        }
+        pf->nb_listers++;
+
+        if (lister_open(l, true) != DB_SUCCESS)
+            goto free_pf;
+    }
+
+    if (nb > 1)
+        DisplayLog(LVL_EVENT, tag(pol), "Listing candidates with %u DB "
+                   "connections", nb);
+    return pf;
+
+free_pf:
+    prefetch_free(pf);
+    return NULL;
+}
+
+/** start the listers */
+static void prefetch_start(struct prefetch *pf)
+{
+    unsigned int i;
+    int rc;
+
+    for (i = 0; i < pf->nb_listers; i++) {
+        P(pf->lock);
+        pf->running++;
+        V(pf->lock);
+
+        rc = pthread_create(&pf->listers[i].thread, NULL, lister_thr,
+                            &pf->listers[i]);
+        pf->listers[i].started = (rc == 0);
+        if (rc) {
+            DisplayLog(LVL_CRIT, tag(pf->pol), "Failed to start listing "
+                       "thread: %s", strerror(rc));
+            P(pf->lock);
+            pf->running--;
+            pf->error = true;
+            V(pf->lock);
+            return;
+        }
+    }
+}
+
+/** insert the pending entries to the workers queue */
+static int flush_queue_batch(policy_info_t *pol, void **batch,
+                             unsigned int *count)
+{
+    int rc;
+
+    if (*count == 0)
+        return 0;
+
+    rc = Queue_InsertBatch(&pol->queue, batch, *count);
+    if (rc == 0)
+        *count = 0;
+    return rc;
+}
+
 /** return codes of fill_workers_queue() */
 typedef enum {
     PASS_EOL,
@@ -1586,11 +2191,14 @@ typedef enum {
 * - end of list is reached
 * or:
 * - the policy limit is potentially reached.
+* @param pf         If not NULL, entries are taken from the candidates
+*                   listed in advance (the following arguments are unused).
 * @param attr_mask  Mask of attrs to be retrieved from the DB,
 *                   to be able to match policy rules, scope...
 */
 static pass_status_e fill_workers_queue(policy_info_t *pol,
                                         const policy_param_t *p_param,
+                                        struct prefetch *pf,
                                         lmgr_t *lmgr,
                                         struct policy_iter *it,
                                         const lmgr_iter_opt_t *req_opt,
@@ -1611,6 +2219,9 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
     unsigned long long feedback_after[AF_ENUM_COUNT];
     unsigned int status_tab_before[AS_ENUM_COUNT];
     unsigned int status_tab_after[AS_ENUM_COUNT];
+    /* entries to be inserted to the workers queue */
+    void *batch[QUEUE_BATCH_SIZE];
+    unsigned int batch_count = 0;
 
     init_pass_stats(pol, &pushed_ctr, status_tab_before, status_tab_after,
                     feedback_before, feedback_after);
@@ -1621,6 +2232,52 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
     /* List entries for policy */
     do {
         counters_t entry_amount;
+        queue_item_t *item;
+        struct timeval list_start;
+
+        if (pf != NULL) {
+            struct pf_cand cand = { .item = NULL };
+
+            /* don't keep entries from idle workers while waiting for
+             * the listers */
+            if (!prefetch_has_taken(pf)
+                && flush_queue_batch(pol, batch, &batch_count) != 0)
+                return PASS_ERROR;
+
+            rc = prefetch_get(pf, &cand);
+
+            if (aborted(pol) || stopping(pol)) {
+                if (rc == 0)
+                    free_queue_item(cand.item);
+
+                DisplayLog(LVL_MAJOR, tag(pol),
+                           "Policy run %s, stop enqueuing requests.",
+                           pol->aborted ? "aborted" : "stopping");
+                st = pol->aborted ? PASS_ABORTED : PASS_EOL;
+                break;
+            } else if (rc == EAGAIN) {
+                /* prevent from processing the same entry twice */
+                gettimeofday(&list_start, NULL);
+                wait_queue_empty(pol, pushed_ctr.count, feedback_before,
+                                 status_tab_before, feedback_after,
+                                 status_tab_after, false);
+                prefetch_drained(pf);
+                add_list_stall(pol, &list_start);
+                continue;
+            } else if (rc == ENOENT) {
+                DisplayLog(LVL_FULL, tag(pol), "End of list "
+                           "(%u entries returned)", pf->total_listed);
+                st = PASS_EOL;
+                break;
+            } else if (rc != 0) {
+                st = PASS_ERROR;
+                break;
+            }
+
+            item = cand.item;
+            entry_amount = cand.amount;
+            goto insert;
+        }
 
         /* reset attr_mask, if it was altered by last ListMgr_GetNext() */
         memset(&attr_set, 0, sizeof(attr_set_t));
@@ -1628,7 +2285,9 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
 
         memset(&entry_id, 0, sizeof(entry_id_t));
 
+        gettimeofday(&list_start, NULL);
         rc = iter_next(it, &entry_id, &attr_set);
+        add_list_stall(pol, &list_start);
 
         if (aborted(pol) || stopping(pol)) {
             /* free the last returned entry */
@@ -1666,6 +2325,10 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
 
             /* Free previous iterator */
             iter_close(it);
+            gettimeofday(&list_start, NULL);
+
+            if (flush_queue_batch(pol, batch, &batch_count) != 0)
+                return PASS_ERROR;
 
             /* we must wait that migr. queue is empty,
              * to prevent from processing the same entry twice
@@ -1726,6 +2389,7 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
             *db_current_list_count = 0;
             rc = iter_open(lmgr, it->it_type, it, filter, sort_type,
                            req_opt);
+            add_list_stall(pol, &list_start);
             if (rc != DB_SUCCESS) {
                 DisplayLog(LVL_CRIT, tag(pol),
                            "Error %d retrieving list of candidates from "
@@ -1755,20 +2419,36 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
             continue;
         }
 
-        /* Insert candidate to workers queue */
-        rc = Queue_Insert(&pol->queue,
-                          entry2queue_item(&entry_id, &attr_set,
-                                           entry_amount.targeted));
-        if (rc)
-            return PASS_ERROR;
+        item = entry2queue_item(&entry_id, &attr_set, entry_amount.targeted);
 
+insert:
+        /* Insert candidates to workers queue by batches, or as soon as
+         * workers are idle */
+        batch[batch_count++] = item;
         counters_add(&pushed_ctr, &entry_amount);
 
+        if (batch_count == QUEUE_BATCH_SIZE) {
+            rc = flush_queue_batch(pol, batch, &batch_count);
+        } else {
+            unsigned int nb_idle;
+
+            RetrieveQueueStats(&pol->queue, &nb_idle, NULL, NULL, NULL,
+                               NULL, NULL, NULL);
+            rc = nb_idle > 0 ? flush_queue_batch(pol, batch, &batch_count)
+                             : 0;
+        }
+        if (rc)
+            return PASS_ERROR;
+
     /* Enqueue entries to workers queue as long as the specified limit is
      * not reached */
     } while (!check_queue_limit(pol, &pushed_ctr, feedback_before,
                                 status_tab_before, &p_param->target_ctr));
 
+    /* entries counted in pushed_ctr must be in the queue */
+    if (flush_queue_batch(pol, batch, &batch_count) != 0)
+        return PASS_ERROR;
+
     /* Make sure the processing queue is empty. */
     wait_queue_empty(pol, pushed_ctr.count, feedback_before,
                      status_tab_before, feedback_after, status_tab_after,
@@ -1921,6 +2601,7 @@ int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
                action_summary_t *p_summary, lmgr_t *lmgr)
 {
     struct policy_iter it = { 0 };
+    struct prefetch *pf = NULL;
     int rc;
     pass_status_e st;
     lmgr_filter_t filter;
@@ -2013,9 +2694,15 @@ int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
     nb_returned = 0;
     total_returned = 0;
 
-    rc = iter_open(lmgr,
-                   p_pol_info->descr->manage_deleted ? IT_RMD : IT_LIST,
-                   &it, &filter, &sort_type, &opt);
+    if (p_pol_info->config->prefetch_size > 0) {
+        pf = prefetch_init(p_pol_info, p_param, lmgr, &filter, &sort_type,
+                           &opt, attr_mask);
+        rc = (pf != NULL) ? DB_SUCCESS : DB_REQUEST_FAILED;
+    } else {
+        rc = iter_open(lmgr,
+                       p_pol_info->descr->manage_deleted ? IT_RMD : IT_LIST,
+                       &it, &filter, &sort_type, &opt);
+    }
     if (rc != DB_SUCCESS) {
         lmgr_simple_filter_free(&filter);
         DisplayLog(LVL_CRIT, tag(p_pol_info),
@@ -2035,6 +2722,8 @@ int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
         if (rc) {
             DisplayLog(LVL_CRIT, tag(p_pol_info),
                        "Failed to reinitialize scheduler #%d", i);
+            if (pf != NULL)
+                prefetch_free(pf);
             if (p_summary)
                 *p_summary = p_pol_info->progress;
             return rc;
@@ -2048,6 +2737,8 @@ int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
     if (rc) {
         DisplayLog(LVL_CRIT, tag(p_pol_info),
                    "Aborting policy run because pre_run_commmand failed");
+        if (pf != NULL)
+            prefetch_free(pf);
         if (p_summary)
             *p_summary = p_pol_info->progress;
         return ECANCELED;
@@ -2056,6 +2747,11 @@ int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
     /* start alert batching in case the policy trigger alerts */
     Alert_StartBatching();
 
+    /* on failure, the run ends with an error after the candidates of
+     * started listers */
+    if (pf != NULL)
+        prefetch_start(pf);
+
     /* loop on all policy passes */
     do {
         /* check if progress must be reported  */
@@ -2063,7 +2759,7 @@ int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
 
         /* feed workers until the specified limit is reached or
          * end of list is reached */
-        st = fill_workers_queue(p_pol_info, p_param, lmgr, &it, &opt,
+        st = fill_workers_queue(p_pol_info, p_param, pf, lmgr, &it, &opt,
                                 &sort_type, &filter, attr_mask,
                                 &last_sort_time, &nb_returned,
                                 &total_returned);
@@ -2090,6 +2786,8 @@ int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
                           p_pol_info->progress.errors,
                           &p_param->target_ctr));
 
+    if (pf != NULL)
+        prefetch_free(pf);
     lmgr_simple_filter_free(&filter);
     /* iterator may have been closed in fill_workers_queue() */
     iter_close(&it);
@@ -2136,6 +2834,8 @@ static inline int update_entry(lmgr_t *lmgr, const entry_id_t *p_entry_id,
 {
     int rc;
     attr_set_t tmp_attrset = *p_attr_set;
+    attr_set_t acct_old = ATTR_SET_INIT;
+    bool acct;
 
     /* update classes according to new attributes */
     match_classes(p_entry_id, &tmp_attrset, NULL);
@@ -2152,15 +2852,41 @@ static inline int update_entry(lmgr_t *lmgr, const entry_id_t *p_entry_id,
     /* never update creation time */
     ATTR_MASK_UNSET(&tmp_attrset, creation_time);
 
+    /* current accounting attributes, if robinhood maintains accounting */
+    acct = ListMgr_AcctGet(lmgr, p_entry_id, &acct_old);
+
     /* update DB and skip the entry */
     rc = ListMgr_Update(lmgr, p_entry_id, &tmp_attrset);
     if (rc)
         DisplayLog(LVL_CRIT, TAG, "Error %d updating entry in database.",
                    rc);
+    else if (acct)
+        ListMgr_AcctDelta(lmgr, p_entry_id, &acct_old, &tmp_attrset);
 
+    ListMgr_FreeAttrs(&acct_old);
     return rc;
 }
 
+/** remove an entry from the DB after its removal from the filesystem */
+static void rm_entry(const policy_info_t *pol, lmgr_t *lmgr,
+                     queue_item_t *item, bool last)
+{
+    attr_set_t acct_old = ATTR_SET_INIT;
+    bool acct = last && ListMgr_AcctGet(lmgr, &item->entry_id, &acct_old);
+    int rc;
+
+    rc = ListMgr_Remove(lmgr, &item->entry_id,
+                        /* must be based on the DB content = old attrs */
+                        &item->entry_attr, last);
+    if (rc)
+        DisplayLog(LVL_CRIT, tag(pol),
+                   "Error %d removing entry from database.", rc);
+    else if (acct)
+        ListMgr_AcctDelta(lmgr, &item->entry_id, &acct_old, NULL);
+
+    ListMgr_FreeAttrs(&acct_old);
+}
+
 static inline bool need_update(match_source_t check_method, uint32_t stdattr)
 {
     return check_method == MS_FORCE_UPDT
@@ -2580,21 +3306,11 @@ static void action_fini(int action_rc, lmgr_t *lmgr,
             lastrm = ATTR_MASK_TEST(&ectx->prev_attrs, nlink) ?
                      (ATTR(&ectx->prev_attrs, nlink) <= 1) : 0;
 
-            rc = ListMgr_Remove(lmgr, &ectx->item->entry_id,
-                /* must be based on the DB content = old attrs */
-                                &ectx->item->entry_attr, lastrm);
-            if (rc)
-                DisplayLog(LVL_CRIT, tag(pol),
-                           "Error %d removing entry from database.", rc);
+            rm_entry(pol, lmgr, ectx->item, lastrm);
             break;
 
         case PA_RM_ALL:
-            rc = ListMgr_Remove(lmgr, &ectx->item->entry_id,
-                 /* must be based on the DB content = old attrs */
-                                &ectx->item->entry_attr, 1);
-            if (rc)
-                DisplayLog(LVL_CRIT, tag(pol),
-                           "Error %d removing entry from database.", rc);
+            rm_entry(pol, lmgr, ectx->item, true);
             break;
         }
     }
@@ -2632,7 +3348,7 @@ static inline const char *match_source2str(match_source_t check_method)
 static int refresh_and_match_entry(lmgr_t *lmgr, entry_context_t *ectx,
                                    match_source_t check_method)
 {
-    policy_match_t  match;
+    policy_match_t  match = POLICY_ERR;
     int             rc;
     policy_info_t  *pol = ectx->policy;
     const char     *path;
@@ -2733,9 +3449,13 @@ static int refresh_and_match_entry(lmgr_t *lmgr, entry_context_t *ectx,
             return rc;
     } /* end if 'don't ignore policies' */
 
-    /* get policy rule for the entry */
-    ectx->rule = policy_case(pol->descr, &ectx->item->entry_id, &ectx->fresh_attrs,
-                             &ectx->fileset);
+    /* get policy rule for the entry, and check its condition unless
+     * 'ignore-policies' flag is specified */
+    ectx->rule = policy_case(pol->descr, &ectx->item->entry_id,
+                             &ectx->fresh_attrs, pol->time_modifier,
+                             &ectx->fileset,
+                             (ignore_policies(pol) || check_method == MS_NONE)
+                                ? NULL : &match);
     if (!ectx->rule) {
         DisplayLog(LVL_DEBUG, tag(pol), "Entry %s matches no policy rule",
                    path);
@@ -2752,10 +3472,6 @@ static int refresh_and_match_entry(lmgr_t *lmgr, entry_context_t *ectx,
         return AS_OK;
 
     /* check if the entry matches the policy condition */
-    match = entry_matches(&ectx->item->entry_id, &ectx->fresh_attrs,
-                          &ectx->rule->condition, pol->time_modifier,
-                          pol->descr->status_mgr);
-
     switch (match) {
     case POLICY_MATCH:
         /* OK, entry matches */
@@ -3024,7 +3740,8 @@ static void *thr_policy_run(void *arg)
 {
     int rc;
     lmgr_t lmgr;
-    void *p_queue_entry;
+    void *entries[WORKER_BATCH_SIZE];
+    unsigned int nb_items, max, count, i;
     policy_info_t *pol = (policy_info_t *) arg;
 
     rc = ListMgr_InitAccess(&lmgr);
@@ -3035,8 +3752,20 @@ static void *thr_policy_run(void *arg)
         exit(rc);
     }
 
-    while (Queue_Get(&pol->queue, &p_queue_entry) == 0)
-        process_entry(pol, &lmgr, (queue_item_t *) p_queue_entry, true);
+    for (;;) {
+        /* take several entries when the queue is well filled,
+         * but leave their share to other workers */
+        RetrieveQueueStats(&pol->queue, NULL, &nb_items, NULL, NULL, NULL,
+                           NULL, NULL);
+        max = nb_items / MAX2(pol->config->nb_threads, 1);
+        max = MIN2(MAX2(max, 1), WORKER_BATCH_SIZE);
+
+        if (Queue_GetBatch(&pol->queue, entries, max, &count) != 0)
+            break;
+
+        for (i = 0; i < count; i++)
+            process_entry(pol, &lmgr, (queue_item_t *) entries[i], true);
+    }
 
     /* Error occurred in queue management... */
     DisplayLog(LVL_CRIT, tag(pol),
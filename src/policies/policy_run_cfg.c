@@ -40,6 +40,8 @@ static int polrun_set_default(const policy_descr_t *pol,
     cfg->nb_threads = 4;
     cfg->queue_size = 4096;
     cfg->db_request_limit = 100000;
+    cfg->prefetch_size = 4096;
+    cfg->db_list_threads = 1;
     cfg->max_action_nbr = 0;    /* unlimited */
     cfg->max_action_vol = 0;    /* unlimited */
 
@@ -138,6 +140,8 @@ static void policy_run_cfg_write_default(FILE *output)
     print_line(output, 1, "reschedule_delay_ms     : 100");
     print_line(output, 1, "queue_size              : 4096");
     print_line(output, 1, "db_result_size_max      : 100000");
+    print_line(output, 1, "prefetch_size           : 4096");
+    print_line(output, 1, "db_list_threads         : 1");
     print_line(output, 1, "pre_maintenance_window  : 0 (disabled)");
     print_line(output, 1, "maint_min_apply_delay   : 30min");
     print_line(output, 1, "pre_sched_match         : cache_only");
@@ -207,6 +211,12 @@ static void policy_run_cfg_write_template(FILE *output)
     print_line(output, 1, "# internal/tuning parameters");
     print_line(output, 1, "#queue_size = 4096;");
     print_line(output, 1, "#db_result_size_max = 100000;");
+    print_line(output, 1, "# candidates listed in advance of policy actions");
+    print_line(output, 1, "# (0 to list them synchronously)");
+    print_line(output, 1, "#prefetch_size = 4096;");
+    print_line(output, 1, "# DB connections for listing candidates, if the policy");
+    print_line(output, 1, "# is not sorted (lru_sort_attr = none)");
+    print_line(output, 1, "#db_list_threads = 1;");
     fprintf(output, "\n");
     print_line(output, 1, "# Indicate what attributes are used to match policy rules");
     print_line(output, 1, "# before the scheduling step.");
@@ -711,7 +721,8 @@ static int polrun_read_config(config_file_t config, const char *policy_name,
         "check_actions_interval", "check_actions_on_startup",
         "recheck_ignored_entries", "report_actions",
         "pre_maintenance_window", "maint_min_apply_delay", "queue_size",
-        "db_result_size_max", "action_params", "action", SCHED_PARAM_NAME,
+        "db_result_size_max", "prefetch_size", "db_list_threads",
+        "action_params", "action", SCHED_PARAM_NAME,
         "pre_sched_match", "post_sched_match", "reschedule_delay_ms",
         "pre_run_command", "post_run_command",
         "recheck_ignored_classes",  /* for compat */
@@ -749,6 +760,10 @@ static int polrun_read_config(config_file_t config, const char *policy_name,
          &conf->queue_size, 0},
         {"db_result_size_max", PT_INT, PFLG_POSITIVE,
          &conf->db_request_limit, 0},
+        {"prefetch_size", PT_INT, PFLG_POSITIVE,
+         &conf->prefetch_size, 0},
+        {"db_list_threads", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->db_list_threads, 0},
         {"reschedule_delay_ms", PT_INT, PFLG_POSITIVE,
          &conf->reschedule_delay_ms, 0},
         {"pre_run_command", PT_CMD, 0, &conf->pre_run_command, 0},
@@ -1267,6 +1282,18 @@ static int polrun_reload(const char *blkname, policy_run_config_t *cfg_tgt,
         cfg_tgt->db_request_limit = cfg_new->db_request_limit;
     }
 
+    if (cfg_tgt->prefetch_size != cfg_new->prefetch_size) {
+        PARAM_UPDT_MSG(blkname, "prefetch_size", "%u",
+                       cfg_tgt->prefetch_size, cfg_new->prefetch_size);
+        cfg_tgt->prefetch_size = cfg_new->prefetch_size;
+    }
+
+    if (cfg_tgt->db_list_threads != cfg_new->db_list_threads) {
+        PARAM_UPDT_MSG(blkname, "db_list_threads", "%u",
+                       cfg_tgt->db_list_threads, cfg_new->db_list_threads);
+        cfg_tgt->db_list_threads = cfg_new->db_list_threads;
+    }
+
     if (cfg_tgt->pre_maintenance_window != cfg_new->pre_maintenance_window) {
         PARAM_UPDT_MSG(blkname, "pre_maintenance_window", "%lu",
                        cfg_tgt->pre_maintenance_window,
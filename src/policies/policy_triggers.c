@@ -1430,6 +1430,11 @@ static void report_policy_run(policy_info_t *pol, policy_param_t *param,
         }
     }
 
+    /* time the workers feed waited for listing candidates */
+    DisplayLog(LVL_MAJOR, tag(pol),
+               "Listing stall time: %.2fs (%.1f%% of the run)",
+               summary->list_stall, 100.0 * summary->list_stall / spent);
+
     store_policy_run_stats(pol, summary->policy_start, time_end,
                            trigger_buff, status_buff);
     free(trigger_buff);
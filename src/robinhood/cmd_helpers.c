@@ -23,6 +23,7 @@
 
 #include <glib.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "uidgidcache.h"
 #include "cmd_helpers.h"
@@ -44,7 +45,6 @@ static unsigned int array_len;   /* number of elements in array. */
 static unsigned int array_first; /* index of first valid element in array. */
 #define array_used (array_len-array_first)
 
-#define LS_CHUNK    1  /* TODO - ListMgr_GetChild will get confused if not 1 */
 
 static size_t what_2_power(size_t s)
 {
@@ -132,36 +132,151 @@ static int add_id_list(const wagon_t *list, unsigned int count)
     return 0;
 }
 
-/** release a list of ids from the array */
-static inline void rbh_scrub_release_list(unsigned int first,
-                                          unsigned int count)
+/** shared state of scrubbing threads */
+struct scrub_ctx {
+    pthread_mutex_t     lock;       /**< protects dir_array and this struct */
+    pthread_cond_t      cond;       /**< signaled when dirs are added or
+                                         when a thread becomes idle */
+    unsigned int        nb_threads;
+    unsigned int        busy;       /**< number of threads listing dirs */
+    bool                stop;       /**< stop scrubbing on fatal error */
+    int                 last_err;
+
+    lmgr_filter_t       filter;
+    attr_mask_t         dir_attr_mask;
+    scrub_callback_t    cb_func;
+    void               *arg;
+};
+
+/** extra scrubbing thread, with its own DB connection */
+struct scrub_worker {
+    pthread_t           thread;
+    lmgr_t              lmgr;
+    struct scrub_ctx   *ctx;
+};
+
+/** release attributes and ids returned by ListMgr_GetChild() */
+static void scrub_free_children(wagon_t *child_ids, attr_set_t *child_attrs,
+                                unsigned int res_count)
 {
-    free_wagon(dir_array, first, first + count);
+    int i;
 
-    if (first != array_first)
-        DisplayLog(LVL_CRIT, SCRUB_TAG,
-                   "IMPLEMENTATION ISSUE: array_first was %u, is now %u\n",
-                   first, array_first);
-    array_first += count;
+    if (child_attrs) {
+        for (i = 0; i < res_count; i++)
+            ListMgr_FreeAttrs(&child_attrs[i]);
+        MemFree(child_attrs);
+    }
+
+    if (child_ids) {
+        free_wagon(child_ids, 0, res_count);
+        MemFree(child_ids);
+    }
+}
+
+/**
+ * Process directories from the shared array until it is empty
+ * and no other thread is listing directories.
+ */
+static void scrub_loop(lmgr_t *p_mgr, struct scrub_ctx *ctx)
+{
+    wagon_t curr_array[LS_CHUNK];
+    unsigned int count;
+    int rc;
+
+    for (;;) {
+        unsigned int res_count = 0;
+        wagon_t *child_ids = NULL;
+        attr_set_t *child_attrs = NULL;
+        bool fatal = false;
+
+        P(ctx->lock);
+        /* wait for directories to process, or for the end of the scrub */
+        while (array_used == 0 && ctx->busy > 0 && !ctx->stop)
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+
+        if (array_used == 0 || ctx->stop) {
+            /* wake up other waiting threads */
+            pthread_cond_broadcast(&ctx->cond);
+            V(ctx->lock);
+            return;
+        }
+
+        /* share available dirs between threads, up to LS_CHUNK */
+        count = MIN2(MAX2(array_used / ctx->nb_threads, 1), LS_CHUNK);
 
 #ifdef _DEBUG_ID_LIST
-    printf("released %u-%u\n", array_first - count, array_first - 1);
+        printf("processing %u-%u\n", array_first, array_first + count - 1);
 #endif
+        /* take the set of entry_ids out of the array */
+        memcpy(curr_array, &dir_array[array_first], count * sizeof(wagon_t));
+        array_first += count;
+        ctx->busy++;
+        V(ctx->lock);
+
+        /* read children */
+        rc = ListMgr_GetChild(p_mgr, &ctx->filter, curr_array, count,
+                              ctx->dir_attr_mask, &child_ids, &child_attrs,
+                              &res_count);
+        if (rc) {
+            DisplayLog(LVL_CRIT, SCRUB_TAG,
+                       "ListMgr_GetChild() terminated with error %d", rc);
+            fatal = true;
+        } else {
+            /* Call the callback func for each listed dir */
+            rc = ctx->cb_func(p_mgr, child_ids, child_attrs, res_count,
+                              ctx->arg);
+        }
+
+        /* can release the list of input ids */
+        free_wagon(curr_array, 0, count);
+
+        P(ctx->lock);
+        if (rc)
+            /* XXX break the scan? */
+            ctx->last_err = rc;
+
+        /* copy entry ids before freeing them */
+        /* TODO: we could transfer the pathname instead of strdup() them. */
+        if (!fatal && add_id_list(child_ids, res_count) != 0)
+            fatal = true;
+
+        if (fatal)
+            ctx->stop = true;
+        ctx->busy--;
+        pthread_cond_broadcast(&ctx->cond);
+        V(ctx->lock);
+
+        scrub_free_children(child_ids, child_attrs, res_count);
+    }
+}
+
+static void *scrub_thr(void *arg)
+{
+    struct scrub_worker *w = arg;
+
+    scrub_loop(&w->lmgr, w->ctx);
+    return NULL;
 }
 
 /** scan sets of directories
+ * \param nb_threads number of threads listing directories in parallel
+ *        (each extra thread opens its own DB connection).
  * \param cb_func, callback function for each set of directory
  */
 int rbh_scrub(lmgr_t *p_mgr, const wagon_t *id_list,
               unsigned int id_count, attr_mask_t dir_attr_mask,
-              scrub_callback_t cb_func, void *arg)
+              unsigned int nb_threads, scrub_callback_t cb_func, void *arg)
 {
-    wagon_t *curr_array;
-    unsigned int count;
-    lmgr_filter_t filter;
+    struct scrub_ctx ctx = {
+        .nb_threads = 1,
+        .dir_attr_mask = dir_attr_mask,
+        .cb_func = cb_func,
+        .arg = arg,
+    };
+    struct scrub_worker *workers = NULL;
     filter_value_t fv;
-    int i, rc;
-    int last_err = 0;
+    unsigned int i, started = 0;
+    int rc;
 
     rc = add_id_list(id_list, id_count);
     if (rc)
@@ -169,76 +284,65 @@ int rbh_scrub(lmgr_t *p_mgr, const wagon_t *id_list,
 
     /* only get subdirs (for scanning) */
     fv.value.val_str = STR_TYPE_DIR;
-    lmgr_simple_filter_init(&filter);
-    lmgr_simple_filter_add(&filter, ATTR_INDEX_type, EQUAL, fv, 0);
+    lmgr_simple_filter_init(&ctx.filter);
+    lmgr_simple_filter_add(&ctx.filter, ATTR_INDEX_type, EQUAL, fv, 0);
 
-    /* while the array is not empty */
-    while (array_used > 0) {
-        unsigned int res_count = 0;
-        wagon_t *child_ids;
-        attr_set_t *child_attrs;
-
-        /* get a set of entry_ids */
-        curr_array = &dir_array[array_first];
-        if (array_used < LS_CHUNK) {
-            /* get all available dirs */
-            count = array_used;
-        } else {
-            /* get a constant chunk */
-            count = LS_CHUNK;
-        }
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
 
-#ifdef _DEBUG_ID_LIST
-        printf("processing %u-%u\n", array_first, array_first + count - 1);
-#endif
+    if (nb_threads > 1) {
+        workers = MemCalloc(nb_threads - 1, sizeof(*workers));
+        if (workers == NULL)
+            DisplayLog(LVL_MAJOR, SCRUB_TAG, "Cannot allocate scrubbing "
+                       "threads: running a single thread");
+    }
 
-        /* read childs */
-        res_count = 0;
-        child_ids = NULL;
-        child_attrs = NULL;
+    /* set the thread count before starting them */
+    ctx.nb_threads = workers ? nb_threads : 1;
 
-        rc = ListMgr_GetChild(p_mgr, &filter, curr_array, count, dir_attr_mask,
-                              &child_ids, &child_attrs, &res_count);
+    for (i = 0; workers != NULL && i < nb_threads - 1; i++) {
+        workers[i].ctx = &ctx;
 
+        rc = ListMgr_InitAccess(&workers[i].lmgr);
         if (rc) {
-            DisplayLog(LVL_CRIT, SCRUB_TAG,
-                       "ListMgr_GetChild() terminated with error %d", rc);
-            /* @TODO free allocated resources */
+            DisplayLog(LVL_MAJOR, SCRUB_TAG, "Failed to open an extra DB "
+                       "connection (error %d): running %u scrubbing threads",
+                       rc, started + 1);
             break;
         }
 
-        /* Call the callback func for each listed dir */
-        rc = cb_func(child_ids, child_attrs, res_count, arg);
-        if (rc)
-            /* XXX break the scan? */
-            last_err = rc;
-
-        /* can release the list of input ids */
-        rbh_scrub_release_list(array_first, count);
-
-        /* copy entry ids before freeing them */
-        /* TODO: we could transfer the pathname instead of strdup() them. */
-        add_id_list(child_ids, res_count);
-
-        /* attributes no longer needed */
-        /* release attrs */
-        if (child_attrs) {
-            for (i = 0; i < res_count; i++)
-                ListMgr_FreeAttrs(&child_attrs[i]);
-            MemFree(child_attrs);
-            child_attrs = NULL;
+        rc = pthread_create(&workers[i].thread, NULL, scrub_thr, &workers[i]);
+        if (rc) {
+            DisplayLog(LVL_MAJOR, SCRUB_TAG, "Failed to start scrubbing "
+                       "thread: %s", strerror(rc));
+            ListMgr_CloseAccess(&workers[i].lmgr);
+            break;
         }
+        started++;
+    }
+    if (workers)
+        DisplayLog(LVL_DEBUG, SCRUB_TAG, "%u scrubbing threads started",
+                   started + 1);
 
-        /* free the returned id array */
-        if (child_ids) {
-            free_wagon(child_ids, 0, res_count);
-            MemFree(child_ids);
-            child_ids = NULL;
-        }
+    /* the current thread also lists directories, using the caller's
+     * DB connection */
+    scrub_loop(p_mgr, &ctx);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ListMgr_CloseAccess(&workers[i].lmgr);
     }
-    lmgr_simple_filter_free(&filter);
+    MemFree(workers);
+
+    /* release remaining ids, if scrubbing was interrupted */
+    free_wagon(dir_array, array_first, array_len);
+    array_first = array_len;
+
+    pthread_cond_destroy(&ctx.cond);
+    pthread_mutex_destroy(&ctx.lock);
+    lmgr_simple_filter_free(&ctx.filter);
 
-    return last_err;
+    return ctx.last_err;
 }
 
 int Path2Id(const char *path, entry_id_t *id)
@@ -38,17 +38,26 @@
 /** initialize internal resources (glib, llapi, internal resources...) */
 int rbh_init_internals(void);
 
-/** The caller's function to be called for scanned entries */
-typedef int (*scrub_callback_t) (wagon_t *id_list,
+/** max number of directories listed at once by rbh_scrub() */
+#define LS_CHUNK    64
+
+/**
+ * The caller's function to be called for scanned entries.
+ * p_mgr is the DB connection of the calling scrubbing thread.
+ * With several scrubbing threads, it can be called concurrently.
+ */
+typedef int (*scrub_callback_t) (lmgr_t *p_mgr, wagon_t *id_list,
                                  attr_set_t *attr_list,
                                  unsigned int entry_count, void *arg);
 
 /** scan sets of directories
+ * \param nb_threads number of threads listing directories in parallel
+ *        (each extra thread opens its own DB connection).
  * \param cb_func, callback function for each set of directory
  */
 int rbh_scrub(lmgr_t *p_mgr, const wagon_t *id_list,
               unsigned int id_count, attr_mask_t dir_attr_mask,
-              scrub_callback_t cb_func, void *arg);
+              unsigned int nb_threads, scrub_callback_t cb_func, void *arg);
 
 int Path2Id(const char *path, entry_id_t *id);
 
@@ -506,6 +506,9 @@ static void dump_stats(lmgr_t *lmgr, const int *module_mask,
         EntryProcessor_DumpCurrentStages();
     }
 
+    ListMgr_PathCacheDumpStats();
+    ListMgr_AcctRebuildDumpStats();
+
     if (*module_mask & MODULE_MASK_POLICY_RUN
         && *p_policy_mask != 0LL && policy_run_cpt != 0 && policy_run != NULL) {
         int i;
@@ -1749,8 +1752,18 @@ int main(int argc, char **argv)
         int nb_stages = 3;
         rc = EntryProcessor_Init(0, options.flags, &nb_stages);
 #else
-        rc = EntryProcessor_Init(STD_PIPELINE, options.flags,
-                                 &options.diff_mask);
+        pipeline_flavor_e flavor = STD_PIPELINE;
+
+        /* one-shot full scan of an empty database: bulk load entries
+         * (if enabled in config) */
+        if ((options.flags & RUNFLG_ONCE)
+            && (action_mask & ACTION_MASK_SCAN)
+            && !(action_mask & ACTION_MASK_HANDLE_EVENTS)
+            && !options.partial_scan && attr_mask_is_null(options.diff_mask)
+            && ListMgr_BulkLoadStart() == DB_SUCCESS)
+            flavor = LOAD_PIPELINE;
+
+        rc = EntryProcessor_Init(flavor, options.flags, &options.diff_mask);
 #endif
         if (rc) {
             DisplayLog(LVL_CRIT, MAIN_TAG,
@@ -1836,6 +1849,8 @@ int main(int argc, char **argv)
         && (action_mask & (ACTION_MASK_SCAN | ACTION_MASK_HANDLE_EVENTS))) {
         /* Pipeline must be flushed */
         EntryProcessor_Terminate(true);
+        /* in case the scan did not complete (no-op if no bulk load) */
+        ListMgr_BulkLoadEnd();
 
 #ifdef HAVE_CHANGELOGS
         if (action_mask & ACTION_MASK_HANDLE_EVENTS) {
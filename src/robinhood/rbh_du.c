@@ -53,6 +53,9 @@ static struct option option_tab[] = {
     {"human-readable", no_argument, NULL, 'H'},
     {"details", no_argument, NULL, 'd'},
 
+    /* behavior options */
+    {"threads", required_argument, NULL, 'j'},
+
     /* config file options */
     {"config-file", required_argument, NULL, 'f'},
 
@@ -67,7 +70,7 @@ static struct option option_tab[] = {
 
 };
 
-#define SHORT_OPT_STRING    "u:g:t:S:scbkmHdf:l:hV"
+#define SHORT_OPT_STRING    "u:g:t:S:scbkmHdj:f:l:hV"
 #define TYPE_HELP "'f' (file), 'd' (dir), 'l' (symlink), 'b' (block), "\
                   "'c' (char), 'p' (named pipe/FIFO), 's' (socket)"
 
@@ -100,14 +103,18 @@ struct du_opt {
     display_unit disp_how;
     unsigned int sum:1;
 
+    /* number of scrubbing threads */
+    unsigned int threads;
+
 } prog_options = {
-    .disp_what = disp_usage, .disp_how = disp_kilo
+    .disp_what = disp_usage, .disp_how = disp_kilo, .threads = 1
 };
 
+/* serialize stats updates from scrubbing threads */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /** filter on entries to be summed */
 static lmgr_filter_t    entry_filter;
-/** same as entry_filter + condition on parent id */
-static lmgr_filter_t    parent_filter;
 
 /* filter for root entries */
 static bool_node_t      match_expr;
@@ -291,7 +298,6 @@ static int mkfilters(void)
 
     /* create DB filters */
     lmgr_simple_filter_init(&entry_filter);
-    lmgr_simple_filter_init(&parent_filter);
 
     if (is_expr) {
         char expr[RBH_PATH_MAX];
@@ -303,8 +309,6 @@ static int mkfilters(void)
         /* Do not use 'OR' expression there */
         convert_boolexpr_to_simple_filter(&match_expr, &entry_filter,
                                           prog_options.smi, NULL, 0, BOOL_AND);
-        convert_boolexpr_to_simple_filter(&match_expr, &parent_filter,
-                                          prog_options.smi, NULL, 0, BOOL_AND);
     }
 
     return 0;
@@ -337,6 +341,11 @@ static const char *help_string =
     "       show detailed stats: type, count, size, disk usage\n"
     "       (display in bytes by default)\n"
     "\n"
+    _B "Behavior:" B_ "\n"
+    "    " _B "-j" B_ " " _U "count" U_ ", " _B "--threads" B_ "=" _U "count" U_ "\n"
+    "       number of threads (and DB connections) browsing the namespace\n"
+    "       in parallel (default: 1)\n"
+    "\n"
     _B "Program options:" B_ "\n"
     "    " _B "-f" B_ " " _U "config_file" U_ "\n"
     "    " _B "-l" B_ " " _U "log_level" U_ "\n"
@@ -450,48 +459,85 @@ static report_field_descr_t dir_info[REPCNT] = {
 };
 
 /* directory callback */
-static int dircb(wagon_t *id_list, attr_set_t *attr_list,
+static int dircb(lmgr_t *p_mgr, wagon_t *id_list, attr_set_t *attr_list,
                  unsigned int entry_count, void *arg)
 {
     /* sum child entries stats for all directories */
-    int i, rc;
-    filter_value_t fv;
+    int i, rc = 0;
     struct lmgr_report_t *it;
     db_value_t result[REPCNT];
     unsigned int result_count;
     stats_du_t *stats = (stats_du_t *) arg;
+    stats_du_t dir_stats[TYPE_COUNT];
+    lmgr_filter_t parent_filter;
+
+    memset(dir_stats, 0, sizeof(dir_stats));
 
-    /* filter on parent_id */
+    /* filter on entries + parent_id (specific to each scrubbing thread) */
+    lmgr_simple_filter_init(&parent_filter);
+    if (is_expr)
+        convert_boolexpr_to_simple_filter(&match_expr, &parent_filter,
+                                          prog_options.smi, NULL, 0, BOOL_AND);
 
-    for (i = 0; i < entry_count; i++) {
-        fv.value.val_id = id_list[i].id;
-        rc = lmgr_simple_filter_add_or_replace(&parent_filter,
-                                               ATTR_INDEX_parent_id,
-                                               EQUAL, fv, 0);
+    /* sum the children of several directories at once */
+    for (i = 0; i < entry_count; i += LS_CHUNK) {
+        unsigned int count = MIN2(entry_count - i, LS_CHUNK);
+        db_type_u ids[LS_CHUNK];
+        filter_value_t fv;
+        int j;
+
+        if (count == 1) {
+            fv.value.val_id = id_list[i].id;
+            rc = lmgr_simple_filter_add_or_replace(&parent_filter,
+                                                   ATTR_INDEX_parent_id,
+                                                   EQUAL, fv, 0);
+        } else {
+            for (j = 0; j < count; j++)
+                ids[j].val_id = id_list[i + j].id;
+            fv.list.count = count;
+            fv.list.values = ids;
+            rc = lmgr_simple_filter_add_or_replace(&parent_filter,
+                                                   ATTR_INDEX_parent_id,
+                                                   IN, fv, 0);
+        }
         if (rc)
-            return rc;
+            goto out;
 
-        it = ListMgr_Report(&lmgr, dir_info, REPCNT, NULL, &parent_filter,
+        it = ListMgr_Report(p_mgr, dir_info, REPCNT, NULL, &parent_filter,
                             NULL);
-        if (it == NULL)
-            return -1;
+        if (it == NULL) {
+            rc = -1;
+            goto out;
+        }
 
         result_count = REPCNT;
         while ((rc =
                 ListMgr_GetNextReportItem(it, result, &result_count,
                                           NULL)) == DB_SUCCESS) {
             unsigned int idx = db2type(result[0].value_u.val_str);
-            stats[idx].count += result[1].value_u.val_biguint;
-            stats[idx].blocks += result[2].value_u.val_biguint;
-            stats[idx].size += result[3].value_u.val_biguint;
+            dir_stats[idx].count += result[1].value_u.val_biguint;
+            dir_stats[idx].blocks += result[2].value_u.val_biguint;
+            dir_stats[idx].size += result[3].value_u.val_biguint;
 
             result_count = REPCNT;
         }
+        rc = 0;
 
         ListMgr_CloseReport(it);
     }
 
-    return 0;
+    /* stats may be updated by several scrubbing threads */
+    P(stats_lock);
+    for (i = 0; i < TYPE_COUNT; i++) {
+        stats[i].count += dir_stats[i].count;
+        stats[i].blocks += dir_stats[i].blocks;
+        stats[i].size += dir_stats[i].size;
+    }
+    V(stats_lock);
+
+out:
+    lmgr_simple_filter_free(&parent_filter);
+    return rc;
 }
 
 /**
@@ -625,7 +671,7 @@ static int list_content(char **id_list, int id_count)
         root_attrs.attr_mask = attr_mask_or(&disp_mask, &query_mask);
         rc = ListMgr_Get(&lmgr, &ids[i].id, &root_attrs);
         if (rc == 0)
-            dircb(&ids[i], &root_attrs, 1, stats);
+            dircb(&lmgr, &ids[i], &root_attrs, 1, stats);
         else {
             DisplayLog(LVL_VERB, DU_TAG, "Notice: no attrs in DB for %s",
                        id_list[i]);
@@ -655,7 +701,7 @@ static int list_content(char **id_list, int id_count)
                 }
             }
 
-            dircb(&ids[i], &root_attrs, 1, stats);
+            dircb(&lmgr, &ids[i], &root_attrs, 1, stats);
         }
 
         /* sum root if it matches */
@@ -670,7 +716,8 @@ static int list_content(char **id_list, int id_count)
 
         if (!prog_options.sum) {
             /* if not group all, run and display stats now */
-            rc = rbh_scrub(&lmgr, &ids[i], 1, disp_mask, dircb, stats);
+            rc = rbh_scrub(&lmgr, &ids[i], 1, disp_mask,
+                           prog_options.threads, dircb, stats);
 
             if (rc)
                 goto out;
@@ -680,7 +727,8 @@ static int list_content(char **id_list, int id_count)
     }
 
     if (prog_options.sum) {
-        rc = rbh_scrub(&lmgr, ids, id_count, disp_mask, dircb, stats);
+        rc = rbh_scrub(&lmgr, ids, id_count, disp_mask,
+                       prog_options.threads, dircb, stats);
         if (rc)
             goto out;
         print_stats("total", stats);
@@ -742,6 +790,16 @@ int main(int argc, char **argv)
         case 'H':
             prog_options.disp_how = disp_human;
             break;
+        case 'j':
+            prog_options.threads = str2int(optarg);
+            if (prog_options.threads == (unsigned int)-1
+                || prog_options.threads == 0) {
+                fprintf(stderr,
+                        "invalid threads value '%s': positive integer "
+                        "expected\n", optarg);
+                exit(1);
+            }
+            break;
 
         case 'u':
             prog_options.match_user = 1;
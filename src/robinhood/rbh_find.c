@@ -46,6 +46,7 @@
 #define INAME_OPT   264
 #define PRINT0_OPT  265
 #define NLINK_OPT   266
+#define THREADS_OPT 267
 
 static struct option option_tab[] = {
     {"user", required_argument, NULL, 'u'},
@@ -85,6 +86,7 @@ static struct option option_tab[] = {
     /* query options */
     {"not", no_argument, NULL, '!'},
     {"nobulk", no_argument, NULL, 'b'},
+    {"threads", required_argument, NULL, THREADS_OPT},
 
     /* config file options */
     {"config-file", required_argument, NULL, 'f'},
@@ -112,10 +114,14 @@ static struct option option_tab[] = {
 
 static lmgr_t lmgr;
 
+/* serialize the output of scrubbing threads */
+static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* program options */
 struct find_opt prog_options = {
     .bulk = bulk_unspec,
     .print = 1,
+    .threads = 1,
 };
 
 static const attr_mask_t LS_DISPLAY_MASK = {.std = ATTR_MASK_nlink
@@ -519,7 +525,11 @@ static const char *help_string =
     "       to bulk DB request instead of browsing the namespace from the DB.\n"
     "       This speeds up the query, but this may result in an arbitrary output ordering,\n"
     "       and a single path may be displayed in case of multiple hardlinks.\n"
-    "       Use -nobulk to disable this optimization.\n" "\n" _B
+    "       Use -nobulk to disable this optimization.\n"
+    "    " _B "-threads" B_ " " _U "count" U_ "\n"
+    "       Number of threads (and DB connections) browsing the namespace in parallel\n"
+    "       (default: 1). Using several threads results in an arbitrary output ordering.\n"
+    "\n" _B
     "Program options:" B_ "\n" "    " _B "-f" B_ " " _U "config_file" U_ "\n"
     "    " _B "-d" B_ " " _U "log_level" U_ "\n"
     "       CRIT, MAJOR, EVENT, VERB, DEBUG, FULL\n" "    " _B "-h" B_ ", " _B
@@ -1003,54 +1013,61 @@ static void print_entry(const wagon_t *id, const attr_set_t *attrs)
         g_string_free(osts, TRUE);
 }
 
+/* display an entry if it matches the expression (dirs and children) */
+static void print_if_match(const wagon_t *id, const attr_set_t *attrs)
+{
+    if (!is_expr || (entry_matches(&id->id, attrs, &match_expr, NULL,
+                                   prog_options.filter_smi) == POLICY_MATCH)) {
+        /* output of parallel scrubbing threads must not be mixed */
+        P(print_lock);
+        print_entry(id, attrs);
+        V(print_lock);
+    }
+}
+
 /* directory callback */
-static int dircb(wagon_t *id_list, attr_set_t *attr_list,
+static int dircb(lmgr_t *p_mgr, wagon_t *id_list, attr_set_t *attr_list,
                  unsigned int entry_count, void *dummy)
 {
     /* retrieve child entries for all directories */
     int i, rc;
 
     for (i = 0; i < entry_count; i++) {
+        /* don't display dirs if no_dir is specified */
+        if (!(prog_options.no_dir && ATTR_MASK_TEST(&attr_list[i], type)
+              && !strcasecmp(ATTR(&attr_list[i], type), STR_TYPE_DIR)))
+            /* match condition on dirs parent */
+            print_if_match(&id_list[i], &attr_list[i]);
+    }
+
+    if (prog_options.dir_only)
+        return 0;
+
+    /* list the children of several directories at once */
+    for (i = 0; i < entry_count; i += LS_CHUNK) {
         wagon_t *chids = NULL;
         attr_set_t *chattrs = NULL;
         unsigned int chcount = 0;
         int j;
 
-        /* match condition on dirs parent */
-        if (!is_expr || (entry_matches(&id_list[i].id, &attr_list[i],
-                                       &match_expr, NULL,
-                                       prog_options.filter_smi)
-                         == POLICY_MATCH)) {
-            /* don't display dirs if no_dir is specified */
-            if (!(prog_options.no_dir && ATTR_MASK_TEST(&attr_list[i], type)
-                  && !strcasecmp(ATTR(&attr_list[i], type), STR_TYPE_DIR)))
-                print_entry(&id_list[i], &attr_list[i]);
+        rc = ListMgr_GetChild(p_mgr, &entry_filter, id_list + i,
+                              MIN2(entry_count - i, LS_CHUNK),
+                              attr_mask_or(&disp_mask, &query_mask),
+                              &chids, &chattrs, &chcount);
+        if (rc) {
+            DisplayLog(LVL_MAJOR, FIND_TAG,
+                       "ListMgr_GetChild() failed with error %d", rc);
+            return rc;
         }
 
-        if (!prog_options.dir_only) {
-            rc = ListMgr_GetChild(&lmgr, &entry_filter, id_list + i, 1,
-                                  attr_mask_or(&disp_mask, &query_mask),
-                                  &chids, &chattrs, &chcount);
-            if (rc) {
-                DisplayLog(LVL_MAJOR, FIND_TAG,
-                           "ListMgr_GetChild() failed with error %d", rc);
-                return rc;
-            }
-
-            for (j = 0; j < chcount; j++) {
-                if (!is_expr || (entry_matches(&chids[j].id, &chattrs[j],
-                                               &match_expr, NULL,
-                                               prog_options.filter_smi)
-                                 == POLICY_MATCH))
-                    print_entry(&chids[j], &chattrs[j]);
-
-                ListMgr_FreeAttrs(&chattrs[j]);
-            }
-
-            free_wagon(chids, 0, chcount);
-            MemFree(chids);
-            MemFree(chattrs);
+        for (j = 0; j < chcount; j++) {
+            print_if_match(&chids[j], &chattrs[j]);
+            ListMgr_FreeAttrs(&chattrs[j]);
         }
+
+        free_wagon(chids, 0, chcount);
+        MemFree(chids);
+        MemFree(chattrs);
     }
     return 0;
 }
@@ -1231,7 +1248,7 @@ static int list_contents(char **id_list, int id_count)
         root_attrs.attr_mask = attr_mask_or(&disp_mask, &query_mask);
         rc = ListMgr_Get(&lmgr, &ids[i].id, &root_attrs);
         if (rc == 0)
-            dircb(&ids[i], &root_attrs, 1, NULL);
+            dircb(&lmgr, &ids[i], &root_attrs, 1, NULL);
         else {
             DisplayLog(LVL_VERB, FIND_TAG, "Notice: no attrs in DB for %s",
                        id_list[i]);
@@ -1270,11 +1287,11 @@ static int list_contents(char **id_list, int id_count)
                 ATTR(&root_attrs, name)[0] = '\0';
             }
 
-            dircb(&ids[i], &root_attrs, 1, NULL);
+            dircb(&lmgr, &ids[i], &root_attrs, 1, NULL);
         }
 
         rc = rbh_scrub(&lmgr, &ids[i], 1, attr_mask_or(&disp_mask, &query_mask),
-                       dircb, NULL);
+                       prog_options.threads, dircb, NULL);
     }
 
  out:
@@ -1361,6 +1378,17 @@ int main(int argc, char **argv)
             neg = false;
             break;
 
+        case THREADS_OPT:
+            prog_options.threads = str2int(optarg);
+            if (prog_options.threads == (unsigned int)-1
+                || prog_options.threads == 0) {
+                fprintf(stderr,
+                        "invalid threads value '%s': positive integer "
+                        "expected\n", optarg);
+                exit(1);
+            }
+            break;
+
         case NLINK_OPT:
             toggle_option(match_nlink, "nlink");
             prog_options.nlink_compar = prefix2comp(&optarg, neg);
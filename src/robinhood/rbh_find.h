@@ -66,6 +66,9 @@ struct find_opt {
         force_nobulk
     } bulk;
 
+    /* number of scrubbing threads */
+    unsigned int threads;
+
     /* output flags */
     unsigned int ls:1;
     unsigned int lsost:1;
@@ -67,6 +67,9 @@
 #define OPT_SIZE_PROFILE  330
 #define OPT_BY_SZ_RATIO   331
 
+#define OPT_EXPORT_SNAPSHOT 340
+#define OPT_SNAPSHOT        341
+
 /* options flags */
 #define OPT_FLAG_CSV        0x0001
 #define OPT_FLAG_NOHEADER   0x0002
@@ -165,6 +168,9 @@ static struct option option_tab[] = {
     {"count-min", required_argument, NULL, OPT_COUNT_MIN},
     {"reverse", no_argument, NULL, 'r'},
 
+    {"export-snapshot", required_argument, NULL, OPT_EXPORT_SNAPSHOT},
+    {"snapshot", required_argument, NULL, OPT_SNAPSHOT},
+
     {"next-maintenance", optional_argument, NULL, SET_NEXT_MAINT},
     {"cancel-maintenance", no_argument, NULL, CLEAR_NEXT_MAINT},
 
@@ -293,6 +299,15 @@ static const char *acct_help =
     "    " _B "-F" B_ ", " _B "--force-no-acct" B_ "\n"
     "        Generate the report without using accounting table (slower)\n";
 
+static const char *snapshot_help =
+    _B "Snapshots:" B_ "\n"
+    "    " _B "--export-snapshot" B_ " " _U "file" U_ "\n"
+    "        Export the contents of the database to a compressed columnar file.\n"
+    "    " _B "--snapshot" B_ " " _U "file" U_ "\n"
+    "        Build the reports from the given snapshot instead of the database.\n"
+    "        Supported reports: --fs-info, --user-info, --group-info, --class-info,\n"
+    "        --status-info, --top-users.\n";
+
 static const char *cfg_help =
     _B "Config file options:" B_ "\n"
     "    " _B "-f" B_ " " _U "cfg_file" U_ ", " _B "--config-file=" B_ _U "cfg_file" U_ "\n"
@@ -323,6 +338,7 @@ static inline void display_help(const char *bin_name)
     printf("%s\n", maintenance_help);
     printf("%s\n", filter_help);
     printf("%s\n", acct_help);
+    printf("%s\n", snapshot_help);
     printf("%s\n", cfg_help);
     printf("%s\n", output_help);
     printf("%s", misc_help);
@@ -2646,6 +2662,10 @@ int main(int argc, char **argv)
     char *status_info_name = NULL;
     char *status_info_value = NULL;
 
+    const char *export_file = NULL;
+    const char *snapshot_file = NULL;
+    time_t snapshot_time = 0;
+
     time_t next_maint = 0;
     bool get_next_maint = false;
     bool cancel_next_maint = false;
@@ -2944,6 +2964,14 @@ int main(int argc, char **argv)
             flags |= OPT_FLAG_SPROF;
             break;
 
+        case OPT_EXPORT_SNAPSHOT:
+            export_file = optarg;
+            break;
+
+        case OPT_SNAPSHOT:
+            snapshot_file = optarg;
+            break;
+
         case ':':
         case '?':
         default:
@@ -2973,11 +3001,27 @@ int main(int argc, char **argv)
 #ifdef _LUSTRE
         && !dump_ost
 #endif
-        && !next_maint && !get_next_maint && !cancel_next_maint) {
+        && !next_maint && !get_next_maint && !cancel_next_maint
+        && export_file == NULL) {
         display_help(bin);
         exit(1);
     }
 
+    /* snapshots only contain entry attributes */
+    if (snapshot_file != NULL
+        && (activity || entry_info || topdirs || topsize || old_files
+            || old_dirs || deferred_rm || dump_all || dump_user || dump_group
+#ifdef _LUSTRE
+            || dump_ost
+#endif
+            || status_name != NULL || next_maint || get_next_maint
+            || export_file != NULL || !EMPTY_STRING(path_filter))) {
+        fprintf(stderr, "Error: only --fs-info, --user-info, --group-info, "
+                "--class-info, --status-info and --top-users reports are "
+                "supported with --snapshot (no path filter)\n");
+        exit(1);
+    }
+
     rc = rbh_init_internals();
     if (rc != 0)
         exit(rc);
@@ -3010,13 +3054,14 @@ int main(int argc, char **argv)
         exit(rc);
     }
 
-    if ((rc = InitFS()) != 0)
+    if (snapshot_file == NULL && (rc = InitFS()) != 0)
         fprintf(stderr,
                 "Warning: cannot access filesystem %s (%s), some reports may be incomplete or not available.\n",
                 global_config.fs_path, strerror(abs(rc)));
 
     /* Initialize list manager */
-    rc = ListMgr_Init(LIF_REPORT_ONLY);
+    rc = ListMgr_Init(LIF_REPORT_ONLY
+                      | (snapshot_file != NULL ? LIF_NO_DB : 0));
     if (rc) {
         DisplayLog(LVL_CRIT, REPORT_TAG,
                    "Error initializing list manager: %s (%d)", lmgr_err2str(rc),
@@ -3026,6 +3071,25 @@ int main(int argc, char **argv)
         DisplayLog(LVL_DEBUG, REPORT_TAG,
                    "ListManager successfully initialized");
 
+    if (snapshot_file != NULL) {
+        /* reports are built from the snapshot, no database access */
+        rc = ListMgr_OpenSnapshot(&lmgr, snapshot_file, &snapshot_time);
+        if (rc) {
+            DisplayLog(LVL_CRIT, REPORT_TAG, "Error opening snapshot %s: %s",
+                       snapshot_file, lmgr_err2str(rc));
+            exit(rc);
+        }
+        if (!NOHEADER(flags)) {
+            char date[128];
+            struct tm t;
+
+            strftime(date, sizeof(date), "%Y/%m/%d %T",
+                     localtime_r(&snapshot_time, &t));
+            printf("Using snapshot %s (%s)\n\n", snapshot_file, date);
+        }
+        goto reports;
+    }
+
     if (CheckLastFS() != 0)
         exit(1);
 
@@ -3037,6 +3101,20 @@ int main(int argc, char **argv)
         exit(rc);
     }
 
+    if (export_file != NULL) {
+        uint64_t count = 0;
+
+        rc = ListMgr_ExportSnapshot(&lmgr, export_file, &count);
+        if (rc) {
+            DisplayLog(LVL_CRIT, REPORT_TAG, "Error exporting snapshot to %s:"
+                       " %s", export_file, lmgr_err2str(rc));
+            exit(rc);
+        }
+        printf("%"PRIu64" entries exported to %s\n", count, export_file);
+    }
+
+ reports:
+
     /* retrieve and display info */
     if (activity)
         report_activity(flags);
@@ -3124,7 +3202,10 @@ int main(int argc, char **argv)
     if (get_next_maint)
         maintenance_get(flags);
 
-    ListMgr_CloseAccess(&lmgr);
+    if (snapshot_file != NULL)
+        ListMgr_CloseSnapshot(&lmgr);
+    else
+        ListMgr_CloseAccess(&lmgr);
 
     return 0;   /* for compiler */
 
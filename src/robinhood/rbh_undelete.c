@@ -359,6 +359,9 @@ static void undelete_helper(const entry_id_t *id, const attr_set_t *attrs)
 
     if ((st == RS_FILE_OK) || (st == RS_FILE_DELTA) || (st == RS_FILE_EMPTY)
         || (st == RS_NON_FILE)) {
+        attr_set_t acct_old = ATTR_SET_INIT;
+        bool exists;
+
         /* discard entry from remove list */
         if (ListMgr_SoftRemove_Discard(&lmgr, id) != 0) {
             db_err++;
@@ -369,14 +372,20 @@ static void undelete_helper(const entry_id_t *id, const attr_set_t *attrs)
         /* clean read-only attrs */
         attr_mask_unset_readonly(&new_attrs.attr_mask);
 
+        /* current accounting attributes, if the entry is already in DB */
+        exists = ListMgr_AcctGet(&lmgr, &new_id, &acct_old);
+
         /* insert or update it in the db */
         rc = ListMgr_Insert(&lmgr, &new_id, &new_attrs, true);
-        if (rc == 0)
+        if (rc == 0) {
+            ListMgr_AcctDelta(&lmgr, &new_id, exists ? &acct_old : NULL,
+                              &new_attrs);
             printf("\tEntry successfully updated in the dabatase\n");
-        else {
+        } else {
             db_err++;
             fprintf(stderr, "\tERROR %d inserting entry in the database\n", rc);
         }
+        ListMgr_FreeAttrs(&acct_old);
     }
 }
 
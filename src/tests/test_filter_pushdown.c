@@ -0,0 +1,636 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Test of the translation of policy rules to DB filters: for random
+ * expressions on size, name, type, tree, OST, xattrs and constants, the
+ * filter built by convert_boolexpr_to_filter() must select all the entries
+ * matching the expression. Filters are evaluated in memory, the way the DB
+ * evaluates the request built by filter2str() (one row per stripe).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "policy_rules.h"
+#include "rbh_boolexpr.h"
+#include "global_config.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <libgen.h>
+#include <fnmatch.h>
+#include <assert.h>
+
+#define FS_ROOT         "/fs"
+#define XATTR_NAME      "user.foo"
+
+#define NB_ENTRIES      300
+#define NB_EXPR         20000
+#define MAX_DEPTH       4
+#define MAX_NODES       64
+#define MAX_STRIPES     3
+#define OST_COUNT       4
+
+/* entries of the filesystem, and their extended attribute */
+struct test_entry {
+    attr_set_t   attrs;
+    const char  *xattr;
+#ifdef _LUSTRE
+    stripe_item_t stripes[MAX_STRIPES];
+#endif
+};
+
+static struct test_entry entries[NB_ENTRIES];
+
+static const char *path_parts[] = {
+    "a", "b", "dir", "Dir", "foo", "FOO", "x.log", "data_1", "c.LOG",
+};
+#define PATH_PART_COUNT (sizeof(path_parts) / sizeof(path_parts[0]))
+
+static const char *xattr_values[] = { "", "a", "foo", "Foo", "bar" };
+#define XATTR_VAL_COUNT (sizeof(xattr_values) / sizeof(xattr_values[0]))
+
+static const unsigned long long sizes[] = { 0, 1, 100, 4096, 1048576 };
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+/* patterns of conditions, as written in config files */
+static const char *name_patterns[] = {
+    "foo", "FOO", "*.log", "*.LOG", "?", "[a-c]*", "*o*", "x*", "dir",
+    "[!a]*", "data_?", "*_*",
+};
+#define NAME_PAT_COUNT (sizeof(name_patterns) / sizeof(name_patterns[0]))
+
+static const char *tree_patterns[] = {
+    FS_ROOT, FS_ROOT "/", FS_ROOT "/dir", FS_ROOT "/*", FS_ROOT "/*/foo",
+    FS_ROOT "/d?r", FS_ROOT "/[ab]", FS_ROOT "/DIR", "dir", "dir/a", "*/b",
+    "/other", "/f*",
+};
+#define TREE_PAT_COUNT (sizeof(tree_patterns) / sizeof(tree_patterns[0]))
+
+static const compare_direction_t size_ops[] = {
+    COMP_GRTHAN, COMP_GRTHAN_EQ, COMP_LSTHAN, COMP_LSTHAN_EQ, COMP_EQUAL,
+    COMP_DIFF,
+};
+#define SIZE_OP_COUNT (sizeof(size_ops) / sizeof(size_ops[0]))
+
+static unsigned int seed = 1;
+
+static unsigned int rnd(unsigned int n)
+{
+    return rand_r(&seed) % n;
+}
+
+static void init_entries(void)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < NB_ENTRIES; i++) {
+        attr_set_t *attrs = &entries[i].attrs;
+        unsigned int depth = (i == 0) ? 0 : 1 + rnd(MAX_DEPTH);
+        const char *type;
+
+        ATTR_MASK_INIT(attrs);
+
+        strcpy(ATTR(attrs, fullpath), FS_ROOT);
+        for (j = 0; j < depth; j++) {
+            strcat(ATTR(attrs, fullpath), "/");
+            strcat(ATTR(attrs, fullpath), path_parts[rnd(PATH_PART_COUNT)]);
+        }
+        ATTR_MASK_SET(attrs, fullpath);
+
+        strcpy(ATTR(attrs, name), strrchr(ATTR(attrs, fullpath), '/') + 1);
+        ATTR_MASK_SET(attrs, name);
+
+        switch (depth == 0 ? 1 : rnd(4)) {
+        case 0:
+        case 3:
+            type = STR_TYPE_FILE;
+            break;
+        case 1:
+            type = STR_TYPE_DIR;
+            break;
+        default:
+            type = STR_TYPE_LINK;
+        }
+        strcpy(ATTR(attrs, type), type);
+        ATTR_MASK_SET(attrs, type);
+
+        ATTR(attrs, size) = sizes[rnd(SIZE_COUNT)];
+        ATTR_MASK_SET(attrs, size);
+
+#ifdef _LUSTRE
+        if (!strcmp(type, STR_TYPE_FILE)) {
+            /* no stripe: released file, or no layout */
+            ATTR(attrs, stripe_items).count = rnd(MAX_STRIPES + 1);
+            ATTR(attrs, stripe_items).stripe = entries[i].stripes;
+            for (j = 0; j < ATTR(attrs, stripe_items).count; j++)
+                entries[i].stripes[j].ost_idx = rnd(OST_COUNT);
+            ATTR_MASK_SET(attrs, stripe_items);
+        }
+#endif
+        entries[i].xattr = xattr_values[rnd(XATTR_VAL_COUNT)];
+    }
+}
+
+/* nodes and conditions of the current expression */
+static bool_node_t nodes[MAX_NODES];
+static compare_triplet_t conds[MAX_NODES];
+static unsigned int node_count;
+static unsigned int cond_count;
+
+/** condition with a string value: wildcards turn == into LIKE, as the
+ * config parser does */
+static void set_str_cond(compare_triplet_t *cond, compare_criteria_t crit,
+                         const char *value, bool equal)
+{
+    cond->crit = crit;
+    rh_strncpy(cond->val.str, value, sizeof(cond->val.str));
+    if (WILDCARDS_IN(value))
+        cond->op = equal ? COMP_LIKE : COMP_UNLIKE;
+    else
+        cond->op = equal ? COMP_EQUAL : COMP_DIFF;
+}
+
+static void random_cond(compare_triplet_t *cond)
+{
+    static const obj_type_t types[] = { TYPE_FILE, TYPE_DIR, TYPE_LINK };
+
+    memset(cond, 0, sizeof(*cond));
+
+    switch (rnd(7)) {
+    case 0:
+        cond->crit = CRITERIA_SIZE;
+        cond->op = size_ops[rnd(SIZE_OP_COUNT)];
+        cond->val.size = sizes[rnd(SIZE_COUNT)] + rnd(2);
+        break;
+    case 1:
+        set_str_cond(cond, CRITERIA_NAME, name_patterns[rnd(NAME_PAT_COUNT)],
+                     rnd(2));
+        break;
+    case 2:
+        set_str_cond(cond, CRITERIA_INAME, name_patterns[rnd(NAME_PAT_COUNT)],
+                     rnd(2));
+        cond->flags = CMP_FLG_INSENSITIVE;
+        break;
+    case 3:
+        cond->crit = CRITERIA_TYPE;
+        cond->op = rnd(2) ? COMP_EQUAL : COMP_DIFF;
+        cond->val.type = types[rnd(sizeof(types) / sizeof(types[0]))];
+        break;
+    case 4:
+        set_str_cond(cond, CRITERIA_TREE, tree_patterns[rnd(TREE_PAT_COUNT)],
+                     rnd(2));
+        if (rnd(4) == 0)
+            cond->flags = CMP_FLG_INSENSITIVE;
+        break;
+    case 5:
+#ifdef _LUSTRE
+        cond->crit = CRITERIA_OST;
+        cond->op = rnd(2) ? COMP_EQUAL : COMP_DIFF;
+        cond->val.integer = rnd(OST_COUNT + 1);
+        break;
+#endif
+        /* fall through */
+    case 6:
+        set_str_cond(cond, CRITERIA_XATTR,
+                     rnd(3) ? xattr_values[rnd(XATTR_VAL_COUNT)] : "*o*",
+                     rnd(2));
+        rh_strncpy(cond->attr_name, XATTR_NAME, sizeof(cond->attr_name));
+        break;
+    }
+}
+
+static bool_node_t *random_expr(unsigned int depth)
+{
+    bool_node_t *node = &nodes[node_count++];
+    unsigned int r = rnd(10);
+
+    memset(node, 0, sizeof(*node));
+
+    if (depth == 0 || r < 3) {
+        if (rnd(12) == 0) {
+            node->node_type = NODE_CONSTANT;
+            node->content_u.constant = rnd(2);
+        } else {
+            node->node_type = NODE_CONDITION;
+            node->content_u.condition = &conds[cond_count];
+            random_cond(&conds[cond_count]);
+            cond_count++;
+        }
+    } else if (r < 5) {
+        node->node_type = NODE_UNARY_EXPR;
+        node->content_u.bool_expr.bool_op = BOOL_NOT;
+        node->content_u.bool_expr.expr1 = random_expr(depth - 1);
+    } else {
+        node->node_type = NODE_BINARY_EXPR;
+        node->content_u.bool_expr.bool_op = (r < 8) ? BOOL_AND : BOOL_OR;
+        node->content_u.bool_expr.expr1 = random_expr(depth - 1);
+        node->content_u.bool_expr.expr2 = random_expr(depth - 1);
+    }
+    return node;
+}
+
+static bool has_xattr_cond(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < cond_count; i++)
+        if (conds[i].crit == CRITERIA_XATTR)
+            return true;
+    return false;
+}
+
+/* ---- reference evaluator: policy semantics on in-memory attributes ---- */
+
+static bool ref_cond(const struct test_entry *e, const compare_triplet_t *cond)
+{
+    const attr_set_t *attrs = &e->attrs;
+    int casefold = (cond->flags & CMP_FLG_INSENSITIVE) ? FNM_CASEFOLD : 0;
+    bool equal = (cond->op == COMP_EQUAL || cond->op == COMP_LIKE);
+    bool rc;
+
+    switch (cond->crit) {
+    case CRITERIA_SIZE:
+        switch (cond->op) {
+        case COMP_GRTHAN:
+            return ATTR(attrs, size) > cond->val.size;
+        case COMP_GRTHAN_EQ:
+            return ATTR(attrs, size) >= cond->val.size;
+        case COMP_LSTHAN:
+            return ATTR(attrs, size) < cond->val.size;
+        case COMP_LSTHAN_EQ:
+            return ATTR(attrs, size) <= cond->val.size;
+        case COMP_EQUAL:
+            return ATTR(attrs, size) == cond->val.size;
+        case COMP_DIFF:
+            return ATTR(attrs, size) != cond->val.size;
+        default:
+            abort();
+        }
+
+    case CRITERIA_NAME:
+    case CRITERIA_INAME:
+        rc = !fnmatch(cond->val.str, ATTR(attrs, name), casefold);
+        return equal ? rc : !rc;
+
+    case CRITERIA_TYPE:
+        rc = !strcmp(ATTR(attrs, type), type2db(cond->val.type));
+        return equal ? rc : !rc;
+
+    case CRITERIA_TREE:
+        {
+            char pattern[RBH_PATH_MAX + sizeof(FS_ROOT)];
+            char parent[RBH_PATH_MAX];
+
+            if (cond->val.str[0] == '/')
+                strcpy(pattern, cond->val.str);
+            else
+                sprintf(pattern, "%s/%s", FS_ROOT, cond->val.str);
+
+            /* entries in the tree, or its root */
+            strcpy(parent, ATTR(attrs, fullpath));
+            rc = !fnmatch(pattern, dirname(parent),
+                          FNM_PATHNAME | FNM_LEADING_DIR | casefold)
+                 || !fnmatch(pattern, ATTR(attrs, fullpath),
+                             FNM_PATHNAME | casefold);
+            return equal ? rc : !rc;
+        }
+
+#ifdef _LUSTRE
+    case CRITERIA_OST:
+        {
+            unsigned int i;
+
+            /* entries other than files never match */
+            if (strcmp(ATTR(attrs, type), STR_TYPE_FILE))
+                return false;
+
+            rc = false;
+            for (i = 0; i < ATTR(attrs, stripe_items).count; i++)
+                if (ATTR(attrs, stripe_items).stripe[i].ost_idx
+                        == cond->val.integer)
+                    rc = true;
+            return equal ? rc : !rc;
+        }
+#endif
+
+    case CRITERIA_XATTR:
+        rc = !fnmatch(cond->val.str, e->xattr, casefold);
+        return equal ? rc : !rc;
+
+    default:
+        abort();
+    }
+}
+
+static bool ref_match(const struct test_entry *e, const bool_node_t *node)
+{
+    switch (node->node_type) {
+    case NODE_CONSTANT:
+        return node->content_u.constant;
+    case NODE_CONDITION:
+        return ref_cond(e, node->content_u.condition);
+    case NODE_UNARY_EXPR:
+        return !ref_match(e, node->content_u.bool_expr.expr1);
+    case NODE_BINARY_EXPR:
+        if (node->content_u.bool_expr.bool_op == BOOL_AND)
+            return ref_match(e, node->content_u.bool_expr.expr1)
+                   && ref_match(e, node->content_u.bool_expr.expr2);
+        return ref_match(e, node->content_u.bool_expr.expr1)
+               || ref_match(e, node->content_u.bool_expr.expr2);
+    }
+    abort();
+}
+
+/* ---- filter evaluator: SQL semantics of the request ---- */
+
+/** SQL LIKE: '%' matches any string, '_' any character */
+static bool sql_like(const char *pattern, const char *str, bool casefold)
+{
+    for (; *pattern != '\0'; pattern++, str++) {
+        if (*pattern == '%') {
+            do {
+                if (sql_like(pattern + 1, str, casefold))
+                    return true;
+            } while (*str++ != '\0');
+            return false;
+        }
+        if (*str == '\0')
+            return false;
+        if (*pattern == '_')
+            continue;
+        if (casefold ? tolower(*pattern) != tolower(*str) : *pattern != *str)
+            return false;
+    }
+    return *str == '\0';
+}
+
+static bool sql_int(filter_comparator_t comp, unsigned long long val,
+                    unsigned long long ref)
+{
+    switch (comp) {
+    case EQUAL:           return val == ref;
+    case NOTEQUAL:        return val != ref;
+    case LESSTHAN:        return val <= ref;
+    case MORETHAN:        return val >= ref;
+    case LESSTHAN_STRICT: return val < ref;
+    case MORETHAN_STRICT: return val > ref;
+    default:
+        fprintf(stderr, "unexpected comparator %d for integer\n", comp);
+        abort();
+    }
+}
+
+static bool sql_str(filter_comparator_t comp, const char *val, const char *ref)
+{
+    switch (comp) {
+    case EQUAL:    return !strcmp(val, ref);
+    case NOTEQUAL: return strcmp(val, ref) != 0;
+    case LIKE:     return sql_like(ref, val, false);
+    case UNLIKE:   return !sql_like(ref, val, false);
+    case ILIKE:    return sql_like(ref, val, true);
+    case IUNLIKE:  return !sql_like(ref, val, true);
+    default:
+        fprintf(stderr, "unexpected comparator %d for string\n", comp);
+        abort();
+    }
+}
+
+struct sql_ctx {
+    const lmgr_simple_filter_t *sf;
+    unsigned int                pos;
+    const attr_set_t           *attrs;
+    int                         stripe;  /**< -1 for a NULL stripe row */
+};
+
+static bool sql_item(const struct sql_ctx *ctx)
+{
+    unsigned int i = ctx->pos;
+    filter_comparator_t comp = ctx->sf->filter_compar[i];
+    const db_type_u *val = &ctx->sf->filter_value[i].value;
+
+    /* negation is expected to be pushed down to comparators */
+    assert(!(ctx->sf->filter_flags[i] & (FILTER_FLAG_NOT | FILTER_FLAG_BEGIN
+                                         | FILTER_FLAG_END)));
+
+    switch (ctx->sf->filter_index[i]) {
+    case ATTR_INDEX_size:
+        return sql_int(comp, ATTR(ctx->attrs, size), val->val_biguint);
+    case ATTR_INDEX_name:
+        return sql_str(comp, ATTR(ctx->attrs, name), val->val_str);
+    case ATTR_INDEX_type:
+        return sql_str(comp, ATTR(ctx->attrs, type), val->val_str);
+    case ATTR_INDEX_fullpath:
+        return sql_str(comp, ATTR(ctx->attrs, fullpath), val->val_str);
+#ifdef _LUSTRE
+    case ATTR_INDEX_stripe_items:
+        if (ctx->stripe < 0)
+            return !!(ctx->sf->filter_flags[i] & FILTER_FLAG_ALLOW_NULL);
+        return sql_int(comp, ATTR(ctx->attrs, stripe_items)
+                             .stripe[ctx->stripe].ost_idx, val->val_uint);
+#endif
+    default:
+        fprintf(stderr, "unexpected field %u in filter\n",
+                ctx->sf->filter_index[i]);
+        abort();
+    }
+}
+
+static bool is_block(const struct sql_ctx *ctx, int flag)
+{
+    return ctx->pos < ctx->sf->filter_count
+           && (ctx->sf->filter_flags[ctx->pos] & flag);
+}
+
+/** is the next item (or block) joined with OR? */
+static bool next_or(const struct sql_ctx *ctx)
+{
+    return !!(ctx->sf->filter_flags[ctx->pos] & FILTER_FLAG_OR);
+}
+
+static bool sql_or(struct sql_ctx *ctx);
+
+static bool sql_primary(struct sql_ctx *ctx)
+{
+    bool rc;
+
+    if (!is_block(ctx, FILTER_FLAG_BEGIN_BLOCK)) {
+        rc = sql_item(ctx);
+        ctx->pos++;
+        return rc;
+    }
+
+    /* filter2str() only handles these flags on blocks */
+    assert((ctx->sf->filter_flags[ctx->pos] & ~FILTER_FLAG_OR)
+           == FILTER_FLAG_BEGIN_BLOCK);
+    ctx->pos++;
+    rc = sql_or(ctx);
+    assert(is_block(ctx, FILTER_FLAG_END_BLOCK));
+    assert(ctx->sf->filter_flags[ctx->pos] == FILTER_FLAG_END_BLOCK);
+    ctx->pos++;
+    return rc;
+}
+
+/* AND has precedence over OR */
+static bool sql_and(struct sql_ctx *ctx)
+{
+    bool rc = sql_primary(ctx);
+
+    while (ctx->pos < ctx->sf->filter_count
+           && !is_block(ctx, FILTER_FLAG_END_BLOCK) && !next_or(ctx)) {
+        bool rc2 = sql_primary(ctx);
+
+        rc = rc && rc2;
+    }
+    return rc;
+}
+
+static bool sql_or(struct sql_ctx *ctx)
+{
+    bool rc = sql_and(ctx);
+
+    while (ctx->pos < ctx->sf->filter_count
+           && !is_block(ctx, FILTER_FLAG_END_BLOCK) && next_or(ctx)) {
+        bool rc2 = sql_and(ctx);
+
+        rc = rc || rc2;
+    }
+    return rc;
+}
+
+/** does the filter select the entry? (on any of its stripe rows) */
+static bool sql_match(const lmgr_filter_t *filter, const struct test_entry *e)
+{
+    struct sql_ctx ctx = {
+        .sf = &filter->filter_simple,
+        .attrs = &e->attrs,
+        .stripe = -1,
+    };
+    int rows = 0;
+
+    if (ctx.sf->filter_count == 0)
+        return true;
+
+#ifdef _LUSTRE
+    /* entries with no stripe have a single row, with NULL stripe fields */
+    if (ATTR_MASK_TEST(&e->attrs, stripe_items)
+        && ATTR(&e->attrs, stripe_items).count > 0) {
+        rows = ATTR(&e->attrs, stripe_items).count;
+        ctx.stripe = 0;
+    }
+#endif
+    do {
+        bool rc;
+
+        ctx.pos = 0;
+        rc = sql_or(&ctx);
+        assert(ctx.pos == ctx.sf->filter_count);
+        if (rc)
+            return true;
+    } while (++ctx.stripe < rows);
+
+    return false;
+}
+
+static void dump_expr(const bool_node_t *expr)
+{
+    char buff[RBH_PATH_MAX];
+
+    if (BoolExpr2str((bool_node_t *)expr, buff, sizeof(buff)) < 0)
+        strcpy(buff, "?");
+    fprintf(stderr, "expression: %s\n", buff);
+}
+
+static void test_expr(void)
+{
+    lmgr_filter_t filter;
+    filter_pushdown_t stats;
+    bool_node_t *expr;
+    bool negate = rnd(4) == 0;
+    bool check_engine;
+    int flags = (negate ? FILTER_FLAG_NOT : 0)
+                | (rnd(4) == 0 ? FILTER_FLAG_ALLOW_NULL : 0);
+    entry_id_t id;
+    unsigned int i;
+
+    node_count = cond_count = 0;
+    expr = random_expr(MAX_DEPTH);
+    /* xattrs are in memory only */
+    check_engine = !has_xattr_cond();
+
+    memset(&id, 0, sizeof(id));
+    memset(&stats, 0, sizeof(stats));
+    assert(lmgr_simple_filter_init(&filter) == 0);
+    assert(convert_boolexpr_to_filter(expr, &filter, NULL, NULL, flags,
+                                      &stats) == 0);
+    assert(stats.cond_count == cond_count);
+    assert(stats.cond_pushed <= stats.cond_count);
+    assert(!stats.never_matches || filter.filter_simple.filter_count == 0);
+
+    for (i = 0; i < NB_ENTRIES; i++) {
+        const struct test_entry *e = &entries[i];
+        bool match = ref_match(e, expr);
+
+        /* check the reference against the policy engine */
+        if (check_engine
+            && entry_matches(&id, &e->attrs, expr, NULL, NULL)
+                != (match ? POLICY_MATCH : POLICY_NO_MATCH)) {
+            dump_expr(expr);
+            fprintf(stderr, "%s: reference evaluator returned %d\n",
+                    ATTR(&e->attrs, fullpath), match);
+            abort();
+        }
+
+        if (negate)
+            match = !match;
+        if (!match)
+            continue;
+
+        if (stats.never_matches || !sql_match(&filter, e)) {
+            dump_expr(expr);
+            fprintf(stderr, "%s%s (%s, size=%llu, xattr='%s') matches, "
+                    "but it is not selected by the filter "
+                    "(never_matches=%d, %u items)\n", negate ? "NOT: " : "",
+                    ATTR(&e->attrs, fullpath), ATTR(&e->attrs, type),
+                    (unsigned long long)ATTR(&e->attrs, size), e->xattr,
+                    stats.never_matches, filter.filter_simple.filter_count);
+            abort();
+        }
+    }
+
+    lmgr_simple_filter_free(&filter);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int i;
+
+    rh_strncpy(global_config.fs_path, FS_ROOT, sizeof(global_config.fs_path));
+
+    init_entries();
+
+    for (i = 0; i < NB_EXPR; i++)
+        test_expr();
+
+    printf("%u expressions on %u entries: OK\n", NB_EXPR, NB_ENTRIES);
+    return 0;
+}
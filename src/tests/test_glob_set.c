@@ -0,0 +1,221 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Test of the multi-pattern matcher: each pattern of a set must match
+ * exactly the strings fnmatch() matches, for bracket expressions, escapes,
+ * FNM_PATHNAME, FNM_CASEFOLD...
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "glob_set.h"
+#include "rbh_logs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <assert.h>
+
+/* avoid linking with all robinhood libs */
+log_config_t log_config = { .debug_level = LVL_DEBUG };
+
+void DisplayLogFn(log_level debug_level, const char *tag, const char *format, ...)
+{
+    if (LVL_DEBUG >= debug_level)
+    {
+        va_list args;
+
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        printf("\n");
+    }
+}
+
+#define MAX_PATTERNS    600
+#define NB_STRINGS      2000
+#define NB_ROUNDS       20
+#define MAX_LEN         64
+
+static const int test_flags[] = {
+    0,
+    FNM_PATHNAME,
+    FNM_CASEFOLD,
+    FNM_PATHNAME | FNM_CASEFOLD,
+    FNM_PATHNAME | FNM_LEADING_DIR,
+    FNM_PATHNAME | FNM_LEADING_DIR | FNM_CASEFOLD,
+    FNM_NOESCAPE,
+    FNM_PERIOD | FNM_PATHNAME,
+};
+#define FLAG_COUNT (sizeof(test_flags) / sizeof(test_flags[0]))
+
+/* parts of random patterns */
+static const char *pattern_parts[] = {
+    "a", "b", "A", "B", "ab", "Ab", "aB", "foo", "FOO", "Foo", "dir", "/",
+    ".", "-", "*", "*", "?", "**",
+    /* bracket expressions */
+    "[ab]", "[!a]", "[^b]", "[a-c]", "[A-C]", "[]a]", "[!]]", "[/]",
+    "[[:alpha:]]", "[[:upper:]]", "[[:digit:]]", "[\\]]", "[a\\-]", "[*?]",
+    /* malformed: '[' is then a regular character */
+    "[", "[a", "[[:alpha:]",
+    /* escapes */
+    "\\*", "\\?", "\\[", "\\a", "\\A", "\\\\", "\\/",
+};
+#define PART_COUNT (sizeof(pattern_parts) / sizeof(pattern_parts[0]))
+
+static const char string_chars[] = "aAbBcfoOFdir/.-*?[]\\!1";
+
+/* hand-picked patterns and strings */
+static const char *fixed_patterns[] = {
+    "*.log", "/fs/dir/*", "/fs/*/foo", "/fs/**/foo", "*[Ff][Oo][Oo]*",
+    "\\*foo", "foo\\", "[!.]*", "*/.*", "ab*ab", "aaa", "*a*a*a*", "",
+};
+static const char *fixed_strings[] = {
+    "x.log", "X.LOG", "/fs/dir/file", "/fs/dir/sub/file", "/fs/a/foo",
+    "/fs/a/b/foo", "FOO", "afoob", "*foo", "foo\\", ".hidden", "dir/.hidden",
+    "abab", "ab", "aaa", "AaA", "aXaXa", "",
+};
+
+static unsigned int seed = 1;
+
+static void random_pattern(char *buff, size_t size)
+{
+    unsigned int n = 1 + rand_r(&seed) % 6;
+
+    buff[0] = '\0';
+    while (n-- > 0) {
+        const char *part = pattern_parts[rand_r(&seed) % PART_COUNT];
+
+        if (strlen(buff) + strlen(part) >= size)
+            break;
+        strcat(buff, part);
+    }
+}
+
+static void random_string(char *buff, size_t size)
+{
+    unsigned int n = rand_r(&seed) % 12;
+    unsigned int i;
+
+    for (i = 0; i < n && i < size - 1; i++)
+        buff[i] = string_chars[rand_r(&seed) % (sizeof(string_chars) - 1)];
+    buff[i] = '\0';
+}
+
+/** compare the result of a set with fnmatch() for each pattern */
+static void check_match(const glob_set_t *set, char **patterns, int *flags,
+                        int *idx, unsigned int count, const char *str)
+{
+    uint64_t bits[GLOB_SET_WORDS(MAX_PATTERNS)];
+    unsigned int i;
+
+    glob_set_match(set, str, bits);
+
+    for (i = 0; i < count; i++) {
+        bool expected = (fnmatch(patterns[i], str, flags[i]) == 0);
+
+        if (GLOB_SET_TEST(bits, idx[i]) != expected) {
+            fprintf(stderr, "pattern '%s' (flags=%#x) on '%s': got %d, "
+                    "fnmatch() returned %d\n", patterns[i], flags[i], str,
+                    !expected, expected);
+            abort();
+        }
+    }
+}
+
+/** build a set of 'count' patterns and test it */
+static void test_set(unsigned int count, bool fixed)
+{
+    char *patterns[MAX_PATTERNS];
+    int flags[MAX_PATTERNS];
+    int idx[MAX_PATTERNS];
+    glob_set_t *set;
+    unsigned int i;
+
+    set = glob_set_new();
+    assert(set != NULL);
+
+    for (i = 0; i < count; i++) {
+        char buff[MAX_LEN];
+
+        if (fixed)
+            strcpy(buff, fixed_patterns[i % (sizeof(fixed_patterns)
+                                             / sizeof(fixed_patterns[0]))]);
+        else
+            random_pattern(buff, sizeof(buff));
+
+        patterns[i] = strdup(buff);
+        assert(patterns[i] != NULL);
+        flags[i] = test_flags[rand_r(&seed) % FLAG_COUNT];
+        idx[i] = glob_set_add(set, patterns[i], flags[i]);
+        assert(idx[i] >= 0 && idx[i] < MAX_PATTERNS);
+    }
+    assert(glob_set_count(set) <= count);
+    assert(glob_set_compile(set) == 0);
+
+    for (i = 0; i < sizeof(fixed_strings) / sizeof(fixed_strings[0]); i++)
+        check_match(set, patterns, flags, idx, count, fixed_strings[i]);
+
+    for (i = 0; i < NB_STRINGS; i++) {
+        char str[MAX_LEN];
+
+        random_string(str, sizeof(str));
+        check_match(set, patterns, flags, idx, count, str);
+
+        /* strings built from patterns are more likely to match */
+        random_pattern(str, sizeof(str));
+        check_match(set, patterns, flags, idx, count, str);
+        check_match(set, patterns, flags, idx, count,
+                    patterns[rand_r(&seed) % count]);
+    }
+
+    glob_set_free(set);
+    for (i = 0; i < count; i++)
+        free(patterns[i]);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int i;
+
+    /* identical patterns with identical flags are stored once */
+    {
+        glob_set_t *set = glob_set_new();
+
+        assert(glob_set_add(set, "*.c", 0) == 0);
+        assert(glob_set_add(set, "*.h", 0) == 1);
+        assert(glob_set_add(set, "*.c", 0) == 0);
+        assert(glob_set_add(set, "*.c", FNM_CASEFOLD) == 2);
+        assert(glob_set_count(set) == 3);
+        glob_set_free(set);
+    }
+
+    test_set(sizeof(fixed_patterns) / sizeof(fixed_patterns[0]), true);
+    printf("fixed patterns: OK\n");
+
+    for (i = 0; i < NB_ROUNDS; i++) {
+        /* small sets, then sets of several result words, and sets larger
+         * than the matcher stack buffers */
+        unsigned int count = (i < NB_ROUNDS / 2) ? 1 + i * 5
+                                : 60 + (i - NB_ROUNDS / 2) * 60;
+
+        test_set(count, false);
+        printf("%u random patterns: OK\n", count);
+    }
+    return 0;
+}
@@ -0,0 +1,315 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Test of the HSM request batches, with a stub send function:
+ * grouping of entries by action, archive_id and data, sending of batches
+ * when they are full or after their timeout, and status of each entry
+ * when a batch fails.
+ */
+
+/* the list of open batches is checked */
+#include "../modules/lhsm_batch.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <assert.h>
+
+/* avoid linking with all robinhood libs */
+log_config_t log_config = { .debug_level = LVL_DEBUG };
+
+void DisplayLogFn(log_level debug_level, const char *tag, const char *format, ...)
+{
+    if (LVL_DEBUG >= debug_level)
+    {
+        va_list args;
+
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        printf("\n");
+    }
+}
+
+#define MAX_REQUESTS    64
+#define MAX_ENTRIES     32
+#define LONG_TIMEOUT    60000
+
+/** a request received by the stub */
+struct sent_request {
+    int             action;
+    unsigned int    archive_id;
+    char            data[16];
+    int             data_len;
+    unsigned int    count;
+    unsigned int    ids[MAX_ENTRIES];
+};
+
+static pthread_mutex_t sent_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sent_request sent[MAX_REQUESTS];
+static unsigned int nb_sent;
+
+/** requests of several entries fail */
+static bool fail_batches;
+/** entries alone fail if their number is a multiple of this */
+static unsigned int fail_modulo;
+
+static void make_id(entry_id_t *id, unsigned int n)
+{
+    memset(id, 0, sizeof(*id));
+#ifdef _HAVE_FID
+    id->f_seq = 0x200000400ULL;
+    id->f_oid = n;
+#else
+    id->inode = n;
+#endif
+}
+
+static unsigned int id_num(const entry_id_t *id)
+{
+#ifdef _HAVE_FID
+    return id->f_oid;
+#else
+    return id->inode;
+#endif
+}
+
+static int stub_send(int action, unsigned int archive_id, const char *data,
+                     int data_len, const entry_id_t *ids, unsigned int count)
+{
+    struct sent_request *req;
+    unsigned int i;
+    int rc = 0;
+
+    assert(count > 0 && count <= MAX_ENTRIES);
+    assert(data_len >= 0 && data_len <= sizeof(req->data));
+
+    pthread_mutex_lock(&sent_lock);
+    assert(nb_sent < MAX_REQUESTS);
+    req = &sent[nb_sent++];
+    req->action = action;
+    req->archive_id = archive_id;
+    memcpy(req->data, data, data_len);
+    req->data_len = data_len;
+    req->count = count;
+    for (i = 0; i < count; i++) {
+        req->ids[i] = id_num(&ids[i]);
+        if (count == 1 && fail_modulo != 0 && req->ids[i] % fail_modulo == 0)
+            rc = -EINVAL;
+    }
+    if (count > 1 && fail_batches)
+        rc = -EIO;
+    pthread_mutex_unlock(&sent_lock);
+
+    return rc;
+}
+
+/** an entry sent by a thread */
+struct request_arg {
+    pthread_t       thread;
+    int             action;
+    unsigned int    archive_id;
+    const char     *data;
+    unsigned int    n;
+    unsigned int    batch_size;
+    unsigned int    timeout_ms;
+    int             rc;
+};
+
+static void *request_thr(void *arg)
+{
+    struct request_arg *req = arg;
+    entry_id_t id;
+
+    make_id(&id, req->n);
+    req->rc = hsm_batch_request(stub_send, req->action, req->archive_id,
+                                req->data,
+                                req->data ? strlen(req->data) + 1 : 0, &id,
+                                req->batch_size, req->timeout_ms);
+    return NULL;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/** send the entries from concurrent threads
+ * @return the time it took, in ms */
+static double run_requests(struct request_arg *args, unsigned int count)
+{
+    double start = now_ms();
+    unsigned int i;
+
+    nb_sent = 0;
+    for (i = 0; i < count; i++)
+        assert(pthread_create(&args[i].thread, NULL, request_thr,
+                              &args[i]) == 0);
+    for (i = 0; i < count; i++)
+        pthread_join(args[i].thread, NULL);
+
+    /* no batch is left behind */
+    assert(rh_list_empty(&open_batches));
+    return now_ms() - start;
+}
+
+static void set_args(struct request_arg *args, unsigned int count,
+                     unsigned int batch_size, unsigned int timeout_ms)
+{
+    unsigned int i;
+
+    memset(args, 0, count * sizeof(*args));
+    for (i = 0; i < count; i++) {
+        args[i].action = 1;
+        args[i].archive_id = 1;
+        args[i].n = i + 1;
+        args[i].batch_size = batch_size;
+        args[i].timeout_ms = timeout_ms;
+    }
+}
+
+/** a batch is sent as soon as it has batch_size entries */
+static void test_batch_size(void)
+{
+    struct request_arg args[8];
+    double elapsed;
+    unsigned int i;
+
+    /* no batching */
+    set_args(args, 3, 1, LONG_TIMEOUT);
+    run_requests(args, 3);
+    assert(nb_sent == 3);
+    for (i = 0; i < nb_sent; i++)
+        assert(sent[i].count == 1);
+
+    set_args(args, 8, 4, LONG_TIMEOUT);
+    elapsed = run_requests(args, 8);
+    assert(elapsed < LONG_TIMEOUT / 2);
+    assert(nb_sent == 2);
+    for (i = 0; i < nb_sent; i++)
+        assert(sent[i].count == 4);
+    for (i = 0; i < 8; i++)
+        assert(args[i].rc == 0);
+}
+
+/** a batch that is not full is sent after timeout_ms */
+static void test_timeout(void)
+{
+    struct request_arg args[3];
+    double elapsed;
+    unsigned int i;
+
+    set_args(args, 3, 16, 200);
+    elapsed = run_requests(args, 3);
+    assert(elapsed >= 150 && elapsed < LONG_TIMEOUT / 2);
+    assert(nb_sent == 1 && sent[0].count == 3);
+    for (i = 0; i < 3; i++)
+        assert(args[i].rc == 0);
+
+    /* alone */
+    set_args(args, 1, 16, 200);
+    elapsed = run_requests(args, 1);
+    assert(elapsed >= 150);
+    assert(nb_sent == 1 && sent[0].count == 1);
+}
+
+/** entries are grouped by action, archive_id and data */
+static void test_grouping(void)
+{
+    static const char *data[] = { NULL, "a=1", "a=2" };
+    struct request_arg args[24];
+    unsigned int i, j;
+
+    /* 12 groups of 2 entries */
+    set_args(args, 24, 2, LONG_TIMEOUT);
+    for (i = 0; i < 24; i++) {
+        unsigned int group = i / 2;
+
+        args[i].action = 1 + group % 2;
+        args[i].archive_id = 1 + (group / 2) % 2;
+        args[i].data = data[group / 4];
+        args[i].n = group * 100 + i;
+    }
+    run_requests(args, 24);
+    assert(nb_sent == 12);
+
+    for (i = 0; i < nb_sent; i++) {
+        unsigned int group = sent[i].ids[0] / 100;
+
+        assert(sent[i].count == 2);
+        assert(sent[i].action == 1 + group % 2);
+        assert(sent[i].archive_id == 1 + (group / 2) % 2);
+        if (data[group / 4] == NULL)
+            assert(sent[i].data_len == 0);
+        else
+            assert(sent[i].data_len == strlen(data[group / 4]) + 1
+                   && !strcmp(sent[i].data, data[group / 4]));
+        for (j = 0; j < sent[i].count; j++)
+            assert(sent[i].ids[j] / 100 == group);
+    }
+    for (i = 0; i < 24; i++)
+        assert(args[i].rc == 0);
+}
+
+/** when a batch fails, each entry is sent alone to get its own status */
+static void test_failed_batch(void)
+{
+    struct request_arg args[8];
+    unsigned int i, alone = 0;
+
+    fail_batches = true;
+    fail_modulo = 3;
+
+    set_args(args, 8, 8, LONG_TIMEOUT);
+    run_requests(args, 8);
+
+    /* the batch, then each entry */
+    assert(nb_sent == 9);
+    for (i = 0; i < nb_sent; i++) {
+        if (sent[i].count == 1)
+            alone++;
+        else
+            assert(sent[i].count == 8);
+    }
+    assert(alone == 8);
+
+    for (i = 0; i < 8; i++)
+        assert(args[i].rc == (args[i].n % 3 == 0 ? -EINVAL : 0));
+
+    /* a successful batch is not resent, even with failing entries */
+    fail_batches = false;
+    set_args(args, 8, 8, LONG_TIMEOUT);
+    run_requests(args, 8);
+    assert(nb_sent == 1);
+    for (i = 0; i < 8; i++)
+        assert(args[i].rc == 0);
+
+    fail_modulo = 0;
+}
+
+int main(int argc, char **argv)
+{
+    test_batch_size();
+    printf("send on batch_size: OK\n");
+    test_timeout();
+    printf("send on timeout: OK\n");
+    test_grouping();
+    printf("grouping by action, archive_id and data: OK\n");
+    test_failed_batch();
+    printf("status of entries of failed batches: OK\n");
+    return 0;
+}
@@ -0,0 +1,248 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Test of the workers queue: several producers and consumers moving
+ * entries one by one or by batches, and blocking when the queue is
+ * empty or full.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "queue.h"
+#include "rbh_logs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+/* avoid linking with all robinhood libs */
+log_config_t log_config = { .debug_level = LVL_DEBUG };
+
+void DisplayLogFn(log_level debug_level, const char *tag, const char *format, ...)
+{
+    if (LVL_DEBUG >= debug_level)
+    {
+        va_list args;
+
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        printf("\n");
+    }
+}
+
+#define QUEUE_SIZE      64
+#define NB_PRODUCERS    4
+#define NB_CONSUMERS    4
+#define NB_ITEMS        200000  /* per producer */
+#define MAX_BATCH       16
+#define STATUS_COUNT    2
+
+static entry_queue_t queue;
+
+/* number of times each item was received */
+static unsigned int received[NB_PRODUCERS * NB_ITEMS];
+
+/* items are encoded as non-NULL pointers, NULL stops consumers */
+#define ITEM(_i)        ((void *)(uintptr_t)((_i) + 1))
+#define ITEM_IDX(_p)    ((uintptr_t)(_p) - 1)
+
+static void *producer(void *arg)
+{
+    unsigned int first = (uintptr_t)arg * NB_ITEMS;
+    unsigned int seed = first;
+    unsigned int i = 0;
+
+    while (i < NB_ITEMS) {
+        void *batch[MAX_BATCH];
+        unsigned int count = 1 + rand_r(&seed) % MAX_BATCH;
+        unsigned int j;
+
+        if (count > NB_ITEMS - i)
+            count = NB_ITEMS - i;
+
+        for (j = 0; j < count; j++)
+            batch[j] = ITEM(first + i + j);
+
+        if (count == 1)
+            assert(Queue_Insert(&queue, batch[0]) == 0);
+        else
+            assert(Queue_InsertBatch(&queue, batch, count) == 0);
+        i += count;
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    unsigned int seed = (uintptr_t)arg;
+    unsigned int nb_stop = 0;
+
+    while (nb_stop == 0) {
+        void *batch[MAX_BATCH];
+        unsigned int max = 1 + rand_r(&seed) % MAX_BATCH;
+        unsigned int count, i;
+
+        assert(Queue_GetBatch(&queue, batch, max, &count) == 0);
+        assert(count >= 1 && count <= max);
+
+        for (i = 0; i < count; i++) {
+            if (batch[i] == NULL) {
+                nb_stop++;
+                continue;
+            }
+            __atomic_add_fetch(&received[ITEM_IDX(batch[i])], 1,
+                               __ATOMIC_RELAXED);
+            Queue_Acknowledge(&queue, ITEM_IDX(batch[i]) % STATUS_COUNT,
+                              NULL, 0);
+        }
+    }
+    /* give back stop items for the other consumers */
+    for (; nb_stop > 1; nb_stop--)
+        assert(Queue_Insert(&queue, NULL) == 0);
+
+    return NULL;
+}
+
+static volatile bool blocked_done;
+
+static void *get_one(void *arg)
+{
+    void *item;
+
+    assert(Queue_Get(&queue, &item) == 0);
+    assert(item == arg);
+    blocked_done = true;
+    return NULL;
+}
+
+static void *insert_many(void *arg)
+{
+    unsigned int count = (uintptr_t)arg;
+    void *batch[count];
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+        batch[i] = ITEM(i);
+    assert(Queue_InsertBatch(&queue, batch, count) == 0);
+    blocked_done = true;
+    return NULL;
+}
+
+/** consumers must wait when the queue is empty */
+static void test_block_empty(void)
+{
+    pthread_t thr;
+    unsigned int nb_wait;
+
+    blocked_done = false;
+    assert(pthread_create(&thr, NULL, get_one, ITEM(42)) == 0);
+
+    usleep(100000);
+    assert(!blocked_done);
+    RetrieveQueueStats(&queue, &nb_wait, NULL, NULL, NULL, NULL, NULL, NULL);
+    assert(nb_wait == 1);
+
+    assert(Queue_Insert(&queue, ITEM(42)) == 0);
+    assert(pthread_join(thr, NULL) == 0);
+    assert(blocked_done);
+}
+
+/** producers must wait when the queue is full */
+static void test_block_full(void)
+{
+    pthread_t thr;
+    unsigned int nb_items, capacity = mpmc_queue_capacity(&queue.ring);
+    void *batch[MAX_BATCH];
+    unsigned int i, count, got = 0;
+
+    blocked_done = false;
+    assert(pthread_create(&thr, NULL, insert_many,
+                          (void *)(uintptr_t)(capacity + 10)) == 0);
+
+    usleep(100000);
+    assert(!blocked_done);
+    RetrieveQueueStats(&queue, NULL, &nb_items, NULL, NULL, NULL, NULL, NULL);
+    assert(nb_items == capacity);
+
+    /* free some slots: the producer can complete */
+    while (got < capacity + 10) {
+        assert(Queue_GetBatch(&queue, batch, MAX_BATCH, &count) == 0);
+        for (i = 0; i < count; i++)
+            assert(batch[i] == ITEM(got + i));  /* in order */
+        got += count;
+    }
+    assert(pthread_join(thr, NULL) == 0);
+    assert(blocked_done);
+
+    RetrieveQueueStats(&queue, NULL, &nb_items, NULL, NULL, NULL, NULL, NULL);
+    assert(nb_items == 0);
+}
+
+/** no entry must be lost or duplicated */
+static void test_mpmc(void)
+{
+    pthread_t prod[NB_PRODUCERS];
+    pthread_t cons[NB_CONSUMERS];
+    unsigned int status[STATUS_COUNT];
+    unsigned int i;
+
+    Reset_StatusCount(&queue);
+
+    for (i = 0; i < NB_CONSUMERS; i++)
+        assert(pthread_create(&cons[i], NULL, consumer,
+                              (void *)(uintptr_t)i) == 0);
+    for (i = 0; i < NB_PRODUCERS; i++)
+        assert(pthread_create(&prod[i], NULL, producer,
+                              (void *)(uintptr_t)i) == 0);
+
+    for (i = 0; i < NB_PRODUCERS; i++)
+        assert(pthread_join(prod[i], NULL) == 0);
+    for (i = 0; i < NB_CONSUMERS; i++)
+        assert(Queue_Insert(&queue, NULL) == 0);
+    for (i = 0; i < NB_CONSUMERS; i++)
+        assert(pthread_join(cons[i], NULL) == 0);
+
+    for (i = 0; i < NB_PRODUCERS * NB_ITEMS; i++) {
+        if (received[i] != 1) {
+            fprintf(stderr, "item %u received %u times\n", i, received[i]);
+            abort();
+        }
+    }
+
+    /* acknowledgements of exited threads are still counted */
+    RetrieveQueueStats(&queue, NULL, NULL, NULL, NULL, NULL, status, NULL);
+    for (i = 0; i < STATUS_COUNT; i++)
+        assert(status[i] == NB_PRODUCERS * NB_ITEMS / STATUS_COUNT);
+}
+
+int main(int argc, char **argv)
+{
+    assert(CreateQueue(&queue, QUEUE_SIZE, STATUS_COUNT - 1, 0) == 0);
+
+    test_block_empty();
+    printf("blocking on empty queue: OK\n");
+    test_block_full();
+    printf("blocking on full queue: OK\n");
+    test_mpmc();
+    printf("%u producers, %u consumers, %u items: OK\n", NB_PRODUCERS,
+           NB_CONSUMERS, NB_PRODUCERS * NB_ITEMS);
+
+    return 0;
+}
@@ -0,0 +1,450 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2020 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Test of the fair share schedulers: queue keys, deficit round-robin
+ * order and shares, limits of running actions per key, and throttling
+ * of new entries. The scheduler internals are driven without threads,
+ * then a last test runs actions with the scheduler threads.
+ */
+
+/* the internal state of the scheduler is tested */
+#include "../modules/sched_fair.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+
+#define NB_USERS 3
+
+/** an entry to be scheduled */
+struct test_item {
+    unsigned int    uid;
+    ull_t           size;
+};
+
+static unsigned int nb_skipped;
+
+static void skip_cb(void *udata, sched_status_e st)
+{
+    assert(st == SCHED_SKIP_ENTRY);
+    nb_skipped++;
+}
+
+/** config with default values, for the given key */
+static void test_config(sched_fair_config_t *cfg, fair_key_e key)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->key = key;
+    sched_fair_cfg_set_default(cfg);
+}
+
+/** scheduler state, with no thread to run the actions */
+static struct sched_fair_state *state_new(const sched_fair_config_t *cfg)
+{
+    struct sched_fair_state *state = calloc(1, sizeof(*state));
+
+    assert(state != NULL);
+    state->cfg = *cfg;
+    state->nb_threads = cfg->nb_threads;
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->cond, NULL);
+    rh_list_init(&state->rr);
+    state->keys = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                        fair_key_free);
+    assert(state->keys != NULL);
+    return state;
+}
+
+static int schedule(struct sched_fair_state *state, struct test_item *ti)
+{
+    attr_set_t attrs = ATTR_SET_INIT;
+
+    ATTR_MASK_SET(&attrs, uid);
+    ATTR(&attrs, uid).num = ti->uid;
+    ATTR_MASK_SET(&attrs, size);
+    ATTR(&attrs, size) = ti->size;
+
+    return sched_fair_schedule(state, NULL, &attrs, skip_cb, ti);
+}
+
+/** take the next entry to run, NULL if there is none */
+static struct test_item *take(struct sched_fair_state *state,
+                              struct fair_key **p_key)
+{
+    struct fair_item *item;
+    struct test_item *ti;
+
+    item = fair_next(state, p_key);
+    if (item == NULL)
+        return NULL;
+
+    ti = item->udata;
+    free(item);
+    return ti;
+}
+
+/** entries are queued by OST, pool, user or fileclass */
+static void test_keys(void)
+{
+    attr_set_t attrs = ATTR_SET_INIT;
+    char buff[FAIR_KEY_MAX];
+#ifdef _LUSTRE
+    stripe_item_t stripes[2] = { { .ost_idx = 3 }, { .ost_idx = 5 } };
+#endif
+
+    /* no attribute: shared key */
+    assert(!strcmp(fair_key_name(FAIR_KEY_USER, NULL, buff, sizeof(buff)),
+                   ""));
+    assert(!strcmp(fair_key_name(FAIR_KEY_USER, &attrs, buff, sizeof(buff)),
+                   ""));
+    assert(!strcmp(fair_key_name(FAIR_KEY_CLASS, &attrs, buff, sizeof(buff)),
+                   ""));
+
+    global_config.uid_gid_as_numbers = true;
+    ATTR_MASK_SET(&attrs, uid);
+    ATTR(&attrs, uid).num = 42;
+    assert(!strcmp(fair_key_name(FAIR_KEY_USER, &attrs, buff, sizeof(buff)),
+                   "42"));
+    global_config.uid_gid_as_numbers = false;
+    strcpy(ATTR(&attrs, uid).txt, "foo");
+    assert(!strcmp(fair_key_name(FAIR_KEY_USER, &attrs, buff, sizeof(buff)),
+                   "foo"));
+    global_config.uid_gid_as_numbers = true;
+
+    ATTR_MASK_SET(&attrs, fileclass);
+    strcpy(ATTR(&attrs, fileclass), "big_files");
+    assert(!strcmp(fair_key_name(FAIR_KEY_CLASS, &attrs, buff, sizeof(buff)),
+                   "big_files"));
+
+#ifdef _LUSTRE
+    /* OST of the first stripe */
+    assert(!strcmp(fair_key_name(FAIR_KEY_OST, &attrs, buff, sizeof(buff)),
+                   ""));
+    ATTR_MASK_SET(&attrs, stripe_items);
+    ATTR(&attrs, stripe_items).count = 0;
+    assert(!strcmp(fair_key_name(FAIR_KEY_OST, &attrs, buff, sizeof(buff)),
+                   ""));
+    ATTR(&attrs, stripe_items).count = 2;
+    ATTR(&attrs, stripe_items).stripe = stripes;
+    assert(!strcmp(fair_key_name(FAIR_KEY_OST, &attrs, buff, sizeof(buff)),
+                   "3"));
+
+    assert(!strcmp(fair_key_name(FAIR_KEY_POOL, &attrs, buff, sizeof(buff)),
+                   ""));
+    ATTR_MASK_SET(&attrs, stripe_info);
+    strcpy(ATTR(&attrs, stripe_info).pool_name, "ssd");
+    assert(!strcmp(fair_key_name(FAIR_KEY_POOL, &attrs, buff, sizeof(buff)),
+                   "ssd"));
+#endif
+}
+
+/** counting actions, keys are served in turn */
+static void test_round_robin(void)
+{
+    static const unsigned int expected[] = { 1, 2, 3, 1, 2, 3, 1, 3, 1, 1, 1 };
+    static const unsigned int count[] = { 6, 2, 3 };
+    struct test_item items[11];
+    sched_fair_config_t cfg;
+    struct sched_fair_state *state;
+    struct fair_key *key;
+    struct test_item *last[NB_USERS + 1] = { NULL };
+    unsigned int i, j, n = 0;
+
+    test_config(&cfg, FAIR_KEY_USER);
+    state = state_new(&cfg);
+
+    for (i = 0; i < NB_USERS; i++) {
+        for (j = 0; j < count[i]; j++, n++) {
+            items[n].uid = i + 1;
+            items[n].size = 1000 * (n + 1);
+            assert(schedule(state, &items[n]) == SCHED_OK);
+        }
+    }
+    assert(state->queued == n && state->nb_active == NB_USERS);
+
+    for (i = 0; i < n; i++) {
+        struct test_item *ti = take(state, &key);
+
+        assert(ti != NULL);
+        assert(ti->uid == expected[i]);
+        /* entries of a key are run in order */
+        assert(last[ti->uid] == NULL || ti > last[ti->uid]);
+        last[ti->uid] = ti;
+        fair_key_done(state, key, 0.0);
+    }
+    assert(take(state, &key) == NULL);
+    assert(state->queued == 0 && state->nb_active == 0);
+}
+
+/** with a quantum, keys get the same volume, whatever the entry sizes */
+static void test_volume_share(void)
+{
+    static const ull_t sizes[NB_USERS] = { 1024 * 1024, 256 * 1024, 1 };
+    static const unsigned int count[NB_USERS] = { 40, 160, 1000 };
+    struct test_item items[1200];
+    sched_fair_config_t cfg;
+    struct sched_fair_state *state;
+    struct fair_key *key;
+    ull_t volume[NB_USERS] = { 0 };
+    unsigned int i, j, n = 0;
+
+    test_config(&cfg, FAIR_KEY_USER);
+    cfg.quantum = 64 * 1024;
+    state = state_new(&cfg);
+
+    for (i = 0; i < NB_USERS; i++) {
+        for (j = 0; j < count[i]; j++, n++) {
+            items[n].uid = i;
+            items[n].size = sizes[i];
+            assert(schedule(state, &items[n]) == SCHED_OK);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        struct test_item *ti = take(state, &key);
+
+        assert(ti != NULL);
+        volume[ti->uid] += ti->size;
+        fair_key_done(state, key, 0.0);
+
+        /* while both are waiting, the 2 first keys get the same volume,
+         * +/- a quantum and an entry */
+        if (volume[0] < count[0] * sizes[0] && volume[1] < count[1] * sizes[1])
+            assert(llabs((long long)(volume[0] - volume[1]))
+                   <= cfg.quantum + sizes[0]);
+    }
+    assert(take(state, &key) == NULL);
+    for (i = 0; i < NB_USERS; i++)
+        assert(volume[i] == count[i] * sizes[i]);
+
+    /* an entry of 1PB with a quantum of 1 byte is granted in a single step
+     * (this would loop forever if the deficit grew round by round) */
+    cfg.quantum = 1;
+    state->cfg = cfg;
+    items[0].uid = 0;
+    items[0].size = 1ULL << 50;
+    items[1].uid = 1;
+    items[1].size = (1ULL << 50) + 1;
+    assert(schedule(state, &items[0]) == SCHED_OK);
+    assert(schedule(state, &items[1]) == SCHED_OK);
+    assert(take(state, &key) == &items[0]);
+    assert(take(state, &key) == &items[1]);
+    assert(take(state, &key) == NULL);
+}
+
+/** keys can't run more than max_per_key actions */
+static void test_caps(void)
+{
+    struct test_item items[6];
+    sched_fair_config_t cfg;
+    struct sched_fair_state *state;
+    struct fair_key *key, *key1 = NULL;
+    unsigned int i, taken[NB_USERS] = { 0 };
+    unsigned int nb_incr = 0;
+    struct test_item *ti;
+
+    test_config(&cfg, FAIR_KEY_USER);
+    cfg.max_per_key = 2;
+    state = state_new(&cfg);
+
+    for (i = 0; i < 6; i++) {
+        items[i].uid = (i < 5) ? 1 : 2;
+        items[i].size = 1;
+        assert(schedule(state, &items[i]) == SCHED_OK);
+    }
+
+    while ((ti = take(state, &key)) != NULL) {
+        taken[ti->uid]++;
+        if (ti->uid == 1)
+            key1 = key;
+    }
+    assert(taken[1] == 2 && taken[2] == 1);
+    assert(key1 != NULL && key1->running == 2);
+
+    /* a running action ends: the key can run a new one */
+    fair_key_done(state, key1, 0.0);
+    ti = take(state, &key);
+    assert(ti != NULL && ti->uid == 1);
+    assert(take(state, &key) == NULL);
+
+    /* max_per_key can't be more than the number of threads */
+    cfg.max_per_key = 0;
+    assert(fair_max_cap(&cfg) == cfg.nb_threads);
+    cfg.max_per_key = cfg.nb_threads + 1;
+    assert(fair_max_cap(&cfg) == cfg.nb_threads);
+
+    /* with max_latency_ms, the limit of slow keys is halved */
+    test_config(&cfg, FAIR_KEY_USER);
+    cfg.max_per_key = 4;
+    cfg.max_latency_ms = 100;
+    state = state_new(&cfg);
+    key = fair_key_get(state, "slow");
+    assert(key != NULL && key->cap == 4);
+
+    for (i = 0; i < 4; i++) {
+        key->running++;
+        assert(!fair_key_done(state, key, 1000.0));
+    }
+    assert(key->cap == 2);
+    for (i = 0; i < 10; i++) {
+        key->running++;
+        assert(!fair_key_done(state, key, 1000.0));
+    }
+    assert(key->cap == 1);
+
+    /* then incremented when actions get faster */
+    for (i = 0; i < 100 && key->cap < 4; i++) {
+        key->running++;
+        if (fair_key_done(state, key, 1.0))
+            nb_incr++;
+    }
+    assert(key->cap == 4 && nb_incr == 3);
+    assert(key->running == 0);
+
+    /* reset to max_per_key when max_latency_ms is disabled */
+    key->cap = 1;
+    cfg.max_latency_ms = 0;
+    state->cfg = cfg;
+    key->running++;
+    fair_key_done(state, key, 1000.0);
+    assert(key->cap == 4);
+}
+
+/** max_queued delays new entries, max_key_queued skips them */
+static void test_backpressure(void)
+{
+    struct test_item items[6];
+    sched_fair_config_t cfg;
+    struct sched_fair_state *state;
+    struct fair_key *key;
+    unsigned int i;
+
+    test_config(&cfg, FAIR_KEY_USER);
+    cfg.max_queued = 4;
+    cfg.max_key_queued = 2;
+    state = state_new(&cfg);
+
+    for (i = 0; i < 6; i++) {
+        items[i].uid = i / 3;
+        items[i].size = 1;
+    }
+
+    assert(schedule(state, &items[0]) == SCHED_OK);
+    assert(schedule(state, &items[1]) == SCHED_OK);
+    /* 2 entries already wait for this key */
+    assert(schedule(state, &items[2]) == SCHED_SKIP_ENTRY);
+    assert(schedule(state, &items[3]) == SCHED_OK);
+    assert(schedule(state, &items[4]) == SCHED_OK);
+    /* 4 entries wait */
+    assert(schedule(state, &items[5]) == SCHED_DELAY);
+    assert(state->queued == 4);
+
+    /* an entry is run: there is room for a new one */
+    assert(take(state, &key) == &items[0]);
+    assert(schedule(state, &items[2]) == SCHED_OK);
+    assert(schedule(state, &items[5]) == SCHED_DELAY);
+
+    /* refused entries are not called back */
+    assert(nb_skipped == 0);
+
+    /* reset: waiting entries are skipped, idle keys are dropped */
+    assert(sched_fair_reset(state) == 0);
+    assert(nb_skipped == 4);
+    assert(state->queued == 0 && state->nb_active == 0);
+    assert(take(state, &key) == NULL);
+    assert(g_hash_table_lookup(state->keys, "0") != NULL);   /* running */
+    assert(g_hash_table_lookup(state->keys, "1") == NULL);
+}
+
+/* actions run by the scheduler threads */
+static pthread_mutex_t thr_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thr_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int running[NB_USERS];
+static unsigned int max_running[NB_USERS];
+static unsigned int nb_done;
+
+static void action_cb(void *udata, sched_status_e st)
+{
+    struct test_item *ti = udata;
+
+    assert(st == SCHED_OK);
+
+    pthread_mutex_lock(&thr_lock);
+    running[ti->uid]++;
+    if (running[ti->uid] > max_running[ti->uid])
+        max_running[ti->uid] = running[ti->uid];
+    pthread_mutex_unlock(&thr_lock);
+
+    usleep(ti->uid == 0 ? 2000 : 200);
+
+    pthread_mutex_lock(&thr_lock);
+    running[ti->uid]--;
+    nb_done++;
+    pthread_cond_signal(&thr_cond);
+    pthread_mutex_unlock(&thr_lock);
+}
+
+static void test_threads(void)
+{
+    struct test_item items[NB_USERS * 100];
+    sched_fair_config_t cfg;
+    void *state;
+    unsigned int i;
+
+    test_config(&cfg, FAIR_KEY_USER);
+    cfg.nb_threads = 4;
+    cfg.max_per_key = 2;
+    cfg.max_queued = 50;
+    assert(sched_fair_init(&cfg, &state) == 0);
+
+    for (i = 0; i < NB_USERS * 100; i++) {
+        attr_set_t attrs = ATTR_SET_INIT;
+        int rc;
+
+        items[i].uid = i % NB_USERS;
+        ATTR_MASK_SET(&attrs, uid);
+        ATTR(&attrs, uid).num = items[i].uid;
+
+        while ((rc = sched_fair_schedule(state, NULL, &attrs, action_cb,
+                                         &items[i])) == SCHED_DELAY)
+            usleep(1000);
+        assert(rc == SCHED_OK);
+    }
+
+    pthread_mutex_lock(&thr_lock);
+    while (nb_done < NB_USERS * 100)
+        pthread_cond_wait(&thr_cond, &thr_lock);
+    pthread_mutex_unlock(&thr_lock);
+
+    for (i = 0; i < NB_USERS; i++)
+        assert(max_running[i] >= 1 && max_running[i] <= 2);
+}
+
+int main(int argc, char **argv)
+{
+    test_keys();
+    printf("queue keys: OK\n");
+    test_round_robin();
+    printf("round-robin: OK\n");
+    test_volume_share();
+    printf("volume shares: OK\n");
+    test_caps();
+    printf("running actions per key: OK\n");
+    test_backpressure();
+    printf("max_queued and max_key_queued: OK\n");
+    test_threads();
+    printf("scheduler threads: OK\n");
+    return 0;
+}
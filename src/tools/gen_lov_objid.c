@@ -31,8 +31,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <inttypes.h>
 #include "../robinhood/cmd_helpers.h"
 #include "../list_mgr/database.h"
+#include "../list_mgr/listmgr_stripe.h"
 
 #define OPT_STRING    "l:f:o:m:"
 
@@ -49,6 +51,120 @@ static inline void display_help(const char *bin_name)
 
 #define MAX_OPT_LEN 1024
 
+#define OBJIDS_TABLE "LOV_OBJIDS"
+#define LAYOUT_CHUNK 10000
+
+/**
+ * compact_stripes: stripe objects are only known from STRIPE_INFO layouts.
+ * Compute the max object index of each OST into a temporary table
+ * (same output as the STRIPE_ITEMS request).
+ */
+static int compact_max_objids(lmgr_t *p_lmgr)
+{
+    /* max objid + 1 for each OST (0 = no object) */
+    uint64_t *max_objid = NULL;
+    unsigned int ost_count = 0;
+    unsigned int i, nb;
+    result_handle_t res;
+    char *resstr[2];
+    unsigned long lens[2];
+    DEF_PK(last);
+    GString *req = g_string_new(NULL);
+    bool first;
+    int rc;
+
+    last[0] = '\0';
+    do
+    {
+        g_string_assign(req, "SELECT id,layout FROM "STRIPE_INFO_TABLE
+                        " WHERE layout IS NOT NULL");
+        if (last[0] != '\0')
+            g_string_append_printf(req, " AND id>'%s'", last);
+        g_string_append_printf(req, " ORDER BY id LIMIT %u", LAYOUT_CHUNK);
+
+        rc = db_exec_sql(&p_lmgr->conn, req->str, &res);
+        if (rc)
+            goto out;
+
+        nb = db_result_nb_records(&p_lmgr->conn, &res);
+        for (i = 0; i < nb; i++)
+        {
+            stripe_items_t items;
+            int s;
+
+            rc = db_next_record(&p_lmgr->conn, &res, resstr, 2);
+            if (rc == 0)
+                rc = db_record_lengths(&p_lmgr->conn, &res, lens, 2);
+            if (rc || resstr[0] == NULL)
+            {
+                rc = rc ? rc : DB_ATTR_MISSING;
+                db_result_free(&p_lmgr->conn, &res);
+                goto out;
+            }
+            rh_strncpy(last, resstr[0], sizeof(last));
+
+            if (stripe_layout_decode(resstr[1], lens[1], &items) != DB_SUCCESS)
+            {
+                DisplayLog(LVL_MAJOR, TAG, "Warning: invalid stripe layout for entry %s",
+                           resstr[0]);
+                continue;
+            }
+
+            for (s = 0; s < items.count; s++)
+            {
+                unsigned int ost = items.stripe[s].ost_idx;
+                uint64_t objid;
+
+                if (ost >= ost_count)
+                {
+                    uint64_t *tmp = realloc(max_objid,
+                                            (ost + 1) * sizeof(*tmp));
+                    if (!tmp)
+                    {
+                        free_stripe_items(&items);
+                        db_result_free(&p_lmgr->conn, &res);
+                        rc = DB_NO_MEMORY;
+                        goto out;
+                    }
+                    memset(tmp + ost_count, 0,
+                           (ost + 1 - ost_count) * sizeof(*tmp));
+                    max_objid = tmp;
+                    ost_count = ost + 1;
+                }
+                /* FIXME max on the low weight 32bits of the 'objid' 64bits value */
+                objid = (uint32_t)items.stripe[s].obj_id;
+                if (objid + 1 > max_objid[ost])
+                    max_objid[ost] = objid + 1;
+            }
+            free_stripe_items(&items);
+        }
+        db_result_free(&p_lmgr->conn, &res);
+    } while (nb == LAYOUT_CHUNK);
+
+    rc = db_exec_sql(&p_lmgr->conn, "CREATE TEMPORARY TABLE "OBJIDS_TABLE
+                     " (ostidx INT UNSIGNED PRIMARY KEY, objid INT UNSIGNED)",
+                     NULL);
+    if (rc || ost_count == 0)
+        goto out;
+
+    g_string_assign(req, "INSERT INTO "OBJIDS_TABLE" (ostidx,objid) VALUES ");
+    for (i = 0, first = true; i < ost_count; i++)
+    {
+        if (max_objid[i] == 0)
+            continue;
+        g_string_append_printf(req, "%s(%u,%"PRIu64")", first ? "" : ",", i,
+                               max_objid[i] - 1);
+        first = false;
+    }
+    rc = db_exec_sql(&p_lmgr->conn, req->str, NULL);
+
+out:
+    if (max_objid)
+        free(max_objid);
+    g_string_free(req, TRUE);
+    return rc;
+}
+
 /**
  * Main daemon routine
  */
@@ -188,9 +304,18 @@ int main( int argc, char **argv )
 
     /* direct SQL request to retrieve the max object index from DB */
     result_handle_t res;
-    /* FIXME max on the low weight 32bits of the 'objid' 64bits value */
-    rc = db_exec_sql(&lmgr.conn, "SELECT ostidx, max(hex(cast(reverse(cast(details as binary(8))) as binary(4)))) "
-                     "FROM "STRIPE_ITEMS_TABLE" GROUP BY ostidx ORDER BY ostidx", &res);
+    if (lmgr_config.compact_stripes)
+    {
+        rc = compact_max_objids(&lmgr);
+        if (rc)
+            goto db_error;
+        rc = db_exec_sql(&lmgr.conn, "SELECT ostidx, hex(objid) FROM "OBJIDS_TABLE
+                         " ORDER BY ostidx", &res);
+    }
+    else
+        /* FIXME max on the low weight 32bits of the 'objid' 64bits value */
+        rc = db_exec_sql(&lmgr.conn, "SELECT ostidx, max(hex(cast(reverse(cast(details as binary(8))) as binary(4)))) "
+                         "FROM "STRIPE_ITEMS_TABLE" GROUP BY ostidx ORDER BY ostidx", &res);
     if (rc)
         goto db_error;
 
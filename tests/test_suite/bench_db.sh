@@ -0,0 +1,115 @@
+#!/bin/bash
+
+# This benchmark compares the database backends on the same workload:
+# a synthetic namespace is created, then scanned (std pipeline) once by a
+# robinhood built with MySQL and once by a robinhood built with SQLite.
+#
+# Usage: bench_db.sh <robinhood (MySQL)> <robinhood (SQLite)> [dirs] [files]
+#
+# MySQL database: $RBH_BENCH_DB (default: robinhood_bench), accessed as
+# user 'robinhood' with password $RBH_BENCH_PASSWD (default: robinhood).
+# It is emptied before the run.
+
+RBH_MYSQL=$1
+RBH_SQLITE=$2
+NB_DIRS=${3:-100}
+NB_FILES=${4:-1000}
+
+DB=${RBH_BENCH_DB:-robinhood_bench}
+PASSWD=${RBH_BENCH_PASSWD:-robinhood}
+ROOT=${RBH_BENCH_ROOT:-/tmp/rbh_bench_db}
+SQLITE_FILE=$ROOT.sqlite
+CFG=$ROOT.conf
+
+if [[ -z $RBH_MYSQL || -z $RBH_SQLITE ]]; then
+    echo "Usage: $0 <robinhood (MySQL)> <robinhood (SQLite)> [dirs] [files]"
+    exit 1
+fi
+
+function err
+{
+    echo "ERROR: $*"
+    exit 1
+}
+
+function create_tree
+{
+    local d
+    local f
+
+    echo "Creating $NB_DIRS x $NB_FILES files in $ROOT..."
+    rm -rf $ROOT
+    mkdir -p $ROOT || err "mkdir $ROOT"
+    for d in `seq 1 $NB_DIRS`; do
+        mkdir $ROOT/dir.$d || err "mkdir $ROOT/dir.$d"
+        (cd $ROOT/dir.$d && seq -f "file.%g" 1 $NB_FILES | xargs touch) ||
+            err "creating files in $ROOT/dir.$d"
+    done
+}
+
+function write_cfg
+{
+    cat > $CFG << EOF
+General
+{
+    fs_path = "$ROOT";
+    fs_type = `stat -f -c %T $ROOT`;
+}
+
+Log
+{
+    debug_level = MAJOR;
+    log_file = stderr;
+    report_file = "/dev/null";
+    alert_file = "/dev/null";
+}
+
+ListManager
+{
+    MySQL
+    {
+        server = "localhost";
+        db = "$DB";
+        user = "robinhood";
+        password = "$PASSWD";
+        engine = InnoDB;
+    }
+
+    SQLite
+    {
+        db_file = "$SQLITE_FILE";
+    }
+}
+EOF
+}
+
+# run a scan and print the elapsed time and ingest rate
+function bench_scan
+{
+    local name=$1
+    local rbh=$2
+    local start
+    local end
+    local nb=$(( $NB_DIRS * ($NB_FILES + 1) + 1 ))
+
+    echo "== $name =="
+    start=`date +%s.%N`
+    $rbh -f $CFG --scan --once -L stderr > $ROOT.$name.log 2>&1 ||
+        err "$name scan failed (see $ROOT.$name.log)"
+    end=`date +%s.%N`
+
+    echo "$name: $nb entries in `echo "$end - $start" | bc -l | cut -c 1-6`s" \
+         "(`echo "$nb / ($end - $start)" | bc`/s)"
+}
+
+create_tree
+write_cfg
+
+mysql -u robinhood -p$PASSWD -e "DROP DATABASE IF EXISTS $DB; CREATE DATABASE $DB" ||
+    err "failed to empty MySQL database $DB"
+bench_scan mysql $RBH_MYSQL
+
+rm -f $SQLITE_FILE $SQLITE_FILE-wal $SQLITE_FILE-shm
+bench_scan sqlite $RBH_SQLITE
+
+rm -rf $ROOT $CFG
@@ -0,0 +1,146 @@
+#!/bin/bash
+
+# This benchmark compares the scan rate with and without 'use_io_uring':
+# a set of files is created in each given directory (e.g. one on tmpfs,
+# one on ext4), then scanned several times with each setting.
+#
+# Usage: bench_scan_uring.sh <robinhood> <dir> [<dir>...]
+#
+# Environment:
+#   RBH_BENCH_FILES        number of files per directory (default: 100000)
+#   RBH_BENCH_PASSES       scans with each setting (default: 3)
+#   RBH_BENCH_THREADS      nb_threads_scan (default: 1)
+#   RBH_BENCH_DROP_CACHES  if set to 1, drop the page, dentry and inode
+#                          caches before each scan (requires root)
+#
+# MySQL database: $RBH_BENCH_DB (default: robinhood_bench), accessed as
+# user 'robinhood' with password $RBH_BENCH_PASSWD (default: robinhood).
+# It is emptied before each scan.
+
+RBH=$1
+shift
+
+NB_FILES=${RBH_BENCH_FILES:-100000}
+PASSES=${RBH_BENCH_PASSES:-3}
+THREADS=${RBH_BENCH_THREADS:-1}
+DB=${RBH_BENCH_DB:-robinhood_bench}
+PASSWD=${RBH_BENCH_PASSWD:-robinhood}
+CFG=/tmp/rbh_bench_uring.conf
+LOG=/tmp/rbh_bench_uring
+
+if [[ -z $RBH || -z $1 ]]; then
+    echo "Usage: $0 <robinhood> <dir> [<dir>...]"
+    exit 1
+fi
+
+function err
+{
+    echo "ERROR: $*"
+    exit 1
+}
+
+# create_tree <root>
+function create_tree
+{
+    local root=$1
+    local d
+
+    echo "Creating $NB_FILES files in $root..."
+    rm -rf $root
+    # 100 directories
+    for d in `seq -w 0 99`; do
+        mkdir -p $root/dir.$d || err "mkdir $root/dir.$d"
+        (cd $root/dir.$d &&
+         seq -f "file.%g" 1 $(( $NB_FILES / 100 )) | xargs touch) ||
+            err "creating files in $root/dir.$d"
+    done
+}
+
+# write_cfg <root> <fs type> <use_io_uring>
+function write_cfg
+{
+    cat > $CFG << EOF
+General
+{
+    fs_path = "$1";
+    fs_type = $2;
+    check_mounted = no;
+}
+
+Log
+{
+    debug_level = MAJOR;
+    log_file = stderr;
+    report_file = "/dev/null";
+    alert_file = "/dev/null";
+}
+
+FS_Scan
+{
+    nb_threads_scan = $THREADS;
+    use_io_uring = $3;
+}
+
+ListManager
+{
+    MySQL
+    {
+        server = "localhost";
+        db = "$DB";
+        user = "robinhood";
+        password = "$PASSWD";
+        engine = InnoDB;
+    }
+}
+EOF
+}
+
+function empty_db
+{
+    mysql -u robinhood -p$PASSWD \
+        -e "DROP DATABASE IF EXISTS $DB; CREATE DATABASE $DB" ||
+        err "failed to empty MySQL database $DB"
+}
+
+# run a scan and print the elapsed time
+# timed_scan <name>
+function timed_scan
+{
+    local name=$1
+    local start
+    local end
+
+    if [[ $RBH_BENCH_DROP_CACHES == 1 ]]; then
+        sync
+        echo 3 > /proc/sys/vm/drop_caches || err "failed to drop caches"
+    fi
+
+    start=`date +%s.%N`
+    $RBH -f $CFG --scan --once -L stderr > $LOG.$name.log 2>&1 ||
+        err "$name failed (see $LOG.$name.log)"
+    end=`date +%s.%N`
+    echo "$end - $start" | bc -l | cut -c 1-6
+}
+
+for dir in "$@"; do
+    root=$dir/rbh_bench_uring
+    fstype=`findmnt -n -o FSTYPE -T $dir` || err "no filesystem for $dir"
+
+    create_tree $root
+    nb=$(( `find $root | wc -l` ))
+
+    for mode in no yes; do
+        echo "== $dir ($fstype): use_io_uring = $mode =="
+        write_cfg $root $fstype $mode
+        for pass in `seq 1 $PASSES`; do
+            empty_db
+            t=`timed_scan ${fstype}_${mode}_$pass`
+            echo "    pass $pass: $nb entries in ${t}s" \
+                 "(`echo "$nb / $t" | bc`/s)"
+        done
+    done
+
+    rm -rf $root
+done
+
+rm -f $CFG
@@ -0,0 +1,171 @@
+#!/bin/bash
+
+# This benchmark compares the storage of stripe information with and
+# without 'compact_stripes': a set of widely striped and PFL files is
+# created on a Lustre filesystem, then scanned once with each encoding.
+# It reports the ingest rate, row counts and size of the stripe tables,
+# then the duration of the conversion of a DB by 'robinhood --alter-db'.
+#
+# Usage: bench_stripes.sh <robinhood> <lustre dir> [files]
+#
+# MySQL database: $RBH_BENCH_DB (default: robinhood_bench), accessed as
+# user 'robinhood' with password $RBH_BENCH_PASSWD (default: robinhood).
+# It is emptied before each run.
+
+RBH=$1
+LDIR=$2
+NB_FILES=${3:-10000}
+
+DB=${RBH_BENCH_DB:-robinhood_bench}
+PASSWD=${RBH_BENCH_PASSWD:-robinhood}
+ROOT=$LDIR/rbh_bench_stripes
+CFG=/tmp/rbh_bench_stripes.conf
+LOG=/tmp/rbh_bench_stripes
+
+if [[ -z $RBH || -z $LDIR ]]; then
+    echo "Usage: $0 <robinhood> <lustre dir> [files]"
+    exit 1
+fi
+
+function err
+{
+    echo "ERROR: $*"
+    exit 1
+}
+
+function sql
+{
+    mysql -u robinhood -p$PASSWD -N -B $DB -e "$*"
+}
+
+function create_tree
+{
+    local half=$(( $NB_FILES / 2 ))
+
+    echo "Creating $NB_FILES files in $ROOT..."
+    rm -rf $ROOT
+    mkdir -p $ROOT/wide $ROOT/pfl || err "mkdir $ROOT"
+
+    # stripe over all OSTs
+    lfs setstripe -c -1 $ROOT/wide || err "lfs setstripe $ROOT/wide"
+    (cd $ROOT/wide && seq -f "file.%g" 1 $half | xargs touch) ||
+        err "creating files in $ROOT/wide"
+
+    # 2 components: instantiate the second one by writing after 1MB
+    lfs setstripe -E 1M -c 1 -E -1 -c -1 $ROOT/pfl ||
+        err "lfs setstripe $ROOT/pfl"
+    for f in `seq -f "file.%g" 1 $half`; do
+        dd if=/dev/zero of=$ROOT/pfl/$f bs=1 count=1 seek=2M 2>/dev/null ||
+            err "writing $ROOT/pfl/$f"
+    done
+}
+
+# write_cfg <compact_stripes>
+function write_cfg
+{
+    cat > $CFG << EOF
+General
+{
+    fs_path = "$LDIR";
+    fs_type = lustre;
+}
+
+Log
+{
+    debug_level = MAJOR;
+    log_file = stderr;
+    report_file = "/dev/null";
+    alert_file = "/dev/null";
+}
+
+ListManager
+{
+    compact_stripes = $1;
+
+    MySQL
+    {
+        server = "localhost";
+        db = "$DB";
+        user = "robinhood";
+        password = "$PASSWD";
+        engine = InnoDB;
+    }
+}
+EOF
+}
+
+function empty_db
+{
+    mysql -u robinhood -p$PASSWD \
+        -e "DROP DATABASE IF EXISTS $DB; CREATE DATABASE $DB" ||
+        err "failed to empty MySQL database $DB"
+}
+
+# run robinhood and print the elapsed time
+# timed_run <name> <options...>
+function timed_run
+{
+    local name=$1
+    local start
+    local end
+    shift
+
+    start=`date +%s.%N`
+    $RBH -f $CFG "$@" -L stderr > $LOG.$name.log 2>&1 ||
+        err "$name failed (see $LOG.$name.log)"
+    end=`date +%s.%N`
+    echo "$end - $start" | bc -l | cut -c 1-6
+}
+
+function table_stats
+{
+    local t
+
+    for t in STRIPE_INFO STRIPE_ITEMS; do
+        echo "    $t: `sql "SELECT COUNT(*) FROM $t"` rows," \
+             "`sql "SELECT ROUND((data_length+index_length)/1024) FROM \
+                    information_schema.TABLES WHERE table_schema='$DB' \
+                    AND table_name='$t'"` KB"
+    done
+    echo "    database: `sql "SELECT ROUND(SUM(data_length+index_length)/1024) \
+                             FROM information_schema.TABLES \
+                             WHERE table_schema='$DB'"` KB"
+}
+
+# files on OST 0, to check the conversion
+function ost0_files
+{
+    sql "SELECT COUNT(DISTINCT id) FROM STRIPE_ITEMS WHERE ostidx=0"
+}
+
+create_tree
+nb=$(( `find $ROOT | wc -l` ))
+
+for mode in no yes; do
+    echo "== compact_stripes = $mode =="
+    write_cfg $mode
+    empty_db
+    t=`timed_run scan_$mode --scan --once`
+    echo "    scan: $nb entries in ${t}s (`echo "$nb / $t" | bc`/s)"
+    table_stats
+done
+
+echo "== conversion =="
+write_cfg no
+empty_db
+timed_run scan_rows --scan --once > /dev/null
+before=`ost0_files`
+t=`timed_run rescan --scan --once`
+echo "    rescan (no conversion): ${t}s"
+
+write_cfg yes
+t=`timed_run to_compact --alter-db --scan --once`
+echo "    rescan + conversion to compact layouts: ${t}s"
+[[ `ost0_files` == $before ]] || err "files on OST 0 changed after conversion"
+
+write_cfg no
+t=`timed_run to_rows --alter-db --scan --once`
+echo "    rescan + conversion to stripe items: ${t}s"
+[[ `ost0_files` == $before ]] || err "files on OST 0 changed after conversion"
+
+rm -rf $ROOT $CFG